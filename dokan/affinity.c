@@ -0,0 +1,138 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+
+static VOID AddAffinityGroup(PDOKAN_INSTANCE DokanInstance,
+                             PGROUP_AFFINITY Mask, USHORT Node) {
+  ULONG group = DokanInstance->AffinityGroupCount++;
+
+  DokanInstance->AffinityMasks[group] = *Mask;
+  DokanInstance->AffinityNodes[group] = Node;
+}
+
+static VOID AddProcessors(PDOKAN_INSTANCE DokanInstance, ULONG MaxGroups) {
+  WORD groupCount = GetActiveProcessorGroupCount();
+  PROCESSOR_NUMBER processor;
+  GROUP_AFFINITY mask;
+  USHORT node;
+  WORD group;
+  DWORD number;
+  DWORD processorCount;
+
+  for (group = 0; group < groupCount; ++group) {
+    processorCount = GetActiveProcessorCount(group);
+    for (number = 0; number < processorCount; ++number) {
+      if (DokanInstance->AffinityGroupCount == MaxGroups)
+        return;
+      ZeroMemory(&processor, sizeof(PROCESSOR_NUMBER));
+      processor.Group = group;
+      processor.Number = (BYTE)number;
+      if (!GetNumaProcessorNodeEx(&processor, &node))
+        node = 0;
+      ZeroMemory(&mask, sizeof(GROUP_AFFINITY));
+      mask.Group = group;
+      mask.Mask = (KAFFINITY)1 << number;
+      AddAffinityGroup(DokanInstance, &mask, node);
+    }
+  }
+}
+
+static VOID AddNumaNodes(PDOKAN_INSTANCE DokanInstance, ULONG MaxGroups) {
+  ULONG highestNode;
+  ULONG node;
+  GROUP_AFFINITY mask;
+
+  if (!GetNumaHighestNodeNumber(&highestNode)) {
+    DbgPrint("Dokan Error: GetNumaHighestNodeNumber failed %d\n",
+             GetLastError());
+    return;
+  }
+  for (node = 0; node <= highestNode; ++node) {
+    if (DokanInstance->AffinityGroupCount == MaxGroups)
+      return;
+    // Nodes without processors only have memory
+    if (!GetNumaNodeProcessorMaskEx((USHORT)node, &mask) || mask.Mask == 0)
+      continue;
+    AddAffinityGroup(DokanInstance, &mask, (USHORT)node);
+  }
+}
+
+VOID DokanAffinityInit(PDOKAN_INSTANCE DokanInstance) {
+  ULONG options = DokanInstance->DokanOptions->Options;
+  ULONG maxGroups = DOKAN_MAX_AFFINITY_GROUPS;
+
+  DokanInstance->AffinityGroupCount = 0;
+  DokanInstance->AffinityNextThread = 0;
+  // A group without any thread would never pick up the requests of its files
+  if ((ULONG)DokanInstance->MinThreadCount < maxGroups)
+    maxGroups = DokanInstance->MinThreadCount;
+
+  if (options & DOKAN_OPTION_CPU_AFFINITY) {
+    AddProcessors(DokanInstance, maxGroups);
+  } else if (options & DOKAN_OPTION_NUMA_AFFINITY) {
+    AddNumaNodes(DokanInstance, maxGroups);
+  } else {
+    return;
+  }
+  DbgPrint("Dokan: threads spread over %lu %s\n",
+           DokanInstance->AffinityGroupCount,
+           (options & DOKAN_OPTION_CPU_AFFINITY) ? "processors" : "NUMA nodes");
+}
+
+// Binds the calling DokanLoop thread to the next group. Returns FALSE when
+// the thread keeps running anywhere.
+BOOL DokanAffinityBindThread(PDOKAN_INSTANCE DokanInstance,
+                             PEVENT_WAIT_AFFINITY Affinity, PUSHORT Node) {
+  ULONG group;
+
+  if (DokanInstance->AffinityGroupCount == 0)
+    return FALSE;
+
+  group = (ULONG)(InterlockedIncrement(&DokanInstance->AffinityNextThread) -
+                  1) %
+          DokanInstance->AffinityGroupCount;
+  if (!SetThreadGroupAffinity(GetCurrentThread(),
+                              &DokanInstance->AffinityMasks[group], NULL)) {
+    DbgPrint("Dokan Error: SetThreadGroupAffinity failed %d\n",
+             GetLastError());
+    return FALSE;
+  }
+
+  Affinity->Group = group;
+  Affinity->GroupCount = DokanInstance->AffinityGroupCount;
+  *Node = DokanInstance->AffinityNodes[group];
+  return TRUE;
+}
+
+// Event buffer of a DokanLoop thread, on the node of the thread when it is
+// bound to one. The memory is zeroed.
+PVOID DokanAffinityAllocBuffer(BOOL Bound, USHORT Node, SIZE_T Size) {
+  if (Bound) {
+    return VirtualAllocExNuma(GetCurrentProcess(), NULL, Size,
+                              MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, Node);
+  }
+  return VirtualAlloc(NULL, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+VOID DokanAffinityFreeBuffer(PVOID Buffer) {
+  VirtualFree(Buffer, 0, MEM_RELEASE);
+}
@@ -0,0 +1,203 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+
+// Request the callback running on the current DokanLoop thread may pend
+static DOKAN_THREAD_LOCAL PDOKAN_REQUEST g_PendableRequest;
+static DOKAN_THREAD_LOCAL PDOKAN_FILE_INFO g_PendableFileInfo;
+// Copy returned by DokanPendRequest during the current callback
+static DOKAN_THREAD_LOCAL PDOKAN_REQUEST g_PendedRequest;
+
+VOID DokanBeginPendableRequest(PDOKAN_REQUEST Request,
+                               PDOKAN_FILE_INFO DokanFileInfo) {
+  g_PendableRequest = Request;
+  g_PendableFileInfo = DokanFileInfo;
+  g_PendedRequest = NULL;
+}
+
+// Returns the pended copy of the request, which the caller no longer owns
+PDOKAN_REQUEST DokanEndPendableRequest() {
+  PDOKAN_REQUEST pended = g_PendedRequest;
+
+  g_PendableRequest = NULL;
+  g_PendableFileInfo = NULL;
+  g_PendedRequest = NULL;
+  return pended;
+}
+
+// Fills the reply of a read or write from the result of the operation
+VOID DokanFinishRequest(PDOKAN_REQUEST Request, NTSTATUS Status, ULONG Bytes) {
+  PEVENT_INFORMATION eventInfo = Request->EventInfo;
+  BOOL read = Request->MajorFunction == IRP_MJ_READ;
+  int64_t currentByteOffset = 0;
+
+  eventInfo->Status = DokanRequestReply(read, Request->Length,
+                                        Request->ByteOffset, Status, &Bytes,
+                                        &currentByteOffset);
+  eventInfo->BufferLength = Bytes;
+  if (eventInfo->Status != STATUS_SUCCESS)
+    return;
+  if (read)
+    eventInfo->Operation.Read.CurrentByteOffset.QuadPart = currentByteOffset;
+  else
+    eventInfo->Operation.Write.CurrentByteOffset.QuadPart = currentByteOffset;
+}
+
+PDOKAN_REQUEST DOKANAPI DokanPendRequest(PDOKAN_FILE_INFO DokanFileInfo) {
+  PDOKAN_REQUEST request;
+
+  if (g_PendableRequest == NULL || g_PendableFileInfo != DokanFileInfo ||
+      g_PendedRequest != NULL) {
+    DbgPrint("Dokan Error: DokanPendRequest called outside of ReadFile or "
+             "WriteFile\n");
+    return NULL;
+  }
+
+  request = (PDOKAN_REQUEST)malloc(sizeof(DOKAN_REQUEST));
+  if (request == NULL) {
+    return NULL;
+  }
+  *request = *g_PendableRequest;
+  request->Context = DokanFileInfo->Context;
+  DokanPendingRequestAdd(request->DokanInstance->PendingRequests,
+                         &request->Pending);
+  g_PendedRequest = request;
+  return request;
+}
+
+static BOOL SendAsyncEventInformation(PDOKAN_INSTANCE DokanInstance,
+                                      PEVENT_INFORMATION EventInfo,
+                                      ULONG EventLength) {
+  ReleaseDokanOpenInfo(EventInfo, DokanInstance);
+  return DokanSendAsyncIoctl(DokanInstance, IOCTL_EVENT_INFO, EventInfo,
+                             EventLength);
+}
+
+static VOID FreeRequest(PDOKAN_REQUEST Request) {
+  free(Request->EventInfo);
+  free(Request);
+}
+
+BOOL DOKANAPI DokanCompleteRequest(PDOKAN_REQUEST Request, NTSTATUS Status,
+                                   ULONG Bytes) {
+  PDOKAN_INSTANCE instance;
+  BOOL status;
+
+  if (Request == NULL) {
+    return FALSE;
+  }
+
+  // The unmount already failed the request and may have deleted its instance
+  if (!DokanPendingRequestClaim(&Request->Pending)) {
+    DbgPrint("Dokan Error: request completed after the unmount failed it\n");
+    if (DokanPendingRequestRelease(&Request->Pending))
+      FreeRequest(Request);
+    return FALSE;
+  }
+  instance = Request->DokanInstance;
+
+  if (Status == STATUS_PENDING) {
+    DbgPrint("Dokan Error: request completed with STATUS_PENDING\n");
+    Status = STATUS_INTERNAL_ERROR;
+  }
+  // The handle is held until the reply is sent
+  if (Request->OpenInfo != NULL)
+    Request->OpenInfo->UserContext = Request->Context;
+  if (Request->MajorFunction == IRP_MJ_WRITE)
+    DokanCacheEndChange(instance, Request->CacheChange);
+  DokanFinishRequest(Request, Status, Bytes);
+  status = SendAsyncEventInformation(instance, Request->EventInfo,
+                                     Request->EventLength);
+
+  DokanPendingRequestRemove(instance->PendingRequests, &Request->Pending);
+  FreeRequest(Request);
+  return status;
+}
+
+BOOL DOKANAPI DokanResetRequestTimeout(PDOKAN_REQUEST Request,
+                                       ULONG Timeout) {
+  PDOKAN_INSTANCE instance;
+  EVENT_INFORMATION eventInfo;
+  BOOL status;
+
+  if (Request == NULL || !DokanPendingRequestUse(&Request->Pending)) {
+    return FALSE;
+  }
+  instance = Request->DokanInstance;
+
+  if (Timeout > DOKAN_RESET_TIMEOUT_MAX) {
+    Timeout = DOKAN_RESET_TIMEOUT_MAX;
+  }
+  RtlZeroMemory(&eventInfo, sizeof(EVENT_INFORMATION));
+  eventInfo.SerialNumber = Request->EventInfo->SerialNumber;
+  eventInfo.Operation.ResetTimeout.Timeout = Timeout;
+  status = DokanSendAsyncIoctl(instance, IOCTL_RESET_TIMEOUT, &eventInfo,
+                               sizeof(EVENT_INFORMATION));
+
+  DokanPendingRequestEndUse(instance->PendingRequests, &Request->Pending);
+  return status;
+}
+
+// Fails a request the unmount stopped waiting for. The callback may still
+// use the read buffer, the request is freed by the last of this and its
+// completion.
+static void AbandonRequest(void *Context, PDOKAN_PENDING_REQUEST Pending) {
+  PDOKAN_INSTANCE instance = (PDOKAN_INSTANCE)Context;
+  PDOKAN_REQUEST request = (PDOKAN_REQUEST)Pending;
+  PEVENT_INFORMATION eventInfo;
+
+  if (request->MajorFunction == IRP_MJ_WRITE)
+    DokanCacheEndChange(instance, request->CacheChange);
+  // The buffer of the reply stays untouched for the callback
+  eventInfo = (PEVENT_INFORMATION)malloc(sizeof(EVENT_INFORMATION));
+  if (eventInfo != NULL) {
+    *eventInfo = *request->EventInfo;
+    eventInfo->Status = STATUS_CANCELLED;
+    eventInfo->BufferLength = 0;
+    SendAsyncEventInformation(instance, eventInfo, sizeof(EVENT_INFORMATION));
+    free(eventInfo);
+  } else {
+    ReleaseDokanOpenInfo(request->EventInfo, instance);
+  }
+  if (DokanPendingRequestRelease(Pending))
+    FreeRequest(request);
+}
+
+// The instance cannot be deleted while a completion may still use it. The
+// requests that are not completed in time are failed.
+VOID DokanWaitPendingRequests(PDOKAN_INSTANCE DokanInstance) {
+  uint32_t abandoned;
+
+  abandoned = DokanPendingRequestsWait(DokanInstance->PendingRequests,
+                                       DOKAN_PENDING_REQUEST_UNMOUNT_TIMEOUT,
+                                       AbandonRequest, DokanInstance);
+  if (abandoned != 0) {
+    DbgPrint("Dokan Error: %u pended requests were not completed before the "
+             "unmount\n",
+             abandoned);
+  }
+}
+
+VOID DokanAsyncCleanup(PDOKAN_INSTANCE DokanInstance) {
+  DokanAsyncDeviceCleanup(DokanInstance);
+  DokanPendingRequestsDelete(DokanInstance->PendingRequests);
+}
@@ -0,0 +1,606 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "blockcache.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK DOKAN_BLOCK_CACHE_LOCK;
+typedef CONDITION_VARIABLE DOKAN_BLOCK_CACHE_CONDITION;
+
+#define BlockCacheInitialize(Cache)                                            \
+  (InitializeSRWLock(&(Cache)->Lock),                                          \
+   InitializeConditionVariable(&(Cache)->Loaded), 1)
+#define BlockCacheUninitialize(Cache)
+#define BlockCacheLock(Cache) AcquireSRWLockExclusive(&(Cache)->Lock)
+#define BlockCacheUnlock(Cache) ReleaseSRWLockExclusive(&(Cache)->Lock)
+#define BlockCacheWait(Cache)                                                  \
+  SleepConditionVariableSRW(&(Cache)->Loaded, &(Cache)->Lock, INFINITE, 0)
+#define BlockCacheWakeAll(Cache) WakeAllConditionVariable(&(Cache)->Loaded)
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t DOKAN_BLOCK_CACHE_LOCK;
+typedef pthread_cond_t DOKAN_BLOCK_CACHE_CONDITION;
+
+#define BlockCacheInitialize(Cache)                                            \
+  (pthread_mutex_init(&(Cache)->Lock, NULL) == 0 &&                            \
+   (pthread_cond_init(&(Cache)->Loaded, NULL) == 0 ||                          \
+    (pthread_mutex_destroy(&(Cache)->Lock), 0)))
+#define BlockCacheUninitialize(Cache)                                          \
+  (pthread_cond_destroy(&(Cache)->Loaded),                                     \
+   pthread_mutex_destroy(&(Cache)->Lock))
+#define BlockCacheLock(Cache) pthread_mutex_lock(&(Cache)->Lock)
+#define BlockCacheUnlock(Cache) pthread_mutex_unlock(&(Cache)->Lock)
+#define BlockCacheWait(Cache)                                                  \
+  pthread_cond_wait(&(Cache)->Loaded, &(Cache)->Lock)
+#define BlockCacheWakeAll(Cache) pthread_cond_broadcast(&(Cache)->Loaded)
+#endif
+
+typedef struct _DOKAN_BLOCK_CACHE_BLOCK DOKAN_BLOCK_CACHE_BLOCK,
+    *PDOKAN_BLOCK_CACHE_BLOCK;
+
+struct _DOKAN_BLOCK_CACHE_BLOCK {
+  PDOKAN_BLOCK_CACHE_BLOCK HashNext;
+  // Least recently used order, only for loaded blocks
+  PDOKAN_BLOCK_CACHE_BLOCK Newer;
+  PDOKAN_BLOCK_CACHE_BLOCK Older;
+  // Loaded blocks of the same file
+  PDOKAN_BLOCK_CACHE_BLOCK FileNext;
+  PDOKAN_BLOCK_CACHE_BLOCK FilePrevious;
+  PDOKAN_BLOCK_CACHE_FILE File;
+  uint64_t Index;
+  uint32_t Length;
+  // Placeholder of a fetch in progress, other readers wait for it
+  int Loading;
+  uint8_t *Data;
+};
+
+struct _DOKAN_BLOCK_CACHE_FILE {
+  PDOKAN_BLOCK_CACHE_FILE HashNext;
+  uint32_t Hash;
+  uint32_t KeyLength;
+  // Changed by every begin and end of a change
+  uint64_t Generation;
+  // Changes in progress
+  uint32_t Changes;
+  // Reads and changes in progress
+  uint32_t References;
+  PDOKAN_BLOCK_CACHE_BLOCK Blocks;
+  uint8_t Key[1];
+};
+
+struct _DOKAN_BLOCK_CACHE {
+  DOKAN_BLOCK_CACHE_LOCK Lock;
+  DOKAN_BLOCK_CACHE_CONDITION Loaded;
+  uint32_t BlockSize;
+  // Blocks allocated, loaded or loading, at most MaximumBlocks
+  uint64_t AllocatedBlocks;
+  uint64_t MaximumBlocks;
+  // Same size for both tables, a power of 2
+  uint32_t HashMask;
+  PDOKAN_BLOCK_CACHE_FILE *Files;
+  PDOKAN_BLOCK_CACHE_BLOCK *Blocks;
+  PDOKAN_BLOCK_CACHE_BLOCK Newest;
+  PDOKAN_BLOCK_CACHE_BLOCK Oldest;
+  // Changes that could not allocate their file, nothing is kept meanwhile
+  DOKAN_BLOCK_CACHE_FILE Untracked;
+  DOKAN_BLOCK_CACHE_COUNTERS Counters;
+};
+
+static uint32_t BlockCacheHashKey(const void *Key, uint32_t KeyLength) {
+  const uint8_t *bytes = (const uint8_t *)Key;
+  uint32_t hash = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < KeyLength; ++i) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t BlockCacheHashBlock(PDOKAN_BLOCK_CACHE_FILE File,
+                                    uint64_t Index) {
+  uint64_t hash = (File->Hash + Index) * 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(hash >> 32);
+}
+
+static PDOKAN_BLOCK_CACHE_FILE BlockCacheFindFile(PDOKAN_BLOCK_CACHE Cache,
+                                                  const void *Key,
+                                                  uint32_t KeyLength,
+                                                  uint32_t Hash) {
+  PDOKAN_BLOCK_CACHE_FILE file = Cache->Files[Hash & Cache->HashMask];
+
+  for (; file != NULL; file = file->HashNext) {
+    if (file->Hash == Hash && file->KeyLength == KeyLength &&
+        memcmp(file->Key, Key, KeyLength) == 0) {
+      return file;
+    }
+  }
+  return NULL;
+}
+
+// Returns the file of Key with a reference, creating it if needed
+static PDOKAN_BLOCK_CACHE_FILE BlockCacheReferenceFile(PDOKAN_BLOCK_CACHE Cache,
+                                                       const void *Key,
+                                                       uint32_t KeyLength) {
+  uint32_t hash = BlockCacheHashKey(Key, KeyLength);
+  PDOKAN_BLOCK_CACHE_FILE file =
+      BlockCacheFindFile(Cache, Key, KeyLength, hash);
+
+  if (file == NULL) {
+    file = (PDOKAN_BLOCK_CACHE_FILE)malloc(
+        sizeof(DOKAN_BLOCK_CACHE_FILE) + KeyLength);
+    if (file == NULL) {
+      return NULL;
+    }
+    memset(file, 0, sizeof(DOKAN_BLOCK_CACHE_FILE));
+    memcpy(file->Key, Key, KeyLength);
+    file->KeyLength = KeyLength;
+    file->Hash = hash;
+    file->HashNext = Cache->Files[hash & Cache->HashMask];
+    Cache->Files[hash & Cache->HashMask] = file;
+  }
+  file->References++;
+  return file;
+}
+
+// Frees the file once nothing refers to it anymore
+static void BlockCacheReleaseFile(PDOKAN_BLOCK_CACHE Cache,
+                                  PDOKAN_BLOCK_CACHE_FILE File,
+                                  int Referenced) {
+  PDOKAN_BLOCK_CACHE_FILE *link;
+
+  if (Referenced) {
+    File->References--;
+  }
+  if (File->References != 0 || File->Blocks != NULL) {
+    return;
+  }
+  for (link = &Cache->Files[File->Hash & Cache->HashMask]; *link != File;
+       link = &(*link)->HashNext)
+    ;
+  *link = File->HashNext;
+  free(File);
+}
+
+static PDOKAN_BLOCK_CACHE_BLOCK BlockCacheFindBlock(
+    PDOKAN_BLOCK_CACHE Cache, PDOKAN_BLOCK_CACHE_FILE File, uint64_t Index) {
+  PDOKAN_BLOCK_CACHE_BLOCK block =
+      Cache->Blocks[BlockCacheHashBlock(File, Index) & Cache->HashMask];
+
+  for (; block != NULL; block = block->HashNext) {
+    if (block->File == File && block->Index == Index) {
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static void BlockCacheUnlinkHash(PDOKAN_BLOCK_CACHE Cache,
+                                 PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  PDOKAN_BLOCK_CACHE_BLOCK *link =
+      &Cache->Blocks[BlockCacheHashBlock(Block->File, Block->Index) &
+                     Cache->HashMask];
+
+  for (; *link != Block; link = &(*link)->HashNext)
+    ;
+  *link = Block->HashNext;
+}
+
+// Makes a loaded block the most recently used one
+static void BlockCacheLinkNewest(PDOKAN_BLOCK_CACHE Cache,
+                                 PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  Block->Newer = NULL;
+  Block->Older = Cache->Newest;
+  if (Cache->Newest != NULL) {
+    Cache->Newest->Newer = Block;
+  } else {
+    Cache->Oldest = Block;
+  }
+  Cache->Newest = Block;
+}
+
+static void BlockCacheUnlinkUsage(PDOKAN_BLOCK_CACHE Cache,
+                                  PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  if (Block->Newer != NULL) {
+    Block->Newer->Older = Block->Older;
+  } else {
+    Cache->Newest = Block->Older;
+  }
+  if (Block->Older != NULL) {
+    Block->Older->Newer = Block->Newer;
+  } else {
+    Cache->Oldest = Block->Newer;
+  }
+}
+
+static void BlockCacheUnlinkFile(PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  if (Block->FilePrevious != NULL) {
+    Block->FilePrevious->FileNext = Block->FileNext;
+  } else {
+    Block->File->Blocks = Block->FileNext;
+  }
+  if (Block->FileNext != NULL) {
+    Block->FileNext->FilePrevious = Block->FilePrevious;
+  }
+}
+
+static void BlockCacheFreeBlock(PDOKAN_BLOCK_CACHE Cache,
+                                PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  Cache->AllocatedBlocks--;
+  free(Block->Data);
+  free(Block);
+}
+
+// Removes a loaded block from the cache, its file is left to the caller
+static void BlockCacheRemoveBlock(PDOKAN_BLOCK_CACHE Cache,
+                                  PDOKAN_BLOCK_CACHE_BLOCK Block) {
+  BlockCacheUnlinkHash(Cache, Block);
+  BlockCacheUnlinkUsage(Cache, Block);
+  BlockCacheUnlinkFile(Block);
+  Cache->Counters.Blocks--;
+}
+
+// Drops the loaded blocks of File overlapping the range and the short ones
+static void BlockCacheDropRange(PDOKAN_BLOCK_CACHE Cache,
+                                PDOKAN_BLOCK_CACHE_FILE File, uint64_t Offset,
+                                uint64_t Length) {
+  PDOKAN_BLOCK_CACHE_BLOCK block = File->Blocks;
+  PDOKAN_BLOCK_CACHE_BLOCK next;
+  uint64_t end = Length > UINT64_MAX - Offset ? UINT64_MAX : Offset + Length;
+  uint64_t blockOffset;
+
+  for (; block != NULL; block = next) {
+    next = block->FileNext;
+    blockOffset = block->Index * Cache->BlockSize;
+    if (block->Length == Cache->BlockSize && Length == 0) {
+      continue;
+    }
+    if (block->Length == Cache->BlockSize &&
+        (blockOffset >= end || blockOffset + Cache->BlockSize <= Offset)) {
+      continue;
+    }
+    BlockCacheRemoveBlock(Cache, block);
+    BlockCacheFreeBlock(Cache, block);
+    Cache->Counters.Invalidations++;
+  }
+}
+
+// Returns a placeholder for a block about to be fetched, allocating it or
+// evicting the least recently used block, or NULL if neither is possible
+static PDOKAN_BLOCK_CACHE_BLOCK BlockCacheAcquireBlock(
+    PDOKAN_BLOCK_CACHE Cache) {
+  PDOKAN_BLOCK_CACHE_BLOCK block = NULL;
+  PDOKAN_BLOCK_CACHE_FILE file;
+
+  if (Cache->AllocatedBlocks < Cache->MaximumBlocks) {
+    block = (PDOKAN_BLOCK_CACHE_BLOCK)malloc(sizeof(DOKAN_BLOCK_CACHE_BLOCK));
+    if (block != NULL) {
+      block->Data = (uint8_t *)malloc(Cache->BlockSize);
+      if (block->Data == NULL) {
+        free(block);
+        block = NULL;
+      } else {
+        Cache->AllocatedBlocks++;
+      }
+    }
+  }
+  if (block == NULL && Cache->Oldest != NULL) {
+    block = Cache->Oldest;
+    file = block->File;
+    BlockCacheRemoveBlock(Cache, block);
+    BlockCacheReleaseFile(Cache, file, 0);
+    Cache->Counters.Evictions++;
+  }
+  if (block != NULL) {
+    memset(block, 0, offsetof(DOKAN_BLOCK_CACHE_BLOCK, Data));
+  }
+  return block;
+}
+
+PDOKAN_BLOCK_CACHE DokanBlockCacheCreate(uint32_t BlockSize,
+                                         uint64_t Capacity) {
+  PDOKAN_BLOCK_CACHE cache;
+  uint64_t buckets = 64;
+
+  if (BlockSize == 0) {
+    return NULL;
+  }
+  cache = (PDOKAN_BLOCK_CACHE)calloc(1, sizeof(DOKAN_BLOCK_CACHE));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->BlockSize = BlockSize;
+  cache->MaximumBlocks = Capacity / BlockSize ? Capacity / BlockSize : 1;
+  while (buckets < cache->MaximumBlocks && buckets < 0x80000000u) {
+    buckets <<= 1;
+  }
+  cache->HashMask = (uint32_t)buckets - 1;
+  cache->Files = (PDOKAN_BLOCK_CACHE_FILE *)calloc(
+      (size_t)buckets, sizeof(PDOKAN_BLOCK_CACHE_FILE));
+  cache->Blocks = (PDOKAN_BLOCK_CACHE_BLOCK *)calloc(
+      (size_t)buckets, sizeof(PDOKAN_BLOCK_CACHE_BLOCK));
+  if (cache->Files == NULL || cache->Blocks == NULL ||
+      !BlockCacheInitialize(cache)) {
+    free(cache->Files);
+    free(cache->Blocks);
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void DokanBlockCacheDelete(PDOKAN_BLOCK_CACHE Cache) {
+  PDOKAN_BLOCK_CACHE_BLOCK block;
+  PDOKAN_BLOCK_CACHE_FILE file;
+  PDOKAN_BLOCK_CACHE_FILE next;
+  uint32_t i;
+
+  if (Cache == NULL) {
+    return;
+  }
+  while ((block = Cache->Oldest) != NULL) {
+    BlockCacheRemoveBlock(Cache, block);
+    BlockCacheFreeBlock(Cache, block);
+  }
+  for (i = 0; i <= Cache->HashMask; ++i) {
+    for (file = Cache->Files[i]; file != NULL; file = next) {
+      next = file->HashNext;
+      free(file);
+    }
+  }
+  BlockCacheUninitialize(Cache);
+  free(Cache->Files);
+  free(Cache->Blocks);
+  free(Cache);
+}
+
+int32_t DokanBlockCacheRead(PDOKAN_BLOCK_CACHE Cache, const void *Key,
+                            uint32_t KeyLength, uint64_t Offset, void *Buffer,
+                            uint32_t Length, uint32_t *Read,
+                            DOKAN_BLOCK_CACHE_FETCH Fetch, void *Context) {
+  PDOKAN_BLOCK_CACHE_FILE file;
+  PDOKAN_BLOCK_CACHE_BLOCK block;
+  uint8_t *buffer = (uint8_t *)Buffer;
+  uint32_t copied = 0;
+  uint32_t fetched;
+  uint32_t inBlock;
+  uint32_t chunk;
+  uint64_t position;
+  uint64_t generation;
+  uint64_t untrackedGeneration;
+  int32_t status = 0;
+  int waited;
+
+  *Read = 0;
+  BlockCacheLock(Cache);
+  file = BlockCacheReferenceFile(Cache, Key, KeyLength);
+  if (file == NULL) {
+    BlockCacheUnlock(Cache);
+    return Fetch(Context, Offset, Buffer, Length, Read);
+  }
+
+  while (copied < Length) {
+    position = Offset + copied;
+    inBlock = (uint32_t)(position % Cache->BlockSize);
+    chunk = Cache->BlockSize - inBlock;
+    if (chunk > Length - copied) {
+      chunk = Length - copied;
+    }
+
+    waited = 0;
+    while ((block = BlockCacheFindBlock(Cache, file,
+                                        position / Cache->BlockSize)) != NULL &&
+           block->Loading) {
+      if (!waited) {
+        Cache->Counters.CoalescedMisses++;
+        waited = 1;
+      }
+      BlockCacheWait(Cache);
+    }
+
+    if (block != NULL) {
+      Cache->Counters.Hits++;
+      BlockCacheUnlinkUsage(Cache, block);
+      BlockCacheLinkNewest(Cache, block);
+      if (inBlock >= block->Length) {
+        break;
+      }
+      if (chunk > block->Length - inBlock) {
+        chunk = block->Length - inBlock;
+      }
+      memcpy(buffer + copied, block->Data + inBlock, chunk);
+      copied += chunk;
+      Cache->Counters.BytesSaved += chunk;
+      if (block->Length < Cache->BlockSize) {
+        break;
+      }
+      continue;
+    }
+
+    Cache->Counters.Misses++;
+    block = BlockCacheAcquireBlock(Cache);
+    if (block == NULL) {
+      // Every block is being loaded, read around the cache
+      BlockCacheUnlock(Cache);
+      fetched = 0;
+      status = Fetch(Context, position, buffer + copied, chunk, &fetched);
+      BlockCacheLock(Cache);
+      if (status != 0 || fetched > chunk) {
+        break;
+      }
+      Cache->Counters.BytesFetched += fetched;
+      copied += fetched;
+      if (fetched < chunk) {
+        break;
+      }
+      continue;
+    }
+
+    block->File = file;
+    block->Index = position / Cache->BlockSize;
+    block->Loading = 1;
+    block->HashNext = Cache->Blocks[BlockCacheHashBlock(file, block->Index) &
+                                    Cache->HashMask];
+    Cache->Blocks[BlockCacheHashBlock(file, block->Index) & Cache->HashMask] =
+        block;
+    generation = file->Generation;
+    untrackedGeneration = Cache->Untracked.Generation;
+
+    BlockCacheUnlock(Cache);
+    fetched = 0;
+    status = Fetch(Context, block->Index * Cache->BlockSize, block->Data,
+                   Cache->BlockSize, &fetched);
+    BlockCacheLock(Cache);
+
+    BlockCacheUnlinkHash(Cache, block);
+    BlockCacheWakeAll(Cache);
+    if (status != 0 || fetched > Cache->BlockSize) {
+      BlockCacheFreeBlock(Cache, block);
+      break;
+    }
+    Cache->Counters.BytesFetched += fetched;
+    block->Length = fetched;
+    block->Loading = 0;
+
+    if (inBlock < fetched) {
+      if (chunk > fetched - inBlock) {
+        chunk = fetched - inBlock;
+      }
+      memcpy(buffer + copied, block->Data + inBlock, chunk);
+      copied += chunk;
+    }
+
+    if (generation == file->Generation && file->Changes == 0 &&
+        untrackedGeneration == Cache->Untracked.Generation &&
+        Cache->Untracked.Changes == 0) {
+      block->HashNext = Cache->Blocks[BlockCacheHashBlock(file, block->Index) &
+                                      Cache->HashMask];
+      Cache->Blocks[BlockCacheHashBlock(file, block->Index) &
+                    Cache->HashMask] = block;
+      BlockCacheLinkNewest(Cache, block);
+      block->FileNext = file->Blocks;
+      if (file->Blocks != NULL) {
+        file->Blocks->FilePrevious = block;
+      }
+      file->Blocks = block;
+      Cache->Counters.Blocks++;
+    } else {
+      // The file changed during the fetch, the data only serves this read
+      fetched = block->Length;
+      BlockCacheFreeBlock(Cache, block);
+    }
+
+    if (fetched < Cache->BlockSize) {
+      break;
+    }
+  }
+
+  BlockCacheReleaseFile(Cache, file, 1);
+  BlockCacheUnlock(Cache);
+
+  *Read = copied;
+  if (copied != 0) {
+    return 0;
+  }
+  return status;
+}
+
+PDOKAN_BLOCK_CACHE_FILE DokanBlockCacheBeginChange(PDOKAN_BLOCK_CACHE Cache,
+                                                   const void *Key,
+                                                   uint32_t KeyLength,
+                                                   uint64_t Offset,
+                                                   uint64_t Length) {
+  PDOKAN_BLOCK_CACHE_FILE file;
+  PDOKAN_BLOCK_CACHE_BLOCK block;
+
+  BlockCacheLock(Cache);
+  file = Key != NULL ? BlockCacheReferenceFile(Cache, Key, KeyLength) : NULL;
+  if (file == NULL) {
+    while ((block = Cache->Oldest) != NULL) {
+      file = block->File;
+      BlockCacheRemoveBlock(Cache, block);
+      BlockCacheFreeBlock(Cache, block);
+      BlockCacheReleaseFile(Cache, file, 0);
+      Cache->Counters.Invalidations++;
+    }
+    Cache->Untracked.Generation++;
+    Cache->Untracked.Changes++;
+    BlockCacheUnlock(Cache);
+    return &Cache->Untracked;
+  }
+  file->Changes++;
+  file->Generation++;
+  BlockCacheDropRange(Cache, file, Offset, Length);
+  BlockCacheUnlock(Cache);
+  return file;
+}
+
+void DokanBlockCacheEndChange(PDOKAN_BLOCK_CACHE Cache,
+                              PDOKAN_BLOCK_CACHE_FILE File) {
+  if (File == NULL) {
+    return;
+  }
+  BlockCacheLock(Cache);
+  // Fetches that started before the end may have seen the old content
+  File->Generation++;
+  File->Changes--;
+  if (File != &Cache->Untracked) {
+    BlockCacheReleaseFile(Cache, File, 1);
+  }
+  BlockCacheUnlock(Cache);
+}
+
+void DokanBlockCacheInvalidate(PDOKAN_BLOCK_CACHE Cache, const void *Prefix,
+                               uint32_t PrefixLength) {
+  PDOKAN_BLOCK_CACHE_FILE file;
+  PDOKAN_BLOCK_CACHE_FILE next;
+  uint32_t i;
+
+  BlockCacheLock(Cache);
+  for (i = 0; i <= Cache->HashMask; ++i) {
+    for (file = Cache->Files[i]; file != NULL; file = next) {
+      next = file->HashNext;
+      if (file->KeyLength < PrefixLength ||
+          memcmp(file->Key, Prefix, PrefixLength) != 0) {
+        continue;
+      }
+      file->Generation++;
+      BlockCacheDropRange(Cache, file, 0, DOKAN_BLOCK_CACHE_WHOLE_FILE);
+      BlockCacheReleaseFile(Cache, file, 0);
+    }
+  }
+  BlockCacheUnlock(Cache);
+}
+
+void DokanBlockCacheGetCounters(PDOKAN_BLOCK_CACHE Cache,
+                                PDOKAN_BLOCK_CACHE_COUNTERS Counters) {
+  BlockCacheLock(Cache);
+  *Counters = Cache->Counters;
+  BlockCacheUnlock(Cache);
+}
@@ -0,0 +1,123 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_BLOCKCACHE_H_
+#define DOKAN_BLOCKCACHE_H_
+
+// Block cache of file contents in front of the ReadFile callback.
+//
+// Files are identified by an opaque key, the upper cased file name for the
+// library. Their content is kept in aligned blocks of a fixed size, evicted in
+// least recently used order once the capacity of the cache is reached. A block
+// shorter than the block size ends the file. Only one fetch of a block runs
+// at a time, the other readers of the block wait for it.
+//
+// Changes of a file are bracketed by DokanBlockCacheBeginChange, which drops
+// the blocks of the changed range and the last block of the file, and
+// DokanBlockCacheEndChange. Blocks fetched while a change is in progress or
+// across one are not kept.
+//
+// This file and blockcache.c only depend on the C runtime and on either
+// Windows or pthreads, samples/blockcache_test checks them on any platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _DOKAN_BLOCK_CACHE DOKAN_BLOCK_CACHE, *PDOKAN_BLOCK_CACHE;
+typedef struct _DOKAN_BLOCK_CACHE_FILE DOKAN_BLOCK_CACHE_FILE,
+    *PDOKAN_BLOCK_CACHE_FILE;
+
+// Counters of a cache since it was created
+typedef struct _DOKAN_BLOCK_CACHE_COUNTERS {
+  // Blocks found in the cache
+  uint64_t Hits;
+  // Blocks fetched from the file system
+  uint64_t Misses;
+  // Misses that waited for the fetch of another reader instead of fetching
+  uint64_t CoalescedMisses;
+  // Bytes of reads answered from the cache
+  uint64_t BytesSaved;
+  // Bytes fetched from the file system
+  uint64_t BytesFetched;
+  // Blocks dropped to make room
+  uint64_t Evictions;
+  // Blocks dropped because their file changed
+  uint64_t Invalidations;
+  // Blocks in the cache
+  uint64_t Blocks;
+} DOKAN_BLOCK_CACHE_COUNTERS, *PDOKAN_BLOCK_CACHE_COUNTERS;
+
+// Reads up to Length bytes of the file at Offset into Buffer and stores the
+// number of bytes read in Read. Returns 0 on success and a status otherwise.
+typedef int32_t (*DOKAN_BLOCK_CACHE_FETCH)(void *Context, uint64_t Offset,
+                                           void *Buffer, uint32_t Length,
+                                           uint32_t *Read);
+
+// Range of DokanBlockCacheBeginChange that covers the whole file
+#define DOKAN_BLOCK_CACHE_WHOLE_FILE UINT64_MAX
+
+// Returns NULL if BlockSize is 0 or there is not enough memory. At least one
+// block is kept whatever the Capacity.
+PDOKAN_BLOCK_CACHE DokanBlockCacheCreate(uint32_t BlockSize,
+                                         uint64_t Capacity);
+
+// No read or change may be in progress.
+void DokanBlockCacheDelete(PDOKAN_BLOCK_CACHE Cache);
+
+// Reads Length bytes of the file at Offset through the cache, calling Fetch
+// with Context for the blocks it does not have. Read is short at the end of
+// the file. If a fetch fails after some bytes were read, those bytes are
+// returned with success, otherwise its status is returned.
+int32_t DokanBlockCacheRead(PDOKAN_BLOCK_CACHE Cache, const void *Key,
+                            uint32_t KeyLength, uint64_t Offset, void *Buffer,
+                            uint32_t Length, uint32_t *Read,
+                            DOKAN_BLOCK_CACHE_FETCH Fetch, void *Context);
+
+// To be called before the file is changed in the range starting at Offset.
+// Returns the file to give to DokanBlockCacheEndChange once it is done. If
+// Key is NULL or there is not enough memory to track the file, every cached
+// block is dropped and nothing is kept until the change ends.
+PDOKAN_BLOCK_CACHE_FILE DokanBlockCacheBeginChange(PDOKAN_BLOCK_CACHE Cache,
+                                                   const void *Key,
+                                                   uint32_t KeyLength,
+                                                   uint64_t Offset,
+                                                   uint64_t Length);
+
+// Ends a change started by DokanBlockCacheBeginChange, File can be NULL.
+void DokanBlockCacheEndChange(PDOKAN_BLOCK_CACHE Cache,
+                              PDOKAN_BLOCK_CACHE_FILE File);
+
+// Drops every file whose key starts with Prefix, for renames and deletes of
+// files and of the directories above them.
+void DokanBlockCacheInvalidate(PDOKAN_BLOCK_CACHE Cache, const void *Prefix,
+                               uint32_t PrefixLength);
+
+void DokanBlockCacheGetCounters(PDOKAN_BLOCK_CACHE Cache,
+                                PDOKAN_BLOCK_CACHE_COUNTERS Counters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_BLOCKCACHE_H_
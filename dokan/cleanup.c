@@ -26,21 +26,43 @@ VOID DispatchCleanup(HANDLE Handle, PEVENT_CONTEXT EventContext,
   PEVENT_INFORMATION eventInfo;
   DOKAN_FILE_INFO fileInfo;
   PDOKAN_OPEN_INFO openInfo;
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
   ULONG sizeOfEventInfo = sizeof(EVENT_INFORMATION);
-
-  CheckFileName(EventContext->Operation.Cleanup.FileName);
+  PDOKAN_BLOCK_CACHE_FILE cacheChange = NULL;
+  NTSTATUS status;
 
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.Cleanup.FileName,
+                                   EventContext->Operation.Cleanup.FileNameLength,
+                                   &name);
 
   eventInfo->Status = STATUS_SUCCESS; // return success at any case
 
   DbgPrint("###Cleanup %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
+  // File systems often close their handle in Cleanup, the gathered writes
+  // have to reach it before
+  status = DokanFlushGatheredWrites(DokanInstance, openInfo, fileName,
+                                    &fileInfo);
+  if (status != STATUS_SUCCESS)
+    DbgPrint("Dokan Error: writes gathered for %ls lost 0x%x\n", fileName,
+             status);
+
   if (DokanInstance->DokanOperations->Cleanup) {
+    // Files are deleted here, drop their blocks
+    if (fileInfo.DeleteOnClose)
+      cacheChange = DokanCacheBeginChange(DokanInstance, fileName, 0,
+                                          DOKAN_BLOCK_CACHE_WHOLE_FILE);
     // ignore return value
-    DokanInstance->DokanOperations->Cleanup(
-        EventContext->Operation.Cleanup.FileName, &fileInfo);
+    DokanStatisticsCallbackBegin();
+    DokanInstance->DokanOperations->Cleanup(fileName, &fileInfo);
+    DokanStatisticsCallbackEnd();
+    DokanCacheEndChange(DokanInstance, cacheChange);
+    if (fileInfo.DeleteOnClose)
+      DokanSecurityCacheChanged(DokanInstance, fileName, fileInfo.IsDirectory);
   }
 
   if (openInfo != NULL)
@@ -48,5 +70,6 @@ VOID DispatchCleanup(HANDLE Handle, PEVENT_CONTEXT EventContext,
 
   SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
 
+  DokanReleaseFileName(name);
   free(eventInfo);
 }
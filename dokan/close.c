@@ -26,33 +26,40 @@ VOID DispatchClose(HANDLE Handle, PEVENT_CONTEXT EventContext,
   PEVENT_INFORMATION eventInfo;
   DOKAN_FILE_INFO fileInfo;
   PDOKAN_OPEN_INFO openInfo;
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
   ULONG sizeOfEventInfo = sizeof(EVENT_INFORMATION);
 
   UNREFERENCED_PARAMETER(Handle);
 
-  CheckFileName(EventContext->Operation.Close.FileName);
-
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.Close.FileName,
+                                   EventContext->Operation.Close.FileNameLength,
+                                   &name);
 
   eventInfo->Status = STATUS_SUCCESS; // return success at any case
 
   DbgPrint("###Close %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
+  DokanCloseGatheredWrites(DokanInstance, openInfo, fileName, &fileInfo);
+
   if (DokanInstance->DokanOperations->CloseFile) {
     // ignore return value
-    DokanInstance->DokanOperations->CloseFile(
-        EventContext->Operation.Close.FileName, &fileInfo);
+    DokanStatisticsCallbackBegin();
+    DokanInstance->DokanOperations->CloseFile(fileName, &fileInfo);
+    DokanStatisticsCallbackEnd();
   }
 
   // do not send it to the driver
   // SendEventInformation(Handle, eventInfo, length);
 
+  // Release the reference of the open file, the one of this request frees it
   if (openInfo != NULL) {
-    EnterCriticalSection(&DokanInstance->CriticalSection);
-    openInfo->OpenCount--;
-    LeaveCriticalSection(&DokanInstance->CriticalSection);
+    DokanReleaseOpenInfoReference(DokanInstance, openInfo);
   }
   ReleaseDokanOpenInfo(eventInfo, DokanInstance);
+  DokanReleaseFileName(name);
   free(eventInfo);
 }
@@ -86,6 +86,25 @@ VOID SetIOSecurityContext(PEVENT_CONTEXT EventContext,
       EventContext->Operation.Create.SecurityContext.DesiredAccess;
 }
 
+// Cuts the last component of FileName in place to leave the name of its
+// parent directory, the root for files of the root
+static VOID DokanCutParentName(WCHAR *FileName) {
+  WCHAR *lastP = NULL;
+  WCHAR *p;
+
+  for (p = FileName; *p; p++) {
+    if ((*p == L'\\' || *p == L'/') && p[1])
+      lastP = p;
+  }
+  if (lastP) {
+    *lastP = 0;
+  }
+  if (!FileName[0]) {
+    FileName[0] = L'\\';
+    FileName[1] = 0;
+  }
+}
+
 BOOL CreateSuccesStatusCheck(NTSTATUS status, ULONG disposition) {
   if (NT_SUCCESS(status))
     return TRUE;
@@ -115,8 +134,13 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
   DOKAN_IO_SECURITY_CONTEXT ioSecurityContext;
   WCHAR *fileName;
   BOOL childExisted = TRUE;
-  WCHAR *origFileName = NULL;
+  BOOL openTargetDirectory = FALSE;
   DWORD origOptions;
+  BY_HANDLE_FILE_INFORMATION byHandleFileInfo;
+  BOOL attributesFound = FALSE;
+  PEVENT_INFORMATION reply;
+  ULONG replyLength;
+  PDOKAN_BLOCK_CACHE_FILE cacheChange = NULL;
 
   fileName = (WCHAR *)((char *)&EventContext->Operation.Create +
                        EventContext->Operation.Create.FileNameOffset);
@@ -134,20 +158,20 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
 
   // DOKAN_OPEN_INFO is structure for a opened file
   // this will be freed by Close
-  openInfo = malloc(sizeof(DOKAN_OPEN_INFO));
+  // One reference for the open file and one for this request
+  openInfo = DokanAllocateOpenInfo(DokanInstance, 2);
   if (openInfo == NULL) {
     eventInfo.Status = STATUS_INSUFFICIENT_RESOURCES;
     SendEventInformation(Handle, &eventInfo, sizeof(EVENT_INFORMATION), NULL);
     return;
   }
-  ZeroMemory(openInfo, sizeof(DOKAN_OPEN_INFO));
-  openInfo->OpenCount = 2;
   openInfo->EventContext = EventContext;
-  openInfo->DokanInstance = DokanInstance;
   fileInfo.DokanContext = (ULONG64)openInfo;
+  // Later events of the handle can omit the name, keep it for them
+  DokanSetOpenInfoFileName(openInfo, fileName, EventContext->NameGeneration);
 
-  // pass it to driver and when the same handle is used get it back
-  eventInfo.Context = (ULONG64)openInfo;
+  // pass its handle to driver and when the same handle is used get it back
+  eventInfo.Context = openInfo->Handle;
 
   // The high 8 bits of this parameter correspond to the Disposition parameter
   disposition =
@@ -173,30 +197,13 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
     // it look like it was
     // a regular request to open a directory.
     // https://msdn.microsoft.com/en-us/library/windows/hardware/ff548630(v=vs.85).aspx
-
-    origFileName = _wcsdup(fileName);
+    // The name is cut in place once the child has been looked up with it.
+    openTargetDirectory = TRUE;
 
     options |= FILE_DIRECTORY_FILE;
     options &= ~FILE_NON_DIRECTORY_FILE;
 
     DbgPrint("SL_OPEN_TARGET_DIRECTORY specified\n");
-
-    // strip the last section of the file path
-    WCHAR *lastP = NULL;
-
-    for (WCHAR *p = fileName; *p; p++) {
-      if ((*p == L'\\' || *p == L'/') && p[1])
-        lastP = p;
-    }
-
-    if (lastP) {
-      *lastP = 0;
-    }
-
-    if (!fileName[0]) {
-      fileName[0] = '\\';
-      fileName[1] = 0;
-    }
   }
 
   DbgPrint("###Create %04d\n", eventId);
@@ -213,16 +220,23 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
 
       if (options & FILE_NON_DIRECTORY_FILE && options & FILE_DIRECTORY_FILE)
         status = STATUS_INVALID_PARAMETER;
-      else
+      else {
+        DokanStatisticsCallbackBegin();
         status = DokanInstance->DokanOperations->ZwCreateFile(
-            origFileName, &ioSecurityContext, ioSecurityContext.DesiredAccess,
+            fileName, &ioSecurityContext, ioSecurityContext.DesiredAccess,
             EventContext->Operation.Create.FileAttributes,
             EventContext->Operation.Create.ShareAccess, disposition,
             origOptions, &fileInfo);
+        DokanStatisticsCallbackEnd();
+      }
 
       if (CreateSuccesStatusCheck(status, disposition)) {
-        DokanInstance->DokanOperations->Cleanup(origFileName, &fileInfo);
-        DokanInstance->DokanOperations->CloseFile(origFileName, &fileInfo);
+        DokanStatisticsCallbackBegin();
+        DokanInstance->DokanOperations->Cleanup(fileName, &fileInfo);
+        DokanStatisticsCallbackEnd();
+        DokanStatisticsCallbackBegin();
+        DokanInstance->DokanOperations->CloseFile(fileName, &fileInfo);
+        DokanStatisticsCallbackEnd();
       } else if (status == STATUS_OBJECT_NAME_NOT_FOUND) {
         DbgPrint("SL_OPEN_TARGET_DIRECTORY file not found\n");
         childExisted = FALSE;
@@ -231,14 +245,28 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
       fileInfo.IsDirectory = TRUE;
     }
 
+    if (openTargetDirectory)
+      DokanCutParentName(fileName);
+
     if (options & FILE_NON_DIRECTORY_FILE && options & FILE_DIRECTORY_FILE)
       status = STATUS_INVALID_PARAMETER;
-    else
+    else {
+      // Overwritten and new files lose the blocks cached for their name
+      if (disposition != FILE_OPEN && disposition != FILE_OPEN_IF)
+        cacheChange = DokanCacheBeginChange(DokanInstance, fileName, 0,
+                                            DOKAN_BLOCK_CACHE_WHOLE_FILE);
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->ZwCreateFile(
           fileName, &ioSecurityContext, ioSecurityContext.DesiredAccess,
           EventContext->Operation.Create.FileAttributes,
           EventContext->Operation.Create.ShareAccess, disposition, options,
           &fileInfo);
+      DokanStatisticsCallbackEnd();
+      DokanCacheEndChange(DokanInstance, cacheChange);
+      // The new file gets the descriptor of the request or of its parent
+      if (disposition != FILE_OPEN && disposition != FILE_OPEN_IF)
+        DokanSecurityCacheChanged(DokanInstance, fileName, FALSE);
+    }
 
     if (CreateSuccesStatusCheck(status, disposition)
       && !childExisted) {
@@ -248,6 +276,20 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
     status = STATUS_NOT_IMPLEMENTED;
   }
 
+  // The attributes of the opened file save the driver asking for them
+  if ((DokanInstance->DokanOptions->Options &
+       DOKAN_OPTION_CACHE_FILE_ATTRIBUTES) &&
+      !(EventContext->Flags & SL_OPEN_TARGET_DIRECTORY) &&
+      DokanInstance->DokanOperations->GetFileInformation &&
+      CreateSuccesStatusCheck(status, disposition)) {
+    ZeroMemory(&byHandleFileInfo, sizeof(BY_HANDLE_FILE_INFORMATION));
+    DokanStatisticsCallbackBegin();
+    attributesFound = DokanInstance->DokanOperations->GetFileInformation(
+                          fileName, &byHandleFileInfo, &fileInfo) ==
+                      STATUS_SUCCESS;
+    DokanStatisticsCallbackEnd();
+  }
+
   // save the information about this access in DOKAN_OPEN_INFO
   openInfo->IsDirectory = fileInfo.IsDirectory;
   openInfo->UserContext = fileInfo.Context;
@@ -276,17 +318,9 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
         (EventContext->Operation.Create.SecurityContext.DesiredAccess &
          DELETE)) {
       DbgPrint("Delete failed, ask parent folder if we have the right\n");
-      // strip the last section of the file path
-      WCHAR *lastP = NULL;
-      for (WCHAR *p = fileName; *p; p++) {
-        if ((*p == L'\\' || *p == L'/') && p[1])
-          lastP = p;
-      }
-      if (lastP) {
-        *lastP = 0;
-      }
+      DokanCutParentName(fileName);
 
-      SetIOSecurityContext(EventContext, &ioSecurityContext);
+      // ioSecurityContext was filled for the first ZwCreateFile
       ACCESS_MASK newDesiredAccess =
           (MAXIMUM_ALLOWED & ioSecurityContext.DesiredAccess)
               ? (FILE_DELETE_CHILD | FILE_LIST_DIRECTORY)
@@ -299,11 +333,13 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
       options |= FILE_OPEN_FOR_BACKUP_INTENT; //Enable open directory
       options &= ~FILE_NON_DIRECTORY_FILE;    //Remove non dir flag
 
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->ZwCreateFile(
           fileName, &ioSecurityContext, newDesiredAccess,
           EventContext->Operation.Create.FileAttributes,
           EventContext->Operation.Create.ShareAccess, disposition, options,
           &fileInfo);
+      DokanStatisticsCallbackEnd();
 
       if (status == STATUS_SUCCESS) {
         DbgPrint("Parent give us the right to delete\n");
@@ -341,14 +377,25 @@ VOID DispatchCreate(HANDLE Handle, // This handle is not for a file. It is for
       eventInfo.Operation.Create.Flags |= DOKAN_FILE_DIRECTORY;
   }
 
-  if (origFileName)
-    free(origFileName);
-
   if (!NT_SUCCESS(eventInfo.Status)) {
-    free((PDOKAN_OPEN_INFO)(UINT_PTR)eventInfo.Context);
+    DokanFreeOpenInfo(DokanInstance, openInfo);
     eventInfo.Context = 0;
   }
 
+  if (attributesFound && NT_SUCCESS(eventInfo.Status)) {
+    replyLength = DOKAN_REPLY_WITH_ATTRIBUTES_LENGTH(0);
+    reply = (PEVENT_INFORMATION)malloc(replyLength);
+    if (reply != NULL) {
+      ZeroMemory(reply, replyLength);
+      CopyMemory(reply, &eventInfo, sizeof(EVENT_INFORMATION));
+      DokanAttachFileAttributes(reply, replyLength, &byHandleFileInfo,
+                                DokanInstance);
+      SendEventInformation(Handle, reply, replyLength, DokanInstance);
+      free(reply);
+      return;
+    }
+  }
+
   SendEventInformation(Handle, &eventInfo, sizeof(EVENT_INFORMATION),
                        DokanInstance);
 }
@@ -0,0 +1,184 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Requests of the library to the driver on the dispatch path: the replies of
+// DokanLoop threads, the events they wait for, and the replies sent from any
+// thread by DokanCompleteRequest.
+//
+// The dispatch functions only reach the driver through this file.
+// samples/fake_device links them against a recording fake of it instead, so
+// that they run without a driver on any platform.
+
+#include "dokani.h"
+
+BOOL DokanDeviceIoControl(HANDLE Device, DWORD IoControlCode,
+                          PVOID InputBuffer, ULONG InputLength,
+                          PVOID OutputBuffer, ULONG OutputLength,
+                          PULONG ReturnedLength) {
+  return DeviceIoControl(Device, IoControlCode, InputBuffer, InputLength,
+                         OutputBuffer, OutputLength, ReturnedLength,
+                         NULL // synchronous call
+                         );
+}
+
+BOOL SendToDevice(LPCWSTR DeviceName, DWORD IoControlCode, PVOID InputBuffer,
+                  ULONG InputLength, PVOID OutputBuffer, ULONG OutputLength,
+                  PULONG ReturnedLength) {
+  HANDLE device;
+  BOOL status;
+
+  device = CreateFile(DeviceName,                         // lpFileName
+                      GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
+                      FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
+                      NULL,          // lpSecurityAttributes
+                      OPEN_EXISTING, // dwCreationDistribution
+                      0,             // dwFlagsAndAttributes
+                      NULL           // hTemplateFile
+                      );
+
+  if (device == INVALID_HANDLE_VALUE) {
+    DWORD dwErrorCode = GetLastError();
+    DbgPrintW(L"Dokan Error: Failed to open %s with code %d\n", DeviceName,
+             dwErrorCode);
+    return FALSE;
+  }
+
+  status = DokanDeviceIoControl(device,         // Handle to device
+                                IoControlCode,  // IO Control code
+                                InputBuffer,    // Input Buffer to driver.
+                                InputLength,    // Length of input buffer.
+                                OutputBuffer,   // Output Buffer from driver.
+                                OutputLength,   // Length of output buffer.
+                                ReturnedLength  // Bytes placed in buffer.
+                                );
+
+  CloseHandle(device);
+
+  if (!status) {
+    DbgPrint("DokanError: Ioctl failed with code %d\n", GetLastError());
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+// Completions come from threads that do not own a device handle, they share
+// one overlapped handle per instance so replies are not serialized on it
+static HANDLE GetAsyncDevice(PDOKAN_INSTANCE DokanInstance) {
+  WCHAR rawDeviceName[MAX_PATH];
+  HANDLE device = DokanInstance->AsyncDevice;
+  HANDLE previous;
+
+  if (device != NULL)
+    return device;
+
+  GetRawDeviceName(DokanInstance->DeviceName, rawDeviceName, MAX_PATH);
+  device = CreateFile(rawDeviceName, GENERIC_READ | GENERIC_WRITE,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                      FILE_FLAG_OVERLAPPED, NULL);
+  if (device == INVALID_HANDLE_VALUE) {
+    DbgPrintW(L"Dokan Error: CreateFile failed %s: %d\n", rawDeviceName,
+              GetLastError());
+    return NULL;
+  }
+
+  previous = InterlockedCompareExchangePointer(
+      (PVOID volatile *)&DokanInstance->AsyncDevice, device, NULL);
+  if (previous != NULL) {
+    CloseHandle(device);
+    return previous;
+  }
+  return device;
+}
+
+// Event of an ioctl sent on the async device, pooled since every completion
+// needs one
+typedef struct _DOKAN_ASYNC_EVENT {
+  SLIST_ENTRY Entry;
+  HANDLE Event;
+} DOKAN_ASYNC_EVENT, *PDOKAN_ASYNC_EVENT;
+
+static PDOKAN_ASYNC_EVENT PopAsyncEvent(PDOKAN_INSTANCE DokanInstance) {
+  PSLIST_ENTRY entry;
+  PDOKAN_ASYNC_EVENT asyncEvent;
+
+  entry = InterlockedPopEntrySList(&DokanInstance->AsyncEvents);
+  if (entry != NULL)
+    return CONTAINING_RECORD(entry, DOKAN_ASYNC_EVENT, Entry);
+
+  asyncEvent = (PDOKAN_ASYNC_EVENT)_aligned_malloc(
+      sizeof(DOKAN_ASYNC_EVENT), MEMORY_ALLOCATION_ALIGNMENT);
+  if (asyncEvent == NULL)
+    return NULL;
+  asyncEvent->Event = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (asyncEvent->Event == NULL) {
+    DbgPrint("Dokan Error: CreateEvent failed %d\n", GetLastError());
+    _aligned_free(asyncEvent);
+    return NULL;
+  }
+  return asyncEvent;
+}
+
+BOOL DokanSendAsyncIoctl(PDOKAN_INSTANCE DokanInstance, DWORD IoControlCode,
+                         PVOID InputBuffer, ULONG InputLength) {
+  HANDLE device;
+  PDOKAN_ASYNC_EVENT asyncEvent;
+  OVERLAPPED overlapped;
+  ULONG returnedLength;
+  BOOL status;
+
+  device = GetAsyncDevice(DokanInstance);
+  if (device == NULL)
+    return FALSE;
+  asyncEvent = PopAsyncEvent(DokanInstance);
+  if (asyncEvent == NULL)
+    return FALSE;
+
+  // The driver completes these ioctls before returning, the event is only
+  // waited on if that ever changes
+  ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+  overlapped.hEvent = asyncEvent->Event;
+  status = DeviceIoControl(device, IoControlCode, InputBuffer, InputLength,
+                           NULL, 0, &returnedLength, &overlapped);
+  if (!status && GetLastError() == ERROR_IO_PENDING) {
+    status = GetOverlappedResult(device, &overlapped, &returnedLength, TRUE);
+  }
+  if (!status) {
+    DbgPrint("Dokan Error: Ioctl failed with code %d\n", GetLastError());
+  }
+  // DeviceIoControl resets the event before it is used again
+  InterlockedPushEntrySList(&DokanInstance->AsyncEvents, &asyncEvent->Entry);
+  return status;
+}
+
+VOID DokanAsyncDeviceCleanup(PDOKAN_INSTANCE DokanInstance) {
+  PSLIST_ENTRY entry;
+  PDOKAN_ASYNC_EVENT asyncEvent;
+
+  while ((entry = InterlockedPopEntrySList(&DokanInstance->AsyncEvents)) !=
+         NULL) {
+    asyncEvent = CONTAINING_RECORD(entry, DOKAN_ASYNC_EVENT, Entry);
+    CloseHandle(asyncEvent->Event);
+    _aligned_free(asyncEvent);
+  }
+  if (DokanInstance->AsyncDevice != NULL)
+    CloseHandle(DokanInstance->AsyncDevice);
+}
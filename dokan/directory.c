@@ -451,6 +451,12 @@ LONG MatchFiles(PEVENT_CONTEXT EventContext, PEVENT_INFORMATION EventInfo,
   EventInfo->BufferLength =
       EventContext->Operation.Directory.BufferLength - lengthRemaining;
 
+  // The driver answers the next query of the handle itself
+  if (thisEntry == listHead &&
+      index > EventContext->Operation.Directory.FileIndex) {
+    EventInfo->Flags |= DOKAN_EVENT_INFO_NO_MORE_ENTRIES;
+  }
+
   if (index <= EventContext->Operation.Directory.FileIndex) {
 
     if (thisEntry != listHead)
@@ -558,17 +564,12 @@ VOID DispatchDirectoryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
   // this buffer length is fixed in MatchFiles function
   eventInfo->BufferLength = EventContext->Operation.Directory.BufferLength;
 
-  if (openInfo->DirListHead == NULL) {
-    openInfo->DirListHead = malloc(sizeof(LIST_ENTRY));
-    if (openInfo->DirListHead != NULL) {
-      InitializeListHead(openInfo->DirListHead);
-    } else {
-      eventInfo->BufferLength = 0;
-      eventInfo->Status = STATUS_NO_MEMORY;
-      SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-      free(eventInfo);
-      return;
-    }
+  if (DokanGetOpenInfoList(&openInfo->DirListHead) == NULL) {
+    eventInfo->BufferLength = 0;
+    eventInfo->Status = STATUS_NO_MEMORY;
+    SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
+    free(eventInfo);
+    return;
   }
 
   if (EventContext->Operation.Directory.FileIndex == 0) {
@@ -592,9 +593,11 @@ VOID DispatchDirectoryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
 
       patternCheck = FALSE; // do not recheck pattern later in MatchFiles
 
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->FindFilesWithPattern(
           EventContext->Operation.Directory.DirectoryName, pattern,
           DokanFillFileData, &fileInfo);
+      DokanStatisticsCallbackEnd();
 
     } else {
       status = STATUS_NOT_IMPLEMENTED;
@@ -606,9 +609,11 @@ VOID DispatchDirectoryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
       patternCheck = TRUE; // do pattern check later in MachFiles
 
       // call FileSystem specifeid callback routine
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->FindFiles(
           EventContext->Operation.Directory.DirectoryName, DokanFillFileData,
           &fileInfo);
+      DokanStatisticsCallbackEnd();
     }
   }
 
@@ -0,0 +1,187 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Dispatch of the events of the driver to the Dispatch* functions, and the
+// helpers they share.
+
+#include "dokani.h"
+
+VOID
+GetRawDeviceName(LPCWSTR DeviceName, LPWSTR DestinationBuffer,
+                 rsize_t DestinationBufferSizeInElements) {
+  if (DeviceName && DestinationBuffer && DestinationBufferSizeInElements > 0) {
+    wcscpy_s(DestinationBuffer, DestinationBufferSizeInElements, L"\\\\.");
+    wcscat_s(DestinationBuffer, DestinationBufferSizeInElements, DeviceName);
+  }
+}
+
+void ALIGN_ALLOCATION_SIZE(PLARGE_INTEGER size, PDOKAN_OPTIONS DokanOptions) {
+  long long r = size->QuadPart % DokanOptions->AllocationUnitSize;
+  size->QuadPart =
+      (size->QuadPart + (r > 0 ? DokanOptions->AllocationUnitSize - r : 0));
+}
+
+VOID SendEventInformation(HANDLE Handle, PEVENT_INFORMATION EventInfo,
+                          ULONG EventLength, PDOKAN_INSTANCE DokanInstance) {
+  BOOL status;
+  ULONG returnedLength;
+
+  // DbgPrint("###EventInfo->Context %X\n", EventInfo->Context);
+  DokanStatisticsReply(EventInfo, EventLength);
+  if (DokanInstance != NULL) {
+    ReleaseDokanOpenInfo(EventInfo, DokanInstance);
+  }
+
+  // send event info to driver
+  status = DokanDeviceIoControl(Handle,           // Handle to device
+                                IOCTL_EVENT_INFO, // IO Control code
+                                EventInfo,        // Input Buffer to driver.
+                                EventLength,      // Length of input buffer.
+                                NULL,             // Output Buffer from driver.
+                                0,                // Length of output buffer.
+                                &returnedLength   // Bytes placed in buffer.
+                                );
+
+  if (!status) {
+    DWORD errorCode = GetLastError();
+    DbgPrint("Dokan Error: Ioctl failed with code %d\n", errorCode);
+  }
+}
+
+VOID CheckFileName(LPWSTR FileName) {
+  size_t len = wcslen(FileName);
+  // if the beginning of file name is "\\",
+  // replace it with "\"
+  if (len >= 2 && FileName[0] == L'\\' && FileName[1] == L'\\') {
+    int i;
+    for (i = 0; FileName[i + 1] != L'\0'; ++i) {
+      FileName[i] = FileName[i + 1];
+    }
+    FileName[i] = L'\0';
+  }
+
+  // Remove "\" in front of Directory
+  len = wcslen(FileName);
+  if (len > 2 && FileName[len - 1] == L'\\')
+    FileName[len - 1] = '\0';
+}
+
+PEVENT_INFORMATION
+DispatchCommon(PEVENT_CONTEXT EventContext, ULONG SizeOfEventInfo,
+               PDOKAN_INSTANCE DokanInstance, PDOKAN_FILE_INFO DokanFileInfo,
+               PDOKAN_OPEN_INFO *DokanOpenInfo) {
+  PEVENT_INFORMATION eventInfo = (PEVENT_INFORMATION)malloc(SizeOfEventInfo);
+
+  if (eventInfo == NULL) {
+    return NULL;
+  }
+  RtlZeroMemory(eventInfo, SizeOfEventInfo);
+  RtlZeroMemory(DokanFileInfo, sizeof(DOKAN_FILE_INFO));
+
+  eventInfo->BufferLength = 0;
+  eventInfo->SerialNumber = EventContext->SerialNumber;
+
+  DokanFileInfo->ProcessId = EventContext->ProcessId;
+  DokanFileInfo->DokanOptions = DokanInstance->DokanOptions;
+  if (EventContext->FileFlags & DOKAN_DELETE_ON_CLOSE) {
+    DokanFileInfo->DeleteOnClose = 1;
+  }
+  if (EventContext->FileFlags & DOKAN_PAGING_IO) {
+    DokanFileInfo->PagingIo = 1;
+  }
+  if (EventContext->FileFlags & DOKAN_WRITE_TO_END_OF_FILE) {
+    DokanFileInfo->WriteToEndOfFile = 1;
+  }
+  if (EventContext->FileFlags & DOKAN_SYNCHRONOUS_IO) {
+    DokanFileInfo->SynchronousIo = 1;
+  }
+  if (EventContext->FileFlags & DOKAN_NOCACHE) {
+    DokanFileInfo->Nocache = 1;
+  }
+
+  *DokanOpenInfo = GetDokanOpenInfo(EventContext, DokanInstance);
+  if (*DokanOpenInfo == NULL) {
+    DbgPrint("error openInfo is NULL\n");
+    return eventInfo;
+  }
+
+  DokanFileInfo->Context = (ULONG64)(*DokanOpenInfo)->UserContext;
+  DokanFileInfo->IsDirectory = (UCHAR)(*DokanOpenInfo)->IsDirectory;
+  DokanFileInfo->DokanContext = (ULONG64)(*DokanOpenInfo);
+
+  eventInfo->Context = (*DokanOpenInfo)->Handle;
+
+  return eventInfo;
+}
+
+// Runs the event on the calling DokanLoop thread, the reply goes to Device
+VOID DokanDispatchEvent(HANDLE Device, PEVENT_CONTEXT EventContext,
+                        PDOKAN_INSTANCE DokanInstance) {
+  LONGLONG dispatchStart;
+
+  dispatchStart = DokanStatisticsBeginDispatch();
+  DokanSetDispatchDevice(Device);
+  switch (EventContext->MajorFunction) {
+  case IRP_MJ_CREATE:
+    DispatchCreate(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_CLEANUP:
+    DispatchCleanup(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_CLOSE:
+    DispatchClose(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_DIRECTORY_CONTROL:
+    DispatchDirectoryInformation(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_READ:
+    DispatchRead(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_WRITE:
+    DispatchWrite(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_QUERY_INFORMATION:
+    DispatchQueryInformation(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_QUERY_VOLUME_INFORMATION:
+    DispatchQueryVolumeInformation(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_LOCK_CONTROL:
+    DispatchLock(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_SET_INFORMATION:
+    DispatchSetInformation(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_FLUSH_BUFFERS:
+    DispatchFlush(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_QUERY_SECURITY:
+    DispatchQuerySecurity(Device, EventContext, DokanInstance);
+    break;
+  case IRP_MJ_SET_SECURITY:
+    DispatchSetSecurity(Device, EventContext, DokanInstance);
+    break;
+  default:
+    break;
+  }
+  DokanStatisticsEndDispatch(DokanInstance, EventContext, dispatchStart);
+  DokanSetDispatchDevice(NULL);
+}
@@ -55,6 +55,13 @@ NewDokanInstance() {
 
   ZeroMemory(instance, sizeof(DOKAN_INSTANCE));
 
+  instance->PendingRequests = DokanPendingRequestsCreate();
+  if (instance->PendingRequests == NULL) {
+    free(instance);
+    return NULL;
+  }
+  InitializeSListHead(&instance->AsyncEvents);
+
 #if _MSC_VER < 1300
   InitializeCriticalSection(&instance->CriticalSection);
 #else
@@ -63,6 +70,9 @@ NewDokanInstance() {
 #endif
 
   InitializeListHead(&instance->ListEntry);
+  DokanOpenInfoTableInit(instance);
+  InitializeListHead(&instance->WriteGatherList);
+  InitializeSRWLock(&instance->WriteGatherListLock);
 
   EnterCriticalSection(&g_InstanceCriticalSection);
   InsertTailList(&g_InstanceList, &instance->ListEntry);
@@ -73,11 +83,22 @@ NewDokanInstance() {
 
 VOID DeleteDokanInstance(PDOKAN_INSTANCE Instance) {
   DeleteCriticalSection(&Instance->CriticalSection);
+  DokanOpenInfoTableCleanup(Instance);
+  if (Instance->ThreadsStoppedEvent != NULL)
+    CloseHandle(Instance->ThreadsStoppedEvent);
+  if (Instance->StatisticsStopEvent != NULL)
+    CloseHandle(Instance->StatisticsStopEvent);
+  if (Instance->WriteGatherStopEvent != NULL)
+    CloseHandle(Instance->WriteGatherStopEvent);
+  DokanAsyncCleanup(Instance);
 
   EnterCriticalSection(&g_InstanceCriticalSection);
   RemoveEntryList(&Instance->ListEntry);
   LeaveCriticalSection(&g_InstanceCriticalSection);
 
+  // DokanGetStatistics reads the cache counters of listed instances
+  DokanBlockCacheDelete(Instance->BlockCache);
+  DokanSecurityCacheDelete(Instance->SecurityCache);
   free(Instance);
 }
 
@@ -177,8 +198,9 @@ void CheckAllocationUnitSectorSize(PDOKAN_OPTIONS DokanOptions) {
 int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
                        PDOKAN_OPERATIONS DokanOperations) {
   HANDLE device;
-  HANDLE threadIds[DOKAN_MAX_THREAD];
   HANDLE legacyKeepAliveThreadIds = NULL;
+  HANDLE statisticsThread = NULL;
+  HANDLE writeGatherThread = NULL;
   BOOL keepalive_active = FALSE;
   PDOKAN_INSTANCE instance;
 
@@ -211,7 +233,10 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   CheckAllocationUnitSectorSize(DokanOptions);
 
   if (DokanOptions->ThreadCount == 0) {
-    DokanOptions->ThreadCount = 5;
+    DokanOptions->ThreadCount =
+        (DokanOptions->Options & DOKAN_OPTION_DYNAMIC_THREAD_POOL)
+            ? DOKAN_MAX_THREAD
+            : 5;
 
   } else if (DOKAN_MAX_THREAD < DokanOptions->ThreadCount) {
     DokanDbgPrintW(L"Dokan Error: too many thread count %d\n",
@@ -238,6 +263,45 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   instance = NewDokanInstance();
   instance->DokanOptions = DokanOptions;
   instance->DokanOperations = DokanOperations;
+  instance->StartTime = GetTickCount64();
+
+  instance->MaxThreadCount = DokanOptions->ThreadCount;
+  instance->MinThreadCount = DokanOptions->ThreadCount;
+  if (DokanOptions->Options & DOKAN_OPTION_DYNAMIC_THREAD_POOL) {
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    if ((LONG)systemInfo.dwNumberOfProcessors < instance->MinThreadCount)
+      instance->MinThreadCount = systemInfo.dwNumberOfProcessors;
+  }
+  DbgPrint("Dokan: thread pool %d - %d\n", instance->MinThreadCount,
+           instance->MaxThreadCount);
+  DokanAffinityInit(instance);
+
+  if (DokanOptions->Options & DOKAN_OPTION_BLOCK_CACHE) {
+    instance->BlockCache = DokanBlockCacheCreate(DOKAN_BLOCK_CACHE_BLOCK_SIZE,
+                                                 DOKAN_BLOCK_CACHE_SIZE);
+    if (instance->BlockCache == NULL)
+      DokanDbgPrint("Dokan Error: block cache allocation failed, reads are "
+                    "not cached\n");
+  }
+  if (DokanOptions->Options & DOKAN_OPTION_CACHE_SECURITY) {
+    instance->SecurityCache =
+        DokanSecurityCacheCreate(DOKAN_SECURITY_CACHE_ENTRIES);
+    if (instance->SecurityCache == NULL)
+      DokanDbgPrint("Dokan Error: security cache allocation failed, "
+                    "descriptors are not cached\n");
+  }
+  InitializeSRWLock(&instance->VolumeInformationLock);
+  InitializeSRWLock(&instance->VolumeInformationRefreshLock);
+  instance->VolumeInformationValidity = DOKAN_VOLUME_INFORMATION_VALIDITY;
+
+  instance->ThreadsStoppedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (instance->ThreadsStoppedEvent == NULL) {
+    DokanDbgPrint("Dokan Error: CreateEvent Failed\n");
+    CloseHandle(device);
+    DeleteDokanInstance(instance);
+    return DOKAN_ERROR;
+  }
 
   if (DokanOptions->MountPoint != NULL) {
     wcscpy_s(instance->MountPoint, sizeof(instance->MountPoint) / sizeof(WCHAR),
@@ -264,13 +328,13 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
     return DOKAN_START_ERROR;
   }
 
-  for (ULONG i = 0; i < DokanOptions->ThreadCount; ++i) {
-    threadIds[i] = (HANDLE)_beginthreadex(NULL, // Security Attributes
-                                          0,    // stack size
-                                          DokanLoop,
-                                          (PVOID)instance, // param
-                                          0, // create flag
-                                          NULL);
+  DokanTraceStart();
+
+  // All the threads are counted before the first one starts, so that one
+  // exiting right away does not signal ThreadsStoppedEvent meanwhile
+  InterlockedExchange(&instance->ThreadCount, instance->MinThreadCount);
+  for (LONG i = 0; i < instance->MinThreadCount; ++i) {
+    StartDokanLoopThread(instance);
   }
 
   if (!DokanMount(instance->MountPoint, instance->DeviceName, DokanOptions)) {
@@ -310,6 +374,33 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
                                NULL);
   }
 
+  if (DokanOptions->Options & DOKAN_OPTION_DUMP_STATISTICS) {
+    instance->StatisticsStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (instance->StatisticsStopEvent != NULL) {
+      statisticsThread = (HANDLE)_beginthreadex(NULL, // Security Attributes
+                                                0,    // stack size
+                                                DokanStatisticsDumpThread,
+                                                (PVOID)instance, // param
+                                                0, // create flag
+                                                NULL);
+    }
+  }
+
+  if (DokanOptions->Options & DOKAN_OPTION_WRITE_GATHERING) {
+    instance->WriteGatherStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (instance->WriteGatherStopEvent != NULL) {
+      writeGatherThread = (HANDLE)_beginthreadex(NULL, // Security Attributes
+                                                 0,    // stack size
+                                                 DokanWriteGatherThread,
+                                                 (PVOID)instance, // param
+                                                 0, // create flag
+                                                 NULL);
+    }
+    if (writeGatherThread == NULL)
+      DbgPrintW(L"Dokan Error: gathered writes will only be flushed by "
+                L"requests of their handle\n");
+  }
+
   if (DokanOptions->Options & DOKAN_OPTION_ENABLE_NOTIFICATION_API) {
     wchar_t notify_path[128];
     StringCbPrintfW(notify_path, sizeof(notify_path), L"\\\\?%s%s",
@@ -327,6 +418,8 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   // IOCTL_MOUNTDEV_QUERY_SUGGESTED_LINK_NAME
   DbgPrintW(L"mounted: %s -> %s\n", instance->MountPoint, instance->DeviceName);
 
+  DokanVolumeInformationMounted(instance);
+
   if (DokanOperations->Mounted) {
     DOKAN_FILE_INFO fileInfo;
     RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
@@ -336,16 +429,27 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   }
 
   // wait for loop thread terminations
-  WaitForMultipleObjects(DokanOptions->ThreadCount, threadIds, TRUE, INFINITE);
-  for (ULONG i = 0; i < DokanOptions->ThreadCount; ++i) {
-    CloseHandle(threadIds[i]);
-  }
+  WaitForSingleObject(instance->ThreadsStoppedEvent, INFINITE);
+  DokanWaitPendingRequests(instance);
 
   if (legacyKeepAliveThreadIds) {
     WaitForSingleObject(legacyKeepAliveThreadIds, INFINITE);
     CloseHandle(legacyKeepAliveThreadIds);
   }
 
+  // Flushes the writes still gathered once no request runs anymore
+  if (writeGatherThread) {
+    SetEvent(instance->WriteGatherStopEvent);
+    WaitForSingleObject(writeGatherThread, INFINITE);
+    CloseHandle(writeGatherThread);
+  }
+
+  if (statisticsThread) {
+    SetEvent(instance->StatisticsStopEvent);
+    WaitForSingleObject(statisticsThread, INFINITE);
+    CloseHandle(statisticsThread);
+  }
+
   if (g_notify_handle != INVALID_HANDLE_VALUE)
     CloseHandle(g_notify_handle);
   // Note that the keepalive close that actually has unmounting effect is the
@@ -372,19 +476,66 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   return DOKAN_SUCCESS;
 }
 
-VOID
-GetRawDeviceName(LPCWSTR DeviceName, LPWSTR DestinationBuffer,
-                 rsize_t DestinationBufferSizeInElements) {
-  if (DeviceName && DestinationBuffer && DestinationBufferSizeInElements > 0) {
-    wcscpy_s(DestinationBuffer, DestinationBufferSizeInElements, L"\\\\.");
-    wcscat_s(DestinationBuffer, DestinationBufferSizeInElements, DeviceName);
+static VOID DokanLoopThreadStopped(PDOKAN_INSTANCE DokanInstance) {
+  if (InterlockedDecrement(&DokanInstance->ThreadCount) == 0)
+    SetEvent(DokanInstance->ThreadsStoppedEvent);
+}
+
+// The caller has already accounted the new thread in ThreadCount
+BOOL StartDokanLoopThread(PDOKAN_INSTANCE DokanInstance) {
+  HANDLE thread = (HANDLE)_beginthreadex(NULL, // Security Attributes
+                                         0,    // stack size
+                                         DokanLoop,
+                                         (PVOID)DokanInstance, // param
+                                         0, // create flag
+                                         NULL);
+  if (thread == NULL) {
+    DbgPrint("Dokan Error: _beginthreadex failed %d\n", errno);
+    DokanLoopThreadStopped(DokanInstance);
+    return FALSE;
+  }
+  CloseHandle(thread);
+  return TRUE;
+}
+
+// Add a thread when the last idle one just picked up an event
+static VOID DokanGrowThreadPool(PDOKAN_INSTANCE DokanInstance) {
+  LONG count = DokanInstance->ThreadCount;
+  while (count < DokanInstance->MaxThreadCount) {
+    LONG prev = InterlockedCompareExchange(&DokanInstance->ThreadCount,
+                                           count + 1, count);
+    if (prev == count) {
+      DbgPrint("Dokan: all threads busy, start thread %d\n", count + 1);
+      StartDokanLoopThread(DokanInstance);
+      return;
+    }
+    count = prev;
   }
 }
 
-void ALIGN_ALLOCATION_SIZE(PLARGE_INTEGER size, PDOKAN_OPTIONS DokanOptions) {
-  long long r = size->QuadPart % DokanOptions->AllocationUnitSize;
-  size->QuadPart =
-      (size->QuadPart + (r > 0 ? DokanOptions->AllocationUnitSize - r : 0));
+// Returns TRUE if the calling thread should exit because enough other threads
+// are already waiting for events
+static BOOL DokanShrinkThreadPool(PDOKAN_INSTANCE DokanInstance) {
+  LONG idleMin = DokanInstance->MinThreadCount;
+  if (idleMin < DOKAN_DYNAMIC_THREAD_IDLE_MIN)
+    idleMin = DOKAN_DYNAMIC_THREAD_IDLE_MIN;
+  if (DokanInstance->IdleThreadCount < idleMin)
+    return FALSE;
+
+  LONG count = DokanInstance->ThreadCount;
+  while (count > DokanInstance->MinThreadCount) {
+    // The thread gives up its count here, so it must not call
+    // DokanLoopThreadStopped when it exits
+    LONG prev = InterlockedCompareExchange(&DokanInstance->ThreadCount,
+                                           count - 1, count);
+    if (prev == count) {
+      DbgPrint("Dokan: %d threads idle, stop thread %d\n",
+               DokanInstance->IdleThreadCount, count);
+      return TRUE;
+    }
+    count = prev;
+  }
+  return FALSE;
 }
 
 UINT WINAPI DokanLoop(PVOID pDokanInstance) {
@@ -396,14 +547,22 @@ UINT WINAPI DokanLoop(PVOID pDokanInstance) {
   DWORD lastError = 0;
   WCHAR rawDeviceName[MAX_PATH];
   PDOKAN_INSTANCE DokanInstance = pDokanInstance;
-
-  buffer = malloc(sizeof(char) * EVENT_CONTEXT_MAX_SIZE);
+  BOOL dynamicPool = (DokanInstance->DokanOptions->Options &
+                      DOKAN_OPTION_DYNAMIC_THREAD_POOL) != 0;
+  BOOL shrunk = FALSE;
+  EVENT_WAIT_AFFINITY affinity;
+  USHORT node = 0;
+  BOOL bound;
+
+  bound = DokanAffinityBindThread(DokanInstance, &affinity, &node);
+  buffer = DokanAffinityAllocBuffer(bound, node,
+                                    sizeof(char) * EVENT_CONTEXT_MAX_SIZE);
   if (buffer == NULL) {
     result = (DWORD)-1;
+    DokanLoopThreadStopped(DokanInstance);
     _endthreadex(result);
     return result;
   }
-  RtlZeroMemory(buffer, sizeof(char) * EVENT_CONTEXT_MAX_SIZE);
 
   GetRawDeviceName(DokanInstance->DeviceName, rawDeviceName, MAX_PATH);
 
@@ -424,24 +583,30 @@ UINT WINAPI DokanLoop(PVOID pDokanInstance) {
           L"Dokan Error: CreateFile failed %s: %d\n",
           rawDeviceName,
           GetLastError());
-      free(buffer);
+      DokanAffinityFreeBuffer(buffer);
       result = (DWORD)-1;
+      DokanLoopThreadStopped(DokanInstance);
       _endthreadex(result);
       return result;
     }
 
-    status = DeviceIoControl(
-        device,           // Handle to device
-        IOCTL_EVENT_WAIT, // IO Control code
-        NULL,             // Input Buffer to driver.
-        0,                // Length of input buffer in bytes.
-        buffer,           // Output Buffer from driver.
+    InterlockedIncrement(&DokanInstance->IdleThreadCount);
+    status = DokanDeviceIoControl(
+        device,                       // Handle to device
+        IOCTL_EVENT_WAIT,             // IO Control code
+        bound ? &affinity : NULL,     // Input Buffer to driver.
+        bound ? sizeof(affinity) : 0, // Length of input buffer in bytes.
+        buffer,                       // Output Buffer from driver.
         sizeof(char) *
             EVENT_CONTEXT_MAX_SIZE, // Length of output buffer in bytes.
-        &returnedLength,            // Bytes placed in buffer.
-        NULL                        // synchronous call
+        &returnedLength             // Bytes placed in buffer.
         );
 
+    if (InterlockedDecrement(&DokanInstance->IdleThreadCount) == 0 && status &&
+        dynamicPool) {
+      DokanGrowThreadPool(DokanInstance);
+    }
+
     if (!status) {
       lastError = GetLastError();
       DbgPrint("Ioctl failed for wait with code %d.\n", lastError);
@@ -467,196 +632,30 @@ UINT WINAPI DokanLoop(PVOID pDokanInstance) {
         continue;
       }
 
-      switch (context->MajorFunction) {
-      case IRP_MJ_CREATE:
-        DispatchCreate(device, context, DokanInstance);
-        break;
-      case IRP_MJ_CLEANUP:
-        DispatchCleanup(device, context, DokanInstance);
-        break;
-      case IRP_MJ_CLOSE:
-        DispatchClose(device, context, DokanInstance);
-        break;
-      case IRP_MJ_DIRECTORY_CONTROL:
-        DispatchDirectoryInformation(device, context, DokanInstance);
-        break;
-      case IRP_MJ_READ:
-        DispatchRead(device, context, DokanInstance);
-        break;
-      case IRP_MJ_WRITE:
-        DispatchWrite(device, context, DokanInstance);
-        break;
-      case IRP_MJ_QUERY_INFORMATION:
-        DispatchQueryInformation(device, context, DokanInstance);
-        break;
-      case IRP_MJ_QUERY_VOLUME_INFORMATION:
-        DispatchQueryVolumeInformation(device, context, DokanInstance);
-        break;
-      case IRP_MJ_LOCK_CONTROL:
-        DispatchLock(device, context, DokanInstance);
-        break;
-      case IRP_MJ_SET_INFORMATION:
-        DispatchSetInformation(device, context, DokanInstance);
-        break;
-      case IRP_MJ_FLUSH_BUFFERS:
-        DispatchFlush(device, context, DokanInstance);
-        break;
-      case IRP_MJ_QUERY_SECURITY:
-        DispatchQuerySecurity(device, context, DokanInstance);
-        break;
-      case IRP_MJ_SET_SECURITY:
-        DispatchSetSecurity(device, context, DokanInstance);
-        break;
-      default:
-        break;
-      }
+      DokanDispatchEvent(device, context, DokanInstance);
 
     } else {
       DbgPrint("ReturnedLength %d\n", returnedLength);
     }
 
     CloseHandle(device);
-  }
-
-  CloseHandle(device);
-  free(buffer);
-  _endthreadex(result);
 
-  return result;
-}
-
-VOID SendEventInformation(HANDLE Handle, PEVENT_INFORMATION EventInfo,
-                          ULONG EventLength, PDOKAN_INSTANCE DokanInstance) {
-  BOOL status;
-  ULONG returnedLength;
-
-  // DbgPrint("###EventInfo->Context %X\n", EventInfo->Context);
-  if (DokanInstance != NULL) {
-    ReleaseDokanOpenInfo(EventInfo, DokanInstance);
-  }
-
-  // send event info to driver
-  status = DeviceIoControl(Handle,           // Handle to device
-                           IOCTL_EVENT_INFO, // IO Control code
-                           EventInfo,        // Input Buffer to driver.
-                           EventLength,      // Length of input buffer in bytes.
-                           NULL,             // Output Buffer from driver.
-                           0,               // Length of output buffer in bytes.
-                           &returnedLength, // Bytes placed in buffer.
-                           NULL             // synchronous call
-                           );
-
-  if (!status) {
-    DWORD errorCode = GetLastError();
-    DbgPrint("Dokan Error: Ioctl failed with code %d\n", errorCode);
-  }
-}
-
-VOID CheckFileName(LPWSTR FileName) {
-  size_t len = wcslen(FileName);
-  // if the beginning of file name is "\\",
-  // replace it with "\"
-  if (len >= 2 && FileName[0] == L'\\' && FileName[1] == L'\\') {
-    int i;
-    for (i = 0; FileName[i + 1] != L'\0'; ++i) {
-      FileName[i] = FileName[i + 1];
+    if (dynamicPool && DokanShrinkThreadPool(DokanInstance)) {
+      device = INVALID_HANDLE_VALUE;
+      shrunk = TRUE;
+      break;
     }
-    FileName[i] = L'\0';
-  }
-
-  // Remove "\" in front of Directory
-  len = wcslen(FileName);
-  if (len > 2 && FileName[len - 1] == L'\\')
-    FileName[len - 1] = '\0';
-}
-
-PEVENT_INFORMATION
-DispatchCommon(PEVENT_CONTEXT EventContext, ULONG SizeOfEventInfo,
-               PDOKAN_INSTANCE DokanInstance, PDOKAN_FILE_INFO DokanFileInfo,
-               PDOKAN_OPEN_INFO *DokanOpenInfo) {
-  PEVENT_INFORMATION eventInfo = (PEVENT_INFORMATION)malloc(SizeOfEventInfo);
-
-  if (eventInfo == NULL) {
-    return NULL;
-  }
-  RtlZeroMemory(eventInfo, SizeOfEventInfo);
-  RtlZeroMemory(DokanFileInfo, sizeof(DOKAN_FILE_INFO));
-
-  eventInfo->BufferLength = 0;
-  eventInfo->SerialNumber = EventContext->SerialNumber;
-
-  DokanFileInfo->ProcessId = EventContext->ProcessId;
-  DokanFileInfo->DokanOptions = DokanInstance->DokanOptions;
-  if (EventContext->FileFlags & DOKAN_DELETE_ON_CLOSE) {
-    DokanFileInfo->DeleteOnClose = 1;
-  }
-  if (EventContext->FileFlags & DOKAN_PAGING_IO) {
-    DokanFileInfo->PagingIo = 1;
-  }
-  if (EventContext->FileFlags & DOKAN_WRITE_TO_END_OF_FILE) {
-    DokanFileInfo->WriteToEndOfFile = 1;
-  }
-  if (EventContext->FileFlags & DOKAN_SYNCHRONOUS_IO) {
-    DokanFileInfo->SynchronousIo = 1;
-  }
-  if (EventContext->FileFlags & DOKAN_NOCACHE) {
-    DokanFileInfo->Nocache = 1;
-  }
-
-  *DokanOpenInfo = GetDokanOpenInfo(EventContext, DokanInstance);
-  if (*DokanOpenInfo == NULL) {
-    DbgPrint("error openInfo is NULL\n");
-    return eventInfo;
   }
 
-  DokanFileInfo->Context = (ULONG64)(*DokanOpenInfo)->UserContext;
-  DokanFileInfo->IsDirectory = (UCHAR)(*DokanOpenInfo)->IsDirectory;
-  DokanFileInfo->DokanContext = (ULONG64)(*DokanOpenInfo);
-
-  eventInfo->Context = (ULONG64)(*DokanOpenInfo);
-
-  return eventInfo;
-}
-
-PDOKAN_OPEN_INFO
-GetDokanOpenInfo(PEVENT_CONTEXT EventContext, PDOKAN_INSTANCE DokanInstance) {
-  PDOKAN_OPEN_INFO openInfo;
-  EnterCriticalSection(&DokanInstance->CriticalSection);
-
-  openInfo = (PDOKAN_OPEN_INFO)(UINT_PTR)EventContext->Context;
-  if (openInfo != NULL) {
-    openInfo->OpenCount++;
-    openInfo->EventContext = EventContext;
-    openInfo->DokanInstance = DokanInstance;
-  }
-  LeaveCriticalSection(&DokanInstance->CriticalSection);
-  return openInfo;
-}
+  if (device != INVALID_HANDLE_VALUE)
+    CloseHandle(device);
+  DokanAffinityFreeBuffer(buffer);
+  DokanTraceThreadStopped();
+  if (!shrunk)
+    DokanLoopThreadStopped(DokanInstance);
+  _endthreadex(result);
 
-VOID ReleaseDokanOpenInfo(PEVENT_INFORMATION EventInformation,
-                          PDOKAN_INSTANCE DokanInstance) {
-  PDOKAN_OPEN_INFO openInfo;
-  EnterCriticalSection(&DokanInstance->CriticalSection);
-
-  openInfo = (PDOKAN_OPEN_INFO)(UINT_PTR)EventInformation->Context;
-  if (openInfo != NULL) {
-    openInfo->OpenCount--;
-    if (openInfo->OpenCount < 1) {
-      if (openInfo->DirListHead != NULL) {
-        ClearFindData(openInfo->DirListHead);
-        free(openInfo->DirListHead);
-        openInfo->DirListHead = NULL;
-      }
-      if (openInfo->StreamListHead != NULL) {
-        ClearFindStreamData(openInfo->StreamListHead);
-        free(openInfo->StreamListHead);
-        openInfo->StreamListHead = NULL;
-      }
-      free(openInfo);
-      EventInformation->Context = 0;
-    }
-  }
-  LeaveCriticalSection(&DokanInstance->CriticalSection);
+  return result;
 }
 
 // ask driver to release all pending IRP to prepare for Unmount.
@@ -721,6 +720,8 @@ BOOL DokanStart(PDOKAN_INSTANCE Instance) {
   ZeroMemory(&driverInfo, sizeof(EVENT_DRIVER_INFO));
 
   eventStart.UserVersion = DOKAN_DRIVER_VERSION;
+  // Names of opened files are kept per handle, see DokanGetEventFileName
+  eventStart.Flags |= DOKAN_EVENT_HANDLE_ONLY;
   if (Instance->DokanOptions->Options & DOKAN_OPTION_ALT_STREAM) {
     eventStart.Flags |= DOKAN_EVENT_ALTERNATIVE_STREAM_ON;
   }
@@ -791,48 +792,6 @@ BOOL DOKANAPI DokanMountPointsCleanUp() {
         0, NULL, 0, &returnedLength);
 }
 
-BOOL SendToDevice(LPCWSTR DeviceName, DWORD IoControlCode, PVOID InputBuffer,
-                  ULONG InputLength, PVOID OutputBuffer, ULONG OutputLength,
-                  PULONG ReturnedLength) {
-  HANDLE device;
-  BOOL status;
-
-  device = CreateFile(DeviceName,                         // lpFileName
-                      GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
-                      FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
-                      NULL,          // lpSecurityAttributes
-                      OPEN_EXISTING, // dwCreationDistribution
-                      0,             // dwFlagsAndAttributes
-                      NULL           // hTemplateFile
-                      );
-
-  if (device == INVALID_HANDLE_VALUE) {
-    DWORD dwErrorCode = GetLastError();
-    DbgPrintW(L"Dokan Error: Failed to open %s with code %d\n", DeviceName,
-             dwErrorCode);
-    return FALSE;
-  }
-
-  status = DeviceIoControl(device,         // Handle to device
-                           IoControlCode,  // IO Control code
-                           InputBuffer,    // Input Buffer to driver.
-                           InputLength,    // Length of input buffer in bytes.
-                           OutputBuffer,   // Output Buffer from driver.
-                           OutputLength,   // Length of output buffer in bytes.
-                           ReturnedLength, // Bytes placed in buffer.
-                           NULL            // synchronous call
-                           );
-
-  CloseHandle(device);
-
-  if (!status) {
-    DbgPrint("DokanError: Ioctl failed with code %d\n", GetLastError());
-    return FALSE;
-  }
-
-  return TRUE;
-}
-
 PDOKAN_CONTROL DOKANAPI DokanGetMountPointList(BOOL uncOnly, PULONG nbRead) {
   ULONG returnedLength = 0;
   PDOKAN_CONTROL dokanControl = NULL;
@@ -908,6 +867,7 @@ BOOL WINAPI DllMain(HINSTANCE Instance, DWORD Reason, LPVOID Reserved) {
 
     LeaveCriticalSection(&g_InstanceCriticalSection);
     DeleteCriticalSection(&g_InstanceCriticalSection);
+    DokanTraceCleanup();
   } break;
   default:
     break;
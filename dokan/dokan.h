@@ -113,6 +113,99 @@ extern "C" {
  * done inside of CreateFile calls on Windows 7.
  */
 #define DOKAN_OPTION_OPTIMIZE_SINGLE_NAME_SEARCH 2048
+/**
+ * Start with one thread per processor and let the library add threads while
+ * all of them are busy, up to \ref DOKAN_OPTIONS.ThreadCount. Threads exit
+ * again once enough of them are idle.
+ */
+#define DOKAN_OPTION_DYNAMIC_THREAD_POOL 4096
+/**
+ * Print the \ref DOKAN_STATISTICS of the mount every
+ * \ref DOKAN_STATISTICS_DUMP_INTERVAL milliseconds and at unmount.
+ */
+#define DOKAN_OPTION_DUMP_STATISTICS 8192
+/**
+ * Bind each DokanLoop thread to a NUMA node, spreading the threads over the
+ * nodes of the machine, and allocate its event buffer on that node.
+ * The driver gives the requests on an opened file to a waiting thread of the
+ * node its handle hashes to when there is one, so that the data of a file
+ * kept by the file system stays on one node.
+ */
+#define DOKAN_OPTION_NUMA_AFFINITY 16384
+/**
+ * Same as \ref DOKAN_OPTION_NUMA_AFFINITY with each thread pinned to one
+ * processor instead of a node. Takes precedence over
+ * \ref DOKAN_OPTION_NUMA_AFFINITY when both are set.
+ */
+#define DOKAN_OPTION_CPU_AFFINITY 32768
+/**
+ * Let the driver answer basic, standard and network open information queries
+ * for \ref DOKAN_FILE_ATTRIBUTES_VALIDITY milliseconds from the
+ * \ref DOKAN_OPERATIONS.GetFileInformation result of the last create or query
+ * information of the file, also called after each successful create.
+ * Writes, set information calls and notifications of the file end it early.
+ * Changes made to the files behind the back of the file system must be
+ * reported with the notification API for the answers to stay exact.
+ */
+#define DOKAN_OPTION_CACHE_FILE_ATTRIBUTES 65536
+/** Milliseconds the driver keeps file attributes with \ref DOKAN_OPTION_CACHE_FILE_ATTRIBUTES */
+#define DOKAN_FILE_ATTRIBUTES_VALIDITY 1000
+/**
+ * Keep the data returned by \ref DOKAN_OPERATIONS.ReadFile in a cache of
+ * \ref DOKAN_BLOCK_CACHE_SIZE bytes, read and evicted in aligned blocks of
+ * \ref DOKAN_BLOCK_CACHE_BLOCK_SIZE bytes, and answer reads from it.
+ * Writes, size changes, renames, deletes and overwriting creates drop the
+ * blocks they change. Cached reads are fetched synchronously and cannot be
+ * pended, reads of handles opened with FILE_FLAG_NO_BUFFERING bypass the
+ * cache. Files must only change through the file system.
+ */
+#define DOKAN_OPTION_BLOCK_CACHE 131072
+/** Size of the blocks of \ref DOKAN_OPTION_BLOCK_CACHE */
+#define DOKAN_BLOCK_CACHE_BLOCK_SIZE (64 * 1024)
+/** Bytes of file data kept by \ref DOKAN_OPTION_BLOCK_CACHE */
+#define DOKAN_BLOCK_CACHE_SIZE (64 * 1024 * 1024)
+/**
+ * Answer volume, size, full size and attribute information queries for
+ * \ref DOKAN_VOLUME_INFORMATION_VALIDITY milliseconds from the last results
+ * of \ref DOKAN_OPERATIONS.GetVolumeInformation and
+ * \ref DOKAN_OPERATIONS.GetDiskFreeSpace, called once at mount. The driver
+ * keeps a copy and answers them without a round trip to user mode.
+ * Use \ref DokanRefreshVolumeInformation when the answers change earlier.
+ */
+#define DOKAN_OPTION_CACHE_VOLUME_INFORMATION 262144
+/** Default milliseconds answers are kept by \ref DOKAN_OPTION_CACHE_VOLUME_INFORMATION */
+#define DOKAN_VOLUME_INFORMATION_VALIDITY 5000
+/**
+ * Keep the security descriptors returned by
+ * \ref DOKAN_OPERATIONS.GetFileSecurity per file and requested security
+ * information, for up to \ref DOKAN_SECURITY_CACHE_ENTRIES files, and answer
+ * security queries from them. Files with the same descriptor share one copy.
+ * A query too small for the descriptor gets it whole so that the driver
+ * answers the retry with a larger buffer without asking user mode.
+ * Set security calls, renames, deletes and overwriting creates drop the
+ * descriptors of the file, and of the files below it for a directory.
+ * Descriptors must only change through the file system.
+ */
+#define DOKAN_OPTION_CACHE_SECURITY 524288
+/** Files whose descriptors are kept by \ref DOKAN_OPTION_CACHE_SECURITY */
+#define DOKAN_SECURITY_CACHE_ENTRIES 65536
+/**
+ * Gather the writes of a handle shorter than \ref DOKAN_WRITE_GATHER_SIZE
+ * that follow each other in a buffer of that size, acknowledge them, and hand
+ * them to \ref DOKAN_OPERATIONS.WriteFile as one write once the buffer is
+ * full, after \ref DOKAN_WRITE_GATHER_AGE milliseconds, on flush, cleanup and
+ * close, before reads of the handle that overlap them, before the other
+ * requests on the handle that query or change the file, and at unmount.
+ * The gathered writes cannot be pended. A failed WriteFile call is reported
+ * to the next request of the handle that flushes. Other handles only see the
+ * data once it is written. Paging, noncached and end of file writes are not
+ * gathered.
+ */
+#define DOKAN_OPTION_WRITE_GATHERING 1048576
+/** Bytes gathered per handle by \ref DOKAN_OPTION_WRITE_GATHERING */
+#define DOKAN_WRITE_GATHER_SIZE (64 * 1024)
+/** Milliseconds writes stay gathered by \ref DOKAN_OPTION_WRITE_GATHERING */
+#define DOKAN_WRITE_GATHER_AGE 100
 
 /** @} */
 
@@ -124,7 +217,10 @@ extern "C" {
 typedef struct _DOKAN_OPTIONS {
   /** Version of the Dokan features requested without dots (version "123" is equal to Dokan version 1.2.3). */
   USHORT Version;
-  /** Number of threads to be used by Dokan library internally. More threads will handle more events at the same time. */
+  /**
+   * Number of threads to be used by Dokan library internally. More threads will handle more events at the same time.
+   * With \ref DOKAN_OPTION_DYNAMIC_THREAD_POOL this is the maximum number of threads.
+   */
   USHORT ThreadCount;
   /** Features enabled for the mount. See \ref DOKAN_OPTION. */
   ULONG Options;
@@ -298,6 +394,7 @@ typedef struct _DOKAN_OPERATIONS {
   * \param Offset Offset from where the read has to be continued.
   * \param DokanFileInfo Information about the file or directory.
   * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \c STATUS_PENDING after \ref DokanPendRequest, see \ref DokanCompleteRequest.
   * \see WriteFile
   */
   NTSTATUS(DOKAN_CALLBACK *ReadFile)(LPCWSTR FileName,
@@ -320,6 +417,7 @@ typedef struct _DOKAN_OPERATIONS {
   * \param Offset Offset from where the write has to be continued.
   * \param DokanFileInfo Information about the file or directory.
   * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \c STATUS_PENDING after \ref DokanPendRequest, see \ref DokanCompleteRequest.
   * \see ReadFile
   */
   NTSTATUS(DOKAN_CALLBACK *WriteFile)(LPCWSTR FileName,
@@ -746,6 +844,189 @@ typedef struct _DOKAN_OPERATIONS {
 
 /** @} */
 
+/**
+ * \defgroup DokanStatistics Dokan statistics
+ * \brief Counters the library keeps for each kind of request of a mount
+ */
+/** @{ */
+
+/** Number of buckets of the \ref DOKAN_OPERATION_STATISTICS latency histograms */
+#define DOKAN_LATENCY_BUCKETS 128
+/** Period in milliseconds of \ref DOKAN_OPTION_DUMP_STATISTICS */
+#define DOKAN_STATISTICS_DUMP_INTERVAL (60 * 1000)
+
+/**
+ * \struct DOKAN_OPERATION_STATISTICS
+ * \brief Counters of one IRP major function handled by a mount.
+ *
+ * Latencies are in microseconds. Histogram buckets 0 to 3 hold the values
+ * 0 to 3, every following power of two is split into 4 buckets of equal
+ * width. \ref DokanGetLatencyPercentile reads percentiles out of them.
+ */
+typedef struct _DOKAN_OPERATION_STATISTICS {
+  /** Number of requests dispatched */
+  ULONG64 Count;
+  /** Requests completed with an error NTSTATUS */
+  ULONG64 ErrorCount;
+  /** Bytes received from the driver, including the data of writes */
+  ULONG64 BytesIn;
+  /** Bytes of replies sent back to the driver, including the data of reads */
+  ULONG64 BytesOut;
+  /** Total time spent in \ref DOKAN_OPERATIONS callbacks */
+  ULONG64 CallbackTime;
+  /** Total time from receiving the request to sending the reply */
+  ULONG64 DispatchTime;
+  /** Histogram of the time spent in callbacks per request */
+  ULONG64 CallbackLatency[DOKAN_LATENCY_BUCKETS];
+  /** Histogram of the time from receiving the request to sending the reply */
+  ULONG64 DispatchLatency[DOKAN_LATENCY_BUCKETS];
+} DOKAN_OPERATION_STATISTICS, *PDOKAN_OPERATION_STATISTICS;
+
+/**
+ * \struct DOKAN_BLOCK_CACHE_STATISTICS
+ * \brief Counters of the \ref DOKAN_OPTION_BLOCK_CACHE cache of a mount.
+ */
+typedef struct _DOKAN_BLOCK_CACHE_STATISTICS {
+  /** Blocks read from the cache */
+  ULONG64 Hits;
+  /** Blocks read with \ref DOKAN_OPERATIONS.ReadFile */
+  ULONG64 Misses;
+  /** Misses that waited for the ReadFile call of another read of the block */
+  ULONG64 CoalescedMisses;
+  /** Bytes of reads answered from the cache */
+  ULONG64 BytesSaved;
+  /** Bytes read with \ref DOKAN_OPERATIONS.ReadFile */
+  ULONG64 BytesFetched;
+  /** Blocks dropped to make room */
+  ULONG64 Evictions;
+  /** Blocks dropped because their file changed */
+  ULONG64 Invalidations;
+  /** Blocks in the cache */
+  ULONG64 Blocks;
+} DOKAN_BLOCK_CACHE_STATISTICS, *PDOKAN_BLOCK_CACHE_STATISTICS;
+
+/**
+ * \struct DOKAN_SECURITY_CACHE_STATISTICS
+ * \brief Counters of the \ref DOKAN_OPTION_CACHE_SECURITY cache of a mount.
+ */
+typedef struct _DOKAN_SECURITY_CACHE_STATISTICS {
+  /** Security queries answered from the cache */
+  ULONG64 Hits;
+  /** Security queries answered by \ref DOKAN_OPERATIONS.GetFileSecurity */
+  ULONG64 Misses;
+  /** Entries dropped to make room */
+  ULONG64 Evictions;
+  /** Entries dropped because their file changed */
+  ULONG64 Invalidations;
+  /** Files and security information with a descriptor in the cache */
+  ULONG64 Entries;
+  /** Distinct descriptors shared by the entries */
+  ULONG64 Descriptors;
+  /** Bytes of the distinct descriptors */
+  ULONG64 DescriptorBytes;
+} DOKAN_SECURITY_CACHE_STATISTICS, *PDOKAN_SECURITY_CACHE_STATISTICS;
+
+/**
+ * \struct DOKAN_WRITE_GATHER_STATISTICS
+ * \brief Counters of \ref DOKAN_OPTION_WRITE_GATHERING for a mount.
+ */
+typedef struct _DOKAN_WRITE_GATHER_STATISTICS {
+  /** Writes acknowledged without a \ref DOKAN_OPERATIONS.WriteFile call */
+  ULONG64 GatheredWrites;
+  /** Bytes of the gathered writes */
+  ULONG64 GatheredBytes;
+  /** \ref DOKAN_OPERATIONS.WriteFile calls that wrote gathered writes */
+  ULONG64 Flushes;
+  /** Flushes that failed */
+  ULONG64 Errors;
+} DOKAN_WRITE_GATHER_STATISTICS, *PDOKAN_WRITE_GATHER_STATISTICS;
+
+/**
+ * \struct DOKAN_STATISTICS
+ * \brief Statistics of a mount since it was started.
+ * \see DokanGetStatistics
+ */
+typedef struct _DOKAN_STATISTICS {
+  /** Time in milliseconds since the mount started */
+  ULONG64 Uptime;
+  /** Indexed by IRP major function: IRP_MJ_CREATE, IRP_MJ_READ... */
+  DOKAN_OPERATION_STATISTICS Operations[IRP_MJ_MAXIMUM_FUNCTION + 1];
+  /** Zero without \ref DOKAN_OPTION_BLOCK_CACHE */
+  DOKAN_BLOCK_CACHE_STATISTICS BlockCache;
+  /** Zero without \ref DOKAN_OPTION_CACHE_SECURITY */
+  DOKAN_SECURITY_CACHE_STATISTICS SecurityCache;
+  /** Zero without \ref DOKAN_OPTION_WRITE_GATHERING */
+  DOKAN_WRITE_GATHER_STATISTICS WriteGather;
+} DOKAN_STATISTICS, *PDOKAN_STATISTICS;
+
+/** Number of records kept per thread by the trace ring */
+#define DOKAN_TRACE_RING_SIZE 1024
+/** First bytes of a file written by \ref DokanDumpTrace: "DKTR" */
+#define DOKAN_TRACE_MAGIC 0x52544B44
+/** Version of the \ref DOKAN_TRACE_FILE_HEADER format */
+#define DOKAN_TRACE_VERSION 1
+/**
+ * Name of the event that makes a process dump its trace to
+ * %TEMP%\\dokan_trace_<ProcessId>.bin, formatted with the process id.
+ */
+#define DOKAN_TRACE_DUMP_EVENT_NAME L"Local\\DokanTraceDump%lu"
+
+/**
+ * \struct DOKAN_TRACE_RECORD
+ * \brief One request dispatched by a DokanLoop thread.
+ */
+typedef struct _DOKAN_TRACE_RECORD {
+  /** QueryPerformanceCounter value when the request was received */
+  ULONG64 Timestamp;
+  /** Position of the record in the ring of its thread, starting at 1 */
+  ULONG64 Sequence;
+  /** Id of the thread that dispatched the request */
+  ULONG ThreadId;
+  /** Serial number of the request given by the driver */
+  ULONG SerialNumber;
+  /** FNV-1a hash of the file name of the request, 0 if it has none */
+  ULONG FileNameHash;
+  /** Status of the reply, 0 if the request has no reply */
+  NTSTATUS Status;
+  /** Size of the request received from the driver */
+  ULONG BytesIn;
+  /** Size of the reply sent to the driver */
+  ULONG BytesOut;
+  /** Time in microseconds spent in \ref DOKAN_OPERATIONS callbacks */
+  ULONG CallbackTime;
+  /** Time in microseconds from receiving the request to sending the reply */
+  ULONG DispatchTime;
+  /** IRP major function */
+  UCHAR MajorFunction;
+  /** IRP minor function */
+  UCHAR MinorFunction;
+  /** Unused */
+  USHORT Reserved;
+} DOKAN_TRACE_RECORD, *PDOKAN_TRACE_RECORD;
+
+/**
+ * \struct DOKAN_TRACE_FILE_HEADER
+ * \brief Header of a file written by \ref DokanDumpTrace, followed by RecordCount \ref DOKAN_TRACE_RECORD.
+ */
+typedef struct _DOKAN_TRACE_FILE_HEADER {
+  /** \ref DOKAN_TRACE_MAGIC */
+  ULONG Magic;
+  /** \ref DOKAN_TRACE_VERSION */
+  ULONG Version;
+  /** sizeof(DOKAN_TRACE_RECORD) */
+  ULONG RecordSize;
+  /** Number of records following the header */
+  ULONG RecordCount;
+  /** QueryPerformanceFrequency value to convert the timestamps */
+  ULONG64 Frequency;
+  /** Id of the process that wrote the trace */
+  ULONG ProcessId;
+  /** Unused */
+  ULONG Reserved;
+} DOKAN_TRACE_FILE_HEADER, *PDOKAN_TRACE_FILE_HEADER;
+
+/** @} */
+
 /**
  * \defgroup Dokan Dokan
  */
@@ -833,6 +1114,13 @@ ULONG DOKANAPI DokanDriverVersion();
 /**
  * \brief Extends the timeout of the current IO operation in driver.
  *
+ * The operation is given \c Timeout milliseconds from now to complete, up to
+ * 5 minutes. Long operations can call it as a heartbeat while they make
+ * progress: when called from the thread running the \ref DOKAN_OPERATIONS
+ * callback, it reuses the device handle of that thread, and calls that would
+ * only extend the deadline by less than an eighth of \c Timeout are not sent
+ * to the driver.
+ *
  * \param Timeout Extended time in milliseconds requested.
  * \param DokanFileInfo \ref DOKAN_FILE_INFO of the operation to extend.
  * \return If the operation was successful.
@@ -851,6 +1139,62 @@ BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO DokanFileInfo);
  */
 HANDLE DOKANAPI DokanOpenRequestorToken(PDOKAN_FILE_INFO DokanFileInfo);
 
+/**
+ * \brief Read or write request completed later by \ref DokanCompleteRequest
+ */
+typedef struct _DOKAN_REQUEST *PDOKAN_REQUEST;
+
+/**
+ * \brief Keep the current read or write request to complete it later.
+ *
+ * Can only be called from the \ref DOKAN_OPERATIONS.ReadFile or
+ * \ref DOKAN_OPERATIONS.WriteFile callback, which then has to return
+ * \c STATUS_PENDING. The \c DokanLoop thread goes back to the driver without
+ * replying, and the request is completed by calling \ref DokanCompleteRequest
+ * exactly once, from any thread.
+ *
+ * The read \c Buffer stays valid until the request is completed. The write
+ * \c Buffer, \c FileName and \c DokanFileInfo are only valid until the
+ * callback returns. \ref DOKAN_FILE_INFO.Context is kept as it is when this
+ * is called and given back to the handle when the request is completed.
+ * \ref DokanResetTimeout cannot be used on a pended request, the driver
+ * timeout is extended with \ref DokanResetRequestTimeout instead.
+ *
+ * \param DokanFileInfo \ref DOKAN_FILE_INFO given to the callback.
+ * \return The request to give to \ref DokanCompleteRequest, or \c NULL if it
+ * cannot be pended. The callback then has to complete it before returning.
+ */
+PDOKAN_REQUEST DOKANAPI DokanPendRequest(PDOKAN_FILE_INFO DokanFileInfo);
+
+/**
+ * \brief Complete a request kept with \ref DokanPendRequest.
+ *
+ * Sends the reply to the driver and frees the request, which must not be used
+ * afterwards. The unmount waits up to 15 seconds for the pended requests to be
+ * completed and fails the others, whose completion then only frees them.
+ *
+ * \param Request Request returned by \ref DokanPendRequest.
+ * \param Status Result of the operation, as the callback would have returned.
+ * \param Bytes Number of bytes read into the read \c Buffer or written.
+ * \return If the reply was sent to the driver. The request is freed either way.
+ */
+BOOL DOKANAPI DokanCompleteRequest(PDOKAN_REQUEST Request, NTSTATUS Status,
+                                   ULONG Bytes);
+
+/**
+ * \brief Extend the time the driver waits for a pended request.
+ *
+ * Works like \ref DokanResetTimeout for a request kept with
+ * \ref DokanPendRequest, from any thread, until it is completed.
+ *
+ * \param Request Request returned by \ref DokanPendRequest.
+ * \param Timeout Time in milliseconds the request is given from now, up to 5
+ * minutes.
+ * \return If the timeout was extended. \c FALSE once the request is being
+ * completed or the unmount failed it.
+ */
+BOOL DOKANAPI DokanResetRequestTimeout(PDOKAN_REQUEST Request, ULONG Timeout);
+
 /**
  * \brief Get active Dokan mount points.
  *
@@ -862,6 +1206,81 @@ HANDLE DOKANAPI DokanOpenRequestorToken(PDOKAN_FILE_INFO DokanFileInfo);
  */
 PDOKAN_CONTROL DOKANAPI DokanGetMountPointList(BOOL uncOnly, PULONG nbRead);
 
+/**
+ * \brief Get a snapshot of the statistics of a mount in this process.
+ *
+ * Counters are updated without locks while requests are processed, so the
+ * snapshot is not an atomic view across counters.
+ *
+ * \param MountPoint Mount point of the instance as given in \ref DOKAN_OPTIONS.MountPoint, or \c NULL for the first mount of the process.
+ * \param Statistics Receives the statistics.
+ * \return \c FALSE if no such mount is running in this process.
+ * \ingroup DokanStatistics
+ */
+BOOL DOKANAPI DokanGetStatistics(LPCWSTR MountPoint,
+                                 PDOKAN_STATISTICS Statistics);
+
+/**
+ * \brief Drop the volume information kept by \ref DOKAN_OPTION_CACHE_VOLUME_INFORMATION.
+ *
+ * The next volume information query of the mount calls
+ * \ref DOKAN_OPERATIONS.GetVolumeInformation and
+ * \ref DOKAN_OPERATIONS.GetDiskFreeSpace again, for instance after the file
+ * system changed its label or its free space changed a lot.
+ * Must not be called from these two callbacks.
+ *
+ * \param MountPoint Mount point of the instance as given in \ref DOKAN_OPTIONS.MountPoint, or \c NULL for the first mount of the process.
+ * \param Validity Milliseconds the next answers are kept, \c 0 to keep the current value.
+ * \return \c FALSE if no such mount with the option is running in this process.
+ */
+BOOL DOKANAPI DokanRefreshVolumeInformation(LPCWSTR MountPoint,
+                                            ULONG Validity);
+
+/**
+ * \brief Get a percentile of a \ref DOKAN_OPERATION_STATISTICS latency histogram.
+ *
+ * \param Histogram \ref DOKAN_OPERATION_STATISTICS.CallbackLatency or \ref DOKAN_OPERATION_STATISTICS.DispatchLatency.
+ * \param Percentile Percentile to compute, from 0 to 100.
+ * \return Upper bound in microseconds of the bucket holding the percentile, 0 for an empty histogram.
+ * \ingroup DokanStatistics
+ */
+ULONG64 DOKANAPI DokanGetLatencyPercentile(const ULONG64 *Histogram,
+                                           ULONG Percentile);
+
+/**
+ * \brief Get a snapshot of the driver queue statistics of a mounted volume.
+ *
+ * Unlike \ref DokanGetStatistics, the volume can be mounted by any process.
+ * Use it to see whether requests wait in the driver for a free thread
+ * (\ref DOKAN_OPTIONS.ThreadCount) or in the file system callbacks.
+ *
+ * \param MountPoint Mount point of the volume ("Z", "Z:", "Z:\", "Z:\MyMountPoint").
+ * \param Metrics Receives the statistics.
+ * \return \c FALSE if the volume was not found or the driver did not answer.
+ * \ingroup DokanStatistics
+ */
+BOOL DOKANAPI DokanGetVolumeMetrics(LPCWSTR MountPoint,
+                                    PDOKAN_VOLUME_METRICS Metrics);
+
+/**
+ * \brief Write the trace rings of all the DokanLoop threads of the process to a file.
+ *
+ * Every request dispatched by the library is recorded in a ring of the
+ * \ref DOKAN_TRACE_RING_SIZE last requests of its thread, without locks or
+ * text formatting so it can stay enabled in production. The file holds a
+ * \ref DOKAN_TRACE_FILE_HEADER followed by the records, which
+ * <tt>dokanctl /x</tt> converts to the Chrome trace JSON format.
+ *
+ * Another process can request a dump to %TEMP%\\dokan_trace_<ProcessId>.bin
+ * by setting the event named \ref DOKAN_TRACE_DUMP_EVENT_NAME, like
+ * <tt>dokanctl /t ProcessId</tt> does.
+ *
+ * \param FileName Path of the file to write.
+ * \return \c FALSE if the file could not be written.
+ * \ingroup DokanStatistics
+ */
+BOOL DOKANAPI DokanDumpTrace(LPCWSTR FileName);
+
 /**
  * \brief Release Mount point list resources from \ref DokanGetMountPointList.
  *
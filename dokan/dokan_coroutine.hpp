@@ -0,0 +1,667 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_COROUTINE_HPP_
+#define DOKAN_COROUTINE_HPP_
+
+/**
+ * \file dokan_coroutine.hpp
+ * \brief Header-only C++20 coroutine front-end of the Dokan callbacks
+ *
+ * A file system implements some of the \ref DOKAN_OPERATIONS as member
+ * coroutines returning \ref dokan::task, and
+ * \ref dokan::coroutine_operations builds the \ref DOKAN_OPERATIONS calling
+ * them. Only the callbacks the file system declares are set:
+ *
+ * \code
+ * struct MyFs {
+ *   using file_type = MyFile; // optional, owned through DOKAN_FILE_INFO.Context
+ *   dokan::task<NTSTATUS> ZwCreateFile(dokan::request &req,
+ *       PDOKAN_IO_SECURITY_CONTEXT, ACCESS_MASK, ULONG, ULONG, ULONG, ULONG);
+ *   dokan::task<dokan::io_result> ReadFile(dokan::request &req, LPVOID buffer,
+ *       DWORD length, LONGLONG offset);
+ * };
+ * MyFs fs;
+ * dokan::coroutine_operations<MyFs> adapter(fs, dokanOptions);
+ * DokanMain(&dokanOptions, adapter.operations());
+ * \endcode
+ *
+ * Every coroutine first runs on the \c DokanLoop thread. When it completes
+ * without suspending, the reply is sent as for a plain callback. When a
+ * \c ReadFile or \c WriteFile coroutine suspends, the request is pended with
+ * \ref DokanPendRequest and the thread goes back to the driver; the thread that
+ * finishes the coroutine calls \ref DokanCompleteRequest. Other operations
+ * cannot be pended by the library, the \c DokanLoop thread waits for them.
+ *
+ * Each request is cancelled once the driver timeout of the mount has elapsed
+ * (\ref DOKAN_OPTIONS.Timeout, 15 seconds by default), as the driver has then
+ * failed the IRP, and when the volume is unmounted. The driver does not tell
+ * user mode about IRPs cancelled by the caller, those run to completion.
+ */
+
+#include "dokan.h"
+#include "dokan_task.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+namespace dokan {
+
+/** \brief Result of a \c ReadFile or \c WriteFile coroutine */
+struct io_result {
+  /** Status of the operation */
+  NTSTATUS status;
+  /** Bytes read into the buffer or written */
+  ULONG bytes;
+};
+
+/**
+ * \brief Adds entries to the result of a \c FindFiles coroutine.
+ */
+class find_sink {
+public:
+  find_sink(PFillFindData fill, PDOKAN_FILE_INFO info) noexcept
+      : fill_(fill), info_(info) {}
+  /** \brief Add one entry */
+  void operator()(WIN32_FIND_DATAW &data) const { fill_(&data, info_); }
+
+private:
+  PFillFindData fill_;
+  PDOKAN_FILE_INFO info_;
+};
+
+class request;
+
+namespace detail {
+
+// Requests in flight of a mount, cancelled by their deadline or the unmount
+class RequestTracker {
+public:
+  void Track(request &req);
+  void Untrack(request &req);
+  void CancelExpired(ULONGLONG now);
+  void CancelAll();
+
+private:
+  std::mutex lock_;
+  request *head_ = nullptr;
+};
+
+} // namespace detail
+
+/**
+ * \brief One call of a coroutine callback.
+ *
+ * It replaces \ref DOKAN_FILE_INFO, which is only valid while the callback
+ * runs. The file name points to the buffer of the driver event: for
+ * \c ReadFile and \c WriteFile it is only valid until the coroutine first
+ * suspends, like the \c WriteFile buffer. Copy them before the first
+ * \c co_await that may suspend.
+ */
+class request {
+public:
+  request(const request &) = delete;
+  request &operator=(const request &) = delete;
+
+  /** \brief Path of the file, see above for its lifetime */
+  std::wstring_view file_name() const noexcept { return fileName_; }
+  /** \brief Process ID of the thread that requested the operation */
+  ULONG process_id() const noexcept { return processId_; }
+  /** \brief See \ref DOKAN_FILE_INFO.IsDirectory */
+  bool is_directory() const noexcept { return isDirectory_; }
+  /** \brief Mark the opened file as a directory, in \c ZwCreateFile */
+  void set_directory(bool directory) noexcept { isDirectory_ = directory; }
+  /** \brief See \ref DOKAN_FILE_INFO.DeleteOnClose */
+  bool delete_on_close() const noexcept { return deleteOnClose_; }
+  /** \brief See \ref DOKAN_FILE_INFO.PagingIo */
+  bool paging_io() const noexcept { return pagingIo_; }
+  /** \brief See \ref DOKAN_FILE_INFO.SynchronousIo */
+  bool synchronous_io() const noexcept { return synchronousIo_; }
+  /** \brief See \ref DOKAN_FILE_INFO.Nocache */
+  bool nocache() const noexcept { return nocache_; }
+  /** \brief See \ref DOKAN_FILE_INFO.WriteToEndOfFile */
+  bool write_to_end_of_file() const noexcept { return writeToEndOfFile_; }
+
+  /** \brief \ref DOKAN_FILE_INFO.Context as given to the callback */
+  ULONG64 raw_context() const noexcept { return context_; }
+  /**
+   * \brief Change \ref DOKAN_FILE_INFO.Context.
+   *
+   * Not taken into account for \c ReadFile and \c WriteFile.
+   */
+  void set_raw_context(ULONG64 context) noexcept { context_ = context; }
+  /** \brief The \c file_type object of the file, or \c nullptr */
+  template <class T> T *file() const noexcept {
+    return reinterpret_cast<T *>(static_cast<UINT_PTR>(context_));
+  }
+  /**
+   * \brief Attach the object of the file opened by \c ZwCreateFile.
+   *
+   * \c T must be the \c file_type of the file system. The object is deleted
+   * after \c CloseFile, or when the open fails.
+   */
+  template <class T> void open_file(std::unique_ptr<T> file) noexcept {
+    context_ = static_cast<ULONG64>(reinterpret_cast<UINT_PTR>(file.release()));
+  }
+
+  /** \brief If the driver gave up on the request or the volume unmounts */
+  bool cancelled() const noexcept {
+    return cancelled_.load(std::memory_order_acquire);
+  }
+  /**
+   * \brief Call \c callback once when the request is cancelled.
+   *
+   * It is called at once if the request is already cancelled. The callback
+   * runs while the requests of the mount are locked, it must not resume the
+   * coroutine itself but post it to an \ref executor.
+   */
+  void on_cancel(void (*callback)(void *), void *argument) {
+    {
+      std::lock_guard<std::mutex> lock(cancelLock_);
+      if (!cancelled()) {
+        cancelCallback_ = callback;
+        cancelArgument_ = argument;
+        return;
+      }
+    }
+    callback(argument);
+  }
+
+  // Pended requests come from the coroutine frame pool
+  static void *operator new(std::size_t size) {
+    return detail::AllocateFrame(size);
+  }
+  static void operator delete(void *frame, std::size_t size) {
+    detail::DeallocateFrame(frame, size);
+  }
+
+private:
+  template <class FileSystem> friend class coroutine_operations;
+  friend class detail::RequestTracker;
+
+  request(LPCWSTR fileName, PDOKAN_FILE_INFO info, ULONG timeout) noexcept
+      : fileName_(fileName != NULL ? fileName : L""),
+        deadline_(GetTickCount64() + timeout), context_(info->Context),
+        processId_(info->ProcessId), isDirectory_(info->IsDirectory != 0),
+        deleteOnClose_(info->DeleteOnClose != 0),
+        pagingIo_(info->PagingIo != 0),
+        synchronousIo_(info->SynchronousIo != 0),
+        nocache_(info->Nocache != 0),
+        writeToEndOfFile_(info->WriteToEndOfFile != 0) {}
+
+  // Gives what the coroutine changed back to a callback still running
+  void Publish(PDOKAN_FILE_INFO info) const noexcept {
+    info->Context = context_;
+    info->IsDirectory = isDirectory_ ? TRUE : FALSE;
+  }
+
+  void Cancel() {
+    void (*callback)(void *);
+    {
+      std::lock_guard<std::mutex> lock(cancelLock_);
+      if (cancelled())
+        return;
+      cancelled_.store(true, std::memory_order_release);
+      callback = std::exchange(cancelCallback_, nullptr);
+    }
+    if (callback != nullptr)
+      callback(cancelArgument_);
+  }
+
+  std::wstring_view fileName_;
+  ULONGLONG deadline_;
+  ULONG64 context_;
+  ULONG processId_;
+  bool isDirectory_;
+  bool deleteOnClose_;
+  bool pagingIo_;
+  bool synchronousIo_;
+  bool nocache_;
+  bool writeToEndOfFile_;
+
+  std::atomic<bool> cancelled_{false};
+  std::mutex cancelLock_;
+  void (*cancelCallback_)(void *) = nullptr;
+  void *cancelArgument_ = nullptr;
+
+  // Links of the RequestTracker list
+  request *previous_ = nullptr;
+  request *next_ = nullptr;
+  // Set once pended
+  detail::RequestTracker *tracker_ = nullptr;
+  PDOKAN_REQUEST pended_ = NULL;
+};
+
+namespace detail {
+
+inline void RequestTracker::Track(request &req) {
+  std::lock_guard<std::mutex> lock(lock_);
+  req.next_ = head_;
+  if (head_ != nullptr)
+    head_->previous_ = &req;
+  head_ = &req;
+}
+
+inline void RequestTracker::Untrack(request &req) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (req.previous_ != nullptr)
+    req.previous_->next_ = req.next_;
+  else
+    head_ = req.next_;
+  if (req.next_ != nullptr)
+    req.next_->previous_ = req.previous_;
+  req.previous_ = req.next_ = nullptr;
+}
+
+inline void RequestTracker::CancelExpired(ULONGLONG now) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (request *req = head_; req != nullptr; req = req->next_) {
+    if (req->deadline_ <= now)
+      req->Cancel();
+  }
+}
+
+inline void RequestTracker::CancelAll() {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (request *req = head_; req != nullptr; req = req->next_)
+    req->Cancel();
+}
+
+} // namespace detail
+
+/**
+ * \brief Builds the \ref DOKAN_OPERATIONS of a coroutine file system.
+ *
+ * It stores itself in \ref DOKAN_OPTIONS.GlobalContext and must outlive
+ * \ref DokanMain. Callbacks the file system does not declare stay \c NULL and
+ * can still be set as plain C callbacks on \ref operations. \c Unmounted is
+ * used to cancel the requests left, call \ref cancel_all if it is replaced.
+ */
+template <class FileSystem> class coroutine_operations {
+public:
+  coroutine_operations(FileSystem &fs, DOKAN_OPTIONS &options)
+      : fs_(fs), timeout_(options.Timeout != 0 ? options.Timeout
+                                                : kDefaultTimeout) {
+    options.GlobalContext = static_cast<ULONG64>(reinterpret_cast<UINT_PTR>(this));
+    ZeroMemory(&operations_, sizeof(DOKAN_OPERATIONS));
+    Bind();
+    sweeper_ = std::thread([this] { Sweep(); });
+  }
+
+  ~coroutine_operations() {
+    {
+      std::lock_guard<std::mutex> lock(sweeperLock_);
+      stopping_ = true;
+    }
+    sweeperCondition_.notify_all();
+    sweeper_.join();
+  }
+
+  coroutine_operations(const coroutine_operations &) = delete;
+  coroutine_operations &operator=(const coroutine_operations &) = delete;
+
+  /** \brief Operations to give to \ref DokanMain */
+  PDOKAN_OPERATIONS operations() noexcept { return &operations_; }
+
+  /** \brief Cancel every request in flight */
+  void cancel_all() { tracker_.CancelAll(); }
+
+private:
+  // Default IRP timeout of the driver, DOKAN_IRP_PENDING_TIMEOUT
+  static constexpr ULONG kDefaultTimeout = 1000 * 15;
+  static constexpr bool kOwnsFiles =
+      requires { typename FileSystem::file_type; };
+
+  static coroutine_operations &Self(PDOKAN_FILE_INFO info) {
+    return *reinterpret_cast<coroutine_operations *>(
+        static_cast<UINT_PTR>(info->DokanOptions->GlobalContext));
+  }
+
+  static task<NTSTATUS> Succeed(task<void> body) {
+    co_await std::move(body);
+    co_return STATUS_SUCCESS;
+  }
+
+  static void ReleaseFile(PDOKAN_FILE_INFO info) {
+    if constexpr (kOwnsFiles) {
+      delete reinterpret_cast<typename FileSystem::file_type *>(
+          static_cast<UINT_PTR>(info->Context));
+      info->Context = 0;
+    }
+  }
+
+  // Runs an operation the library cannot pend, waiting for it if it suspends
+  template <class Body>
+  static NTSTATUS Wait(LPCWSTR fileName, PDOKAN_FILE_INFO info, Body body) {
+    coroutine_operations &self = Self(info);
+    request req(fileName, info, self.timeout_);
+    NTSTATUS status;
+
+    self.tracker_.Track(req);
+    try {
+      status = pendable<NTSTATUS>::wait(body(self.fs_, req),
+                                        STATUS_INTERNAL_ERROR);
+    } catch (const std::bad_alloc &) {
+      status = STATUS_NO_MEMORY;
+    }
+    self.tracker_.Untrack(req);
+    req.Publish(info);
+    return status;
+  }
+
+  static void CompletePended(void *token, io_result result) {
+    request *req = static_cast<request *>(token);
+    req->tracker_->Untrack(*req);
+    DokanCompleteRequest(req->pended_, result.status, result.bytes);
+    delete req;
+  }
+
+  // Runs a read or write inline, and pends it if it suspends
+  template <class Body>
+  static NTSTATUS Pend(LPCWSTR fileName, PDOKAN_FILE_INFO info, LPDWORD bytes,
+                       Body body) {
+    coroutine_operations &self = Self(info);
+    request *req;
+    io_result result;
+
+    try {
+      req = new request(fileName, info, self.timeout_);
+    } catch (const std::bad_alloc &) {
+      return STATUS_NO_MEMORY;
+    }
+    self.tracker_.Track(*req);
+    req->tracker_ = &self.tracker_;
+    try {
+      pendable<io_result> call(body(self.fs_, *req),
+                               io_result{STATUS_INTERNAL_ERROR, 0});
+      if (call.start()) {
+        result = call.result();
+      } else {
+        req->pended_ = DokanPendRequest(info);
+        if (req->pended_ != NULL) {
+          call.detach(req, &CompletePended);
+          return STATUS_PENDING;
+        }
+        result = call.join();
+      }
+    } catch (const std::bad_alloc &) {
+      result = io_result{STATUS_NO_MEMORY, 0};
+    }
+    self.tracker_.Untrack(*req);
+    delete req;
+    *bytes = result.bytes;
+    return result.status;
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  ZwCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
+               ACCESS_MASK DesiredAccess, ULONG FileAttributes,
+               ULONG ShareAccess, ULONG CreateDisposition, ULONG CreateOptions,
+               PDOKAN_FILE_INFO DokanFileInfo) {
+    NTSTATUS status = Wait(FileName, DokanFileInfo,
+                           [&](FileSystem &fs, request &req) {
+                             return fs.ZwCreateFile(
+                                 req, SecurityContext, DesiredAccess,
+                                 FileAttributes, ShareAccess,
+                                 CreateDisposition, CreateOptions);
+                           });
+    if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION)
+      ReleaseFile(DokanFileInfo);
+    return status;
+  }
+
+  static void DOKAN_CALLBACK Cleanup(LPCWSTR FileName,
+                                     PDOKAN_FILE_INFO DokanFileInfo) {
+    Wait(FileName, DokanFileInfo, [](FileSystem &fs, request &req) {
+      return Succeed(fs.Cleanup(req));
+    });
+  }
+
+  static void DOKAN_CALLBACK CloseFile(LPCWSTR FileName,
+                                       PDOKAN_FILE_INFO DokanFileInfo) {
+    if constexpr (requires(FileSystem &fs, request &req) { fs.CloseFile(req); }) {
+      Wait(FileName, DokanFileInfo, [](FileSystem &fs, request &req) {
+        return Succeed(fs.CloseFile(req));
+      });
+    }
+    ReleaseFile(DokanFileInfo);
+  }
+
+  static NTSTATUS DOKAN_CALLBACK ReadFile(LPCWSTR FileName, LPVOID Buffer,
+                                          DWORD BufferLength,
+                                          LPDWORD ReadLength, LONGLONG Offset,
+                                          PDOKAN_FILE_INFO DokanFileInfo) {
+    return Pend(FileName, DokanFileInfo, ReadLength,
+                [&](FileSystem &fs, request &req) {
+                  return fs.ReadFile(req, Buffer, BufferLength, Offset);
+                });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  WriteFile(LPCWSTR FileName, LPCVOID Buffer, DWORD NumberOfBytesToWrite,
+            LPDWORD NumberOfBytesWritten, LONGLONG Offset,
+            PDOKAN_FILE_INFO DokanFileInfo) {
+    return Pend(FileName, DokanFileInfo, NumberOfBytesWritten,
+                [&](FileSystem &fs, request &req) {
+                  return fs.WriteFile(req, Buffer, NumberOfBytesToWrite,
+                                      Offset);
+                });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  FlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [](FileSystem &fs, request &req) {
+      return fs.FlushFileBuffers(req);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  GetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer,
+                     PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.GetFileInformation(req, Buffer);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK FindFiles(LPCWSTR FileName,
+                                           PFillFindData FillFindData,
+                                           PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.FindFiles(req, find_sink(FillFindData, DokanFileInfo));
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  SetFileAttributes(LPCWSTR FileName, DWORD FileAttributes,
+                    PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.SetFileAttributes(req, FileAttributes);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK SetFileTime(LPCWSTR FileName,
+                                             CONST FILETIME *CreationTime,
+                                             CONST FILETIME *LastAccessTime,
+                                             CONST FILETIME *LastWriteTime,
+                                             PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.SetFileTime(req, CreationTime, LastAccessTime, LastWriteTime);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK DeleteFile(LPCWSTR FileName,
+                                            PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [](FileSystem &fs, request &req) {
+      return fs.DeleteFile(req);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  DeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [](FileSystem &fs, request &req) {
+      return fs.DeleteDirectory(req);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK MoveFile(LPCWSTR FileName,
+                                          LPCWSTR NewFileName,
+                                          BOOL ReplaceIfExisting,
+                                          PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.MoveFile(req, std::wstring_view(NewFileName),
+                         ReplaceIfExisting != FALSE);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK SetEndOfFile(LPCWSTR FileName,
+                                              LONGLONG ByteOffset,
+                                              PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.SetEndOfFile(req, ByteOffset);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  SetAllocationSize(LPCWSTR FileName, LONGLONG AllocSize,
+                    PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(FileName, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.SetAllocationSize(req, AllocSize);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK
+  GetDiskFreeSpace(PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes,
+                   PULONGLONG TotalNumberOfFreeBytes,
+                   PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(NULL, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.GetDiskFreeSpace(req, FreeBytesAvailable, TotalNumberOfBytes,
+                                 TotalNumberOfFreeBytes);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK GetVolumeInformation(
+      LPWSTR VolumeNameBuffer, DWORD VolumeNameSize,
+      LPDWORD VolumeSerialNumber, LPDWORD MaximumComponentLength,
+      LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer,
+      DWORD FileSystemNameSize, PDOKAN_FILE_INFO DokanFileInfo) {
+    return Wait(NULL, DokanFileInfo, [&](FileSystem &fs, request &req) {
+      return fs.GetVolumeInformation(
+          req, VolumeNameBuffer, VolumeNameSize, VolumeSerialNumber,
+          MaximumComponentLength, FileSystemFlags, FileSystemNameBuffer,
+          FileSystemNameSize);
+    });
+  }
+
+  static NTSTATUS DOKAN_CALLBACK Unmounted(PDOKAN_FILE_INFO DokanFileInfo) {
+    Self(DokanFileInfo).cancel_all();
+    return STATUS_SUCCESS;
+  }
+
+  void Bind() {
+    using R = request &;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.ZwCreateFile(req, PDOKAN_IO_SECURITY_CONTEXT{},
+                                    ACCESS_MASK{}, ULONG{}, ULONG{}, ULONG{},
+                                    ULONG{});
+                  })
+      operations_.ZwCreateFile = &ZwCreateFile;
+    if constexpr (requires(FileSystem &fs, R req) { fs.Cleanup(req); })
+      operations_.Cleanup = &Cleanup;
+    if constexpr (kOwnsFiles ||
+                  requires(FileSystem &fs, R req) { fs.CloseFile(req); })
+      operations_.CloseFile = &CloseFile;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.ReadFile(req, LPVOID{}, DWORD{}, LONGLONG{});
+                  })
+      operations_.ReadFile = &ReadFile;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.WriteFile(req, LPCVOID{}, DWORD{}, LONGLONG{});
+                  })
+      operations_.WriteFile = &WriteFile;
+    if constexpr (requires(FileSystem &fs, R req) { fs.FlushFileBuffers(req); })
+      operations_.FlushFileBuffers = &FlushFileBuffers;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.GetFileInformation(req, LPBY_HANDLE_FILE_INFORMATION{});
+                  })
+      operations_.GetFileInformation = &GetFileInformation;
+    if constexpr (requires(FileSystem &fs, R req, find_sink sink) {
+                    fs.FindFiles(req, sink);
+                  })
+      operations_.FindFiles = &FindFiles;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.SetFileAttributes(req, DWORD{});
+                  })
+      operations_.SetFileAttributes = &SetFileAttributes;
+    if constexpr (requires(FileSystem &fs, R req, const FILETIME *time) {
+                    fs.SetFileTime(req, time, time, time);
+                  })
+      operations_.SetFileTime = &SetFileTime;
+    if constexpr (requires(FileSystem &fs, R req) { fs.DeleteFile(req); })
+      operations_.DeleteFile = &DeleteFile;
+    if constexpr (requires(FileSystem &fs, R req) { fs.DeleteDirectory(req); })
+      operations_.DeleteDirectory = &DeleteDirectory;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.MoveFile(req, std::wstring_view{}, bool{});
+                  })
+      operations_.MoveFile = &MoveFile;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.SetEndOfFile(req, LONGLONG{});
+                  })
+      operations_.SetEndOfFile = &SetEndOfFile;
+    if constexpr (requires(FileSystem &fs, R req) {
+                    fs.SetAllocationSize(req, LONGLONG{});
+                  })
+      operations_.SetAllocationSize = &SetAllocationSize;
+    if constexpr (requires(FileSystem &fs, R req, PULONGLONG value) {
+                    fs.GetDiskFreeSpace(req, value, value, value);
+                  })
+      operations_.GetDiskFreeSpace = &GetDiskFreeSpace;
+    if constexpr (requires(FileSystem &fs, R req, LPWSTR name, LPDWORD value) {
+                    fs.GetVolumeInformation(req, name, DWORD{}, value, value,
+                                            value, name, DWORD{});
+                  })
+      operations_.GetVolumeInformation = &GetVolumeInformation;
+    operations_.Unmounted = &Unmounted;
+  }
+
+  void Sweep() {
+    std::unique_lock<std::mutex> lock(sweeperLock_);
+    while (!stopping_) {
+      sweeperCondition_.wait_for(lock, std::chrono::milliseconds(250));
+      tracker_.CancelExpired(GetTickCount64());
+    }
+  }
+
+  FileSystem &fs_;
+  ULONG timeout_;
+  DOKAN_OPERATIONS operations_;
+  detail::RequestTracker tracker_;
+
+  std::mutex sweeperLock_;
+  std::condition_variable sweeperCondition_;
+  bool stopping_ = false;
+  std::thread sweeper_;
+};
+
+} // namespace dokan
+
+#endif // DOKAN_COROUTINE_HPP_
@@ -0,0 +1,542 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_TASK_HPP_
+#define DOKAN_TASK_HPP_
+
+/**
+ * \file dokan_task.hpp
+ * \brief C++20 coroutine primitives used by dokan_coroutine.hpp
+ *
+ * This header does not depend on Windows or on the Dokan library so it can be
+ * used and tested on its own:
+ * - \ref dokan::task, a lazily started coroutine returning a value.
+ * - \ref dokan::executor, worker threads running resumed coroutines, with
+ *   \ref dokan::executor::sleep_for timers.
+ * - \ref dokan::pendable, which runs a task on the calling thread until it
+ *   completes or first suspends. This is how a \c DokanLoop thread serves a
+ *   request inline when the backend answers at once, and hands it over with
+ *   \ref DokanPendRequest otherwise.
+ *
+ * Coroutine frames are recycled in per-thread free lists, so the common path
+ * does not allocate once the lists are warm.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <semaphore>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dokan {
+
+namespace detail {
+
+// Frames up to 64 << (kFrameClasses - 1) bytes are recycled
+constexpr std::size_t kFrameClasses = 8;
+// Frames kept per class and thread
+constexpr std::size_t kFramesPerClass = 256;
+
+inline std::size_t FrameClass(std::size_t size) {
+  std::size_t frameClass = 0;
+  while (frameClass < kFrameClasses && (std::size_t(64) << frameClass) < size)
+    ++frameClass;
+  return frameClass;
+}
+
+// Free lists of the calling thread. Frames are often freed by another thread
+// than the one that allocated them, they then move to the list of that thread.
+class FramePool {
+public:
+  ~FramePool() {
+    for (std::size_t i = 0; i < kFrameClasses; ++i) {
+      while (free_[i] != nullptr) {
+        Node *node = free_[i];
+        free_[i] = node->next;
+        ::operator delete(node);
+      }
+    }
+    destroyed() = true;
+  }
+
+  void *Allocate(std::size_t frameClass) {
+    Node *node = free_[frameClass];
+    if (node == nullptr)
+      return ::operator new(std::size_t(64) << frameClass);
+    free_[frameClass] = node->next;
+    --count_[frameClass];
+    return node;
+  }
+
+  void Deallocate(void *frame, std::size_t frameClass) {
+    if (count_[frameClass] == kFramesPerClass) {
+      ::operator delete(frame);
+      return;
+    }
+    Node *node = static_cast<Node *>(frame);
+    node->next = free_[frameClass];
+    free_[frameClass] = node;
+    ++count_[frameClass];
+  }
+
+  // Frames freed while the thread exits, after its pool is gone
+  static bool &destroyed() {
+    static thread_local bool value = false;
+    return value;
+  }
+
+  static FramePool &current() {
+    static thread_local FramePool pool;
+    return pool;
+  }
+
+private:
+  struct Node {
+    Node *next;
+  };
+  Node *free_[kFrameClasses] = {};
+  std::size_t count_[kFrameClasses] = {};
+};
+
+inline void *AllocateFrame(std::size_t size) {
+  std::size_t frameClass = FrameClass(size);
+  if (frameClass == kFrameClasses || FramePool::destroyed())
+    return ::operator new(size);
+  return FramePool::current().Allocate(frameClass);
+}
+
+inline void DeallocateFrame(void *frame, std::size_t size) {
+  std::size_t frameClass = FrameClass(size);
+  if (frameClass == kFrameClasses || FramePool::destroyed()) {
+    ::operator delete(frame);
+    return;
+  }
+  FramePool::current().Deallocate(frame, frameClass);
+}
+
+// Coroutine frames of the promises deriving from it come from the pool
+struct PooledFrame {
+  static void *operator new(std::size_t size) { return AllocateFrame(size); }
+  static void operator delete(void *frame, std::size_t size) {
+    DeallocateFrame(frame, size);
+  }
+};
+
+// Resumes the awaiting coroutine when a task ends
+template <class Promise> struct FinalAwaiter {
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    std::coroutine_handle<> continuation = handle.promise().continuation;
+    if (continuation)
+      return continuation;
+    return std::noop_coroutine();
+  }
+  void await_resume() const noexcept {}
+};
+
+struct TaskPromiseBase : PooledFrame {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template <class T> struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+
+  template <class U> void return_value(U &&result) {
+    value.emplace(std::forward<U>(result));
+  }
+  T result() {
+    if (exception)
+      std::rethrow_exception(exception);
+    return std::move(*value);
+  }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase {
+  void return_void() const noexcept {}
+  void result() {
+    if (exception)
+      std::rethrow_exception(exception);
+  }
+};
+
+} // namespace detail
+
+/**
+ * \brief Coroutine returning a \c T, started when it is awaited.
+ *
+ * A task is awaited once, by \c co_await from another coroutine or through
+ * \ref pendable. Exceptions thrown by the coroutine are rethrown to the
+ * awaiter.
+ */
+template <class T = void> class [[nodiscard]] task {
+public:
+  struct promise_type : detail::TaskPromise<T> {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    detail::FinalAwaiter<promise_type> final_suspend() const noexcept {
+      return {};
+    }
+  };
+
+  task() = default;
+  task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+      bool await_ready() const noexcept { return !handle || handle.done(); }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+      T await_resume() { return handle.promise().result(); }
+    };
+    return Awaiter{handle_};
+  }
+  auto operator co_await() & noexcept { return std::move(*this).operator co_await(); }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * \brief Worker threads resuming coroutines.
+ *
+ * Coroutines move to a worker with \c co_await \c executor.schedule() and
+ * wait without holding a thread with \c co_await \c executor.sleep_for(d).
+ * Each worker runs as many suspended requests as are ready, so a few threads
+ * serve many requests in flight.
+ *
+ * The destructor fires the remaining timers and runs the queued coroutines
+ * before it joins the threads.
+ */
+class executor {
+public:
+  explicit executor(unsigned threads = std::thread::hardware_concurrency()) {
+    if (threads == 0)
+      threads = 1;
+    for (unsigned i = 0; i < threads; ++i)
+      workers_.emplace_back([this] { RunWorker(); });
+    timer_ = std::thread([this] { RunTimers(); });
+  }
+
+  ~executor() {
+    {
+      std::lock_guard<std::mutex> lock(timerLock_);
+      stopping_ = true;
+    }
+    timerCondition_.notify_all();
+    timer_.join();
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      stopped_ = true;
+    }
+    condition_.notify_all();
+    for (std::thread &worker : workers_)
+      worker.join();
+  }
+
+  executor(const executor &) = delete;
+  executor &operator=(const executor &) = delete;
+
+  /** \brief Queue a suspended coroutine to be resumed by a worker */
+  void post(std::coroutine_handle<> handle) {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      queue_.push_back(handle);
+    }
+    condition_.notify_one();
+  }
+
+  /** \brief Awaitable continuing the coroutine on a worker thread */
+  auto schedule() noexcept {
+    struct Awaiter {
+      executor *owner;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle) { owner->post(handle); }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{this};
+  }
+
+  /** \brief Awaitable continuing the coroutine on a worker after \c delay */
+  auto sleep_for(std::chrono::nanoseconds delay) noexcept {
+    struct Awaiter {
+      executor *owner;
+      std::chrono::nanoseconds delay;
+      bool await_ready() const noexcept { return delay.count() <= 0; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        owner->AddTimer(std::chrono::steady_clock::now() + delay, handle);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{this, delay};
+  }
+
+  /** \brief Number of worker threads */
+  std::size_t thread_count() const noexcept { return workers_.size(); }
+
+private:
+  struct Timer {
+    std::chrono::steady_clock::time_point due;
+    std::uint64_t sequence;
+    std::coroutine_handle<> handle;
+    bool operator>(const Timer &other) const {
+      return due != other.due ? due > other.due : sequence > other.sequence;
+    }
+  };
+
+  void AddTimer(std::chrono::steady_clock::time_point due,
+                std::coroutine_handle<> handle) {
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(timerLock_);
+      first = timers_.empty() || due < timers_.top().due;
+      timers_.push(Timer{due, timerSequence_++, handle});
+    }
+    if (first)
+      timerCondition_.notify_one();
+  }
+
+  void RunTimers() {
+    std::unique_lock<std::mutex> lock(timerLock_);
+    for (;;) {
+      if (timers_.empty()) {
+        if (stopping_)
+          return;
+        timerCondition_.wait(lock);
+        continue;
+      }
+      if (!stopping_ && timers_.top().due > std::chrono::steady_clock::now()) {
+        timerCondition_.wait_until(lock, timers_.top().due);
+        continue;
+      }
+      std::coroutine_handle<> handle = timers_.top().handle;
+      timers_.pop();
+      lock.unlock();
+      post(handle);
+      lock.lock();
+    }
+  }
+
+  void RunWorker() {
+    std::unique_lock<std::mutex> lock(lock_);
+    for (;;) {
+      if (queue_.empty()) {
+        if (stopped_)
+          return;
+        condition_.wait(lock);
+        continue;
+      }
+      std::coroutine_handle<> handle = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+      handle.resume();
+      lock.lock();
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable condition_;
+  std::deque<std::coroutine_handle<>> queue_;
+  bool stopped_ = false;
+  std::vector<std::thread> workers_;
+
+  std::mutex timerLock_;
+  std::condition_variable timerCondition_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+  std::uint64_t timerSequence_ = 0;
+  bool stopping_ = false;
+  std::thread timer_;
+};
+
+/**
+ * \brief Runs a task inline and hands it over if it suspends.
+ *
+ * \ref start resumes the task on the calling thread. If it returns \c true the
+ * task completed without suspending and \ref result can be read. Otherwise the
+ * caller gives a completion function to \ref detach, which is called exactly
+ * once with the result, by the thread that finishes the task, or by
+ * \ref detach itself if the task finished in between.
+ *
+ * An exception escaping the task is replaced by the \c on_exception value.
+ */
+template <class T> class pendable {
+public:
+  /** \brief Called with the result of a detached task */
+  using complete_fn = void (*)(void *token, T result);
+
+  pendable(task<T> body, T on_exception)
+      : handle_(Run(std::move(body), std::move(on_exception)).handle) {}
+  pendable(const pendable &) = delete;
+  pendable &operator=(const pendable &) = delete;
+  ~pendable() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  /** \brief Run the task until it completes or suspends */
+  bool start() {
+    handle_.resume();
+    return handle_.promise().state.load(std::memory_order_acquire) == kDone;
+  }
+
+  /** \brief Result of a task that completed in \ref start */
+  T result() { return std::move(*handle_.promise().value); }
+
+  /**
+   * \brief Let the task complete on its own after \ref start returned false.
+   *
+   * The pendable no longer owns the task once detached.
+   */
+  void detach(void *token, complete_fn complete) {
+    Promise &promise = handle_.promise();
+    std::coroutine_handle<Promise> handle = std::exchange(handle_, {});
+    promise.token = token;
+    promise.complete = complete;
+    if (promise.state.exchange(kDetached, std::memory_order_acq_rel) == kDone) {
+      complete(token, std::move(*promise.value));
+      handle.destroy();
+    }
+  }
+
+  /**
+   * \brief Block until a task that did not complete in \ref start completes.
+   */
+  T join() {
+    struct Waiter {
+      std::binary_semaphore done{0};
+      std::optional<T> value;
+    };
+    Waiter waiter;
+    detach(&waiter, [](void *token, T result) {
+      Waiter *waiter = static_cast<Waiter *>(token);
+      waiter->value.emplace(std::move(result));
+      waiter->done.release();
+    });
+    waiter.done.acquire();
+    return std::move(*waiter.value);
+  }
+
+  /**
+   * \brief Run a task from a thread that can block until it completes.
+   */
+  static T wait(task<T> body, T on_exception) {
+    pendable call(std::move(body), std::move(on_exception));
+    if (call.start())
+      return call.result();
+    return call.join();
+  }
+
+private:
+  static constexpr int kRunning = 0;
+  static constexpr int kDone = 1;
+  static constexpr int kDetached = 2;
+
+  struct Promise;
+
+  struct Driver {
+    using promise_type = Promise;
+    std::coroutine_handle<Promise> handle;
+  };
+
+  // Whoever of the task and detach() comes second reports the result
+  struct CompleteAwaiter {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      Promise &promise = handle.promise();
+      if (promise.state.exchange(kDone, std::memory_order_acq_rel) ==
+          kDetached) {
+        promise.complete(promise.token, std::move(*promise.value));
+        handle.destroy();
+      }
+    }
+    void await_resume() const noexcept {}
+  };
+
+  struct Promise : detail::PooledFrame {
+    std::atomic<int> state{kRunning};
+    std::optional<T> value;
+    void *token = nullptr;
+    complete_fn complete = nullptr;
+
+    Driver get_return_object() {
+      return Driver{std::coroutine_handle<Promise>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    CompleteAwaiter final_suspend() const noexcept { return {}; }
+    template <class U> void return_value(U &&result) {
+      value.emplace(std::forward<U>(result));
+    }
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  static Driver Run(task<T> body, T on_exception) {
+    std::optional<T> result;
+    try {
+      result.emplace(co_await std::move(body));
+    } catch (...) {
+      result.emplace(std::move(on_exception));
+    }
+    co_return std::move(*result);
+  }
+
+  std::coroutine_handle<Promise> handle_;
+};
+
+} // namespace dokan
+
+#endif // DOKAN_TASK_HPP_
@@ -44,7 +44,10 @@ extern "C" {
 
 #define DOKAN_KEEPALIVE_TIME 3000 // in miliseconds
 
-#define DOKAN_MAX_THREAD 63
+#define DOKAN_MAX_THREAD 512
+
+// Number of idle DokanLoop threads above which a dynamic pool shrinks
+#define DOKAN_DYNAMIC_THREAD_IDLE_MIN 2
 
 // DokanOptions->DebugMode is ON?
 extern BOOL g_DebugMode;
@@ -27,14 +27,24 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #undef WIN32_NO_STATUS
 #include <stdio.h>
 
+#include "blockcache.h"
 #include "dokan.h"
 #include "dokanc.h"
 #include "list.h"
+#include "pendingrequest.h"
+#include "securitycache.h"
+#include "writegather.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#if defined(_MSC_VER)
+#define DOKAN_THREAD_LOCAL __declspec(thread)
+#else
+#define DOKAN_THREAD_LOCAL __thread
+#endif
+
 /**
  * \struct DOKAN_INSTANCE
  * \brief Dokan mount instance informations
@@ -44,6 +54,55 @@ extern "C" {
  * \see DOKAN_OPTIONS
  * \see DOKAN_OPERATIONS
  */
+// Most NUMA nodes or processors the DokanLoop threads of an instance are
+// spread over with DOKAN_OPTION_NUMA_AFFINITY or DOKAN_OPTION_CPU_AFFINITY
+#define DOKAN_MAX_AFFINITY_GROUPS 256
+
+// Entries allocated at once when the handle table of an instance grows
+#define DOKAN_OPEN_INFO_SLAB_SIZE 1024
+// Up to 1M files opened at the same time on an instance
+#define DOKAN_OPEN_INFO_MAX_SLABS 1024
+
+// Longest timeout the driver accepts, DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX
+#define DOKAN_RESET_TIMEOUT_MAX (1000 * 60 * 5)
+// Time the unmount gives pended requests before failing them, the default
+// timeout of the driver DOKAN_IRP_PENDING_TIMEOUT
+#define DOKAN_PENDING_REQUEST_UNMOUNT_TIMEOUT (1000 * 15)
+
+/**
+ * \struct DOKAN_OPEN_INFO_TABLE
+ * \brief Open files of an instance
+ *
+ * Entries are allocated by slabs that are only freed with the instance, so a
+ * stale handle from the driver always points to a valid entry whose
+ * generation no longer matches.
+ */
+typedef struct _DOKAN_OPEN_INFO_TABLE {
+  /** Entries that are not in use */
+  SLIST_HEADER FreeList;
+  /** Slabs of DOKAN_OPEN_INFO_SLAB_SIZE entries */
+  struct _DOKAN_OPEN_INFO *volatile Slabs[DOKAN_OPEN_INFO_MAX_SLABS];
+  /** Number of slabs allocated */
+  volatile LONG SlabCount;
+  /** Serializes the allocation of slabs */
+  CRITICAL_SECTION GrowLock;
+} DOKAN_OPEN_INFO_TABLE, *PDOKAN_OPEN_INFO_TABLE;
+
+/**
+ * \struct DOKAN_VOLUME_INFORMATION
+ * \brief Answers of the GetVolumeInformation and GetDiskFreeSpace callbacks
+ */
+typedef struct _DOKAN_VOLUME_INFORMATION {
+  WCHAR VolumeName[MAX_PATH];
+  DWORD VolumeSerialNumber;
+  DWORD MaximumComponentLength;
+  DWORD FileSystemFlags;
+  WCHAR FileSystemName[MAX_PATH];
+  ULONGLONG FreeBytesAvailable;
+  ULONGLONG TotalNumberOfBytes;
+  ULONGLONG TotalNumberOfFreeBytes;
+} DOKAN_VOLUME_INFORMATION, *PDOKAN_VOLUME_INFORMATION;
+
 typedef struct _DOKAN_INSTANCE {
   /** to ensure that unmount dispatch is called at once */
   CRITICAL_SECTION CriticalSection;
@@ -70,19 +129,119 @@ typedef struct _DOKAN_INSTANCE {
 
   /** Current list entry informations */
   LIST_ENTRY ListEntry;
+
+  /** Number of running DokanLoop threads */
+  volatile LONG ThreadCount;
+  /** Number of DokanLoop threads waiting for an event from the driver */
+  volatile LONG IdleThreadCount;
+  /** Lower bound of ThreadCount when the pool shrinks */
+  LONG MinThreadCount;
+  /** Upper bound of ThreadCount when the pool grows */
+  LONG MaxThreadCount;
+  /** Signaled when the last DokanLoop thread has exited */
+  HANDLE ThreadsStoppedEvent;
+
+  /** Request counters, updated with Interlocked functions */
+  DOKAN_STATISTICS Statistics;
+  /** GetTickCount64 value when the mount started */
+  ULONGLONG StartTime;
+  /** Signaled to stop the DOKAN_OPTION_DUMP_STATISTICS thread */
+  HANDLE StatisticsStopEvent;
+
+  /** Files opened on the mount */
+  DOKAN_OPEN_INFO_TABLE OpenInfoTable;
+
+  /** Number of NUMA nodes or processors the threads are spread over */
+  ULONG AffinityGroupCount;
+  /** Threads bound so far, the next one goes to this group modulo the count */
+  volatile LONG AffinityNextThread;
+  /** Processors each group of threads runs on */
+  GROUP_AFFINITY AffinityMasks[DOKAN_MAX_AFFINITY_GROUPS];
+  /** NUMA node of each group of threads */
+  USHORT AffinityNodes[DOKAN_MAX_AFFINITY_GROUPS];
+
+  /** Requests pended with DokanPendRequest and not completed yet */
+  PDOKAN_PENDING_REQUESTS PendingRequests;
+  /** Overlapped device handle replies of pended requests are sent on */
+  HANDLE volatile AsyncDevice;
+  /** Events of the ioctls sent on AsyncDevice, when they are not in use */
+  SLIST_HEADER AsyncEvents;
+
+  /** Cache of DOKAN_OPTION_BLOCK_CACHE, NULL without it */
+  PDOKAN_BLOCK_CACHE BlockCache;
+
+  /** Answers kept by DOKAN_OPTION_CACHE_VOLUME_INFORMATION */
+  DOKAN_VOLUME_INFORMATION VolumeInformation;
+  /** GetTickCount64 value VolumeInformation expires at, 0 when it has none */
+  ULONGLONG VolumeInformationExpiry;
+  /** Milliseconds VolumeInformation is kept */
+  ULONG VolumeInformationValidity;
+  /** Protects the three fields above */
+  SRWLOCK VolumeInformationLock;
+  /** Serializes the callers of the volume callbacks that refresh it */
+  SRWLOCK VolumeInformationRefreshLock;
+
+  /** Cache of DOKAN_OPTION_CACHE_SECURITY, NULL without it */
+  PDOKAN_SECURITY_CACHE SecurityCache;
+
+  /** Open files with writes gathered by DOKAN_OPTION_WRITE_GATHERING */
+  LIST_ENTRY WriteGatherList;
+  /** Protects WriteGatherList and the WriteGatherEntry of the open files */
+  SRWLOCK WriteGatherListLock;
+  /** Signaled to stop the thread that flushes expired gathered writes */
+  HANDLE WriteGatherStopEvent;
 } DOKAN_INSTANCE, *PDOKAN_INSTANCE;
 
+/**
+ * \struct DOKAN_CACHE_KEY
+ * \brief Upper cased name of a file in the block and security caches
+ *
+ * The driver compares names without case, so every spelling of a name shares
+ * the same cache entries.
+ */
+typedef struct _DOKAN_CACHE_KEY {
+  WCHAR Buffer[MAX_PATH];
+  LPWSTR Name;
+  ULONG Length;
+} DOKAN_CACHE_KEY, *PDOKAN_CACHE_KEY;
+
+/**
+ * \struct DOKAN_FILE_NAME
+ * \brief Name of an opened file kept for events that omit it
+ *
+ * It is immutable and counts its references, so requests can keep using a
+ * name while a later event of the handle replaces it.
+ */
+typedef struct _DOKAN_FILE_NAME {
+  /** Number of references, updated with Interlocked functions */
+  volatile LONG References;
+  /** EVENT_CONTEXT.NameGeneration of the name */
+  ULONG Generation;
+  /** Name after CheckFileName */
+  WCHAR Name[1];
+} DOKAN_FILE_NAME, *PDOKAN_FILE_NAME;
+
 /**
  * \struct DOKAN_OPEN_INFO
  * \brief Dokan open file informations
  *
- * This is created in CreateFile and will be freed in CloseFile.
+ * This is taken from the handle table of the instance in CreateFile and given
+ * back in CloseFile. The driver only sees its handle.
  */
 typedef struct _DOKAN_OPEN_INFO {
+  /** Entry in the free list of the handle table */
+  SLIST_ENTRY FreeEntry;
+  /**
+   * Generation of the entry in the high 32 bits and number of references in
+   * the low 32 bits, updated with Interlocked functions
+   */
+  volatile LONG64 State;
+  /** Handle given to the driver as Context */
+  ULONG64 Handle;
+  /** Index of the entry in the handle table */
+  ULONG Index;
   /** DOKAN_OPTIONS linked to the mount */
   BOOL IsDirectory;
-  /** Open count on the file */
-  ULONG OpenCount;
   /** Event context */
   PEVENT_CONTEXT EventContext;
   /** Dokan instance linked to the open */
@@ -95,14 +254,75 @@ typedef struct _DOKAN_OPEN_INFO {
   PLIST_ENTRY DirListHead;
   /** File streams list. Used by FindStreams */
   PLIST_ENTRY StreamListHead;
+  /** Last name received for the handle, see DokanGetEventFileName */
+  PDOKAN_FILE_NAME FileName;
+  /** Generation of FileName, acknowledged to the driver in replies */
+  volatile ULONG FileNameGeneration;
+  /** Protects FileName */
+  SRWLOCK FileNameLock;
+  /** Writes gathered by DOKAN_OPTION_WRITE_GATHERING, created on first use */
+  PDOKAN_WRITE_GATHER WriteGather;
+  /** Entry in WriteGatherList of the instance, Flink is NULL when unlisted */
+  LIST_ENTRY WriteGatherEntry;
+  /** Process of the last gathered write, given to the WriteFile that flushes */
+  ULONG WriteGatherProcessId;
 } DOKAN_OPEN_INFO, *PDOKAN_OPEN_INFO;
 
+/**
+ * \struct DOKAN_REQUEST
+ * \brief Read or write request whose reply is sent by DokanCompleteRequest
+ *
+ * DispatchRead and DispatchWrite describe their request with it while the
+ * callback runs. DokanPendRequest gives the callback a copy that owns the
+ * reply.
+ */
+typedef struct _DOKAN_REQUEST {
+  /** Entry in PendingRequests of the instance once pended, first so that the
+   * request can be cast from it */
+  DOKAN_PENDING_REQUEST Pending;
+  /** Dokan instance the request was received on */
+  PDOKAN_INSTANCE DokanInstance;
+  /** Handle the request is on, NULL if the driver sent none */
+  PDOKAN_OPEN_INFO OpenInfo;
+  /** DOKAN_FILE_INFO.Context when pended, given back to OpenInfo when the
+   * request completes */
+  ULONG64 Context;
+  /** Reply sent to the driver, owned by the request once pended */
+  PEVENT_INFORMATION EventInfo;
+  /** Size of EventInfo */
+  ULONG EventLength;
+  /** IRP_MJ_READ or IRP_MJ_WRITE */
+  UCHAR MajorFunction;
+  /** Bytes requested */
+  ULONG Length;
+  /** Offset of the request in the file */
+  LONGLONG ByteOffset;
+  /** Block cache change of a write, ended when the write completes */
+  PDOKAN_BLOCK_CACHE_FILE CacheChange;
+} DOKAN_REQUEST;
+
+extern CRITICAL_SECTION g_InstanceCriticalSection;
+extern LIST_ENTRY g_InstanceList;
+
 BOOL DokanStart(PDOKAN_INSTANCE Instance);
 
+// Sends a synchronous ioctl on a device handle
+BOOL DokanDeviceIoControl(HANDLE Device, DWORD IoControlCode,
+                          PVOID InputBuffer, ULONG InputLength,
+                          PVOID OutputBuffer, ULONG OutputLength,
+                          PULONG ReturnedLength);
+
 BOOL SendToDevice(LPCWSTR DeviceName, DWORD IoControlCode, PVOID InputBuffer,
                   ULONG InputLength, PVOID OutputBuffer, ULONG OutputLength,
                   PULONG ReturnedLength);
 
+// Sends an ioctl that has no output from any thread
+BOOL DokanSendAsyncIoctl(PDOKAN_INSTANCE DokanInstance, DWORD IoControlCode,
+                         PVOID InputBuffer, ULONG InputLength);
+
+// Closes the device handle and events of DokanSendAsyncIoctl
+VOID DokanAsyncDeviceCleanup(PDOKAN_INSTANCE DokanInstance);
+
 VOID
 GetRawDeviceName(LPCWSTR DeviceName, LPWSTR DestinationBuffer,
                  rsize_t DestinationBufferSizeInElements);
@@ -111,14 +331,50 @@ void ALIGN_ALLOCATION_SIZE(PLARGE_INTEGER size, PDOKAN_OPTIONS DokanOptions);
 
 UINT __stdcall DokanLoop(PVOID Param);
 
+BOOL StartDokanLoopThread(PDOKAN_INSTANCE DokanInstance);
+
 BOOL DokanMount(LPCWSTR MountPoint, LPCWSTR DeviceName,
                 PDOKAN_OPTIONS DokanOptions);
 
 BOOL IsMountPointDriveLetter(LPCWSTR mountPoint);
 
+// Compares two mount points, drive letters with or without ":\" are equal
+BOOL IsSameMountPoint(LPCWSTR MountPoint, LPCWSTR Other);
+
 VOID SendEventInformation(HANDLE Handle, PEVENT_INFORMATION EventInfo,
                           ULONG EventLength, PDOKAN_INSTANCE DokanInstance);
 
+VOID DokanDispatchEvent(HANDLE Device, PEVENT_CONTEXT EventContext,
+                        PDOKAN_INSTANCE DokanInstance);
+
+LONGLONG DokanStatisticsBeginDispatch();
+
+VOID DokanStatisticsEndDispatch(PDOKAN_INSTANCE DokanInstance,
+                                PEVENT_CONTEXT EventContext,
+                                LONGLONG DispatchStart);
+
+VOID DokanStatisticsReply(PEVENT_INFORMATION EventInfo, ULONG EventLength);
+
+VOID DokanStatisticsCallbackBegin();
+
+VOID DokanStatisticsCallbackEnd();
+
+VOID DokanDumpStatistics(PDOKAN_INSTANCE DokanInstance);
+
+UINT __stdcall DokanStatisticsDumpThread(PVOID Param);
+
+VOID DokanSetDispatchDevice(HANDLE Device);
+
+VOID DokanTraceDispatch(PEVENT_CONTEXT EventContext, LONGLONG DispatchStart,
+                        NTSTATUS Status, ULONG BytesIn, ULONG BytesOut,
+                        ULONG CallbackTime, ULONG DispatchTime);
+
+VOID DokanTraceThreadStopped();
+
+VOID DokanTraceStart();
+
+VOID DokanTraceCleanup();
+
 PEVENT_INFORMATION
 DispatchCommon(PEVENT_CONTEXT EventContext, ULONG SizeOfEventInfo,
                PDOKAN_INSTANCE DokanInstance, PDOKAN_FILE_INFO DokanFileInfo,
@@ -130,9 +386,25 @@ VOID DispatchDirectoryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
 VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                               PDOKAN_INSTANCE DokanInstance);
 
+// Length of a reply with BufferLength bytes of Buffer that ends with an
+// EVENT_FILE_ATTRIBUTES block
+#define DOKAN_REPLY_WITH_ATTRIBUTES_LENGTH(BufferLength)                       \
+  ((((ULONG)FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (BufferLength) + 7) &    \
+    ~7UL) +                                                                    \
+   sizeof(EVENT_FILE_ATTRIBUTES))
+
+// Writes the attributes in the last bytes of the EventLength long reply
+VOID DokanAttachFileAttributes(PEVENT_INFORMATION EventInfo, ULONG EventLength,
+                               PBY_HANDLE_FILE_INFORMATION FileInfo,
+                               PDOKAN_INSTANCE DokanInstance);
+
 VOID DispatchQueryVolumeInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                                     PDOKAN_INSTANCE DokanInstance);
 
+// Calls the volume callbacks and gives their answers to the driver when
+// DOKAN_OPTION_CACHE_VOLUME_INFORMATION is set
+VOID DokanVolumeInformationMounted(PDOKAN_INSTANCE DokanInstance);
+
 VOID DispatchSetInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                             PDOKAN_INSTANCE DokanInstance);
 
@@ -190,6 +462,96 @@ VOID ClearFindStreamData(PLIST_ENTRY ListHead);
 
 UINT WINAPI DokanKeepAlive(PVOID Param);
 
+VOID DokanAffinityInit(PDOKAN_INSTANCE DokanInstance);
+
+BOOL DokanAffinityBindThread(PDOKAN_INSTANCE DokanInstance,
+                             PEVENT_WAIT_AFFINITY Affinity, PUSHORT Node);
+
+PVOID DokanAffinityAllocBuffer(BOOL Bound, USHORT Node, SIZE_T Size);
+
+VOID DokanAffinityFreeBuffer(PVOID Buffer);
+
+VOID DokanBeginPendableRequest(PDOKAN_REQUEST Request,
+                               PDOKAN_FILE_INFO DokanFileInfo);
+
+PDOKAN_REQUEST DokanEndPendableRequest();
+
+VOID DokanFinishRequest(PDOKAN_REQUEST Request, NTSTATUS Status, ULONG Bytes);
+
+VOID DokanWaitPendingRequests(PDOKAN_INSTANCE DokanInstance);
+
+VOID DokanAsyncCleanup(PDOKAN_INSTANCE DokanInstance);
+
+// Writes the writes gathered for the handle. Returns the status of the write,
+// or of a previous one that failed without being reported.
+NTSTATUS DokanFlushGatheredWrites(PDOKAN_INSTANCE DokanInstance,
+                                  PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                                  PDOKAN_FILE_INFO DokanFileInfo);
+
+// Same as DokanFlushGatheredWrites, only when they overlap the read range
+NTSTATUS DokanFlushGatheredRange(PDOKAN_INSTANCE DokanInstance,
+                                 PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                                 PDOKAN_FILE_INFO DokanFileInfo,
+                                 LONGLONG Offset, ULONG Length);
+
+// Flushes the writes gathered for a handle being closed and stops tracking it
+VOID DokanCloseGatheredWrites(PDOKAN_INSTANCE DokanInstance,
+                              PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                              PDOKAN_FILE_INFO DokanFileInfo);
+
+UINT __stdcall DokanWriteGatherThread(PVOID Param);
+
+NTSTATUS DokanCacheReadFile(PDOKAN_INSTANCE DokanInstance, LPCWSTR FileName,
+                            LPVOID Buffer, DWORD BufferLength,
+                            LPDWORD ReadLength, LONGLONG Offset,
+                            PDOKAN_FILE_INFO DokanFileInfo);
+
+PDOKAN_BLOCK_CACHE_FILE DokanCacheBeginChange(PDOKAN_INSTANCE DokanInstance,
+                                              LPCWSTR FileName,
+                                              ULONG64 Offset, ULONG64 Length);
+
+VOID DokanCacheEndChange(PDOKAN_INSTANCE DokanInstance,
+                         PDOKAN_BLOCK_CACHE_FILE Change);
+
+VOID DokanCacheInvalidateChildren(PDOKAN_INSTANCE DokanInstance,
+                                  LPCWSTR DirectoryName);
+
+BOOL DokanCacheMakeKey(LPCWSTR FileName, BOOL Directory, PDOKAN_CACHE_KEY Key);
+
+VOID DokanCacheFreeKey(PDOKAN_CACHE_KEY Key);
+
+// Drops the security descriptors cached for the file, and for the files below
+// it when it is a directory
+VOID DokanSecurityCacheChanged(PDOKAN_INSTANCE DokanInstance,
+                               LPCWSTR FileName, BOOL Directory);
+
+VOID DokanOpenInfoTableInit(PDOKAN_INSTANCE DokanInstance);
+
+VOID DokanOpenInfoTableCleanup(PDOKAN_INSTANCE DokanInstance);
+
+PDOKAN_OPEN_INFO
+DokanAllocateOpenInfo(PDOKAN_INSTANCE DokanInstance, LONG References);
+
+VOID DokanFreeOpenInfo(PDOKAN_INSTANCE DokanInstance,
+                       PDOKAN_OPEN_INFO OpenInfo);
+
+BOOL DokanReleaseOpenInfoReference(PDOKAN_INSTANCE DokanInstance,
+                                   PDOKAN_OPEN_INFO OpenInfo);
+
+PLIST_ENTRY DokanGetOpenInfoList(PLIST_ENTRY *ListHead);
+
+VOID DokanSetOpenInfoFileName(PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                              ULONG Generation);
+
+LPWSTR DokanGetEventFileName(PEVENT_CONTEXT EventContext,
+                             PDOKAN_OPEN_INFO OpenInfo, LPWSTR FileName,
+                             ULONG FileNameLength,
+                             PDOKAN_FILE_NAME *Reference);
+
+VOID DokanReleaseFileName(PDOKAN_FILE_NAME FileName);
+
+PDOKAN_FILE_NAME DokanReferenceOpenInfoFileName(PDOKAN_OPEN_INFO OpenInfo);
+
 PDOKAN_OPEN_INFO
 GetDokanOpenInfo(PEVENT_CONTEXT EventInfomation, PDOKAN_INSTANCE DokanInstance);
 
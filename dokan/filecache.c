@@ -0,0 +1,146 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+
+// Context of the block fetches of a cached read
+typedef struct _DOKAN_CACHE_READ {
+  PDOKAN_INSTANCE DokanInstance;
+  LPCWSTR FileName;
+  PDOKAN_FILE_INFO DokanFileInfo;
+} DOKAN_CACHE_READ, *PDOKAN_CACHE_READ;
+
+// Directory keys end with a backslash to only match the files below it
+BOOL DokanCacheMakeKey(LPCWSTR FileName, BOOL Directory, PDOKAN_CACHE_KEY Key) {
+  size_t length = wcslen(FileName);
+
+  Key->Name = Key->Buffer;
+  if (length + 2 > MAX_PATH) {
+    Key->Name = (LPWSTR)malloc((length + 2) * sizeof(WCHAR));
+    if (Key->Name == NULL)
+      return FALSE;
+  }
+  RtlCopyMemory(Key->Name, FileName, length * sizeof(WCHAR));
+  CharUpperBuffW(Key->Name, (DWORD)length);
+  if (Directory && (length == 0 || Key->Name[length - 1] != L'\\'))
+    Key->Name[length++] = L'\\';
+  Key->Length = (ULONG)(length * sizeof(WCHAR));
+  return TRUE;
+}
+
+VOID DokanCacheFreeKey(PDOKAN_CACHE_KEY Key) {
+  if (Key->Name != Key->Buffer)
+    free(Key->Name);
+}
+
+// Reads a block with the ReadFile callback. The request is not pendable at
+// this point so the callback completes synchronously.
+static int32_t DokanCacheFetch(void *Context, uint64_t Offset, void *Buffer,
+                               uint32_t Length, uint32_t *Read) {
+  PDOKAN_CACHE_READ read = (PDOKAN_CACHE_READ)Context;
+  DWORD readLength = 0;
+  NTSTATUS status;
+
+  DokanStatisticsCallbackBegin();
+  status = read->DokanInstance->DokanOperations->ReadFile(
+      read->FileName, Buffer, Length, &readLength, (LONGLONG)Offset,
+      read->DokanFileInfo);
+  DokanStatisticsCallbackEnd();
+
+  *Read = readLength < Length ? readLength : Length;
+  if (status == STATUS_END_OF_FILE) {
+    *Read = 0;
+    return STATUS_SUCCESS;
+  }
+  if (status == STATUS_PENDING) {
+    DbgPrint("Dokan Error: ReadFile returned STATUS_PENDING without "
+             "DokanPendRequest\n");
+    return STATUS_INTERNAL_ERROR;
+  }
+  return status;
+}
+
+NTSTATUS DokanCacheReadFile(PDOKAN_INSTANCE DokanInstance, LPCWSTR FileName,
+                            LPVOID Buffer, DWORD BufferLength,
+                            LPDWORD ReadLength, LONGLONG Offset,
+                            PDOKAN_FILE_INFO DokanFileInfo) {
+  DOKAN_CACHE_KEY key;
+  DOKAN_CACHE_READ read;
+  uint32_t readLength = 0;
+  NTSTATUS status;
+
+  read.DokanInstance = DokanInstance;
+  read.FileName = FileName;
+  read.DokanFileInfo = DokanFileInfo;
+
+  if (Offset < 0 || !DokanCacheMakeKey(FileName, FALSE, &key)) {
+    status = DokanCacheFetch(&read, (uint64_t)Offset, Buffer, BufferLength,
+                             &readLength);
+  } else {
+    status = DokanBlockCacheRead(DokanInstance->BlockCache, key.Name,
+                                 key.Length, (uint64_t)Offset, Buffer,
+                                 BufferLength, &readLength, DokanCacheFetch,
+                                 &read);
+    DokanCacheFreeKey(&key);
+  }
+  *ReadLength = readLength;
+  return status;
+}
+
+PDOKAN_BLOCK_CACHE_FILE DokanCacheBeginChange(PDOKAN_INSTANCE DokanInstance,
+                                              LPCWSTR FileName,
+                                              ULONG64 Offset, ULONG64 Length) {
+  DOKAN_CACHE_KEY key;
+  PDOKAN_BLOCK_CACHE_FILE change;
+
+  if (DokanInstance->BlockCache == NULL)
+    return NULL;
+
+  // Without a key the change applies to every file
+  if (!DokanCacheMakeKey(FileName, FALSE, &key))
+    return DokanBlockCacheBeginChange(DokanInstance->BlockCache, NULL, 0,
+                                      Offset, Length);
+  change = DokanBlockCacheBeginChange(DokanInstance->BlockCache, key.Name,
+                                      key.Length, Offset, Length);
+  DokanCacheFreeKey(&key);
+  return change;
+}
+
+VOID DokanCacheEndChange(PDOKAN_INSTANCE DokanInstance,
+                         PDOKAN_BLOCK_CACHE_FILE Change) {
+  if (DokanInstance->BlockCache != NULL)
+    DokanBlockCacheEndChange(DokanInstance->BlockCache, Change);
+}
+
+VOID DokanCacheInvalidateChildren(PDOKAN_INSTANCE DokanInstance,
+                                  LPCWSTR DirectoryName) {
+  DOKAN_CACHE_KEY key;
+
+  if (DokanInstance->BlockCache == NULL)
+    return;
+
+  if (!DokanCacheMakeKey(DirectoryName, TRUE, &key)) {
+    DokanBlockCacheInvalidate(DokanInstance->BlockCache, L"", 0);
+    return;
+  }
+  DokanBlockCacheInvalidate(DokanInstance->BlockCache, key.Name, key.Length);
+  DokanCacheFreeKey(&key);
+}
@@ -114,8 +114,8 @@ DokanFillInternalInfo(PFILE_INTERNAL_INFORMATION InternalInfo,
 NTSTATUS
 DokanFillFileAllInfo(PFILE_ALL_INFORMATION AllInfo,
                      PBY_HANDLE_FILE_INFORMATION FileInfo,
-                     PULONG RemainingLength, PEVENT_CONTEXT EventContext,
-                     PDOKAN_INSTANCE DokanInstance) {
+                     PULONG RemainingLength, LPCWSTR FileName,
+                     ULONG FileNameLength, PDOKAN_INSTANCE DokanInstance) {
   ULONG allRemainingLength = *RemainingLength;
 
   if (*RemainingLength < sizeof(FILE_ALL_INFORMATION)) {
@@ -140,14 +140,11 @@ DokanFillFileAllInfo(PFILE_ALL_INFORMATION AllInfo,
                             RemainingLength);
 
   // there is not enough space to fill FileNameInformation
-  if (allRemainingLength < sizeof(FILE_ALL_INFORMATION) +
-                               EventContext->Operation.File.FileNameLength) {
+  if (allRemainingLength < sizeof(FILE_ALL_INFORMATION) + FileNameLength) {
     // fill out to the limit
     // FileNameInformation
-    AllInfo->NameInformation.FileNameLength =
-        EventContext->Operation.File.FileNameLength;
-    AllInfo->NameInformation.FileName[0] =
-        EventContext->Operation.File.FileName[0];
+    AllInfo->NameInformation.FileNameLength = FileNameLength;
+    AllInfo->NameInformation.FileName[0] = FileName[0];
 
     allRemainingLength -= sizeof(FILE_ALL_INFORMATION);
     *RemainingLength = allRemainingLength;
@@ -155,11 +152,9 @@ DokanFillFileAllInfo(PFILE_ALL_INFORMATION AllInfo,
   }
 
   // FileNameInformation
-  AllInfo->NameInformation.FileNameLength =
-      EventContext->Operation.File.FileNameLength;
-  RtlCopyMemory(&(AllInfo->NameInformation.FileName[0]),
-                EventContext->Operation.File.FileName,
-                EventContext->Operation.File.FileNameLength);
+  AllInfo->NameInformation.FileNameLength = FileNameLength;
+  RtlCopyMemory(&(AllInfo->NameInformation.FileName[0]), FileName,
+                FileNameLength);
 
   // the size except of FILE_NAME_INFORMATION
   allRemainingLength -=
@@ -177,18 +172,17 @@ DokanFillFileAllInfo(PFILE_ALL_INFORMATION AllInfo,
 NTSTATUS
 DokanFillFileNameInfo(PFILE_NAME_INFORMATION NameInfo,
                       PBY_HANDLE_FILE_INFORMATION FileInfo,
-                      PULONG RemainingLength, PEVENT_CONTEXT EventContext) {
+                      PULONG RemainingLength, LPCWSTR FileName,
+                      ULONG FileNameLength) {
 
   UNREFERENCED_PARAMETER(FileInfo);
 
-  if (*RemainingLength < sizeof(FILE_NAME_INFORMATION) +
-                             EventContext->Operation.File.FileNameLength) {
+  if (*RemainingLength < sizeof(FILE_NAME_INFORMATION) + FileNameLength) {
     return STATUS_BUFFER_OVERFLOW;
   }
 
-  NameInfo->FileNameLength = EventContext->Operation.File.FileNameLength;
-  RtlCopyMemory(&(NameInfo->FileName[0]), EventContext->Operation.File.FileName,
-                EventContext->Operation.File.FileNameLength);
+  NameInfo->FileNameLength = FileNameLength;
+  RtlCopyMemory(&(NameInfo->FileName[0]), FileName, FileNameLength);
 
   *RemainingLength -= FIELD_OFFSET(FILE_NAME_INFORMATION, FileName[0]);
   *RemainingLength -= NameInfo->FileNameLength;
@@ -245,17 +239,16 @@ NTSTATUS
 DokanFillNetworkPhysicalNameInfo(
     PFILE_NETWORK_PHYSICAL_NAME_INFORMATION NetInfo,
     PBY_HANDLE_FILE_INFORMATION FileInfo, PULONG RemainingLength,
-    PEVENT_CONTEXT EventContext) {
-  if (*RemainingLength < sizeof(FILE_NETWORK_PHYSICAL_NAME_INFORMATION) +
-                             EventContext->Operation.File.FileNameLength) {
+    LPCWSTR FileName, ULONG FileNameLength) {
+  if (*RemainingLength <
+      sizeof(FILE_NETWORK_PHYSICAL_NAME_INFORMATION) + FileNameLength) {
     return STATUS_BUFFER_OVERFLOW;
   }
 
   UNREFERENCED_PARAMETER(FileInfo);
 
-  NetInfo->FileNameLength = EventContext->Operation.File.FileNameLength;
-  CopyMemory(NetInfo->FileName, EventContext->Operation.File.FileName,
-             EventContext->Operation.File.FileNameLength);
+  NetInfo->FileNameLength = FileNameLength;
+  CopyMemory(NetInfo->FileName, FileName, FileNameLength);
 
   *RemainingLength -=
       FIELD_OFFSET(FILE_NETWORK_PHYSICAL_NAME_INFORMATION, FileName[0]);
@@ -332,7 +325,7 @@ VOID ClearFindStreamData(PLIST_ENTRY ListHead) {
 
 NTSTATUS
 DokanFindStreams(PFILE_STREAM_INFORMATION StreamInfo, PDOKAN_FILE_INFO FileInfo,
-                 PEVENT_CONTEXT EventContext, PDOKAN_INSTANCE DokanInstance,
+                 LPCWSTR FileName, PDOKAN_INSTANCE DokanInstance,
                  PULONG RemainingLength) {
   PDOKAN_OPEN_INFO openInfo =
       (PDOKAN_OPEN_INFO)(UINT_PTR)FileInfo->DokanContext;
@@ -342,19 +335,15 @@ DokanFindStreams(PFILE_STREAM_INFORMATION StreamInfo, PDOKAN_FILE_INFO FileInfo,
     return STATUS_NOT_IMPLEMENTED;
   }
 
-  if (openInfo->StreamListHead == NULL) {
-    openInfo->StreamListHead = malloc(sizeof(LIST_ENTRY));
-    if (openInfo->StreamListHead != NULL) {
-      InitializeListHead(openInfo->StreamListHead);
-    } else {
-      status = STATUS_NO_MEMORY;
-    }
+  if (DokanGetOpenInfoList(&openInfo->StreamListHead) == NULL) {
+    status = STATUS_NO_MEMORY;
   }
 
   if (status == STATUS_SUCCESS && IsListEmpty(openInfo->StreamListHead)) {
+    DokanStatisticsCallbackBegin();
     status = DokanInstance->DokanOperations->FindStreams(
-        EventContext->Operation.File.FileName, DokanFillFindStreamData,
-        FileInfo);
+        FileName, DokanFillFindStreamData, FileInfo);
+    DokanStatisticsCallbackEnd();
   }
 
   if (status == STATUS_SUCCESS) {
@@ -411,6 +400,33 @@ DokanFindStreams(PFILE_STREAM_INFORMATION StreamInfo, PDOKAN_FILE_INFO FileInfo,
   return status;
 }
 
+VOID DokanAttachFileAttributes(PEVENT_INFORMATION EventInfo, ULONG EventLength,
+                               PBY_HANDLE_FILE_INFORMATION FileInfo,
+                               PDOKAN_INSTANCE DokanInstance) {
+  FILE_NETWORK_OPEN_INFORMATION netInfo;
+  EVENT_FILE_ATTRIBUTES attributes;
+  ULONG remainingLength = sizeof(FILE_NETWORK_OPEN_INFORMATION);
+
+  // Same values as the information classes filled by user mode
+  DokanFillNetworkOpenInfo(&netInfo, FileInfo, &remainingLength, DokanInstance);
+
+  ZeroMemory(&attributes, sizeof(EVENT_FILE_ATTRIBUTES));
+  attributes.CreationTime = netInfo.CreationTime;
+  attributes.LastAccessTime = netInfo.LastAccessTime;
+  attributes.LastWriteTime = netInfo.LastWriteTime;
+  attributes.ChangeTime = netInfo.ChangeTime;
+  attributes.AllocationSize = netInfo.AllocationSize;
+  attributes.EndOfFile = netInfo.EndOfFile;
+  attributes.FileAttributes = netInfo.FileAttributes;
+  attributes.NumberOfLinks = FileInfo->nNumberOfLinks;
+  attributes.ValidityMs = DOKAN_FILE_ATTRIBUTES_VALIDITY;
+
+  // The block is not aligned when Buffer is not
+  CopyMemory((PCHAR)EventInfo + EventLength - sizeof(EVENT_FILE_ATTRIBUTES),
+             &attributes, sizeof(EVENT_FILE_ATTRIBUTES));
+  EventInfo->Flags |= DOKAN_EVENT_INFO_FILE_ATTRIBUTES;
+}
+
 VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                               PDOKAN_INSTANCE DokanInstance) {
   PEVENT_INFORMATION eventInfo;
@@ -420,24 +436,45 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
   NTSTATUS status = STATUS_INVALID_PARAMETER;
   PDOKAN_OPEN_INFO openInfo;
   ULONG sizeOfEventInfo;
+  LPWSTR fileName;
+  ULONG fileNameLength;
+  PDOKAN_FILE_NAME name;
 
   sizeOfEventInfo =
       sizeof(EVENT_INFORMATION) - 8 + EventContext->Operation.File.BufferLength;
-
-  CheckFileName(EventContext->Operation.File.FileName);
+  // Room for the attributes the driver can answer later queries with
+  if (DokanInstance->DokanOptions->Options &
+      DOKAN_OPTION_CACHE_FILE_ATTRIBUTES) {
+    sizeOfEventInfo = DOKAN_REPLY_WITH_ATTRIBUTES_LENGTH(
+        EventContext->Operation.File.BufferLength);
+  }
 
   ZeroMemory(&byHandleFileInfo, sizeof(BY_HANDLE_FILE_INFORMATION));
 
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.File.FileName,
+                                   EventContext->Operation.File.FileNameLength,
+                                   &name);
+  // The name kept for the handle does not come with its length
+  fileNameLength = name != NULL
+                       ? (ULONG)(wcslen(fileName) * sizeof(WCHAR))
+                       : EventContext->Operation.File.FileNameLength;
 
   eventInfo->BufferLength = EventContext->Operation.File.BufferLength;
 
   DbgPrint("###GetFileInfo %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
-  if (DokanInstance->DokanOperations->GetFileInformation) {
+  // Sizes and times include the writes gathered by the handle
+  if (DokanFlushGatheredWrites(DokanInstance, openInfo, fileName,
+                               &fileInfo) != STATUS_SUCCESS) {
+    DbgPrint("\tgathered writes failed\n");
+  } else if (DokanInstance->DokanOperations->GetFileInformation) {
+    DokanStatisticsCallbackBegin();
     status = DokanInstance->DokanOperations->GetFileInformation(
-        EventContext->Operation.File.FileName, &byHandleFileInfo, &fileInfo);
+        fileName, &byHandleFileInfo, &fileInfo);
+    DokanStatisticsCallbackEnd();
   }
 
   remainingLength = eventInfo->BufferLength;
@@ -488,7 +525,7 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
       DbgPrint("\tFileAllInformation\n");
       status = DokanFillFileAllInfo((PFILE_ALL_INFORMATION)eventInfo->Buffer,
                                     &byHandleFileInfo, &remainingLength,
-                                    EventContext, DokanInstance);
+                                    fileName, fileNameLength, DokanInstance);
       break;
 
     case FileAlternateNameInformation:
@@ -515,7 +552,7 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
       DbgPrint("\tFileNameInformation\n");
       status = DokanFillFileNameInfo((PFILE_NAME_INFORMATION)eventInfo->Buffer,
                                      &byHandleFileInfo, &remainingLength,
-                                     EventContext);
+                                     fileName, fileNameLength);
       break;
 
     case FileNetworkOpenInformation:
@@ -535,14 +572,14 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
     case FileStreamInformation:
       DbgPrint("FileStreamInformation\n");
       status = DokanFindStreams((PFILE_STREAM_INFORMATION)eventInfo->Buffer,
-                                &fileInfo, EventContext, DokanInstance,
+                                &fileInfo, fileName, DokanInstance,
                                 &remainingLength);
       break;
     case FileNetworkPhysicalNameInformation:
       DbgPrint("FileNetworkPhysicalNameInformation\n");
       status = DokanFillNetworkPhysicalNameInfo(
           (PFILE_NETWORK_PHYSICAL_NAME_INFORMATION)eventInfo->Buffer,
-          &byHandleFileInfo, &remainingLength, EventContext);
+          &byHandleFileInfo, &remainingLength, fileName, fileNameLength);
       break;
     default: {
       status = STATUS_INVALID_PARAMETER;
@@ -554,6 +591,12 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
     eventInfo->Status = status;
     eventInfo->BufferLength =
         EventContext->Operation.File.BufferLength - remainingLength;
+
+    if (DokanInstance->DokanOptions->Options &
+        DOKAN_OPTION_CACHE_FILE_ATTRIBUTES) {
+      DokanAttachFileAttributes(eventInfo, sizeOfEventInfo, &byHandleFileInfo,
+                                DokanInstance);
+    }
   }
 
   DbgPrint("\tDispatchQueryInformation result =  %lx\n", status);
@@ -563,5 +606,6 @@ VOID DispatchQueryInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
     openInfo->UserContext = fileInfo.Context;
 
   SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
+  DokanReleaseFileName(name);
   free(eventInfo);
 }
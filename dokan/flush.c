@@ -27,19 +27,30 @@ VOID DispatchFlush(HANDLE Handle, PEVENT_CONTEXT EventContext,
   PEVENT_INFORMATION eventInfo;
   ULONG sizeOfEventInfo = sizeof(EVENT_INFORMATION);
   PDOKAN_OPEN_INFO openInfo;
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
   NTSTATUS status;
-
-  CheckFileName(EventContext->Operation.Flush.FileName);
+  NTSTATUS gatherStatus;
 
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.Flush.FileName,
+                                   EventContext->Operation.Flush.FileNameLength,
+                                   &name);
 
   DbgPrint("###Flush %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
+  // Gathered writes reach the file system before it flushes the file
+  gatherStatus = DokanFlushGatheredWrites(DokanInstance, openInfo, fileName,
+                                          &fileInfo);
+
   if (DokanInstance->DokanOperations->FlushFileBuffers) {
 
-    status = DokanInstance->DokanOperations->FlushFileBuffers(
-        EventContext->Operation.Flush.FileName, &fileInfo);
+    DokanStatisticsCallbackBegin();
+    status =
+        DokanInstance->DokanOperations->FlushFileBuffers(fileName, &fileInfo);
+    DokanStatisticsCallbackEnd();
 
   } else {
     status = STATUS_NOT_IMPLEMENTED;
@@ -51,11 +62,14 @@ VOID DispatchFlush(HANDLE Handle, PEVENT_CONTEXT EventContext,
     eventInfo->Status =
         status != STATUS_SUCCESS ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
   }
+  if (gatherStatus != STATUS_SUCCESS)
+    eventInfo->Status = gatherStatus;
 
   if (openInfo != NULL)
     openInfo->UserContext = fileInfo.Context;
 
   SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
 
+  DokanReleaseFileName(name);
   free(eventInfo);
 }
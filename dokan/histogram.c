@@ -0,0 +1,83 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "histogram.h"
+
+#include <stddef.h>
+
+uint32_t DokanHistogramBucket(uint64_t Value) {
+  uint32_t exponent = 0;
+  uint32_t bucket;
+
+  if (Value < DOKAN_HISTOGRAM_SUB_BUCKETS)
+    return (uint32_t)Value;
+
+  while ((Value >> exponent) > 1)
+    ++exponent;
+  bucket = (exponent - DOKAN_HISTOGRAM_SUB_BUCKET_BITS + 1) *
+               DOKAN_HISTOGRAM_SUB_BUCKETS +
+           (uint32_t)((Value >> (exponent - DOKAN_HISTOGRAM_SUB_BUCKET_BITS)) &
+                      (DOKAN_HISTOGRAM_SUB_BUCKETS - 1));
+  return bucket < DOKAN_HISTOGRAM_BUCKETS ? bucket
+                                          : DOKAN_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t DokanHistogramBucketLimit(uint32_t Bucket) {
+  uint32_t exponent;
+  uint64_t sub;
+
+  if (Bucket + 1 < DOKAN_HISTOGRAM_SUB_BUCKETS)
+    return Bucket + 1;
+  exponent = (Bucket + 1) / DOKAN_HISTOGRAM_SUB_BUCKETS +
+             DOKAN_HISTOGRAM_SUB_BUCKET_BITS - 1;
+  sub = (Bucket + 1) % DOKAN_HISTOGRAM_SUB_BUCKETS;
+  return (DOKAN_HISTOGRAM_SUB_BUCKETS + sub)
+         << (exponent - DOKAN_HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+uint64_t DokanHistogramPercentile(const uint64_t *Histogram,
+                                  uint32_t Percentile) {
+  uint64_t total = 0;
+  uint64_t rank;
+  uint64_t seen = 0;
+  uint32_t i;
+
+  if (Histogram == NULL)
+    return 0;
+  if (Percentile > 100)
+    Percentile = 100;
+  for (i = 0; i < DOKAN_HISTOGRAM_BUCKETS; ++i)
+    total += Histogram[i];
+  if (total == 0)
+    return 0;
+
+  rank = (total * Percentile + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+  for (i = 0; i < DOKAN_HISTOGRAM_BUCKETS; ++i) {
+    seen += Histogram[i];
+    if (seen >= rank)
+      break;
+  }
+  if (i == DOKAN_HISTOGRAM_BUCKETS)
+    i = DOKAN_HISTOGRAM_BUCKETS - 1;
+  return DokanHistogramBucketLimit(i) - 1;
+}
@@ -0,0 +1,61 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_HISTOGRAM_H_
+#define DOKAN_HISTOGRAM_H_
+
+// Bucket math of the latency histograms of DOKAN_OPERATION_STATISTICS.
+//
+// Values below DOKAN_HISTOGRAM_SUB_BUCKETS have one bucket each, every
+// following power of two is split into DOKAN_HISTOGRAM_SUB_BUCKETS buckets of
+// equal width, and the last bucket holds every larger value.
+//
+// This file and histogram.c only depend on the C runtime,
+// samples/statistics_test checks them on any platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// DOKAN_LATENCY_BUCKETS of dokan.h
+#define DOKAN_HISTOGRAM_BUCKETS 128
+#define DOKAN_HISTOGRAM_SUB_BUCKETS 4
+#define DOKAN_HISTOGRAM_SUB_BUCKET_BITS 2
+
+// Returns the bucket Value is counted in.
+uint32_t DokanHistogramBucket(uint64_t Value);
+
+// Returns the first value that falls in the bucket after Bucket.
+uint64_t DokanHistogramBucketLimit(uint32_t Bucket);
+
+// Returns the largest value of the bucket holding the Percentile of the
+// values counted in the DOKAN_HISTOGRAM_BUCKETS buckets of Histogram, 0 when
+// it is empty. Percentile is clamped to 100.
+uint64_t DokanHistogramPercentile(const uint64_t *Histogram,
+                                  uint32_t Percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_HISTOGRAM_H_
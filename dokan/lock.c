@@ -43,12 +43,14 @@ VOID DispatchLock(HANDLE Handle, PEVENT_CONTEXT EventContext,
   case IRP_MN_LOCK:
     if (DokanInstance->DokanOperations->LockFile) {
 
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->LockFile(
           EventContext->Operation.Lock.FileName,
           EventContext->Operation.Lock.ByteOffset.QuadPart,
           EventContext->Operation.Lock.Length.QuadPart,
           // EventContext->Operation.Lock.Key,
           &fileInfo);
+      DokanStatisticsCallbackEnd();
 
       if (status != STATUS_NOT_IMPLEMENTED) {
         eventInfo->Status =
@@ -63,12 +65,14 @@ VOID DispatchLock(HANDLE Handle, PEVENT_CONTEXT EventContext,
   case IRP_MN_UNLOCK_SINGLE:
     if (DokanInstance->DokanOperations->UnlockFile) {
 
+      DokanStatisticsCallbackBegin();
       status = DokanInstance->DokanOperations->UnlockFile(
           EventContext->Operation.Lock.FileName,
           EventContext->Operation.Lock.ByteOffset.QuadPart,
           EventContext->Operation.Lock.Length.QuadPart,
           // EventContext->Operation.Lock.Key,
           &fileInfo);
+      DokanStatisticsCallbackEnd();
 
       if (status != STATUS_NOT_IMPLEMENTED) {
         eventInfo->Status =
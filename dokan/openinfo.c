@@ -0,0 +1,359 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+
+#include <malloc.h>
+
+// A handle is the generation of the entry in its high 32 bits and its index
+// plus one in its low 32 bits, so a valid handle is never 0.
+#define OPEN_INFO_HANDLE(Generation, Index)                                    \
+  (((ULONG64)(Generation) << 32) | ((ULONG64)(Index) + 1))
+#define OPEN_INFO_STATE(Generation, References)                                \
+  ((LONG64)(((ULONG64)(Generation) << 32) | (ULONG)(References)))
+#define OPEN_INFO_GENERATION(State) ((ULONG)((ULONG64)(State) >> 32))
+#define OPEN_INFO_REFERENCES(State) ((ULONG)((ULONG64)(State)&0xFFFFFFFF))
+
+VOID DokanOpenInfoTableInit(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_OPEN_INFO_TABLE table = &DokanInstance->OpenInfoTable;
+
+  InitializeSListHead(&table->FreeList);
+  InitializeCriticalSection(&table->GrowLock);
+}
+
+static VOID ClearOpenInfoData(PDOKAN_OPEN_INFO OpenInfo) {
+  if (OpenInfo->DirListHead != NULL) {
+    ClearFindData(OpenInfo->DirListHead);
+    free(OpenInfo->DirListHead);
+    OpenInfo->DirListHead = NULL;
+  }
+  if (OpenInfo->StreamListHead != NULL) {
+    ClearFindStreamData(OpenInfo->StreamListHead);
+    free(OpenInfo->StreamListHead);
+    OpenInfo->StreamListHead = NULL;
+  }
+  DokanReleaseFileName(OpenInfo->FileName);
+  OpenInfo->FileName = NULL;
+  OpenInfo->FileNameGeneration = 0;
+  // Flushed when the handle was closed or at unmount
+  DokanWriteGatherDelete(OpenInfo->WriteGather);
+  OpenInfo->WriteGather = NULL;
+  OpenInfo->WriteGatherEntry.Flink = NULL;
+  OpenInfo->WriteGatherEntry.Blink = NULL;
+}
+
+VOID DokanOpenInfoTableCleanup(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_OPEN_INFO_TABLE table = &DokanInstance->OpenInfoTable;
+  PDOKAN_OPEN_INFO slab;
+  LONG i;
+  ULONG j;
+
+  // Files still opened when the device was unmounted are never closed
+  for (i = 0; i < table->SlabCount; ++i) {
+    slab = table->Slabs[i];
+    for (j = 0; j < DOKAN_OPEN_INFO_SLAB_SIZE; ++j) {
+      ClearOpenInfoData(&slab[j]);
+    }
+    _aligned_free(slab);
+    table->Slabs[i] = NULL;
+  }
+  table->SlabCount = 0;
+  InterlockedFlushSList(&table->FreeList);
+  DeleteCriticalSection(&table->GrowLock);
+}
+
+static BOOL GrowOpenInfoTable(PDOKAN_OPEN_INFO_TABLE Table) {
+  PDOKAN_OPEN_INFO slab;
+  LONG slabCount;
+  ULONG i;
+  BOOL grown = TRUE;
+
+  EnterCriticalSection(&Table->GrowLock);
+  // Another thread may have grown the table while this one waited
+  if (QueryDepthSList(&Table->FreeList) == 0) {
+    slabCount = Table->SlabCount;
+    slab = NULL;
+    if (slabCount < DOKAN_OPEN_INFO_MAX_SLABS) {
+      slab = (PDOKAN_OPEN_INFO)_aligned_malloc(
+          sizeof(DOKAN_OPEN_INFO) * DOKAN_OPEN_INFO_SLAB_SIZE,
+          MEMORY_ALLOCATION_ALIGNMENT);
+    }
+    if (slab == NULL) {
+      grown = FALSE;
+    } else {
+      ZeroMemory(slab, sizeof(DOKAN_OPEN_INFO) * DOKAN_OPEN_INFO_SLAB_SIZE);
+      for (i = 0; i < DOKAN_OPEN_INFO_SLAB_SIZE; ++i) {
+        slab[i].Index = slabCount * DOKAN_OPEN_INFO_SLAB_SIZE + i;
+        slab[i].State = OPEN_INFO_STATE(1, 0);
+      }
+      InterlockedExchangePointer((PVOID volatile *)&Table->Slabs[slabCount],
+                                 slab);
+      InterlockedExchange(&Table->SlabCount, slabCount + 1);
+      // Pushed backward so that low indexes are used first
+      for (i = DOKAN_OPEN_INFO_SLAB_SIZE; i > 0; --i) {
+        InterlockedPushEntrySList(&Table->FreeList, &slab[i - 1].FreeEntry);
+      }
+    }
+  }
+  LeaveCriticalSection(&Table->GrowLock);
+  return grown;
+}
+
+PDOKAN_OPEN_INFO
+DokanAllocateOpenInfo(PDOKAN_INSTANCE DokanInstance, LONG References) {
+  PDOKAN_OPEN_INFO_TABLE table = &DokanInstance->OpenInfoTable;
+  PSLIST_ENTRY entry;
+  PDOKAN_OPEN_INFO openInfo;
+  ULONG generation;
+
+  while ((entry = InterlockedPopEntrySList(&table->FreeList)) == NULL) {
+    if (!GrowOpenInfoTable(table)) {
+      DbgPrint("Dokan Error: cannot grow the open handle table\n");
+      return NULL;
+    }
+  }
+
+  openInfo = CONTAINING_RECORD(entry, DOKAN_OPEN_INFO, FreeEntry);
+  generation = OPEN_INFO_GENERATION(openInfo->State);
+  openInfo->Handle = OPEN_INFO_HANDLE(generation, openInfo->Index);
+  openInfo->IsDirectory = FALSE;
+  openInfo->EventContext = NULL;
+  openInfo->DokanInstance = DokanInstance;
+  openInfo->UserContext = 0;
+  openInfo->EventId = 0;
+  // The references are published last, the handle cannot be resolved before
+  InterlockedExchange64(&openInfo->State,
+                        OPEN_INFO_STATE(generation, References));
+  return openInfo;
+}
+
+// Gives the entry back to the table. The caller owns the last reference.
+VOID DokanFreeOpenInfo(PDOKAN_INSTANCE DokanInstance,
+                       PDOKAN_OPEN_INFO OpenInfo) {
+  ULONG generation = OPEN_INFO_GENERATION(OpenInfo->State);
+
+  ClearOpenInfoData(OpenInfo);
+  // Skip generation 0 on wrap around to keep handles from an old entry stale
+  if (++generation == 0) {
+    generation = 1;
+  }
+  InterlockedExchange64(&OpenInfo->State, OPEN_INFO_STATE(generation, 0));
+  InterlockedPushEntrySList(&DokanInstance->OpenInfoTable.FreeList,
+                            &OpenInfo->FreeEntry);
+}
+
+// Returns TRUE when the last reference was released and the entry freed
+BOOL DokanReleaseOpenInfoReference(PDOKAN_INSTANCE DokanInstance,
+                                   PDOKAN_OPEN_INFO OpenInfo) {
+  LONG64 state = InterlockedDecrement64(&OpenInfo->State);
+
+  if (OPEN_INFO_REFERENCES(state) != 0) {
+    return FALSE;
+  }
+  // No reference can be taken once there are none left
+  DokanFreeOpenInfo(DokanInstance, OpenInfo);
+  return TRUE;
+}
+
+VOID DokanReleaseFileName(PDOKAN_FILE_NAME FileName) {
+  if (FileName != NULL && InterlockedDecrement(&FileName->References) == 0) {
+    free(FileName);
+  }
+}
+
+// Keeps the name of the file for the events of the handle that omit it,
+// unless a newer one is already kept
+VOID DokanSetOpenInfoFileName(PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                              ULONG Generation) {
+  PDOKAN_FILE_NAME name;
+  PDOKAN_FILE_NAME previous = NULL;
+  size_t length;
+
+  if (Generation == 0 || Generation == OpenInfo->FileNameGeneration) {
+    return;
+  }
+  length = (wcslen(FileName) + 1) * sizeof(WCHAR);
+  name = malloc(FIELD_OFFSET(DOKAN_FILE_NAME, Name) + length);
+  if (name == NULL) {
+    // Not acknowledged, the driver keeps sending the name
+    return;
+  }
+  name->References = 1;
+  name->Generation = Generation;
+  memcpy(name->Name, FileName, length);
+
+  AcquireSRWLockExclusive(&OpenInfo->FileNameLock);
+  if (OpenInfo->FileName == NULL ||
+      (LONG)(Generation - OpenInfo->FileName->Generation) > 0) {
+    previous = OpenInfo->FileName;
+    OpenInfo->FileName = name;
+    InterlockedExchange((volatile LONG *)&OpenInfo->FileNameGeneration,
+                        (LONG)Generation);
+    name = NULL;
+  }
+  ReleaseSRWLockExclusive(&OpenInfo->FileNameLock);
+  DokanReleaseFileName(previous);
+  DokanReleaseFileName(name);
+}
+
+// Last name received for the handle with a reference, NULL if none was kept
+PDOKAN_FILE_NAME DokanReferenceOpenInfoFileName(PDOKAN_OPEN_INFO OpenInfo) {
+  PDOKAN_FILE_NAME name;
+
+  AcquireSRWLockShared(&OpenInfo->FileNameLock);
+  name = OpenInfo->FileName;
+  if (name != NULL) {
+    InterlockedIncrement(&name->References);
+  }
+  ReleaseSRWLockShared(&OpenInfo->FileNameLock);
+  return name;
+}
+
+// Name of the file of an event on an opened file. When the driver omitted it,
+// the name kept for the handle is returned with a reference in *Reference, to
+// release with DokanReleaseFileName once the callback returned.
+LPWSTR DokanGetEventFileName(PEVENT_CONTEXT EventContext,
+                             PDOKAN_OPEN_INFO OpenInfo, LPWSTR FileName,
+                             ULONG FileNameLength,
+                             PDOKAN_FILE_NAME *Reference) {
+  PDOKAN_FILE_NAME name;
+
+  *Reference = NULL;
+  if (FileNameLength != 0 || OpenInfo == NULL) {
+    CheckFileName(FileName);
+    if (OpenInfo != NULL) {
+      DokanSetOpenInfoFileName(OpenInfo, FileName,
+                               EventContext->NameGeneration);
+    }
+    return FileName;
+  }
+
+  name = DokanReferenceOpenInfoFileName(OpenInfo);
+  if (name == NULL) {
+    DbgPrint("Dokan Error: no file name kept for handle %I64x\n",
+             OpenInfo->Handle);
+    return FileName;
+  }
+  *Reference = name;
+  return name->Name;
+}
+
+// Creates a find list of the entry on first use. Requests running at the same
+// time on the file can both get here, only one list is kept.
+PLIST_ENTRY DokanGetOpenInfoList(PLIST_ENTRY *ListHead) {
+  PLIST_ENTRY list = *(PLIST_ENTRY volatile *)ListHead;
+  PLIST_ENTRY created;
+
+  if (list != NULL) {
+    return list;
+  }
+  created = malloc(sizeof(LIST_ENTRY));
+  if (created == NULL) {
+    return NULL;
+  }
+  InitializeListHead(created);
+  list = InterlockedCompareExchangePointer((PVOID volatile *)ListHead,
+                                           created, NULL);
+  if (list != NULL) {
+    free(created);
+    return list;
+  }
+  return created;
+}
+
+static PDOKAN_OPEN_INFO LookupOpenInfo(PDOKAN_OPEN_INFO_TABLE Table,
+                                       ULONG64 Handle) {
+  ULONG index = (ULONG)(Handle & 0xFFFFFFFF);
+  PDOKAN_OPEN_INFO slab;
+
+  if (index == 0 ||
+      index > DOKAN_OPEN_INFO_MAX_SLABS * DOKAN_OPEN_INFO_SLAB_SIZE) {
+    return NULL;
+  }
+  --index;
+  slab = Table->Slabs[index / DOKAN_OPEN_INFO_SLAB_SIZE];
+  if (slab == NULL) {
+    return NULL;
+  }
+  return &slab[index % DOKAN_OPEN_INFO_SLAB_SIZE];
+}
+
+PDOKAN_OPEN_INFO
+GetDokanOpenInfo(PEVENT_CONTEXT EventContext, PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_OPEN_INFO openInfo;
+  ULONG generation;
+  LONG64 state;
+  LONG64 previous;
+
+  if (EventContext->Context == 0) {
+    return NULL;
+  }
+  openInfo = LookupOpenInfo(&DokanInstance->OpenInfoTable,
+                            EventContext->Context);
+  if (openInfo == NULL) {
+    DbgPrint("Dokan Error: invalid open handle %I64x\n",
+             EventContext->Context);
+    return NULL;
+  }
+
+  generation = (ULONG)(EventContext->Context >> 32);
+  // Plain 64 bit reads can be torn on x86
+  state = InterlockedCompareExchange64(&openInfo->State, 0, 0);
+  for (;;) {
+    if (OPEN_INFO_GENERATION(state) != generation ||
+        OPEN_INFO_REFERENCES(state) == 0) {
+      DbgPrint("Dokan Error: stale open handle %I64x\n",
+               EventContext->Context);
+      return NULL;
+    }
+    previous =
+        InterlockedCompareExchange64(&openInfo->State, state + 1, state);
+    if (previous == state) {
+      break;
+    }
+    state = previous;
+  }
+
+  openInfo->EventContext = EventContext;
+  openInfo->DokanInstance = DokanInstance;
+  return openInfo;
+}
+
+VOID ReleaseDokanOpenInfo(PEVENT_INFORMATION EventInformation,
+                          PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_OPEN_INFO openInfo;
+
+  if (EventInformation->Context == 0) {
+    return;
+  }
+  // The request still holds its reference, the entry cannot be reused
+  openInfo = LookupOpenInfo(&DokanInstance->OpenInfoTable,
+                            EventInformation->Context);
+  if (openInfo == NULL) {
+    return;
+  }
+  // The driver omits the name from the next events of the handle once it
+  // knows this one has it
+  EventInformation->NameGeneration = openInfo->FileNameGeneration;
+  if (DokanReleaseOpenInfoReference(DokanInstance, openInfo)) {
+    EventInformation->Context = 0;
+  }
+}
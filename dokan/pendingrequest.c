@@ -0,0 +1,285 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pendingrequest.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK DOKAN_PENDING_REQUESTS_LOCK;
+typedef CONDITION_VARIABLE DOKAN_PENDING_REQUESTS_CONDITION;
+typedef ULONGLONG DOKAN_PENDING_REQUESTS_DEADLINE;
+
+#define PendingRequestsInitialize(Requests)                                    \
+  (InitializeSRWLock(&(Requests)->Lock),                                       \
+   InitializeConditionVariable(&(Requests)->Changed), 1)
+#define PendingRequestsUninitialize(Requests)
+#define PendingRequestsLock(Requests) AcquireSRWLockExclusive(&(Requests)->Lock)
+#define PendingRequestsUnlock(Requests)                                        \
+  ReleaseSRWLockExclusive(&(Requests)->Lock)
+#define PendingRequestsWait(Requests)                                          \
+  SleepConditionVariableSRW(&(Requests)->Changed, &(Requests)->Lock, INFINITE, \
+                            0)
+#define PendingRequestsWakeAll(Requests)                                       \
+  WakeAllConditionVariable(&(Requests)->Changed)
+#define PendingRequestCompareExchange(State, Exchange, Comparand)              \
+  InterlockedCompareExchange(State, Exchange, Comparand)
+#define PendingRequestIncrement(State) InterlockedIncrement(State)
+#define PendingRequestYield() SwitchToThread()
+
+static void PendingRequestsDeadline(DOKAN_PENDING_REQUESTS_DEADLINE *Deadline,
+                                    uint32_t Timeout) {
+  *Deadline = GetTickCount64() + Timeout;
+}
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+typedef pthread_mutex_t DOKAN_PENDING_REQUESTS_LOCK;
+typedef pthread_cond_t DOKAN_PENDING_REQUESTS_CONDITION;
+typedef struct timespec DOKAN_PENDING_REQUESTS_DEADLINE;
+
+#define PendingRequestsInitialize(Requests)                                    \
+  (pthread_mutex_init(&(Requests)->Lock, NULL) == 0 &&                         \
+   (pthread_cond_init(&(Requests)->Changed, NULL) == 0 ||                      \
+    (pthread_mutex_destroy(&(Requests)->Lock), 0)))
+#define PendingRequestsUninitialize(Requests)                                  \
+  (pthread_cond_destroy(&(Requests)->Changed),                                 \
+   pthread_mutex_destroy(&(Requests)->Lock))
+#define PendingRequestsLock(Requests) pthread_mutex_lock(&(Requests)->Lock)
+#define PendingRequestsUnlock(Requests) pthread_mutex_unlock(&(Requests)->Lock)
+#define PendingRequestsWait(Requests)                                          \
+  pthread_cond_wait(&(Requests)->Changed, &(Requests)->Lock)
+#define PendingRequestsWakeAll(Requests)                                       \
+  pthread_cond_broadcast(&(Requests)->Changed)
+#define PendingRequestCompareExchange(State, Exchange, Comparand)              \
+  __sync_val_compare_and_swap(State, Comparand, Exchange)
+#define PendingRequestIncrement(State) __sync_add_and_fetch(State, 1)
+#define PendingRequestYield() sched_yield()
+
+static void PendingRequestsDeadline(DOKAN_PENDING_REQUESTS_DEADLINE *Deadline,
+                                    uint32_t Timeout) {
+  clock_gettime(CLOCK_REALTIME, Deadline);
+  Deadline->tv_sec += Timeout / 1000;
+  Deadline->tv_nsec += (long)(Timeout % 1000) * 1000000;
+  if (Deadline->tv_nsec >= 1000000000) {
+    Deadline->tv_sec++;
+    Deadline->tv_nsec -= 1000000000;
+  }
+}
+#endif
+
+// Values of DOKAN_PENDING_REQUEST.State. Abandoned requests count the
+// releases of their two owners above DOKAN_PENDING_REQUEST_ABANDONED.
+#define DOKAN_PENDING_REQUEST_WAITING 0
+#define DOKAN_PENDING_REQUEST_IN_USE 1
+#define DOKAN_PENDING_REQUEST_COMPLETING 2
+#define DOKAN_PENDING_REQUEST_ABANDONED 3
+
+struct _DOKAN_PENDING_REQUESTS {
+  DOKAN_PENDING_REQUESTS_LOCK Lock;
+  // Signaled when a request is unlinked or no longer in use
+  DOKAN_PENDING_REQUESTS_CONDITION Changed;
+  PDOKAN_PENDING_REQUEST Head;
+  uint32_t Count;
+};
+
+// Waits for a change of the requests, returns 0 once the deadline passed
+#ifdef _WIN32
+static int PendingRequestsWaitUntil(PDOKAN_PENDING_REQUESTS Requests,
+                                    DOKAN_PENDING_REQUESTS_DEADLINE *Deadline) {
+  ULONGLONG now = GetTickCount64();
+
+  if (now >= *Deadline)
+    return 0;
+  SleepConditionVariableSRW(&Requests->Changed, &Requests->Lock,
+                            (DWORD)(*Deadline - now), 0);
+  return 1;
+}
+#else
+static int PendingRequestsWaitUntil(PDOKAN_PENDING_REQUESTS Requests,
+                                    DOKAN_PENDING_REQUESTS_DEADLINE *Deadline) {
+  return pthread_cond_timedwait(&Requests->Changed, &Requests->Lock,
+                                Deadline) != ETIMEDOUT;
+}
+#endif
+
+static void PendingRequestUnlink(PDOKAN_PENDING_REQUESTS Requests,
+                                 PDOKAN_PENDING_REQUEST Request) {
+  if (Request->Previous != NULL)
+    Request->Previous->Next = Request->Next;
+  else
+    Requests->Head = Request->Next;
+  if (Request->Next != NULL)
+    Request->Next->Previous = Request->Previous;
+  Request->Next = Request->Previous = NULL;
+  Requests->Count--;
+}
+
+int32_t DokanRequestReply(int Read, uint32_t Length, int64_t ByteOffset,
+                          int32_t Status, uint32_t *Bytes,
+                          int64_t *CurrentByteOffset) {
+  if (Status != DOKAN_REQUEST_SUCCESS) {
+    *Bytes = 0;
+    return Status;
+  }
+  if (*Bytes > Length)
+    *Bytes = Length;
+  if (Read && *Bytes == 0)
+    return DOKAN_REQUEST_END_OF_FILE;
+  *CurrentByteOffset = ByteOffset + *Bytes;
+  return DOKAN_REQUEST_SUCCESS;
+}
+
+PDOKAN_PENDING_REQUESTS DokanPendingRequestsCreate(void) {
+  PDOKAN_PENDING_REQUESTS requests;
+
+  requests = (PDOKAN_PENDING_REQUESTS)calloc(1, sizeof(DOKAN_PENDING_REQUESTS));
+  if (requests == NULL)
+    return NULL;
+  if (!PendingRequestsInitialize(requests)) {
+    free(requests);
+    return NULL;
+  }
+  return requests;
+}
+
+void DokanPendingRequestsDelete(PDOKAN_PENDING_REQUESTS Requests) {
+  if (Requests == NULL)
+    return;
+  PendingRequestsUninitialize(Requests);
+  free(Requests);
+}
+
+void DokanPendingRequestAdd(PDOKAN_PENDING_REQUESTS Requests,
+                            PDOKAN_PENDING_REQUEST Request) {
+  Request->State = DOKAN_PENDING_REQUEST_WAITING;
+  Request->Previous = NULL;
+  PendingRequestsLock(Requests);
+  Request->Next = Requests->Head;
+  if (Requests->Head != NULL)
+    Requests->Head->Previous = Request;
+  Requests->Head = Request;
+  Requests->Count++;
+  PendingRequestsUnlock(Requests);
+}
+
+int DokanPendingRequestClaim(PDOKAN_PENDING_REQUEST Request) {
+  long state;
+
+  for (;;) {
+    state = PendingRequestCompareExchange(&Request->State,
+                                          DOKAN_PENDING_REQUEST_COMPLETING,
+                                          DOKAN_PENDING_REQUEST_WAITING);
+    if (state == DOKAN_PENDING_REQUEST_WAITING)
+      return 1;
+    if (state != DOKAN_PENDING_REQUEST_IN_USE)
+      return 0;
+    // Uses are short, the completion waits for them
+    PendingRequestYield();
+  }
+}
+
+void DokanPendingRequestRemove(PDOKAN_PENDING_REQUESTS Requests,
+                               PDOKAN_PENDING_REQUEST Request) {
+  PendingRequestsLock(Requests);
+  PendingRequestUnlink(Requests, Request);
+  PendingRequestsWakeAll(Requests);
+  PendingRequestsUnlock(Requests);
+}
+
+int DokanPendingRequestUse(PDOKAN_PENDING_REQUEST Request) {
+  return PendingRequestCompareExchange(&Request->State,
+                                       DOKAN_PENDING_REQUEST_IN_USE,
+                                       DOKAN_PENDING_REQUEST_WAITING) ==
+         DOKAN_PENDING_REQUEST_WAITING;
+}
+
+void DokanPendingRequestEndUse(PDOKAN_PENDING_REQUESTS Requests,
+                               PDOKAN_PENDING_REQUEST Request) {
+  // Under the lock so that a wait cannot miss it between its scan and sleep
+  PendingRequestsLock(Requests);
+  PendingRequestCompareExchange(&Request->State, DOKAN_PENDING_REQUEST_WAITING,
+                                DOKAN_PENDING_REQUEST_IN_USE);
+  PendingRequestsWakeAll(Requests);
+  PendingRequestsUnlock(Requests);
+}
+
+int DokanPendingRequestRelease(PDOKAN_PENDING_REQUEST Request) {
+  return PendingRequestIncrement(&Request->State) ==
+         DOKAN_PENDING_REQUEST_ABANDONED + 2;
+}
+
+uint32_t DokanPendingRequestsWait(PDOKAN_PENDING_REQUESTS Requests,
+                                  uint32_t Timeout,
+                                  DOKAN_PENDING_REQUEST_ABANDON Abandon,
+                                  void *Context) {
+  DOKAN_PENDING_REQUESTS_DEADLINE deadline;
+  PDOKAN_PENDING_REQUEST abandoned = NULL;
+  PDOKAN_PENDING_REQUEST request;
+  PDOKAN_PENDING_REQUEST next;
+  uint32_t count = 0;
+
+  PendingRequestsDeadline(&deadline, Timeout);
+  PendingRequestsLock(Requests);
+  while (Requests->Count != 0) {
+    if (!PendingRequestsWaitUntil(Requests, &deadline))
+      break;
+  }
+
+  while (Requests->Count != 0) {
+    for (request = Requests->Head; request != NULL; request = next) {
+      next = request->Next;
+      if (PendingRequestCompareExchange(&request->State,
+                                        DOKAN_PENDING_REQUEST_ABANDONED,
+                                        DOKAN_PENDING_REQUEST_WAITING) !=
+          DOKAN_PENDING_REQUEST_WAITING)
+        continue;
+      PendingRequestUnlink(Requests, request);
+      request->Next = abandoned;
+      abandoned = request;
+    }
+    // Completions and uses in progress end in a bounded time
+    if (Requests->Count != 0)
+      PendingRequestsWait(Requests);
+  }
+  PendingRequestsUnlock(Requests);
+
+  for (request = abandoned; request != NULL; request = next) {
+    next = request->Next;
+    Abandon(Context, request);
+    count++;
+  }
+  return count;
+}
+
+uint32_t DokanPendingRequestsCount(PDOKAN_PENDING_REQUESTS Requests) {
+  uint32_t count;
+
+  PendingRequestsLock(Requests);
+  count = Requests->Count;
+  PendingRequestsUnlock(Requests);
+  return count;
+}
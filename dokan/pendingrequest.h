@@ -0,0 +1,122 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_PENDINGREQUEST_H_
+#define DOKAN_PENDINGREQUEST_H_
+
+// Bookkeeping of the read and write requests pended by DokanPendRequest.
+//
+// Pending requests are linked in the set of their instance until they are
+// completed. The unmount waits for the set to empty, up to a timeout after
+// which the requests still waiting for their completion are abandoned: the
+// library fails them, and their completion only gives back their memory.
+// An entry is freed once both sides are done with it, so a completion racing
+// with the unmount never touches freed memory.
+//
+// Other uses of a pending request, such as extending its timeout, hold it for
+// their duration so that it is neither completed nor abandoned meanwhile.
+//
+// The replies of reads and writes are filled by DokanRequestReply, whether
+// they are pended or not.
+//
+// This file and pendingrequest.c only depend on the C runtime and on either
+// Windows or pthreads, samples/pendingrequest_test checks them on any
+// platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// STATUS_SUCCESS and STATUS_END_OF_FILE
+#define DOKAN_REQUEST_SUCCESS 0
+#define DOKAN_REQUEST_END_OF_FILE ((int32_t)0xC0000011)
+
+typedef struct _DOKAN_PENDING_REQUESTS DOKAN_PENDING_REQUESTS,
+    *PDOKAN_PENDING_REQUESTS;
+
+// Part of a pending request, owned by the set while it is linked
+typedef struct _DOKAN_PENDING_REQUEST {
+  struct _DOKAN_PENDING_REQUEST *Next;
+  struct _DOKAN_PENDING_REQUEST *Previous;
+  // DOKAN_PENDING_REQUEST_* state, changed with atomic operations
+  volatile long State;
+} DOKAN_PENDING_REQUEST, *PDOKAN_PENDING_REQUEST;
+
+// Fails an abandoned request and gives it to DokanPendingRequestRelease.
+typedef void (*DOKAN_PENDING_REQUEST_ABANDON)(void *Context,
+                                              PDOKAN_PENDING_REQUEST Request);
+
+// Returns the status of the reply of a read or write of Length bytes at
+// ByteOffset that ended with Status after Bytes were transferred. Stores the
+// length of the reply in Bytes and the offset that follows in
+// CurrentByteOffset. A successful read of nothing is the end of the file.
+int32_t DokanRequestReply(int Read, uint32_t Length, int64_t ByteOffset,
+                          int32_t Status, uint32_t *Bytes,
+                          int64_t *CurrentByteOffset);
+
+// Returns NULL if there is not enough memory.
+PDOKAN_PENDING_REQUESTS DokanPendingRequestsCreate(void);
+
+// No request may be pending.
+void DokanPendingRequestsDelete(PDOKAN_PENDING_REQUESTS Requests);
+
+void DokanPendingRequestAdd(PDOKAN_PENDING_REQUESTS Requests,
+                            PDOKAN_PENDING_REQUEST Request);
+
+// To be called before the request is completed. Returns 1 if the caller
+// completes it and then calls DokanPendingRequestRemove. Returns 0 if it was
+// abandoned, the caller then only calls DokanPendingRequestRelease.
+int DokanPendingRequestClaim(PDOKAN_PENDING_REQUEST Request);
+
+// Unlinks a claimed request. The set must not be used by the caller after.
+void DokanPendingRequestRemove(PDOKAN_PENDING_REQUESTS Requests,
+                               PDOKAN_PENDING_REQUEST Request);
+
+// Holds the request for a use other than its completion. Returns 0 if it is
+// being completed, abandoned or already held, otherwise the caller calls
+// DokanPendingRequestEndUse once done.
+int DokanPendingRequestUse(PDOKAN_PENDING_REQUEST Request);
+
+void DokanPendingRequestEndUse(PDOKAN_PENDING_REQUESTS Requests,
+                               PDOKAN_PENDING_REQUEST Request);
+
+// Returns 1 when the caller frees the abandoned request, which happens for
+// the second of its Abandon callback and its completion to call it.
+int DokanPendingRequestRelease(PDOKAN_PENDING_REQUEST Request);
+
+// Waits up to Timeout milliseconds for the pending requests to be completed.
+// The ones that are not claimed by then are unlinked and handed to Abandon
+// once the requests being completed or held are done, whatever the time it
+// takes. Returns the number of abandoned requests.
+uint32_t DokanPendingRequestsWait(PDOKAN_PENDING_REQUESTS Requests,
+                                  uint32_t Timeout,
+                                  DOKAN_PENDING_REQUEST_ABANDON Abandon,
+                                  void *Context);
+
+uint32_t DokanPendingRequestsCount(PDOKAN_PENDING_REQUESTS Requests);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_PENDINGREQUEST_H_
@@ -29,38 +29,78 @@ VOID DispatchRead(HANDLE Handle, PEVENT_CONTEXT EventContext,
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
   DOKAN_FILE_INFO fileInfo;
   ULONG sizeOfEventInfo;
+  DOKAN_REQUEST request;
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
 
   sizeOfEventInfo =
       sizeof(EVENT_INFORMATION) - 8 + EventContext->Operation.Read.BufferLength;
 
-  CheckFileName(EventContext->Operation.Read.FileName);
-
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.Read.FileName,
+                                   EventContext->Operation.Read.FileNameLength,
+                                   &name);
 
   DbgPrint("###Read %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
-  if (DokanInstance->DokanOperations->ReadFile) {
-    status = DokanInstance->DokanOperations->ReadFile(
-        EventContext->Operation.Read.FileName, eventInfo->Buffer,
+  request.DokanInstance = DokanInstance;
+  request.OpenInfo = openInfo;
+  request.EventInfo = eventInfo;
+  request.EventLength = sizeOfEventInfo;
+  request.MajorFunction = IRP_MJ_READ;
+  request.Length = EventContext->Operation.Read.BufferLength;
+  request.ByteOffset = EventContext->Operation.Read.ByteOffset.QuadPart;
+  request.CacheChange = NULL;
+
+  // The handle reads back the writes it gathered
+  status = DokanFlushGatheredRange(
+      DokanInstance, openInfo, fileName, &fileInfo,
+      EventContext->Operation.Read.ByteOffset.QuadPart,
+      EventContext->Operation.Read.BufferLength);
+
+  // Reads that asked to skip the caches go to the file system, paging reads
+  // of mapped files are noncached by nature and still use the cache
+  if (status != STATUS_SUCCESS) {
+    DokanReleaseFileName(name);
+  } else if (DokanInstance->BlockCache != NULL &&
+      DokanInstance->DokanOperations->ReadFile &&
+      !(fileInfo.Nocache && !fileInfo.PagingIo)) {
+    status = DokanCacheReadFile(
+        DokanInstance, fileName, eventInfo->Buffer,
         EventContext->Operation.Read.BufferLength, &readLength,
         EventContext->Operation.Read.ByteOffset.QuadPart, &fileInfo);
+    DokanReleaseFileName(name);
+  } else if (DokanInstance->DokanOperations->ReadFile) {
+    DokanBeginPendableRequest(&request, &fileInfo);
+    DokanStatisticsCallbackBegin();
+    status = DokanInstance->DokanOperations->ReadFile(
+        fileName, eventInfo->Buffer, EventContext->Operation.Read.BufferLength,
+        &readLength, EventContext->Operation.Read.ByteOffset.QuadPart,
+        &fileInfo);
+    DokanStatisticsCallbackEnd();
+    DokanReleaseFileName(name);
+    // The reply, eventInfo and the context of the handle now belong to
+    // DokanCompleteRequest, which may already have run
+    if (DokanEndPendableRequest() != NULL) {
+      if (status != STATUS_PENDING)
+        DbgPrint("Dokan Error: pended ReadFile returned 0x%x\n", status);
+      return;
+    }
+    if (status == STATUS_PENDING) {
+      DbgPrint("Dokan Error: ReadFile returned STATUS_PENDING without "
+               "DokanPendRequest\n");
+      status = STATUS_INTERNAL_ERROR;
+    }
+  } else {
+    DokanReleaseFileName(name);
+    status = STATUS_NOT_IMPLEMENTED;
   }
 
   if (openInfo != NULL)
     openInfo->UserContext = fileInfo.Context;
-  eventInfo->BufferLength = 0;
-  eventInfo->Status = status;
-
-  if (status == STATUS_SUCCESS) {
-    if (readLength == 0) {
-      eventInfo->Status = STATUS_END_OF_FILE;
-    } else {
-      eventInfo->BufferLength = readLength;
-      eventInfo->Operation.Read.CurrentByteOffset.QuadPart =
-          EventContext->Operation.Read.ByteOffset.QuadPart + readLength;
-    }
-  }
+  DokanFinishRequest(&request, status, readLength);
 
   SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
   free(eventInfo);
@@ -126,11 +126,158 @@ NTSTATUS DefaultGetFileSecurity(LPCWSTR FileName,
   return STATUS_SUCCESS;
 }
 
+// Buffer given to GetFileSecurity by DOKAN_OPTION_CACHE_SECURITY when the
+// caller asks for less, large enough for most descriptors to be cached by the
+// first query of a file
+#define DOKAN_SECURITY_PROBE_LENGTH 4096
+
+// Calls GetFileSecurity, or the default when it is not implemented
+static NTSTATUS DokanCallGetFileSecurity(PEVENT_CONTEXT EventContext,
+                                         PDOKAN_INSTANCE DokanInstance,
+                                         PSECURITY_DESCRIPTOR Buffer,
+                                         ULONG BufferLength,
+                                         PULONG LengthNeeded,
+                                         PDOKAN_FILE_INFO FileInfo) {
+  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+
+  if (DokanInstance->DokanOperations->GetFileSecurity) {
+    DokanStatisticsCallbackBegin();
+    status = DokanInstance->DokanOperations->GetFileSecurity(
+        EventContext->Operation.Security.FileName,
+        &EventContext->Operation.Security.SecurityInformation, Buffer,
+        BufferLength, LengthNeeded, FileInfo);
+    DokanStatisticsCallbackEnd();
+  }
+
+  if (status == STATUS_NOT_IMPLEMENTED) {
+    status = DefaultGetFileSecurity(
+        EventContext->Operation.Security.FileName,
+        &EventContext->Operation.Security.SecurityInformation, Buffer,
+        BufferLength, LengthNeeded, FileInfo);
+  }
+
+  return status;
+}
+
+// Makes room for a Length bytes long descriptor in the reply
+static BOOL DokanReserveSecurityReply(PEVENT_INFORMATION *EventInfo,
+                                      PULONG EventInfoLength, ULONG Length) {
+  ULONG needed = sizeof(EVENT_INFORMATION) - 8 + Length;
+  PEVENT_INFORMATION eventInfo;
+
+  if (needed <= *EventInfoLength)
+    return TRUE;
+  eventInfo = (PEVENT_INFORMATION)realloc(*EventInfo, needed);
+  if (eventInfo == NULL)
+    return FALSE;
+  RtlZeroMemory((PCHAR)eventInfo + *EventInfoLength,
+                needed - *EventInfoLength);
+  *EventInfo = eventInfo;
+  *EventInfoLength = needed;
+  return TRUE;
+}
+
+// Answers from the security cache, or caches the descriptor returned by the
+// file system. The reply holds the whole descriptor even when the buffer of
+// the caller is too small so that the driver answers its retry.
+static NTSTATUS DokanQueryCachedSecurity(PEVENT_CONTEXT EventContext,
+                                         PDOKAN_INSTANCE DokanInstance,
+                                         PDOKAN_FILE_INFO FileInfo,
+                                         PDOKAN_CACHE_KEY Key,
+                                         PEVENT_INFORMATION *EventInfo,
+                                         PULONG EventInfoLength) {
+  PDOKAN_SECURITY_CACHE cache = DokanInstance->SecurityCache;
+  ULONG securityInformation =
+      EventContext->Operation.Security.SecurityInformation;
+  ULONG bufferLength = EventContext->Operation.Security.BufferLength;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR descriptor;
+  const void *data;
+  uint32_t length;
+  uint64_t generation;
+  ULONG probeLength;
+  ULONG lengthNeeded = 0;
+  NTSTATUS status;
+
+  descriptor = DokanSecurityCacheLookup(cache, Key->Name, Key->Length,
+                                        securityInformation);
+  if (descriptor != NULL) {
+    data = DokanSecurityCacheDescriptorData(descriptor, &length);
+    if (!DokanReserveSecurityReply(EventInfo, EventInfoLength, length)) {
+      DokanSecurityCacheRelease(cache, descriptor);
+      return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlCopyMemory((*EventInfo)->Buffer, data, length);
+    DokanSecurityCacheRelease(cache, descriptor);
+    (*EventInfo)->BufferLength = length;
+    (*EventInfo)->Flags |= DOKAN_EVENT_INFO_SECURITY_DESCRIPTOR;
+    return length <= bufferLength ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+  }
+
+  generation = DokanSecurityCacheGeneration(cache);
+  probeLength = bufferLength > DOKAN_SECURITY_PROBE_LENGTH
+                    ? bufferLength
+                    : DOKAN_SECURITY_PROBE_LENGTH;
+  if (!DokanReserveSecurityReply(EventInfo, EventInfoLength, probeLength))
+    return STATUS_INSUFFICIENT_RESOURCES;
+  status = DokanCallGetFileSecurity(EventContext, DokanInstance,
+                                    (*EventInfo)->Buffer, probeLength,
+                                    &lengthNeeded, FileInfo);
+  // Descriptors larger than the probe are read again at their size
+  if (status == STATUS_BUFFER_OVERFLOW && lengthNeeded > probeLength) {
+    probeLength = lengthNeeded;
+    if (!DokanReserveSecurityReply(EventInfo, EventInfoLength, probeLength))
+      return STATUS_INSUFFICIENT_RESOURCES;
+    lengthNeeded = 0;
+    status = DokanCallGetFileSecurity(EventContext, DokanInstance,
+                                      (*EventInfo)->Buffer, probeLength,
+                                      &lengthNeeded, FileInfo);
+  }
+
+  if (status != STATUS_SUCCESS && status != STATUS_BUFFER_OVERFLOW) {
+    (*EventInfo)->BufferLength = 0;
+    return status;
+  }
+
+  (*EventInfo)->BufferLength = lengthNeeded;
+  if (status == STATUS_SUCCESS && lengthNeeded <= probeLength) {
+    DokanSecurityCacheInsert(cache, Key->Name, Key->Length,
+                             securityInformation, (*EventInfo)->Buffer,
+                             lengthNeeded, generation);
+    (*EventInfo)->Flags |= DOKAN_EVENT_INFO_SECURITY_DESCRIPTOR;
+  }
+  return status == STATUS_SUCCESS && lengthNeeded <= bufferLength
+             ? STATUS_SUCCESS
+             : STATUS_BUFFER_OVERFLOW;
+}
+
+VOID DokanSecurityCacheChanged(PDOKAN_INSTANCE DokanInstance,
+                               LPCWSTR FileName, BOOL Directory) {
+  DOKAN_CACHE_KEY key;
+
+  if (DokanInstance->SecurityCache == NULL)
+    return;
+
+  // Without a key any descriptor may be stale
+  if (!DokanCacheMakeKey(FileName, FALSE, &key)) {
+    DokanSecurityCacheInvalidate(DokanInstance->SecurityCache, L"", 0);
+    return;
+  }
+  // The prefix also matches the files below the directory
+  if (Directory)
+    DokanSecurityCacheInvalidate(DokanInstance->SecurityCache, key.Name,
+                                 key.Length);
+  else
+    DokanSecurityCacheRemove(DokanInstance->SecurityCache, key.Name,
+                             key.Length);
+  DokanCacheFreeKey(&key);
+}
+
 VOID DispatchQuerySecurity(HANDLE Handle, PEVENT_CONTEXT EventContext,
                            PDOKAN_INSTANCE DokanInstance) {
   PEVENT_INFORMATION eventInfo;
   DOKAN_FILE_INFO fileInfo;
   PDOKAN_OPEN_INFO openInfo;
+  DOKAN_CACHE_KEY key;
   ULONG eventInfoLength;
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
   ULONG lengthNeeded = 0;
@@ -145,21 +292,21 @@ VOID DispatchQuerySecurity(HANDLE Handle, PEVENT_CONTEXT EventContext,
   DbgPrint("###GetFileSecurity %04d\n",
            openInfo != NULL ? openInfo->EventId : -1);
 
-  if (DokanInstance->DokanOperations->GetFileSecurity) {
-    status = DokanInstance->DokanOperations->GetFileSecurity(
-        EventContext->Operation.Security.FileName,
-        &EventContext->Operation.Security.SecurityInformation,
-        &eventInfo->Buffer, EventContext->Operation.Security.BufferLength,
-        &lengthNeeded, &fileInfo);
+  if (DokanInstance->SecurityCache != NULL &&
+      DokanCacheMakeKey(EventContext->Operation.Security.FileName, FALSE,
+                        &key)) {
+    eventInfo->Status =
+        DokanQueryCachedSecurity(EventContext, DokanInstance, &fileInfo, &key,
+                                 &eventInfo, &eventInfoLength);
+    DokanCacheFreeKey(&key);
+    SendEventInformation(Handle, eventInfo, eventInfoLength, DokanInstance);
+    free(eventInfo);
+    return;
   }
 
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    status = DefaultGetFileSecurity(
-        EventContext->Operation.Security.FileName,
-        &EventContext->Operation.Security.SecurityInformation,
-        &eventInfo->Buffer, EventContext->Operation.Security.BufferLength,
-        &lengthNeeded, &fileInfo);
-  }
+  status = DokanCallGetFileSecurity(
+      EventContext, DokanInstance, &eventInfo->Buffer,
+      EventContext->Operation.Security.BufferLength, &lengthNeeded, &fileInfo);
 
   eventInfo->Status = status;
 
@@ -200,13 +347,20 @@ VOID DispatchSetSecurity(HANDLE Handle, PEVENT_CONTEXT EventContext,
       (PCHAR)EventContext + EventContext->Operation.SetSecurity.BufferOffset;
 
   if (DokanInstance->DokanOperations->SetFileSecurity) {
+    DokanStatisticsCallbackBegin();
     status = DokanInstance->DokanOperations->SetFileSecurity(
         EventContext->Operation.SetSecurity.FileName,
         &EventContext->Operation.SetSecurity.SecurityInformation,
         securityDescriptor, EventContext->Operation.SetSecurity.BufferLength,
         &fileInfo);
+    DokanStatisticsCallbackEnd();
   }
 
+  // Also after a failure, the descriptor may have changed partially
+  DokanSecurityCacheChanged(DokanInstance,
+                            EventContext->Operation.SetSecurity.FileName,
+                            fileInfo.IsDirectory);
+
   if (status != STATUS_SUCCESS) {
     eventInfo->Status = STATUS_INVALID_PARAMETER;
     eventInfo->BufferLength = 0;
@@ -0,0 +1,393 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "securitycache.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK DOKAN_SECURITY_CACHE_LOCK;
+
+#define SecurityCacheInitialize(Cache) (InitializeSRWLock(&(Cache)->Lock), 1)
+#define SecurityCacheUninitialize(Cache)
+#define SecurityCacheLock(Cache) AcquireSRWLockExclusive(&(Cache)->Lock)
+#define SecurityCacheUnlock(Cache) ReleaseSRWLockExclusive(&(Cache)->Lock)
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t DOKAN_SECURITY_CACHE_LOCK;
+
+#define SecurityCacheInitialize(Cache)                                         \
+  (pthread_mutex_init(&(Cache)->Lock, NULL) == 0)
+#define SecurityCacheUninitialize(Cache) pthread_mutex_destroy(&(Cache)->Lock)
+#define SecurityCacheLock(Cache) pthread_mutex_lock(&(Cache)->Lock)
+#define SecurityCacheUnlock(Cache) pthread_mutex_unlock(&(Cache)->Lock)
+#endif
+
+// Most entries of a cache, keeps the hash tables addressable
+#define DOKAN_SECURITY_CACHE_MAXIMUM_ENTRIES (1u << 24)
+
+typedef struct _DOKAN_SECURITY_CACHE_ENTRY DOKAN_SECURITY_CACHE_ENTRY,
+    *PDOKAN_SECURITY_CACHE_ENTRY;
+
+struct _DOKAN_SECURITY_CACHE_DESCRIPTOR {
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR HashNext;
+  uint32_t Hash;
+  uint32_t Length;
+  // Entries using the descriptor and lookups that returned it
+  uint32_t References;
+  uint8_t Data[1];
+};
+
+struct _DOKAN_SECURITY_CACHE_ENTRY {
+  PDOKAN_SECURITY_CACHE_ENTRY HashNext;
+  // Least recently used order
+  PDOKAN_SECURITY_CACHE_ENTRY Newer;
+  PDOKAN_SECURITY_CACHE_ENTRY Older;
+  // Hash of the key only, the entries of a file share a bucket
+  uint32_t Hash;
+  uint32_t SecurityInformation;
+  uint32_t KeyLength;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor;
+  uint8_t Key[1];
+};
+
+struct _DOKAN_SECURITY_CACHE {
+  DOKAN_SECURITY_CACHE_LOCK Lock;
+  uint32_t MaximumEntries;
+  // Same size for both tables, a power of 2
+  uint32_t HashMask;
+  PDOKAN_SECURITY_CACHE_ENTRY *Entries;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR *Descriptors;
+  PDOKAN_SECURITY_CACHE_ENTRY Newest;
+  PDOKAN_SECURITY_CACHE_ENTRY Oldest;
+  // Changed by every removal
+  uint64_t Generation;
+  DOKAN_SECURITY_CACHE_COUNTERS Counters;
+};
+
+static uint32_t SecurityCacheHash(const void *Data, uint32_t Length) {
+  const uint8_t *bytes = (const uint8_t *)Data;
+  uint32_t hash = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < Length; ++i) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void SecurityCacheLinkNewest(PDOKAN_SECURITY_CACHE Cache,
+                                    PDOKAN_SECURITY_CACHE_ENTRY Entry) {
+  Entry->Newer = NULL;
+  Entry->Older = Cache->Newest;
+  if (Cache->Newest != NULL)
+    Cache->Newest->Newer = Entry;
+  else
+    Cache->Oldest = Entry;
+  Cache->Newest = Entry;
+}
+
+static void SecurityCacheUnlinkOrder(PDOKAN_SECURITY_CACHE Cache,
+                                     PDOKAN_SECURITY_CACHE_ENTRY Entry) {
+  if (Entry->Newer != NULL)
+    Entry->Newer->Older = Entry->Older;
+  else
+    Cache->Newest = Entry->Older;
+  if (Entry->Older != NULL)
+    Entry->Older->Newer = Entry->Newer;
+  else
+    Cache->Oldest = Entry->Newer;
+}
+
+static void
+SecurityCacheReleaseLocked(PDOKAN_SECURITY_CACHE Cache,
+                           PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor) {
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR *link;
+
+  if (--Descriptor->References != 0)
+    return;
+
+  link = &Cache->Descriptors[Descriptor->Hash & Cache->HashMask];
+  while (*link != Descriptor)
+    link = &(*link)->HashNext;
+  *link = Descriptor->HashNext;
+  Cache->Counters.Descriptors--;
+  Cache->Counters.DescriptorBytes -= Descriptor->Length;
+  free(Descriptor);
+}
+
+// Returns a referenced descriptor with the content of Data, shared with the
+// entries that already have it
+static PDOKAN_SECURITY_CACHE_DESCRIPTOR
+SecurityCacheIntern(PDOKAN_SECURITY_CACHE Cache, const void *Data,
+                    uint32_t Length) {
+  uint32_t hash = SecurityCacheHash(Data, Length);
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR descriptor =
+      Cache->Descriptors[hash & Cache->HashMask];
+
+  for (; descriptor != NULL; descriptor = descriptor->HashNext) {
+    if (descriptor->Hash == hash && descriptor->Length == Length &&
+        memcmp(descriptor->Data, Data, Length) == 0) {
+      descriptor->References++;
+      return descriptor;
+    }
+  }
+
+  descriptor = (PDOKAN_SECURITY_CACHE_DESCRIPTOR)malloc(
+      offsetof(DOKAN_SECURITY_CACHE_DESCRIPTOR, Data) + Length);
+  if (descriptor == NULL)
+    return NULL;
+  descriptor->Hash = hash;
+  descriptor->Length = Length;
+  descriptor->References = 1;
+  memcpy(descriptor->Data, Data, Length);
+  descriptor->HashNext = Cache->Descriptors[hash & Cache->HashMask];
+  Cache->Descriptors[hash & Cache->HashMask] = descriptor;
+  Cache->Counters.Descriptors++;
+  Cache->Counters.DescriptorBytes += Length;
+  return descriptor;
+}
+
+static void SecurityCacheFreeEntry(PDOKAN_SECURITY_CACHE Cache,
+                                   PDOKAN_SECURITY_CACHE_ENTRY Entry) {
+  PDOKAN_SECURITY_CACHE_ENTRY *link;
+
+  link = &Cache->Entries[Entry->Hash & Cache->HashMask];
+  while (*link != Entry)
+    link = &(*link)->HashNext;
+  *link = Entry->HashNext;
+  SecurityCacheUnlinkOrder(Cache, Entry);
+  SecurityCacheReleaseLocked(Cache, Entry->Descriptor);
+  Cache->Counters.Entries--;
+  free(Entry);
+}
+
+static PDOKAN_SECURITY_CACHE_ENTRY
+SecurityCacheFindEntry(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                       uint32_t KeyLength, uint32_t Hash,
+                       uint32_t SecurityInformation) {
+  PDOKAN_SECURITY_CACHE_ENTRY entry = Cache->Entries[Hash & Cache->HashMask];
+
+  for (; entry != NULL; entry = entry->HashNext) {
+    if (entry->Hash == Hash && entry->KeyLength == KeyLength &&
+        entry->SecurityInformation == SecurityInformation &&
+        memcmp(entry->Key, Key, KeyLength) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+PDOKAN_SECURITY_CACHE DokanSecurityCacheCreate(uint32_t MaximumEntries) {
+  PDOKAN_SECURITY_CACHE cache;
+  uint32_t buckets = 16;
+
+  if (MaximumEntries == 0)
+    MaximumEntries = 1;
+  if (MaximumEntries > DOKAN_SECURITY_CACHE_MAXIMUM_ENTRIES)
+    MaximumEntries = DOKAN_SECURITY_CACHE_MAXIMUM_ENTRIES;
+  while (buckets < MaximumEntries)
+    buckets <<= 1;
+
+  cache = (PDOKAN_SECURITY_CACHE)calloc(1, sizeof(DOKAN_SECURITY_CACHE));
+  if (cache == NULL)
+    return NULL;
+  cache->MaximumEntries = MaximumEntries;
+  cache->HashMask = buckets - 1;
+  cache->Entries = (PDOKAN_SECURITY_CACHE_ENTRY *)calloc(
+      buckets, sizeof(PDOKAN_SECURITY_CACHE_ENTRY));
+  cache->Descriptors = (PDOKAN_SECURITY_CACHE_DESCRIPTOR *)calloc(
+      buckets, sizeof(PDOKAN_SECURITY_CACHE_DESCRIPTOR));
+  if (cache->Entries == NULL || cache->Descriptors == NULL ||
+      !SecurityCacheInitialize(cache)) {
+    free(cache->Entries);
+    free(cache->Descriptors);
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void DokanSecurityCacheDelete(PDOKAN_SECURITY_CACHE Cache) {
+  if (Cache == NULL)
+    return;
+  while (Cache->Oldest != NULL)
+    SecurityCacheFreeEntry(Cache, Cache->Oldest);
+  SecurityCacheUninitialize(Cache);
+  free(Cache->Entries);
+  free(Cache->Descriptors);
+  free(Cache);
+}
+
+PDOKAN_SECURITY_CACHE_DESCRIPTOR
+DokanSecurityCacheLookup(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                         uint32_t KeyLength, uint32_t SecurityInformation) {
+  uint32_t hash = SecurityCacheHash(Key, KeyLength);
+  PDOKAN_SECURITY_CACHE_ENTRY entry;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR descriptor = NULL;
+
+  SecurityCacheLock(Cache);
+  entry = SecurityCacheFindEntry(Cache, Key, KeyLength, hash,
+                                 SecurityInformation);
+  if (entry != NULL) {
+    SecurityCacheUnlinkOrder(Cache, entry);
+    SecurityCacheLinkNewest(Cache, entry);
+    descriptor = entry->Descriptor;
+    descriptor->References++;
+    Cache->Counters.Hits++;
+  } else {
+    Cache->Counters.Misses++;
+  }
+  SecurityCacheUnlock(Cache);
+  return descriptor;
+}
+
+const void *
+DokanSecurityCacheDescriptorData(PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor,
+                                 uint32_t *Length) {
+  // The content of a descriptor never changes once interned
+  *Length = Descriptor->Length;
+  return Descriptor->Data;
+}
+
+void DokanSecurityCacheRelease(PDOKAN_SECURITY_CACHE Cache,
+                               PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor) {
+  if (Descriptor == NULL)
+    return;
+  SecurityCacheLock(Cache);
+  SecurityCacheReleaseLocked(Cache, Descriptor);
+  SecurityCacheUnlock(Cache);
+}
+
+uint64_t DokanSecurityCacheGeneration(PDOKAN_SECURITY_CACHE Cache) {
+  uint64_t generation;
+
+  SecurityCacheLock(Cache);
+  generation = Cache->Generation;
+  SecurityCacheUnlock(Cache);
+  return generation;
+}
+
+void DokanSecurityCacheInsert(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                              uint32_t KeyLength, uint32_t SecurityInformation,
+                              const void *Data, uint32_t Length,
+                              uint64_t Generation) {
+  uint32_t hash = SecurityCacheHash(Key, KeyLength);
+  PDOKAN_SECURITY_CACHE_ENTRY entry;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR descriptor;
+
+  SecurityCacheLock(Cache);
+  // A change since the descriptor was read may have made it stale
+  if (Generation != Cache->Generation) {
+    SecurityCacheUnlock(Cache);
+    return;
+  }
+
+  descriptor = SecurityCacheIntern(Cache, Data, Length);
+  if (descriptor == NULL) {
+    SecurityCacheUnlock(Cache);
+    return;
+  }
+
+  entry = SecurityCacheFindEntry(Cache, Key, KeyLength, hash,
+                                 SecurityInformation);
+  if (entry != NULL) {
+    SecurityCacheReleaseLocked(Cache, entry->Descriptor);
+    entry->Descriptor = descriptor;
+    SecurityCacheUnlinkOrder(Cache, entry);
+    SecurityCacheLinkNewest(Cache, entry);
+    SecurityCacheUnlock(Cache);
+    return;
+  }
+
+  entry = (PDOKAN_SECURITY_CACHE_ENTRY)malloc(
+      offsetof(DOKAN_SECURITY_CACHE_ENTRY, Key) + KeyLength);
+  if (entry == NULL) {
+    SecurityCacheReleaseLocked(Cache, descriptor);
+    SecurityCacheUnlock(Cache);
+    return;
+  }
+  if (Cache->Counters.Entries >= Cache->MaximumEntries) {
+    SecurityCacheFreeEntry(Cache, Cache->Oldest);
+    Cache->Counters.Evictions++;
+  }
+  entry->Hash = hash;
+  entry->SecurityInformation = SecurityInformation;
+  entry->KeyLength = KeyLength;
+  entry->Descriptor = descriptor;
+  memcpy(entry->Key, Key, KeyLength);
+  entry->HashNext = Cache->Entries[hash & Cache->HashMask];
+  Cache->Entries[hash & Cache->HashMask] = entry;
+  SecurityCacheLinkNewest(Cache, entry);
+  Cache->Counters.Entries++;
+  SecurityCacheUnlock(Cache);
+}
+
+void DokanSecurityCacheRemove(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                              uint32_t KeyLength) {
+  uint32_t hash = SecurityCacheHash(Key, KeyLength);
+  PDOKAN_SECURITY_CACHE_ENTRY entry;
+  PDOKAN_SECURITY_CACHE_ENTRY next;
+
+  SecurityCacheLock(Cache);
+  // Also when there is no entry, a lookup may be reading the descriptor
+  Cache->Generation++;
+  for (entry = Cache->Entries[hash & Cache->HashMask]; entry != NULL;
+       entry = next) {
+    next = entry->HashNext;
+    if (entry->Hash == hash && entry->KeyLength == KeyLength &&
+        memcmp(entry->Key, Key, KeyLength) == 0) {
+      SecurityCacheFreeEntry(Cache, entry);
+      Cache->Counters.Invalidations++;
+    }
+  }
+  SecurityCacheUnlock(Cache);
+}
+
+void DokanSecurityCacheInvalidate(PDOKAN_SECURITY_CACHE Cache,
+                                  const void *Prefix, uint32_t PrefixLength) {
+  PDOKAN_SECURITY_CACHE_ENTRY entry;
+  PDOKAN_SECURITY_CACHE_ENTRY older;
+
+  SecurityCacheLock(Cache);
+  Cache->Generation++;
+  for (entry = Cache->Newest; entry != NULL; entry = older) {
+    older = entry->Older;
+    if (entry->KeyLength >= PrefixLength &&
+        memcmp(entry->Key, Prefix, PrefixLength) == 0) {
+      SecurityCacheFreeEntry(Cache, entry);
+      Cache->Counters.Invalidations++;
+    }
+  }
+  SecurityCacheUnlock(Cache);
+}
+
+void DokanSecurityCacheGetCounters(PDOKAN_SECURITY_CACHE Cache,
+                                   PDOKAN_SECURITY_CACHE_COUNTERS Counters) {
+  SecurityCacheLock(Cache);
+  *Counters = Cache->Counters;
+  SecurityCacheUnlock(Cache);
+}
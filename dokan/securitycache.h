@@ -0,0 +1,120 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_SECURITYCACHE_H_
+#define DOKAN_SECURITYCACHE_H_
+
+// Cache of the security descriptors returned by the GetFileSecurity callback.
+//
+// Entries map an opaque key, the upper cased file name for the library, and
+// the requested security information to a descriptor. Descriptors are
+// interned by content: files with the same descriptor share one copy, so the
+// memory used grows with the number of distinct descriptors rather than with
+// the number of files. Entries are evicted in least recently used order once
+// the maximum is reached, and a descriptor is freed with its last entry.
+//
+// Every removal changes the generation of the cache. A descriptor read from
+// the file system is only kept if the generation did not change since before
+// it was read, so a change racing with the read cannot leave a stale entry.
+//
+// This file and securitycache.c only depend on the C runtime and on either
+// Windows or pthreads, samples/securitycache_test checks them on any
+// platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _DOKAN_SECURITY_CACHE DOKAN_SECURITY_CACHE,
+    *PDOKAN_SECURITY_CACHE;
+typedef struct _DOKAN_SECURITY_CACHE_DESCRIPTOR DOKAN_SECURITY_CACHE_DESCRIPTOR,
+    *PDOKAN_SECURITY_CACHE_DESCRIPTOR;
+
+// Counters of a cache since it was created
+typedef struct _DOKAN_SECURITY_CACHE_COUNTERS {
+  // Lookups that found an entry
+  uint64_t Hits;
+  // Lookups that found none
+  uint64_t Misses;
+  // Entries dropped to make room
+  uint64_t Evictions;
+  // Entries dropped because their file changed
+  uint64_t Invalidations;
+  // Entries in the cache
+  uint64_t Entries;
+  // Distinct descriptors shared by the entries
+  uint64_t Descriptors;
+  // Bytes of the distinct descriptors
+  uint64_t DescriptorBytes;
+} DOKAN_SECURITY_CACHE_COUNTERS, *PDOKAN_SECURITY_CACHE_COUNTERS;
+
+// Returns NULL if there is not enough memory. At least one entry is kept
+// whatever the MaximumEntries.
+PDOKAN_SECURITY_CACHE DokanSecurityCacheCreate(uint32_t MaximumEntries);
+
+// Every descriptor returned by a lookup must have been released.
+void DokanSecurityCacheDelete(PDOKAN_SECURITY_CACHE Cache);
+
+// Returns the descriptor of the file for SecurityInformation, or NULL if the
+// cache has none. The descriptor must be given back to
+// DokanSecurityCacheRelease.
+PDOKAN_SECURITY_CACHE_DESCRIPTOR
+DokanSecurityCacheLookup(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                         uint32_t KeyLength, uint32_t SecurityInformation);
+
+const void *
+DokanSecurityCacheDescriptorData(PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor,
+                                 uint32_t *Length);
+
+void DokanSecurityCacheRelease(PDOKAN_SECURITY_CACHE Cache,
+                               PDOKAN_SECURITY_CACHE_DESCRIPTOR Descriptor);
+
+// To be read before the descriptor given to DokanSecurityCacheInsert is read
+// from the file system.
+uint64_t DokanSecurityCacheGeneration(PDOKAN_SECURITY_CACHE Cache);
+
+// Keeps a copy of the Length bytes of Data as the descriptor of the file for
+// SecurityInformation, unless the cache changed since Generation or there is
+// not enough memory.
+void DokanSecurityCacheInsert(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                              uint32_t KeyLength, uint32_t SecurityInformation,
+                              const void *Data, uint32_t Length,
+                              uint64_t Generation);
+
+// Drops the entries of the file, to be called once its descriptor changed.
+void DokanSecurityCacheRemove(PDOKAN_SECURITY_CACHE Cache, const void *Key,
+                              uint32_t KeyLength);
+
+// Drops every entry whose key starts with Prefix, for changes of a directory
+// that the files below it inherit from.
+void DokanSecurityCacheInvalidate(PDOKAN_SECURITY_CACHE Cache,
+                                  const void *Prefix, uint32_t PrefixLength);
+
+void DokanSecurityCacheGetCounters(PDOKAN_SECURITY_CACHE Cache,
+                                   PDOKAN_SECURITY_CACHE_COUNTERS Counters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_SECURITYCACHE_H_
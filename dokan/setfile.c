@@ -25,7 +25,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 
 NTSTATUS
-DokanSetAllocationInformation(PEVENT_CONTEXT EventContext,
+DokanSetAllocationInformation(PEVENT_CONTEXT EventContext, LPCWSTR FileName,
                               PDOKAN_FILE_INFO FileInfo,
                               PDOKAN_OPERATIONS DokanOperations) {
   PFILE_ALLOCATION_INFORMATION allocInfo = (PFILE_ALLOCATION_INFORMATION)(
@@ -44,8 +44,7 @@ DokanSetAllocationInformation(PEVENT_CONTEXT EventContext,
 
   if (DokanOperations->SetAllocationSize) {
     status = DokanOperations->SetAllocationSize(
-        EventContext->Operation.SetFile.FileName,
-        allocInfo->AllocationSize.QuadPart, FileInfo);
+        FileName, allocInfo->AllocationSize.QuadPart, FileInfo);
   } else {
     status = STATUS_NOT_IMPLEMENTED;
   }
@@ -54,7 +53,8 @@ DokanSetAllocationInformation(PEVENT_CONTEXT EventContext,
 }
 
 NTSTATUS
-DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
+DokanSetBasicInformation(PEVENT_CONTEXT EventContext, LPCWSTR FileName,
+                         PDOKAN_FILE_INFO FileInfo,
                          PDOKAN_OPERATIONS DokanOperations) {
   FILETIME creation, lastAccess, lastWrite;
   NTSTATUS status;
@@ -69,8 +69,7 @@ DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
     return STATUS_NOT_IMPLEMENTED;
 
   status = DokanOperations->SetFileAttributes(
-      EventContext->Operation.SetFile.FileName, basicInfo->FileAttributes,
-      FileInfo);
+      FileName, basicInfo->FileAttributes, FileInfo);
 
   if (status != STATUS_SUCCESS)
     return status;
@@ -82,13 +81,12 @@ DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
   lastWrite.dwLowDateTime = basicInfo->LastWriteTime.LowPart;
   lastWrite.dwHighDateTime = basicInfo->LastWriteTime.HighPart;
 
-  return DokanOperations->SetFileTime(EventContext->Operation.SetFile.FileName,
-                                      &creation, &lastAccess, &lastWrite,
-                                      FileInfo);
+  return DokanOperations->SetFileTime(FileName, &creation, &lastAccess,
+                                      &lastWrite, FileInfo);
 }
 
 NTSTATUS
-DokanSetDispositionInformation(PEVENT_CONTEXT EventContext,
+DokanSetDispositionInformation(PEVENT_CONTEXT EventContext, LPCWSTR FileName,
                                PDOKAN_FILE_INFO FileInfo,
                                PDOKAN_OPERATIONS DokanOperations) {
 
@@ -120,8 +118,8 @@ DokanSetDispositionInformation(PEVENT_CONTEXT EventContext,
   if (DokanOperations->GetFileInformation && DeleteFileFlag) {
     BY_HANDLE_FILE_INFORMATION byHandleFileInfo;
     ZeroMemory(&byHandleFileInfo, sizeof(BY_HANDLE_FILE_INFORMATION));
-    result = DokanOperations->GetFileInformation(
-        EventContext->Operation.SetFile.FileName, &byHandleFileInfo, FileInfo);
+    result = DokanOperations->GetFileInformation(FileName, &byHandleFileInfo,
+                                                 FileInfo);
 
     if (result == STATUS_SUCCESS &&
         (byHandleFileInfo.dwFileAttributes & FILE_ATTRIBUTE_READONLY) != 0)
@@ -131,11 +129,9 @@ DokanSetDispositionInformation(PEVENT_CONTEXT EventContext,
   FileInfo->DeleteOnClose = DeleteFileFlag;
 
   if (FileInfo->IsDirectory) {
-    result = DokanOperations->DeleteDirectory(
-        EventContext->Operation.SetFile.FileName, FileInfo);
+    result = DokanOperations->DeleteDirectory(FileName, FileInfo);
   } else {
-    result = DokanOperations->DeleteFile(EventContext->Operation.SetFile.FileName,
-                                       FileInfo);
+    result = DokanOperations->DeleteFile(FileName, FileInfo);
   }
   //Double set for later be sure FS user did not changed it
   FileInfo->DeleteOnClose = DeleteFileFlag;
@@ -143,7 +139,7 @@ DokanSetDispositionInformation(PEVENT_CONTEXT EventContext,
 }
 
 NTSTATUS
-DokanSetEndOfFileInformation(PEVENT_CONTEXT EventContext,
+DokanSetEndOfFileInformation(PEVENT_CONTEXT EventContext, LPCWSTR FileName,
                              PDOKAN_FILE_INFO FileInfo,
                              PDOKAN_OPERATIONS DokanOperations) {
   PFILE_END_OF_FILE_INFORMATION endInfo = (PFILE_END_OF_FILE_INFORMATION)(
@@ -152,8 +148,8 @@ DokanSetEndOfFileInformation(PEVENT_CONTEXT EventContext,
   if (!DokanOperations->SetEndOfFile)
     return STATUS_NOT_IMPLEMENTED;
 
-  return DokanOperations->SetEndOfFile(EventContext->Operation.SetFile.FileName,
-                                       endInfo->EndOfFile.QuadPart, FileInfo);
+  return DokanOperations->SetEndOfFile(FileName, endInfo->EndOfFile.QuadPart,
+                                       FileInfo);
 }
 
 NTSTATUS
@@ -172,11 +168,14 @@ DokanSetLinkInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
 NTSTATUS
 DokanSetRenameInformation(PEVENT_CONTEXT EventContext,
                           PDOKAN_FILE_INFO FileInfo,
-                          PDOKAN_OPERATIONS DokanOperations) {
+                          PDOKAN_INSTANCE DokanInstance) {
   PDOKAN_RENAME_INFORMATION renameInfo = (PDOKAN_RENAME_INFORMATION)(
       (PCHAR)EventContext + EventContext->Operation.SetFile.BufferOffset);
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
   WCHAR *newName = NULL;
+  PDOKAN_OPERATIONS DokanOperations = DokanInstance->DokanOperations;
+  PDOKAN_BLOCK_CACHE_FILE oldChange;
+  PDOKAN_BLOCK_CACHE_FILE newChange;
 
   if (!DokanOperations->MoveFile)
     return STATUS_NOT_IMPLEMENTED;
@@ -206,16 +205,32 @@ DokanSetRenameInformation(PEVENT_CONTEXT EventContext,
     RtlCopyMemory(newName, renameInfo->FileName, renameInfo->FileNameLength);
   }
 
+  // The cached blocks of both names and of the files below the renamed
+  // directory no longer match their names
+  oldChange = DokanCacheBeginChange(DokanInstance,
+                                    EventContext->Operation.SetFile.FileName,
+                                    0, DOKAN_BLOCK_CACHE_WHOLE_FILE);
+  newChange = DokanCacheBeginChange(DokanInstance, newName, 0,
+                                    DOKAN_BLOCK_CACHE_WHOLE_FILE);
+  DokanCacheInvalidateChildren(DokanInstance,
+                               EventContext->Operation.SetFile.FileName);
   status =
       DokanOperations->MoveFile(EventContext->Operation.SetFile.FileName,
                                 newName, renameInfo->ReplaceIfExists, FileInfo);
+  DokanCacheEndChange(DokanInstance, newChange);
+  DokanCacheEndChange(DokanInstance, oldChange);
+  // Descriptors can be inherited from the new parent
+  DokanSecurityCacheChanged(DokanInstance,
+                            EventContext->Operation.SetFile.FileName,
+                            FileInfo->IsDirectory);
+  DokanSecurityCacheChanged(DokanInstance, newName, FileInfo->IsDirectory);
   free(newName);
   return status;
 }
 
 NTSTATUS
 DokanSetValidDataLengthInformation(PEVENT_CONTEXT EventContext,
-                                   PDOKAN_FILE_INFO FileInfo,
+                                   LPCWSTR FileName, PDOKAN_FILE_INFO FileInfo,
                                    PDOKAN_OPERATIONS DokanOperations) {
   PFILE_VALID_DATA_LENGTH_INFORMATION validInfo =
       (PFILE_VALID_DATA_LENGTH_INFORMATION)(
@@ -224,11 +239,30 @@ DokanSetValidDataLengthInformation(PEVENT_CONTEXT EventContext,
   if (!DokanOperations->SetEndOfFile)
     return STATUS_NOT_IMPLEMENTED;
 
-  return DokanOperations->SetEndOfFile(EventContext->Operation.SetFile.FileName,
+  return DokanOperations->SetEndOfFile(FileName,
                                        validInfo->ValidDataLength.QuadPart,
                                        FileInfo);
 }
 
+// Offset from which a size change can alter the content of the file, or -1
+// for the information classes that leave it as it is
+static LONGLONG DokanSetInformationChangeOffset(PEVENT_CONTEXT EventContext) {
+  PVOID buffer =
+      (PCHAR)EventContext + EventContext->Operation.SetFile.BufferOffset;
+
+  switch (EventContext->Operation.SetFile.FileInformationClass) {
+  case FileAllocationInformation:
+    return ((PFILE_ALLOCATION_INFORMATION)buffer)->AllocationSize.QuadPart;
+  case FileEndOfFileInformation:
+    return ((PFILE_END_OF_FILE_INFORMATION)buffer)->EndOfFile.QuadPart;
+  case FileValidDataLengthInformation:
+    return ((PFILE_VALID_DATA_LENGTH_INFORMATION)buffer)
+        ->ValidDataLength.QuadPart;
+  default:
+    return -1;
+  }
+}
+
 VOID DispatchSetInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                             PDOKAN_INSTANCE DokanInstance) {
   PEVENT_INFORMATION eventInfo;
@@ -236,6 +270,10 @@ VOID DispatchSetInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
   DOKAN_FILE_INFO fileInfo;
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
   ULONG sizeOfEventInfo = sizeof(EVENT_INFORMATION);
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
+  LONGLONG changeOffset;
+  PDOKAN_BLOCK_CACHE_FILE cacheChange = NULL;
 
   if (EventContext->Operation.SetFile.FileInformationClass == FileRenameInformation
 	  || EventContext->Operation.SetFile.FileInformationClass == FileRenameInformationEx) {
@@ -244,62 +282,81 @@ VOID DispatchSetInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
     sizeOfEventInfo += renameInfo->FileNameLength;
   }
 
-  CheckFileName(EventContext->Operation.SetFile.FileName);
-
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
+  // Renames and links always come with the name of the file
+  fileName = DokanGetEventFileName(
+      EventContext, openInfo, EventContext->Operation.SetFile.FileName,
+      EventContext->Operation.SetFile.FileNameLength, &name);
 
   DbgPrint("###SetFileInfo %04d  %d\n",
            openInfo != NULL ? openInfo->EventId : -1,
            EventContext->Operation.SetFile.FileInformationClass);
 
-  switch (EventContext->Operation.SetFile.FileInformationClass) {
-  case FileAllocationInformation:
-    status = DokanSetAllocationInformation(EventContext, &fileInfo,
-                                           DokanInstance->DokanOperations);
-    break;
-
-  case FileBasicInformation:
-    status = DokanSetBasicInformation(EventContext, &fileInfo,
-                                      DokanInstance->DokanOperations);
-    break;
-
-  case FileDispositionInformation:
-  case FileDispositionInformationEx:
-    status = DokanSetDispositionInformation(EventContext, &fileInfo,
-                                            DokanInstance->DokanOperations);
-    break;
-
-  case FileEndOfFileInformation:
-    status = DokanSetEndOfFileInformation(EventContext, &fileInfo,
-                                          DokanInstance->DokanOperations);
-    break;
-
-  case FileLinkInformation:
-    status = DokanSetLinkInformation(EventContext, &fileInfo,
-                                     DokanInstance->DokanOperations);
-    break;
-
-  case FilePositionInformation:
-    // this case is dealed with by driver
+  // The change applies after the writes gathered by the handle
+  status = DokanFlushGatheredWrites(DokanInstance, openInfo, fileName,
+                                    &fileInfo);
+  if (status == STATUS_SUCCESS) {
     status = STATUS_NOT_IMPLEMENTED;
-    break;
 
-  case FileRenameInformation:
-  case FileRenameInformationEx:
-    status = DokanSetRenameInformation(EventContext, &fileInfo,
-                                       DokanInstance->DokanOperations);
-    break;
+    // Blocks past the new size are dropped, the one holding it included
+    changeOffset = DokanSetInformationChangeOffset(EventContext);
+    if (changeOffset >= 0)
+      cacheChange = DokanCacheBeginChange(DokanInstance, fileName, changeOffset,
+                                          DOKAN_BLOCK_CACHE_WHOLE_FILE);
+
+    DokanStatisticsCallbackBegin();
+    switch (EventContext->Operation.SetFile.FileInformationClass) {
+    case FileAllocationInformation:
+      status = DokanSetAllocationInformation(EventContext, fileName, &fileInfo,
+                                             DokanInstance->DokanOperations);
+      break;
+
+    case FileBasicInformation:
+      status = DokanSetBasicInformation(EventContext, fileName, &fileInfo,
+                                        DokanInstance->DokanOperations);
+      break;
+
+    case FileDispositionInformation:
+    case FileDispositionInformationEx:
+      status = DokanSetDispositionInformation(EventContext, fileName, &fileInfo,
+                                              DokanInstance->DokanOperations);
+      break;
+
+    case FileEndOfFileInformation:
+      status = DokanSetEndOfFileInformation(EventContext, fileName, &fileInfo,
+                                            DokanInstance->DokanOperations);
+      break;
 
-  case FileValidDataLengthInformation:
-    status = DokanSetValidDataLengthInformation(EventContext, &fileInfo,
-                                                DokanInstance->DokanOperations);
-    break;
-  default:
-    DbgPrint("  unknown FileInformationClass %d\n",
-             EventContext->Operation.SetFile.FileInformationClass);
-    break;
+    case FileLinkInformation:
+      status = DokanSetLinkInformation(EventContext, &fileInfo,
+                                       DokanInstance->DokanOperations);
+      break;
+
+    case FilePositionInformation:
+      // this case is dealed with by driver
+      status = STATUS_NOT_IMPLEMENTED;
+      break;
+
+    case FileRenameInformation:
+    case FileRenameInformationEx:
+      status =
+          DokanSetRenameInformation(EventContext, &fileInfo, DokanInstance);
+      break;
+
+    case FileValidDataLengthInformation:
+      status = DokanSetValidDataLengthInformation(
+          EventContext, fileName, &fileInfo, DokanInstance->DokanOperations);
+      break;
+    default:
+      DbgPrint("  unknown FileInformationClass %d\n",
+               EventContext->Operation.SetFile.FileInformationClass);
+      break;
+    }
+    DokanStatisticsCallbackEnd();
+    DokanCacheEndChange(DokanInstance, cacheChange);
   }
+  DokanReleaseFileName(name);
 
   if (openInfo != NULL)
     openInfo->UserContext = fileInfo.Context;
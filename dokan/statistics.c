@@ -0,0 +1,371 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <process.h>
+#include "dokani.h"
+#include "histogram.h"
+
+C_ASSERT(DOKAN_LATENCY_BUCKETS == DOKAN_HISTOGRAM_BUCKETS);
+
+/**
+ * \struct DOKAN_DISPATCH_TIMER
+ * \brief State of the request being processed by the current DokanLoop thread
+ */
+typedef struct _DOKAN_DISPATCH_TIMER {
+  /** Performance counter when the current callback was entered */
+  LONGLONG CallbackStart;
+  /** Performance counter ticks spent in callbacks so far */
+  LONGLONG CallbackTicks;
+  /** Performance counter when the reply was sent, 0 if not sent yet */
+  LONGLONG ReplyTime;
+  /** Status of the reply */
+  NTSTATUS Status;
+  /** Size of the reply */
+  ULONG BytesOut;
+} DOKAN_DISPATCH_TIMER;
+
+static DOKAN_THREAD_LOCAL DOKAN_DISPATCH_TIMER g_DispatchTimer;
+
+static LONGLONG QueryPerformanceTicks() {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+}
+
+static ULONG64 TicksToMicroseconds(LONGLONG Ticks) {
+  static LONGLONG frequency = 0;
+  if (frequency == 0) {
+    LARGE_INTEGER value;
+    QueryPerformanceFrequency(&value);
+    frequency = value.QuadPart;
+  }
+  if (Ticks <= 0 || frequency == 0)
+    return 0;
+  // Split to avoid overflowing on long uptimes
+  return (ULONG64)(Ticks / frequency) * 1000000 +
+         (ULONG64)(Ticks % frequency) * 1000000 / frequency;
+}
+
+static VOID AddCounter(ULONG64 *Counter, ULONG64 Value) {
+  if (Value)
+    InterlockedExchangeAdd64((LONG64 volatile *)Counter, (LONG64)Value);
+}
+
+LONGLONG DokanStatisticsBeginDispatch() {
+  RtlZeroMemory(&g_DispatchTimer, sizeof(DOKAN_DISPATCH_TIMER));
+  return QueryPerformanceTicks();
+}
+
+VOID DokanStatisticsCallbackBegin() {
+  g_DispatchTimer.CallbackStart = QueryPerformanceTicks();
+}
+
+VOID DokanStatisticsCallbackEnd() {
+  g_DispatchTimer.CallbackTicks +=
+      QueryPerformanceTicks() - g_DispatchTimer.CallbackStart;
+}
+
+VOID DokanStatisticsReply(PEVENT_INFORMATION EventInfo, ULONG EventLength) {
+  g_DispatchTimer.ReplyTime = QueryPerformanceTicks();
+  g_DispatchTimer.Status = EventInfo->Status;
+  g_DispatchTimer.BytesOut = EventLength;
+}
+
+VOID DokanStatisticsEndDispatch(PDOKAN_INSTANCE DokanInstance,
+                                PEVENT_CONTEXT EventContext,
+                                LONGLONG DispatchStart) {
+  PDOKAN_OPERATION_STATISTICS stats;
+  LONGLONG end;
+  ULONG64 dispatchTime;
+  ULONG64 callbackTime;
+  ULONG64 bytesIn;
+
+  if (EventContext->MajorFunction > IRP_MJ_MAXIMUM_FUNCTION)
+    return;
+  stats = &DokanInstance->Statistics.Operations[EventContext->MajorFunction];
+
+  // Requests without reply, like close, end with their dispatch function
+  end = g_DispatchTimer.ReplyTime ? g_DispatchTimer.ReplyTime
+                                  : QueryPerformanceTicks();
+  dispatchTime = TicksToMicroseconds(end - DispatchStart);
+  callbackTime = TicksToMicroseconds(g_DispatchTimer.CallbackTicks);
+  bytesIn = EventContext->Length;
+  if (EventContext->MajorFunction == IRP_MJ_WRITE &&
+      EventContext->Operation.Write.BufferLength > bytesIn)
+    bytesIn = EventContext->Operation.Write.BufferLength;
+
+  InterlockedIncrement64((LONG64 volatile *)&stats->Count);
+  // Severity error, warnings like STATUS_NO_MORE_FILES are expected
+  if (((ULONG)g_DispatchTimer.Status >> 30) == 3)
+    InterlockedIncrement64((LONG64 volatile *)&stats->ErrorCount);
+  AddCounter(&stats->BytesIn, bytesIn);
+  AddCounter(&stats->BytesOut, g_DispatchTimer.BytesOut);
+  AddCounter(&stats->CallbackTime, callbackTime);
+  AddCounter(&stats->DispatchTime, dispatchTime);
+  InterlockedIncrement64(
+      (LONG64 volatile *)&stats
+          ->CallbackLatency[DokanHistogramBucket(callbackTime)]);
+  InterlockedIncrement64(
+      (LONG64 volatile *)&stats
+          ->DispatchLatency[DokanHistogramBucket(dispatchTime)]);
+
+  DokanTraceDispatch(EventContext, DispatchStart, g_DispatchTimer.Status,
+                     (ULONG)bytesIn, g_DispatchTimer.BytesOut,
+                     (ULONG)min(callbackTime, MAXULONG),
+                     (ULONG)min(dispatchTime, MAXULONG));
+}
+
+ULONG64 DOKANAPI DokanGetLatencyPercentile(const ULONG64 *Histogram,
+                                           ULONG Percentile) {
+  return DokanHistogramPercentile(Histogram, Percentile);
+}
+
+BOOL IsSameMountPoint(LPCWSTR MountPoint, LPCWSTR Other) {
+  if (IsMountPointDriveLetter(MountPoint) && IsMountPointDriveLetter(Other))
+    return towupper(MountPoint[0]) == towupper(Other[0]);
+  return _wcsicmp(MountPoint, Other) == 0;
+}
+
+// The block cache keeps its own counters
+static VOID DokanGetBlockCacheStatistics(
+    PDOKAN_INSTANCE DokanInstance, PDOKAN_BLOCK_CACHE_STATISTICS Statistics) {
+  DOKAN_BLOCK_CACHE_COUNTERS counters;
+
+  ZeroMemory(Statistics, sizeof(DOKAN_BLOCK_CACHE_STATISTICS));
+  if (DokanInstance->BlockCache == NULL)
+    return;
+  DokanBlockCacheGetCounters(DokanInstance->BlockCache, &counters);
+  Statistics->Hits = counters.Hits;
+  Statistics->Misses = counters.Misses;
+  Statistics->CoalescedMisses = counters.CoalescedMisses;
+  Statistics->BytesSaved = counters.BytesSaved;
+  Statistics->BytesFetched = counters.BytesFetched;
+  Statistics->Evictions = counters.Evictions;
+  Statistics->Invalidations = counters.Invalidations;
+  Statistics->Blocks = counters.Blocks;
+}
+
+static VOID DokanGetSecurityCacheStatistics(
+    PDOKAN_INSTANCE DokanInstance,
+    PDOKAN_SECURITY_CACHE_STATISTICS Statistics) {
+  DOKAN_SECURITY_CACHE_COUNTERS counters;
+
+  ZeroMemory(Statistics, sizeof(DOKAN_SECURITY_CACHE_STATISTICS));
+  if (DokanInstance->SecurityCache == NULL)
+    return;
+  DokanSecurityCacheGetCounters(DokanInstance->SecurityCache, &counters);
+  Statistics->Hits = counters.Hits;
+  Statistics->Misses = counters.Misses;
+  Statistics->Evictions = counters.Evictions;
+  Statistics->Invalidations = counters.Invalidations;
+  Statistics->Entries = counters.Entries;
+  Statistics->Descriptors = counters.Descriptors;
+  Statistics->DescriptorBytes = counters.DescriptorBytes;
+}
+
+BOOL DOKANAPI DokanGetStatistics(LPCWSTR MountPoint,
+                                 PDOKAN_STATISTICS Statistics) {
+  BOOL found = FALSE;
+  PLIST_ENTRY entry;
+
+  if (Statistics == NULL)
+    return FALSE;
+
+  EnterCriticalSection(&g_InstanceCriticalSection);
+  for (entry = g_InstanceList.Flink; entry != &g_InstanceList;
+       entry = entry->Flink) {
+    PDOKAN_INSTANCE instance =
+        CONTAINING_RECORD(entry, DOKAN_INSTANCE, ListEntry);
+    if (MountPoint == NULL ||
+        IsSameMountPoint(MountPoint, instance->MountPoint)) {
+      CopyMemory(Statistics, &instance->Statistics, sizeof(DOKAN_STATISTICS));
+      Statistics->Uptime = GetTickCount64() - instance->StartTime;
+      DokanGetBlockCacheStatistics(instance, &Statistics->BlockCache);
+      DokanGetSecurityCacheStatistics(instance, &Statistics->SecurityCache);
+      found = TRUE;
+      break;
+    }
+  }
+  LeaveCriticalSection(&g_InstanceCriticalSection);
+  return found;
+}
+
+// Compares a mount point given by the user with one of the driver mount
+// point list, which is prefixed by \DosDevices\.
+static BOOL IsDriverMountPoint(LPCWSTR MountPoint, LPCWSTR DriverMountPoint) {
+  size_t prefixLength = wcslen(L"\\DosDevices\\");
+  size_t length;
+
+  if (_wcsnicmp(DriverMountPoint, L"\\DosDevices\\", prefixLength) == 0)
+    DriverMountPoint += prefixLength;
+  if (IsMountPointDriveLetter(MountPoint) &&
+      IsMountPointDriveLetter(DriverMountPoint))
+    return towupper(MountPoint[0]) == towupper(DriverMountPoint[0]);
+
+  length = wcslen(MountPoint);
+  if (length > 0 && MountPoint[length - 1] == L'\\')
+    --length;
+  return wcslen(DriverMountPoint) == length &&
+         _wcsnicmp(MountPoint, DriverMountPoint, length) == 0;
+}
+
+BOOL DOKANAPI DokanGetVolumeMetrics(LPCWSTR MountPoint,
+                                    PDOKAN_VOLUME_METRICS Metrics) {
+  PDOKAN_CONTROL dokanControl;
+  ULONG nbRead = 0;
+  ULONG i;
+  ULONG returnedLength = 0;
+  WCHAR rawDeviceName[MAX_PATH];
+  BOOL found = FALSE;
+
+  if (MountPoint == NULL || Metrics == NULL)
+    return FALSE;
+
+  dokanControl = DokanGetMountPointList(FALSE, &nbRead);
+  if (dokanControl == NULL)
+    return FALSE;
+  for (i = 0; i < nbRead; ++i) {
+    if (IsDriverMountPoint(MountPoint, dokanControl[i].MountPoint)) {
+      // DeviceName is \Device\Volume{...}, open it as \\.\Volume{...}
+      LPCWSTR volumeName = wcsrchr(dokanControl[i].DeviceName, L'\\');
+      if (volumeName != NULL) {
+        GetRawDeviceName(volumeName, rawDeviceName, MAX_PATH);
+        found = TRUE;
+      }
+      break;
+    }
+  }
+  DokanReleaseMountPointList(dokanControl);
+  if (!found)
+    return FALSE;
+
+  ZeroMemory(Metrics, sizeof(DOKAN_VOLUME_METRICS));
+  return SendToDevice(rawDeviceName, IOCTL_GET_VOLUME_METRICS, NULL, 0,
+                      Metrics, sizeof(DOKAN_VOLUME_METRICS), &returnedLength);
+}
+
+static LPCSTR MajorFunctionName(ULONG MajorFunction) {
+  switch (MajorFunction) {
+  case IRP_MJ_CREATE:
+    return "Create";
+  case IRP_MJ_CLOSE:
+    return "Close";
+  case IRP_MJ_READ:
+    return "Read";
+  case IRP_MJ_WRITE:
+    return "Write";
+  case IRP_MJ_QUERY_INFORMATION:
+    return "QueryInformation";
+  case IRP_MJ_SET_INFORMATION:
+    return "SetInformation";
+  case IRP_MJ_FLUSH_BUFFERS:
+    return "FlushBuffers";
+  case IRP_MJ_QUERY_VOLUME_INFORMATION:
+    return "QueryVolumeInformation";
+  case IRP_MJ_DIRECTORY_CONTROL:
+    return "DirectoryControl";
+  case IRP_MJ_LOCK_CONTROL:
+    return "LockControl";
+  case IRP_MJ_CLEANUP:
+    return "Cleanup";
+  case IRP_MJ_QUERY_SECURITY:
+    return "QuerySecurity";
+  case IRP_MJ_SET_SECURITY:
+    return "SetSecurity";
+  default:
+    return "Other";
+  }
+}
+
+VOID DokanDumpStatistics(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_STATISTICS stats = &DokanInstance->Statistics;
+  DOKAN_BLOCK_CACHE_STATISTICS cache;
+  DOKAN_SECURITY_CACHE_STATISTICS securityCache;
+  ULONG64 lookups;
+  ULONG i;
+
+  DokanDbgPrintW(L"Dokan statistics of %s after %I64u s\n",
+                 DokanInstance->MountPoint,
+                 (GetTickCount64() - DokanInstance->StartTime) / 1000);
+  DokanDbgPrint("%-24s %10s %8s %12s %12s %8s %8s %8s %8s\n", "Operation",
+                "Count", "Errors", "BytesIn", "BytesOut", "CbP50", "CbP99",
+                "P50", "P99");
+  for (i = 0; i <= IRP_MJ_MAXIMUM_FUNCTION; ++i) {
+    PDOKAN_OPERATION_STATISTICS op = &stats->Operations[i];
+    if (op->Count == 0)
+      continue;
+    DokanDbgPrint("%-24s %10I64u %8I64u %12I64u %12I64u %8I64u %8I64u %8I64u "
+                  "%8I64u\n",
+                  MajorFunctionName(i), op->Count, op->ErrorCount, op->BytesIn,
+                  op->BytesOut,
+                  DokanGetLatencyPercentile(op->CallbackLatency, 50),
+                  DokanGetLatencyPercentile(op->CallbackLatency, 99),
+                  DokanGetLatencyPercentile(op->DispatchLatency, 50),
+                  DokanGetLatencyPercentile(op->DispatchLatency, 99));
+  }
+
+  if (DokanInstance->BlockCache != NULL) {
+    DokanGetBlockCacheStatistics(DokanInstance, &cache);
+    lookups = cache.Hits + cache.Misses;
+    DokanDbgPrint("Block cache: %I64u hits %I64u misses (%I64u coalesced) "
+                  "hit ratio %I64u%% bytes saved %I64u fetched %I64u "
+                  "evictions %I64u invalidations %I64u blocks %I64u\n",
+                  cache.Hits, cache.Misses, cache.CoalescedMisses,
+                  lookups != 0 ? cache.Hits * 100 / lookups : 0,
+                  cache.BytesSaved, cache.BytesFetched, cache.Evictions,
+                  cache.Invalidations, cache.Blocks);
+  }
+
+  if (DokanInstance->SecurityCache != NULL) {
+    DokanGetSecurityCacheStatistics(DokanInstance, &securityCache);
+    lookups = securityCache.Hits + securityCache.Misses;
+    DokanDbgPrint("Security cache: %I64u hits %I64u misses hit ratio "
+                  "%I64u%% evictions %I64u invalidations %I64u entries "
+                  "%I64u descriptors %I64u (%I64u bytes)\n",
+                  securityCache.Hits, securityCache.Misses,
+                  lookups != 0 ? securityCache.Hits * 100 / lookups : 0,
+                  securityCache.Evictions, securityCache.Invalidations,
+                  securityCache.Entries, securityCache.Descriptors,
+                  securityCache.DescriptorBytes);
+  }
+
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_WRITE_GATHERING) {
+    DokanDbgPrint("Write gathering: %I64u writes (%I64u bytes) in %I64u "
+                  "flushes, %I64u failed\n",
+                  stats->WriteGather.GatheredWrites,
+                  stats->WriteGather.GatheredBytes, stats->WriteGather.Flushes,
+                  stats->WriteGather.Errors);
+  }
+}
+
+UINT WINAPI DokanStatisticsDumpThread(PVOID Param) {
+  PDOKAN_INSTANCE DokanInstance = (PDOKAN_INSTANCE)Param;
+
+  while (WaitForSingleObject(DokanInstance->StatisticsStopEvent,
+                             DOKAN_STATISTICS_DUMP_INTERVAL) ==
+         WAIT_TIMEOUT) {
+    DokanDumpStatistics(DokanInstance);
+  }
+  DokanDumpStatistics(DokanInstance);
+
+  _endthreadex(0);
+  return 0;
+}
@@ -22,15 +22,25 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <process.h>
 #include "dokani.h"
 
+// Device handle the current DokanLoop thread received its request from
+static DOKAN_THREAD_LOCAL HANDLE g_DispatchDevice;
+// Last timeout reset sent by the current thread
+static DOKAN_THREAD_LOCAL ULONG g_ResetSerialNumber;
+static DOKAN_THREAD_LOCAL ULONGLONG g_ResetDeadline;
+
+VOID DokanSetDispatchDevice(HANDLE Device) {
+  g_DispatchDevice = Device;
+  g_ResetDeadline = 0;
+}
+
 BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO FileInfo) {
   BOOL status;
   ULONG returnedLength;
   PDOKAN_INSTANCE instance;
   PDOKAN_OPEN_INFO openInfo;
   PEVENT_CONTEXT eventContext;
-  PEVENT_INFORMATION eventInfo;
-  ULONG eventInfoSize = sizeof(EVENT_INFORMATION);
-  WCHAR rawDeviceName[MAX_PATH];
+  EVENT_INFORMATION eventInfo;
+  ULONGLONG now;
 
   openInfo = (PDOKAN_OPEN_INFO)(UINT_PTR)FileInfo->DokanContext;
 
@@ -48,62 +58,51 @@ BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO FileInfo) {
     return FALSE;
   }
 
-  eventInfo = (PEVENT_INFORMATION)malloc(eventInfoSize);
-  if (eventInfo == NULL) {
-    return FALSE;
+  if (Timeout > DOKAN_RESET_TIMEOUT_MAX) {
+    Timeout = DOKAN_RESET_TIMEOUT_MAX;
+  }
+
+  // Heartbeats of a long operation would mostly move the deadline by the time
+  // elapsed since the previous one, skip them until that is worth an ioctl
+  now = GetTickCount64();
+  if (g_ResetDeadline != 0 &&
+      g_ResetSerialNumber == eventContext->SerialNumber &&
+      g_ResetDeadline + Timeout / 8 >= now + Timeout) {
+    return TRUE;
+  }
+
+  RtlZeroMemory(&eventInfo, sizeof(EVENT_INFORMATION));
+  eventInfo.SerialNumber = eventContext->SerialNumber;
+  eventInfo.Operation.ResetTimeout.Timeout = Timeout;
+  if (g_DispatchDevice != NULL) {
+    status = DokanDeviceIoControl(g_DispatchDevice, IOCTL_RESET_TIMEOUT,
+                                  &eventInfo, sizeof(EVENT_INFORMATION), NULL,
+                                  0, &returnedLength);
+  } else {
+    WCHAR rawDeviceName[MAX_PATH];
+    GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+    status = SendToDevice(rawDeviceName, IOCTL_RESET_TIMEOUT, &eventInfo,
+                          sizeof(EVENT_INFORMATION), NULL, 0, &returnedLength);
+  }
+
+  if (status) {
+    g_ResetSerialNumber = eventContext->SerialNumber;
+    g_ResetDeadline = now + Timeout;
   }
-  RtlZeroMemory(eventInfo, eventInfoSize);
-
-  eventInfo->SerialNumber = eventContext->SerialNumber;
-  eventInfo->Operation.ResetTimeout.Timeout = Timeout;
-  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
-  status = SendToDevice(rawDeviceName,
-      IOCTL_RESET_TIMEOUT, eventInfo, eventInfoSize, NULL, 0, &returnedLength);
-  free(eventInfo);
   return status;
 }
 
 /* Legacy KeepAlive - Remove for 2.0.0 */
 UINT WINAPI DokanKeepAlive(PVOID instance) {
   PDOKAN_INSTANCE DokanInstance = (PDOKAN_INSTANCE)instance;
-  HANDLE device;
   ULONG ReturnedLength;
   WCHAR rawDeviceName[MAX_PATH];
 
   GetRawDeviceName(DokanInstance->DeviceName, rawDeviceName, MAX_PATH);
 
   while (TRUE) {
-
-    device = CreateFile(rawDeviceName,
-        GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
-        FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
-        NULL,                               // lpSecurityAttributes
-        OPEN_EXISTING,                      // dwCreationDistribution
-        0,                                  // dwFlagsAndAttributes
-        NULL                                // hTemplateFile
-    );
-
-    if (device == INVALID_HANDLE_VALUE) {
-      DbgPrint(
-          "Dokan Error: DokanKeepAlive CreateFile failed %ws: %d\n",
-          rawDeviceName,
-          GetLastError());
-      break;
-    }
-
-    BOOL status = DeviceIoControl(device,          // Handle to device
-                                  IOCTL_KEEPALIVE, // IO Control code
-                                  NULL,            // Input Buffer to driver.
-                                  0,    // Length of input buffer in bytes.
-                                  NULL, // Output Buffer from driver.
-                                  0,    // Length of output buffer in bytes.
-                                  &ReturnedLength, // Bytes placed in buffer.
-                                  NULL             // synchronous call
-    );
-
-    CloseHandle(device);
-
-    if (!status) {
+    if (!SendToDevice(rawDeviceName, IOCTL_KEEPALIVE, NULL, 0, NULL, 0,
+                      &ReturnedLength)) {
       break;
     }
 
@@ -0,0 +1,318 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+#include "tracering.h"
+
+#include <strsafe.h>
+
+C_ASSERT(DOKAN_TRACE_RING_SIZE == DOKAN_TRACE_RING_ENTRIES);
+C_ASSERT(DOKAN_TRACE_MAGIC == DOKAN_TRACE_FILE_MAGIC);
+C_ASSERT(DOKAN_TRACE_VERSION == DOKAN_TRACE_FILE_VERSION);
+C_ASSERT(sizeof(DOKAN_TRACE_FILE_HEADER) == DOKAN_TRACE_FILE_HEADER_SIZE);
+C_ASSERT(sizeof(DOKAN_TRACE_RECORD) == DOKAN_TRACE_FILE_RECORD_SIZE);
+
+// Enough for every DokanLoop thread of two instances at their maximum
+#define DOKAN_TRACE_MAX_RINGS (DOKAN_MAX_THREAD * 2)
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+/**
+ * \struct DOKAN_TRACE_RING
+ * \brief Last requests dispatched by one DokanLoop thread
+ *
+ * Only the owner thread writes to the ring. A ring is handed over to another
+ * thread when its owner stops, and is only freed when the library is unloaded
+ * so readers never see it disappear.
+ */
+typedef struct _DOKAN_TRACE_RING {
+  /** 1 while a thread writes to the ring */
+  volatile LONG Owned;
+  DOKAN_TRACE_RING_BUFFER Buffer;
+} DOKAN_TRACE_RING, *PDOKAN_TRACE_RING;
+
+static PDOKAN_TRACE_RING volatile g_TraceRings[DOKAN_TRACE_MAX_RINGS];
+
+static DOKAN_THREAD_LOCAL PDOKAN_TRACE_RING g_TraceRing;
+static DOKAN_THREAD_LOCAL BOOL g_TraceRingUnavailable;
+
+static volatile LONG g_TraceStarted = 0;
+static HANDLE g_TraceDumpEvent = NULL;
+static HANDLE g_TraceDumpWait = NULL;
+
+static PDOKAN_TRACE_RING ClaimTraceRing() {
+  PDOKAN_TRACE_RING ring;
+  ULONG i;
+
+  // Take over the ring of a stopped thread before growing the pool
+  for (i = 0; i < DOKAN_TRACE_MAX_RINGS; ++i) {
+    ring = g_TraceRings[i];
+    if (ring == NULL)
+      break;
+    if (InterlockedCompareExchange(&ring->Owned, 1, 0) == 0)
+      return ring;
+  }
+
+  ring = (PDOKAN_TRACE_RING)calloc(1, sizeof(DOKAN_TRACE_RING));
+  if (ring == NULL)
+    return NULL;
+  ring->Owned = 1;
+  for (; i < DOKAN_TRACE_MAX_RINGS; ++i) {
+    if (InterlockedCompareExchangePointer((PVOID volatile *)&g_TraceRings[i],
+                                          ring, NULL) == NULL)
+      return ring;
+  }
+  free(ring);
+  return NULL;
+}
+
+static ULONG HashFileName(LPCWSTR FileName, ULONG FileNameLength) {
+  const UCHAR *bytes = (const UCHAR *)FileName;
+  ULONG hash = FNV_OFFSET_BASIS;
+  ULONG i;
+
+  if (FileNameLength == 0)
+    return 0;
+  for (i = 0; i < FileNameLength; ++i) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static ULONG EventContextFileNameHash(PEVENT_CONTEXT EventContext) {
+  switch (EventContext->MajorFunction) {
+  case IRP_MJ_CREATE:
+    return HashFileName(
+        (LPCWSTR)((PCHAR)&EventContext->Operation.Create +
+                  EventContext->Operation.Create.FileNameOffset),
+        EventContext->Operation.Create.FileNameLength);
+  case IRP_MJ_CLEANUP:
+    return HashFileName(EventContext->Operation.Cleanup.FileName,
+                        EventContext->Operation.Cleanup.FileNameLength);
+  case IRP_MJ_CLOSE:
+    return HashFileName(EventContext->Operation.Close.FileName,
+                        EventContext->Operation.Close.FileNameLength);
+  case IRP_MJ_DIRECTORY_CONTROL:
+    return HashFileName(EventContext->Operation.Directory.DirectoryName,
+                        EventContext->Operation.Directory.DirectoryNameLength);
+  case IRP_MJ_READ:
+    return HashFileName(EventContext->Operation.Read.FileName,
+                        EventContext->Operation.Read.FileNameLength);
+  case IRP_MJ_WRITE:
+    return HashFileName(EventContext->Operation.Write.FileName,
+                        EventContext->Operation.Write.FileNameLength);
+  case IRP_MJ_QUERY_INFORMATION:
+    return HashFileName(EventContext->Operation.File.FileName,
+                        EventContext->Operation.File.FileNameLength);
+  case IRP_MJ_SET_INFORMATION:
+    return HashFileName(EventContext->Operation.SetFile.FileName,
+                        EventContext->Operation.SetFile.FileNameLength);
+  case IRP_MJ_LOCK_CONTROL:
+    return HashFileName(EventContext->Operation.Lock.FileName,
+                        EventContext->Operation.Lock.FileNameLength);
+  case IRP_MJ_FLUSH_BUFFERS:
+    return HashFileName(EventContext->Operation.Flush.FileName,
+                        EventContext->Operation.Flush.FileNameLength);
+  case IRP_MJ_QUERY_SECURITY:
+    return HashFileName(EventContext->Operation.Security.FileName,
+                        EventContext->Operation.Security.FileNameLength);
+  case IRP_MJ_SET_SECURITY:
+    return HashFileName(EventContext->Operation.SetSecurity.FileName,
+                        EventContext->Operation.SetSecurity.FileNameLength);
+  default:
+    return 0;
+  }
+}
+
+VOID DokanTraceDispatch(PEVENT_CONTEXT EventContext, LONGLONG DispatchStart,
+                        NTSTATUS Status, ULONG BytesIn, ULONG BytesOut,
+                        ULONG CallbackTime, ULONG DispatchTime) {
+  PDOKAN_TRACE_RING ring = g_TraceRing;
+  DOKAN_TRACE_ENTRY entry;
+
+  if (ring == NULL) {
+    if (g_TraceRingUnavailable)
+      return;
+    ring = ClaimTraceRing();
+    if (ring == NULL) {
+      g_TraceRingUnavailable = TRUE;
+      return;
+    }
+    g_TraceRing = ring;
+  }
+
+  entry.Timestamp = (ULONG64)DispatchStart;
+  entry.Sequence = 0;
+  entry.ThreadId = GetCurrentThreadId();
+  entry.SerialNumber = EventContext->SerialNumber;
+  entry.FileNameHash = EventContextFileNameHash(EventContext);
+  entry.Status = Status;
+  entry.BytesIn = BytesIn;
+  entry.BytesOut = BytesOut;
+  entry.CallbackTime = CallbackTime;
+  entry.DispatchTime = DispatchTime;
+  entry.MajorFunction = EventContext->MajorFunction;
+  entry.MinorFunction = EventContext->MinorFunction;
+  DokanTraceRingWrite(&ring->Buffer, &entry);
+}
+
+VOID DokanTraceThreadStopped() {
+  PDOKAN_TRACE_RING ring = g_TraceRing;
+
+  // Records are kept for the next thread that takes the ring
+  if (ring != NULL) {
+    g_TraceRing = NULL;
+    InterlockedExchange(&ring->Owned, 0);
+  }
+}
+
+BOOL DOKANAPI DokanDumpTrace(LPCWSTR FileName) {
+  DOKAN_TRACE_FILE_INFO info;
+  UCHAR header[DOKAN_TRACE_FILE_HEADER_SIZE];
+  PDOKAN_TRACE_ENTRY entries;
+  PUCHAR records;
+  LARGE_INTEGER frequency;
+  HANDLE file;
+  DWORD written;
+  BOOL result = TRUE;
+  ULONG i;
+  ULONG j;
+
+  if (FileName == NULL)
+    return FALSE;
+
+  entries = (PDOKAN_TRACE_ENTRY)malloc(sizeof(DOKAN_TRACE_ENTRY) *
+                                       DOKAN_TRACE_RING_ENTRIES);
+  records = (PUCHAR)malloc(DOKAN_TRACE_FILE_RECORD_SIZE *
+                           DOKAN_TRACE_RING_ENTRIES);
+  if (entries == NULL || records == NULL) {
+    free(entries);
+    free(records);
+    return FALSE;
+  }
+
+  file = CreateFileW(FileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                     FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    DbgPrintW(L"DokanDumpTrace: failed to create %s (%d)\n", FileName,
+              GetLastError());
+    free(entries);
+    free(records);
+    return FALSE;
+  }
+
+  QueryPerformanceFrequency(&frequency);
+  info.RecordCount = 0;
+  info.Frequency = (ULONG64)frequency.QuadPart;
+  info.ProcessId = GetCurrentProcessId();
+  DokanTraceEncodeHeader(&info, header);
+
+  // The header is written again once the record count is known
+  result = WriteFile(file, header, sizeof(header), &written, NULL);
+  for (i = 0; result && i < DOKAN_TRACE_MAX_RINGS; ++i) {
+    PDOKAN_TRACE_RING ring = g_TraceRings[i];
+    ULONG count;
+    if (ring == NULL)
+      break;
+    count = DokanTraceRingCopy(&ring->Buffer, entries);
+    if (count == 0)
+      continue;
+    for (j = 0; j < count; ++j)
+      DokanTraceEncodeRecord(&entries[j],
+                             records + j * DOKAN_TRACE_FILE_RECORD_SIZE);
+    result = WriteFile(file, records, count * DOKAN_TRACE_FILE_RECORD_SIZE,
+                       &written, NULL);
+    info.RecordCount += count;
+  }
+  if (result) {
+    DokanTraceEncodeHeader(&info, header);
+    result = SetFilePointer(file, 0, NULL, FILE_BEGIN) !=
+                 INVALID_SET_FILE_POINTER &&
+             WriteFile(file, header, sizeof(header), &written, NULL);
+  }
+
+  CloseHandle(file);
+  free(entries);
+  free(records);
+  if (!result) {
+    DbgPrintW(L"DokanDumpTrace: failed to write %s (%d)\n", FileName,
+              GetLastError());
+  }
+  return result;
+}
+
+static VOID CALLBACK DokanTraceDumpCallback(PVOID Parameter,
+                                            BOOLEAN TimerOrWaitFired) {
+  WCHAR fileName[MAX_PATH];
+  DWORD length;
+
+  UNREFERENCED_PARAMETER(Parameter);
+  UNREFERENCED_PARAMETER(TimerOrWaitFired);
+
+  length = GetTempPathW(MAX_PATH, fileName);
+  if (length == 0 || length >= MAX_PATH)
+    return;
+  if (FAILED(StringCchPrintfW(fileName + length, MAX_PATH - length,
+                              L"dokan_trace_%lu.bin",
+                              GetCurrentProcessId())))
+    return;
+  DokanDumpTrace(fileName);
+}
+
+VOID DokanTraceStart() {
+  WCHAR eventName[64];
+
+  if (InterlockedCompareExchange(&g_TraceStarted, 1, 0) != 0)
+    return;
+
+  if (FAILED(StringCchPrintfW(eventName, 64, DOKAN_TRACE_DUMP_EVENT_NAME,
+                              GetCurrentProcessId())))
+    return;
+  // Auto reset so the wait is armed again after each dump
+  g_TraceDumpEvent = CreateEventW(NULL, FALSE, FALSE, eventName);
+  if (g_TraceDumpEvent == NULL) {
+    DbgPrintW(L"DokanTraceStart: failed to create %s (%d)\n", eventName,
+              GetLastError());
+    return;
+  }
+  if (!RegisterWaitForSingleObject(&g_TraceDumpWait, g_TraceDumpEvent,
+                                   DokanTraceDumpCallback, NULL, INFINITE,
+                                   WT_EXECUTELONGFUNCTION)) {
+    DbgPrintW(L"DokanTraceStart: RegisterWaitForSingleObject failed (%d)\n",
+              GetLastError());
+    g_TraceDumpWait = NULL;
+  }
+}
+
+VOID DokanTraceCleanup() {
+  ULONG i;
+
+  if (g_TraceDumpWait != NULL)
+    UnregisterWait(g_TraceDumpWait);
+  if (g_TraceDumpEvent != NULL)
+    CloseHandle(g_TraceDumpEvent);
+  for (i = 0; i < DOKAN_TRACE_MAX_RINGS; ++i) {
+    free(g_TraceRings[i]);
+    g_TraceRings[i] = NULL;
+  }
+}
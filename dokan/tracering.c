@@ -0,0 +1,170 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracering.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#define TraceRingExchange(Target, Value)                                       \
+  InterlockedExchange64((volatile LONG64 *)(Target), (LONG64)(Value))
+// Plain 64 bit reads can be torn on x86
+#define TraceRingRead(Target)                                                  \
+  (uint64_t) InterlockedCompareExchange64((volatile LONG64 *)(Target), 0, 0)
+#define TraceRingBarrier() MemoryBarrier()
+#else
+#define TraceRingExchange(Target, Value)                                       \
+  __atomic_store_n((volatile int64_t *)(Target), (int64_t)(Value),            \
+                   __ATOMIC_SEQ_CST)
+#define TraceRingRead(Target)                                                  \
+  (uint64_t) __atomic_load_n((volatile int64_t *)(Target), __ATOMIC_SEQ_CST)
+#define TraceRingBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+void DokanTraceRingWrite(PDOKAN_TRACE_RING_BUFFER Ring,
+                         const DOKAN_TRACE_ENTRY *Entry) {
+  uint64_t sequence = (uint64_t)Ring->Head + 1;
+  PDOKAN_TRACE_ENTRY entry =
+      &Ring->Entries[(sequence - 1) % DOKAN_TRACE_RING_ENTRIES];
+
+  // Readers drop the entry if its sequence changed while they copied it
+  TraceRingExchange(&entry->Sequence, 0);
+  entry->Timestamp = Entry->Timestamp;
+  entry->ThreadId = Entry->ThreadId;
+  entry->SerialNumber = Entry->SerialNumber;
+  entry->FileNameHash = Entry->FileNameHash;
+  entry->Status = Entry->Status;
+  entry->BytesIn = Entry->BytesIn;
+  entry->BytesOut = Entry->BytesOut;
+  entry->CallbackTime = Entry->CallbackTime;
+  entry->DispatchTime = Entry->DispatchTime;
+  entry->MajorFunction = Entry->MajorFunction;
+  entry->MinorFunction = Entry->MinorFunction;
+  TraceRingExchange(&entry->Sequence, sequence);
+  TraceRingExchange(&Ring->Head, sequence);
+}
+
+uint32_t DokanTraceRingCopy(PDOKAN_TRACE_RING_BUFFER Ring,
+                            PDOKAN_TRACE_ENTRY Entries) {
+  uint64_t head = TraceRingRead(&Ring->Head);
+  uint64_t sequence;
+  uint32_t count = 0;
+
+  sequence = head > DOKAN_TRACE_RING_ENTRIES
+                 ? head - DOKAN_TRACE_RING_ENTRIES + 1
+                 : 1;
+  for (; sequence <= head; ++sequence) {
+    PDOKAN_TRACE_ENTRY entry =
+        &Ring->Entries[(sequence - 1) % DOKAN_TRACE_RING_ENTRIES];
+    if (TraceRingRead(&entry->Sequence) != sequence)
+      continue;
+    memcpy(&Entries[count], entry, sizeof(DOKAN_TRACE_ENTRY));
+    TraceRingBarrier();
+    if (TraceRingRead(&entry->Sequence) != sequence)
+      continue;
+    Entries[count].Sequence = sequence;
+    ++count;
+  }
+  return count;
+}
+
+static void Put16(uint8_t *Buffer, uint16_t Value) {
+  Buffer[0] = (uint8_t)Value;
+  Buffer[1] = (uint8_t)(Value >> 8);
+}
+
+static void Put32(uint8_t *Buffer, uint32_t Value) {
+  Put16(Buffer, (uint16_t)Value);
+  Put16(Buffer + 2, (uint16_t)(Value >> 16));
+}
+
+static void Put64(uint8_t *Buffer, uint64_t Value) {
+  Put32(Buffer, (uint32_t)Value);
+  Put32(Buffer + 4, (uint32_t)(Value >> 32));
+}
+
+static uint32_t Get32(const uint8_t *Buffer) {
+  return (uint32_t)Buffer[0] | (uint32_t)Buffer[1] << 8 |
+         (uint32_t)Buffer[2] << 16 | (uint32_t)Buffer[3] << 24;
+}
+
+static uint64_t Get64(const uint8_t *Buffer) {
+  return (uint64_t)Get32(Buffer) | (uint64_t)Get32(Buffer + 4) << 32;
+}
+
+// Layout of DOKAN_TRACE_FILE_HEADER
+void DokanTraceEncodeHeader(const DOKAN_TRACE_FILE_INFO *Info,
+                            uint8_t *Buffer) {
+  Put32(Buffer, DOKAN_TRACE_FILE_MAGIC);
+  Put32(Buffer + 4, DOKAN_TRACE_FILE_VERSION);
+  Put32(Buffer + 8, DOKAN_TRACE_FILE_RECORD_SIZE);
+  Put32(Buffer + 12, Info->RecordCount);
+  Put64(Buffer + 16, Info->Frequency);
+  Put32(Buffer + 24, Info->ProcessId);
+  Put32(Buffer + 28, 0);
+}
+
+int DokanTraceDecodeHeader(const uint8_t *Buffer,
+                           PDOKAN_TRACE_FILE_INFO Info) {
+  if (Get32(Buffer) != DOKAN_TRACE_FILE_MAGIC ||
+      Get32(Buffer + 4) != DOKAN_TRACE_FILE_VERSION ||
+      Get32(Buffer + 8) != DOKAN_TRACE_FILE_RECORD_SIZE)
+    return 0;
+  Info->RecordCount = Get32(Buffer + 12);
+  Info->Frequency = Get64(Buffer + 16);
+  Info->ProcessId = Get32(Buffer + 24);
+  return Info->Frequency != 0;
+}
+
+// Layout of DOKAN_TRACE_RECORD
+void DokanTraceEncodeRecord(const DOKAN_TRACE_ENTRY *Entry, uint8_t *Buffer) {
+  Put64(Buffer, Entry->Timestamp);
+  Put64(Buffer + 8, Entry->Sequence);
+  Put32(Buffer + 16, Entry->ThreadId);
+  Put32(Buffer + 20, Entry->SerialNumber);
+  Put32(Buffer + 24, Entry->FileNameHash);
+  Put32(Buffer + 28, (uint32_t)Entry->Status);
+  Put32(Buffer + 32, Entry->BytesIn);
+  Put32(Buffer + 36, Entry->BytesOut);
+  Put32(Buffer + 40, Entry->CallbackTime);
+  Put32(Buffer + 44, Entry->DispatchTime);
+  Buffer[48] = Entry->MajorFunction;
+  Buffer[49] = Entry->MinorFunction;
+  Put16(Buffer + 50, 0);
+  Put32(Buffer + 52, 0);
+}
+
+void DokanTraceDecodeRecord(const uint8_t *Buffer, PDOKAN_TRACE_ENTRY Entry) {
+  Entry->Timestamp = Get64(Buffer);
+  Entry->Sequence = Get64(Buffer + 8);
+  Entry->ThreadId = Get32(Buffer + 16);
+  Entry->SerialNumber = Get32(Buffer + 20);
+  Entry->FileNameHash = Get32(Buffer + 24);
+  Entry->Status = (int32_t)Get32(Buffer + 28);
+  Entry->BytesIn = Get32(Buffer + 32);
+  Entry->BytesOut = Get32(Buffer + 36);
+  Entry->CallbackTime = Get32(Buffer + 40);
+  Entry->DispatchTime = Get32(Buffer + 44);
+  Entry->MajorFunction = Buffer[48];
+  Entry->MinorFunction = Buffer[49];
+}
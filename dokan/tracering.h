@@ -0,0 +1,105 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_TRACERING_H_
+#define DOKAN_TRACERING_H_
+
+// Trace rings of the requests dispatched by DokanLoop threads and the format
+// of the files DokanDumpTrace writes.
+//
+// A ring keeps the last DOKAN_TRACE_RING_ENTRIES entries written by its only
+// writer. Readers copy it at any time without a lock: an entry is cleared
+// before it is written and stamped with its sequence after, the copies whose
+// sequence changed while they were made are dropped.
+//
+// Trace files are a header followed by the records, both little-endian with
+// the layout of DOKAN_TRACE_FILE_HEADER and DOKAN_TRACE_RECORD of dokan.h.
+//
+// This file and tracering.c only depend on the C runtime and on either
+// Windows or GCC atomics, samples/trace_test checks them on any platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// DOKAN_TRACE_RING_SIZE, DOKAN_TRACE_MAGIC and DOKAN_TRACE_VERSION of dokan.h
+#define DOKAN_TRACE_RING_ENTRIES 1024
+#define DOKAN_TRACE_FILE_MAGIC 0x52544B44
+#define DOKAN_TRACE_FILE_VERSION 1
+// Bytes of an encoded header and record
+#define DOKAN_TRACE_FILE_HEADER_SIZE 32
+#define DOKAN_TRACE_FILE_RECORD_SIZE 56
+
+typedef struct _DOKAN_TRACE_ENTRY {
+  uint64_t Timestamp;
+  // Position in the ring starting at 1, set by DokanTraceRingWrite
+  uint64_t Sequence;
+  uint32_t ThreadId;
+  uint32_t SerialNumber;
+  uint32_t FileNameHash;
+  int32_t Status;
+  uint32_t BytesIn;
+  uint32_t BytesOut;
+  uint32_t CallbackTime;
+  uint32_t DispatchTime;
+  uint8_t MajorFunction;
+  uint8_t MinorFunction;
+} DOKAN_TRACE_ENTRY, *PDOKAN_TRACE_ENTRY;
+
+typedef struct _DOKAN_TRACE_RING_BUFFER {
+  // Sequence of the last entry written
+  volatile int64_t Head;
+  DOKAN_TRACE_ENTRY Entries[DOKAN_TRACE_RING_ENTRIES];
+} DOKAN_TRACE_RING_BUFFER, *PDOKAN_TRACE_RING_BUFFER;
+
+typedef struct _DOKAN_TRACE_FILE_INFO {
+  uint32_t RecordCount;
+  uint64_t Frequency;
+  uint32_t ProcessId;
+} DOKAN_TRACE_FILE_INFO, *PDOKAN_TRACE_FILE_INFO;
+
+// Writes Entry after the last one, overwriting the oldest once the ring is
+// full. Only called by the writer of the ring.
+void DokanTraceRingWrite(PDOKAN_TRACE_RING_BUFFER Ring,
+                         const DOKAN_TRACE_ENTRY *Entry);
+
+// Copies the entries of the ring that are not being written, oldest first,
+// to the DOKAN_TRACE_RING_ENTRIES of Entries. Returns their number.
+uint32_t DokanTraceRingCopy(PDOKAN_TRACE_RING_BUFFER Ring,
+                            PDOKAN_TRACE_ENTRY Entries);
+
+void DokanTraceEncodeHeader(const DOKAN_TRACE_FILE_INFO *Info,
+                            uint8_t *Buffer);
+
+// Returns 0 if Buffer is not the header of a trace file of this version.
+int DokanTraceDecodeHeader(const uint8_t *Buffer, PDOKAN_TRACE_FILE_INFO Info);
+
+void DokanTraceEncodeRecord(const DOKAN_TRACE_ENTRY *Entry, uint8_t *Buffer);
+
+void DokanTraceDecodeRecord(const uint8_t *Buffer, PDOKAN_TRACE_ENTRY Entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_TRACERING_H_
@@ -53,18 +53,231 @@ NTSTATUS DOKAN_CALLBACK DokanGetVolumeInformation(
   return STATUS_SUCCESS;
 }
 
+// Calls GetVolumeInformation, or the default when it is not implemented
+static NTSTATUS DokanCallGetVolumeInformation(PDOKAN_INSTANCE DokanInstance,
+                                              PDOKAN_FILE_INFO FileInfo,
+                                              PDOKAN_VOLUME_INFORMATION Info) {
+  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+
+  RtlZeroMemory(Info->VolumeName, sizeof(Info->VolumeName));
+  RtlZeroMemory(Info->FileSystemName, sizeof(Info->FileSystemName));
+
+  if (DokanInstance->DokanOperations->GetVolumeInformation) {
+    status = DokanInstance->DokanOperations->GetVolumeInformation(
+        Info->VolumeName,                         // VolumeNameBuffer
+        sizeof(Info->VolumeName) / sizeof(WCHAR), // VolumeNameSize
+        &Info->VolumeSerialNumber,                // VolumeSerialNumber
+        &Info->MaximumComponentLength,            // MaximumComponentLength
+        &Info->FileSystemFlags,                   // FileSystemFlags
+        Info->FileSystemName,                     // FileSystemNameBuffer
+        sizeof(Info->FileSystemName) / sizeof(WCHAR), // FileSystemNameSize
+        FileInfo);
+  }
+
+  if (status == STATUS_NOT_IMPLEMENTED) {
+    status = DokanGetVolumeInformation(
+        Info->VolumeName,                         // VolumeNameBuffer
+        sizeof(Info->VolumeName) / sizeof(WCHAR), // VolumeNameSize
+        &Info->VolumeSerialNumber,                // VolumeSerialNumber
+        &Info->MaximumComponentLength,            // MaximumComponentLength
+        &Info->FileSystemFlags,                   // FileSystemFlags
+        Info->FileSystemName,                     // FileSystemNameBuffer
+        sizeof(Info->FileSystemName) / sizeof(WCHAR), // FileSystemNameSize
+        FileInfo);
+  }
+
+  // Names are not always terminated when they fill their buffer
+  Info->VolumeName[MAX_PATH - 1] = L'\0';
+  Info->FileSystemName[MAX_PATH - 1] = L'\0';
+  return status;
+}
+
+// Calls GetDiskFreeSpace, or the default when it is not implemented
+static NTSTATUS DokanCallGetDiskFreeSpace(PDOKAN_INSTANCE DokanInstance,
+                                          PDOKAN_FILE_INFO FileInfo,
+                                          PDOKAN_VOLUME_INFORMATION Info) {
+  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+
+  if (DokanInstance->DokanOperations->GetDiskFreeSpace) {
+    status = DokanInstance->DokanOperations->GetDiskFreeSpace(
+        &Info->FreeBytesAvailable,     // FreeBytesAvailable
+        &Info->TotalNumberOfBytes,     // TotalNumberOfBytes
+        &Info->TotalNumberOfFreeBytes, // TotalNumberOfFreeBytes
+        FileInfo);
+  }
+
+  if (status == STATUS_NOT_IMPLEMENTED) {
+    status = DokanGetDiskFreeSpace(
+        &Info->FreeBytesAvailable,     // FreeBytesAvailable
+        &Info->TotalNumberOfBytes,     // TotalNumberOfBytes
+        &Info->TotalNumberOfFreeBytes, // TotalNumberOfFreeBytes
+        FileInfo);
+  }
+
+  return status;
+}
+
+static BOOL DokanLookupVolumeInformation(PDOKAN_INSTANCE DokanInstance,
+                                         PDOKAN_VOLUME_INFORMATION Info) {
+  BOOL found;
+
+  AcquireSRWLockShared(&DokanInstance->VolumeInformationLock);
+  found = DokanInstance->VolumeInformationExpiry > GetTickCount64();
+  if (found)
+    *Info = DokanInstance->VolumeInformation;
+  ReleaseSRWLockShared(&DokanInstance->VolumeInformationLock);
+  return found;
+}
+
+// Gives the driver a copy of Info, or drops its copy when Info is NULL
+static VOID DokanSendVolumeInformation(PDOKAN_INSTANCE DokanInstance,
+                                       PDOKAN_VOLUME_INFORMATION Info,
+                                       ULONG Validity) {
+  EVENT_VOLUME_INFORMATION volumeInfo;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength;
+  size_t volumeNameLength = 0;
+  size_t fileSystemNameLength = 0;
+
+  RtlZeroMemory(&volumeInfo, sizeof(EVENT_VOLUME_INFORMATION));
+  if (Info != NULL) {
+    volumeNameLength = wcslen(Info->VolumeName);
+    fileSystemNameLength = wcslen(Info->FileSystemName);
+  }
+  // Names too long for the driver copy are only answered by the library
+  if (Info != NULL &&
+      volumeNameLength <= DOKAN_VOLUME_INFORMATION_NAME_MAX &&
+      fileSystemNameLength <= DOKAN_VOLUME_INFORMATION_NAME_MAX) {
+    volumeInfo.Validity = Validity;
+    volumeInfo.VolumeSerialNumber = Info->VolumeSerialNumber;
+    volumeInfo.MaximumComponentLength = Info->MaximumComponentLength;
+    volumeInfo.FileSystemFlags = Info->FileSystemFlags;
+    volumeInfo.FreeBytesAvailable = Info->FreeBytesAvailable;
+    volumeInfo.TotalNumberOfBytes = Info->TotalNumberOfBytes;
+    volumeInfo.TotalNumberOfFreeBytes = Info->TotalNumberOfFreeBytes;
+    volumeInfo.AllocationUnitSize =
+        DokanInstance->DokanOptions->AllocationUnitSize;
+    volumeInfo.SectorSize = DokanInstance->DokanOptions->SectorSize;
+    volumeInfo.VolumeNameLength = (ULONG)(volumeNameLength * sizeof(WCHAR));
+    volumeInfo.FileSystemNameLength =
+        (ULONG)(fileSystemNameLength * sizeof(WCHAR));
+    RtlCopyMemory(volumeInfo.VolumeName, Info->VolumeName,
+                  volumeInfo.VolumeNameLength);
+    RtlCopyMemory(volumeInfo.FileSystemName, Info->FileSystemName,
+                  volumeInfo.FileSystemNameLength);
+  }
+
+  GetRawDeviceName(DokanInstance->DeviceName, rawDeviceName, MAX_PATH);
+  if (!SendToDevice(rawDeviceName, IOCTL_SET_VOLUME_INFORMATION, &volumeInfo,
+                    sizeof(EVENT_VOLUME_INFORMATION), NULL, 0,
+                    &returnedLength)) {
+    DbgPrint("Dokan Error: Failed to send volume information to the driver\n");
+  }
+}
+
+// Gets the answers of the volume callbacks, from the copy kept by
+// DOKAN_OPTION_CACHE_VOLUME_INFORMATION when it is still valid. Only the
+// callback FreeSpace selects is called without the option.
+static NTSTATUS DokanQueryVolumeInformation(PDOKAN_INSTANCE DokanInstance,
+                                            PDOKAN_FILE_INFO FileInfo,
+                                            BOOL FreeSpace,
+                                            PDOKAN_VOLUME_INFORMATION Info) {
+  NTSTATUS volumeStatus;
+  NTSTATUS freeSpaceStatus;
+  ULONG validity;
+
+  RtlZeroMemory(Info, sizeof(DOKAN_VOLUME_INFORMATION));
+
+  if (!(DokanInstance->DokanOptions->Options &
+        DOKAN_OPTION_CACHE_VOLUME_INFORMATION)) {
+    if (FreeSpace)
+      return DokanCallGetDiskFreeSpace(DokanInstance, FileInfo, Info);
+    return DokanCallGetVolumeInformation(DokanInstance, FileInfo, Info);
+  }
+
+  if (DokanLookupVolumeInformation(DokanInstance, Info))
+    return STATUS_SUCCESS;
+
+  // Queries that miss together wait for the first one to refresh the copy
+  AcquireSRWLockExclusive(&DokanInstance->VolumeInformationRefreshLock);
+  if (DokanLookupVolumeInformation(DokanInstance, Info)) {
+    ReleaseSRWLockExclusive(&DokanInstance->VolumeInformationRefreshLock);
+    return STATUS_SUCCESS;
+  }
+
+  volumeStatus = DokanCallGetVolumeInformation(DokanInstance, FileInfo, Info);
+  freeSpaceStatus = DokanCallGetDiskFreeSpace(DokanInstance, FileInfo, Info);
+  if (volumeStatus == STATUS_SUCCESS && freeSpaceStatus == STATUS_SUCCESS) {
+    AcquireSRWLockExclusive(&DokanInstance->VolumeInformationLock);
+    DokanInstance->VolumeInformation = *Info;
+    validity = DokanInstance->VolumeInformationValidity;
+    DokanInstance->VolumeInformationExpiry = GetTickCount64() + validity;
+    ReleaseSRWLockExclusive(&DokanInstance->VolumeInformationLock);
+    DokanSendVolumeInformation(DokanInstance, Info, validity);
+  }
+  ReleaseSRWLockExclusive(&DokanInstance->VolumeInformationRefreshLock);
+
+  return FreeSpace ? freeSpaceStatus : volumeStatus;
+}
+
+VOID DokanVolumeInformationMounted(PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_VOLUME_INFORMATION info;
+  DOKAN_FILE_INFO fileInfo;
+
+  if (!(DokanInstance->DokanOptions->Options &
+        DOKAN_OPTION_CACHE_VOLUME_INFORMATION))
+    return;
+
+  RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
+  fileInfo.DokanOptions = DokanInstance->DokanOptions;
+  DokanQueryVolumeInformation(DokanInstance, &fileInfo, FALSE, &info);
+}
+
+BOOL DOKANAPI DokanRefreshVolumeInformation(LPCWSTR MountPoint,
+                                            ULONG Validity) {
+  PDOKAN_INSTANCE instance = NULL;
+  PLIST_ENTRY listEntry;
+
+  EnterCriticalSection(&g_InstanceCriticalSection);
+  for (listEntry = g_InstanceList.Flink; listEntry != &g_InstanceList;
+       listEntry = listEntry->Flink) {
+    PDOKAN_INSTANCE candidate =
+        CONTAINING_RECORD(listEntry, DOKAN_INSTANCE, ListEntry);
+    if (MountPoint == NULL ||
+        IsSameMountPoint(MountPoint, candidate->MountPoint)) {
+      instance = candidate;
+      break;
+    }
+  }
+
+  if (instance == NULL || !(instance->DokanOptions->Options &
+                            DOKAN_OPTION_CACHE_VOLUME_INFORMATION)) {
+    LeaveCriticalSection(&g_InstanceCriticalSection);
+    return FALSE;
+  }
+
+  // Waits for a refresh in progress so it cannot publish older answers
+  AcquireSRWLockExclusive(&instance->VolumeInformationRefreshLock);
+  AcquireSRWLockExclusive(&instance->VolumeInformationLock);
+  if (Validity != 0)
+    instance->VolumeInformationValidity = Validity;
+  instance->VolumeInformationExpiry = 0;
+  ReleaseSRWLockExclusive(&instance->VolumeInformationLock);
+  DokanSendVolumeInformation(instance, NULL, 0);
+  ReleaseSRWLockExclusive(&instance->VolumeInformationRefreshLock);
+
+  LeaveCriticalSection(&g_InstanceCriticalSection);
+  return TRUE;
+}
+
 NTSTATUS
 DokanFsVolumeInformation(PEVENT_INFORMATION EventInfo,
                          PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
-                         PDOKAN_OPERATIONS DokanOperations) {
-  WCHAR volumeName[MAX_PATH];
-  DWORD volumeSerial = 0;
-  DWORD maxComLength = 0;
-  DWORD fsFlags = 0;
-  WCHAR fsName[MAX_PATH];
+                         PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_VOLUME_INFORMATION info;
   ULONG remainingLength;
   ULONG bytesToCopy;
-  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+  NTSTATUS status;
 
   PFILE_FS_VOLUME_INFORMATION volumeInfo =
       (PFILE_FS_VOLUME_INFORMATION)EventInfo->Buffer;
@@ -75,50 +288,24 @@ DokanFsVolumeInformation(PEVENT_INFORMATION EventInfo,
     return STATUS_BUFFER_OVERFLOW;
   }
 
-  RtlZeroMemory(volumeName, sizeof(volumeName));
-  RtlZeroMemory(fsName, sizeof(fsName));
-
-  if (DokanOperations->GetVolumeInformation) {
-    status = DokanOperations->GetVolumeInformation(
-        volumeName,                         // VolumeNameBuffer
-        sizeof(volumeName) / sizeof(WCHAR), // VolumeNameSize
-        &volumeSerial,                      // VolumeSerialNumber
-        &maxComLength,                      // MaximumComponentLength
-        &fsFlags,                           // FileSystemFlags
-        fsName,                             // FileSystemNameBuffer
-        sizeof(fsName) / sizeof(WCHAR),     // FileSystemNameSize
-        FileInfo);
-  }
-
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    status = DokanGetVolumeInformation(
-        volumeName,                         // VolumeNameBuffer
-        sizeof(volumeName) / sizeof(WCHAR), // VolumeNameSize
-        &volumeSerial,                      // VolumeSerialNumber
-        &maxComLength,                      // MaximumComponentLength
-        &fsFlags,                           // FileSystemFlags
-        fsName,                             // FileSystemNameBuffer
-        sizeof(fsName) / sizeof(WCHAR),     // FileSystemNameSize
-        FileInfo);
-  }
-
+  status = DokanQueryVolumeInformation(DokanInstance, FileInfo, FALSE, &info);
   if (status != STATUS_SUCCESS) {
     return status;
   }
 
   volumeInfo->VolumeCreationTime.QuadPart = 0;
-  volumeInfo->VolumeSerialNumber = volumeSerial;
+  volumeInfo->VolumeSerialNumber = info.VolumeSerialNumber;
   volumeInfo->SupportsObjects = FALSE;
 
   remainingLength -= FIELD_OFFSET(FILE_FS_VOLUME_INFORMATION, VolumeLabel[0]);
 
-  bytesToCopy = (ULONG)wcslen(volumeName) * sizeof(WCHAR);
+  bytesToCopy = (ULONG)wcslen(info.VolumeName) * sizeof(WCHAR);
   if (remainingLength < bytesToCopy) {
     bytesToCopy = remainingLength;
   }
 
   volumeInfo->VolumeLabelLength = bytesToCopy;
-  RtlCopyMemory(volumeInfo->VolumeLabel, volumeName, bytesToCopy);
+  RtlCopyMemory(volumeInfo->VolumeLabel, info.VolumeName, bytesToCopy);
   remainingLength -= bytesToCopy;
 
   EventInfo->BufferLength =
@@ -130,11 +317,9 @@ DokanFsVolumeInformation(PEVENT_INFORMATION EventInfo,
 NTSTATUS
 DokanFsSizeInformation(PEVENT_INFORMATION EventInfo,
                        PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
-                       PDOKAN_OPERATIONS DokanOperations) {
-  ULONGLONG freeBytesAvailable = 0;
-  ULONGLONG totalBytes = 0;
-  ULONGLONG freeBytes = 0;
-  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+                       PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_VOLUME_INFORMATION info;
+  NTSTATUS status;
 
   ULONG allocationUnitSize = FileInfo->DokanOptions->AllocationUnitSize;
   ULONG sectorSize = FileInfo->DokanOptions->SectorSize;
@@ -147,29 +332,15 @@ DokanFsSizeInformation(PEVENT_INFORMATION EventInfo,
     return STATUS_BUFFER_OVERFLOW;
   }
 
-  if (DokanOperations->GetDiskFreeSpace) {
-    status = DokanOperations->GetDiskFreeSpace(
-        &freeBytesAvailable, // FreeBytesAvailable
-        &totalBytes,         // TotalNumberOfBytes
-        &freeBytes,          // TotalNumberOfFreeBytes
-        FileInfo);
-  }
-
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    status = DokanGetDiskFreeSpace(&freeBytesAvailable, // FreeBytesAvailable
-                                   &totalBytes,         // TotalNumberOfBytes
-                                   &freeBytes, // TotalNumberOfFreeBytes
-                                   FileInfo);
-  }
-
+  status = DokanQueryVolumeInformation(DokanInstance, FileInfo, TRUE, &info);
   if (status != STATUS_SUCCESS) {
     return status;
   }
 
   sizeInfo->TotalAllocationUnits.QuadPart =
-      totalBytes / allocationUnitSize;
+      info.TotalNumberOfBytes / allocationUnitSize;
   sizeInfo->AvailableAllocationUnits.QuadPart =
-      freeBytesAvailable / allocationUnitSize;
+      info.FreeBytesAvailable / allocationUnitSize;
   sizeInfo->SectorsPerAllocationUnit =
 	  allocationUnitSize / sectorSize;
   sizeInfo->BytesPerSector = sectorSize;
@@ -183,15 +354,11 @@ NTSTATUS
 DokanFsAttributeInformation(PEVENT_INFORMATION EventInfo,
                             PEVENT_CONTEXT EventContext,
                             PDOKAN_FILE_INFO FileInfo,
-                            PDOKAN_OPERATIONS DokanOperations) {
-  WCHAR volumeName[MAX_PATH];
-  DWORD volumeSerial;
-  DWORD maxComLength = 0;
-  DWORD fsFlags = 0;
-  WCHAR fsName[MAX_PATH];
+                            PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_VOLUME_INFORMATION info;
   ULONG remainingLength;
   ULONG bytesToCopy;
-  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+  NTSTATUS status;
 
   PFILE_FS_ATTRIBUTE_INFORMATION attrInfo =
       (PFILE_FS_ATTRIBUTE_INFORMATION)EventInfo->Buffer;
@@ -202,50 +369,24 @@ DokanFsAttributeInformation(PEVENT_INFORMATION EventInfo,
     return STATUS_BUFFER_OVERFLOW;
   }
 
-  RtlZeroMemory(volumeName, sizeof(volumeName));
-  RtlZeroMemory(fsName, sizeof(fsName));
-
-  if (DokanOperations->GetVolumeInformation) {
-    status = DokanOperations->GetVolumeInformation(
-        volumeName,                         // VolumeNameBuffer
-        sizeof(volumeName) / sizeof(WCHAR), // VolumeNameSize
-        &volumeSerial,                      // VolumeSerialNumber
-        &maxComLength,                      // MaximumComponentLength
-        &fsFlags,                           // FileSystemFlags
-        fsName,                             // FileSystemNameBuffer
-        sizeof(fsName) / sizeof(WCHAR),     // FileSystemNameSize
-        FileInfo);
-  }
-
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    status = DokanGetVolumeInformation(
-        volumeName,                         // VolumeNameBuffer
-        sizeof(volumeName) / sizeof(WCHAR), // VolumeNameSize
-        &volumeSerial,                      // VolumeSerialNumber
-        &maxComLength,                      // MaximumComponentLength
-        &fsFlags,                           // FileSystemFlags
-        fsName,                             // FileSystemNameBuffer
-        sizeof(fsName) / sizeof(WCHAR),     // FileSystemNameSize
-        FileInfo);
-  }
-
+  status = DokanQueryVolumeInformation(DokanInstance, FileInfo, FALSE, &info);
   if (status != STATUS_SUCCESS) {
     return status;
   }
 
-  attrInfo->FileSystemAttributes = fsFlags;
-  attrInfo->MaximumComponentNameLength = maxComLength;
+  attrInfo->FileSystemAttributes = info.FileSystemFlags;
+  attrInfo->MaximumComponentNameLength = info.MaximumComponentLength;
 
   remainingLength -=
       FIELD_OFFSET(FILE_FS_ATTRIBUTE_INFORMATION, FileSystemName[0]);
 
-  bytesToCopy = (ULONG)wcslen(fsName) * sizeof(WCHAR);
+  bytesToCopy = (ULONG)wcslen(info.FileSystemName) * sizeof(WCHAR);
   if (remainingLength < bytesToCopy) {
     bytesToCopy = remainingLength;
   }
 
   attrInfo->FileSystemNameLength = bytesToCopy;
-  RtlCopyMemory(attrInfo->FileSystemName, fsName, bytesToCopy);
+  RtlCopyMemory(attrInfo->FileSystemName, info.FileSystemName, bytesToCopy);
   remainingLength -= bytesToCopy;
 
   EventInfo->BufferLength =
@@ -258,11 +399,9 @@ NTSTATUS
 DokanFsFullSizeInformation(PEVENT_INFORMATION EventInfo,
                            PEVENT_CONTEXT EventContext,
                            PDOKAN_FILE_INFO FileInfo,
-                           PDOKAN_OPERATIONS DokanOperations) {
-  ULONGLONG freeBytesAvailable = 0;
-  ULONGLONG totalBytes = 0;
-  ULONGLONG freeBytes = 0;
-  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+                           PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_VOLUME_INFORMATION info;
+  NTSTATUS status;
 
   ULONG allocationUnitSize = FileInfo->DokanOptions->AllocationUnitSize;
   ULONG sectorSize = FileInfo->DokanOptions->SectorSize;
@@ -275,31 +414,17 @@ DokanFsFullSizeInformation(PEVENT_INFORMATION EventInfo,
     return STATUS_BUFFER_OVERFLOW;
   }
 
-  if (DokanOperations->GetDiskFreeSpace) {
-    status = DokanOperations->GetDiskFreeSpace(
-        &freeBytesAvailable, // FreeBytesAvailable
-        &totalBytes,         // TotalNumberOfBytes
-        &freeBytes,          // TotalNumberOfFreeBytes
-        FileInfo);
-  }
-
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    status = DokanGetDiskFreeSpace(&freeBytesAvailable, // FreeBytesAvailable
-                                   &totalBytes,         // TotalNumberOfBytes
-                                   &freeBytes, // TotalNumberOfFreeBytes
-                                   FileInfo);
-  }
-
+  status = DokanQueryVolumeInformation(DokanInstance, FileInfo, TRUE, &info);
   if (status != STATUS_SUCCESS) {
     return status;
   }
 
   sizeInfo->TotalAllocationUnits.QuadPart =
-      totalBytes / allocationUnitSize;
+      info.TotalNumberOfBytes / allocationUnitSize;
   sizeInfo->ActualAvailableAllocationUnits.QuadPart =
-      freeBytes / allocationUnitSize;
+      info.TotalNumberOfFreeBytes / allocationUnitSize;
   sizeInfo->CallerAvailableAllocationUnits.QuadPart =
-      freeBytesAvailable / allocationUnitSize;
+      info.FreeBytesAvailable / allocationUnitSize;
   sizeInfo->SectorsPerAllocationUnit =
 	  allocationUnitSize / sectorSize;
   sizeInfo->BytesPerSector = sectorSize;
@@ -313,7 +438,6 @@ VOID DispatchQueryVolumeInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
                                     PDOKAN_INSTANCE DokanInstance) {
   PEVENT_INFORMATION eventInfo;
   DOKAN_FILE_INFO fileInfo;
-  PDOKAN_OPEN_INFO openInfo;
   ULONG sizeOfEventInfo = sizeof(EVENT_INFORMATION) - 8 +
                           EventContext->Operation.Volume.BufferLength;
 
@@ -327,7 +451,6 @@ VOID DispatchQueryVolumeInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
 
   // There is no Context because file is not opened
   // so DispatchCommon is not used here
-  openInfo = (PDOKAN_OPEN_INFO)(INT_PTR)EventContext->Context;
 
   eventInfo->BufferLength = 0;
   eventInfo->SerialNumber = EventContext->SerialNumber;
@@ -338,30 +461,31 @@ VOID DispatchQueryVolumeInformation(HANDLE Handle, PEVENT_CONTEXT EventContext,
   eventInfo->Status = STATUS_NOT_IMPLEMENTED;
   eventInfo->BufferLength = 0;
 
-  DbgPrint("###QueryVolumeInfo %04d\n",
-           openInfo != NULL ? openInfo->EventId : -1);
+  DbgPrint("###QueryVolumeInfo %I64x\n", EventContext->Context);
 
+  DokanStatisticsCallbackBegin();
   switch (EventContext->Operation.Volume.FsInformationClass) {
   case FileFsVolumeInformation:
     eventInfo->Status = DokanFsVolumeInformation(
-        eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+        eventInfo, EventContext, &fileInfo, DokanInstance);
     break;
   case FileFsSizeInformation:
     eventInfo->Status = DokanFsSizeInformation(
-        eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+        eventInfo, EventContext, &fileInfo, DokanInstance);
     break;
   case FileFsAttributeInformation:
     eventInfo->Status = DokanFsAttributeInformation(
-        eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+        eventInfo, EventContext, &fileInfo, DokanInstance);
     break;
   case FileFsFullSizeInformation:
     eventInfo->Status = DokanFsFullSizeInformation(
-        eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+        eventInfo, EventContext, &fileInfo, DokanInstance);
     break;
   default:
     DbgPrint("error unknown volume info %d\n",
              EventContext->Operation.Volume.FsInformationClass);
   }
+  DokanStatisticsCallbackEnd();
 
   SendEventInformation(Handle, eventInfo, sizeOfEventInfo, NULL);
   free(eventInfo);
@@ -21,6 +21,323 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokani.h"
 
+// Most open files flushed per pass over the list of the instance
+#define DOKAN_WRITE_GATHER_BATCH 32
+
+// Context of the WriteFile calls that flush gathered writes
+typedef struct _DOKAN_GATHER_FLUSH {
+  PDOKAN_INSTANCE DokanInstance;
+  LPCWSTR FileName;
+  PDOKAN_FILE_INFO DokanFileInfo;
+} DOKAN_GATHER_FLUSH, *PDOKAN_GATHER_FLUSH;
+
+// Writes gathered data with the WriteFile callback. The request that
+// triggers it is not a write of the data, so the call cannot be pended.
+static int32_t DokanGatherFlushFile(void *Context, uint64_t Offset,
+                                    const void *Buffer, uint32_t Length) {
+  PDOKAN_GATHER_FLUSH flush = (PDOKAN_GATHER_FLUSH)Context;
+  PDOKAN_INSTANCE instance = flush->DokanInstance;
+  PDOKAN_BLOCK_CACHE_FILE cacheChange;
+  DWORD writtenLength = 0;
+  NTSTATUS status;
+
+  cacheChange =
+      DokanCacheBeginChange(instance, flush->FileName, Offset, Length);
+  DokanStatisticsCallbackBegin();
+  status = instance->DokanOperations->WriteFile(
+      flush->FileName, Buffer, Length, &writtenLength, (LONGLONG)Offset,
+      flush->DokanFileInfo);
+  DokanStatisticsCallbackEnd();
+  DokanCacheEndChange(instance, cacheChange);
+
+  if (status == STATUS_PENDING) {
+    DbgPrint("Dokan Error: WriteFile returned STATUS_PENDING without "
+             "DokanPendRequest\n");
+    status = STATUS_INTERNAL_ERROR;
+  } else if (status == STATUS_SUCCESS && writtenLength < Length) {
+    // The writes were acknowledged whole
+    status = STATUS_DISK_FULL;
+  }
+
+  InterlockedIncrement64(
+      (LONG64 volatile *)&instance->Statistics.WriteGather.Flushes);
+  if (status != STATUS_SUCCESS) {
+    DbgPrint("Dokan Error: gathered writes of %ls failed 0x%x\n",
+             flush->FileName, status);
+    InterlockedIncrement64(
+        (LONG64 volatile *)&instance->Statistics.WriteGather.Errors);
+  }
+  return status;
+}
+
+// File information of the WriteFile calls that flush the gathered writes of
+// the handle, whatever request triggers them
+static VOID DokanGatherFileInfo(PDOKAN_INSTANCE DokanInstance,
+                                PDOKAN_OPEN_INFO OpenInfo, ULONG64 Context,
+                                PDOKAN_FILE_INFO DokanFileInfo) {
+  ZeroMemory(DokanFileInfo, sizeof(DOKAN_FILE_INFO));
+  DokanFileInfo->Context = Context;
+  DokanFileInfo->DokanContext = (ULONG64)OpenInfo;
+  DokanFileInfo->DokanOptions = DokanInstance->DokanOptions;
+  DokanFileInfo->ProcessId = OpenInfo->WriteGatherProcessId;
+  DokanFileInfo->IsDirectory = (UCHAR)OpenInfo->IsDirectory;
+}
+
+// Creates the gather buffer of the handle on first use. Writes running at the
+// same time on the handle can both get here, only one buffer is kept.
+static PDOKAN_WRITE_GATHER DokanGetWriteGather(PDOKAN_OPEN_INFO OpenInfo) {
+  PDOKAN_WRITE_GATHER gather =
+      *(PDOKAN_WRITE_GATHER volatile *)&OpenInfo->WriteGather;
+  PDOKAN_WRITE_GATHER created;
+
+  if (gather != NULL)
+    return gather;
+  created = DokanWriteGatherCreate(DOKAN_WRITE_GATHER_SIZE);
+  if (created == NULL)
+    return NULL;
+  gather = InterlockedCompareExchangePointer(
+      (PVOID volatile *)&OpenInfo->WriteGather, created, NULL);
+  if (gather != NULL) {
+    DokanWriteGatherDelete(created);
+    return gather;
+  }
+  return created;
+}
+
+NTSTATUS DokanFlushGatheredWrites(PDOKAN_INSTANCE DokanInstance,
+                                  PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                                  PDOKAN_FILE_INFO DokanFileInfo) {
+  PDOKAN_WRITE_GATHER gather;
+  DOKAN_FILE_INFO fileInfo;
+  DOKAN_GATHER_FLUSH flush;
+  NTSTATUS status;
+
+  if (OpenInfo == NULL)
+    return STATUS_SUCCESS;
+  gather = *(PDOKAN_WRITE_GATHER volatile *)&OpenInfo->WriteGather;
+  if (gather == NULL)
+    return STATUS_SUCCESS;
+
+  DokanGatherFileInfo(DokanInstance, OpenInfo, DokanFileInfo->Context,
+                      &fileInfo);
+  flush.DokanInstance = DokanInstance;
+  flush.FileName = FileName;
+  flush.DokanFileInfo = &fileInfo;
+  status = DokanWriteGatherFlush(gather, DokanGatherFlushFile, &flush);
+  DokanFileInfo->Context = fileInfo.Context;
+  return status;
+}
+
+NTSTATUS DokanFlushGatheredRange(PDOKAN_INSTANCE DokanInstance,
+                                 PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                                 PDOKAN_FILE_INFO DokanFileInfo,
+                                 LONGLONG Offset, ULONG Length) {
+  PDOKAN_WRITE_GATHER gather;
+  DOKAN_FILE_INFO fileInfo;
+  DOKAN_GATHER_FLUSH flush;
+  NTSTATUS status;
+
+  if (OpenInfo == NULL)
+    return STATUS_SUCCESS;
+  gather = *(PDOKAN_WRITE_GATHER volatile *)&OpenInfo->WriteGather;
+  if (gather == NULL)
+    return STATUS_SUCCESS;
+  if (Offset < 0)
+    return DokanFlushGatheredWrites(DokanInstance, OpenInfo, FileName,
+                                    DokanFileInfo);
+
+  DokanGatherFileInfo(DokanInstance, OpenInfo, DokanFileInfo->Context,
+                      &fileInfo);
+  flush.DokanInstance = DokanInstance;
+  flush.FileName = FileName;
+  flush.DokanFileInfo = &fileInfo;
+  status = DokanWriteGatherFlushRange(gather, (uint64_t)Offset, Length,
+                                      DokanGatherFlushFile, &flush);
+  DokanFileInfo->Context = fileInfo.Context;
+  return status;
+}
+
+VOID DokanCloseGatheredWrites(PDOKAN_INSTANCE DokanInstance,
+                              PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                              PDOKAN_FILE_INFO DokanFileInfo) {
+  NTSTATUS status;
+
+  if (OpenInfo == NULL || OpenInfo->WriteGather == NULL)
+    return;
+
+  // Nothing is left to report the error to
+  status = DokanFlushGatheredWrites(DokanInstance, OpenInfo, FileName,
+                                    DokanFileInfo);
+  if (status != STATUS_SUCCESS)
+    DbgPrint("Dokan Error: writes gathered for %ls lost 0x%x\n", FileName,
+             status);
+
+  AcquireSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+  if (OpenInfo->WriteGatherEntry.Flink != NULL) {
+    RemoveEntryList(&OpenInfo->WriteGatherEntry);
+    OpenInfo->WriteGatherEntry.Flink = NULL;
+  }
+  ReleaseSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+}
+
+// Gathers the write when DOKAN_OPTION_WRITE_GATHERING allows it. Returns
+// FALSE when the write is for WriteFile, once the gathered writes of the
+// handle were flushed. Otherwise the write was gathered or failed with
+// *Status.
+static BOOL DokanGatherWrite(PDOKAN_INSTANCE DokanInstance,
+                             PDOKAN_OPEN_INFO OpenInfo, LPCWSTR FileName,
+                             PEVENT_CONTEXT EventContext,
+                             PDOKAN_FILE_INFO DokanFileInfo,
+                             NTSTATUS *Status) {
+  ULONG length = EventContext->Operation.Write.BufferLength;
+  LONGLONG offset = EventContext->Operation.Write.ByteOffset.QuadPart;
+  PDOKAN_WRITE_GATHER gather = NULL;
+  DOKAN_FILE_INFO fileInfo;
+  DOKAN_GATHER_FLUSH flush;
+
+  if (!(DokanInstance->DokanOptions->Options & DOKAN_OPTION_WRITE_GATHERING) ||
+      OpenInfo == NULL)
+    return FALSE;
+
+  // Writes whose range is only known to the file system, writes the caller
+  // wants on the file and large writes keep their own WriteFile call
+  if (!DokanFileInfo->PagingIo && !DokanFileInfo->Nocache &&
+      !DokanFileInfo->WriteToEndOfFile && offset >= 0 && length != 0 &&
+      length < DOKAN_WRITE_GATHER_SIZE)
+    gather = DokanGetWriteGather(OpenInfo);
+  if (gather == NULL) {
+    *Status = DokanFlushGatheredWrites(DokanInstance, OpenInfo, FileName,
+                                       DokanFileInfo);
+    return *Status != STATUS_SUCCESS;
+  }
+
+  OpenInfo->WriteGatherProcessId = DokanFileInfo->ProcessId;
+  DokanGatherFileInfo(DokanInstance, OpenInfo, DokanFileInfo->Context,
+                      &fileInfo);
+  flush.DokanInstance = DokanInstance;
+  flush.FileName = FileName;
+  flush.DokanFileInfo = &fileInfo;
+  *Status = DokanWriteGatherWrite(
+      gather, (uint64_t)offset,
+      (PCHAR)EventContext + EventContext->Operation.Write.BufferOffset, length,
+      GetTickCount64(), DokanGatherFlushFile, &flush);
+  DokanFileInfo->Context = fileInfo.Context;
+
+  if (*Status == STATUS_SUCCESS) {
+    InterlockedIncrement64(
+        (LONG64 volatile *)&DokanInstance->Statistics.WriteGather
+            .GatheredWrites);
+    InterlockedAdd64(
+        (LONG64 volatile *)&DokanInstance->Statistics.WriteGather
+            .GatheredBytes,
+        length);
+  }
+
+  // Listed for DokanWriteGatherThread while data waits in the buffer
+  if (DokanWriteGatherPending(gather, NULL) != 0) {
+    AcquireSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+    if (OpenInfo->WriteGatherEntry.Flink == NULL)
+      InsertTailList(&DokanInstance->WriteGatherList,
+                     &OpenInfo->WriteGatherEntry);
+    ReleaseSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+  }
+  return TRUE;
+}
+
+// Flushes the gathered writes of the handle made at least Age before Now.
+// Failures are reported to the next request of the handle. Returns FALSE if
+// the writes could not be flushed and are still waiting.
+static BOOL DokanFlushExpiredHandle(PDOKAN_INSTANCE DokanInstance,
+                                    PDOKAN_OPEN_INFO OpenInfo, ULONGLONG Now,
+                                    ULONGLONG Age) {
+  PDOKAN_FILE_NAME name;
+  DOKAN_FILE_INFO fileInfo;
+  DOKAN_GATHER_FLUSH flush;
+
+  name = DokanReferenceOpenInfoFileName(OpenInfo);
+  if (name == NULL) {
+    DbgPrint("Dokan Error: no file name kept for handle %I64x, its gathered "
+             "writes wait for its next request\n",
+             OpenInfo->Handle);
+    return FALSE;
+  }
+  DokanGatherFileInfo(DokanInstance, OpenInfo, OpenInfo->UserContext,
+                      &fileInfo);
+  flush.DokanInstance = DokanInstance;
+  flush.FileName = name->Name;
+  flush.DokanFileInfo = &fileInfo;
+  DokanWriteGatherFlushExpired(OpenInfo->WriteGather, Now, Age,
+                               DokanGatherFlushFile, &flush);
+  DokanReleaseFileName(name);
+  return TRUE;
+}
+
+// Flushes the handles whose gathered writes are at least Age old, and stops
+// tracking the ones that have none left. Batched handles go to the tail of the
+// list, so that the ones that cannot be flushed do not hide the others, and a
+// full batch of them ends the pass until the next tick.
+static VOID DokanFlushExpiredWrites(PDOKAN_INSTANCE DokanInstance,
+                                    ULONGLONG Age) {
+  PDOKAN_OPEN_INFO batch[DOKAN_WRITE_GATHER_BATCH];
+  PDOKAN_OPEN_INFO openInfo;
+  PLIST_ENTRY entry;
+  PLIST_ENTRY next;
+  ULONGLONG since;
+  ULONGLONG now;
+  ULONG count;
+  ULONG i;
+  BOOL progress;
+
+  do {
+    count = 0;
+    progress = FALSE;
+    now = GetTickCount64();
+    AcquireSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+    for (entry = DokanInstance->WriteGatherList.Flink;
+         entry != &DokanInstance->WriteGatherList &&
+         count < DOKAN_WRITE_GATHER_BATCH;
+         entry = next) {
+      next = entry->Flink;
+      openInfo = CONTAINING_RECORD(entry, DOKAN_OPEN_INFO, WriteGatherEntry);
+      if (DokanWriteGatherPending(openInfo->WriteGather, &since) == 0) {
+        RemoveEntryList(entry);
+        entry->Flink = NULL;
+      } else if (since <= now && now - since >= Age) {
+        // Listed handles are not closed yet, the reference keeps the entry
+        // until the flush is done
+        InterlockedIncrement64(&openInfo->State);
+        batch[count++] = openInfo;
+      }
+    }
+    for (i = 0; i < count; ++i) {
+      RemoveEntryList(&batch[i]->WriteGatherEntry);
+      InsertTailList(&DokanInstance->WriteGatherList,
+                     &batch[i]->WriteGatherEntry);
+    }
+    ReleaseSRWLockExclusive(&DokanInstance->WriteGatherListLock);
+
+    for (i = 0; i < count; ++i) {
+      if (DokanFlushExpiredHandle(DokanInstance, batch[i], now, Age))
+        progress = TRUE;
+      DokanReleaseOpenInfoReference(DokanInstance, batch[i]);
+    }
+  } while (count == DOKAN_WRITE_GATHER_BATCH && progress);
+}
+
+UINT WINAPI DokanWriteGatherThread(PVOID Param) {
+  PDOKAN_INSTANCE DokanInstance = (PDOKAN_INSTANCE)Param;
+
+  while (WaitForSingleObject(DokanInstance->WriteGatherStopEvent,
+                             DOKAN_WRITE_GATHER_AGE / 2) == WAIT_TIMEOUT) {
+    DokanFlushExpiredWrites(DokanInstance, DOKAN_WRITE_GATHER_AGE);
+  }
+  // No request runs anymore, write what is left before the unmount
+  DokanFlushExpiredWrites(DokanInstance, 0);
+
+  _endthreadex(0);
+  return 0;
+}
+
 BOOL SendWriteRequest(_In_ HANDLE Handle, _In_ PEVENT_INFORMATION EventInfo,
                       _In_ ULONG EventLength, _Out_ PVOID Buffer, _In_ ULONG BufferLength, 
                       _Out_ ULONG *ReturnedLengthOutPointer, _Out_ DWORD *LastError) {
@@ -30,15 +347,14 @@ BOOL SendWriteRequest(_In_ HANDLE Handle, _In_ PEVENT_INFORMATION EventInfo,
 
   DbgPrint("SendWriteRequest\n");
 
-  status = DeviceIoControl(Handle,            // Handle to device
-                           IOCTL_EVENT_WRITE, // IO Control code
-                           EventInfo,         // Input Buffer to driver.
-                           EventLength,     // Length of input buffer in bytes.
-                           Buffer,          // Output Buffer from driver.
-                           BufferLength,    // Length of output buffer in bytes.
-                           &returnedLength, // Bytes placed in buffer.
-                           NULL             // synchronous call
-                           );
+  status = DokanDeviceIoControl(Handle,            // Handle to device
+                                IOCTL_EVENT_WRITE, // IO Control code
+                                EventInfo,         // Input Buffer to driver.
+                                EventLength,     // Length of input buffer.
+                                Buffer,          // Output Buffer from driver.
+                                BufferLength,    // Length of output buffer.
+                                &returnedLength  // Bytes placed in buffer.
+                                );
 
   if (!status) {
     DWORD errorCode = GetLastError();
@@ -68,6 +384,10 @@ VOID DispatchWrite(HANDLE Handle, PEVENT_CONTEXT EventContext,
   ULONG returnedLength = 0;
   BOOL SendWriteRequestStatus = TRUE;	// otherwise DokanInstance->DokanOperations->WriteFile cannot be called
   DWORD SendWriteRequestLastError = 0;
+  DOKAN_REQUEST request;
+  PDOKAN_REQUEST pended = NULL;
+  LPWSTR fileName;
+  PDOKAN_FILE_NAME name;
 
   eventInfo = DispatchCommon(EventContext, sizeOfEventInfo, DokanInstance,
                              &fileInfo, &openInfo);
@@ -88,7 +408,10 @@ VOID DispatchWrite(HANDLE Handle, PEVENT_CONTEXT EventContext,
     bufferAllocated = TRUE;
   }
 
-  CheckFileName(EventContext->Operation.Write.FileName);
+  fileName = DokanGetEventFileName(EventContext, openInfo,
+                                   EventContext->Operation.Write.FileName,
+                                   EventContext->Operation.Write.FileNameLength,
+                                   &name);
 
   DbgPrint("###WriteFile %04d\n", openInfo != NULL ? openInfo->EventId : -1);
 
@@ -104,17 +427,60 @@ VOID DispatchWrite(HANDLE Handle, PEVENT_CONTEXT EventContext,
   }
   else {
 	  // for the case SendWriteRequest success
-	  if (DokanInstance->DokanOperations->WriteFile) {
+	  if (DokanInstance->DokanOperations->WriteFile &&
+		  DokanGatherWrite(DokanInstance, openInfo, fileName, EventContext,
+			  &fileInfo, &status)) {
+		  // Acknowledged whole, or failed by a flush of the handle
+		  if (status == STATUS_SUCCESS)
+			  writtenLength = EventContext->Operation.Write.BufferLength;
+	  }
+	  else if (DokanInstance->DokanOperations->WriteFile) {
+		  request.DokanInstance = DokanInstance;
+		  request.OpenInfo = openInfo;
+		  request.EventInfo = eventInfo;
+		  request.EventLength = sizeOfEventInfo;
+		  request.MajorFunction = IRP_MJ_WRITE;
+		  request.Length = EventContext->Operation.Write.BufferLength;
+		  request.ByteOffset = EventContext->Operation.Write.ByteOffset.QuadPart;
+		  // Writes at the end of file only change the last block
+		  request.CacheChange = DokanCacheBeginChange(
+			  DokanInstance, fileName,
+			  fileInfo.WriteToEndOfFile ? 0 : request.ByteOffset,
+			  fileInfo.WriteToEndOfFile ? 0 : request.Length);
+		  DokanBeginPendableRequest(&request, &fileInfo);
+		  DokanStatisticsCallbackBegin();
 		  status = DokanInstance->DokanOperations->WriteFile(
-			  EventContext->Operation.Write.FileName,
+			  fileName,
 			  (PCHAR)EventContext + EventContext->Operation.Write.BufferOffset,
 			  EventContext->Operation.Write.BufferLength, &writtenLength,
 			  EventContext->Operation.Write.ByteOffset.QuadPart, &fileInfo);
+		  DokanStatisticsCallbackEnd();
+		  pended = DokanEndPendableRequest();
+		  // A pended write ends its change in DokanCompleteRequest
+		  if (pended == NULL)
+			  DokanCacheEndChange(DokanInstance, request.CacheChange);
 	  }
 	  else {
 		  status = STATUS_NOT_IMPLEMENTED;
 	  }
   }
+  DokanReleaseFileName(name);
+
+  // The reply, eventInfo and the context of the handle now belong to
+  // DokanCompleteRequest, which may already have run. The written data was
+  // copied by the callback.
+  if (pended != NULL) {
+    if (status != STATUS_PENDING)
+      DbgPrint("Dokan Error: pended WriteFile returned 0x%x\n", status);
+    if (bufferAllocated)
+      free(EventContext);
+    return;
+  }
+  if (status == STATUS_PENDING) {
+    DbgPrint("Dokan Error: WriteFile returned STATUS_PENDING without "
+             "DokanPendRequest\n");
+    status = STATUS_INTERNAL_ERROR;
+  }
 
   if (openInfo != NULL)
     openInfo->UserContext = fileInfo.Context;
@@ -0,0 +1,203 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "writegather.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK DOKAN_WRITE_GATHER_LOCK;
+
+#define WriteGatherInitialize(Gather) (InitializeSRWLock(&(Gather)->Lock), 1)
+#define WriteGatherUninitialize(Gather)
+#define WriteGatherLock(Gather) AcquireSRWLockExclusive(&(Gather)->Lock)
+#define WriteGatherUnlock(Gather) ReleaseSRWLockExclusive(&(Gather)->Lock)
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t DOKAN_WRITE_GATHER_LOCK;
+
+#define WriteGatherInitialize(Gather)                                          \
+  (pthread_mutex_init(&(Gather)->Lock, NULL) == 0)
+#define WriteGatherUninitialize(Gather) pthread_mutex_destroy(&(Gather)->Lock)
+#define WriteGatherLock(Gather) pthread_mutex_lock(&(Gather)->Lock)
+#define WriteGatherUnlock(Gather) pthread_mutex_unlock(&(Gather)->Lock)
+#endif
+
+struct _DOKAN_WRITE_GATHER {
+  // Held across the flushes so that the writes of the handle stay in order
+  DOKAN_WRITE_GATHER_LOCK Lock;
+  uint32_t Capacity;
+  // Bytes gathered, written at Offset
+  uint32_t Length;
+  uint64_t Offset;
+  // Time of the first gathered write
+  uint64_t Since;
+  // Status of a failed flush that nothing waited for
+  int32_t Error;
+  uint8_t *Buffer;
+};
+
+// Hands the gathered data to Flush. The data is dropped whatever the result.
+static int32_t WriteGatherFlushLocked(PDOKAN_WRITE_GATHER Gather,
+                                      DOKAN_WRITE_GATHER_FLUSH Flush,
+                                      void *Context) {
+  int32_t status;
+
+  if (Gather->Length == 0)
+    return 0;
+  status = Flush(Context, Gather->Offset, Gather->Buffer, Gather->Length);
+  Gather->Length = 0;
+  return status;
+}
+
+// Returns the status kept for the next write or flush and forgets it
+static int32_t WriteGatherTakeError(PDOKAN_WRITE_GATHER Gather) {
+  int32_t error = Gather->Error;
+
+  Gather->Error = 0;
+  return error;
+}
+
+PDOKAN_WRITE_GATHER DokanWriteGatherCreate(uint32_t Capacity) {
+  PDOKAN_WRITE_GATHER gather;
+
+  if (Capacity == 0)
+    return NULL;
+  gather = (PDOKAN_WRITE_GATHER)calloc(1, sizeof(DOKAN_WRITE_GATHER));
+  if (gather == NULL)
+    return NULL;
+  gather->Capacity = Capacity;
+  gather->Buffer = (uint8_t *)malloc(Capacity);
+  if (gather->Buffer == NULL || !WriteGatherInitialize(gather)) {
+    free(gather->Buffer);
+    free(gather);
+    return NULL;
+  }
+  return gather;
+}
+
+void DokanWriteGatherDelete(PDOKAN_WRITE_GATHER Gather) {
+  if (Gather == NULL)
+    return;
+  WriteGatherUninitialize(Gather);
+  free(Gather->Buffer);
+  free(Gather);
+}
+
+int32_t DokanWriteGatherWrite(PDOKAN_WRITE_GATHER Gather, uint64_t Offset,
+                              const void *Data, uint32_t Length, uint64_t Now,
+                              DOKAN_WRITE_GATHER_FLUSH Flush, void *Context) {
+  int32_t status;
+
+  WriteGatherLock(Gather);
+  status = WriteGatherTakeError(Gather);
+  if (status != 0) {
+    WriteGatherUnlock(Gather);
+    return status;
+  }
+
+  // Only a write that continues the gathered data and fits joins it
+  if (Gather->Length != 0 &&
+      (Offset != Gather->Offset + Gather->Length ||
+       Length > Gather->Capacity - Gather->Length)) {
+    status = WriteGatherFlushLocked(Gather, Flush, Context);
+    if (status != 0) {
+      WriteGatherUnlock(Gather);
+      return status;
+    }
+  }
+
+  if (Length >= Gather->Capacity) {
+    status = Flush(Context, Offset, Data, Length);
+    WriteGatherUnlock(Gather);
+    return status;
+  }
+
+  if (Gather->Length == 0) {
+    Gather->Offset = Offset;
+    Gather->Since = Now;
+  }
+  memcpy(Gather->Buffer + Gather->Length, Data, Length);
+  Gather->Length += Length;
+  if (Gather->Length == Gather->Capacity)
+    status = WriteGatherFlushLocked(Gather, Flush, Context);
+  WriteGatherUnlock(Gather);
+  return status;
+}
+
+int32_t DokanWriteGatherFlush(PDOKAN_WRITE_GATHER Gather,
+                              DOKAN_WRITE_GATHER_FLUSH Flush, void *Context) {
+  int32_t status;
+
+  WriteGatherLock(Gather);
+  status = WriteGatherTakeError(Gather);
+  if (status == 0)
+    status = WriteGatherFlushLocked(Gather, Flush, Context);
+  WriteGatherUnlock(Gather);
+  return status;
+}
+
+int32_t DokanWriteGatherFlushRange(PDOKAN_WRITE_GATHER Gather, uint64_t Offset,
+                                   uint32_t Length,
+                                   DOKAN_WRITE_GATHER_FLUSH Flush,
+                                   void *Context) {
+  int32_t status;
+
+  WriteGatherLock(Gather);
+  status = WriteGatherTakeError(Gather);
+  if (status == 0 && Gather->Length != 0 && Length != 0 &&
+      Offset < Gather->Offset + Gather->Length &&
+      (Gather->Offset <= Offset || Gather->Offset - Offset < Length))
+    status = WriteGatherFlushLocked(Gather, Flush, Context);
+  WriteGatherUnlock(Gather);
+  return status;
+}
+
+void DokanWriteGatherFlushExpired(PDOKAN_WRITE_GATHER Gather, uint64_t Now,
+                                  uint64_t Age, DOKAN_WRITE_GATHER_FLUSH Flush,
+                                  void *Context) {
+  int32_t status;
+
+  WriteGatherLock(Gather);
+  if (Gather->Length != 0 && Gather->Since <= Now &&
+      Now - Gather->Since >= Age) {
+    status = WriteGatherFlushLocked(Gather, Flush, Context);
+    // An older error is the first one the handle must see
+    if (status != 0 && Gather->Error == 0)
+      Gather->Error = status;
+  }
+  WriteGatherUnlock(Gather);
+}
+
+uint32_t DokanWriteGatherPending(PDOKAN_WRITE_GATHER Gather, uint64_t *Since) {
+  uint32_t length;
+
+  WriteGatherLock(Gather);
+  length = Gather->Length;
+  if (length != 0 && Since != NULL)
+    *Since = Gather->Since;
+  WriteGatherUnlock(Gather);
+  return length;
+}
@@ -0,0 +1,95 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_WRITEGATHER_H_
+#define DOKAN_WRITEGATHER_H_
+
+// Gathering of the small sequential writes of an open handle.
+//
+// Writes adjacent to the ones already gathered are copied into a buffer of a
+// fixed capacity and acknowledged. The buffer is handed to the flush function
+// as one write once it is full, once its oldest data is older than the age
+// given to DokanWriteGatherFlushExpired, or when DokanWriteGatherFlush or an
+// overlapping DokanWriteGatherFlushRange asks for it. A write that is not
+// adjacent flushes the buffer before it is gathered.
+//
+// A flush that fails drops the data it had. When nothing waits for its result,
+// its status is kept and returned by the next write or flush of the handle.
+//
+// This file and writegather.c only depend on the C runtime and on either
+// Windows or pthreads, samples/writegather_test checks them on any platform.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _DOKAN_WRITE_GATHER DOKAN_WRITE_GATHER, *PDOKAN_WRITE_GATHER;
+
+// Writes the Length bytes of Buffer at Offset of the file. Returns 0 on
+// success and a status otherwise.
+typedef int32_t (*DOKAN_WRITE_GATHER_FLUSH)(void *Context, uint64_t Offset,
+                                            const void *Buffer,
+                                            uint32_t Length);
+
+// Returns NULL if Capacity is 0 or there is not enough memory.
+PDOKAN_WRITE_GATHER DokanWriteGatherCreate(uint32_t Capacity);
+
+// Drops the data that was not flushed.
+void DokanWriteGatherDelete(PDOKAN_WRITE_GATHER Gather);
+
+// Gathers the write of Length bytes of Data at Offset, made at time Now.
+// Writes of at least the capacity are flushed right away after the gathered
+// data. Returns the status of a previous flush still to be reported without
+// writing anything, otherwise 0 or the status of the flushes the write caused.
+int32_t DokanWriteGatherWrite(PDOKAN_WRITE_GATHER Gather, uint64_t Offset,
+                              const void *Data, uint32_t Length, uint64_t Now,
+                              DOKAN_WRITE_GATHER_FLUSH Flush, void *Context);
+
+// Flushes the gathered data. Returns the status of the flush, or of a
+// previous one still to be reported.
+int32_t DokanWriteGatherFlush(PDOKAN_WRITE_GATHER Gather,
+                              DOKAN_WRITE_GATHER_FLUSH Flush, void *Context);
+
+// Same as DokanWriteGatherFlush, but only flushes when the gathered data
+// overlaps the Length bytes at Offset, for reads of the handle.
+int32_t DokanWriteGatherFlushRange(PDOKAN_WRITE_GATHER Gather, uint64_t Offset,
+                                   uint32_t Length,
+                                   DOKAN_WRITE_GATHER_FLUSH Flush,
+                                   void *Context);
+
+// Flushes the gathered data if its first write was made at least Age before
+// Now, never if it was made after Now. The status of the flush is kept for
+// the next write or flush.
+void DokanWriteGatherFlushExpired(PDOKAN_WRITE_GATHER Gather, uint64_t Now,
+                                  uint64_t Age, DOKAN_WRITE_GATHER_FLUSH Flush,
+                                  void *Context);
+
+// Returns the number of bytes gathered and not flushed, and stores the time
+// of their first write in Since when there are some and Since is not NULL.
+uint32_t DokanWriteGatherPending(PDOKAN_WRITE_GATHER Gather, uint64_t *Since);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_WRITEGATHER_H_
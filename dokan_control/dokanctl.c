@@ -31,6 +31,7 @@ THE SOFTWARE.
 
 #include "../dokan/dokan.h"
 #include "../dokan/dokanc.h"
+#include "../dokan/tracering.h"
 #include <ShlObj.h>
 
 #define DOKAN_DRIVER_FULL_PATH                                                 \
@@ -43,6 +44,9 @@ int ShowUsage() {
           "dokanctl /i [d||n]\n"
           "dokanctl /r [d||n]\n"
           "dokanctl /v\n"
+          "dokanctl /s MountPoint [Seconds]\n"
+          "dokanctl /t ProcessId\n"
+          "dokanctl /x TraceFile JsonFile\n"
           "\n"
           "Example:\n"
           "  /u M                : Unmount M: drive\n"
@@ -54,6 +58,11 @@ int ShowUsage() {
           "  /r n                : Remove network provider\n"
           "  /l a                : List current mount points\n"
           "  /d [0-7]            : Enable Kernel Debug output\n"
+          "  /s M                : Print driver queue statistics of M: drive\n"
+          "  /s M 5              : Print them again every 5 seconds\n"
+          "  /t 1234             : Dump request trace of process 1234 to\n"
+          "                        %%TEMP%%\\dokan_trace_1234.bin\n"
+          "  /x t.bin t.json     : Convert a request trace to Chrome trace JSON\n"
           "  /v                  : Print Dokan version\n");
   return EXIT_FAILURE;
 }
@@ -101,6 +110,178 @@ int DeleteDokanService(LPCWSTR ServiceName) {
   return EXIT_SUCCESS;
 }
 
+static const char *MajorFunctionNames[DOKAN_METRICS_MAJOR_FUNCTIONS] = {
+    "Create",           "CreateNamedPipe",   "Close",
+    "Read",             "Write",             "QueryInformation",
+    "SetInformation",   "QueryEa",           "SetEa",
+    "FlushBuffers",     "QueryVolumeInfo",   "SetVolumeInfo",
+    "DirectoryControl", "FileSystemControl", "DeviceControl",
+    "InternalDevCtl",   "Shutdown",          "LockControl",
+    "Cleanup",          "CreateMailslot",    "QuerySecurity",
+    "SetSecurity",      "Power",             "SystemControl",
+    "DeviceChange",     "QueryQuota",        "SetQuota",
+    "Pnp"};
+
+static const char
+    *EventContextAllocatorNames[DOKAN_METRICS_EVENT_CONTEXT_ALLOCATORS] = {
+        "Lookaside 512 B", "Lookaside 2 KB", "Lookaside 8 KB",
+        "Lookaside 32 KB", "Pool"};
+
+// Converts an average of 100 nanoseconds units to microseconds
+static ULONG64 AverageMicroseconds(ULONG64 Time, ULONG64 Count) {
+  return Count ? Time / Count / 10 : 0;
+}
+
+void PrintVolumeMetrics(PDOKAN_VOLUME_METRICS Metrics) {
+  ULONG64 queueTime =
+      AverageMicroseconds(Metrics->QueueTime, Metrics->PickupCount);
+  ULONG64 replyTime =
+      AverageMicroseconds(Metrics->ReplyTime, Metrics->ReplyCount);
+
+  fprintf(stdout, "Uptime: %llu s\n", Metrics->Uptime / 10000000);
+  fprintf(stdout, "  %-16s %10s %10s\n", "Queue", "Current", "Peak");
+  fprintf(stdout, "  %-16s %10lu %10lu\n", "PendingIrp",
+          Metrics->PendingIrp.Current, Metrics->PendingIrp.Peak);
+  fprintf(stdout, "  %-16s %10lu %10lu\n", "PendingEvent",
+          Metrics->PendingEvent.Current, Metrics->PendingEvent.Peak);
+  fprintf(stdout, "  %-16s %10lu %10lu\n", "NotifyEvent",
+          Metrics->NotifyEvent.Current, Metrics->NotifyEvent.Peak);
+  fprintf(stdout, "  %-16s %10lu %10lu\n", "PendingRetryIrp",
+          Metrics->PendingRetryIrp.Current, Metrics->PendingRetryIrp.Peak);
+  fprintf(stdout, "  Picked up: %llu, avg wait %llu us, max %llu us\n",
+          Metrics->PickupCount, queueTime, Metrics->MaxQueueTime / 10);
+  if (Metrics->AffinityPickupCount != 0)
+    fprintf(stdout, "  Picked up by a thread of the file group: %llu\n",
+            Metrics->AffinityPickupCount);
+  fprintf(stdout, "  Replied: %llu, avg %llu us, max %llu us\n",
+          Metrics->ReplyCount, replyTime, Metrics->MaxReplyTime / 10);
+  fprintf(stdout, "  Avg time in user mode: ~%llu us\n",
+          replyTime > queueTime ? replyTime - queueTime : 0);
+  fprintf(stdout, "  Canceled: %llu, timed out: %llu, oplock retries: %llu\n",
+          Metrics->CancelCount, Metrics->TimeoutCount, Metrics->RetryCount);
+  for (ULONG i = 0; i < DOKAN_METRICS_MAJOR_FUNCTIONS; ++i) {
+    if (Metrics->DispatchCount[i] != 0)
+      fprintf(stdout, "  %-22s %12llu\n", MajorFunctionNames[i],
+              Metrics->DispatchCount[i]);
+  }
+  fprintf(stdout, "  Event contexts: %llu KB, peak %llu KB\n",
+          Metrics->EventContextBytes / 1024,
+          Metrics->EventContextPeakBytes / 1024);
+  for (ULONG i = 0; i < DOKAN_METRICS_EVENT_CONTEXT_ALLOCATORS; ++i) {
+    fprintf(stdout, "  %-22s %12llu\n", EventContextAllocatorNames[i],
+            Metrics->EventContextAllocations[i]);
+  }
+}
+
+int ShowVolumeMetrics(LPCWSTR MountPoint, ULONG IntervalSeconds) {
+  DOKAN_VOLUME_METRICS metrics;
+
+  do {
+    if (!DokanGetVolumeMetrics(MountPoint, &metrics)) {
+      fwprintf(stderr, L"Cannot retrieve statistics of %s\n", MountPoint);
+      return EXIT_FAILURE;
+    }
+    PrintVolumeMetrics(&metrics);
+    if (IntervalSeconds)
+      Sleep(IntervalSeconds * 1000);
+  } while (IntervalSeconds);
+
+  return EXIT_SUCCESS;
+}
+
+int RequestTraceDump(ULONG ProcessId) {
+  WCHAR eventName[64];
+  HANDLE event;
+
+  swprintf_s(eventName, 64, DOKAN_TRACE_DUMP_EVENT_NAME, ProcessId);
+  event = OpenEventW(EVENT_MODIFY_STATE, FALSE, eventName);
+  if (event == NULL) {
+    fwprintf(stderr, L"Cannot open %s (%lu)\n", eventName, GetLastError());
+    return EXIT_FAILURE;
+  }
+  SetEvent(event);
+  CloseHandle(event);
+  fwprintf(stdout, L"Trace dump requested to %%TEMP%%\\dokan_trace_%lu.bin\n",
+           ProcessId);
+  return EXIT_SUCCESS;
+}
+
+// Writes a trace of DokanDumpTrace as Chrome trace event JSON, which
+// chrome://tracing and Perfetto open
+int DecodeTrace(LPCWSTR TraceFile, LPCWSTR JsonFile) {
+  UCHAR header[DOKAN_TRACE_FILE_HEADER_SIZE];
+  UCHAR record[DOKAN_TRACE_FILE_RECORD_SIZE];
+  DOKAN_TRACE_FILE_INFO info;
+  DOKAN_TRACE_ENTRY *entries;
+  FILE *in = NULL;
+  FILE *out = NULL;
+  ULONG64 origin = MAXULONG64;
+  ULONG i;
+
+  if (_wfopen_s(&in, TraceFile, L"rb") != 0 || in == NULL) {
+    fwprintf(stderr, L"Cannot open %s\n", TraceFile);
+    return EXIT_FAILURE;
+  }
+  if (fread(header, sizeof(header), 1, in) != 1 ||
+      !DokanTraceDecodeHeader(header, &info)) {
+    fwprintf(stderr, L"%s is not a supported trace file\n", TraceFile);
+    fclose(in);
+    return EXIT_FAILURE;
+  }
+  entries = (DOKAN_TRACE_ENTRY *)malloc(
+      (info.RecordCount ? info.RecordCount : 1) * sizeof(DOKAN_TRACE_ENTRY));
+  for (i = 0; entries != NULL && i < info.RecordCount; ++i) {
+    if (fread(record, sizeof(record), 1, in) != 1)
+      break;
+    DokanTraceDecodeRecord(record, &entries[i]);
+  }
+  if (entries == NULL || i != info.RecordCount) {
+    fwprintf(stderr, L"%s is truncated\n", TraceFile);
+    free(entries);
+    fclose(in);
+    return EXIT_FAILURE;
+  }
+  fclose(in);
+
+  if (_wfopen_s(&out, JsonFile, L"w") != 0 || out == NULL) {
+    fwprintf(stderr, L"Cannot create %s\n", JsonFile);
+    free(entries);
+    return EXIT_FAILURE;
+  }
+  // Timestamps are made relative to the first request of the trace
+  for (i = 0; i < info.RecordCount; ++i) {
+    if (entries[i].Timestamp < origin)
+      origin = entries[i].Timestamp;
+  }
+  fprintf(out, "{\"traceEvents\":[");
+  for (i = 0; i < info.RecordCount; ++i) {
+    DOKAN_TRACE_ENTRY *entry = &entries[i];
+    double timestamp = (double)(entry->Timestamp - origin) * 1000000.0 /
+                       (double)info.Frequency;
+    fprintf(out,
+            "%s\n{\"name\":\"%s\",\"cat\":\"dokan\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%lu,\"pid\":%lu,\"tid\":%lu,"
+            "\"args\":{\"serial\":%lu,\"minor\":%u,\"status\":\"0x%08lx\","
+            "\"bytesIn\":%lu,\"bytesOut\":%lu,\"callbackUs\":%lu,"
+            "\"file\":\"%08lx\"}}",
+            i ? "," : "",
+            entry->MajorFunction < DOKAN_METRICS_MAJOR_FUNCTIONS
+                ? MajorFunctionNames[entry->MajorFunction]
+                : "Unknown",
+            timestamp, entry->DispatchTime, info.ProcessId, entry->ThreadId,
+            entry->SerialNumber, entry->MinorFunction, (ULONG)entry->Status,
+            entry->BytesIn, entry->BytesOut, entry->CallbackTime,
+            entry->FileNameHash);
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(out);
+  free(entries);
+
+  fwprintf(stdout, L"%lu requests written to %s\n", info.RecordCount,
+           JsonFile);
+  return EXIT_SUCCESS;
+}
+
 #define GetOption(argc, argv, index)                                           \
   (((argc) > (index) && wcslen((argv)[(index)]) == 2 &&                        \
     (argv)[(index)][0] == L'/')                                                \
@@ -216,6 +397,28 @@ int __cdecl wmain(int argc, PWCHAR argv[]) {
     DokanReleaseMountPointList(dokanControl);
   } break;
 
+  case L's': {
+    if (argc < 3) {
+      return DefaultCaseOption();
+    }
+    return ShowVolumeMetrics(argv[2], argc > 3 ? wcstoul(argv[3], NULL, 10)
+                                               : 0);
+  }
+
+  case L't': {
+    if (argc < 3) {
+      return DefaultCaseOption();
+    }
+    return RequestTraceDump(wcstoul(argv[2], NULL, 10));
+  }
+
+  case L'x': {
+    if (argc < 4) {
+      return DefaultCaseOption();
+    }
+    return DecodeTrace(argv[2], argv[3]);
+  }
+
   case L'v': {
     fprintf(stdout, "dokanctl : %s %s\n", __DATE__, __TIME__);
     fprintf(stdout, "Dokan version : %ld\n", DokanVersion());
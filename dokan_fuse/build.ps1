@@ -12,7 +12,8 @@ $script:failed = 0
         make -j `$(getconf _NPROCESSORS_ONLN) install"
     & $env:CYGWIN_INST_DIR\bin\bash -lc "
         cd '$currentPath' &&
-        i686-pc-cygwin-gcc -o '$installDir'/mirror samples/fuse_mirror/fusexmp.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs)"
+        i686-pc-cygwin-gcc -o '$installDir'/mirror samples/fuse_mirror/fusexmp.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs) &&
+        i686-pc-cygwin-gcc -o '$installDir'/memfs samples/fuse_memfs/fusememfs.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs)"
     if ($LASTEXITCODE -ne 0) {
         $script:failed = $LASTEXITCODE
     }
@@ -27,7 +28,8 @@ $script:failed = 0
         make -j `$(getconf _NPROCESSORS_ONLN) install"
     & $env:CYGWIN_INST_DIR\bin\bash -lc "
         cd '$currentPath' &&
-        gcc -o '$installDir'/mirror samples/fuse_mirror/fusexmp.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs)"
+        gcc -o '$installDir'/mirror samples/fuse_mirror/fusexmp.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs) &&
+        gcc -o '$installDir'/memfs samples/fuse_memfs/fusememfs.c `$(PKG_CONFIG_PATH='$installDir/lib/pkgconfig' pkg-config fuse --cflags --libs)"
     if ($LASTEXITCODE -ne 0) {
         $script:failed = $LASTEXITCODE
     }
@@ -35,6 +35,12 @@ struct fuse_config
   int networkDrive;
   unsigned long allocationUnitSize;
   unsigned long sectorSize;
+  unsigned int parallelIo;
+  unsigned int threads;
+  unsigned int maxThreads;
+  unsigned int readAhead;
+  unsigned int writeBack;
+  int stats;
 };
 
 struct fuse_session
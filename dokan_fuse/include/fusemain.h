@@ -4,22 +4,28 @@
 #include "../../dokan/dokan.h"
 #include "fuse.h"
 #include "utils.h"
+#include "fusestats.h"
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
+#include <list>
 
 #define CHECKED(arg) if (0);else {int __res=arg; if (__res<0) return __res;}
 #define MAX_READ_SIZE (65536)
+#define SYMLINK_CACHE_SIZE (4096)
 
 class impl_fuse_context;
 struct impl_chain_link;
 
 class impl_file_handle;
 class impl_file_lock;
+struct impl_io_batch;
+template <typename T> struct impl_counted_op;
 
 class impl_file_locks
 {
+	friend class impl_file_lock;
 private:
 	typedef std::map<std::string, impl_file_lock *> file_locks_t;
 	file_locks_t file_locks;
@@ -34,6 +40,30 @@ public:
 	void remove_file(const std::string& name);
 };
 
+/*
+	Bounded LRU cache of resolved symlink targets, keyed by the link path.
+	Entries are dropped when the link or its target is renamed or deleted
+	through the bridge.
+*/
+class impl_symlink_cache
+{
+private:
+	typedef std::list<std::pair<std::string, std::string> > entries_t;
+	entries_t entries; // Most recently used first
+	typedef std::map<std::string, entries_t::iterator> index_t;
+	index_t index;
+	size_t max_size;
+	CRITICAL_SECTION lock;
+public:
+	impl_symlink_cache(size_t _max_size) : max_size(_max_size) { InitializeCriticalSection(&lock); }
+	~impl_symlink_cache() { DeleteCriticalSection(&lock); };
+	impl_symlink_cache(impl_symlink_cache &other) = delete;
+	impl_symlink_cache &operator=(const impl_symlink_cache &other) = delete;
+	bool lookup(const std::string &name, std::string *target);
+	void insert(const std::string &name, const std::string &target);
+	void invalidate(const std::string &name);
+};
+
 struct impl_chain_link
 {
 	impl_chain_link *prev_link_;
@@ -71,8 +101,12 @@ private:
 class impl_fuse_context
 {
 	friend class impl_chain_guard;
+	template <typename T> friend struct impl_counted_op;
 
 	struct fuse_operations ops_;
+	// Operations of the filesystem itself, ops_ wraps them to count calls
+	// when statistics are enabled
+	struct fuse_operations backend_ops_;
 	fuse_conn_info conn_info_;
 	void *user_data_;
 	bool debug_;
@@ -81,13 +115,44 @@ class impl_fuse_context
 	unsigned int dirmask_;
 	const char *fsname_, *volname_, *uncname_;
 
+	// Maximum number of backend calls issued concurrently for one request,
+	// set by "-o parallel_io=M"
+	unsigned int io_fanout_;
+
+	// Size limits of the per-handle read-ahead window and write-back
+	// buffer, 0 disables them
+	unsigned int read_ahead_;
+	unsigned int write_back_;
+
 	impl_file_locks file_locks;
+	impl_symlink_cache symlinks;
+	std::unique_ptr<impl_fuse_stats> stats_;
+
+	int do_io_chunk(impl_io_batch *batch, LONG idx);
+	void drain_io_batch(impl_io_batch *batch);
+	static DWORD WINAPI io_worker(LPVOID param);
+	int do_chunked_io(bool is_write, const std::string &name,
+		const fuse_file_info &finfo, char *buffer, DWORD length,
+		FUSE_OFF_T offset, DWORD chunk_size, DWORD *transferred);
+	DWORD write_chunk_size() const
+	{
+		return conn_info_.max_write ? conn_info_.max_write : MAXDWORD;
+	}
+	int read_ahead(impl_file_handle *hndl, char *buffer, DWORD length,
+		LONGLONG offset, DWORD *read);
+	int write_behind(impl_file_handle *hndl, const char *buffer, DWORD length,
+		LONGLONG offset);
+	int flush_write_back_unlocked(impl_file_handle *hndl);
+	void sync_file(impl_file_handle *hndl);
 public:
 	impl_fuse_context(const struct fuse_operations *ops, void *user_data, 
 		bool debug, unsigned int filemask, unsigned int dirmask,
-		const char *fsname, const char *volname, const char *uncname);
+		const char *fsname, const char *volname, const char *uncname,
+		unsigned int io_fanout, unsigned int read_ahead,
+		unsigned int write_back, bool stats);
 
 	bool debug() const {return debug_;}
+	impl_fuse_stats *stats() const {return stats_.get();}
 
 	////////////////////////////////////Methods///////////////////////////////
 	static int cast_from_longlong(LONGLONG src, FUSE_OFF_T *res);
@@ -107,6 +172,8 @@ public:
 
 	int resolve_symlink(const std::string &name, std::string *res);
 	int check_and_resolve(std::string *name);
+	int getattr_resolved(const std::string &name, struct FUSE_STAT *stbuf,
+		std::string *resolved);
 
     typedef int(*PWalkDirectoryWithSetFuseContext)(PDOKAN_FILE_INFO DokanFileInfo, void *buf, const char *name,
         const struct FUSE_STAT *stbuf,
@@ -197,6 +264,10 @@ public:
 
 	int mounted(PDOKAN_FILE_INFO DokanFileInfo);
 
+	// Writes the buffered data of a handle to the filesystem. If report is
+	// set, errors of earlier background flushes are returned and cleared.
+	int flush_write_back(impl_file_handle *hndl, bool report);
+
 	int unmounted(PDOKAN_FILE_INFO DokanFileInfo);
 };
 
@@ -220,6 +291,9 @@ public:
 	impl_file_lock &operator=(const impl_file_lock &other) = delete;
 	void remove_file(impl_file_handle *file);
 	const std::string& get_name() const {return name_;}
+	// Keep the buffers of all handles on this file coherent
+	void flush_write_back(impl_fuse_context *ctx);
+	void drop_read_ahead();
 };
 
 
@@ -227,6 +301,7 @@ class impl_file_handle
 {	
 	friend class impl_file_lock;
 	friend class impl_file_locks;
+	friend class impl_fuse_context;
 	bool is_dir_;
 	uint64_t fh_;
 	impl_file_handle *next_file;
@@ -234,6 +309,17 @@ class impl_file_handle
 	DWORD shared_mode_;
 	typedef std::map<long long, long long> locks_t;
 	locks_t locks;
+
+	// Guards the read-ahead and write-back state below
+	CRITICAL_SECTION cache_lock;
+	std::vector<char> read_ahead_;
+	long long read_ahead_offset_;
+	long long next_read_; // Where a sequential read would continue
+	DWORD read_ahead_window_;
+	// Pending writes, always a single contiguous range
+	std::vector<char> write_back_;
+	long long write_back_offset_;
+	int write_back_error_; // Failure of a flush nobody could report yet
 	impl_file_handle(bool is_dir, DWORD shared_mode);
 public:
 	~impl_file_handle();
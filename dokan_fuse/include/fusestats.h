@@ -0,0 +1,89 @@
+#ifndef FUSESTATS_H_
+#define FUSESTATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum impl_fuse_op
+{
+	FUSE_OP_CREATE_FILE,
+	FUSE_OP_CLEANUP,
+	FUSE_OP_CLOSE_FILE,
+	FUSE_OP_READ_FILE,
+	FUSE_OP_WRITE_FILE,
+	FUSE_OP_FLUSH_FILE_BUFFERS,
+	FUSE_OP_GET_FILE_INFORMATION,
+	FUSE_OP_FIND_FILES,
+	FUSE_OP_SET_FILE_ATTRIBUTES,
+	FUSE_OP_SET_FILE_TIME,
+	FUSE_OP_DELETE_FILE,
+	FUSE_OP_DELETE_DIRECTORY,
+	FUSE_OP_MOVE_FILE,
+	FUSE_OP_SET_END_OF_FILE,
+	FUSE_OP_SET_ALLOCATION_SIZE,
+	FUSE_OP_LOCK_FILE,
+	FUSE_OP_UNLOCK_FILE,
+	FUSE_OP_GET_DISK_FREE_SPACE,
+	FUSE_OP_GET_VOLUME_INFORMATION,
+	FUSE_OP_COUNT
+};
+
+// Latencies are bucketed by powers of two microseconds
+#define FUSE_STATS_BUCKETS 40
+
+/*
+	Per-operation counters of the FUSE bridge: number of Dokan callbacks,
+	backend (fuse_operations) calls they caused and a latency histogram.
+	Enabled with "-o stats" and printed when the filesystem is unmounted.
+	Only depends on the C runtime and on Windows or POSIX clocks,
+	samples/fusestats_test checks it on any platform.
+*/
+class impl_fuse_stats
+{
+	struct op_stats
+	{
+		volatile int64_t calls;
+		volatile int64_t backend_calls;
+		volatile int64_t total_us;
+		volatile int64_t buckets[FUSE_STATS_BUCKETS];
+	};
+	op_stats ops[FUSE_OP_COUNT];
+	// Clock ticks per second, and when the stats were created
+	int64_t frequency;
+	int64_t started;
+public:
+	impl_fuse_stats();
+	impl_fuse_stats(impl_fuse_stats &other) = delete;
+	impl_fuse_stats &operator=(const impl_fuse_stats &other) = delete;
+
+	int64_t now() const;
+	int64_t elapsed_us(int64_t since) const;
+	void record(impl_fuse_op op, int64_t elapsed_us, int64_t backend_calls);
+	void dump(FILE *out) const;
+
+	int64_t calls(impl_fuse_op op) const {return ops[op].calls;}
+	// Upper bound in microseconds of the bucket holding the percentile
+	int64_t percentile_us(impl_fuse_op op, int percent) const;
+
+	// Backend calls made by the current thread so far
+	static int64_t backend_calls();
+	static void add_backend_calls(int64_t count);
+};
+
+/*
+	Records one Dokan callback in the stats, if they are enabled
+*/
+class impl_fuse_op_timer
+{
+	impl_fuse_stats *stats_;
+	impl_fuse_op op_;
+	int64_t start_;
+	int64_t start_calls_;
+public:
+	impl_fuse_op_timer(impl_fuse_stats *stats, impl_fuse_op op);
+	~impl_fuse_op_timer();
+	impl_fuse_op_timer(impl_fuse_op_timer &other) = delete;
+	impl_fuse_op_timer &operator=(const impl_fuse_op_timer &other) = delete;
+};
+
+#endif // FUSESTATS_H_
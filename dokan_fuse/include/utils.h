@@ -26,6 +26,7 @@ std::string wchar_to_utf8_cstr(const wchar_t *str);
 std::string unixify(const std::string &str);
 std::string extract_file_name(const std::string &str);
 std::string extract_dir_name(const std::string &str);
+std::string normalize_path(const std::string &str);
 
 template<class T> void convertStatlikeBuf(const struct FUSE_STAT *stbuf, const std::string &name, 
 										  T * find_data)
@@ -54,6 +54,7 @@ FuseFindFiles(LPCWSTR FileName,
     FPRINTF(stderr, "FindFiles: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_FIND_FILES);
   return errno_to_ntstatus_error(
       impl->find_files(FileName, FillFindData, &WalkDirectoryWithSetFuseContext, DokanFileInfo));
 }
@@ -65,6 +66,7 @@ static void DOKAN_CALLBACK FuseCleanup(LPCWSTR FileName,
 	  FPRINTF(stderr, "Cleanup: %ls\n\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_CLEANUP);
   impl->cleanup(FileName, DokanFileInfo);
 }
 
@@ -75,6 +77,7 @@ FuseDeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
 	  FPRINTF(stderr, "DeleteDirectory: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_DELETE_DIRECTORY);
   return errno_to_ntstatus_error(
       impl->delete_directory(FileName, DokanFileInfo));
 }
@@ -195,6 +198,7 @@ FuseCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
   }
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_CREATE_FILE);
 
   if ((CreateOptions & FILE_DIRECTORY_FILE) == FILE_DIRECTORY_FILE) {
 
@@ -220,6 +224,7 @@ static void DOKAN_CALLBACK FuseCloseFile(LPCWSTR FileName,
     FPRINTF(stderr, "Close: %ls\n\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_CLOSE_FILE);
   impl->close_file(FileName, DokanFileInfo);
 }
 
@@ -233,6 +238,7 @@ static NTSTATUS DOKAN_CALLBACK FuseReadFile(LPCWSTR FileName, LPVOID Buffer,
              static_cast<__int64>(Offset), static_cast<unsigned>(BufferLength));
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_READ_FILE);
   return errno_to_ntstatus_error(impl->read_file(
       FileName, Buffer, BufferLength, ReadLength, Offset, DokanFileInfo));
 }
@@ -248,6 +254,7 @@ static NTSTATUS DOKAN_CALLBACK FuseWriteFile(LPCWSTR FileName, LPCVOID Buffer,
              Offset, NumberOfBytesToWrite);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_WRITE_FILE);
   return errno_to_ntstatus_error(
       impl->write_file(FileName, Buffer, NumberOfBytesToWrite,
                        NumberOfBytesWritten, Offset, DokanFileInfo));
@@ -260,6 +267,7 @@ FuseFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
     FPRINTF(stderr, "FlushFileBuffers: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_FLUSH_FILE_BUFFERS);
   return errno_to_ntstatus_error(
       impl->flush_file_buffers(FileName, DokanFileInfo));
 }
@@ -272,6 +280,7 @@ static NTSTATUS DOKAN_CALLBACK FuseGetFileInformation(
     FPRINTF(stderr, "GetFileInfo: : %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_GET_FILE_INFORMATION);
   return errno_to_ntstatus_error(impl->get_file_information(
       FileName, HandleFileInformation, DokanFileInfo));
 }
@@ -283,6 +292,7 @@ static NTSTATUS DOKAN_CALLBACK FuseDeleteFile(LPCWSTR FileName,
     FPRINTF(stderr, "DeleteFile: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_DELETE_FILE);
   return errno_to_ntstatus_error(impl->delete_file(FileName, DokanFileInfo));
 }
 
@@ -295,6 +305,7 @@ FuseMoveFile(LPCWSTR FileName, // existing file name
     FPRINTF(stderr, "MoveFile: %ls -> %ls\n\n", FileName, NewFileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_MOVE_FILE);
   return errno_to_ntstatus_error(
       impl->move_file(FileName, NewFileName, ReplaceIfExisting, DokanFileInfo));
 }
@@ -308,6 +319,7 @@ static NTSTATUS DOKAN_CALLBACK FuseLockFile(LPCWSTR FileName,
     FPRINTF(stderr, "LockFile: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_LOCK_FILE);
   return errno_to_ntstatus_error(
       impl->lock_file(FileName, ByteOffset, Length, DokanFileInfo));
 }
@@ -321,6 +333,7 @@ static NTSTATUS DOKAN_CALLBACK FuseUnlockFile(LPCWSTR FileName,
     FPRINTF(stderr, "UnlockFile: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_UNLOCK_FILE);
   return errno_to_ntstatus_error(
       impl->unlock_file(FileName, ByteOffset, Length, DokanFileInfo));
 }
@@ -332,6 +345,7 @@ static NTSTATUS DOKAN_CALLBACK FuseSetEndOfFile(
     FPRINTF(stderr, "SetEndOfFile: %ls, %lld\n", FileName, ByteOffset);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_SET_END_OF_FILE);
   return errno_to_ntstatus_error(
       impl->set_end_of_file(FileName, ByteOffset, DokanFileInfo));
 }
@@ -343,6 +357,7 @@ static NTSTATUS DOKAN_CALLBACK FuseSetAllocationSize(
     FPRINTF(stderr, "SetAllocationSize: %ls, %lld\n", FileName, ByteOffset);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_SET_ALLOCATION_SIZE);
 
   BY_HANDLE_FILE_INFORMATION byHandleFileInfo;
   ZeroMemory(&byHandleFileInfo, sizeof(BY_HANDLE_FILE_INFORMATION));
@@ -378,6 +393,7 @@ static NTSTATUS DOKAN_CALLBACK FuseSetFileAttributes(
     FPRINTF(stderr, "SetFileAttributes: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_SET_FILE_ATTRIBUTES);
   return errno_to_ntstatus_error(
       impl->set_file_attributes(FileName, FileAttributes, DokanFileInfo));
 }
@@ -392,6 +408,7 @@ static NTSTATUS DOKAN_CALLBACK FuseSetFileTime(LPCWSTR FileName,
     FPRINTF(stderr, "SetFileTime: %ls\n", FileName);
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_SET_FILE_TIME);
   return errno_to_ntstatus_error(impl->set_file_time(
       FileName, CreationTime, LastAccessTime, LastWriteTime, DokanFileInfo));
 }
@@ -404,6 +421,7 @@ static NTSTATUS DOKAN_CALLBACK FuseGetDiskFreeSpace(
     FPRINTF(stderr, "GetDiskFreeSpace\n");
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_GET_DISK_FREE_SPACE);
   return errno_to_ntstatus_error(
       impl->get_disk_free_space(FreeBytesAvailable, TotalNumberOfBytes,
                                 TotalNumberOfFreeBytes, DokanFileInfo));
@@ -419,6 +437,7 @@ GetVolumeInformation(LPWSTR VolumeNameBuffer, DWORD VolumeNameSize,
     FPRINTF(stderr, "GetVolumeInformation\n");
 
   impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  impl_fuse_op_timer timer(impl->stats(), FUSE_OP_GET_VOLUME_INFORMATION);
   *VolumeSerialNumber = 0;
   *MaximumComponentLength = 255;
   return errno_to_ntstatus_error(impl->get_volume_information(
@@ -490,9 +509,15 @@ int do_fuse_loop(struct fuse *fs, bool mt) {
   if (fileumask == 0)
     fileumask = umask;
 
+  // Splitting a request over several threads only makes sense if the
+  // filesystem is already prepared to be called concurrently
+  unsigned int io_fanout = mt ? fs->conf.parallelIo : 1;
+
   impl_fuse_context impl(&fs->ops, fs->user_data, fs->conf.debug != 0,
                          fileumask, dirumask, fs->conf.fsname,
-                         fs->conf.volname, fs->conf.uncname);
+                         fs->conf.volname, fs->conf.uncname, io_fanout,
+                         fs->conf.readAhead, fs->conf.writeBack,
+                         fs->conf.stats != 0);
 
   // Parse Dokan options
   PDOKAN_OPTIONS dokanOptions = static_cast<PDOKAN_OPTIONS>(malloc(sizeof(DOKAN_OPTIONS)));
@@ -515,7 +540,21 @@ int do_fuse_loop(struct fuse *fs, bool mt) {
 
   dokanOptions->Version = DOKAN_VERSION;
   dokanOptions->MountPoint = mount;
-  dokanOptions->ThreadCount = mt ? FUSE_THREAD_COUNT : 1;
+  if (!mt) {
+    dokanOptions->ThreadCount = 1;
+  } else if (fs->conf.maxThreads) {
+    // Let Dokan grow and shrink the pool on demand
+    dokanOptions->Options |= DOKAN_OPTION_DYNAMIC_THREAD_POOL;
+    dokanOptions->ThreadCount = static_cast<USHORT>(
+        fs->conf.maxThreads < DOKAN_MAX_THREAD ? fs->conf.maxThreads
+                                               : DOKAN_MAX_THREAD);
+  } else if (fs->conf.threads) {
+    dokanOptions->ThreadCount = static_cast<USHORT>(
+        fs->conf.threads < DOKAN_MAX_THREAD ? fs->conf.threads
+                                            : DOKAN_MAX_THREAD);
+  } else {
+    dokanOptions->ThreadCount = FUSE_THREAD_COUNT;
+  }
   dokanOptions->Timeout = fs->conf.timeoutInSec * 1000;
   dokanOptions->AllocationUnitSize = fs->conf.allocationUnitSize;
   dokanOptions->SectorSize = fs->conf.sectorSize;
@@ -538,6 +577,9 @@ int do_fuse_loop(struct fuse *fs, bool mt) {
   fs->within_loop = true;
   int res = fs->ch->ResolvedDokanMain(dokanOptions, &dokanOperations);
   fs->within_loop = false;
+
+  if (impl.stats())
+    impl.stats()->dump(stderr);
   return res;
 }
 
@@ -598,6 +640,12 @@ static const struct fuse_opt fuse_lib_opts[] = {
     FUSE_LIB_OPT("daemon_timeout=%d", timeoutInSec, 0),
     FUSE_LIB_OPT("alloc_unit_size=%lu", allocationUnitSize, 0),
     FUSE_LIB_OPT("sector_size=%lu", sectorSize, 0),
+    FUSE_LIB_OPT("parallel_io=%u", parallelIo, 0),
+    FUSE_LIB_OPT("threads=%u", threads, 0),
+    FUSE_LIB_OPT("max_threads=%u", maxThreads, 0),
+    FUSE_LIB_OPT("readahead=%u", readAhead, 0),
+    FUSE_LIB_OPT("write_back=%u", writeBack, 0),
+    FUSE_LIB_OPT("stats", stats, 1),
     FUSE_LIB_OPT("-n", networkDrive, 1),
     FUSE_OPT_END};
 
@@ -614,6 +662,17 @@ static void fuse_lib_help(void) {
       "    -o daemon_timeout=M    set timeout in seconds\n"
       "    -o alloc_unit_size=M   set allocation unit size\n"
       "    -o sector_size=M       set sector size\n"
+      "    -o parallel_io=M       split reads and writes over up to M threads\n"
+      "                           (the filesystem must allow concurrent calls\n"
+      "                           on the same file handle)\n"
+      "    -o threads=M           use M threads for the multithreaded loop\n"
+      "    -o max_threads=M       start one thread per CPU and grow on demand\n"
+      "                           up to M threads\n"
+      "    -o readahead=M         read ahead up to M bytes on sequential reads\n"
+      "                           (limited by max_readahead set in init)\n"
+      "    -o write_back=M        buffer up to M bytes of sequential writes per\n"
+      "                           handle until flush, cleanup or close\n"
+      "    -o stats               print per-operation statistics on unmount\n"
       "    -n                     use network drive\n"
       "\n");
 }
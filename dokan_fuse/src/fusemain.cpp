@@ -66,6 +66,27 @@ struct fuse_context *fuse_get_context(void) {
   return &cur_impl_chain_link->call_ctx_;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////
+////// Backend call counting
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Stands in for a fuse_operations member, counts the call on the current
+// thread and forwards it to the filesystem's own implementation
+template <typename R, typename... Args> struct impl_counted_op<R (*)(Args...)> {
+  template <R (*fuse_operations::*member)(Args...)>
+  static R call(Args... args) {
+    impl_fuse_stats::add_backend_calls(1);
+    impl_fuse_context *ctx = static_cast<impl_fuse_context *>(
+        static_cast<void *>(fuse_get_context()->fuse));
+    return (ctx->backend_ops_.*member)(args...);
+  }
+};
+
+#define COUNT_OP(name)                                                         \
+  if (ops_.name)                                                               \
+    ops_.name = &impl_counted_op<decltype(ops_.name)>::call<                   \
+        &fuse_operations::name>;
+
 ///////////////////////////////////////////////////////////////////////////////////////
 ////// FUSE bridge
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -73,11 +94,32 @@ impl_fuse_context::impl_fuse_context(const struct fuse_operations *ops,
                                      void *user_data, bool debug,
                                      unsigned int filemask,
                                      unsigned int dirmask, const char *fsname,
-                                     const char *volname, const char *uncname)
-    : ops_(*ops), user_data_(user_data), debug_(debug), filemask_(filemask),
-      dirmask_(dirmask), fsname_(fsname),
-      volname_(volname), uncname_(uncname) // Use current user data
+                                     const char *volname, const char *uncname,
+                                     unsigned int io_fanout,
+                                     unsigned int read_ahead,
+                                     unsigned int write_back, bool stats)
+    : ops_(*ops), backend_ops_(*ops), user_data_(user_data), debug_(debug),
+      filemask_(filemask), dirmask_(dirmask), fsname_(fsname),
+      volname_(volname), uncname_(uncname), // Use current user data
+      io_fanout_(io_fanout ? io_fanout : 1), read_ahead_(read_ahead),
+      write_back_(write_back), symlinks(SYMLINK_CACHE_SIZE)
 {
+  if (stats) {
+    stats_.reset(new impl_fuse_stats());
+    // init and destroy run outside of any request and are not counted
+    COUNT_OP(getattr) COUNT_OP(readlink) COUNT_OP(getdir) COUNT_OP(mknod)
+    COUNT_OP(mkdir) COUNT_OP(unlink) COUNT_OP(rmdir) COUNT_OP(symlink)
+    COUNT_OP(rename) COUNT_OP(link) COUNT_OP(chmod) COUNT_OP(chown)
+    COUNT_OP(truncate) COUNT_OP(utime) COUNT_OP(open) COUNT_OP(read)
+    COUNT_OP(write) COUNT_OP(statfs) COUNT_OP(flush) COUNT_OP(release)
+    COUNT_OP(fsync) COUNT_OP(setxattr) COUNT_OP(getxattr) COUNT_OP(listxattr)
+    COUNT_OP(removexattr) COUNT_OP(opendir) COUNT_OP(readdir)
+    COUNT_OP(releasedir) COUNT_OP(fsyncdir) COUNT_OP(access) COUNT_OP(create)
+    COUNT_OP(ftruncate) COUNT_OP(fgetattr) COUNT_OP(lock) COUNT_OP(utimens)
+    COUNT_OP(bmap) COUNT_OP(win_get_attributes) COUNT_OP(win_set_attributes)
+    COUNT_OP(win_set_times)
+  }
+
   // Reset connection info
   memset(&conn_info_, 0, sizeof(fuse_conn_info));
   conn_info_.max_write = UINT_MAX;
@@ -164,6 +206,7 @@ int impl_fuse_context::do_delete_directory(LPCWSTR file_name,
   // A special case: symlinks are deleted by unlink, not rmdir
   struct FUSE_STAT stbuf = {0};
   CHECKED(ops_.getattr(fname.c_str(), &stbuf));
+  symlinks.invalidate(fname);
   if (S_ISLNK(stbuf.st_mode) && ops_.unlink)
     return ops_.unlink(fname.c_str());
 
@@ -178,6 +221,7 @@ int impl_fuse_context::do_delete_file(LPCWSTR file_name,
 
   // Note: we do not try to resolve symlink target
   std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  symlinks.invalidate(fname);
   return ops_.unlink(fname.c_str());
 }
 
@@ -237,15 +281,19 @@ int impl_fuse_context::resolve_symlink(const std::string &name,
   if (!ops_.readlink)
     return -EINVAL;
 
+  if (symlinks.lookup(name, res))
+    return 0;
+
   char buf[MAX_PATH * 2] = {0};
   CHECKED(ops_.readlink(name.c_str(), buf, MAX_PATH * 2));
+  std::string target;
   if (buf[0] == '/')
-    *res = buf;
-  else {
-    // TODO: add full path normalization here
-    *res = extract_dir_name(name) + buf;
-  }
+    target = normalize_path(buf);
+  else
+    target = normalize_path(extract_dir_name(name) + buf);
 
+  symlinks.insert(name, target);
+  *res = target;
   return 0;
 }
 
@@ -253,6 +301,10 @@ int impl_fuse_context::check_and_resolve(std::string *name) {
   if (!ops_.getattr)
     return -EINVAL;
 
+  // A known symlink does not need to be stat'ed again
+  if (symlinks.lookup(*name, name))
+    return 0;
+
   struct FUSE_STAT stat = {0};
   CHECKED(ops_.getattr(name->c_str(), &stat));
   if (S_ISLNK(stat.st_mode)) {
@@ -262,6 +314,34 @@ int impl_fuse_context::check_and_resolve(std::string *name) {
   return 0;
 }
 
+// getattr() that follows a symlink. *resolved is set to the path the
+// attributes belong to, or left empty if name itself does not exist.
+int impl_fuse_context::getattr_resolved(const std::string &name,
+                                        struct FUSE_STAT *stbuf,
+                                        std::string *resolved) {
+  resolved->clear();
+
+  std::string target;
+  if (symlinks.lookup(name, &target)) {
+    if (ops_.getattr(target.c_str(), stbuf) == 0) {
+      *resolved = target;
+      return 0;
+    }
+    // The link may have been changed behind our back, look it up again
+    symlinks.invalidate(name);
+  }
+
+  CHECKED(ops_.getattr(name.c_str(), stbuf));
+  *resolved = name;
+  if (S_ISLNK(stbuf->st_mode)) {
+    CHECKED(resolve_symlink(name, &target));
+    CHECKED(ops_.getattr(target.c_str(), stbuf));
+    *resolved = target;
+  }
+
+  return 0;
+}
+
 int impl_fuse_context::walk_directory(void *buf, const char *name,
                                       const struct FUSE_STAT *stbuf,
                                       FUSE_OFF_T off) {
@@ -286,8 +366,10 @@ int impl_fuse_context::walk_directory(void *buf, const char *name,
     utf8_to_wchar_buf_old(name, find_data.cFileName, MAX_PATH);
     std::string new_name = wchar_to_utf8_cstr(find_data.cFileName);
     if (ctx->ops_.getattr && ctx->ops_.rename && new_name.length() &&
-        ctx->ops_.getattr(new_name.c_str(), &stbuf) == -ENOENT)
+        ctx->ops_.getattr(new_name.c_str(), &stbuf) == -ENOENT) {
+      ctx->symlinks.invalidate(dirname + name);
       ctx->ops_.rename(name, new_name.c_str());
+    }
   }
   memset(find_data.cAlternateFileName, 0, sizeof(find_data.cAlternateFileName));
 
@@ -298,14 +380,8 @@ int impl_fuse_context::walk_directory(void *buf, const char *name,
     stat.st_mode |= S_IFDIR; // TODO: fill directory params here!!!
   }
   else if (ctx->ops_.getattr) {
-    CHECKED(ctx->ops_.getattr((dirname + name).c_str(), &stat));
-  }
-
-  if (S_ISLNK(stat.st_mode)
-      && ctx->ops_.getattr) {
     std::string resolved;
-    CHECKED(ctx->resolve_symlink(dirname + name, &resolved));
-    CHECKED(ctx->ops_.getattr(resolved.c_str(), &stat));
+    CHECKED(ctx->getattr_resolved(dirname + name, &stat, &resolved));
   }
 
   convertStatlikeBuf(&stat, name, &find_data);
@@ -382,12 +458,8 @@ int impl_fuse_context::open_directory(LPCWSTR file_name,
   // We don't have opendir(), so the most we can do is make sure
   // that the target is indeed a directory
   struct FUSE_STAT st = {0};
-  CHECKED(ops_.getattr(fname.c_str(), &st));
-  if (S_ISLNK(st.st_mode)) {
-    std::string resolved;
-    CHECKED(resolve_symlink(fname, &resolved));
-    CHECKED(ops_.getattr(resolved.c_str(), &st));
-  }
+  std::string resolved;
+  CHECKED(getattr_resolved(fname, &st, &resolved));
 
   // Not a directory
   if ((st.st_mode & S_IFDIR) != S_IFDIR)
@@ -409,6 +481,13 @@ int impl_fuse_context::cleanup(LPCWSTR file_name,
   // The one way to solve this is to keep a table of files 'still in flight'
   // and block until the file is closed. We're not doing this yet.
 
+  impl_file_handle *hndl =
+      reinterpret_cast<impl_file_handle *>(dokan_file_info->Context);
+  // Last user handle is gone, do not keep data back any longer. Done before
+  // DeleteOnClose so nothing is written to the file after it is removed.
+  if (hndl && !hndl->is_dir())
+    flush_write_back(hndl, false);
+
   // No context for directories when ops_.opendir is not set
   if (dokan_file_info->Context
     || (dokan_file_info->IsDirectory && !ops_.opendir)) {
@@ -511,19 +590,18 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
     return -EINVAL;
 
   struct FUSE_STAT stbuf = {0};
-  // Check if the target file/directory exists
-  if (ops_.getattr(fname.c_str(), &stbuf) < 0) {
+  // Check if the target file/directory exists, following symlinks
+  std::string resolved;
+  int res = getattr_resolved(fname, &stbuf, &resolved);
+  if (res < 0 && resolved.empty()) {
     // Nope.
     if (dokan_file_info->IsDirectory)
       return -EINVAL; // We can't create directories using CreateFile
     return do_create_file(file_name, creation_disposition, share_mode,
                           access_mode, dokan_file_info);
   } else {
-    if (S_ISLNK(stbuf.st_mode)) {
-      // Get link's target
-      CHECKED(resolve_symlink(fname, &fname));
-      CHECKED(ops_.getattr(fname.c_str(), &stbuf));
-    }
+    CHECKED(res); // Dangling symlink
+    fname = resolved;
 
     if ((stbuf.st_mode & S_IFDIR) == S_IFDIR) {
       // Existing directory
@@ -539,6 +617,7 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
       if (creation_disposition == FILE_OVERWRITE) {
         if (!ops_.unlink)
           return -EINVAL;
+        symlinks.invalidate(fname);
         CHECKED(ops_.unlink(fname.c_str())); // Delete file
         // And create it!
         return do_create_file(file_name, creation_disposition, share_mode,
@@ -552,7 +631,7 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
         return win_error(STATUS_OBJECT_NAME_COLLISION, true);
       }
 
-      long res = do_open_file(file_name, share_mode, access_mode, dokan_file_info);
+      res = do_open_file(file_name, share_mode, access_mode, dokan_file_info);
       if (res == 0 &&
         (creation_disposition == FILE_OVERWRITE_IF ||
         creation_disposition == FILE_OPEN_IF)) {
@@ -571,7 +650,10 @@ int impl_fuse_context::close_file(LPCWSTR file_name,
 
   int flush_err = 0;
   if (hndl) {
+    int write_err = flush_write_back(hndl, true);
     flush_err = hndl->close(&ops_);
+    if (!flush_err)
+      flush_err = write_err;
     delete hndl;
   }
   dokan_file_info->Context = 0;
@@ -603,26 +685,19 @@ int impl_fuse_context::read_file(LPCWSTR /*file_name*/, LPVOID buffer,
 
   FUSE_OFF_T off;
   CHECKED(cast_from_longlong(offset, &off));
-  fuse_file_info finfo(hndl->make_finfo());
 
-  std::string file_name = hndl->get_name();
-  DWORD total_read = 0;
-  while (total_read < num_bytes_to_read) {
-    DWORD to_read = num_bytes_to_read - total_read;
-    if (to_read > MAX_READ_SIZE)
-      to_read = MAX_READ_SIZE;
-
-    int res = ops_.read(file_name.c_str(), static_cast<char *>(buffer), to_read,
-                        off,
-                        &finfo);
-    if (res < 0)
-      return res; // Error
-    if (res == 0)
-      break; // End of file reached
+  // Data written through any handle of the file has to be visible
+  sync_file(hndl);
 
-    total_read += res;
-    off += res;
-    buffer = static_cast<char *>(buffer) + res;
+  DWORD total_read = 0;
+  if (read_ahead_) {
+    CHECKED(read_ahead(hndl, static_cast<char *>(buffer), num_bytes_to_read,
+                       offset, &total_read));
+  } else {
+    fuse_file_info finfo(hndl->make_finfo());
+    std::string file_name = hndl->get_name();
+    CHECKED(do_chunked_io(false, file_name, finfo, static_cast<char *>(buffer),
+                          num_bytes_to_read, off, MAX_READ_SIZE, &total_read));
   }
   // OK!
   *read_bytes = total_read;
@@ -649,15 +724,13 @@ int impl_fuse_context::write_file(LPCWSTR /*file_name*/, LPCVOID buffer,
     return -EACCES;
 
   if (offset < 0) {
+	  // Appending, the size has to include data not written yet
+	  sync_file(hndl);
 	  struct FUSE_STAT stat;
 	  if (0 == ops_.getattr(hndl->get_name().c_str(), &stat)) {
 		  offset = stat.st_size;
 	  }
   }
-  // Clip the maximum write size
-  if (num_bytes_to_write > conn_info_.max_write)
-    num_bytes_to_write = conn_info_.max_write;
-
   // check locking
   if (hndl->check_lock(offset, num_bytes_to_write))
     return -EACCES;
@@ -665,14 +738,29 @@ int impl_fuse_context::write_file(LPCWSTR /*file_name*/, LPCVOID buffer,
   FUSE_OFF_T off;
   CHECKED(cast_from_longlong(offset, &off));
 
+  if (read_ahead_)
+    hndl->file_lock->drop_read_ahead();
+
+  if (write_back_ && num_bytes_to_write < write_back_) {
+    CHECKED(write_behind(hndl, static_cast<const char *>(buffer),
+                         num_bytes_to_write, offset));
+    *num_bytes_written = num_bytes_to_write;
+    return 0;
+  }
+  // Earlier writes of this handle must reach the filesystem first
+  if (write_back_)
+    CHECKED(flush_write_back(hndl, false));
+
+  // Writes larger than max_write are split into several backend calls
   fuse_file_info finfo(hndl->make_finfo());
-  int res = ops_.write(hndl->get_name().c_str(), static_cast<const char *>(buffer),
-                       num_bytes_to_write, off, &finfo);
-  if (res < 0)
-    return res; // Error
+  DWORD total_written = 0;
+  CHECKED(do_chunked_io(true, hndl->get_name(), finfo,
+                        static_cast<char *>(const_cast<void *>(buffer)),
+                        num_bytes_to_write, off, write_chunk_size(),
+                        &total_written));
 
   // OK!
-  *num_bytes_written = res;
+  *num_bytes_written = total_written;
   return 0;
 }
 
@@ -691,6 +779,7 @@ int impl_fuse_context::flush_file_buffers(LPCWSTR /*file_name*/,
     fuse_file_info finfo(hndl->make_finfo());
     return ops_.fsyncdir(hndl->get_name().c_str(), 0, &finfo);
   } else {
+    CHECKED(flush_write_back(hndl, true));
     if (!ops_.fsync)
       return -EINVAL;
     fuse_file_info finfo(hndl->make_finfo());
@@ -706,13 +795,12 @@ int impl_fuse_context::get_file_information(
   if (!ops_.getattr)
     return -EINVAL;
 
+  // Report the size including buffered writes
+  sync_file(reinterpret_cast<impl_file_handle *>(dokan_file_info->Context));
+
   struct FUSE_STAT st = {0};
-  CHECKED(ops_.getattr(fname.c_str(), &st));
-  if (S_ISLNK(st.st_mode)) {
-    std::string resolved;
-    CHECKED(resolve_symlink(fname, &resolved));
-    CHECKED(ops_.getattr(resolved.c_str(), &st));
-  }
+  std::string resolved;
+  CHECKED(getattr_resolved(fname, &st, &resolved));
 
   handle_file_information->nNumberOfLinks = st.st_nlink;
   if ((st.st_mode & S_IFDIR) == S_IFDIR)
@@ -758,6 +846,7 @@ int impl_fuse_context::move_file(LPCWSTR file_name, LPCWSTR new_file_name,
       return -EISDIR;
     if (!ops_.unlink)
       return -EINVAL;
+    symlinks.invalidate(new_name);
     CHECKED(ops_.unlink(new_name.c_str()));
   }
 
@@ -767,6 +856,8 @@ int impl_fuse_context::move_file(LPCWSTR file_name, LPCWSTR new_file_name,
     return -EEXIST;
   }
 
+  symlinks.invalidate(name);
+  symlinks.invalidate(new_name);
   CHECKED(ops_.rename(name.c_str(), new_name.c_str()));
   file_locks.renamed_file(name, new_name);
   return 0;
@@ -837,6 +928,9 @@ int impl_fuse_context::set_end_of_file(LPCWSTR file_name, LONGLONG byte_offset,
 
   impl_file_handle *hndl =
       reinterpret_cast<impl_file_handle *>(dokan_file_info->Context);
+  sync_file(hndl);
+  if (hndl && read_ahead_)
+    hndl->file_lock->drop_read_ahead();
   if (hndl && ops_.ftruncate) {
     fuse_file_info finfo(hndl->make_finfo());
     return ops_.ftruncate(hndl->get_name().c_str(), off, &finfo);
@@ -886,6 +980,9 @@ int impl_fuse_context::set_file_time(PCWSTR file_name,
   if (!ops_.utimens && !ops_.utime && !ops_.win_set_times)
     return -EINVAL;
 
+  // A later flush would overwrite the times set here
+  sync_file(reinterpret_cast<impl_file_handle *>(dokan_file_info->Context));
+
   if (ops_.win_set_times) {
     std::string fname = unixify(wchar_to_utf8_cstr(file_name));
     CHECKED(check_and_resolve(&fname));
@@ -996,6 +1093,348 @@ int impl_fuse_context::unmounted(PDOKAN_FILE_INFO DokanFileInfo) {
   return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////
+////// I/O engine
+///////////////////////////////////////////////////////////////////////////////////////
+
+/*
+	A single read or write request split into chunk_size pieces. Chunks are
+	claimed through next_chunk by the calling thread and, when parallel_io
+	is set, by up to io_fanout_ - 1 thread pool workers.
+*/
+struct impl_io_batch {
+  impl_fuse_context *ctx;
+  int caller_pid;
+  bool is_write;
+  const std::string *name;
+  fuse_file_info finfo;
+  char *buffer;
+  DWORD length;
+  FUSE_OFF_T offset;
+  DWORD chunk_size;
+  LONG chunk_count;
+  volatile LONG next_chunk;
+  // Index of the first chunk that ended short (EOF, short write or error).
+  // Chunks after it are not needed anymore.
+  volatile LONG stop_chunk;
+  volatile LONG pending;
+  // Backend calls made by pool threads, reported to the caller's thread
+  volatile LONG64 worker_backend_calls;
+  HANDLE done;
+  std::vector<int> results;
+};
+
+int impl_fuse_context::do_io_chunk(impl_io_batch *batch, LONG idx) {
+  DWORD start = static_cast<DWORD>(idx) * batch->chunk_size;
+  DWORD len = batch->length - start;
+  if (len > batch->chunk_size)
+    len = batch->chunk_size;
+
+  // Backends may modify the file info, so every chunk gets its own copy
+  fuse_file_info finfo(batch->finfo);
+  DWORD done = 0;
+  while (done < len) {
+    char *buf = batch->buffer + start + done;
+    FUSE_OFF_T off = batch->offset + start + done;
+    int res;
+    if (batch->is_write)
+      res = ops_.write(batch->name->c_str(), buf, len - done, off, &finfo);
+    else
+      res = ops_.read(batch->name->c_str(), buf, len - done, off, &finfo);
+    if (res < 0)
+      return res; // Error
+    if (res == 0)
+      break; // End of file reached or backend refuses to write more
+    done += res;
+  }
+  return static_cast<int>(done);
+}
+
+void impl_fuse_context::drain_io_batch(impl_io_batch *batch) {
+  for (;;) {
+    LONG idx = InterlockedIncrement(&batch->next_chunk) - 1;
+    if (idx >= batch->chunk_count || idx > batch->stop_chunk)
+      return;
+
+    int res = do_io_chunk(batch, idx);
+    batch->results[idx] = res;
+
+    DWORD expected = batch->length - static_cast<DWORD>(idx) * batch->chunk_size;
+    if (expected > batch->chunk_size)
+      expected = batch->chunk_size;
+    if (res < 0 || static_cast<DWORD>(res) < expected) {
+      // Lower stop_chunk to idx unless an earlier chunk already did
+      LONG stop = batch->stop_chunk;
+      while (idx < stop) {
+        LONG prev = InterlockedCompareExchange(&batch->stop_chunk, idx, stop);
+        if (prev == stop)
+          break;
+        stop = prev;
+      }
+    }
+  }
+}
+
+DWORD WINAPI impl_fuse_context::io_worker(LPVOID param) {
+  impl_io_batch *batch = static_cast<impl_io_batch *>(param);
+  {
+    // Pool threads need the caller's FUSE frame for fuse_get_context()
+    impl_chain_guard guard(batch->ctx, batch->caller_pid);
+    LONGLONG calls = impl_fuse_stats::backend_calls();
+    batch->ctx->drain_io_batch(batch);
+    InterlockedExchangeAdd64(&batch->worker_backend_calls,
+                             impl_fuse_stats::backend_calls() - calls);
+  }
+  if (InterlockedDecrement(&batch->pending) == 0)
+    SetEvent(batch->done);
+  return 0;
+}
+
+int impl_fuse_context::do_chunked_io(bool is_write, const std::string &name,
+                                     const fuse_file_info &finfo, char *buffer,
+                                     DWORD length, FUSE_OFF_T offset,
+                                     DWORD chunk_size, DWORD *transferred) {
+  *transferred = 0;
+  if (length == 0)
+    return 0;
+
+  impl_io_batch batch;
+  batch.ctx = this;
+  fuse_context *context = fuse_get_context();
+  batch.caller_pid = context ? context->pid : -1;
+  batch.is_write = is_write;
+  batch.name = &name;
+  batch.finfo = finfo;
+  batch.buffer = buffer;
+  batch.length = length;
+  batch.offset = offset;
+  batch.chunk_size = chunk_size;
+  batch.chunk_count = static_cast<LONG>((length - 1) / chunk_size + 1);
+  batch.next_chunk = 0;
+  batch.stop_chunk = batch.chunk_count;
+  batch.pending = 1; // The calling thread
+  batch.worker_backend_calls = 0;
+  batch.done = nullptr;
+  batch.results.assign(batch.chunk_count, 0);
+
+  // Parallel dispatch is opt-in through parallel_io: whoever mounts the
+  // filesystem vouches that it serves concurrent requests on the same file
+  // handle.
+  LONG workers = 0;
+  if (io_fanout_ > 1 && batch.chunk_count > 1) {
+    workers = batch.chunk_count - 1;
+    if (workers > static_cast<LONG>(io_fanout_ - 1))
+      workers = static_cast<LONG>(io_fanout_ - 1);
+    batch.done = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (batch.done == nullptr)
+      workers = 0;
+  }
+
+  for (LONG i = 0; i < workers; ++i) {
+    InterlockedIncrement(&batch.pending);
+    // Workers block on the backend, the pool may add threads for them
+    if (!QueueUserWorkItem(&io_worker, &batch, WT_EXECUTELONGFUNCTION)) {
+      InterlockedDecrement(&batch.pending);
+      break;
+    }
+  }
+
+  drain_io_batch(&batch);
+  if (InterlockedDecrement(&batch.pending) != 0)
+    WaitForSingleObject(batch.done, INFINITE);
+  if (batch.done)
+    CloseHandle(batch.done);
+  impl_fuse_stats::add_backend_calls(batch.worker_backend_calls);
+
+  // Only the contiguous prefix of completed chunks counts as transferred
+  DWORD total = 0;
+  for (LONG i = 0; i < batch.chunk_count; ++i) {
+    int res = batch.results[i];
+    if (res < 0) {
+      if (total == 0)
+        return res; // Error
+      break;
+    }
+    total += res;
+    if (i >= batch.stop_chunk)
+      break;
+  }
+
+  *transferred = total;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Symlink cache
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Is name equal to path or located below it?
+static bool is_same_or_below(const std::string &name, const std::string &path) {
+  if (name.compare(0, path.size(), path) != 0)
+    return false;
+  return name.size() == path.size() || name[path.size()] == '/' ||
+         path == "/";
+}
+
+bool impl_symlink_cache::lookup(const std::string &name, std::string *target) {
+  bool found = false;
+  EnterCriticalSection(&lock);
+  index_t::iterator i = index.find(name);
+  if (i != index.end()) {
+    entries.splice(entries.begin(), entries, i->second);
+    *target = i->second->second;
+    found = true;
+  }
+  LeaveCriticalSection(&lock);
+  return found;
+}
+
+void impl_symlink_cache::insert(const std::string &name,
+                                const std::string &target) {
+  EnterCriticalSection(&lock);
+  index_t::iterator i = index.find(name);
+  if (i != index.end()) {
+    i->second->second = target;
+    entries.splice(entries.begin(), entries, i->second);
+  } else {
+    entries.push_front(std::make_pair(name, target));
+    index[name] = entries.begin();
+    if (entries.size() > max_size) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+  LeaveCriticalSection(&lock);
+}
+
+void impl_symlink_cache::invalidate(const std::string &name) {
+  // Renaming or deleting a directory affects every link below it and every
+  // link pointing into it.
+  EnterCriticalSection(&lock);
+  for (entries_t::iterator i = entries.begin(); i != entries.end();) {
+    if (is_same_or_below(i->first, name) || is_same_or_below(i->second, name)) {
+      index.erase(i->first);
+      i = entries.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  LeaveCriticalSection(&lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Read-ahead and write-back
+///////////////////////////////////////////////////////////////////////////////////////
+int impl_fuse_context::read_ahead(impl_file_handle *hndl, char *buffer,
+                                  DWORD length, LONGLONG offset, DWORD *read) {
+  EnterCriticalSection(&hndl->cache_lock);
+  std::vector<char> &cache = hndl->read_ahead_;
+  LONGLONG cache_end =
+      hndl->read_ahead_offset_ + static_cast<LONGLONG>(cache.size());
+  if (!cache.empty() && offset >= hndl->read_ahead_offset_ &&
+      offset + length <= cache_end) {
+    memcpy(buffer, &cache[offset - hndl->read_ahead_offset_], length);
+    hndl->next_read_ = offset + length;
+    LeaveCriticalSection(&hndl->cache_lock);
+    *read = length;
+    return 0;
+  }
+
+  // Grow the window while the reads stay sequential
+  DWORD max_window = read_ahead_;
+  if (conn_info_.max_readahead < max_window)
+    max_window = conn_info_.max_readahead;
+  DWORD window = 0;
+  if (offset == hndl->next_read_) {
+    window = hndl->read_ahead_window_ ? hndl->read_ahead_window_ * 2
+                                      : length * 2;
+    if (window > max_window || window < hndl->read_ahead_window_)
+      window = max_window;
+  }
+  hndl->read_ahead_window_ = window;
+
+  FUSE_OFF_T off;
+  int res = cast_from_longlong(offset, &off);
+  fuse_file_info finfo(hndl->make_finfo());
+  if (res == 0 && window > length) {
+    DWORD got = 0;
+    cache.resize(window);
+    res = do_chunked_io(false, hndl->get_name(), finfo, &cache[0], window, off,
+                        MAX_READ_SIZE, &got);
+    cache.resize(res == 0 ? got : 0);
+    hndl->read_ahead_offset_ = offset;
+    *read = got < length ? got : length;
+    if (*read)
+      memcpy(buffer, &cache[0], *read);
+  } else if (res == 0) {
+    cache.clear();
+    res = do_chunked_io(false, hndl->get_name(), finfo, buffer, length, off,
+                        MAX_READ_SIZE, read);
+  }
+  hndl->next_read_ = offset + *read;
+  LeaveCriticalSection(&hndl->cache_lock);
+  return res;
+}
+
+int impl_fuse_context::write_behind(impl_file_handle *hndl, const char *buffer,
+                                    DWORD length, LONGLONG offset) {
+  int res = 0;
+  EnterCriticalSection(&hndl->cache_lock);
+  std::vector<char> &pending = hndl->write_back_;
+  if (!pending.empty() &&
+      offset != hndl->write_back_offset_ + static_cast<LONGLONG>(pending.size()))
+    res = flush_write_back_unlocked(hndl);
+  if (res == 0) {
+    if (pending.empty())
+      hndl->write_back_offset_ = offset;
+    pending.insert(pending.end(), buffer, buffer + length);
+    if (pending.size() >= write_back_)
+      res = flush_write_back_unlocked(hndl);
+  }
+  LeaveCriticalSection(&hndl->cache_lock);
+  return res;
+}
+
+int impl_fuse_context::flush_write_back_unlocked(impl_file_handle *hndl) {
+  std::vector<char> &pending = hndl->write_back_;
+  if (pending.empty())
+    return 0;
+
+  FUSE_OFF_T off;
+  int res = cast_from_longlong(hndl->write_back_offset_, &off);
+  if (res == 0) {
+    fuse_file_info finfo(hndl->make_finfo());
+    DWORD written = 0;
+    res = do_chunked_io(true, hndl->get_name(), finfo, &pending[0],
+                        static_cast<DWORD>(pending.size()), off,
+                        write_chunk_size(), &written);
+    if (res == 0 && written < pending.size())
+      res = -EIO;
+  }
+  // The data is dropped on failure, as the write would have failed too
+  pending.clear();
+  if (res)
+    hndl->write_back_error_ = res;
+  return res;
+}
+
+int impl_fuse_context::flush_write_back(impl_file_handle *hndl, bool report) {
+  EnterCriticalSection(&hndl->cache_lock);
+  int res = flush_write_back_unlocked(hndl);
+  if (report) {
+    if (res == 0)
+      res = hndl->write_back_error_;
+    hndl->write_back_error_ = 0;
+  }
+  LeaveCriticalSection(&hndl->cache_lock);
+  return res;
+}
+
+void impl_fuse_context::sync_file(impl_file_handle *hndl) {
+  if (hndl && write_back_)
+    hndl->file_lock->flush_write_back(this);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 ////// File lock
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -1054,6 +1493,24 @@ int impl_file_locks::get_file(const std::string &name, bool is_dir,
   return res;
 }
 
+void impl_file_lock::flush_write_back(impl_fuse_context *ctx) {
+  EnterCriticalSection(&lock);
+  for (impl_file_handle *p = first; p; p = p->next_file)
+    ctx->flush_write_back(p, false);
+  LeaveCriticalSection(&lock);
+}
+
+void impl_file_lock::drop_read_ahead() {
+  EnterCriticalSection(&lock);
+  for (impl_file_handle *p = first; p; p = p->next_file) {
+    EnterCriticalSection(&p->cache_lock);
+    p->read_ahead_.clear();
+    p->read_ahead_window_ = 0;
+    LeaveCriticalSection(&p->cache_lock);
+  }
+  LeaveCriticalSection(&lock);
+}
+
 void impl_file_lock::add_file_unlocked(impl_file_handle *file) {
   file->next_file = first;
   first = file;
@@ -1061,7 +1518,11 @@ void impl_file_lock::add_file_unlocked(impl_file_handle *file) {
 
 void impl_file_lock::remove_file(impl_file_handle *file) {
   impl_file_handle *first_locked;
+  impl_file_locks *owner = locks;
 
+  // Same lock order as get_file. Holding the lock of the owner keeps another
+  // handle from finding this file lock and removing it in between.
+  EnterCriticalSection(&owner->lock);
   EnterCriticalSection(&lock);
   impl_file_handle **p = &first;
   while (*p != nullptr) {
@@ -1073,14 +1534,12 @@ void impl_file_lock::remove_file(impl_file_handle *file) {
     p = &(*p)->next_file;
   }
   first_locked = first;
-  // avoid dead lock
   LeaveCriticalSection(&lock);
 
-  // empty ??
-  if (first_locked)
-    return;
-
-  locks->remove_file(name_);
+  // empty ?? this is deleted then
+  if (!first_locked)
+    owner->remove_file(name_);
+  LeaveCriticalSection(&owner->lock);
 }
 
 void impl_file_locks::remove_file(const std::string &name) {
@@ -1174,9 +1633,16 @@ int impl_file_lock::unlock_file(impl_file_handle *file, long long start,
 ////// File handle
 ///////////////////////////////////////////////////////////////////////////////////////
 impl_file_handle::impl_file_handle(bool is_dir, DWORD shared_mode)
-    : is_dir_(is_dir), fh_(-1), next_file(nullptr), file_lock(nullptr), shared_mode_(shared_mode) {}
+    : is_dir_(is_dir), fh_(-1), next_file(nullptr), file_lock(nullptr), shared_mode_(shared_mode),
+      read_ahead_offset_(0), next_read_(0), read_ahead_window_(0),
+      write_back_offset_(0), write_back_error_(0) {
+  InitializeCriticalSection(&cache_lock);
+}
 
-impl_file_handle::~impl_file_handle() { file_lock->remove_file(this); }
+impl_file_handle::~impl_file_handle() {
+  file_lock->remove_file(this);
+  DeleteCriticalSection(&cache_lock);
+}
 
 int impl_file_handle::close(const struct fuse_operations *ops) {
   int flush_err = 0;
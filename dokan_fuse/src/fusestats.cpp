@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include "fusestats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+#define stats_add(target, value) InterlockedExchangeAdd64(target, value)
+
+static int64_t stats_clock() {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+}
+
+static int64_t stats_clock_frequency() {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  return frequency.QuadPart;
+}
+#else
+#include <time.h>
+
+#define stats_add(target, value) __sync_fetch_and_add(target, value)
+
+static int64_t stats_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static int64_t stats_clock_frequency() { return 1000000000; }
+#endif
+
+#ifdef _MSC_VER
+__declspec(thread) int64_t cur_backend_calls = 0;
+#else
+static __thread int64_t cur_backend_calls = 0;
+#endif
+
+static const char *const op_names[FUSE_OP_COUNT] = {
+    "CreateFile",           "Cleanup",           "CloseFile",
+    "ReadFile",             "WriteFile",         "FlushFileBuffers",
+    "GetFileInformation",   "FindFiles",         "SetFileAttributes",
+    "SetFileTime",          "DeleteFile",        "DeleteDirectory",
+    "MoveFile",             "SetEndOfFile",      "SetAllocationSize",
+    "LockFile",             "UnlockFile",        "GetDiskFreeSpace",
+    "GetVolumeInformation"};
+
+impl_fuse_stats::impl_fuse_stats() {
+  memset(ops, 0, sizeof(ops));
+  frequency = stats_clock_frequency();
+  started = stats_clock();
+}
+
+int64_t impl_fuse_stats::now() const { return stats_clock(); }
+
+int64_t impl_fuse_stats::elapsed_us(int64_t since) const {
+  if (frequency == 0)
+    return 0;
+  return (now() - since) * 1000000 / frequency;
+}
+
+void impl_fuse_stats::record(impl_fuse_op op, int64_t elapsed_us,
+                             int64_t backend_calls) {
+  op_stats &stats = ops[op];
+  int bucket = 0;
+  while (bucket < FUSE_STATS_BUCKETS - 1 && (1LL << bucket) <= elapsed_us)
+    ++bucket;
+
+  stats_add(&stats.calls, 1);
+  stats_add(&stats.backend_calls, backend_calls);
+  stats_add(&stats.total_us, elapsed_us);
+  stats_add(&stats.buckets[bucket], 1);
+}
+
+int64_t impl_fuse_stats::percentile_us(impl_fuse_op op, int percent) const {
+  const op_stats &stats = ops[op];
+  int64_t rank = (stats.calls * percent + 99) / 100;
+  int64_t seen = 0;
+  for (int i = 0; i < FUSE_STATS_BUCKETS; ++i) {
+    seen += stats.buckets[i];
+    if (seen >= rank)
+      return 1LL << i;
+  }
+  return 1LL << (FUSE_STATS_BUCKETS - 1);
+}
+
+void impl_fuse_stats::dump(FILE *out) const {
+  double seconds = static_cast<double>(elapsed_us(started)) / 1e6;
+  long long total_calls = 0;
+
+  fprintf(out, "%-22s %10s %10s %10s %10s %10s %12s\n", "Operation", "Calls",
+          "Ops/sec", "Avg(us)", "P50(us)", "P99(us)", "Backend/op");
+  for (int i = 0; i < FUSE_OP_COUNT; ++i) {
+    impl_fuse_op op = static_cast<impl_fuse_op>(i);
+    const op_stats &stats = ops[i];
+    long long calls = stats.calls;
+    if (calls == 0)
+      continue;
+    total_calls += calls;
+    fprintf(out, "%-22s %10lld %10.1f %10lld %10lld %10lld %12.2f\n",
+            op_names[i], calls, seconds > 0 ? calls / seconds : 0.0,
+            static_cast<long long>(stats.total_us / calls),
+            static_cast<long long>(percentile_us(op, 50)),
+            static_cast<long long>(percentile_us(op, 99)),
+            static_cast<double>(stats.backend_calls) / calls);
+  }
+  fprintf(out, "%lld operations in %.1f seconds (%.1f ops/sec)\n", total_calls,
+          seconds, seconds > 0 ? total_calls / seconds : 0.0);
+}
+
+int64_t impl_fuse_stats::backend_calls() { return cur_backend_calls; }
+
+void impl_fuse_stats::add_backend_calls(int64_t count) {
+  cur_backend_calls += count;
+}
+
+impl_fuse_op_timer::impl_fuse_op_timer(impl_fuse_stats *stats,
+                                       impl_fuse_op op)
+    : stats_(stats), op_(op), start_(0), start_calls_(0) {
+  if (stats_) {
+    start_ = stats_->now();
+    start_calls_ = impl_fuse_stats::backend_calls();
+  }
+}
+
+impl_fuse_op_timer::~impl_fuse_op_timer() {
+  if (stats_)
+    stats_->record(op_, stats_->elapsed_us(start_),
+                   impl_fuse_stats::backend_calls() - start_calls_);
+}
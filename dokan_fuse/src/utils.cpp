@@ -4,6 +4,7 @@
 #include <ntstatus.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <vector>
 #include "utils.h"
 
 typedef unsigned int ICONV_CHAR;
@@ -126,10 +127,30 @@ static size_t put_utf16(unsigned char *buf, ICONV_CHAR c) {
   return 4;
 }
 
+static size_t get_utf32(const unsigned char *p, size_t len, ICONV_CHAR *out) {
+  if (len < 4)
+    return -EINVAL;
+  memcpy(out, p, 4);
+  return 4;
+}
+
+static size_t put_utf32(unsigned char *buf, ICONV_CHAR c) {
+  if (c >= 0x110000u)
+    return -EILSEQ;
+  memcpy(buf, &c, 4);
+  return 4;
+}
+
 typedef size_t (*get_conver_t)(const unsigned char *p, size_t len,
                                ICONV_CHAR *out);
 typedef size_t (*put_convert_t)(unsigned char *buf, ICONV_CHAR c);
 
+// wchar_t is UTF-16 on Windows and UTF-32 on the other platforms
+static const get_conver_t get_wchar =
+    sizeof(wchar_t) == 2 ? get_utf16 : get_utf32;
+static const put_convert_t put_wchar =
+    sizeof(wchar_t) == 2 ? put_utf16 : put_utf32;
+
 static size_t convert_char(get_conver_t get_func, put_convert_t put_func,
                            const void *src, size_t src_len, void *dest) {
   size_t il = src_len;
@@ -162,7 +183,7 @@ static char *wchar_to_utf8(const wchar_t *str) {
     return nullptr;
 
   // Determine required length
-  size_t ln = convert_char(get_utf16, put_utf8, str,
+  size_t ln = convert_char(get_wchar, put_utf8, str,
                            (wcslen(str) + 1) * sizeof(wchar_t), nullptr);
   if (ln <= 0)
     return nullptr;
@@ -171,7 +192,7 @@ static char *wchar_to_utf8(const wchar_t *str) {
     return nullptr;
 
   // Convert to Unicode
-  convert_char(get_utf16, put_utf8, str, (wcslen(str) + 1) * sizeof(wchar_t),
+  convert_char(get_wchar, put_utf8, str, (wcslen(str) + 1) * sizeof(wchar_t),
                res);
   return res;
 }
@@ -180,14 +201,14 @@ void utf8_to_wchar_buf(const char *src, wchar_t *res, int maxlen) {
   if (res == nullptr || maxlen == 0)
     return;
 
-  size_t ln = convert_char(get_utf8, put_utf16, src, strlen(src) + 1,
+  size_t ln = convert_char(get_utf8, put_wchar, src, strlen(src) + 1,
                            nullptr); /* | raise_w32_error()*/
   ;
   if (ln <= 0 || ln / sizeof(wchar_t) > static_cast<size_t>(maxlen)) {
     *res = L'\0';
     return;
   }
-  convert_char(get_utf8, put_utf16, src, strlen(src) + 1,
+  convert_char(get_utf8, put_wchar, src, strlen(src) + 1,
                res); /* | raise_w32_error()*/
   ;
 }
@@ -375,3 +396,29 @@ std::string extract_dir_name(const std::string &str) {
       return str.substr(0, en - f);
   return str;
 }
+
+std::string normalize_path(const std::string &str) {
+  // Drop empty and "." components and let ".." remove its parent
+  std::vector<std::string> parts;
+  size_t pos = 0;
+  while (pos <= str.size()) {
+    size_t next = str.find('/', pos);
+    if (next == std::string::npos)
+      next = str.size();
+    std::string part = str.substr(pos, next - pos);
+    if (part == "..") {
+      if (!parts.empty())
+        parts.pop_back();
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    pos = next + 1;
+  }
+
+  std::string res;
+  for (auto f = parts.begin(); f != parts.end(); ++f)
+    res.append("/").append(*f);
+  if (res.empty())
+    return "/";
+  return res;
+}
@@ -0,0 +1,908 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the reads and writes pended with DokanPendRequest on the fake device
+// channel of samples/fake_device: the DokanLoop thread goes back without
+// replying, DokanCompleteRequest sends the reply from another thread on the
+// async device with the status, length, data and offset of the operation,
+// DokanResetRequestTimeout extends the request until it is completed, and a
+// handle closed while its read is pended stays opened until the reply. Then
+// several loop threads pend reads and writes that completion threads finish in
+// any order, each must get exactly one reply.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan /I..\..\sys /D_EXPORTING async_test.c
+//       ..\fake_device\dokanfiles.c ..\fake_device\fakedevice.c
+//       ..\fake_device\memoryfs.c advapi32.lib
+//   gcc -O2 -pthread -I../win32_shim -I../../dokan -I../../sys -D_EXPORTING
+//       async_test.c ../fake_device/dokanfiles.c ../fake_device/fakedevice.c
+//       ../fake_device/memoryfs.c -o async_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "dokani.h"
+#include "../fake_device/fakedevice.h"
+#include "../fake_device/memoryfs.h"
+
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_PROCESS_ID 4242
+#define TEST_BLOCK 4096
+#define TEST_MAX_SERIALS 8192
+#define STRESS_LOOPS 4
+#define STRESS_COMPLETIONS 4
+#define STRESS_REQUESTS 500
+#define STRESS_BLOCKS 64
+
+#define TEST_ALIGN(Length) (((Length) + 7) & ~(ULONG)7)
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+// What the ReadFile and WriteFile callbacks do
+typedef enum _TEST_BACKEND {
+  // Run the memoryfs callback before returning
+  TEST_BACKEND_SYNC,
+  // Pend the request for TestTakePended
+  TEST_BACKEND_PEND,
+  // Return STATUS_PENDING without pending the request
+  TEST_BACKEND_FAKE_PENDING,
+} TEST_BACKEND;
+
+/**
+ * \struct TEST_PENDED
+ * \brief Read or write pended by the callbacks, completed later
+ */
+typedef struct _TEST_PENDED {
+  PDOKAN_REQUEST Request;
+  BOOL Write;
+  /** Read buffer of the library, or copy of the data to write */
+  PVOID Buffer;
+  DWORD Length;
+  LONGLONG Offset;
+  /** Copy of the DOKAN_FILE_INFO given to the callback */
+  DOKAN_FILE_INFO FileInfo;
+  struct _TEST_PENDED *Next;
+} TEST_PENDED, *PTEST_PENDED;
+
+/**
+ * \struct TEST_REPLY
+ * \brief Replies received for one serial number, on any device
+ */
+typedef struct _TEST_REPLY {
+  LONG Count;
+  NTSTATUS Status;
+  ULONG BufferLength;
+  ULONG64 Context;
+  LONGLONG CurrentByteOffset;
+  /** First bytes of the data of a read */
+  ULONG64 Data;
+} TEST_REPLY, *PTEST_REPLY;
+
+/**
+ * \struct TEST_LOOP
+ * \brief One DokanLoop thread of the test
+ */
+typedef struct _TEST_LOOP {
+  PDOKAN_INSTANCE DokanInstance;
+  FAKE_DEVICE Device;
+  /** Event given to DokanDispatchEvent, EVENT_CONTEXT_MAX_SIZE bytes */
+  PEVENT_CONTEXT Event;
+  ULONG Index;
+} TEST_LOOP, *PTEST_LOOP;
+
+static int g_Failures;
+static volatile LONG g_SerialNumber;
+static TEST_REPLY g_Replies[TEST_MAX_SERIALS];
+static CRITICAL_SECTION g_RepliesLock;
+
+static TEST_BACKEND g_Backend;
+static PTEST_PENDED g_PendedHead;
+static PTEST_PENDED *g_PendedTail = &g_PendedHead;
+static volatile LONG g_PendedCount;
+static CRITICAL_SECTION g_PendedLock;
+// Result of DokanPendRequest called by GetFileInformation
+static PDOKAN_REQUEST g_QueryPendResult;
+static volatile LONG g_Stop;
+
+static DOKAN_OPERATIONS g_MemoryFs;
+static DOKAN_OPERATIONS g_Operations;
+static DOKAN_OPTIONS g_Options;
+static FAKE_DEVICE g_AsyncDevice;
+
+// Reply callback of the loop devices and of the async device
+static VOID RecordReply(PFAKE_DEVICE Device, PEVENT_INFORMATION EventInfo,
+                        ULONG EventLength) {
+  PTEST_REPLY reply = &g_Replies[EventInfo->SerialNumber % TEST_MAX_SERIALS];
+
+  UNREFERENCED_PARAMETER(Device);
+  UNREFERENCED_PARAMETER(EventLength);
+  EnterCriticalSection(&g_RepliesLock);
+  ++reply->Count;
+  reply->Status = EventInfo->Status;
+  reply->BufferLength = EventInfo->BufferLength;
+  reply->Context = EventInfo->Context;
+  // Same field for reads and writes
+  reply->CurrentByteOffset =
+      EventInfo->Operation.Read.CurrentByteOffset.QuadPart;
+  reply->Data = 0;
+  if (EventInfo->BufferLength >= sizeof(ULONG64))
+    CopyMemory(&reply->Data, EventInfo->Buffer, sizeof(ULONG64));
+  LeaveCriticalSection(&g_RepliesLock);
+}
+
+static TEST_REPLY ReplyOf(ULONG SerialNumber) {
+  TEST_REPLY reply;
+
+  EnterCriticalSection(&g_RepliesLock);
+  reply = g_Replies[SerialNumber % TEST_MAX_SERIALS];
+  LeaveCriticalSection(&g_RepliesLock);
+  return reply;
+}
+
+// Backend
+
+static VOID PushPended(PTEST_PENDED Pended) {
+  EnterCriticalSection(&g_PendedLock);
+  Pended->Next = NULL;
+  *g_PendedTail = Pended;
+  g_PendedTail = &Pended->Next;
+  LeaveCriticalSection(&g_PendedLock);
+  InterlockedIncrement(&g_PendedCount);
+}
+
+// Returns the oldest pended request, NULL if there is none
+static PTEST_PENDED TestTakePended(void) {
+  PTEST_PENDED pended;
+
+  EnterCriticalSection(&g_PendedLock);
+  pended = g_PendedHead;
+  if (pended != NULL) {
+    g_PendedHead = pended->Next;
+    if (g_PendedHead == NULL)
+      g_PendedTail = &g_PendedHead;
+    InterlockedDecrement(&g_PendedCount);
+  }
+  LeaveCriticalSection(&g_PendedLock);
+  return pended;
+}
+
+static NTSTATUS Pend(BOOL Write, LPCVOID Buffer, DWORD Length, LONGLONG Offset,
+                     PDOKAN_FILE_INFO DokanFileInfo) {
+  PTEST_PENDED pended;
+
+  pended = (PTEST_PENDED)calloc(1, sizeof(TEST_PENDED) + (Write ? Length : 0));
+  if (pended == NULL)
+    return STATUS_INSUFFICIENT_RESOURCES;
+  pended->Request = DokanPendRequest(DokanFileInfo);
+  if (pended->Request == NULL) {
+    free(pended);
+    return STATUS_INTERNAL_ERROR;
+  }
+  pended->Write = Write;
+  // The write buffer is only valid until the callback returns
+  if (Write) {
+    pended->Buffer = pended + 1;
+    CopyMemory(pended->Buffer, Buffer, Length);
+  } else {
+    pended->Buffer = (PVOID)Buffer;
+  }
+  pended->Length = Length;
+  pended->Offset = Offset;
+  pended->FileInfo = *DokanFileInfo;
+  PushPended(pended);
+  return STATUS_PENDING;
+}
+
+static NTSTATUS DOKAN_CALLBACK TestReadFile(LPCWSTR FileName, LPVOID Buffer,
+                                            DWORD BufferLength,
+                                            LPDWORD ReadLength,
+                                            LONGLONG Offset,
+                                            PDOKAN_FILE_INFO DokanFileInfo) {
+  switch (g_Backend) {
+  case TEST_BACKEND_PEND:
+    *ReadLength = 0;
+    return Pend(FALSE, Buffer, BufferLength, Offset, DokanFileInfo);
+  case TEST_BACKEND_FAKE_PENDING:
+    *ReadLength = 0;
+    return STATUS_PENDING;
+  default:
+    return g_MemoryFs.ReadFile(FileName, Buffer, BufferLength, ReadLength,
+                               Offset, DokanFileInfo);
+  }
+}
+
+static NTSTATUS DOKAN_CALLBACK TestWriteFile(LPCWSTR FileName, LPCVOID Buffer,
+                                             DWORD NumberOfBytesToWrite,
+                                             LPDWORD NumberOfBytesWritten,
+                                             LONGLONG Offset,
+                                             PDOKAN_FILE_INFO DokanFileInfo) {
+  switch (g_Backend) {
+  case TEST_BACKEND_PEND:
+    *NumberOfBytesWritten = 0;
+    return Pend(TRUE, Buffer, NumberOfBytesToWrite, Offset, DokanFileInfo);
+  case TEST_BACKEND_FAKE_PENDING:
+    *NumberOfBytesWritten = 0;
+    return STATUS_PENDING;
+  default:
+    return g_MemoryFs.WriteFile(FileName, Buffer, NumberOfBytesToWrite,
+                                NumberOfBytesWritten, Offset, DokanFileInfo);
+  }
+}
+
+static NTSTATUS DOKAN_CALLBACK
+TestGetFileInformation(LPCWSTR FileName,
+                       LPBY_HANDLE_FILE_INFORMATION HandleFileInformation,
+                       PDOKAN_FILE_INFO DokanFileInfo) {
+  // Only reads and writes can be pended
+  g_QueryPendResult = DokanPendRequest(DokanFileInfo);
+  return g_MemoryFs.GetFileInformation(FileName, HandleFileInformation,
+                                       DokanFileInfo);
+}
+
+// Runs the pended operation on memoryfs and completes it with its result
+static BOOL CompleteWithBackend(PTEST_PENDED Pended) {
+  DWORD bytes = 0;
+  NTSTATUS status;
+  BOOL sent;
+
+  if (Pended->Write)
+    status = g_MemoryFs.WriteFile(L"", Pended->Buffer, Pended->Length, &bytes,
+                                  Pended->Offset, &Pended->FileInfo);
+  else
+    status = g_MemoryFs.ReadFile(L"", Pended->Buffer, Pended->Length, &bytes,
+                                 Pended->Offset, &Pended->FileInfo);
+  sent = DokanCompleteRequest(Pended->Request, status, bytes);
+  free(Pended);
+  return sent;
+}
+
+typedef struct _TEST_COMPLETION {
+  PTEST_PENDED Pended;
+  // Given to DokanCompleteRequest instead of the result of memoryfs
+  BOOL UseStatus;
+  NTSTATUS Status;
+  ULONG Bytes;
+  BOOL Sent;
+} TEST_COMPLETION;
+
+static unsigned __stdcall CompletionThread(void *Parameter) {
+  TEST_COMPLETION *completion = (TEST_COMPLETION *)Parameter;
+
+  if (completion->UseStatus) {
+    completion->Sent = DokanCompleteRequest(completion->Pended->Request,
+                                            completion->Status,
+                                            completion->Bytes);
+    free(completion->Pended);
+  } else {
+    completion->Sent = CompleteWithBackend(completion->Pended);
+  }
+  return 0;
+}
+
+// Completes the pended request on a thread of its own, with the result of
+// memoryfs or with Status and Bytes if UseStatus
+static BOOL CompleteOnThread(PTEST_PENDED Pended, BOOL UseStatus,
+                             NTSTATUS Status, ULONG Bytes) {
+  TEST_COMPLETION completion;
+  HANDLE thread;
+
+  completion.Pended = Pended;
+  completion.UseStatus = UseStatus;
+  completion.Status = Status;
+  completion.Bytes = Bytes;
+  completion.Sent = FALSE;
+  thread = (HANDLE)_beginthreadex(NULL, 0, CompletionThread, &completion, 0,
+                                  NULL);
+  if (thread == NULL) {
+    CompletionThread(&completion);
+    return completion.Sent;
+  }
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+  return completion.Sent;
+}
+
+// Events
+
+static BOOL InitLoop(PTEST_LOOP Loop, PDOKAN_INSTANCE DokanInstance,
+                     ULONG Index) {
+  ZeroMemory(Loop, sizeof(TEST_LOOP));
+  Loop->DokanInstance = DokanInstance;
+  Loop->Device.Reply = RecordReply;
+  Loop->Index = Index;
+  Loop->Event = (PEVENT_CONTEXT)malloc(EVENT_CONTEXT_MAX_SIZE);
+  return Loop->Event != NULL;
+}
+
+static PEVENT_CONTEXT BeginEvent(PTEST_LOOP Loop, UCHAR MajorFunction,
+                                 ULONG64 Context) {
+  PEVENT_CONTEXT event = Loop->Event;
+
+  ZeroMemory(event, sizeof(EVENT_CONTEXT));
+  event->MountId = 1;
+  event->SerialNumber = (ULONG)InterlockedIncrement(&g_SerialNumber);
+  event->ProcessId = TEST_PROCESS_ID;
+  event->MajorFunction = MajorFunction;
+  event->Context = Context;
+  return event;
+}
+
+static VOID EndEvent(PEVENT_CONTEXT Event, PVOID End) {
+  Event->Length = TEST_ALIGN((ULONG)((PCHAR)End - (PCHAR)Event));
+}
+
+// Copies Name with its null, returns its length in bytes without the null
+static ULONG CopyName(PWCHAR Destination, LPCWSTR Name) {
+  ULONG length = (ULONG)(wcslen(Name) * sizeof(WCHAR));
+
+  CopyMemory(Destination, Name, length + sizeof(WCHAR));
+  return length;
+}
+
+// Runs the event like a DokanLoop thread, returns its serial number
+static ULONG Dispatch(PTEST_LOOP Loop, PEVENT_CONTEXT Event) {
+  DokanDispatchEvent((HANDLE)&Loop->Device, Event, Loop->DokanInstance);
+  return Event->SerialNumber;
+}
+
+// Returns the context of the opened file, 0 if the create failed
+static ULONG64 Create(PTEST_LOOP Loop, LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Loop, IRP_MJ_CREATE, 0);
+  PCREATE_CONTEXT create = &event->Operation.Create;
+  PDOKAN_ACCESS_STATE_INTERMEDIATE accessState =
+      &create->SecurityContext.AccessState;
+  PDOKAN_UNICODE_STRING_INTERMEDIATE emptyString;
+  ACCESS_MASK access = FILE_GENERIC_READ | FILE_GENERIC_WRITE;
+  PWCHAR name;
+  TEST_REPLY reply;
+
+  create->SecurityContext.DesiredAccess = access;
+  accessState->OriginalDesiredAccess = access;
+  accessState->RemainingDesiredAccess = access;
+  create->FileAttributes = FILE_ATTRIBUTE_NORMAL;
+  create->CreateOptions = (FILE_OPEN_IF << 24) | FILE_NON_DIRECTORY_FILE;
+  create->ShareAccess = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+  // The object name and type of the access state are both empty
+  emptyString = (PDOKAN_UNICODE_STRING_INTERMEDIATE)(create + 1);
+  ZeroMemory(emptyString, sizeof(DOKAN_UNICODE_STRING_INTERMEDIATE));
+  accessState->UnicodeStringObjectNameOffset =
+      (ULONG)((PCHAR)emptyString - (PCHAR)accessState);
+  accessState->UnicodeStringObjectTypeOffset =
+      accessState->UnicodeStringObjectNameOffset;
+  name = (PWCHAR)(emptyString + 1);
+  create->FileNameOffset = (ULONG)((PCHAR)name - (PCHAR)create);
+  create->FileNameLength = CopyName(name, FileName);
+  EndEvent(event, (PCHAR)name + create->FileNameLength + sizeof(WCHAR));
+
+  reply = ReplyOf(Dispatch(Loop, event));
+  if (reply.Count != 1 || reply.Status != STATUS_SUCCESS)
+    return 0;
+  return reply.Context;
+}
+
+static VOID CloseHandleOf(PTEST_LOOP Loop, ULONG64 Context, LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Loop, IRP_MJ_CLEANUP, Context);
+  PCLEANUP_CONTEXT cleanup = &event->Operation.Cleanup;
+  PCLOSE_CONTEXT close;
+
+  cleanup->FileNameLength = CopyName(cleanup->FileName, FileName);
+  EndEvent(event, (PCHAR)cleanup->FileName + cleanup->FileNameLength +
+                      sizeof(WCHAR));
+  CHECK(ReplyOf(Dispatch(Loop, event)).Status == STATUS_SUCCESS);
+
+  event = BeginEvent(Loop, IRP_MJ_CLOSE, Context);
+  close = &event->Operation.Close;
+  close->FileNameLength = CopyName(close->FileName, FileName);
+  EndEvent(event,
+           (PCHAR)close->FileName + close->FileNameLength + sizeof(WCHAR));
+  Dispatch(Loop, event);
+}
+
+// Returns the serial number of the read
+static ULONG Read(PTEST_LOOP Loop, ULONG64 Context, LPCWSTR FileName,
+                  LONGLONG Offset, ULONG Length) {
+  PEVENT_CONTEXT event = BeginEvent(Loop, IRP_MJ_READ, Context);
+  PREAD_CONTEXT read = &event->Operation.Read;
+
+  read->ByteOffset.QuadPart = Offset;
+  read->BufferLength = Length;
+  read->FileNameLength = CopyName(read->FileName, FileName);
+  EndEvent(event, (PCHAR)read->FileName + read->FileNameLength +
+                      sizeof(WCHAR));
+  return Dispatch(Loop, event);
+}
+
+// Writes Length bytes starting with Tag, returns the serial number of the
+// write. The event is overwritten once dispatched, as the driver reuses it.
+static ULONG Write(PTEST_LOOP Loop, ULONG64 Context, LPCWSTR FileName,
+                   LONGLONG Offset, ULONG Length, ULONG64 Tag) {
+  PEVENT_CONTEXT event = BeginEvent(Loop, IRP_MJ_WRITE, Context);
+  PWRITE_CONTEXT write = &event->Operation.Write;
+  ULONG dataOffset;
+  ULONG serialNumber;
+
+  write->ByteOffset.QuadPart = Offset;
+  write->BufferLength = Length;
+  write->FileNameLength = CopyName(write->FileName, FileName);
+  dataOffset =
+      TEST_ALIGN((ULONG)((PCHAR)write->FileName - (PCHAR)event) +
+                 write->FileNameLength + (ULONG)sizeof(WCHAR));
+  write->BufferOffset = dataOffset;
+  ZeroMemory((PCHAR)event + dataOffset, Length);
+  CopyMemory((PCHAR)event + dataOffset, &Tag, min(Length, sizeof(Tag)));
+  event->Length = dataOffset + Length;
+  serialNumber = Dispatch(Loop, event);
+  FillMemory(event, event->Length, 0xcc);
+  return serialNumber;
+}
+
+static ULONG QueryInformation(PTEST_LOOP Loop, ULONG64 Context,
+                              LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Loop, IRP_MJ_QUERY_INFORMATION, Context);
+  PFILEINFO_CONTEXT file = &event->Operation.File;
+
+  file->FileInformationClass = FileStandardInformation;
+  file->BufferLength = sizeof(FILE_STANDARD_INFORMATION);
+  file->FileNameLength = CopyName(file->FileName, FileName);
+  EndEvent(event, (PCHAR)file->FileName + file->FileNameLength +
+                      sizeof(WCHAR));
+  return Dispatch(Loop, event);
+}
+
+// Tests
+
+static PDOKAN_INSTANCE StartInstance(void) {
+  ZeroMemory(g_Replies, sizeof(g_Replies));
+  ZeroMemory(&g_AsyncDevice, sizeof(FAKE_DEVICE));
+  g_AsyncDevice.Reply = RecordReply;
+  g_Backend = TEST_BACKEND_SYNC;
+  MemoryFsInit(&g_MemoryFs);
+  g_Operations = g_MemoryFs;
+  g_Operations.ReadFile = TestReadFile;
+  g_Operations.WriteFile = TestWriteFile;
+  g_Operations.GetFileInformation = TestGetFileInformation;
+  ZeroMemory(&g_Options, sizeof(DOKAN_OPTIONS));
+  g_Options.Version = DOKAN_VERSION;
+  return FakeDeviceCreateInstance(&g_Options, &g_Operations, &g_AsyncDevice);
+}
+
+static VOID StopInstance(PDOKAN_INSTANCE DokanInstance) {
+  FakeDeviceDeleteInstance(DokanInstance);
+  MemoryFsCleanup();
+}
+
+// Writes the blocks of a file with their offset as tag, synchronously
+static VOID FillFile(PTEST_LOOP Loop, ULONG64 Context, LPCWSTR FileName,
+                     ULONG Blocks) {
+  TEST_REPLY reply;
+  ULONG i;
+
+  g_Backend = TEST_BACKEND_SYNC;
+  for (i = 0; i < Blocks; ++i) {
+    reply = ReplyOf(Write(Loop, Context, FileName, (LONGLONG)i * TEST_BLOCK,
+                          TEST_BLOCK, (ULONG64)i * TEST_BLOCK));
+    CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  }
+}
+
+static void TestPendedRead(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  TEST_LOOP loop;
+  ULONG64 handle;
+  ULONG first;
+  ULONG second;
+  PTEST_PENDED pended;
+  PTEST_PENDED last;
+  TEST_REPLY reply;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  handle = Create(&loop, L"\\read.dat");
+  CHECK(handle != 0);
+  FillFile(&loop, handle, L"\\read.dat", 4);
+
+  // The loop thread goes back without replying and can run other requests
+  g_Backend = TEST_BACKEND_PEND;
+  first = Read(&loop, handle, L"\\read.dat", TEST_BLOCK, TEST_BLOCK);
+  second = Read(&loop, handle, L"\\read.dat", 3 * TEST_BLOCK, 2 * TEST_BLOCK);
+  CHECK(ReplyOf(first).Count == 0 && ReplyOf(second).Count == 0);
+  CHECK(g_PendedCount == 2);
+  CHECK(g_AsyncDevice.ReplyCount == 0);
+
+  // Completed in the other order, on the async device
+  pended = TestTakePended();
+  last = TestTakePended();
+  CHECK(CompleteOnThread(last, FALSE, 0, 0));
+  reply = ReplyOf(second);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK);
+  CHECK(reply.Data == 3 * TEST_BLOCK);
+  CHECK(reply.CurrentByteOffset == 4 * TEST_BLOCK);
+  CHECK(ReplyOf(first).Count == 0);
+
+  CHECK(CompleteOnThread(pended, FALSE, 0, 0));
+  reply = ReplyOf(first);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK);
+  CHECK(reply.Data == TEST_BLOCK);
+  CHECK(reply.CurrentByteOffset == 2 * TEST_BLOCK);
+  CHECK(g_AsyncDevice.ReplyCount == 2);
+
+  g_Backend = TEST_BACKEND_SYNC;
+  CloseHandleOf(&loop, handle, L"\\read.dat");
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+static void TestPendedWrite(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  TEST_LOOP loop;
+  ULONG64 handle;
+  ULONG serialNumber;
+  TEST_REPLY reply;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  handle = Create(&loop, L"\\write.dat");
+  CHECK(handle != 0);
+
+  // The event is overwritten once dispatched, the data was copied
+  g_Backend = TEST_BACKEND_PEND;
+  serialNumber = Write(&loop, handle, L"\\write.dat", 2 * TEST_BLOCK,
+                       TEST_BLOCK, 0x1234567890ULL);
+  CHECK(ReplyOf(serialNumber).Count == 0);
+  CHECK(CompleteOnThread(TestTakePended(), FALSE, 0, 0));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK);
+  CHECK(reply.CurrentByteOffset == 3 * TEST_BLOCK);
+
+  g_Backend = TEST_BACKEND_SYNC;
+  reply = ReplyOf(Read(&loop, handle, L"\\write.dat", 2 * TEST_BLOCK,
+                       TEST_BLOCK));
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK && reply.Data == 0x1234567890ULL);
+  // The file was extended by the completion
+  reply = ReplyOf(Read(&loop, handle, L"\\write.dat", 3 * TEST_BLOCK,
+                       TEST_BLOCK));
+  CHECK(reply.Status == STATUS_END_OF_FILE);
+
+  CloseHandleOf(&loop, handle, L"\\write.dat");
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+static void TestCompletionStatus(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  TEST_LOOP loop;
+  ULONG64 handle;
+  ULONG serialNumber;
+  TEST_REPLY reply;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  handle = Create(&loop, L"\\status.dat");
+  CHECK(handle != 0);
+  FillFile(&loop, handle, L"\\status.dat", 1);
+  g_Backend = TEST_BACKEND_PEND;
+
+  // Nothing read at the end of the file
+  serialNumber = Read(&loop, handle, L"\\status.dat", TEST_BLOCK, TEST_BLOCK);
+  CHECK(CompleteOnThread(TestTakePended(), FALSE, 0, 0));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_END_OF_FILE);
+  CHECK(reply.BufferLength == 0);
+
+  // An error has no data
+  serialNumber = Read(&loop, handle, L"\\status.dat", 0, TEST_BLOCK);
+  CHECK(CompleteOnThread(TestTakePended(), TRUE, STATUS_ACCESS_DENIED,
+                         TEST_BLOCK));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_ACCESS_DENIED);
+  CHECK(reply.BufferLength == 0);
+
+  // More bytes than asked are cut to the length of the request
+  serialNumber = Write(&loop, handle, L"\\status.dat", 0, TEST_BLOCK, 0);
+  CHECK(CompleteOnThread(TestTakePended(), TRUE, STATUS_SUCCESS,
+                         2 * TEST_BLOCK));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK);
+  CHECK(reply.CurrentByteOffset == TEST_BLOCK);
+
+  // A request cannot be completed as pending
+  serialNumber = Read(&loop, handle, L"\\status.dat", 0, TEST_BLOCK);
+  CHECK(CompleteOnThread(TestTakePended(), TRUE, STATUS_PENDING, 0));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_INTERNAL_ERROR);
+
+  // Nor returned as pending without being pended, the loop thread replies
+  g_Backend = TEST_BACKEND_FAKE_PENDING;
+  serialNumber = Read(&loop, handle, L"\\status.dat", 0, TEST_BLOCK);
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_INTERNAL_ERROR);
+  CHECK(g_PendedCount == 0);
+  CHECK(g_AsyncDevice.ReplyCount == 4);
+
+  g_Backend = TEST_BACKEND_SYNC;
+  CloseHandleOf(&loop, handle, L"\\status.dat");
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+static void TestPendOutsideReadWrite(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  DOKAN_FILE_INFO fileInfo;
+  TEST_LOOP loop;
+  ULONG64 handle;
+  TEST_REPLY reply;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  ZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
+  CHECK(DokanPendRequest(&fileInfo) == NULL);
+  CHECK(DokanPendRequest(NULL) == NULL);
+  CHECK(!DokanCompleteRequest(NULL, STATUS_SUCCESS, 0));
+  CHECK(!DokanResetRequestTimeout(NULL, 1000));
+
+  handle = Create(&loop, L"\\query.dat");
+  CHECK(handle != 0);
+  g_QueryPendResult = (PDOKAN_REQUEST)&fileInfo;
+  reply = ReplyOf(QueryInformation(&loop, handle, L"\\query.dat"));
+  CHECK(g_QueryPendResult == NULL);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+
+  CloseHandleOf(&loop, handle, L"\\query.dat");
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+typedef struct _TEST_RESET {
+  PDOKAN_REQUEST Request;
+  BOOL Reset;
+} TEST_RESET;
+
+static unsigned __stdcall ResetThread(void *Parameter) {
+  TEST_RESET *reset = (TEST_RESET *)Parameter;
+
+  reset->Reset = DokanResetRequestTimeout(reset->Request, 60 * 1000) &&
+                 DokanResetRequestTimeout(reset->Request, MAXULONG);
+  return 0;
+}
+
+static void TestResetRequestTimeout(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  TEST_LOOP loop;
+  ULONG64 handle;
+  ULONG serialNumber;
+  PTEST_PENDED pended;
+  TEST_RESET reset;
+  HANDLE thread;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  handle = Create(&loop, L"\\reset.dat");
+  CHECK(handle != 0);
+  FillFile(&loop, handle, L"\\reset.dat", 1);
+
+  g_Backend = TEST_BACKEND_PEND;
+  serialNumber = Read(&loop, handle, L"\\reset.dat", 0, TEST_BLOCK);
+  pended = TestTakePended();
+  CHECK(pended != NULL);
+  if (pended == NULL)
+    return;
+  reset.Request = pended->Request;
+  reset.Reset = FALSE;
+  thread = (HANDLE)_beginthreadex(NULL, 0, ResetThread, &reset, 0, NULL);
+  CHECK(thread != NULL);
+  if (thread != NULL) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+  }
+  // On the async device, not on the device of the loop thread
+  CHECK(reset.Reset);
+  CHECK(g_AsyncDevice.ResetTimeoutCount == 2);
+  CHECK(loop.Device.ResetTimeoutCount == 0);
+  CHECK(ReplyOf(serialNumber).Count == 0);
+
+  CHECK(CompleteOnThread(pended, FALSE, 0, 0));
+  CHECK(ReplyOf(serialNumber).Status == STATUS_SUCCESS);
+
+  g_Backend = TEST_BACKEND_SYNC;
+  CloseHandleOf(&loop, handle, L"\\reset.dat");
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+static void TestCloseWhilePended(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  TEST_LOOP loop;
+  ULONG64 handle;
+  ULONG serialNumber;
+  TEST_REPLY reply;
+
+  CHECK(instance != NULL && InitLoop(&loop, instance, 0));
+  handle = Create(&loop, L"\\close.dat");
+  CHECK(handle != 0);
+  FillFile(&loop, handle, L"\\close.dat", 2);
+
+  // The handle and its context stay until the reply of the read
+  g_Backend = TEST_BACKEND_PEND;
+  serialNumber = Read(&loop, handle, L"\\close.dat", TEST_BLOCK, TEST_BLOCK);
+  g_Backend = TEST_BACKEND_SYNC;
+  CloseHandleOf(&loop, handle, L"\\close.dat");
+  CHECK(ReplyOf(serialNumber).Count == 0);
+
+  CHECK(CompleteOnThread(TestTakePended(), FALSE, 0, 0));
+  reply = ReplyOf(serialNumber);
+  CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+  CHECK(reply.BufferLength == TEST_BLOCK && reply.Data == TEST_BLOCK);
+
+  free(loop.Event);
+  StopInstance(instance);
+}
+
+typedef struct _STRESS_LOOP {
+  TEST_LOOP Loop;
+  ULONG64 Handle;
+  WCHAR FileName[MAX_PATH];
+  ULONG SerialNumbers[STRESS_REQUESTS];
+  LONGLONG Offsets[STRESS_REQUESTS];
+  BOOL Writes[STRESS_REQUESTS];
+} STRESS_LOOP;
+
+static unsigned __stdcall StressLoopThread(void *Parameter) {
+  STRESS_LOOP *stress = (STRESS_LOOP *)Parameter;
+  ULONG random = 2463534242U + stress->Loop.Index * 7919;
+  ULONG block;
+  ULONG i;
+
+  for (i = 0; i < STRESS_REQUESTS; ++i) {
+    // xorshift32
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    block = random % STRESS_BLOCKS;
+    stress->Offsets[i] = (LONGLONG)block * TEST_BLOCK;
+    // Writes put back the tag the block already has
+    stress->Writes[i] = random % 3 == 0;
+    if (stress->Writes[i])
+      stress->SerialNumbers[i] =
+          Write(&stress->Loop, stress->Handle, stress->FileName,
+                stress->Offsets[i], TEST_BLOCK, (ULONG64)stress->Offsets[i]);
+    else
+      stress->SerialNumbers[i] = Read(&stress->Loop, stress->Handle,
+                                      stress->FileName, stress->Offsets[i],
+                                      TEST_BLOCK);
+  }
+  return 0;
+}
+
+static unsigned __stdcall StressCompletionThread(void *Parameter) {
+  LONG *completed = (LONG *)Parameter;
+  PTEST_PENDED pended;
+
+  for (;;) {
+    pended = TestTakePended();
+    if (pended == NULL) {
+      if (g_Stop)
+        break;
+      SwitchToThread();
+      continue;
+    }
+    if (CompleteWithBackend(pended))
+      InterlockedIncrement(completed);
+  }
+  return 0;
+}
+
+static void TestStress(void) {
+  PDOKAN_INSTANCE instance = StartInstance();
+  STRESS_LOOP *loops;
+  HANDLE threads[STRESS_LOOPS + STRESS_COMPLETIONS];
+  LONG completed = 0;
+  TEST_REPLY reply;
+  ULONGLONG start;
+  ULONG i;
+  ULONG j;
+
+  loops = (STRESS_LOOP *)calloc(STRESS_LOOPS, sizeof(STRESS_LOOP));
+  CHECK(instance != NULL && loops != NULL);
+  if (instance == NULL || loops == NULL)
+    return;
+  for (i = 0; i < STRESS_LOOPS; ++i) {
+    CHECK(InitLoop(&loops[i].Loop, instance, i));
+    swprintf_s(loops[i].FileName, MAX_PATH, L"\\stress%u.dat", i);
+    loops[i].Handle = Create(&loops[i].Loop, loops[i].FileName);
+    CHECK(loops[i].Handle != 0);
+    FillFile(&loops[i].Loop, loops[i].Handle, loops[i].FileName,
+             STRESS_BLOCKS);
+  }
+
+  g_Backend = TEST_BACKEND_PEND;
+  g_Stop = 0;
+  for (i = 0; i < STRESS_COMPLETIONS; ++i)
+    threads[STRESS_LOOPS + i] = (HANDLE)_beginthreadex(
+        NULL, 0, StressCompletionThread, &completed, 0, NULL);
+  for (i = 0; i < STRESS_LOOPS; ++i)
+    threads[i] = (HANDLE)_beginthreadex(NULL, 0, StressLoopThread, &loops[i],
+                                        0, NULL);
+  for (i = 0; i < STRESS_LOOPS; ++i) {
+    CHECK(threads[i] != NULL);
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+  }
+  InterlockedExchange(&g_Stop, 1);
+  for (i = STRESS_LOOPS; i < STRESS_LOOPS + STRESS_COMPLETIONS; ++i) {
+    CHECK(threads[i] != NULL);
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+  }
+  g_Backend = TEST_BACKEND_SYNC;
+
+  CHECK(completed == STRESS_LOOPS * STRESS_REQUESTS);
+  CHECK(g_AsyncDevice.ReplyCount == STRESS_LOOPS * STRESS_REQUESTS);
+  for (i = 0; i < STRESS_LOOPS; ++i) {
+    for (j = 0; j < STRESS_REQUESTS; ++j) {
+      reply = ReplyOf(loops[i].SerialNumbers[j]);
+      CHECK(reply.Count == 1 && reply.Status == STATUS_SUCCESS);
+      CHECK(reply.BufferLength == TEST_BLOCK);
+      CHECK(reply.CurrentByteOffset == loops[i].Offsets[j] + TEST_BLOCK);
+      if (!loops[i].Writes[j])
+        CHECK(reply.Data == (ULONG64)loops[i].Offsets[j]);
+    }
+    CloseHandleOf(&loops[i].Loop, loops[i].Handle, loops[i].FileName);
+    free(loops[i].Loop.Event);
+  }
+  free(loops);
+
+  // Nothing is left for the unmount to wait for
+  start = GetTickCount64();
+  StopInstance(instance);
+  CHECK(GetTickCount64() - start < DOKAN_PENDING_REQUEST_UNMOUNT_TIMEOUT / 2);
+}
+
+int main(void) {
+  FakeDeviceInit();
+  InitializeCriticalSection(&g_RepliesLock);
+  InitializeCriticalSection(&g_PendedLock);
+
+  TestPendedRead();
+  TestPendedWrite();
+  TestCompletionStatus();
+  TestPendOutsideReadWrite();
+  TestResetRequestTimeout();
+  TestCloseWhilePended();
+  TestStress();
+
+  DeleteCriticalSection(&g_PendedLock);
+  DeleteCriticalSection(&g_RepliesLock);
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
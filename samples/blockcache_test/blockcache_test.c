@@ -0,0 +1,493 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the block cache of dokan/blockcache.c against files kept in memory,
+// without a mounted volume: hits and end of file blocks, invalidation by
+// changes and by name, changes racing with fetches, coalesced misses, the
+// capacity bound and fetch errors, then readers and writers on several
+// threads.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan blockcache_test.c ..\..\dokan\blockcache.c
+//   gcc -O2 -pthread -I../../dokan blockcache_test.c ../../dokan/blockcache.c
+//       -o blockcache_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "blockcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE THREAD;
+typedef CRITICAL_SECTION MUTEX;
+
+static DWORD WINAPI ThreadStart(LPVOID Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  *Thread = CreateThread(NULL, 0, ThreadStart, Parameter, 0, NULL);
+}
+static void JoinThread(THREAD Thread) {
+  WaitForSingleObject(Thread, INFINITE);
+  CloseHandle(Thread);
+}
+#define MutexInitialize(Mutex) InitializeCriticalSection(Mutex)
+#define MutexLock(Mutex) EnterCriticalSection(Mutex)
+#define MutexUnlock(Mutex) LeaveCriticalSection(Mutex)
+#define SleepMs(Ms) Sleep(Ms)
+#define AtomicIncrement(Value) InterlockedIncrement(Value)
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t THREAD;
+typedef pthread_mutex_t MUTEX;
+
+static void *ThreadStart(void *Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  pthread_create(Thread, NULL, ThreadStart, Parameter);
+}
+static void JoinThread(THREAD Thread) { pthread_join(Thread, NULL); }
+#define MutexInitialize(Mutex) pthread_mutex_init(Mutex, NULL)
+#define MutexLock(Mutex) pthread_mutex_lock(Mutex)
+#define MutexUnlock(Mutex) pthread_mutex_unlock(Mutex)
+#define SleepMs(Ms) usleep((Ms)*1000)
+#define AtomicIncrement(Value) __sync_add_and_fetch(Value, 1)
+#endif
+
+#define BLOCK_SIZE 4096
+#define MAX_FILE_SIZE (64 * BLOCK_SIZE)
+#define STATUS_TEST_ERROR 0x13
+
+// File kept in memory, behind the cache
+typedef struct _TEST_FILE {
+  const char *Name;
+  MUTEX Lock;
+  uint32_t Size;
+  uint8_t Data[MAX_FILE_SIZE];
+  volatile long Fetches;
+  // Offset at which fetches fail, MAX_FILE_SIZE if none
+  uint32_t FailAt;
+  // Milliseconds each fetch takes
+  int Delay;
+  // Called once by the next fetch after it read the file
+  void (*RaceCallback)(struct _TEST_FILE *File);
+} TEST_FILE;
+
+static PDOKAN_BLOCK_CACHE g_Cache;
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static void InitializeFile(TEST_FILE *File, const char *Name, uint32_t Size,
+                           uint8_t Seed) {
+  uint32_t i;
+
+  memset(File, 0, sizeof(TEST_FILE));
+  MutexInitialize(&File->Lock);
+  File->Name = Name;
+  File->Size = Size;
+  File->FailAt = MAX_FILE_SIZE;
+  for (i = 0; i < Size; ++i) {
+    File->Data[i] = (uint8_t)(i * 31 + Seed);
+  }
+}
+
+static int32_t FetchFile(void *Context, uint64_t Offset, void *Buffer,
+                         uint32_t Length, uint32_t *Read) {
+  TEST_FILE *file = (TEST_FILE *)Context;
+  void (*raceCallback)(TEST_FILE *);
+
+  AtomicIncrement(&file->Fetches);
+  if (file->Delay) {
+    SleepMs(file->Delay);
+  }
+  MutexLock(&file->Lock);
+  if (Offset >= file->FailAt) {
+    MutexUnlock(&file->Lock);
+    return STATUS_TEST_ERROR;
+  }
+  *Read = 0;
+  if (Offset < file->Size) {
+    *Read = file->Size - (uint32_t)Offset < Length
+                ? file->Size - (uint32_t)Offset
+                : Length;
+    memcpy(Buffer, file->Data + Offset, *Read);
+  }
+  raceCallback = file->RaceCallback;
+  file->RaceCallback = NULL;
+  MutexUnlock(&file->Lock);
+  if (raceCallback != NULL) {
+    raceCallback(file);
+  }
+  return 0;
+}
+
+static int32_t TestRead(TEST_FILE *File, uint32_t Offset, void *Buffer,
+                        uint32_t Length, uint32_t *Read) {
+  return DokanBlockCacheRead(g_Cache, File->Name, (uint32_t)strlen(File->Name),
+                             Offset, Buffer, Length, Read, FetchFile, File);
+}
+
+// Writes through the cache the way DispatchWrite does
+static void TestWrite(TEST_FILE *File, uint32_t Offset, uint32_t Length,
+                      uint8_t Value) {
+  PDOKAN_BLOCK_CACHE_FILE cacheFile = DokanBlockCacheBeginChange(
+      g_Cache, File->Name, (uint32_t)strlen(File->Name), Offset, Length);
+
+  MutexLock(&File->Lock);
+  memset(File->Data + Offset, Value, Length);
+  if (Offset + Length > File->Size) {
+    File->Size = Offset + Length;
+  }
+  MutexUnlock(&File->Lock);
+  DokanBlockCacheEndChange(g_Cache, cacheFile);
+}
+
+static void TestSetEndOfFile(TEST_FILE *File, uint32_t Size) {
+  PDOKAN_BLOCK_CACHE_FILE cacheFile =
+      DokanBlockCacheBeginChange(g_Cache, File->Name,
+                                 (uint32_t)strlen(File->Name), 0,
+                                 DOKAN_BLOCK_CACHE_WHOLE_FILE);
+
+  MutexLock(&File->Lock);
+  if (Size > File->Size) {
+    memset(File->Data + File->Size, 0, Size - File->Size);
+  }
+  File->Size = Size;
+  MutexUnlock(&File->Lock);
+  DokanBlockCacheEndChange(g_Cache, cacheFile);
+}
+
+// Reads the range through the cache and compares it with the file
+static int ReadMatches(TEST_FILE *File, uint32_t Offset, uint32_t Length) {
+  static uint8_t buffer[MAX_FILE_SIZE];
+  uint32_t read = 0;
+  uint32_t expected;
+  int matches;
+
+  if (TestRead(File, Offset, buffer, Length, &read) != 0) {
+    return 0;
+  }
+  MutexLock(&File->Lock);
+  expected = Offset >= File->Size ? 0 : File->Size - Offset;
+  if (expected > Length) {
+    expected = Length;
+  }
+  matches = read == expected && memcmp(buffer, File->Data + Offset, read) == 0;
+  MutexUnlock(&File->Lock);
+  return matches;
+}
+
+static void GetCounters(PDOKAN_BLOCK_CACHE_COUNTERS Counters) {
+  DokanBlockCacheGetCounters(g_Cache, Counters);
+}
+
+static void TestHits(void) {
+  static TEST_FILE file;
+  DOKAN_BLOCK_CACHE_COUNTERS counters;
+
+  InitializeFile(&file, "\\HITS", 10 * BLOCK_SIZE + 100, 1);
+  CHECK(ReadMatches(&file, 100, 3 * BLOCK_SIZE));
+  CHECK(file.Fetches == 4);
+  CHECK(ReadMatches(&file, 200, 3 * BLOCK_SIZE - 200));
+  CHECK(file.Fetches == 4);
+  GetCounters(&counters);
+  CHECK(counters.Hits == 3);
+  CHECK(counters.Misses == 4);
+  CHECK(counters.BytesSaved == 3 * BLOCK_SIZE - 200);
+  CHECK(counters.BytesFetched == 4 * BLOCK_SIZE);
+  CHECK(counters.Blocks == 4);
+
+  // The short last block ends reads without fetching past it
+  CHECK(ReadMatches(&file, 10 * BLOCK_SIZE - 10, 1000));
+  CHECK(file.Fetches == 6);
+  CHECK(ReadMatches(&file, 10 * BLOCK_SIZE + 50, 1000));
+  CHECK(ReadMatches(&file, 10 * BLOCK_SIZE + 100, 1000));
+  CHECK(ReadMatches(&file, 10 * BLOCK_SIZE + 500, 1000));
+  CHECK(file.Fetches == 6);
+  CHECK(ReadMatches(&file, 20 * BLOCK_SIZE, 1000));
+  CHECK(file.Fetches == 7);
+}
+
+static void TestChanges(void) {
+  static TEST_FILE file;
+  static TEST_FILE other;
+  long fetches;
+
+  InitializeFile(&file, "\\CHANGES", 8 * BLOCK_SIZE + 10, 2);
+  InitializeFile(&other, "\\CHANGES2", 8 * BLOCK_SIZE, 3);
+  CHECK(ReadMatches(&file, 0, 8 * BLOCK_SIZE + 10));
+  CHECK(ReadMatches(&other, 0, 8 * BLOCK_SIZE));
+
+  // Only the written blocks and the last one are fetched again
+  TestWrite(&file, BLOCK_SIZE + 10, 20, 0xAA);
+  fetches = file.Fetches;
+  CHECK(ReadMatches(&file, 0, 8 * BLOCK_SIZE + 10));
+  CHECK(file.Fetches == fetches + 2);
+
+  // Appending drops the old last block
+  TestWrite(&file, 8 * BLOCK_SIZE + 10, 100, 0xBB);
+  CHECK(ReadMatches(&file, 0, 9 * BLOCK_SIZE));
+
+  // A write of nothing at the end of file still drops the last block
+  CHECK(ReadMatches(&file, 0, 9 * BLOCK_SIZE));
+  fetches = file.Fetches;
+  TestWrite(&file, 8 * BLOCK_SIZE + 110, 0, 0);
+  CHECK(ReadMatches(&file, 0, 9 * BLOCK_SIZE));
+  CHECK(file.Fetches == fetches + 1);
+
+  TestSetEndOfFile(&file, 3 * BLOCK_SIZE + 5);
+  CHECK(ReadMatches(&file, 0, 9 * BLOCK_SIZE));
+  TestSetEndOfFile(&file, 5 * BLOCK_SIZE);
+  CHECK(ReadMatches(&file, 0, 9 * BLOCK_SIZE));
+
+  // Renaming a directory drops the files below it
+  fetches = other.Fetches;
+  DokanBlockCacheInvalidate(g_Cache, "\\CHANGES", 8);
+  CHECK(ReadMatches(&other, 0, 8 * BLOCK_SIZE));
+  CHECK(other.Fetches == fetches + 8);
+  fetches = other.Fetches;
+  DokanBlockCacheInvalidate(g_Cache, "\\UNRELATED", 10);
+  CHECK(ReadMatches(&other, 0, 8 * BLOCK_SIZE));
+  CHECK(other.Fetches == fetches);
+}
+
+static void WriteDuringFetch(TEST_FILE *File) {
+  TestWrite(File, 0, 10, 0xCC);
+}
+
+static PDOKAN_BLOCK_CACHE_FILE g_PendingChange;
+
+static void BeginChangeDuringFetch(TEST_FILE *File) {
+  g_PendingChange = DokanBlockCacheBeginChange(
+      g_Cache, File->Name, (uint32_t)strlen(File->Name), 0, 10);
+  MutexLock(&File->Lock);
+  memset(File->Data, 0xDD, 10);
+  MutexUnlock(&File->Lock);
+}
+
+static void TestRaces(void) {
+  static TEST_FILE file;
+  static uint8_t buffer[BLOCK_SIZE];
+  uint32_t read;
+
+  // A write completed during the fetch of its block leaves it uncached
+  InitializeFile(&file, "\\RACES", 2 * BLOCK_SIZE, 4);
+  file.RaceCallback = WriteDuringFetch;
+  CHECK(TestRead(&file, 0, buffer, BLOCK_SIZE, &read) == 0);
+  CHECK(read == BLOCK_SIZE && buffer[0] == (uint8_t)4);
+  CHECK(ReadMatches(&file, 0, BLOCK_SIZE));
+  CHECK(file.Data[0] == 0xCC);
+
+  // So does a write still in progress, until its end
+  InitializeFile(&file, "\\RACES2", 2 * BLOCK_SIZE, 5);
+  CHECK(ReadMatches(&file, BLOCK_SIZE, BLOCK_SIZE));
+  file.RaceCallback = BeginChangeDuringFetch;
+  CHECK(TestRead(&file, 0, buffer, BLOCK_SIZE, &read) == 0);
+  CHECK(ReadMatches(&file, 0, BLOCK_SIZE));
+  CHECK(ReadMatches(&file, 0, BLOCK_SIZE));
+  CHECK(file.Fetches == 4);
+  DokanBlockCacheEndChange(g_Cache, g_PendingChange);
+  CHECK(ReadMatches(&file, 0, 2 * BLOCK_SIZE));
+  CHECK(ReadMatches(&file, 0, 2 * BLOCK_SIZE));
+  CHECK(file.Fetches == 5);
+}
+
+static void TestErrors(void) {
+  static TEST_FILE file;
+  static uint8_t buffer[4 * BLOCK_SIZE];
+  uint32_t read;
+
+  InitializeFile(&file, "\\ERRORS", 4 * BLOCK_SIZE, 6);
+  file.FailAt = 2 * BLOCK_SIZE;
+  CHECK(TestRead(&file, 2 * BLOCK_SIZE, buffer, BLOCK_SIZE, &read) ==
+        STATUS_TEST_ERROR);
+  CHECK(read == 0);
+  CHECK(TestRead(&file, 0, buffer, 4 * BLOCK_SIZE, &read) == 0);
+  CHECK(read == 2 * BLOCK_SIZE);
+  file.FailAt = MAX_FILE_SIZE;
+  CHECK(ReadMatches(&file, 0, 4 * BLOCK_SIZE));
+}
+
+typedef struct _THREAD_CONTEXT {
+  int Kind;
+  TEST_FILE *Files;
+  int FileCount;
+  unsigned Seed;
+  volatile long *Errors;
+} THREAD_CONTEXT;
+
+enum { CoalescingThread, ReaderThread, WriterThread };
+
+static unsigned NextRandom(unsigned *Seed) {
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) & 0xFFFFFF;
+}
+
+static void RunThread(THREAD_CONTEXT *Context) {
+  static uint8_t buffers[16][BLOCK_SIZE * 4];
+  uint8_t *buffer = buffers[Context->Seed % 16];
+  TEST_FILE *file;
+  uint32_t offset;
+  uint32_t read;
+  int i;
+
+  if (Context->Kind == CoalescingThread) {
+    if (TestRead(Context->Files, 0, buffer, 100, &read) != 0 || read != 100 ||
+        memcmp(buffer, Context->Files->Data, 100) != 0) {
+      AtomicIncrement(Context->Errors);
+    }
+    return;
+  }
+  for (i = 0; i < 3000; ++i) {
+    file = &Context->Files[NextRandom(&Context->Seed) % Context->FileCount];
+    offset = NextRandom(&Context->Seed) % (MAX_FILE_SIZE / 2);
+    if (Context->Kind == WriterThread) {
+      TestWrite(file, offset, NextRandom(&Context->Seed) % BLOCK_SIZE,
+                (uint8_t)NextRandom(&Context->Seed));
+    } else if (TestRead(file, offset, buffer, sizeof(buffers[0]), &read) !=
+               0) {
+      AtomicIncrement(Context->Errors);
+    }
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadStart(LPVOID Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return 0;
+}
+#else
+static void *ThreadStart(void *Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return NULL;
+}
+#endif
+
+static void TestCoalescing(void) {
+  static TEST_FILE file;
+  THREAD threads[8];
+  THREAD_CONTEXT contexts[8];
+  DOKAN_BLOCK_CACHE_COUNTERS before;
+  DOKAN_BLOCK_CACHE_COUNTERS after;
+  volatile long errors = 0;
+  int i;
+
+  InitializeFile(&file, "\\COALESCING", BLOCK_SIZE, 7);
+  file.Delay = 100;
+  GetCounters(&before);
+  for (i = 0; i < 8; ++i) {
+    contexts[i].Kind = CoalescingThread;
+    contexts[i].Files = &file;
+    contexts[i].Seed = i;
+    contexts[i].Errors = &errors;
+    StartThread(&threads[i], &contexts[i]);
+  }
+  for (i = 0; i < 8; ++i) {
+    JoinThread(threads[i]);
+  }
+  GetCounters(&after);
+  CHECK(errors == 0);
+  CHECK(file.Fetches == 1);
+  CHECK(after.Misses - before.Misses == 1);
+  CHECK(after.CoalescedMisses - before.CoalescedMisses == 7);
+}
+
+static void TestStress(void) {
+  static TEST_FILE files[4];
+  static const char *names[4] = {"\\S\\A", "\\S\\B", "\\S\\C", "\\S\\D"};
+  THREAD threads[12];
+  THREAD_CONTEXT contexts[12];
+  DOKAN_BLOCK_CACHE_COUNTERS counters;
+  volatile long errors = 0;
+  int i;
+
+  for (i = 0; i < 4; ++i) {
+    InitializeFile(&files[i], names[i], MAX_FILE_SIZE / 2, (uint8_t)(10 + i));
+  }
+  for (i = 0; i < 12; ++i) {
+    contexts[i].Kind = i < 4 ? WriterThread : ReaderThread;
+    contexts[i].Files = files;
+    contexts[i].FileCount = 4;
+    contexts[i].Seed = 1000 + i;
+    contexts[i].Errors = &errors;
+    StartThread(&threads[i], &contexts[i]);
+  }
+  for (i = 0; i < 12; ++i) {
+    JoinThread(threads[i]);
+  }
+  CHECK(errors == 0);
+  // Whatever the interleaving, nothing older than the last write is kept
+  for (i = 0; i < 4; ++i) {
+    CHECK(ReadMatches(&files[i], 0, MAX_FILE_SIZE));
+  }
+  GetCounters(&counters);
+  CHECK(counters.Evictions > 0);
+  CHECK(counters.Blocks <= 64);
+}
+
+int main(void) {
+  DOKAN_BLOCK_CACHE_COUNTERS counters;
+
+  CHECK(DokanBlockCacheCreate(0, 1) == NULL);
+  g_Cache = DokanBlockCacheCreate(BLOCK_SIZE, 64 * BLOCK_SIZE);
+  CHECK(g_Cache != NULL);
+  if (g_Cache == NULL) {
+    return 1;
+  }
+
+  TestHits();
+  TestChanges();
+  TestRaces();
+  TestErrors();
+  TestCoalescing();
+  TestStress();
+
+  GetCounters(&counters);
+  printf("hits %llu misses %llu coalesced %llu saved %llu fetched %llu "
+         "evictions %llu invalidations %llu blocks %llu\n",
+         (unsigned long long)counters.Hits,
+         (unsigned long long)counters.Misses,
+         (unsigned long long)counters.CoalescedMisses,
+         (unsigned long long)counters.BytesSaved,
+         (unsigned long long)counters.BytesFetched,
+         (unsigned long long)counters.Evictions,
+         (unsigned long long)counters.Invalidations,
+         (unsigned long long)counters.Blocks);
+  DokanBlockCacheDelete(g_Cache);
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,361 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Portable model of the bookkeeping DispatchCreate of dokan/create.c does
+// around a trivial ZwCreateFile callback, without a mounted volume:
+//   copy    - the name duplicated for SL_OPEN_TARGET_DIRECTORY opens and the
+//             security context unpacked again for the delete retry
+//   inplace - the parent name cut in place once the child was looked up and
+//             the security context unpacked once per request
+// Both take the open info from a free list as dokan/openinfo.c does, the
+// difference is what is left per create.
+//
+// Build it with any C++11 compiler:
+//   cl /O2 /EHsc create_bench.cpp
+//   g++ -O2 -std=c++11 create_bench.cpp -o create_bench
+//
+// create_bench [/n Creates] [/p TargetDirectoryPercent] [/r RetryPercent]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Layout of the DOKAN_UNICODE_STRING_INTERMEDIATE the driver sends
+struct StringIntermediate {
+  uint16_t Length;
+  uint16_t MaximumLength;
+  wchar_t Buffer[1];
+};
+
+// Layout of the DOKAN_ACCESS_STATE_INTERMEDIATE the driver sends
+struct AccessStateIntermediate {
+  uint8_t SecurityEvaluated;
+  uint8_t GenerateAudit;
+  uint8_t GenerateOnClose;
+  uint8_t AuditPrivileges;
+  uint32_t Flags;
+  uint32_t RemainingDesiredAccess;
+  uint32_t PreviouslyGrantedAccess;
+  uint32_t OriginalDesiredAccess;
+  uint32_t SecurityDescriptorOffset;
+  uint32_t UnicodeStringObjectNameOffset;
+  uint32_t UnicodeStringObjectTypeOffset;
+};
+
+struct UnicodeString {
+  uint16_t Length;
+  uint16_t MaximumLength;
+  const wchar_t *Buffer;
+};
+
+// DOKAN_IO_SECURITY_CONTEXT given to ZwCreateFile
+struct SecurityContext {
+  uint8_t SecurityEvaluated;
+  uint8_t GenerateAudit;
+  uint8_t GenerateOnClose;
+  uint8_t AuditPrivileges;
+  uint32_t Flags;
+  uint32_t RemainingDesiredAccess;
+  uint32_t PreviouslyGrantedAccess;
+  uint32_t OriginalDesiredAccess;
+  const void *SecurityDescriptor;
+  UnicodeString ObjectName;
+  UnicodeString ObjectType;
+  uint32_t DesiredAccess;
+};
+
+const size_t kEventSize = 1024;
+const uint32_t kDelete = 0x10000;
+
+// EVENT_CONTEXT of a create: the access state, its strings and the name
+struct Event {
+  alignas(8) unsigned char Data[kEventSize];
+  AccessStateIntermediate *AccessState() {
+    return reinterpret_cast<AccessStateIntermediate *>(Data);
+  }
+  wchar_t *FileName() {
+    return reinterpret_cast<wchar_t *>(Data + kEventSize / 2);
+  }
+  uint32_t DesiredAccess = kDelete;
+  bool OpenTargetDirectory = false;
+};
+
+struct OpenInfo {
+  OpenInfo *Next;
+  Event *EventContext;
+  uint64_t UserContext;
+};
+
+// Free list of the handle table, single threaded here
+struct OpenInfoPool {
+  std::vector<OpenInfo> entries;
+  OpenInfo *free = nullptr;
+  explicit OpenInfoPool(size_t Count) : entries(Count) {
+    for (OpenInfo &entry : entries) {
+      entry.Next = free;
+      free = &entry;
+    }
+  }
+  OpenInfo *Allocate() {
+    OpenInfo *entry = free;
+    free = entry->Next;
+    return entry;
+  }
+  void Release(OpenInfo *Entry) {
+    Entry->Next = free;
+    free = Entry;
+  }
+};
+
+void InitializeString(unsigned char *Base, uint32_t Offset,
+                      const wchar_t *Value) {
+  StringIntermediate *string =
+      reinterpret_cast<StringIntermediate *>(Base + Offset);
+  size_t length = std::wcslen(Value);
+  string->Length = static_cast<uint16_t>(length * sizeof(wchar_t));
+  string->MaximumLength = string->Length;
+  std::wmemcpy(string->Buffer, Value, length);
+}
+
+void InitializeEvent(Event &Event_, const wchar_t *Name, bool Target,
+                     bool Retry) {
+  std::memset(Event_.Data, 0, sizeof(Event_.Data));
+  AccessStateIntermediate *state = Event_.AccessState();
+  state->Flags = 0x800;
+  state->OriginalDesiredAccess = kDelete;
+  state->UnicodeStringObjectNameOffset = sizeof(AccessStateIntermediate);
+  state->UnicodeStringObjectTypeOffset = sizeof(AccessStateIntermediate) + 64;
+  InitializeString(Event_.Data, state->UnicodeStringObjectNameOffset, Name);
+  InitializeString(Event_.Data, state->UnicodeStringObjectTypeOffset,
+                   L"File");
+  std::wcscpy(Event_.FileName(), Name);
+  Event_.OpenTargetDirectory = Target;
+  Event_.DesiredAccess = Retry ? kDelete : 0;
+}
+
+// SetIOSecurityContext
+void Unpack(Event &Event_, SecurityContext &Context) {
+  AccessStateIntermediate *state = Event_.AccessState();
+  unsigned char *base = Event_.Data;
+  Context.SecurityEvaluated = state->SecurityEvaluated;
+  Context.GenerateAudit = state->GenerateAudit;
+  Context.GenerateOnClose = state->GenerateOnClose;
+  Context.AuditPrivileges = state->AuditPrivileges;
+  Context.Flags = state->Flags;
+  Context.RemainingDesiredAccess = state->RemainingDesiredAccess;
+  Context.PreviouslyGrantedAccess = state->PreviouslyGrantedAccess;
+  Context.OriginalDesiredAccess = state->OriginalDesiredAccess;
+  Context.SecurityDescriptor = state->SecurityDescriptorOffset
+                                   ? base + state->SecurityDescriptorOffset
+                                   : nullptr;
+  const StringIntermediate *name = reinterpret_cast<StringIntermediate *>(
+      base + state->UnicodeStringObjectNameOffset);
+  const StringIntermediate *type = reinterpret_cast<StringIntermediate *>(
+      base + state->UnicodeStringObjectTypeOffset);
+  Context.ObjectName = {name->Length, name->MaximumLength, name->Buffer};
+  Context.ObjectType = {type->Length, type->MaximumLength, type->Buffer};
+  Context.DesiredAccess = Event_.DesiredAccess;
+}
+
+// DokanCutParentName
+void CutParentName(wchar_t *FileName) {
+  wchar_t *lastP = nullptr;
+  for (wchar_t *p = FileName; *p; p++) {
+    if ((*p == L'\\' || *p == L'/') && p[1])
+      lastP = p;
+  }
+  if (lastP)
+    *lastP = 0;
+  if (!FileName[0]) {
+    FileName[0] = L'\\';
+    FileName[1] = 0;
+  }
+}
+
+// Trivial ZwCreateFile: fails the first open of retried deletes
+volatile uint64_t g_Sink;
+bool CreateFile(const wchar_t *FileName, const SecurityContext &Context,
+                uint32_t DesiredAccess) {
+  g_Sink = g_Sink + FileName[1] + Context.ObjectName.Length + DesiredAccess;
+  return !(DesiredAccess & kDelete);
+}
+
+void DispatchCopy(Event &Event_, OpenInfoPool &Pool) {
+  SecurityContext context;
+  wchar_t *fileName = Event_.FileName();
+  wchar_t *origFileName = nullptr;
+  OpenInfo *openInfo = Pool.Allocate();
+  openInfo->EventContext = &Event_;
+
+  if (Event_.OpenTargetDirectory) {
+    // _wcsdup
+    size_t length = std::wcslen(fileName) + 1;
+    origFileName =
+        static_cast<wchar_t *>(std::malloc(length * sizeof(wchar_t)));
+    std::wmemcpy(origFileName, fileName, length);
+    CutParentName(fileName);
+  }
+  Unpack(Event_, context);
+  if (Event_.OpenTargetDirectory)
+    CreateFile(origFileName, context, context.DesiredAccess);
+  if (!CreateFile(fileName, context, context.DesiredAccess)) {
+    CutParentName(fileName);
+    Unpack(Event_, context);
+    CreateFile(fileName, context, 0);
+  }
+  std::free(origFileName);
+  openInfo->UserContext = g_Sink;
+  Pool.Release(openInfo);
+}
+
+void DispatchInPlace(Event &Event_, OpenInfoPool &Pool) {
+  SecurityContext context;
+  wchar_t *fileName = Event_.FileName();
+  OpenInfo *openInfo = Pool.Allocate();
+  openInfo->EventContext = &Event_;
+
+  Unpack(Event_, context);
+  if (Event_.OpenTargetDirectory) {
+    CreateFile(fileName, context, context.DesiredAccess);
+    CutParentName(fileName);
+  }
+  if (!CreateFile(fileName, context, context.DesiredAccess)) {
+    CutParentName(fileName);
+    CreateFile(fileName, context, 0);
+  }
+  openInfo->UserContext = g_Sink;
+  Pool.Release(openInfo);
+}
+
+// The in place cut must leave the names the copies had
+bool ModelCheck() {
+  static const wchar_t *const kNames[][2] = {
+      {L"\\", L"\\"},
+      {L"\\a", L"\\"},
+      {L"\\dir\\file.txt", L"\\dir"},
+      {L"\\dir\\sub\\", L"\\dir"},
+      {L"\\dir/file", L"\\dir"},
+  };
+  for (const auto &name : kNames) {
+    wchar_t buffer[32];
+    std::wcscpy(buffer, name[0]);
+    CutParentName(buffer);
+    if (std::wcscmp(buffer, name[1]) != 0)
+      return false;
+  }
+  return true;
+}
+
+struct Options {
+  unsigned creates = 2000000;
+  unsigned targetPercent = 10;
+  unsigned retryPercent = 2;
+};
+
+bool ParseOptions(int argc, char *argv[], Options &Options_) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc || std::strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-'))
+      return false;
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 'n':
+      Options_.creates = std::strtoul(value, nullptr, 10);
+      break;
+    case 'p':
+      Options_.targetPercent = std::strtoul(value, nullptr, 10);
+      break;
+    case 'r':
+      Options_.retryPercent = std::strtoul(value, nullptr, 10);
+      break;
+    default:
+      return false;
+    }
+  }
+  return Options_.creates > 0 && Options_.targetPercent <= 100 &&
+         Options_.retryPercent <= 100;
+}
+
+template <typename Dispatch>
+void Run(const char *Model, Dispatch Dispatch_, const Options &Options_,
+         std::vector<Event> &Events, const std::vector<Event> &Templates) {
+  OpenInfoPool pool(16);
+  uint64_t elapsedNs = 0;
+  for (unsigned done = 0; done < Options_.creates;) {
+    // The dispatch cuts names, start each round from the templates
+    Events = Templates;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < Events.size() && done < Options_.creates;
+         ++i, ++done)
+      Dispatch_(Events[i], pool);
+    elapsedNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     Clock::now() - start)
+                     .count();
+  }
+  std::printf("%-8s %10u %10.1f\n", Model, Options_.creates,
+              static_cast<double>(elapsedNs) / Options_.creates);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::fprintf(stderr, "create_bench [/n Creates] "
+                         "[/p TargetDirectoryPercent] [/r RetryPercent]\n");
+    return EXIT_FAILURE;
+  }
+  if (!ModelCheck()) {
+    std::fprintf(stderr, "Parent name model check failed\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Event> templates(1024);
+  unsigned seed = 1;
+  for (size_t i = 0; i < templates.size(); ++i) {
+    std::wstring name = L"\\src\\module" + std::to_wstring(i % 37) +
+                        L"\\file" + std::to_wstring(i) + L".c";
+    seed = seed * 1103515245 + 12345;
+    bool target = (seed >> 8) % 100 < options.targetPercent;
+    seed = seed * 1103515245 + 12345;
+    bool retry = (seed >> 8) % 100 < options.retryPercent;
+    InitializeEvent(templates[i], name.c_str(), target, retry);
+  }
+  std::vector<Event> events;
+
+  std::printf("Dispatch cost in ns per create, the copy of the events "
+              "between rounds is not timed\n");
+  std::printf("%-8s %10s %10s\n", "model", "creates", "ns/create");
+  Run("copy", DispatchCopy, options, events, templates);
+  Run("inplace", DispatchInPlace, options, events, templates);
+  Run("copy", DispatchCopy, options, events, templates);
+  Run("inplace", DispatchInPlace, options, events, templates);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,521 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Portable model of the directory pages of sys/directory.c, to check them
+// without a mounted volume:
+//   direct - every query is an event sized to the buffer of the caller
+//   paged  - events ask for DOKAN_DIRECTORY_PAGE_LENGTH bytes, the entries
+//            the caller has no room for answer its next queries
+// MatchFiles and DispatchDirectoryInformation of dokan/directory.c are
+// modelled as the user-mode side. The check runs random query sequences
+// (buffer sizes, SL_RESTART_SCAN, SL_RETURN_SINGLE_ENTRY, SL_INDEX_SPECIFIED,
+// information class and pattern changes) through both and requires the same
+// status and bytes for every query. It then counts the events of one listing.
+//
+// Build it with any C++11 compiler:
+//   cl /O2 /EHsc dirpage_model.cpp
+//   g++ -O2 -std=c++11 dirpage_model.cpp -o dirpage_model
+//
+// dirpage_model [/n Entries] [/b BufferLength] [/p PageLength] [/s Seeds]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint32_t STATUS_SUCCESS = 0x00000000;
+const uint32_t STATUS_BUFFER_OVERFLOW = 0x80000005;
+const uint32_t STATUS_NO_MORE_FILES = 0x80000006;
+const uint32_t STATUS_INVALID_PARAMETER = 0xC000000D;
+const uint32_t STATUS_NO_SUCH_FILE = 0xC000000F;
+const uint32_t STATUS_INSUFFICIENT_RESOURCES = 0xC000009A;
+
+const uint8_t SL_RESTART_SCAN = 0x01;
+const uint8_t SL_RETURN_SINGLE_ENTRY = 0x02;
+const uint8_t SL_INDEX_SPECIFIED = 0x04;
+
+const uint32_t kDirectoryPageLength = 64 * 1024;
+
+// FileDirectoryInformation, FileFullDirectoryInformation,
+// FileBothDirectoryInformation, FileNamesInformation and
+// FileIdBothDirectoryInformation: sizeof() of the structures on x64
+const uint32_t kClassHeaderSize[] = {72, 72, 96, 16, 112};
+const int kClassCount = 5;
+
+uint32_t QuadAlign(uint32_t Value) { return (Value + 7) & ~7u; }
+
+// Every class starts with NextEntryOffset and FileIndex, the name follows
+// the header
+struct EntryHeader {
+  uint32_t NextEntryOffset;
+  uint32_t FileIndex;
+};
+
+struct Query {
+  uint32_t BufferLength;
+  uint8_t Flags;
+  uint32_t FileIndex;
+  int InformationClass;
+  // Empty for none
+  std::wstring Pattern;
+};
+
+struct Result {
+  uint32_t Status;
+  std::vector<uint8_t> Buffer;
+};
+
+struct Event {
+  uint32_t FileIndex;
+  uint32_t BufferLength;
+  uint8_t Flags;
+  int InformationClass;
+  std::wstring Pattern;
+};
+
+struct Reply {
+  uint32_t Status;
+  uint32_t Index;
+  bool NoMoreEntries;
+  std::vector<uint8_t> Buffer;
+};
+
+// Pattern matching of the model: a name matches when it contains the pattern
+bool Matches(const std::wstring &Pattern, const std::wstring &Name) {
+  return Pattern.empty() || Pattern == L"*" ||
+         Name.find(Pattern) != std::wstring::npos;
+}
+
+// MatchFiles and DispatchDirectoryInformation of dokan/directory.c
+class UserMode {
+public:
+  explicit UserMode(const std::vector<std::wstring> &Names) : names_(Names) {}
+
+  Reply Answer(const Event &E) {
+    Reply reply;
+    std::vector<uint8_t> buffer(E.BufferLength);
+    uint32_t remaining = E.BufferLength;
+    uint32_t current = 0;
+    uint32_t last = 0;
+    uint32_t index = 0;
+    size_t i;
+
+    ++events_;
+    for (i = 0; i < names_.size(); ++i) {
+      if (!Matches(E.Pattern, names_[i]))
+        continue;
+      if (E.FileIndex <= index) {
+        uint32_t nameBytes = (uint32_t)names_[i].size() * 2;
+        uint32_t size =
+            QuadAlign(kClassHeaderSize[E.InformationClass] + nameBytes);
+        if (remaining < size)
+          break;
+        EntryHeader header = {0, index + 1};
+        memcpy(&buffer[current], &header, sizeof(header));
+        memcpy(&buffer[current + kClassHeaderSize[E.InformationClass]],
+               names_[i].data(), nameBytes);
+        remaining -= size;
+        last = current;
+        if (E.Flags & SL_RETURN_SINGLE_ENTRY) {
+          index++;
+          break;
+        }
+        header.NextEntryOffset = size;
+        memcpy(&buffer[current], &header, sizeof(header));
+        current += size;
+      }
+      index++;
+    }
+    if (E.BufferLength >= sizeof(EntryHeader)) {
+      uint32_t zero = 0;
+      memcpy(&buffer[last], &zero, sizeof(zero));
+    }
+    buffer.resize(E.BufferLength - remaining);
+
+    reply.NoMoreEntries = i == names_.size() && index > E.FileIndex;
+    if (index <= E.FileIndex) {
+      reply.Index = E.FileIndex;
+      reply.NoMoreEntries = false;
+      if (i != names_.size())
+        reply.Status = STATUS_BUFFER_OVERFLOW;
+      else
+        reply.Status =
+            E.FileIndex == 0 ? STATUS_NO_SUCH_FILE : STATUS_NO_MORE_FILES;
+      return reply;
+    }
+    reply.Status = STATUS_SUCCESS;
+    reply.Index = index;
+    reply.Buffer.swap(buffer);
+    return reply;
+  }
+
+  uint64_t Events() const { return events_; }
+
+private:
+  const std::vector<std::wstring> &names_;
+  uint64_t events_ = 0;
+};
+
+// The fields of DokanCCB a query uses
+struct Ccb {
+  uint32_t Context = 0;
+  bool HasPattern = false;
+  bool MatchAll = false;
+  std::wstring SearchPattern;
+  std::vector<uint8_t> DirectoryPage;
+  uint32_t DirectoryPageOffset = 0;
+  int DirectoryPageClass = 0;
+  bool DirectoryPageEnd = false;
+};
+
+// DokanQueryDirectory and DokanCompleteDirectoryControl of sys/directory.c,
+// with and without the directory pages
+class Driver {
+public:
+  Driver(UserMode &User, uint32_t PageLength)
+      : user_(User), pageLength_(PageLength) {}
+
+  Result QueryDirectory(const Query &Q) {
+    Result result;
+    if (pageLength_ != 0 && QueryDirectoryPage(Q, &result))
+      return result;
+
+    // Initial query
+    if (!ccb_.HasPattern && !ccb_.MatchAll) {
+      if (!Q.Pattern.empty()) {
+        ccb_.HasPattern = true;
+        ccb_.SearchPattern = Q.Pattern;
+      } else {
+        ccb_.MatchAll = true;
+      }
+    }
+    Event e;
+    e.FileIndex = QueryIndex(Q);
+    e.BufferLength = Q.BufferLength;
+    if (pageLength_ != 0 && !(Q.Flags & SL_RETURN_SINGLE_ENTRY) &&
+        e.BufferLength < pageLength_)
+      e.BufferLength = pageLength_;
+    e.Flags = Q.Flags;
+    e.InformationClass = Q.InformationClass;
+    e.Pattern = ccb_.SearchPattern;
+    return Complete(Q, user_.Answer(e));
+  }
+
+private:
+  uint32_t QueryIndex(const Query &Q) const {
+    if (Q.Flags & SL_INDEX_SPECIFIED)
+      return Q.FileIndex;
+    if (Q.Flags & SL_RESTART_SCAN)
+      return 0;
+    return ccb_.Context;
+  }
+
+  void FreeDirectoryPage() {
+    ccb_.DirectoryPage.clear();
+    ccb_.DirectoryPageOffset = 0;
+    ccb_.DirectoryPageEnd = false;
+  }
+
+  bool PageMatches(const Query &Q) const {
+    if ((Q.Flags & SL_RESTART_SCAN) ||
+        Q.InformationClass != ccb_.DirectoryPageClass ||
+        QueryIndex(Q) != ccb_.Context)
+      return false;
+    return Q.Pattern.empty() ||
+           (ccb_.HasPattern && Q.Pattern == ccb_.SearchPattern);
+  }
+
+  // DokanCopyDirectoryEntries
+  static uint32_t CopyEntries(std::vector<uint8_t> &Buffer,
+                              const uint8_t *Entries, uint32_t EntriesLength,
+                              bool SingleEntry, uint32_t *Consumed,
+                              uint32_t *Index) {
+    uint32_t bufferLength = (uint32_t)Buffer.size();
+    uint32_t offset = 0;
+    int64_t last = -1;
+    *Consumed = 0;
+    while (EntriesLength - offset >= sizeof(EntryHeader)) {
+      EntryHeader entry;
+      memcpy(&entry, Entries + offset, sizeof(entry));
+      uint32_t entryLength = entry.NextEntryOffset != 0
+                                 ? entry.NextEntryOffset
+                                 : EntriesLength - offset;
+      if (entryLength > EntriesLength - offset ||
+          entryLength > bufferLength - offset)
+        break;
+      memcpy(&Buffer[offset], Entries + offset, entryLength);
+      last = offset;
+      *Index = entry.FileIndex;
+      offset += entryLength;
+      if (SingleEntry || entry.NextEntryOffset == 0)
+        break;
+    }
+    if (last < 0)
+      return 0;
+    uint32_t zero = 0;
+    memcpy(&Buffer[(size_t)last], &zero, sizeof(zero));
+    *Consumed = offset;
+    return offset;
+  }
+
+  // DokanQueryDirectoryPage
+  bool QueryDirectoryPage(const Query &Q, Result *R) {
+    if (ccb_.DirectoryPage.empty() && !ccb_.DirectoryPageEnd)
+      return false;
+    if (!PageMatches(Q)) {
+      FreeDirectoryPage();
+      return false;
+    }
+    if (Q.BufferLength == 0)
+      return false;
+    if (ccb_.DirectoryPageOffset == ccb_.DirectoryPage.size()) {
+      R->Status = STATUS_NO_MORE_FILES;
+      return true;
+    }
+    std::vector<uint8_t> buffer(Q.BufferLength);
+    uint32_t consumed = 0;
+    uint32_t index = 0;
+    uint32_t copied = CopyEntries(
+        buffer, &ccb_.DirectoryPage[ccb_.DirectoryPageOffset],
+        (uint32_t)ccb_.DirectoryPage.size() - ccb_.DirectoryPageOffset,
+        (Q.Flags & SL_RETURN_SINGLE_ENTRY) != 0, &consumed, &index);
+    if (copied == 0) {
+      R->Status = STATUS_BUFFER_OVERFLOW;
+      return true;
+    }
+    if (!ccb_.DirectoryPageEnd && !(Q.Flags & SL_RETURN_SINGLE_ENTRY) &&
+        ccb_.DirectoryPageOffset + consumed == ccb_.DirectoryPage.size()) {
+      FreeDirectoryPage();
+      return false;
+    }
+    ccb_.DirectoryPageOffset += consumed;
+    ccb_.Context = index;
+    if (ccb_.DirectoryPageOffset == ccb_.DirectoryPage.size() &&
+        !ccb_.DirectoryPageEnd)
+      FreeDirectoryPage();
+    buffer.resize(copied);
+    R->Status = STATUS_SUCCESS;
+    R->Buffer.swap(buffer);
+    return true;
+  }
+
+  // DokanCompleteDirectoryControl
+  Result Complete(const Query &Q, const Reply &E) {
+    Result result;
+    if (Q.BufferLength == 0) {
+      result.Status = STATUS_INSUFFICIENT_RESOURCES;
+      return result;
+    }
+    std::vector<uint8_t> buffer(Q.BufferLength);
+    uint32_t length = (uint32_t)E.Buffer.size();
+    uint32_t index = E.Index;
+    uint32_t consumed = 0;
+    uint32_t info;
+    uint32_t status = E.Status;
+
+    FreeDirectoryPage();
+    if (length <= Q.BufferLength) {
+      if (length != 0)
+        memcpy(&buffer[0], E.Buffer.data(), length);
+      info = length;
+      consumed = length;
+    } else if (status == STATUS_SUCCESS) {
+      info = CopyEntries(buffer, E.Buffer.data(), length,
+                         (Q.Flags & SL_RETURN_SINGLE_ENTRY) != 0, &consumed,
+                         &index);
+      if (info == 0) {
+        status = STATUS_BUFFER_OVERFLOW;
+        index = QueryIndex(Q);
+      }
+    } else {
+      info = 0;
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      consumed = length;
+      index = ccb_.Context;
+    }
+    ccb_.Context = index;
+    if ((status == STATUS_SUCCESS || status == STATUS_BUFFER_OVERFLOW) &&
+        (length - consumed != 0 || E.NoMoreEntries)) {
+      ccb_.DirectoryPage.assign(E.Buffer.begin() + consumed, E.Buffer.end());
+      ccb_.DirectoryPageOffset = 0;
+      ccb_.DirectoryPageClass = Q.InformationClass;
+      ccb_.DirectoryPageEnd = E.NoMoreEntries;
+    }
+    buffer.resize(info);
+    result.Status = status;
+    result.Buffer.swap(buffer);
+    return result;
+  }
+
+  UserMode &user_;
+  uint32_t pageLength_;
+  Ccb ccb_;
+};
+
+std::vector<std::wstring> MakeNames(std::mt19937 &Random, size_t Count) {
+  static const wchar_t kLetters[] = L"abcdefghij";
+  std::vector<std::wstring> names;
+  for (size_t i = 0; i < Count; ++i) {
+    std::wstring name;
+    size_t length = 1 + Random() % 40;
+    for (size_t j = 0; j < length; ++j)
+      name += kLetters[Random() % 10];
+    names.push_back(name);
+  }
+  return names;
+}
+
+Query RandomQuery(std::mt19937 &Random, bool First, int *Class) {
+  static const uint32_t kBufferLengths[] = {0, 16, 100, 200, 600, 4096, 65536};
+  static const wchar_t *kPatterns[] = {L"a", L"ab", L"*", L"j"};
+  Query q;
+  q.BufferLength = kBufferLengths[Random() % 7];
+  q.Flags = 0;
+  q.FileIndex = 0;
+  if (Random() % 20 == 0)
+    q.Flags |= SL_RESTART_SCAN;
+  if (Random() % 10 == 0)
+    q.Flags |= SL_RETURN_SINGLE_ENTRY;
+  if (Random() % 30 == 0) {
+    q.Flags |= SL_INDEX_SPECIFIED;
+    q.FileIndex = Random() % 64;
+  }
+  if (Random() % 30 == 0)
+    *Class = Random() % kClassCount;
+  q.InformationClass = *Class;
+  if ((First && Random() % 2 == 0) || Random() % 30 == 0)
+    q.Pattern = kPatterns[Random() % 4];
+  return q;
+}
+
+// Random query sequences must get the same answers with and without pages
+bool ModelCheck(unsigned Seeds) {
+  for (unsigned seed = 1; seed <= Seeds; ++seed) {
+    std::mt19937 random(seed);
+    std::vector<std::wstring> names = MakeNames(random, random() % 300);
+    // Small pages so a listing spans several of them
+    uint32_t pageLength = seed % 2 ? 1024 : kDirectoryPageLength;
+    UserMode directUser(names), pagedUser(names);
+    Driver direct(directUser, 0), paged(pagedUser, pageLength);
+    int infoClass = random() % kClassCount;
+
+    for (int i = 0; i < 200; ++i) {
+      Query q = RandomQuery(random, i == 0, &infoClass);
+      Result expected = direct.QueryDirectory(q);
+      Result actual = paged.QueryDirectory(q);
+      if (expected.Status != actual.Status ||
+          expected.Buffer != actual.Buffer) {
+        fprintf(stderr,
+                "seed %u query %d: status 0x%08x/%u bytes expected, "
+                "0x%08x/%u bytes\n",
+                seed, i, expected.Status, (unsigned)expected.Buffer.size(),
+                actual.Status, (unsigned)actual.Buffer.size());
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Events of one listing of Entries names, like FindFirstFile / FindNextFile
+uint64_t CountEvents(const std::vector<std::wstring> &Names,
+                     uint32_t BufferLength, uint32_t PageLength,
+                     uint64_t *Queries) {
+  UserMode user(Names);
+  Driver driver(user, PageLength);
+  Query q;
+  q.BufferLength = BufferLength;
+  q.Flags = 0;
+  q.FileIndex = 0;
+  q.InformationClass = 2;
+  q.Pattern = L"*";
+  *Queries = 0;
+  for (;;) {
+    Result r = driver.QueryDirectory(q);
+    ++*Queries;
+    q.Pattern.clear();
+    if (r.Status != STATUS_SUCCESS)
+      break;
+  }
+  return user.Events();
+}
+
+void Usage() {
+  fprintf(stderr, "dirpage_model [/n Entries] [/b BufferLength] "
+                  "[/p PageLength] [/s Seeds]\n");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t entries = 100000;
+  uint32_t bufferLength = 4096;
+  uint32_t pageLength = kDirectoryPageLength;
+  unsigned seeds = 2000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc || strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-')) {
+      Usage();
+      return EXIT_FAILURE;
+    }
+    unsigned long value = strtoul(argv[++i], NULL, 10);
+    switch (argv[i - 1][1]) {
+    case 'n':
+      entries = value;
+      break;
+    case 'b':
+      bufferLength = (uint32_t)value;
+      break;
+    case 'p':
+      pageLength = (uint32_t)value;
+      break;
+    case 's':
+      seeds = (unsigned)value;
+      break;
+    default:
+      Usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!ModelCheck(seeds)) {
+    fprintf(stderr, "model check failed\n");
+    return EXIT_FAILURE;
+  }
+  printf("model check: %u query sequences answered the same\n", seeds);
+
+  std::mt19937 random(0);
+  std::vector<std::wstring> names = MakeNames(random, entries);
+  uint64_t queries = 0;
+  uint64_t direct = CountEvents(names, bufferLength, 0, &queries);
+  uint64_t paged = CountEvents(names, bufferLength, pageLength, &queries);
+  printf("%zu entries, %u byte buffer: %llu queries, %llu events direct, "
+         "%llu events with %u byte pages\n",
+         entries, bufferLength, (unsigned long long)queries,
+         (unsigned long long)direct, (unsigned long long)paged, pageLength);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1714 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark of the real Dispatch* functions of dokan/, without a driver: the
+// events a driver sends for each workload go through DokanDispatchEvent on the
+// fake device channel of samples/fake_device, to the in-memory file system of
+// memoryfs.c. Scenarios:
+//   create - create, query basic and standard information, cleanup and close
+//            storms of small files, one in four deleted on close
+//   seq    - sequential writes then reads of a large file per thread, the
+//            chunks that do not fit in an event fetched with IOCTL_EVENT_WRITE
+//   walk   - listings of every directory of a deep tree, paged, alternately
+//            with the "*" and "f*.log" patterns
+//   rename - renames of files back and forth between two directories
+//   mixed  - random opens, reads, writes, listings and temporary files on
+//            files shared by all threads
+//   replay - the requests of a trace file of DokanDumpTrace or dokanctl /t,
+//            on files named after the hashes of the recorded names
+//   block  - random reads and writes of a file per thread on a backend that
+//            waits the injected latency before running them
+//   pend   - the same on a backend that pends them with DokanPendRequest,
+//            completion threads finish them once the latency has elapsed
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan /I..\..\sys /D_EXPORTING dispatch_bench.c
+//       ..\fake_device\dokanfiles.c ..\fake_device\fakedevice.c
+//       ..\fake_device\memoryfs.c advapi32.lib
+//   gcc -O2 -pthread -I../win32_shim -I../../dokan -I../../sys -D_EXPORTING
+//       dispatch_bench.c ../fake_device/dokanfiles.c
+//       ../fake_device/fakedevice.c ../fake_device/memoryfs.c -o dispatch_bench
+//
+// dispatch_bench [/s create,seq,walk,rename,mixed] [/t 1,4] [/d Seconds]
+//                [/c ChunkKB] [/f FileMB] [/o Options] [/r TraceFile]
+//                [/x TraceFile] [/j ResultFile] [/l LatencyUs] [/q Depth]
+//
+// /o takes the DOKAN_OPTION_* flags of the instance, /r adds the replay
+// scenario, /x dumps the trace of the last requests of the run for /r and
+// /j writes one JSON object per result line. /l sets the latency of the
+// backend of block and pend and adds them, /q is the number of requests each
+// thread keeps pended. Latencies are the time spent in DokanDispatchEvent by
+// each request, until the completion for the pended ones, the last
+// BENCH_MAX_SAMPLES of each thread are kept for the percentiles. Allocations
+// are only counted with the C runtime of glibc. Exits with 1 if a request
+// failed unexpectedly.
+
+#include "dokani.h"
+#include "../fake_device/fakedevice.h"
+#include "../fake_device/memoryfs.h"
+#include "tracering.h"
+
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SAMPLES (256 * 1024)
+#define BENCH_PROCESS_ID 4242
+#define BENCH_DIRECTORY_PAGE (64 * 1024)
+#define BENCH_CREATE_FILES 1024
+#define BENCH_WALK_DEPTH 6
+#define BENCH_WALK_FANOUT 3
+#define BENCH_WALK_FILES 16
+#define BENCH_RENAME_FILES 64
+#define BENCH_MIXED_FILES 256
+#define BENCH_MIXED_FILE_SIZE (64 * 1024)
+#define BENCH_MIXED_IO_SIZE 4096
+#define BENCH_REPLAY_HANDLES 1024
+#define BENCH_REPLAY_MAX_LENGTH (1024 * 1024)
+#define BENCH_REPLAY_THREADS 256
+#define BENCH_LATENCY_FILE_SIZE (256 * 1024)
+#define BENCH_COMPLETION_THREADS 4
+
+#define BENCH_ALIGN(Length) (((Length) + 7) & ~(ULONG)7)
+
+// Allocations of the calling thread, counted by the allocator replaced below
+static DOKAN_THREAD_LOCAL ULONG64 g_Allocations;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define BENCH_COUNTS_ALLOCATIONS TRUE
+
+// The allocator of glibc under its internal names, the library and the file
+// system allocate through the replacements
+extern void *__libc_malloc(size_t Size);
+extern void *__libc_calloc(size_t Count, size_t Size);
+extern void *__libc_realloc(void *Memory, size_t Size);
+extern void *__libc_memalign(size_t Alignment, size_t Size);
+extern void __libc_free(void *Memory);
+
+void *malloc(size_t Size) {
+  ++g_Allocations;
+  return __libc_malloc(Size);
+}
+
+void *calloc(size_t Count, size_t Size) {
+  ++g_Allocations;
+  return __libc_calloc(Count, Size);
+}
+
+void *realloc(void *Memory, size_t Size) {
+  ++g_Allocations;
+  return __libc_realloc(Memory, Size);
+}
+
+void *memalign(size_t Alignment, size_t Size) {
+  ++g_Allocations;
+  return __libc_memalign(Alignment, Size);
+}
+
+void *aligned_alloc(size_t Alignment, size_t Size) {
+  return memalign(Alignment, Size);
+}
+
+int posix_memalign(void **Memory, size_t Alignment, size_t Size) {
+  *Memory = memalign(Alignment, Size);
+  return *Memory != NULL ? 0 : ENOMEM;
+}
+
+void free(void *Memory) { __libc_free(Memory); }
+#else
+#define BENCH_COUNTS_ALLOCATIONS FALSE
+#endif
+
+/**
+ * \struct BENCH_REPLY
+ * \brief What a thread keeps of the last reply sent on its device
+ */
+typedef struct _BENCH_REPLY {
+  NTSTATUS Status;
+  ULONG Flags;
+  ULONG64 Context;
+  ULONG DirectoryIndex;
+  ULONG BufferLength;
+  /** Entries of a directory listing */
+  ULONG Entries;
+  /** First bytes of the data of a read */
+  ULONG64 Data;
+} BENCH_REPLY, *PBENCH_REPLY;
+
+/**
+ * \struct BENCH_THREAD
+ * \brief One DokanLoop thread of the benchmark
+ */
+typedef struct _BENCH_THREAD {
+  ULONG Index;
+  ULONG Threads;
+  PDOKAN_INSTANCE DokanInstance;
+  FAKE_DEVICE Device;
+  /** Event given to DokanDispatchEvent, EVENT_CONTEXT_MAX_SIZE bytes */
+  PEVENT_CONTEXT Event;
+  /** Whole event of the writes larger than an event */
+  PEVENT_CONTEXT WriteEvent;
+  ULONG SerialNumber;
+  ULONG Random;
+  BOOL ListingDirectory;
+  BENCH_REPLY Reply;
+  /** Counter of the start of the request being dispatched */
+  LONGLONG DispatchStart;
+  /** Set by the backend when it pends the request being dispatched */
+  BOOL Pended;
+  /** Requests pended and not completed yet */
+  volatile LONG InFlight;
+
+  // State of the scenario
+  ULONG64 Iteration;
+  ULONG64 Handle;
+  WCHAR HandleName[MAX_PATH];
+  ULONG64 Position;
+  BOOL Reading;
+  UCHAR RenameSide[BENCH_RENAME_FILES];
+  ULONG64 ReplayHashes[BENCH_REPLAY_HANDLES];
+  ULONG64 ReplayHandles[BENCH_REPLAY_HANDLES];
+  ULONG64 ReplayOffsets[BENCH_REPLAY_HANDLES];
+  ULONG ReplayNext;
+
+  // Results
+  ULONG64 Operations;
+  ULONG64 Requests;
+  ULONG64 Allocations;
+  ULONG64 Bytes;
+  ULONG64 Errors;
+  ULONG64 SampleCount;
+  ULONG *Samples;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+typedef struct _BENCH_OPTIONS {
+  ULONG Threads[BENCH_MAX_THREADS];
+  ULONG ThreadCounts;
+  // Room for the scenarios added by /r and /l
+  char Scenarios[256 + 32];
+  double Seconds;
+  ULONG ChunkSize;
+  ULONG64 FileSize;
+  ULONG DokanOptions;
+  const char *ReplayFile;
+  const char *TraceFile;
+  const char *ResultFile;
+  ULONG LatencyUs;
+  BOOL Latency;
+  ULONG QueueDepth;
+} BENCH_OPTIONS;
+
+// What the ReadFile and WriteFile callbacks do
+typedef enum _BENCH_BACKEND {
+  // Run memoryfs
+  BENCH_BACKEND_MEMORY,
+  // Wait the latency on the DokanLoop thread, then run memoryfs
+  BENCH_BACKEND_BLOCK,
+  // Pend the request, a completion thread runs memoryfs after the latency
+  BENCH_BACKEND_PEND,
+} BENCH_BACKEND;
+
+typedef struct _BENCH_SCENARIO {
+  const char *Name;
+  VOID (*Prepare)(PBENCH_THREAD Setup);
+  VOID (*Operation)(PBENCH_THREAD Thread);
+  BENCH_BACKEND Backend;
+} BENCH_SCENARIO;
+
+/**
+ * \struct BENCH_PENDED
+ * \brief Read or write pended by the backend until its deadline
+ */
+typedef struct _BENCH_PENDED {
+  PDOKAN_REQUEST Request;
+  /** Thread that dispatched the request */
+  PBENCH_THREAD Thread;
+  BOOL Write;
+  /** Read buffer of the library, or copy of the data to write */
+  PVOID Buffer;
+  DWORD Length;
+  LONGLONG Offset;
+  /** Copy of the DOKAN_FILE_INFO given to the callback */
+  DOKAN_FILE_INFO FileInfo;
+  /** Counter of the start of the dispatch */
+  LONGLONG Start;
+  /** Counter after which the request is completed */
+  LONGLONG Deadline;
+  struct _BENCH_PENDED *Next;
+} BENCH_PENDED, *PBENCH_PENDED;
+
+/**
+ * \struct BENCH_COMPLETION
+ * \brief One completion thread of the pend backend
+ */
+typedef struct _BENCH_COMPLETION {
+  ULONG64 Errors;
+  ULONG64 SampleCount;
+  ULONG *Samples;
+} BENCH_COMPLETION, *PBENCH_COMPLETION;
+
+static BENCH_OPTIONS g_Options;
+static volatile LONG g_Stop;
+static LONGLONG g_Frequency;
+
+// Latency backend, which runs the callbacks of memoryfs in g_MemoryFs
+static BENCH_BACKEND g_Backend;
+static DOKAN_OPERATIONS g_MemoryFs;
+static LONGLONG g_LatencyTicks;
+static DOKAN_THREAD_LOCAL PBENCH_THREAD g_CurrentThread;
+// Requests pended by the backend, oldest first
+static PBENCH_PENDED g_PendedHead;
+static PBENCH_PENDED *g_PendedTail = &g_PendedHead;
+static CRITICAL_SECTION g_PendedLock;
+static volatile LONG g_StopCompletions;
+
+// Records of the trace file to replay, their ThreadId replaced by the number
+// of the recorded thread in order of appearance
+static PDOKAN_TRACE_ENTRY g_ReplayEntries;
+static ULONG g_ReplayCount;
+static ULONG g_ReplayThreads;
+
+static VOID BenchReply(PFAKE_DEVICE Device, PEVENT_INFORMATION EventInfo,
+                       ULONG EventLength) {
+  PBENCH_THREAD thread = (PBENCH_THREAD)Device->Context;
+  ULONG nextEntryOffset;
+  ULONG offset = 0;
+
+  UNREFERENCED_PARAMETER(EventLength);
+  thread->Reply.Status = EventInfo->Status;
+  thread->Reply.Flags = EventInfo->Flags;
+  thread->Reply.Context = EventInfo->Context;
+  thread->Reply.DirectoryIndex = EventInfo->Operation.Directory.Index;
+  thread->Reply.BufferLength = EventInfo->BufferLength;
+  thread->Reply.Entries = 0;
+  thread->Reply.Data = 0;
+  if (EventInfo->BufferLength >= sizeof(ULONG64))
+    CopyMemory(&thread->Reply.Data, EventInfo->Buffer, sizeof(ULONG64));
+  if (!thread->ListingDirectory || EventInfo->BufferLength == 0)
+    return;
+  // Entries are not always aligned, NextEntryOffset is their first field
+  for (;;) {
+    CopyMemory(&nextEntryOffset, EventInfo->Buffer + offset, sizeof(ULONG));
+    ++thread->Reply.Entries;
+    if (nextEntryOffset == 0)
+      break;
+    offset += nextEntryOffset;
+  }
+}
+
+static ULONG NextRandom(PBENCH_THREAD Thread) {
+  // xorshift32
+  Thread->Random ^= Thread->Random << 13;
+  Thread->Random ^= Thread->Random >> 17;
+  Thread->Random ^= Thread->Random << 5;
+  return Thread->Random;
+}
+
+// Copies Name with its null, returns its length in bytes without the null
+static ULONG CopyName(PWCHAR Destination, LPCWSTR Name) {
+  ULONG length = (ULONG)(wcslen(Name) * sizeof(WCHAR));
+
+  CopyMemory(Destination, Name, length + sizeof(WCHAR));
+  return length;
+}
+
+static PEVENT_CONTEXT BeginEvent(PBENCH_THREAD Thread, UCHAR MajorFunction,
+                                 ULONG64 Context) {
+  PEVENT_CONTEXT event = Thread->Event;
+
+  ZeroMemory(event, sizeof(EVENT_CONTEXT));
+  event->MountId = 1;
+  event->SerialNumber = ++Thread->SerialNumber;
+  event->ProcessId = BENCH_PROCESS_ID;
+  event->MajorFunction = MajorFunction;
+  event->Context = Context;
+  return event;
+}
+
+static VOID EndEvent(PEVENT_CONTEXT Event, PVOID End) {
+  Event->Length = BENCH_ALIGN((ULONG)((PCHAR)End - (PCHAR)Event));
+}
+
+// Runs the event like a DokanLoop thread and returns the status of its reply,
+// STATUS_SUCCESS for the requests without reply
+static NTSTATUS Dispatch(PBENCH_THREAD Thread, PEVENT_CONTEXT Event) {
+  LARGE_INTEGER start;
+  LARGE_INTEGER end;
+  LONG replies = Thread->Device.ReplyCount;
+  ULONG64 allocations = g_Allocations;
+  ULONG64 latency;
+
+  Thread->Reply.Status = STATUS_SUCCESS;
+  Thread->Pended = FALSE;
+  QueryPerformanceCounter(&start);
+  Thread->DispatchStart = start.QuadPart;
+  DokanDispatchEvent((HANDLE)&Thread->Device, Event, Thread->DokanInstance);
+  QueryPerformanceCounter(&end);
+
+  Thread->Allocations += g_Allocations - allocations;
+  ++Thread->Requests;
+  // The completion takes the sample of a pended request
+  if (Thread->Pended)
+    return STATUS_SUCCESS;
+  latency = (ULONG64)(end.QuadPart - start.QuadPart) * 1000000000 /
+            (ULONG64)g_Frequency;
+  Thread->Samples[Thread->SampleCount % BENCH_MAX_SAMPLES] =
+      (ULONG)min(latency, MAXULONG);
+  ++Thread->SampleCount;
+  if (Thread->Device.ReplyCount == replies)
+    return STATUS_SUCCESS;
+  return Thread->Reply.Status;
+}
+
+static VOID Check(PBENCH_THREAD Thread, BOOL Condition) {
+  if (!Condition)
+    ++Thread->Errors;
+}
+
+// Returns the context of the opened file, 0 if the create failed
+static ULONG64 Create(PBENCH_THREAD Thread, LPCWSTR FileName,
+                      ULONG Disposition, ULONG Options,
+                      ACCESS_MASK DesiredAccess) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_CREATE, 0);
+  PCREATE_CONTEXT create = &event->Operation.Create;
+  PDOKAN_ACCESS_STATE_INTERMEDIATE accessState =
+      &create->SecurityContext.AccessState;
+  PDOKAN_UNICODE_STRING_INTERMEDIATE emptyString;
+  PWCHAR name;
+
+  create->SecurityContext.DesiredAccess = DesiredAccess;
+  accessState->OriginalDesiredAccess = DesiredAccess;
+  accessState->RemainingDesiredAccess = DesiredAccess;
+  create->FileAttributes = (Options & FILE_DIRECTORY_FILE)
+                               ? FILE_ATTRIBUTE_DIRECTORY
+                               : FILE_ATTRIBUTE_NORMAL;
+  create->CreateOptions = (Disposition << 24) | Options;
+  create->ShareAccess = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+  // The object name and type of the access state are both empty
+  emptyString = (PDOKAN_UNICODE_STRING_INTERMEDIATE)(create + 1);
+  ZeroMemory(emptyString, sizeof(DOKAN_UNICODE_STRING_INTERMEDIATE));
+  accessState->UnicodeStringObjectNameOffset =
+      (ULONG)((PCHAR)emptyString - (PCHAR)accessState);
+  accessState->UnicodeStringObjectTypeOffset =
+      accessState->UnicodeStringObjectNameOffset;
+  name = (PWCHAR)(emptyString + 1);
+  create->FileNameOffset = (ULONG)((PCHAR)name - (PCHAR)create);
+  create->FileNameLength = CopyName(name, FileName);
+  EndEvent(event, (PCHAR)name + create->FileNameLength + sizeof(WCHAR));
+
+  if (!NT_SUCCESS(Dispatch(Thread, event)))
+    return 0;
+  return Thread->Reply.Context;
+}
+
+static VOID Cleanup(PBENCH_THREAD Thread, ULONG64 Context, LPCWSTR FileName,
+                    BOOL DeleteOnClose) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_CLEANUP, Context);
+  PCLEANUP_CONTEXT cleanup = &event->Operation.Cleanup;
+
+  if (DeleteOnClose)
+    event->FileFlags |= DOKAN_DELETE_ON_CLOSE;
+  cleanup->FileNameLength = CopyName(cleanup->FileName, FileName);
+  EndEvent(event, (PCHAR)cleanup->FileName + cleanup->FileNameLength +
+                      sizeof(WCHAR));
+  Check(Thread, Dispatch(Thread, event) == STATUS_SUCCESS);
+}
+
+static VOID Close(PBENCH_THREAD Thread, ULONG64 Context, LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_CLOSE, Context);
+  PCLOSE_CONTEXT close = &event->Operation.Close;
+
+  close->FileNameLength = CopyName(close->FileName, FileName);
+  EndEvent(event,
+           (PCHAR)close->FileName + close->FileNameLength + sizeof(WCHAR));
+  Dispatch(Thread, event);
+}
+
+// Cleanup and close of a handle
+static VOID CloseHandleOf(PBENCH_THREAD Thread, ULONG64 Context,
+                          LPCWSTR FileName, BOOL DeleteOnClose) {
+  Cleanup(Thread, Context, FileName, DeleteOnClose);
+  Close(Thread, Context, FileName);
+}
+
+static NTSTATUS QueryInformation(PBENCH_THREAD Thread, ULONG64 Context,
+                                 LPCWSTR FileName, ULONG FileInformationClass,
+                                 ULONG BufferLength) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_QUERY_INFORMATION, Context);
+  PFILEINFO_CONTEXT file = &event->Operation.File;
+
+  file->FileInformationClass = FileInformationClass;
+  file->BufferLength = BufferLength;
+  file->FileNameLength = CopyName(file->FileName, FileName);
+  EndEvent(event, (PCHAR)file->FileName + file->FileNameLength +
+                      sizeof(WCHAR));
+  return Dispatch(Thread, event);
+}
+
+// Returns the number of bytes read, the first ones are in Reply.Data
+static ULONG Read(PBENCH_THREAD Thread, ULONG64 Context, LPCWSTR FileName,
+                  ULONG64 Offset, ULONG Length) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_READ, Context);
+  PREAD_CONTEXT read = &event->Operation.Read;
+
+  read->ByteOffset.QuadPart = (LONGLONG)Offset;
+  read->BufferLength = Length;
+  read->FileNameLength = CopyName(read->FileName, FileName);
+  EndEvent(event, (PCHAR)read->FileName + read->FileNameLength +
+                      sizeof(WCHAR));
+  if (Dispatch(Thread, event) != STATUS_SUCCESS)
+    return 0;
+  return Thread->Reply.BufferLength;
+}
+
+// Writes Length bytes starting with Tag, returns the number of bytes written
+static ULONG Write(PBENCH_THREAD Thread, ULONG64 Context, LPCWSTR FileName,
+                   ULONG64 Offset, ULONG Length, ULONG64 Tag) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_WRITE, Context);
+  PWRITE_CONTEXT write = &event->Operation.Write;
+  PEVENT_CONTEXT whole;
+  ULONG dataOffset;
+
+  write->ByteOffset.QuadPart = (LONGLONG)Offset;
+  write->BufferLength = Length;
+  write->FileNameLength = CopyName(write->FileName, FileName);
+  dataOffset =
+      BENCH_ALIGN((ULONG)((PCHAR)write->FileName - (PCHAR)event) +
+                  write->FileNameLength + (ULONG)sizeof(WCHAR));
+  write->BufferOffset = dataOffset;
+  if (dataOffset + Length <= EVENT_CONTEXT_MAX_SIZE) {
+    CopyMemory((PCHAR)event + dataOffset, &Tag, min(Length, sizeof(Tag)));
+    event->Length = dataOffset + Length;
+    Thread->Device.WriteContext = NULL;
+  } else {
+    // The driver only sends the size of the whole write, user mode fetches it
+    whole = Thread->WriteEvent;
+    CopyMemory(whole, event, dataOffset);
+    CopyMemory((PCHAR)whole + dataOffset, &Tag, sizeof(Tag));
+    whole->Length = dataOffset + Length;
+    write->RequestLength = whole->Length;
+    event->Length = dataOffset;
+    Thread->Device.WriteContext = whole;
+  }
+  if (Dispatch(Thread, event) != STATUS_SUCCESS)
+    return 0;
+  return Thread->Reply.BufferLength;
+}
+
+static NTSTATUS Flush(PBENCH_THREAD Thread, ULONG64 Context,
+                      LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_FLUSH_BUFFERS, Context);
+  PFLUSH_CONTEXT flush = &event->Operation.Flush;
+
+  flush->FileNameLength = CopyName(flush->FileName, FileName);
+  EndEvent(event, (PCHAR)flush->FileName + flush->FileNameLength +
+                      sizeof(WCHAR));
+  return Dispatch(Thread, event);
+}
+
+// Lists the directory opened as Context one page at a time, returns the
+// number of entries or -1 if a query failed
+static LONG List(PBENCH_THREAD Thread, ULONG64 Context, LPCWSTR DirectoryName,
+                 LPCWSTR Pattern) {
+  PEVENT_CONTEXT event;
+  PDIRECTORY_CONTEXT directory;
+  ULONG patternLength = (ULONG)(wcslen(Pattern) * sizeof(WCHAR));
+  ULONG nameLength = (ULONG)(wcslen(DirectoryName) * sizeof(WCHAR));
+  PCHAR pattern;
+  NTSTATUS status;
+  ULONG index = 0;
+  LONG entries = 0;
+
+  Thread->ListingDirectory = TRUE;
+  for (;;) {
+    event = BeginEvent(Thread, IRP_MJ_DIRECTORY_CONTROL, Context);
+    directory = &event->Operation.Directory;
+    directory->FileInformationClass = FileBothDirectoryInformation;
+    directory->FileIndex = index;
+    directory->BufferLength = BENCH_DIRECTORY_PAGE;
+    ZeroMemory(directory->DirectoryName,
+               nameLength + patternLength + 2 * sizeof(WCHAR));
+    directory->DirectoryNameLength = CopyName(directory->DirectoryName,
+                                              DirectoryName);
+    pattern = (PCHAR)directory->SearchPatternBase + nameLength;
+    directory->SearchPatternLength = patternLength;
+    directory->SearchPatternOffset = nameLength;
+    CopyName((PWCHAR)pattern, Pattern);
+    EndEvent(event, pattern + patternLength + sizeof(WCHAR));
+
+    status = Dispatch(Thread, event);
+    if (status == STATUS_NO_MORE_FILES || status == STATUS_NO_SUCH_FILE)
+      break;
+    if (status != STATUS_SUCCESS) {
+      entries = -1;
+      break;
+    }
+    entries += Thread->Reply.Entries;
+    if ((Thread->Reply.Flags & DOKAN_EVENT_INFO_NO_MORE_ENTRIES) ||
+        Thread->Reply.Entries == 0)
+      break;
+    index = Thread->Reply.DirectoryIndex;
+  }
+  Thread->ListingDirectory = FALSE;
+  return entries;
+}
+
+static NTSTATUS Rename(PBENCH_THREAD Thread, ULONG64 Context,
+                       LPCWSTR FileName, LPCWSTR NewFileName) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_SET_INFORMATION, Context);
+  PSETFILE_CONTEXT setFile = &event->Operation.SetFile;
+  PDOKAN_RENAME_INFORMATION renameInfo;
+
+  setFile->FileInformationClass = FileRenameInformation;
+  setFile->FileNameLength = CopyName(setFile->FileName, FileName);
+  setFile->BufferOffset =
+      BENCH_ALIGN((ULONG)((PCHAR)setFile->FileName - (PCHAR)event) +
+                  setFile->FileNameLength + (ULONG)sizeof(WCHAR));
+  renameInfo =
+      (PDOKAN_RENAME_INFORMATION)((PCHAR)event + setFile->BufferOffset);
+  ZeroMemory(renameInfo, sizeof(DOKAN_RENAME_INFORMATION));
+  renameInfo->ReplaceIfExists = FALSE;
+  renameInfo->FileNameLength = CopyName(renameInfo->FileName, NewFileName);
+  setFile->BufferLength =
+      FIELD_OFFSET(DOKAN_RENAME_INFORMATION, FileName) +
+      renameInfo->FileNameLength;
+  EndEvent(event, (PCHAR)renameInfo->FileName + renameInfo->FileNameLength +
+                      sizeof(WCHAR));
+  return Dispatch(Thread, event);
+}
+
+static NTSTATUS SetBasicInformation(PBENCH_THREAD Thread, ULONG64 Context,
+                                    LPCWSTR FileName) {
+  PEVENT_CONTEXT event = BeginEvent(Thread, IRP_MJ_SET_INFORMATION, Context);
+  PSETFILE_CONTEXT setFile = &event->Operation.SetFile;
+  PFILE_BASIC_INFORMATION basicInfo;
+
+  setFile->FileInformationClass = FileBasicInformation;
+  setFile->FileNameLength = CopyName(setFile->FileName, FileName);
+  setFile->BufferOffset =
+      BENCH_ALIGN((ULONG)((PCHAR)setFile->FileName - (PCHAR)event) +
+                  setFile->FileNameLength + (ULONG)sizeof(WCHAR));
+  setFile->BufferLength = sizeof(FILE_BASIC_INFORMATION);
+  // Zero times and attributes leave the file unchanged
+  basicInfo = (PFILE_BASIC_INFORMATION)((PCHAR)event + setFile->BufferOffset);
+  ZeroMemory(basicInfo, sizeof(FILE_BASIC_INFORMATION));
+  EndEvent(event, basicInfo + 1);
+  return Dispatch(Thread, event);
+}
+
+static NTSTATUS QueryVolumeInformation(PBENCH_THREAD Thread) {
+  PEVENT_CONTEXT event =
+      BeginEvent(Thread, IRP_MJ_QUERY_VOLUME_INFORMATION, 0);
+
+  event->Operation.Volume.FsInformationClass = FileFsSizeInformation;
+  event->Operation.Volume.BufferLength = sizeof(FILE_FS_SIZE_INFORMATION);
+  EndEvent(event, &event->Operation.Volume + 1);
+  return Dispatch(Thread, event);
+}
+
+static VOID MakeDirectory(PBENCH_THREAD Thread, LPCWSTR FileName) {
+  ULONG64 handle = Create(Thread, FileName, FILE_OPEN_IF, FILE_DIRECTORY_FILE,
+                          FILE_GENERIC_READ);
+
+  Check(Thread, handle != 0);
+  if (handle != 0)
+    CloseHandleOf(Thread, handle, FileName, FALSE);
+}
+
+static VOID MakeFile(PBENCH_THREAD Thread, LPCWSTR FileName, ULONG Size) {
+  ULONG64 handle = Create(Thread, FileName, FILE_OVERWRITE_IF,
+                          FILE_NON_DIRECTORY_FILE, FILE_GENERIC_WRITE);
+  ULONG offset;
+
+  Check(Thread, handle != 0);
+  if (handle == 0)
+    return;
+  for (offset = 0; offset < Size; offset += BENCH_MIXED_IO_SIZE)
+    Write(Thread, handle, FileName, offset, min(Size - offset,
+                                               BENCH_MIXED_IO_SIZE), offset);
+  CloseHandleOf(Thread, handle, FileName, FALSE);
+}
+
+// create
+
+static VOID CreatePrepare(PBENCH_THREAD Setup) {
+  WCHAR name[MAX_PATH];
+  ULONG i;
+
+  for (i = 0; i < Setup->Threads; ++i) {
+    swprintf_s(name, MAX_PATH, L"\\c%u", i);
+    MakeDirectory(Setup, name);
+  }
+}
+
+static VOID CreateOperation(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  ULONG64 handle;
+  BOOL deleteOnClose = Thread->Iteration % 4 == 3;
+
+  swprintf_s(name, MAX_PATH, L"\\c%u\\f%u.txt", Thread->Index,
+             (ULONG)(Thread->Iteration++ % BENCH_CREATE_FILES));
+  handle = Create(Thread, name, FILE_OPEN_IF, FILE_NON_DIRECTORY_FILE,
+                  FILE_GENERIC_READ | FILE_GENERIC_WRITE | DELETE);
+  Check(Thread, handle != 0);
+  if (handle == 0)
+    return;
+  Check(Thread, QueryInformation(Thread, handle, name, FileBasicInformation,
+                                 sizeof(FILE_BASIC_INFORMATION)) ==
+                    STATUS_SUCCESS);
+  Check(Thread,
+        QueryInformation(Thread, handle, name, FileStandardInformation,
+                         sizeof(FILE_STANDARD_INFORMATION)) == STATUS_SUCCESS);
+  CloseHandleOf(Thread, handle, name, deleteOnClose);
+}
+
+// seq
+
+static VOID SequentialOperation(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  ULONG length;
+  ULONG done;
+
+  swprintf_s(name, MAX_PATH, L"\\s%u.dat", Thread->Index);
+  if (Thread->Handle == 0) {
+    wcscpy_s(Thread->HandleName, MAX_PATH, name);
+    Thread->Handle =
+        Thread->Reading
+            ? Create(Thread, name, FILE_OPEN, FILE_NON_DIRECTORY_FILE,
+                     FILE_GENERIC_READ)
+            : Create(Thread, name, FILE_OVERWRITE_IF, FILE_NON_DIRECTORY_FILE,
+                     FILE_GENERIC_WRITE);
+    Check(Thread, Thread->Handle != 0);
+    if (Thread->Handle == 0)
+      return;
+    Thread->Position = 0;
+  }
+
+  length = (ULONG)min(g_Options.ChunkSize,
+                      g_Options.FileSize - Thread->Position);
+  if (Thread->Reading) {
+    done = Read(Thread, Thread->Handle, name, Thread->Position, length);
+    Check(Thread, done == length && Thread->Reply.Data == Thread->Position);
+  } else {
+    done = Write(Thread, Thread->Handle, name, Thread->Position, length,
+                 Thread->Position);
+    Check(Thread, done == length);
+  }
+  Thread->Bytes += done;
+  Thread->Position += length;
+
+  if (Thread->Position >= g_Options.FileSize) {
+    CloseHandleOf(Thread, Thread->Handle, name, FALSE);
+    Thread->Handle = 0;
+    Thread->Reading = !Thread->Reading;
+  }
+}
+
+// walk
+
+// Directories of the tree, level by level
+static ULONG WalkDirectoryCount(void) {
+  ULONG count = 0;
+  ULONG level = 1;
+  ULONG i;
+
+  for (i = 0; i <= BENCH_WALK_DEPTH; ++i) {
+    count += level;
+    level *= BENCH_WALK_FANOUT;
+  }
+  return count;
+}
+
+// Name of the Number-th directory of the tree, \w for the first one
+static VOID WalkDirectoryName(ULONG Number, PWCHAR Name) {
+  ULONG digits[BENCH_WALK_DEPTH];
+  ULONG depth = 0;
+  ULONG level = 1;
+  size_t length;
+  ULONG i;
+
+  while (Number >= level) {
+    Number -= level;
+    level *= BENCH_WALK_FANOUT;
+    ++depth;
+  }
+  for (i = depth; i > 0; --i) {
+    digits[i - 1] = Number % BENCH_WALK_FANOUT;
+    Number /= BENCH_WALK_FANOUT;
+  }
+  wcscpy_s(Name, MAX_PATH, L"\\w");
+  for (i = 0; i < depth; ++i) {
+    length = wcslen(Name);
+    swprintf_s(Name + length, MAX_PATH - length, L"\\d%u", digits[i]);
+  }
+}
+
+static VOID WalkPrepare(PBENCH_THREAD Setup) {
+  WCHAR directory[MAX_PATH];
+  WCHAR name[MAX_PATH];
+  ULONG count = WalkDirectoryCount();
+  ULONG i;
+  ULONG j;
+
+  // Parents come first
+  for (i = 0; i < count; ++i) {
+    WalkDirectoryName(i, directory);
+    MakeDirectory(Setup, directory);
+    for (j = 0; j < BENCH_WALK_FILES; ++j) {
+      swprintf_s(name, MAX_PATH, j % 2 ? L"%ls\\g%u.txt" : L"%ls\\f%u.log",
+                 directory, j);
+      MakeFile(Setup, name, 0);
+    }
+  }
+}
+
+static VOID WalkOperation(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  ULONG count = WalkDirectoryCount();
+  ULONG64 step = Thread->Iteration++ + (ULONG64)Thread->Index * 7;
+  BOOL allEntries = (step / count) % 2 == 0;
+  ULONG64 handle;
+  LONG entries;
+
+  WalkDirectoryName((ULONG)(step % count), name);
+  handle = Create(Thread, name, FILE_OPEN, FILE_DIRECTORY_FILE,
+                  FILE_GENERIC_READ);
+  Check(Thread, handle != 0);
+  if (handle == 0)
+    return;
+  entries = List(Thread, handle, name, allEntries ? L"*" : L"f*.log");
+  // "*" also has the subdirectories, and . and .. below the root
+  Check(Thread, allEntries ? entries >= BENCH_WALK_FILES
+                           : entries == BENCH_WALK_FILES / 2);
+  CloseHandleOf(Thread, handle, name, FALSE);
+}
+
+// rename
+
+static VOID RenamePrepare(PBENCH_THREAD Setup) {
+  WCHAR name[MAX_PATH];
+  ULONG i;
+  ULONG j;
+
+  for (i = 0; i < Setup->Threads; ++i) {
+    swprintf_s(name, MAX_PATH, L"\\r%ua", i);
+    MakeDirectory(Setup, name);
+    swprintf_s(name, MAX_PATH, L"\\r%ub", i);
+    MakeDirectory(Setup, name);
+    for (j = 0; j < BENCH_RENAME_FILES; ++j) {
+      swprintf_s(name, MAX_PATH, L"\\r%ua\\f%u.txt", i, j);
+      MakeFile(Setup, name, 0);
+    }
+  }
+}
+
+static VOID RenameOperation(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  WCHAR newName[MAX_PATH];
+  ULONG file = (ULONG)(Thread->Iteration++ % BENCH_RENAME_FILES);
+  UCHAR side = Thread->RenameSide[file];
+  ULONG64 handle;
+
+  swprintf_s(name, MAX_PATH, L"\\r%u%lc\\f%u.txt", Thread->Index,
+             side ? L'b' : L'a', file);
+  swprintf_s(newName, MAX_PATH, L"\\r%u%lc\\f%u.txt", Thread->Index,
+             side ? L'a' : L'b', file);
+  handle = Create(Thread, name, FILE_OPEN, FILE_NON_DIRECTORY_FILE,
+                  DELETE | FILE_READ_ATTRIBUTES);
+  Check(Thread, handle != 0);
+  if (handle == 0)
+    return;
+  if (Rename(Thread, handle, name, newName) == STATUS_SUCCESS) {
+    Thread->RenameSide[file] = !side;
+    CloseHandleOf(Thread, handle, newName, FALSE);
+  } else {
+    ++Thread->Errors;
+    CloseHandleOf(Thread, handle, name, FALSE);
+  }
+}
+
+// mixed
+
+static VOID MixedPrepare(PBENCH_THREAD Setup) {
+  WCHAR name[MAX_PATH];
+  ULONG i;
+
+  MakeDirectory(Setup, L"\\m");
+  for (i = 0; i < BENCH_MIXED_FILES; ++i) {
+    swprintf_s(name, MAX_PATH, L"\\m\\f%u.dat", i);
+    MakeFile(Setup, name, BENCH_MIXED_FILE_SIZE);
+  }
+}
+
+static VOID MixedOperation(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  ULONG choice = NextRandom(Thread) % 100;
+  ULONG64 offset = (ULONG64)(NextRandom(Thread) %
+                             (BENCH_MIXED_FILE_SIZE / BENCH_MIXED_IO_SIZE)) *
+                   BENCH_MIXED_IO_SIZE;
+  ULONG64 handle;
+
+  if (choice < 80) {
+    swprintf_s(name, MAX_PATH, L"\\m\\f%u.dat",
+               NextRandom(Thread) % BENCH_MIXED_FILES);
+    handle = Create(Thread, name, FILE_OPEN, FILE_NON_DIRECTORY_FILE,
+                    FILE_GENERIC_READ | FILE_GENERIC_WRITE);
+    Check(Thread, handle != 0);
+    if (handle == 0)
+      return;
+    if (choice < 40) {
+      Check(Thread,
+            QueryInformation(Thread, handle, name, FileStandardInformation,
+                             sizeof(FILE_STANDARD_INFORMATION)) ==
+                STATUS_SUCCESS);
+    } else if (choice < 65) {
+      Thread->Bytes +=
+          Read(Thread, handle, name, offset, BENCH_MIXED_IO_SIZE);
+    } else {
+      Thread->Bytes += Write(Thread, handle, name, offset,
+                             BENCH_MIXED_IO_SIZE, offset);
+    }
+    CloseHandleOf(Thread, handle, name, FALSE);
+  } else if (choice < 90) {
+    handle = Create(Thread, L"\\m", FILE_OPEN, FILE_DIRECTORY_FILE,
+                    FILE_GENERIC_READ);
+    Check(Thread, handle != 0);
+    if (handle == 0)
+      return;
+    Check(Thread, List(Thread, handle, L"\\m", L"f1*") > 0);
+    CloseHandleOf(Thread, handle, L"\\m", FALSE);
+  } else {
+    // Temporary file, deleted on close
+    swprintf_s(name, MAX_PATH, L"\\m\\t%u.tmp", Thread->Index);
+    handle = Create(Thread, name, FILE_CREATE, FILE_NON_DIRECTORY_FILE,
+                    FILE_GENERIC_WRITE | DELETE);
+    Check(Thread, handle != 0);
+    if (handle == 0)
+      return;
+    Thread->Bytes +=
+        Write(Thread, handle, name, 0, BENCH_MIXED_IO_SIZE, offset);
+    Check(Thread, Flush(Thread, handle, name) == STATUS_SUCCESS);
+    CloseHandleOf(Thread, handle, name, TRUE);
+  }
+}
+
+// replay
+
+static BOOL LoadTrace(const char *FileName) {
+  UCHAR header[DOKAN_TRACE_FILE_HEADER_SIZE];
+  UCHAR record[DOKAN_TRACE_FILE_RECORD_SIZE];
+  DOKAN_TRACE_FILE_INFO info;
+  ULONG threadIds[BENCH_REPLAY_THREADS];
+  FILE *file;
+  ULONG i;
+  ULONG j;
+
+  file = fopen(FileName, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", FileName);
+    return FALSE;
+  }
+  if (fread(header, sizeof(header), 1, file) != 1 ||
+      !DokanTraceDecodeHeader(header, &info) || info.RecordCount == 0) {
+    fprintf(stderr, "%s is not a trace file or has no records\n", FileName);
+    fclose(file);
+    return FALSE;
+  }
+  g_ReplayEntries = (PDOKAN_TRACE_ENTRY)calloc(info.RecordCount,
+                                               sizeof(DOKAN_TRACE_ENTRY));
+  if (g_ReplayEntries == NULL) {
+    fclose(file);
+    return FALSE;
+  }
+  for (i = 0; i < info.RecordCount; ++i) {
+    if (fread(record, sizeof(record), 1, file) != 1)
+      break;
+    DokanTraceDecodeRecord(record, &g_ReplayEntries[i]);
+  }
+  fclose(file);
+  g_ReplayCount = i;
+  for (i = 0; i < g_ReplayCount; ++i) {
+    for (j = 0; j < g_ReplayThreads; ++j) {
+      if (threadIds[j] == g_ReplayEntries[i].ThreadId)
+        break;
+    }
+    if (j == g_ReplayThreads && g_ReplayThreads < BENCH_REPLAY_THREADS)
+      threadIds[g_ReplayThreads++] = g_ReplayEntries[i].ThreadId;
+    g_ReplayEntries[i].ThreadId = j % BENCH_REPLAY_THREADS;
+  }
+  return g_ReplayCount != 0;
+}
+
+static VOID ReplayName(ULONG FileNameHash, PWCHAR Name) {
+  swprintf_s(Name, MAX_PATH, L"\\replay\\h%08x", FileNameHash);
+}
+
+static VOID ReplayPrepare(PBENCH_THREAD Setup) {
+  MakeDirectory(Setup, L"\\replay");
+}
+
+// Slot of the file in the handles of the thread, opened if it was not
+static ULONG ReplayOpen(PBENCH_THREAD Thread, ULONG FileNameHash) {
+  WCHAR name[MAX_PATH];
+  ULONG slot = FileNameHash % BENCH_REPLAY_HANDLES;
+
+  if (Thread->ReplayHandles[slot] != 0 &&
+      Thread->ReplayHashes[slot] == FileNameHash)
+    return slot;
+  if (Thread->ReplayHandles[slot] != 0) {
+    ReplayName((ULONG)Thread->ReplayHashes[slot], name);
+    CloseHandleOf(Thread, Thread->ReplayHandles[slot], name, FALSE);
+  }
+  ReplayName(FileNameHash, name);
+  Thread->ReplayHashes[slot] = FileNameHash;
+  Thread->ReplayOffsets[slot] = 0;
+  Thread->ReplayHandles[slot] =
+      Create(Thread, name, FILE_OPEN_IF, FILE_NON_DIRECTORY_FILE,
+             FILE_GENERIC_READ | FILE_GENERIC_WRITE);
+  Check(Thread, Thread->ReplayHandles[slot] != 0);
+  return slot;
+}
+
+// Payload of a read or write of Bytes bytes of the trace
+static ULONG ReplayLength(ULONG Bytes, ULONG Header) {
+  if (Bytes <= Header)
+    return BENCH_MIXED_IO_SIZE;
+  return min(Bytes - Header, BENCH_REPLAY_MAX_LENGTH);
+}
+
+static VOID ReplayOperation(PBENCH_THREAD Thread) {
+  PDOKAN_TRACE_ENTRY entry;
+  WCHAR name[MAX_PATH];
+  ULONG64 handle;
+  ULONG slot;
+  ULONG length;
+
+  // Each thread replays the records of the recorded threads it stands for,
+  // recorded threads are shared when there are less of them
+  do {
+    entry = &g_ReplayEntries[Thread->ReplayNext++ % g_ReplayCount];
+  } while (g_ReplayThreads >= Thread->Threads
+               ? entry->ThreadId % Thread->Threads != Thread->Index
+               : entry->ThreadId != Thread->Index % g_ReplayThreads);
+
+  ReplayName(entry->FileNameHash, name);
+  switch (entry->MajorFunction) {
+  case IRP_MJ_CREATE:
+    ReplayOpen(Thread, entry->FileNameHash);
+    break;
+  case IRP_MJ_CLEANUP:
+  case IRP_MJ_CLOSE:
+    slot = entry->FileNameHash % BENCH_REPLAY_HANDLES;
+    if (Thread->ReplayHandles[slot] != 0 &&
+        Thread->ReplayHashes[slot] == entry->FileNameHash) {
+      CloseHandleOf(Thread, Thread->ReplayHandles[slot], name, FALSE);
+      Thread->ReplayHandles[slot] = 0;
+    }
+    break;
+  case IRP_MJ_READ:
+    slot = ReplayOpen(Thread, entry->FileNameHash);
+    if (Thread->ReplayHandles[slot] == 0)
+      break;
+    length = ReplayLength(entry->BytesOut, sizeof(EVENT_INFORMATION) - 8);
+    Thread->Bytes += Read(Thread, Thread->ReplayHandles[slot], name,
+                          Thread->ReplayOffsets[slot], length);
+    Thread->ReplayOffsets[slot] += length;
+    break;
+  case IRP_MJ_WRITE:
+    slot = ReplayOpen(Thread, entry->FileNameHash);
+    if (Thread->ReplayHandles[slot] == 0)
+      break;
+    length = ReplayLength(entry->BytesIn, sizeof(EVENT_CONTEXT));
+    Thread->Bytes += Write(Thread, Thread->ReplayHandles[slot], name,
+                           Thread->ReplayOffsets[slot], length, 0);
+    Thread->ReplayOffsets[slot] += length;
+    break;
+  case IRP_MJ_QUERY_INFORMATION:
+    slot = ReplayOpen(Thread, entry->FileNameHash);
+    if (Thread->ReplayHandles[slot] != 0)
+      QueryInformation(Thread, Thread->ReplayHandles[slot], name,
+                       FileStandardInformation,
+                       sizeof(FILE_STANDARD_INFORMATION));
+    break;
+  case IRP_MJ_SET_INFORMATION:
+    slot = ReplayOpen(Thread, entry->FileNameHash);
+    if (Thread->ReplayHandles[slot] != 0)
+      SetBasicInformation(Thread, Thread->ReplayHandles[slot], name);
+    break;
+  case IRP_MJ_FLUSH_BUFFERS:
+    slot = ReplayOpen(Thread, entry->FileNameHash);
+    if (Thread->ReplayHandles[slot] != 0)
+      Flush(Thread, Thread->ReplayHandles[slot], name);
+    break;
+  case IRP_MJ_DIRECTORY_CONTROL:
+    handle = Create(Thread, L"\\replay", FILE_OPEN, FILE_DIRECTORY_FILE,
+                    FILE_GENERIC_READ);
+    Check(Thread, handle != 0);
+    if (handle == 0)
+      break;
+    List(Thread, handle, L"\\replay", L"*");
+    CloseHandleOf(Thread, handle, L"\\replay", FALSE);
+    break;
+  case IRP_MJ_QUERY_VOLUME_INFORMATION:
+    QueryVolumeInformation(Thread);
+    break;
+  default:
+    // Locks and security are not replayed
+    break;
+  }
+}
+
+static VOID ReplayFinish(PBENCH_THREAD Thread) {
+  WCHAR name[MAX_PATH];
+  ULONG i;
+
+  for (i = 0; i < BENCH_REPLAY_HANDLES; ++i) {
+    if (Thread->ReplayHandles[i] == 0)
+      continue;
+    ReplayName((ULONG)Thread->ReplayHashes[i], name);
+    CloseHandleOf(Thread, Thread->ReplayHandles[i], name, FALSE);
+    Thread->ReplayHandles[i] = 0;
+  }
+}
+
+// block and pend
+
+// Waits until the performance counter reaches Deadline
+static VOID WaitUntil(LONGLONG Deadline) {
+  LARGE_INTEGER now;
+
+  for (;;) {
+    QueryPerformanceCounter(&now);
+    if (now.QuadPart >= Deadline)
+      break;
+    if (Deadline - now.QuadPart > g_Frequency / 1000)
+      Sleep(1);
+    else
+      SwitchToThread();
+  }
+}
+
+static NTSTATUS PendRequest(BOOL Write, LPCVOID Buffer, DWORD Length,
+                            LONGLONG Offset, PDOKAN_FILE_INFO DokanFileInfo) {
+  PBENCH_PENDED pended;
+
+  pended = (PBENCH_PENDED)malloc(sizeof(BENCH_PENDED) + (Write ? Length : 0));
+  if (pended == NULL)
+    return STATUS_INSUFFICIENT_RESOURCES;
+  pended->Request = DokanPendRequest(DokanFileInfo);
+  if (pended->Request == NULL) {
+    free(pended);
+    return STATUS_INTERNAL_ERROR;
+  }
+  pended->Thread = g_CurrentThread;
+  pended->Write = Write;
+  // The write buffer is only valid until the callback returns
+  if (Write) {
+    pended->Buffer = pended + 1;
+    CopyMemory(pended->Buffer, Buffer, Length);
+  } else {
+    pended->Buffer = (PVOID)Buffer;
+  }
+  pended->Length = Length;
+  pended->Offset = Offset;
+  pended->FileInfo = *DokanFileInfo;
+  pended->Start = g_CurrentThread->DispatchStart;
+  pended->Deadline = pended->Start + g_LatencyTicks;
+  pended->Next = NULL;
+  g_CurrentThread->Pended = TRUE;
+
+  EnterCriticalSection(&g_PendedLock);
+  *g_PendedTail = pended;
+  g_PendedTail = &pended->Next;
+  LeaveCriticalSection(&g_PendedLock);
+  return STATUS_PENDING;
+}
+
+static NTSTATUS DOKAN_CALLBACK LatencyReadFile(LPCWSTR FileName, LPVOID Buffer,
+                                               DWORD BufferLength,
+                                               LPDWORD ReadLength,
+                                               LONGLONG Offset,
+                                               PDOKAN_FILE_INFO DokanFileInfo) {
+  LARGE_INTEGER now;
+
+  if (g_Backend == BENCH_BACKEND_PEND) {
+    *ReadLength = 0;
+    return PendRequest(FALSE, Buffer, BufferLength, Offset, DokanFileInfo);
+  }
+  if (g_Backend == BENCH_BACKEND_BLOCK) {
+    QueryPerformanceCounter(&now);
+    WaitUntil(now.QuadPart + g_LatencyTicks);
+  }
+  return g_MemoryFs.ReadFile(FileName, Buffer, BufferLength, ReadLength,
+                             Offset, DokanFileInfo);
+}
+
+static NTSTATUS DOKAN_CALLBACK LatencyWriteFile(LPCWSTR FileName,
+                                                LPCVOID Buffer,
+                                                DWORD NumberOfBytesToWrite,
+                                                LPDWORD NumberOfBytesWritten,
+                                                LONGLONG Offset,
+                                                PDOKAN_FILE_INFO DokanFileInfo) {
+  LARGE_INTEGER now;
+
+  if (g_Backend == BENCH_BACKEND_PEND) {
+    *NumberOfBytesWritten = 0;
+    return PendRequest(TRUE, Buffer, NumberOfBytesToWrite, Offset,
+                       DokanFileInfo);
+  }
+  if (g_Backend == BENCH_BACKEND_BLOCK) {
+    QueryPerformanceCounter(&now);
+    WaitUntil(now.QuadPart + g_LatencyTicks);
+  }
+  return g_MemoryFs.WriteFile(FileName, Buffer, NumberOfBytesToWrite,
+                              NumberOfBytesWritten, Offset, DokanFileInfo);
+}
+
+// Completes the pended requests once their deadline is reached, oldest first
+static unsigned __stdcall CompletionThread(void *Parameter) {
+  PBENCH_COMPLETION completion = (PBENCH_COMPLETION)Parameter;
+  PBENCH_PENDED pended;
+  PBENCH_THREAD thread;
+  LARGE_INTEGER now;
+  LONGLONG deadline;
+  ULONG64 latency;
+  DWORD bytes;
+  NTSTATUS status;
+
+  for (;;) {
+    deadline = 0;
+    EnterCriticalSection(&g_PendedLock);
+    pended = g_PendedHead;
+    if (pended != NULL) {
+      QueryPerformanceCounter(&now);
+      if (pended->Deadline <= now.QuadPart) {
+        g_PendedHead = pended->Next;
+        if (g_PendedHead == NULL)
+          g_PendedTail = &g_PendedHead;
+      } else {
+        deadline = pended->Deadline;
+        pended = NULL;
+      }
+    }
+    LeaveCriticalSection(&g_PendedLock);
+    if (pended == NULL) {
+      if (deadline != 0)
+        WaitUntil(min(deadline, now.QuadPart + g_Frequency / 1000));
+      else if (g_StopCompletions)
+        break;
+      else
+        SwitchToThread();
+      continue;
+    }
+
+    bytes = 0;
+    if (pended->Write)
+      status = g_MemoryFs.WriteFile(L"", pended->Buffer, pended->Length,
+                                    &bytes, pended->Offset,
+                                    &pended->FileInfo);
+    else
+      status = g_MemoryFs.ReadFile(L"", pended->Buffer, pended->Length,
+                                   &bytes, pended->Offset, &pended->FileInfo);
+    if (status != STATUS_SUCCESS || bytes != pended->Length ||
+        !DokanCompleteRequest(pended->Request, status, bytes))
+      ++completion->Errors;
+    QueryPerformanceCounter(&now);
+    latency = (ULONG64)(now.QuadPart - pended->Start) * 1000000000 /
+              (ULONG64)g_Frequency;
+    completion->Samples[completion->SampleCount % BENCH_MAX_SAMPLES] =
+        (ULONG)min(latency, MAXULONG);
+    ++completion->SampleCount;
+    thread = pended->Thread;
+    free(pended);
+    InterlockedDecrement(&thread->InFlight);
+  }
+  return 0;
+}
+
+static VOID LatencyPrepare(PBENCH_THREAD Setup) {
+  WCHAR name[MAX_PATH];
+  ULONG i;
+
+  for (i = 0; i < Setup->Threads; ++i) {
+    swprintf_s(name, MAX_PATH, L"\\l%u.dat", i);
+    MakeFile(Setup, name, BENCH_LATENCY_FILE_SIZE);
+  }
+}
+
+static VOID LatencyOperation(PBENCH_THREAD Thread) {
+  ULONG64 offset;
+  ULONG done;
+
+  if (Thread->Handle == 0) {
+    swprintf_s(Thread->HandleName, MAX_PATH, L"\\l%u.dat", Thread->Index);
+    Thread->Handle = Create(Thread, Thread->HandleName, FILE_OPEN,
+                            FILE_NON_DIRECTORY_FILE,
+                            FILE_GENERIC_READ | FILE_GENERIC_WRITE);
+    Check(Thread, Thread->Handle != 0);
+    if (Thread->Handle == 0)
+      return;
+  }
+
+  // The completions free the places of the pended requests
+  while (g_Backend == BENCH_BACKEND_PEND &&
+         Thread->InFlight >= (LONG)g_Options.QueueDepth && !g_Stop)
+    SwitchToThread();
+  if (g_Stop)
+    return;
+
+  offset = (ULONG64)(NextRandom(Thread) %
+                     (BENCH_LATENCY_FILE_SIZE / BENCH_MIXED_IO_SIZE)) *
+           BENCH_MIXED_IO_SIZE;
+  if (g_Backend == BENCH_BACKEND_PEND)
+    InterlockedIncrement(&Thread->InFlight);
+  if (NextRandom(Thread) % 2)
+    done = Read(Thread, Thread->Handle, Thread->HandleName, offset,
+                BENCH_MIXED_IO_SIZE);
+  else
+    done = Write(Thread, Thread->Handle, Thread->HandleName, offset,
+                 BENCH_MIXED_IO_SIZE, offset);
+  // The completion thread checks the pended ones
+  if (Thread->Pended) {
+    done = BENCH_MIXED_IO_SIZE;
+  } else if (g_Backend == BENCH_BACKEND_PEND) {
+    InterlockedDecrement(&Thread->InFlight);
+  }
+  Check(Thread, done == BENCH_MIXED_IO_SIZE);
+  Thread->Bytes += done;
+}
+
+static const BENCH_SCENARIO g_Scenarios[] = {
+    {"create", CreatePrepare, CreateOperation, BENCH_BACKEND_MEMORY},
+    {"seq", NULL, SequentialOperation, BENCH_BACKEND_MEMORY},
+    {"walk", WalkPrepare, WalkOperation, BENCH_BACKEND_MEMORY},
+    {"rename", RenamePrepare, RenameOperation, BENCH_BACKEND_MEMORY},
+    {"mixed", MixedPrepare, MixedOperation, BENCH_BACKEND_MEMORY},
+    {"replay", ReplayPrepare, ReplayOperation, BENCH_BACKEND_MEMORY},
+    {"block", LatencyPrepare, LatencyOperation, BENCH_BACKEND_BLOCK},
+    {"pend", LatencyPrepare, LatencyOperation, BENCH_BACKEND_PEND},
+};
+
+static BOOL InitThread(PBENCH_THREAD Thread, ULONG Index, ULONG Threads,
+                       PDOKAN_INSTANCE DokanInstance) {
+  ZeroMemory(Thread, sizeof(BENCH_THREAD));
+  Thread->Index = Index;
+  Thread->Threads = Threads;
+  Thread->DokanInstance = DokanInstance;
+  Thread->Device.Reply = BenchReply;
+  Thread->Device.Context = Thread;
+  Thread->Random = 2463534242U + Index * 7919;
+  Thread->Event = (PEVENT_CONTEXT)malloc(EVENT_CONTEXT_MAX_SIZE);
+  Thread->WriteEvent = (PEVENT_CONTEXT)malloc(
+      EVENT_CONTEXT_MAX_SIZE + max(g_Options.ChunkSize,
+                                   BENCH_REPLAY_MAX_LENGTH));
+  Thread->Samples = (ULONG *)calloc(BENCH_MAX_SAMPLES, sizeof(ULONG));
+  return Thread->Event != NULL && Thread->WriteEvent != NULL &&
+         Thread->Samples != NULL;
+}
+
+static VOID FreeThread(PBENCH_THREAD Thread) {
+  free(Thread->Event);
+  free(Thread->WriteEvent);
+  free(Thread->Samples);
+}
+
+typedef struct _BENCH_WORKER {
+  PBENCH_THREAD Thread;
+  const BENCH_SCENARIO *Scenario;
+} BENCH_WORKER;
+
+static unsigned __stdcall BenchThread(void *Parameter) {
+  BENCH_WORKER *worker = (BENCH_WORKER *)Parameter;
+  PBENCH_THREAD thread = worker->Thread;
+
+  g_CurrentThread = thread;
+  while (!g_Stop) {
+    worker->Scenario->Operation(thread);
+    ++thread->Operations;
+  }
+  while (thread->InFlight != 0)
+    SwitchToThread();
+  if (thread->Handle != 0) {
+    CloseHandleOf(thread, thread->Handle, thread->HandleName, FALSE);
+    thread->Handle = 0;
+  }
+  ReplayFinish(thread);
+  // Like DokanLoop, the trace ring goes to the next thread
+  DokanTraceThreadStopped();
+  return 0;
+}
+
+static int CompareSamples(const void *First, const void *Second) {
+  ULONG first = *(const ULONG *)First;
+  ULONG second = *(const ULONG *)Second;
+  return first < second ? -1 : first > second;
+}
+
+static double Percentile(const ULONG *Samples, ULONG64 Count, double Percent) {
+  ULONG64 index;
+
+  if (Count == 0)
+    return 0;
+  index = (ULONG64)(Count * Percent / 100.0);
+  if (index >= Count)
+    index = Count - 1;
+  return Samples[index] / 1000.0;
+}
+
+static BOOL RunScenario(const BENCH_SCENARIO *Scenario, ULONG Threads,
+                        FILE *Results) {
+  DOKAN_OPERATIONS operations;
+  DOKAN_OPTIONS options;
+  FAKE_DEVICE asyncDevice;
+  PDOKAN_INSTANCE instance;
+  BENCH_THREAD setup;
+  PBENCH_THREAD threads;
+  BENCH_WORKER workers[BENCH_MAX_THREADS];
+  HANDLE handles[BENCH_MAX_THREADS];
+  BENCH_COMPLETION completions[BENCH_COMPLETION_THREADS];
+  HANDLE completionHandles[BENCH_COMPLETION_THREADS];
+  ULONG completionThreads = 0;
+  BENCH_THREAD total;
+  ULONG *samples;
+  ULONG64 sampleCount = 0;
+  LONG64 callbacks;
+  LARGE_INTEGER start;
+  LARGE_INTEGER end;
+  double elapsed;
+  ULONG i;
+
+  ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+  options.Version = DOKAN_VERSION;
+  options.Options = g_Options.DokanOptions;
+  ZeroMemory(&asyncDevice, sizeof(FAKE_DEVICE));
+  MemoryFsInit(&operations);
+  g_MemoryFs = operations;
+  operations.ReadFile = LatencyReadFile;
+  operations.WriteFile = LatencyWriteFile;
+  g_Backend = BENCH_BACKEND_MEMORY;
+  instance = FakeDeviceCreateInstance(&options, &operations, &asyncDevice);
+  threads = (PBENCH_THREAD)calloc(Threads, sizeof(BENCH_THREAD));
+  if (instance == NULL || threads == NULL ||
+      !InitThread(&setup, 0, Threads, instance)) {
+    fprintf(stderr, "not enough memory\n");
+    return FALSE;
+  }
+
+  if (Scenario->Prepare != NULL)
+    Scenario->Prepare(&setup);
+
+  g_Backend = Scenario->Backend;
+  g_Stop = 0;
+  g_StopCompletions = 0;
+  if (g_Backend == BENCH_BACKEND_PEND)
+    completionThreads = BENCH_COMPLETION_THREADS;
+  for (i = 0; i < completionThreads; ++i) {
+    ZeroMemory(&completions[i], sizeof(BENCH_COMPLETION));
+    completions[i].Samples = (ULONG *)calloc(BENCH_MAX_SAMPLES, sizeof(ULONG));
+    completionHandles[i] =
+        completions[i].Samples != NULL
+            ? (HANDLE)_beginthreadex(NULL, 0, CompletionThread,
+                                     &completions[i], 0, NULL)
+            : NULL;
+    if (completionHandles[i] == NULL) {
+      fprintf(stderr, "cannot start completion thread %lu\n",
+              (unsigned long)i);
+      return FALSE;
+    }
+  }
+  QueryPerformanceCounter(&start);
+  callbacks = MemoryFsCallCount();
+  for (i = 0; i < Threads; ++i) {
+    if (!InitThread(&threads[i], i, Threads, instance)) {
+      fprintf(stderr, "not enough memory\n");
+      return FALSE;
+    }
+    workers[i].Thread = &threads[i];
+    workers[i].Scenario = Scenario;
+    handles[i] =
+        (HANDLE)_beginthreadex(NULL, 0, BenchThread, &workers[i], 0, NULL);
+    if (handles[i] == NULL) {
+      fprintf(stderr, "cannot start thread %lu\n", (unsigned long)i);
+      return FALSE;
+    }
+  }
+  Sleep((DWORD)(g_Options.Seconds * 1000));
+  InterlockedExchange(&g_Stop, 1);
+  for (i = 0; i < Threads; ++i) {
+    WaitForSingleObject(handles[i], INFINITE);
+    CloseHandle(handles[i]);
+  }
+  QueryPerformanceCounter(&end);
+  InterlockedExchange(&g_StopCompletions, 1);
+  for (i = 0; i < completionThreads; ++i) {
+    WaitForSingleObject(completionHandles[i], INFINITE);
+    CloseHandle(completionHandles[i]);
+  }
+  callbacks = MemoryFsCallCount() - callbacks;
+  elapsed = (double)(end.QuadPart - start.QuadPart) / (double)g_Frequency;
+
+  ZeroMemory(&total, sizeof(BENCH_THREAD));
+  total.Errors = setup.Errors;
+  samples = (ULONG *)malloc(sizeof(ULONG) * BENCH_MAX_SAMPLES *
+                           (Threads + completionThreads));
+  for (i = 0; i < Threads; ++i) {
+    ULONG64 count = min(threads[i].SampleCount, BENCH_MAX_SAMPLES);
+    total.Operations += threads[i].Operations;
+    total.Requests += threads[i].Requests;
+    total.Allocations += threads[i].Allocations;
+    total.Bytes += threads[i].Bytes;
+    total.Errors += threads[i].Errors;
+    if (samples != NULL)
+      CopyMemory(samples + sampleCount, threads[i].Samples,
+                 (size_t)count * sizeof(ULONG));
+    sampleCount += count;
+    FreeThread(&threads[i]);
+  }
+  for (i = 0; i < completionThreads; ++i) {
+    ULONG64 count = min(completions[i].SampleCount, BENCH_MAX_SAMPLES);
+    total.Errors += completions[i].Errors;
+    if (samples != NULL)
+      CopyMemory(samples + sampleCount, completions[i].Samples,
+                 (size_t)count * sizeof(ULONG));
+    sampleCount += count;
+    free(completions[i].Samples);
+  }
+  if (samples == NULL)
+    sampleCount = 0;
+  else
+    qsort(samples, (size_t)sampleCount, sizeof(ULONG), CompareSamples);
+
+  printf("%-7s %7lu %10.0f %10.0f %8.1f %8.2f %8.2f %8.2f", Scenario->Name,
+         (unsigned long)Threads, total.Operations / elapsed,
+         total.Requests / elapsed, total.Bytes / elapsed / (1024 * 1024),
+         Percentile(samples, sampleCount, 50),
+         Percentile(samples, sampleCount, 99),
+         Percentile(samples, sampleCount, 99.9));
+  if (BENCH_COUNTS_ALLOCATIONS)
+    printf(" %8.2f", total.Requests
+                         ? (double)total.Allocations / total.Requests
+                         : 0);
+  else
+    printf(" %8s", "-");
+  printf(" %8.2f %6llu\n",
+         total.Requests ? (double)callbacks / total.Requests : 0,
+         (unsigned long long)total.Errors);
+
+  if (Results != NULL) {
+    fprintf(Results,
+            "{\"scenario\":\"%s\",\"threads\":%lu,\"seconds\":%.3f,"
+            "\"operations\":%llu,\"requests\":%llu,\"opsPerSecond\":%.1f,"
+            "\"requestsPerSecond\":%.1f,\"bytesPerSecond\":%.1f,"
+            "\"p50Us\":%.3f,\"p99Us\":%.3f,\"p999Us\":%.3f,",
+            Scenario->Name, (unsigned long)Threads, elapsed,
+            (unsigned long long)total.Operations,
+            (unsigned long long)total.Requests, total.Operations / elapsed,
+            total.Requests / elapsed, total.Bytes / elapsed,
+            Percentile(samples, sampleCount, 50),
+            Percentile(samples, sampleCount, 99),
+            Percentile(samples, sampleCount, 99.9));
+    if (BENCH_COUNTS_ALLOCATIONS && total.Requests)
+      fprintf(Results, "\"allocationsPerRequest\":%.3f,",
+              (double)total.Allocations / total.Requests);
+    else
+      fprintf(Results, "\"allocationsPerRequest\":null,");
+    if (Scenario->Backend != BENCH_BACKEND_MEMORY)
+      fprintf(Results, "\"latencyUs\":%lu,\"queueDepth\":%lu,",
+              (unsigned long)g_Options.LatencyUs,
+              (unsigned long)(Scenario->Backend == BENCH_BACKEND_PEND
+                                  ? g_Options.QueueDepth
+                                  : 1));
+    fprintf(Results,
+            "\"callbacksPerRequest\":%.3f,\"options\":%lu,\"errors\":%llu}\n",
+            total.Requests ? (double)callbacks / total.Requests : 0,
+            (unsigned long)g_Options.DokanOptions,
+            (unsigned long long)total.Errors);
+    fflush(Results);
+  }
+
+  free(samples);
+  free(threads);
+  FreeThread(&setup);
+  FakeDeviceDeleteInstance(instance);
+  MemoryFsCleanup();
+  return total.Errors == 0;
+}
+
+static BOOL ParseOptions(int argc, char *argv[]) {
+  const char *value;
+  char *end;
+  int i;
+
+  g_Options.Threads[0] = 1;
+  g_Options.Threads[1] = 4;
+  g_Options.ThreadCounts = 2;
+  strcpy(g_Options.Scenarios, "create,seq,walk,rename,mixed");
+  g_Options.Seconds = 2;
+  g_Options.ChunkSize = 64 * 1024;
+  g_Options.FileSize = 16 * 1024 * 1024;
+  g_Options.LatencyUs = 100;
+  g_Options.QueueDepth = 16;
+
+  for (i = 1; i < argc; ++i) {
+    if (i + 1 == argc || strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-'))
+      return FALSE;
+    value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 't':
+      g_Options.ThreadCounts = 0;
+      while (*value != '\0' && g_Options.ThreadCounts < BENCH_MAX_THREADS) {
+        ULONG threads = strtoul(value, &end, 10);
+        if (threads == 0 || threads > BENCH_MAX_THREADS ||
+            (*end != ',' && *end != '\0'))
+          return FALSE;
+        g_Options.Threads[g_Options.ThreadCounts++] = threads;
+        value = *end == ',' ? end + 1 : end;
+      }
+      break;
+    case 's':
+      if (strlen(value) >= 256)
+        return FALSE;
+      strcpy(g_Options.Scenarios, value);
+      break;
+    case 'd':
+      g_Options.Seconds = atof(value);
+      break;
+    case 'c':
+      g_Options.ChunkSize = strtoul(value, NULL, 10) * 1024;
+      break;
+    case 'f':
+      g_Options.FileSize = (ULONG64)strtoul(value, NULL, 10) * 1024 * 1024;
+      break;
+    case 'o':
+      g_Options.DokanOptions = strtoul(value, NULL, 0);
+      break;
+    case 'r':
+      g_Options.ReplayFile = value;
+      break;
+    case 'x':
+      g_Options.TraceFile = value;
+      break;
+    case 'j':
+      g_Options.ResultFile = value;
+      break;
+    case 'l':
+      g_Options.LatencyUs = strtoul(value, NULL, 10);
+      g_Options.Latency = TRUE;
+      break;
+    case 'q':
+      g_Options.QueueDepth = strtoul(value, NULL, 10);
+      break;
+    default:
+      return FALSE;
+    }
+  }
+  return g_Options.ThreadCounts > 0 && g_Options.Seconds > 0 &&
+         g_Options.QueueDepth > 0 &&
+         g_Options.ChunkSize > 0 &&
+         g_Options.ChunkSize <= BENCH_REPLAY_MAX_LENGTH &&
+         g_Options.FileSize >= g_Options.ChunkSize;
+}
+
+// Whether Name is in the comma separated List
+static BOOL InList(const char *List, const char *Name) {
+  size_t length = strlen(Name);
+  const char *p = List;
+
+  while ((p = strstr(p, Name)) != NULL) {
+    if ((p == List || p[-1] == ',') && (p[length] == ',' || p[length] == 0))
+      return TRUE;
+    p += length;
+  }
+  return FALSE;
+}
+
+int main(int argc, char *argv[]) {
+  LARGE_INTEGER frequency;
+  FILE *results = NULL;
+  WCHAR traceFile[MAX_PATH];
+  BOOL passed = TRUE;
+  ULONG i;
+  ULONG j;
+
+  if (!ParseOptions(argc, argv)) {
+    fprintf(stderr,
+            "dispatch_bench [/s create,seq,walk,rename,mixed] [/t 1,4] "
+            "[/d Seconds]\n"
+            "               [/c ChunkKB] [/f FileMB] [/o Options] "
+            "[/r TraceFile]\n"
+            "               [/x TraceFile] [/j ResultFile] [/l LatencyUs] "
+            "[/q Depth]\n");
+    return EXIT_FAILURE;
+  }
+  if (g_Options.ReplayFile != NULL) {
+    if (!LoadTrace(g_Options.ReplayFile))
+      return EXIT_FAILURE;
+    if (!InList(g_Options.Scenarios, "replay"))
+      strcat(g_Options.Scenarios, ",replay");
+  }
+  if (g_Options.Latency) {
+    if (!InList(g_Options.Scenarios, "block"))
+      strcat(g_Options.Scenarios, ",block");
+    if (!InList(g_Options.Scenarios, "pend"))
+      strcat(g_Options.Scenarios, ",pend");
+  }
+  if (g_Options.ResultFile != NULL) {
+    results = fopen(g_Options.ResultFile, "w");
+    if (results == NULL) {
+      fprintf(stderr, "cannot create %s\n", g_Options.ResultFile);
+      return EXIT_FAILURE;
+    }
+  }
+
+  QueryPerformanceFrequency(&frequency);
+  g_Frequency = frequency.QuadPart;
+  g_LatencyTicks = (LONGLONG)g_Options.LatencyUs * g_Frequency / 1000000;
+  InitializeCriticalSection(&g_PendedLock);
+  FakeDeviceInit();
+
+  printf("%-7s %7s %10s %10s %8s %8s %8s %8s %8s %8s %6s\n", "run",
+         "threads", "ops/s", "req/s", "MB/s", "p50(us)", "p99(us)",
+         "p999(us)", "alloc/rq", "calls/rq", "errors");
+  for (i = 0; i < sizeof(g_Scenarios) / sizeof(g_Scenarios[0]); ++i) {
+    if (!InList(g_Options.Scenarios, g_Scenarios[i].Name))
+      continue;
+    if (g_Scenarios[i].Operation == ReplayOperation && g_ReplayCount == 0)
+      continue;
+    for (j = 0; j < g_Options.ThreadCounts; ++j)
+      passed &= RunScenario(&g_Scenarios[i], g_Options.Threads[j], results);
+  }
+
+  if (g_Options.TraceFile != NULL) {
+    if (mbstowcs(traceFile, g_Options.TraceFile, MAX_PATH) >= MAX_PATH ||
+        !DokanDumpTrace(traceFile)) {
+      fprintf(stderr, "cannot write %s\n", g_Options.TraceFile);
+      passed = FALSE;
+    }
+  }
+  if (results != NULL)
+    fclose(results);
+  free(g_ReplayEntries);
+  DeleteCriticalSection(&g_PendedLock);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,496 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Portable benchmark of dokan/dokan_task.hpp against a simulated device
+// channel, to size the coroutine front-end without a mounted volume:
+//   blocking  - LoopThreads threads each wait for the backend, like plain
+//               DokanLoop threads
+//   threads   - one thread per request in flight, the thread-per-request
+//               bridge a coroutine backend needs without the front-end
+//   coroutine - LoopThreads threads run the read coroutine inline and hand it
+//               over when it suspends, like DokanPendRequest, and Workers
+//               executor threads complete it, like DokanCompleteRequest
+// Clients keep one read each in flight on the channel. The backend answers
+// HitPercent of the reads at once and the others after Latency.
+//
+// Build it with a C++20 compiler:
+//   cl /O2 /EHsc /std:c++20 coroutine_bench.cpp
+//   g++ -O2 -std=c++20 -pthread coroutine_bench.cpp -o coroutine_bench
+//
+// coroutine_bench [/c 16,64,256] [/t LoopThreads] [/w Workers]
+//                 [/l LatencyUs] [/h HitPercent] [/d Seconds]
+
+#include "../../dokan/dokan_task.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> g_Allocations{0};
+
+} // namespace
+
+// g++ pairs the inlined malloc and free of the replacements below with the
+// new and delete expressions and reports them as mismatched
+#if defined(__GNUC__) && !defined(__clang__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+// Counts the allocations made while requests are served
+BENCH_NOINLINE void *operator new(std::size_t size) {
+  g_Allocations.fetch_add(1, std::memory_order_relaxed);
+  void *memory = std::malloc(size != 0 ? size : 1);
+  if (memory == nullptr)
+    throw std::bad_alloc();
+  return memory;
+}
+BENCH_NOINLINE void operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+BENCH_NOINLINE void operator delete(void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const uint32_t kReadSize = 4096;
+const uint32_t kFileSize = 1 << 20;
+const size_t kMaxSamples = 1 << 20;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct IoResult {
+  int32_t status;
+  uint32_t bytes;
+};
+
+struct Client;
+
+// A read sent by the driver to user mode
+struct Event {
+  Client *client = nullptr;
+  int64_t offset = 0;
+  uint32_t length = 0;
+  char *buffer = nullptr;
+  uint64_t submitNs = 0;
+  IoResult result{0, 0};
+};
+
+struct Client {
+  std::binary_semaphore done{0};
+  Event event;
+  std::vector<char> buffer = std::vector<char>(kReadSize);
+  std::vector<uint32_t> latencyUs;
+  uint64_t operations = 0;
+};
+
+// Driver side of the channel: events wait here for a DokanLoop thread
+class SimChannel {
+public:
+  void Submit(Event *Event_) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      queue_.push_back(Event_);
+    }
+    condition_.notify_one();
+  }
+
+  // Blocks like IOCTL_EVENT_WAIT, returns nullptr once the channel is closed
+  Event *Wait() {
+    std::unique_lock<std::mutex> guard(lock_);
+    condition_.wait(guard, [this] { return closed_ || !queue_.empty(); });
+    if (queue_.empty())
+      return nullptr;
+    Event *event = queue_.front();
+    queue_.pop_front();
+    return event;
+  }
+
+  void Close() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      closed_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  // IOCTL_EVENT_INFO, completes the IRP of the client
+  static void Reply(Event *Event_, IoResult Result) {
+    Event_->result = Result;
+    Event_->client->done.release();
+  }
+
+private:
+  std::mutex lock_;
+  std::condition_variable condition_;
+  std::deque<Event *> queue_;
+  bool closed_ = false;
+};
+
+// Example backend: a 1 MB file of which HitPercent of the pages are cached,
+// the others are fetched from a remote storage that takes Latency
+class LatencyBackend {
+public:
+  LatencyBackend(dokan::executor *Executor, std::chrono::microseconds Latency,
+                 unsigned HitPercent)
+      : executor_(Executor), latency_(Latency), hitPercent_(HitPercent),
+        data_(kFileSize) {
+    for (uint32_t i = 0; i < kFileSize; ++i)
+      data_[i] = static_cast<char>(i * 31);
+  }
+
+  dokan::task<IoResult> Read(char *Buffer, uint32_t Length, int64_t Offset) {
+    if (!Cached(Offset))
+      co_await executor_->sleep_for(latency_);
+    co_return Copy(Buffer, Length, Offset);
+  }
+
+  IoResult ReadBlocking(char *Buffer, uint32_t Length, int64_t Offset) {
+    if (!Cached(Offset))
+      std::this_thread::sleep_for(latency_);
+    return Copy(Buffer, Length, Offset);
+  }
+
+private:
+  bool Cached(int64_t Offset) const {
+    uint64_t page = static_cast<uint64_t>(Offset) / kReadSize;
+    return (page * 2654435761u) % 100 < hitPercent_;
+  }
+
+  IoResult Copy(char *Buffer, uint32_t Length, int64_t Offset) const {
+    if (Offset >= kFileSize)
+      return IoResult{0, 0};
+    uint32_t bytes = std::min<uint32_t>(
+        Length, kFileSize - static_cast<uint32_t>(Offset));
+    std::memcpy(Buffer, &data_[static_cast<size_t>(Offset)], bytes);
+    return IoResult{0, bytes};
+  }
+
+  dokan::executor *executor_;
+  std::chrono::microseconds latency_;
+  unsigned hitPercent_;
+  std::vector<char> data_;
+};
+
+enum class Mode { Blocking, Threads, Coroutine };
+
+const char *ModeName(Mode Mode_) {
+  switch (Mode_) {
+  case Mode::Blocking:
+    return "blocking";
+  case Mode::Threads:
+    return "threads";
+  default:
+    return "coroutine";
+  }
+}
+
+struct LoopStats {
+  uint64_t inlineCompletions = 0;
+  uint64_t pended = 0;
+};
+
+void BlockingLoop(SimChannel &Channel, LatencyBackend &Backend) {
+  while (Event *event = Channel.Wait())
+    SimChannel::Reply(event, Backend.ReadBlocking(event->buffer, event->length,
+                                                  event->offset));
+}
+
+void CoroutineLoop(SimChannel &Channel, LatencyBackend &Backend,
+                   LoopStats &Stats) {
+  while (Event *event = Channel.Wait()) {
+    dokan::pendable<IoResult> call(
+        Backend.Read(event->buffer, event->length, event->offset),
+        IoResult{-1, 0});
+    if (call.start()) {
+      Stats.inlineCompletions++;
+      SimChannel::Reply(event, call.result());
+      continue;
+    }
+    Stats.pended++;
+    call.detach(event, [](void *Token, IoResult Result) {
+      SimChannel::Reply(static_cast<Event *>(Token), Result);
+    });
+  }
+}
+
+void ClientLoop(SimChannel &Channel, Client &Client_, unsigned Seed,
+                const std::atomic<bool> &Stop) {
+  uint64_t random = Seed;
+  while (!Stop.load(std::memory_order_relaxed)) {
+    random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+    Client_.event.client = &Client_;
+    Client_.event.buffer = Client_.buffer.data();
+    Client_.event.length = kReadSize;
+    Client_.event.offset =
+        static_cast<int64_t>((random >> 33) % (kFileSize / kReadSize)) *
+        kReadSize;
+    Client_.event.submitNs = NowNs();
+    Channel.Submit(&Client_.event);
+    Client_.done.acquire();
+    if (Client_.latencyUs.size() < kMaxSamples)
+      Client_.latencyUs.push_back(
+          static_cast<uint32_t>((NowNs() - Client_.event.submitNs) / 1000));
+    Client_.operations++;
+  }
+}
+
+struct Options {
+  std::vector<unsigned> clients{16, 64, 256};
+  unsigned loopThreads = 4;
+  unsigned workers = 2;
+  unsigned latencyUs = 1000;
+  unsigned hitPercent = 50;
+  double seconds = 2;
+};
+
+double Percentile(std::vector<uint32_t> &Samples, double Percent) {
+  if (Samples.empty())
+    return 0;
+  size_t index = static_cast<size_t>(Samples.size() * Percent / 100.0);
+  if (index >= Samples.size())
+    index = Samples.size() - 1;
+  std::nth_element(Samples.begin(), Samples.begin() + index, Samples.end());
+  return Samples[index];
+}
+
+void Run(Mode Mode_, unsigned Clients, const Options &Options_) {
+  dokan::executor executor(Options_.workers);
+  LatencyBackend backend(&executor,
+                         std::chrono::microseconds(Options_.latencyUs),
+                         Options_.hitPercent);
+  SimChannel channel;
+  unsigned loopThreads =
+      Mode_ == Mode::Threads ? Clients : Options_.loopThreads;
+  std::vector<LoopStats> loopStats(loopThreads);
+  std::vector<std::thread> loops;
+  for (unsigned i = 0; i < loopThreads; ++i) {
+    if (Mode_ == Mode::Coroutine)
+      loops.emplace_back(CoroutineLoop, std::ref(channel), std::ref(backend),
+                         std::ref(loopStats[i]));
+    else
+      loops.emplace_back(BlockingLoop, std::ref(channel), std::ref(backend));
+  }
+
+  std::vector<Client> clients(Clients);
+  for (Client &client : clients)
+    client.latencyUs.reserve(kMaxSamples / Clients);
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  // Thread creation is not part of serving requests, measured on a thread
+  // that does nothing
+  uint64_t allocations = g_Allocations.load();
+  std::thread([] {}).join();
+  int64_t threadAllocations =
+      static_cast<int64_t>(g_Allocations.load() - allocations);
+  allocations = g_Allocations.load();
+  uint64_t start = NowNs();
+  for (unsigned i = 0; i < Clients; ++i)
+    threads.emplace_back(ClientLoop, std::ref(channel), std::ref(clients[i]),
+                         i + 1, std::cref(stop));
+  std::this_thread::sleep_for(std::chrono::duration<double>(Options_.seconds));
+  stop.store(true);
+  for (std::thread &thread : threads)
+    thread.join();
+  double elapsed = (NowNs() - start) / 1e9;
+  int64_t served = static_cast<int64_t>(g_Allocations.load() - allocations) -
+                   threadAllocations * Clients;
+  if (served < 0)
+    served = 0;
+
+  channel.Close();
+  for (std::thread &loop : loops)
+    loop.join();
+
+  uint64_t operations = 0;
+  std::vector<uint32_t> latencyUs;
+  for (Client &client : clients) {
+    operations += client.operations;
+    latencyUs.insert(latencyUs.end(), client.latencyUs.begin(),
+                     client.latencyUs.end());
+  }
+  uint64_t inlineCompletions = 0;
+  uint64_t pended = 0;
+  for (LoopStats &stats : loopStats) {
+    inlineCompletions += stats.inlineCompletions;
+    pended += stats.pended;
+  }
+
+  unsigned threadCount = loopThreads;
+  if (Mode_ == Mode::Coroutine)
+    threadCount += Options_.workers + 1;
+  std::printf("%-9s %7u %7u %12.0f %8.0f %8.0f %7.1f%% %9.2f\n",
+              ModeName(Mode_), Clients, threadCount, operations / elapsed,
+              Percentile(latencyUs, 50), Percentile(latencyUs, 99),
+              inlineCompletions + pended != 0
+                  ? 100.0 * inlineCompletions / (inlineCompletions + pended)
+                  : 0.0,
+              operations != 0 ? static_cast<double>(served) / operations
+                              : 0.0);
+}
+
+// Every detached read must be completed exactly once, whether its coroutine
+// ends before, during or after detach().
+bool PendableCheck() {
+  const unsigned kCalls = 20000;
+  dokan::executor executor(4);
+  std::vector<std::atomic<unsigned>> completions(kCalls);
+  std::atomic<unsigned> remaining(kCalls);
+  struct Body {
+    static dokan::task<IoResult> Run(dokan::executor &Executor, unsigned I) {
+      if (I % 3 != 0)
+        co_await Executor.schedule();
+      if (I % 7 == 0)
+        throw std::bad_alloc();
+      co_return IoResult{0, I};
+    }
+  };
+  struct Token {
+    std::atomic<unsigned> *completions;
+    std::atomic<unsigned> *remaining;
+  };
+  Token token{completions.data(), &remaining};
+
+  for (unsigned i = 0; i < kCalls; ++i) {
+    dokan::pendable<IoResult> call(Body::Run(executor, i), IoResult{-1, i});
+    if (call.start()) {
+      if (call.result().bytes != i)
+        return false;
+      completions[i]++;
+      remaining--;
+      continue;
+    }
+    call.detach(&token, [](void *Token_, IoResult Result) {
+      Token *token = static_cast<Token *>(Token_);
+      token->completions[Result.bytes]++;
+      (*token->remaining)--;
+    });
+  }
+  while (remaining.load() != 0)
+    std::this_thread::yield();
+  for (unsigned i = 0; i < kCalls; ++i) {
+    if (completions[i].load() != 1)
+      return false;
+  }
+  return true;
+}
+
+bool ParseList(const char *Value, std::vector<unsigned> &List) {
+  List.clear();
+  std::string list(Value);
+  size_t position = 0;
+  while (position < list.size()) {
+    unsigned value = std::strtoul(list.c_str() + position, nullptr, 10);
+    if (value == 0)
+      return false;
+    List.push_back(value);
+    position = list.find(',', position);
+    if (position == std::string::npos)
+      break;
+    ++position;
+  }
+  return !List.empty();
+}
+
+bool ParseOptions(int argc, char *argv[], Options &Options_) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc || std::strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-'))
+      return false;
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 'c':
+      if (!ParseList(value, Options_.clients))
+        return false;
+      break;
+    case 't':
+      Options_.loopThreads = std::strtoul(value, nullptr, 10);
+      break;
+    case 'w':
+      Options_.workers = std::strtoul(value, nullptr, 10);
+      break;
+    case 'l':
+      Options_.latencyUs = std::strtoul(value, nullptr, 10);
+      break;
+    case 'h':
+      Options_.hitPercent = std::strtoul(value, nullptr, 10);
+      break;
+    case 'd':
+      Options_.seconds = std::atof(value);
+      break;
+    default:
+      return false;
+    }
+  }
+  return Options_.loopThreads > 0 && Options_.workers > 0 &&
+         Options_.hitPercent <= 100 && Options_.seconds > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::fprintf(stderr, "coroutine_bench [/c 16,64,256] [/t LoopThreads] "
+                         "[/w Workers] [/l LatencyUs] [/h HitPercent] "
+                         "[/d Seconds]\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!PendableCheck()) {
+    std::fprintf(stderr, "pendable check failed\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%u loop threads, %u workers, %u us latency, %u%% hits\n",
+              options.loopThreads, options.workers, options.latencyUs,
+              options.hitPercent);
+  std::printf("%-9s %7s %7s %12s %8s %8s %8s %9s\n", "mode", "clients",
+              "threads", "ops/s", "p50 us", "p99 us", "inline", "allocs/op");
+  for (unsigned clients : options.clients) {
+    Run(Mode::Blocking, clients, options);
+    Run(Mode::Threads, clients, options);
+    Run(Mode::Coroutine, clients, options);
+  }
+  return EXIT_SUCCESS;
+}
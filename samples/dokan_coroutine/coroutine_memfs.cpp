@@ -0,0 +1,420 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Example backend of dokan/dokan_coroutine.hpp: a flat in-memory file system
+// whose reads and writes wait Latency on an executor, like a remote storage.
+// Their DokanLoop thread serves other requests in the meantime.
+//
+// Build it from a developer command prompt after building the library:
+//   cl /O2 /EHsc /std:c++20 /I..\..\dokan coroutine_memfs.cpp
+//      /link /LIBPATH:<dokan1.lib directory> dokan1.lib
+//
+// coroutine_memfs /l MountPoint [/y LatencyMs] [/w Workers] [/t ThreadCount]
+//                 [/d]
+
+#include "../../dokan/dokan_coroutine.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+const ULONGLONG kVolumeSize = 1ULL << 30;
+
+struct NameLess {
+  bool operator()(const std::wstring &left, const std::wstring &right) const {
+    return _wcsicmp(left.c_str(), right.c_str()) < 0;
+  }
+};
+
+// Content of a file, shared by its opened handles
+struct Node {
+  std::vector<char> data;
+  DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+  FILETIME creationTime{};
+  FILETIME lastAccessTime{};
+  FILETIME lastWriteTime{};
+};
+
+// DOKAN_FILE_INFO.Context of an opened file, the root directory has no node
+struct OpenFile {
+  std::wstring name;
+  std::shared_ptr<Node> node;
+};
+
+class MemoryFs {
+public:
+  using file_type = OpenFile;
+
+  MemoryFs(dokan::executor &Executor, std::chrono::milliseconds Latency)
+      : executor_(Executor), latency_(Latency) {}
+
+  dokan::task<NTSTATUS> ZwCreateFile(dokan::request &req,
+                                     PDOKAN_IO_SECURITY_CONTEXT,
+                                     ACCESS_MASK DesiredAccess,
+                                     ULONG FileAttributes, ULONG,
+                                     ULONG CreateDisposition,
+                                     ULONG CreateOptions) {
+    ACCESS_MASK genericDesiredAccess;
+    DWORD fileAttributesAndFlags;
+    DWORD creationDisposition;
+    std::wstring name(req.file_name());
+
+    DokanMapKernelToUserCreateFileFlags(
+        DesiredAccess, FileAttributes, CreateOptions, CreateDisposition,
+        &genericDesiredAccess, &fileAttributesAndFlags, &creationDisposition);
+
+    if (name == L"\\") {
+      if (creationDisposition == CREATE_NEW)
+        co_return STATUS_OBJECT_NAME_COLLISION;
+      req.set_directory(true);
+      req.open_file(std::make_unique<OpenFile>(OpenFile{name, nullptr}));
+      co_return STATUS_SUCCESS;
+    }
+    // Flat: the root directory is the only one
+    if (name.find(L'\\', 1) != std::wstring::npos)
+      co_return STATUS_OBJECT_PATH_NOT_FOUND;
+    if (req.is_directory() || (CreateOptions & FILE_DIRECTORY_FILE))
+      co_return STATUS_ACCESS_DENIED;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    auto found = files_.find(name);
+    NTSTATUS status = STATUS_SUCCESS;
+    std::shared_ptr<Node> node;
+    if (found != files_.end()) {
+      if (creationDisposition == CREATE_NEW)
+        co_return STATUS_OBJECT_NAME_COLLISION;
+      node = found->second;
+      if (creationDisposition == CREATE_ALWAYS ||
+          creationDisposition == TRUNCATE_EXISTING)
+        node->data.clear();
+      // Tell the driver the file was opened and not created
+      if (creationDisposition == OPEN_ALWAYS ||
+          creationDisposition == CREATE_ALWAYS)
+        status = STATUS_OBJECT_NAME_COLLISION;
+    } else {
+      if (creationDisposition == OPEN_EXISTING ||
+          creationDisposition == TRUNCATE_EXISTING)
+        co_return STATUS_OBJECT_NAME_NOT_FOUND;
+      node = std::make_shared<Node>();
+      node->attributes = (fileAttributesAndFlags & 0xFFFF) != 0
+                             ? fileAttributesAndFlags & 0xFFFF
+                             : FILE_ATTRIBUTE_NORMAL;
+      GetSystemTimeAsFileTime(&node->creationTime);
+      node->lastAccessTime = node->lastWriteTime = node->creationTime;
+      files_.emplace(name, node);
+    }
+    req.open_file(std::make_unique<OpenFile>(OpenFile{name, node}));
+    co_return status;
+  }
+
+  dokan::task<void> Cleanup(dokan::request &req) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file != nullptr && req.delete_on_close()) {
+      std::lock_guard<std::mutex> lock(lock_);
+      files_.erase(file->name);
+    }
+    co_return;
+  }
+
+  dokan::task<dokan::io_result> ReadFile(dokan::request &req, LPVOID Buffer,
+                                         DWORD BufferLength, LONGLONG Offset) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file == nullptr || file->node == nullptr)
+      co_return dokan::io_result{STATUS_INVALID_DEVICE_REQUEST, 0};
+    // The read buffer stays valid while the request is pended
+    co_await Storage();
+    if (req.cancelled())
+      co_return dokan::io_result{STATUS_CANCELLED, 0};
+
+    std::lock_guard<std::mutex> lock(lock_);
+    std::vector<char> &data = file->node->data;
+    if (Offset >= static_cast<LONGLONG>(data.size()))
+      co_return dokan::io_result{STATUS_SUCCESS, 0};
+    ULONG bytes = static_cast<ULONG>((std::min)(
+        static_cast<ULONGLONG>(BufferLength),
+        static_cast<ULONGLONG>(data.size() - static_cast<size_t>(Offset))));
+    memcpy(Buffer, &data[static_cast<size_t>(Offset)], bytes);
+    co_return dokan::io_result{STATUS_SUCCESS, bytes};
+  }
+
+  dokan::task<dokan::io_result> WriteFile(dokan::request &req, LPCVOID Buffer,
+                                          DWORD NumberOfBytesToWrite,
+                                          LONGLONG Offset) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file == nullptr || file->node == nullptr)
+      co_return dokan::io_result{STATUS_INVALID_DEVICE_REQUEST, 0};
+    // The write buffer is only valid until the first suspension
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      std::vector<char> &data = file->node->data;
+      if (req.write_to_end_of_file())
+        Offset = static_cast<LONGLONG>(data.size());
+      if (static_cast<ULONGLONG>(Offset) + NumberOfBytesToWrite > kVolumeSize)
+        co_return dokan::io_result{STATUS_DISK_FULL, 0};
+      if (static_cast<size_t>(Offset) + NumberOfBytesToWrite > data.size())
+        data.resize(static_cast<size_t>(Offset + NumberOfBytesToWrite));
+      memcpy(&data[static_cast<size_t>(Offset)], Buffer, NumberOfBytesToWrite);
+      GetSystemTimeAsFileTime(&file->node->lastWriteTime);
+    }
+    co_await Storage();
+    co_return dokan::io_result{STATUS_SUCCESS, NumberOfBytesToWrite};
+  }
+
+  dokan::task<NTSTATUS>
+  GetFileInformation(dokan::request &req,
+                     LPBY_HANDLE_FILE_INFORMATION HandleFileInformation) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file == nullptr)
+      co_return STATUS_INVALID_HANDLE;
+    ZeroMemory(HandleFileInformation, sizeof(BY_HANDLE_FILE_INFORMATION));
+    HandleFileInformation->nNumberOfLinks = 1;
+    if (file->node == nullptr) {
+      HandleFileInformation->dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+      co_return STATUS_SUCCESS;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    Fill(*file->node, HandleFileInformation->dwFileAttributes,
+         HandleFileInformation->ftCreationTime,
+         HandleFileInformation->ftLastAccessTime,
+         HandleFileInformation->ftLastWriteTime,
+         HandleFileInformation->nFileSizeHigh,
+         HandleFileInformation->nFileSizeLow);
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS> FindFiles(dokan::request &req, dokan::find_sink Sink) {
+    if (req.file_name() != L"\\")
+      co_return STATUS_NOT_A_DIRECTORY;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    for (auto &entry : files_) {
+      WIN32_FIND_DATAW findData;
+      ZeroMemory(&findData, sizeof(WIN32_FIND_DATAW));
+      wcsncpy_s(findData.cFileName, MAX_PATH, entry.first.c_str() + 1,
+                _TRUNCATE);
+      Fill(*entry.second, findData.dwFileAttributes, findData.ftCreationTime,
+           findData.ftLastAccessTime, findData.ftLastWriteTime,
+           findData.nFileSizeHigh, findData.nFileSizeLow);
+      Sink(findData);
+    }
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS> DeleteFile(dokan::request &req) {
+    OpenFile *file = req.file<OpenFile>();
+    co_return file != nullptr && file->node != nullptr ? STATUS_SUCCESS
+                                                       : STATUS_ACCESS_DENIED;
+  }
+
+  dokan::task<NTSTATUS> MoveFile(dokan::request &req,
+                                 std::wstring_view NewFileName,
+                                 bool ReplaceIfExisting) {
+    OpenFile *file = req.file<OpenFile>();
+    std::wstring newName(NewFileName);
+    if (file == nullptr || file->node == nullptr ||
+        newName.find(L'\\', 1) != std::wstring::npos)
+      co_return STATUS_ACCESS_DENIED;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    auto existing = files_.find(newName);
+    if (existing != files_.end() && existing->second != file->node) {
+      if (!ReplaceIfExisting)
+        co_return STATUS_OBJECT_NAME_COLLISION;
+      files_.erase(existing);
+    }
+    files_.erase(file->name);
+    files_[newName] = file->node;
+    file->name = newName;
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS> SetEndOfFile(dokan::request &req, LONGLONG ByteOffset) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file == nullptr || file->node == nullptr)
+      co_return STATUS_INVALID_HANDLE;
+    if (static_cast<ULONGLONG>(ByteOffset) > kVolumeSize)
+      co_return STATUS_DISK_FULL;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    file->node->data.resize(static_cast<size_t>(ByteOffset));
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS> SetAllocationSize(dokan::request &req,
+                                          LONGLONG AllocSize) {
+    OpenFile *file = req.file<OpenFile>();
+    if (file == nullptr || file->node == nullptr)
+      co_return STATUS_INVALID_HANDLE;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (static_cast<ULONGLONG>(AllocSize) < file->node->data.size())
+      file->node->data.resize(static_cast<size_t>(AllocSize));
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS> GetDiskFreeSpace(dokan::request &,
+                                         PULONGLONG FreeBytesAvailable,
+                                         PULONGLONG TotalNumberOfBytes,
+                                         PULONGLONG TotalNumberOfFreeBytes) {
+    ULONGLONG used = 0;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      for (auto &entry : files_)
+        used += entry.second->data.size();
+    }
+    ULONGLONG free = used < kVolumeSize ? kVolumeSize - used : 0;
+    if (FreeBytesAvailable)
+      *FreeBytesAvailable = free;
+    if (TotalNumberOfBytes)
+      *TotalNumberOfBytes = kVolumeSize;
+    if (TotalNumberOfFreeBytes)
+      *TotalNumberOfFreeBytes = free;
+    co_return STATUS_SUCCESS;
+  }
+
+  dokan::task<NTSTATUS>
+  GetVolumeInformation(dokan::request &, LPWSTR VolumeNameBuffer,
+                       DWORD VolumeNameSize, LPDWORD VolumeSerialNumber,
+                       LPDWORD MaximumComponentLength,
+                       LPDWORD FileSystemFlags, LPWSTR FileSystemNameBuffer,
+                       DWORD FileSystemNameSize) {
+    wcscpy_s(VolumeNameBuffer, VolumeNameSize, L"DOKAN");
+    if (VolumeSerialNumber)
+      *VolumeSerialNumber = 0x19831116;
+    if (MaximumComponentLength)
+      *MaximumComponentLength = 255;
+    if (FileSystemFlags)
+      *FileSystemFlags = FILE_CASE_PRESERVED_NAMES | FILE_UNICODE_ON_DISK;
+    // Windows checks few features based on the name, use NTFS
+    wcscpy_s(FileSystemNameBuffer, FileSystemNameSize, L"NTFS");
+    co_return STATUS_SUCCESS;
+  }
+
+private:
+  // Wait of the remote storage, without holding the thread
+  dokan::task<void> Storage() {
+    if (latency_.count() > 0)
+      co_await executor_.sleep_for(latency_);
+  }
+
+  static void Fill(const Node &File, DWORD &Attributes, FILETIME &CreationTime,
+                   FILETIME &LastAccessTime, FILETIME &LastWriteTime,
+                   DWORD &FileSizeHigh, DWORD &FileSizeLow) {
+    ULONGLONG size = File.data.size();
+    Attributes = File.attributes;
+    CreationTime = File.creationTime;
+    LastAccessTime = File.lastAccessTime;
+    LastWriteTime = File.lastWriteTime;
+    FileSizeHigh = static_cast<DWORD>(size >> 32);
+    FileSizeLow = static_cast<DWORD>(size & 0xFFFFFFFF);
+  }
+
+  dokan::executor &executor_;
+  std::chrono::milliseconds latency_;
+  std::mutex lock_;
+  std::map<std::wstring, std::shared_ptr<Node>, NameLess> files_;
+};
+
+WCHAR MountPoint[MAX_PATH] = L"";
+
+void ShowUsage() {
+  fprintf(stderr, "coroutine_memfs.exe\n"
+                  "  /l MountPoint (ex. /l m)\t Mount point.\n"
+                  "  /y LatencyMs (ex. /y 5)\t Latency of every read and write.\n"
+                  "  /w Workers (ex. /w 2)\t\t Threads completing the "
+                  "reads and writes.\n"
+                  "  /t ThreadCount (ex. /t 5)\t Number of threads to be used "
+                  "internally by Dokan library.\n"
+                  "  /d (enable debug output)\t Enable debug output to an "
+                  "attached debugger.\n");
+}
+
+} // namespace
+
+int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
+  int status;
+  ULONG command;
+  ULONG latencyMs = 0;
+  ULONG workers = 2;
+  DOKAN_OPTIONS dokanOptions;
+
+  if (argc < 3) {
+    ShowUsage();
+    return EXIT_FAILURE;
+  }
+
+  ZeroMemory(&dokanOptions, sizeof(DOKAN_OPTIONS));
+  dokanOptions.Version = DOKAN_VERSION;
+  dokanOptions.ThreadCount = 0; // use default
+
+  for (command = 1; command < argc; command++) {
+    switch (towlower(argv[command][1])) {
+    case L'l':
+      command++;
+      wcscpy_s(MountPoint, MAX_PATH, argv[command]);
+      dokanOptions.MountPoint = MountPoint;
+      break;
+    case L'y':
+      command++;
+      latencyMs = (ULONG)_wtol(argv[command]);
+      break;
+    case L'w':
+      command++;
+      workers = (ULONG)_wtol(argv[command]);
+      break;
+    case L't':
+      command++;
+      dokanOptions.ThreadCount = (USHORT)_wtoi(argv[command]);
+      break;
+    case L'd':
+      dokanOptions.Options |= DOKAN_OPTION_DEBUG | DOKAN_OPTION_STDERR;
+      break;
+    default:
+      fwprintf(stderr, L"unknown command: %s\n", argv[command]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (wcscmp(MountPoint, L"") == 0 || workers == 0) {
+    ShowUsage();
+    return EXIT_FAILURE;
+  }
+
+  dokan::executor executor(workers);
+  MemoryFs fs(executor, std::chrono::milliseconds(latencyMs));
+  dokan::coroutine_operations<MemoryFs> operations(fs, dokanOptions);
+
+  status = DokanMain(&dokanOptions, operations.operations());
+  if (status != DOKAN_SUCCESS) {
+    fprintf(stderr, "DokanMain failed: %d\n", status);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
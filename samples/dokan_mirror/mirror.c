@@ -44,6 +44,8 @@ BOOL g_UseStdErr;
 BOOL g_DebugMode;
 BOOL g_HasSeSecurityPrivilege;
 BOOL g_ImpersonateCallerUser;
+BOOL g_AsyncIo;
+ULONG g_AsyncLatency;
 
 static void DbgPrint(LPCWSTR format, ...) {
   if (g_DebugMode) {
@@ -555,6 +557,107 @@ static void DOKAN_CALLBACK MirrorCleanup(LPCWSTR FileName,
   }
 }
 
+typedef struct _MIRROR_ASYNC_IO {
+  PDOKAN_REQUEST Request;
+  HANDLE Handle;
+  LPVOID Buffer;
+  DWORD Length;
+  LONGLONG Offset;
+  BOOL Write;
+} MIRROR_ASYNC_IO, *PMIRROR_ASYNC_IO;
+
+// Backend of the async mode: waits g_AsyncLatency milliseconds to simulate a
+// remote storage, then does the IO and completes the request
+static VOID CALLBACK MirrorAsyncIo(PTP_CALLBACK_INSTANCE Instance,
+                                   PVOID Context) {
+  PMIRROR_ASYNC_IO io = (PMIRROR_ASYNC_IO)Context;
+  OVERLAPPED overlapped;
+  DWORD bytes = 0;
+  NTSTATUS status = STATUS_SUCCESS;
+  BOOL result;
+
+  UNREFERENCED_PARAMETER(Instance);
+
+  if (g_AsyncLatency)
+    Sleep(g_AsyncLatency);
+
+  ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+  overlapped.Offset = (DWORD)(io->Offset & 0xFFFFFFFF);
+  overlapped.OffsetHigh = (DWORD)(io->Offset >> 32);
+  if (io->Write)
+    result = WriteFile(io->Handle, io->Buffer, io->Length, &bytes, &overlapped);
+  else
+    result = ReadFile(io->Handle, io->Buffer, io->Length, &bytes, &overlapped);
+  if (!result && GetLastError() == ERROR_IO_PENDING)
+    result = GetOverlappedResult(io->Handle, &overlapped, &bytes, TRUE);
+  if (!result) {
+    DWORD error = GetLastError();
+    // Reading at or past the end of the file is a read of 0 bytes
+    if (error != ERROR_HANDLE_EOF) {
+      DbgPrint(L"\tasync %s error = %u, offset %I64d\n",
+               io->Write ? L"write" : L"read", error, io->Offset);
+      status = DokanNtStatusFromWin32(error);
+    }
+  }
+
+  DokanCompleteRequest(io->Request, status, bytes);
+  CloseHandle(io->Handle);
+  if (io->Write)
+    free(io->Buffer);
+  free(io);
+}
+
+// Pends the request and hands it to MirrorAsyncIo. Returns STATUS_PENDING, or
+// another status if the caller has to do the IO itself.
+static NTSTATUS MirrorPendIo(HANDLE Handle, LPVOID Buffer, DWORD Length,
+                             LONGLONG Offset, BOOL Write,
+                             PDOKAN_FILE_INFO DokanFileInfo) {
+  PMIRROR_ASYNC_IO io;
+
+  io = (PMIRROR_ASYNC_IO)malloc(sizeof(MIRROR_ASYNC_IO));
+  if (io == NULL)
+    return STATUS_NO_MEMORY;
+  ZeroMemory(io, sizeof(MIRROR_ASYNC_IO));
+  io->Length = Length;
+  io->Offset = Offset;
+  io->Write = Write;
+  io->Buffer = Buffer;
+  // The write buffer is only valid until the callback returns
+  if (Write) {
+    io->Buffer = malloc(Length ? Length : 1);
+    if (io->Buffer == NULL) {
+      free(io);
+      return STATUS_NO_MEMORY;
+    }
+    CopyMemory(io->Buffer, Buffer, Length);
+  }
+  // Cleanup closes the handle of the file while paging IO can still be pended
+  if (!DuplicateHandle(GetCurrentProcess(), Handle, GetCurrentProcess(),
+                       &io->Handle, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+    DWORD error = GetLastError();
+    DbgPrint(L"\tDuplicateHandle error : %d\n", error);
+    if (Write)
+      free(io->Buffer);
+    free(io);
+    return DokanNtStatusFromWin32(error);
+  }
+
+  io->Request = DokanPendRequest(DokanFileInfo);
+  if (io->Request == NULL) {
+    CloseHandle(io->Handle);
+    if (Write)
+      free(io->Buffer);
+    free(io);
+    return STATUS_NO_MEMORY;
+  }
+  if (!TrySubmitThreadpoolCallback(MirrorAsyncIo, io, NULL)) {
+    // The request is pended, it can only be completed from here
+    DbgPrint(L"\tTrySubmitThreadpoolCallback error : %d\n", GetLastError());
+    MirrorAsyncIo(NULL, io);
+  }
+  return STATUS_PENDING;
+}
+
 static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
                                               DWORD BufferLength,
                                               LPDWORD ReadLength,
@@ -581,6 +684,13 @@ static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
     opened = TRUE;
   }
 
+  if (g_AsyncIo && !opened) {
+    NTSTATUS status = MirrorPendIo(handle, Buffer, BufferLength, Offset, FALSE,
+                                   DokanFileInfo);
+    if (status != STATUS_NO_MEMORY)
+      return status;
+  }
+
   LARGE_INTEGER distanceToMove;
   distanceToMove.QuadPart = Offset;
   if (!SetFilePointerEx(handle, distanceToMove, NULL, FILE_BEGIN)) {
@@ -637,6 +747,15 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
     opened = TRUE;
   }
 
+  // Appends and paging IO depend on the file size, they stay synchronous
+  if (g_AsyncIo && !opened && !DokanFileInfo->WriteToEndOfFile &&
+      !DokanFileInfo->PagingIo) {
+    NTSTATUS status = MirrorPendIo(handle, (LPVOID)Buffer, NumberOfBytesToWrite,
+                                   Offset, TRUE, DokanFileInfo);
+    if (status != STATUS_NO_MEMORY)
+      return status;
+  }
+
   UINT64 fileSize = 0;
   DWORD fileSizeLow = 0;
   DWORD fileSizeHigh = 0;
@@ -1535,7 +1654,15 @@ void ShowUsage() {
           "  /f User mode Lock\t\t\t\t Enable Lockfile/Unlockfile operations. Otherwise Dokan will take care of it.\n"
           "  /e Disable OpLocks\t\t\t\t Disable OpLocks kernel operations. Otherwise Dokan will take care of it.\n"
           "  /i (Timeout in Milliseconds ex. /i 30000)\t Timeout until a running operation is aborted and the device is unmounted.\n"
-          "  /z Optimize single name search\t\t Speed up directory query under Windows 7.\n\n"
+          "  /z Optimize single name search\t\t Speed up directory query under Windows 7.\n"
+          "  /g NUMA node affinity\t\t\t Bind threads to NUMA nodes and keep the requests of a file on one node.\n"
+          "  /b Processor affinity\t\t\t Pin threads to processors and keep the requests of a file on one processor.\n"
+          "  /x Cache file attributes\t\t\t Let the driver answer attribute queries for a second without asking the mirror.\n"
+          "  /j Block cache\t\t\t\t Keep the data read from the mirror in a 64 MB cache of 64 KB blocks.\n"
+          "  /v Cache volume information\t\t\t Answer free space and volume queries for 5 seconds without asking the mirror.\n"
+          "  /q Cache security descriptors\t\t Answer security queries without asking the mirror until the file changes.\n"
+          "  /h Write gathering\t\t\t\t Gather small sequential writes of a handle into 64 KB writes.\n"
+          "  /y Async latency (ex. /y 5)\t\t\t Complete reads and writes from a thread pool after the given milliseconds.\n\n"
           "Examples:\n"
           "\tmirror.exe /r C:\\Users /l M:\t\t\t# Mirror C:\\Users as RootDirectory into a drive of letter M:\\.\n"
           "\tmirror.exe /r C:\\Users /l C:\\mount\\dokan\t# Mirror C:\\Users as RootDirectory into NTFS folder C:\\mount\\dokan.\n"
@@ -1614,6 +1741,32 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
     case L'z':
       dokanOptions.Options |= DOKAN_OPTION_OPTIMIZE_SINGLE_NAME_SEARCH;
       break;
+    case L'g':
+      dokanOptions.Options |= DOKAN_OPTION_NUMA_AFFINITY;
+      break;
+    case L'b':
+      dokanOptions.Options |= DOKAN_OPTION_CPU_AFFINITY;
+      break;
+    case L'x':
+      dokanOptions.Options |= DOKAN_OPTION_CACHE_FILE_ATTRIBUTES;
+      break;
+    case L'j':
+      dokanOptions.Options |= DOKAN_OPTION_BLOCK_CACHE;
+      break;
+    case L'v':
+      dokanOptions.Options |= DOKAN_OPTION_CACHE_VOLUME_INFORMATION;
+      break;
+    case L'q':
+      dokanOptions.Options |= DOKAN_OPTION_CACHE_SECURITY;
+      break;
+    case L'h':
+      dokanOptions.Options |= DOKAN_OPTION_WRITE_GATHERING;
+      break;
+    case L'y':
+      command++;
+      g_AsyncIo = TRUE;
+      g_AsyncLatency = (ULONG)_wtol(argv[command]);
+      break;
     case L'u':
       command++;
       wcscpy_s(UNCName, sizeof(UNCName) / sizeof(WCHAR), argv[command]);
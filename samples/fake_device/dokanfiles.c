@@ -0,0 +1,57 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The files of dokan/ the Dispatch* functions need, in one translation unit
+// so that the samples build them with a single command line. The library is
+// built with whole program optimization, so they are not slower here than in
+// the DLL.
+//
+// dokan.c, device.c, mount.c, affinity.c and version.c are left out, they
+// only run with the driver. fakedevice.c stands for what the dispatch files
+// use of them. ntstatus.c is left out as well, for its table of every Win32
+// error code.
+
+#include "../../dokan/access.c"
+#include "../../dokan/async.c"
+#include "../../dokan/blockcache.c"
+#include "../../dokan/cleanup.c"
+#include "../../dokan/close.c"
+#include "../../dokan/create.c"
+#include "../../dokan/directory.c"
+#include "../../dokan/dispatch.c"
+#include "../../dokan/filecache.c"
+#include "../../dokan/fileinfo.c"
+#include "../../dokan/flush.c"
+#include "../../dokan/histogram.c"
+#include "../../dokan/lock.c"
+#include "../../dokan/openinfo.c"
+#include "../../dokan/pendingrequest.c"
+#include "../../dokan/read.c"
+#include "../../dokan/security.c"
+#include "../../dokan/securitycache.c"
+#include "../../dokan/setfile.c"
+#include "../../dokan/statistics.c"
+#include "../../dokan/timeout.c"
+#include "../../dokan/trace.c"
+#include "../../dokan/tracering.c"
+#include "../../dokan/volume.c"
+#include "../../dokan/write.c"
+#include "../../dokan/writegather.c"
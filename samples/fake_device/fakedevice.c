@@ -0,0 +1,206 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fakedevice.h"
+
+// Globals of dokan.c
+BOOL g_DebugMode = FALSE;
+BOOL g_UseStdErr = FALSE;
+CRITICAL_SECTION g_InstanceCriticalSection;
+LIST_ENTRY g_InstanceList;
+
+VOID FakeDeviceInit(void) {
+  InitializeCriticalSection(&g_InstanceCriticalSection);
+  InitializeListHead(&g_InstanceList);
+}
+
+BOOL DokanDeviceIoControl(HANDLE Device, DWORD IoControlCode,
+                          PVOID InputBuffer, ULONG InputLength,
+                          PVOID OutputBuffer, ULONG OutputLength,
+                          PULONG ReturnedLength) {
+  PFAKE_DEVICE device = (PFAKE_DEVICE)Device;
+  PEVENT_CONTEXT writeContext;
+
+  *ReturnedLength = 0;
+  if (device == NULL) {
+    SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+  }
+
+  switch (IoControlCode) {
+  case IOCTL_EVENT_INFO:
+    InterlockedIncrement(&device->ReplyCount);
+    if (device->Reply != NULL)
+      device->Reply(device, (PEVENT_INFORMATION)InputBuffer, InputLength);
+    return TRUE;
+  case IOCTL_EVENT_WRITE:
+    InterlockedIncrement(&device->WriteRequestCount);
+    writeContext = device->WriteContext;
+    if (writeContext == NULL) {
+      SetLastError(ERROR_OPERATION_ABORTED);
+      return FALSE;
+    }
+    if (writeContext->Length > OutputLength) {
+      SetLastError(ERROR_INSUFFICIENT_BUFFER);
+      return FALSE;
+    }
+    CopyMemory(OutputBuffer, writeContext, writeContext->Length);
+    *ReturnedLength = writeContext->Length;
+    return TRUE;
+  case IOCTL_RESET_TIMEOUT:
+    InterlockedIncrement(&device->ResetTimeoutCount);
+    return TRUE;
+  default:
+    SetLastError(ERROR_INVALID_FUNCTION);
+    return FALSE;
+  }
+}
+
+BOOL SendToDevice(LPCWSTR DeviceName, DWORD IoControlCode, PVOID InputBuffer,
+                  ULONG InputLength, PVOID OutputBuffer, ULONG OutputLength,
+                  PULONG ReturnedLength) {
+  UNREFERENCED_PARAMETER(DeviceName);
+  UNREFERENCED_PARAMETER(IoControlCode);
+  UNREFERENCED_PARAMETER(InputBuffer);
+  UNREFERENCED_PARAMETER(InputLength);
+  UNREFERENCED_PARAMETER(OutputBuffer);
+  UNREFERENCED_PARAMETER(OutputLength);
+  *ReturnedLength = 0;
+  SetLastError(ERROR_FILE_NOT_FOUND);
+  return FALSE;
+}
+
+BOOL DokanSendAsyncIoctl(PDOKAN_INSTANCE DokanInstance, DWORD IoControlCode,
+                         PVOID InputBuffer, ULONG InputLength) {
+  ULONG returnedLength;
+
+  return DokanDeviceIoControl(DokanInstance->AsyncDevice, IoControlCode,
+                              InputBuffer, InputLength, NULL, 0,
+                              &returnedLength);
+}
+
+VOID DokanAsyncDeviceCleanup(PDOKAN_INSTANCE DokanInstance) {
+  // The async device belongs to the caller of FakeDeviceCreateInstance
+  DokanInstance->AsyncDevice = NULL;
+}
+
+// Only the errors the dispatch functions convert themselves, ntstatus.c has
+// the whole table
+NTSTATUS DOKANAPI DokanNtStatusFromWin32(DWORD Error) {
+  switch (Error) {
+  case ERROR_SUCCESS:
+    return STATUS_SUCCESS;
+  case ERROR_OPERATION_ABORTED:
+    return STATUS_CANCELLED;
+  case ERROR_INSUFFICIENT_BUFFER:
+    return STATUS_BUFFER_TOO_SMALL;
+  case ERROR_NOT_ENOUGH_MEMORY:
+    return STATUS_NO_MEMORY;
+  case ERROR_INVALID_HANDLE:
+    return STATUS_INVALID_HANDLE;
+  default:
+    return STATUS_ACCESS_DENIED;
+  }
+}
+
+BOOL IsMountPointDriveLetter(LPCWSTR mountPoint) {
+  size_t mountPointLength;
+
+  if (!mountPoint || *mountPoint == 0)
+    return FALSE;
+  mountPointLength = wcslen(mountPoint);
+  return mountPointLength == 1 ||
+         (mountPointLength == 2 && mountPoint[1] == L':') ||
+         (mountPointLength == 3 && mountPoint[1] == L':' &&
+          mountPoint[2] == L'\\');
+}
+
+PDOKAN_CONTROL DOKANAPI DokanGetMountPointList(BOOL uncOnly, PULONG nbRead) {
+  UNREFERENCED_PARAMETER(uncOnly);
+  *nbRead = 0;
+  return NULL;
+}
+
+VOID DOKANAPI DokanReleaseMountPointList(PDOKAN_CONTROL list) { free(list); }
+
+PDOKAN_INSTANCE FakeDeviceCreateInstance(PDOKAN_OPTIONS DokanOptions,
+                                         PDOKAN_OPERATIONS DokanOperations,
+                                         PFAKE_DEVICE AsyncDevice) {
+  PDOKAN_INSTANCE instance;
+
+  // CheckAllocationUnitSectorSize of DokanMain
+  if (DokanOptions->AllocationUnitSize == 0 || DokanOptions->SectorSize == 0) {
+    DokanOptions->AllocationUnitSize = DOKAN_DEFAULT_ALLOCATION_UNIT_SIZE;
+    DokanOptions->SectorSize = DOKAN_DEFAULT_SECTOR_SIZE;
+  }
+
+  // NewDokanInstance
+  instance = (PDOKAN_INSTANCE)malloc(sizeof(DOKAN_INSTANCE));
+  if (instance == NULL)
+    return NULL;
+  ZeroMemory(instance, sizeof(DOKAN_INSTANCE));
+  instance->PendingRequests = DokanPendingRequestsCreate();
+  if (instance->PendingRequests == NULL) {
+    free(instance);
+    return NULL;
+  }
+  InitializeSListHead(&instance->AsyncEvents);
+  InitializeCriticalSection(&instance->CriticalSection);
+  InitializeListHead(&instance->ListEntry);
+  DokanOpenInfoTableInit(instance);
+  InitializeListHead(&instance->WriteGatherList);
+  InitializeSRWLock(&instance->WriteGatherListLock);
+  EnterCriticalSection(&g_InstanceCriticalSection);
+  InsertTailList(&g_InstanceList, &instance->ListEntry);
+  LeaveCriticalSection(&g_InstanceCriticalSection);
+
+  // DokanMain, the flush thread of gathered writes is not started so they
+  // are flushed by the requests of their handle
+  instance->DokanOptions = DokanOptions;
+  instance->DokanOperations = DokanOperations;
+  instance->StartTime = GetTickCount64();
+  instance->AsyncDevice = (HANDLE)AsyncDevice;
+  wcscpy_s(instance->DeviceName, 64, L"\\Device\\Volume{fake}");
+  if (DokanOptions->Options & DOKAN_OPTION_BLOCK_CACHE)
+    instance->BlockCache = DokanBlockCacheCreate(DOKAN_BLOCK_CACHE_BLOCK_SIZE,
+                                                 DOKAN_BLOCK_CACHE_SIZE);
+  if (DokanOptions->Options & DOKAN_OPTION_CACHE_SECURITY)
+    instance->SecurityCache =
+        DokanSecurityCacheCreate(DOKAN_SECURITY_CACHE_ENTRIES);
+  InitializeSRWLock(&instance->VolumeInformationLock);
+  InitializeSRWLock(&instance->VolumeInformationRefreshLock);
+  instance->VolumeInformationValidity = DOKAN_VOLUME_INFORMATION_VALIDITY;
+  return instance;
+}
+
+VOID FakeDeviceDeleteInstance(PDOKAN_INSTANCE DokanInstance) {
+  // The unmount, then DeleteDokanInstance
+  DokanWaitPendingRequests(DokanInstance);
+  DeleteCriticalSection(&DokanInstance->CriticalSection);
+  DokanOpenInfoTableCleanup(DokanInstance);
+  DokanAsyncCleanup(DokanInstance);
+  EnterCriticalSection(&g_InstanceCriticalSection);
+  RemoveEntryList(&DokanInstance->ListEntry);
+  LeaveCriticalSection(&g_InstanceCriticalSection);
+  DokanBlockCacheDelete(DokanInstance->BlockCache);
+  DokanSecurityCacheDelete(DokanInstance->SecurityCache);
+  free(DokanInstance);
+}
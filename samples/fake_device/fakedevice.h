@@ -0,0 +1,90 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FAKEDEVICE_H_
+#define FAKEDEVICE_H_
+
+// Fake of the device channel of dokan/device.c, for the samples that run the
+// real Dispatch* functions of dokan/ without a driver, on any platform.
+//
+// A FAKE_DEVICE stands for the device handle of one DokanLoop thread: it is
+// the Device given to DokanDispatchEvent, and the replies sent on it are given
+// to its Reply callback on the thread that sends them. Replies sent by
+// DokanCompleteRequest go to the AsyncDevice of the instance, a FAKE_DEVICE as
+// well. Requests by device name, like SendToDevice, fail as if there was no
+// driver.
+//
+// fakedevice.c also stands for the part of dokan.c the dispatch files use:
+// its globals and the setup of an instance by DokanMain.
+
+#include "dokani.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _FAKE_DEVICE FAKE_DEVICE, *PFAKE_DEVICE;
+
+// Called with a reply of IOCTL_EVENT_INFO, EventInfo is only valid during the
+// call
+typedef VOID (*PFAKE_DEVICE_REPLY)(PFAKE_DEVICE Device,
+                                   PEVENT_INFORMATION EventInfo,
+                                   ULONG EventLength);
+
+struct _FAKE_DEVICE {
+  /** Called for each reply, NULL to only count them */
+  PFAKE_DEVICE_REPLY Reply;
+  /** Free for the owner of the device */
+  PVOID Context;
+  /**
+   * Event IOCTL_EVENT_WRITE answers with, the whole write whose data did not
+   * fit in the event given to DokanDispatchEvent. NULL fails the ioctl with
+   * ERROR_OPERATION_ABORTED like a canceled write.
+   */
+  PEVENT_CONTEXT WriteContext;
+  /** Number of IOCTL_EVENT_INFO sent on the device */
+  volatile LONG ReplyCount;
+  /** Number of IOCTL_EVENT_WRITE sent on the device */
+  volatile LONG WriteRequestCount;
+  /** Number of IOCTL_RESET_TIMEOUT sent on the device */
+  volatile LONG ResetTimeoutCount;
+};
+
+// Initializes the globals DllMain initializes. Called once before the other
+// functions.
+VOID FakeDeviceInit(void);
+
+// Instance as DokanMain sets it up before starting its threads, without
+// device name or mount point. DokanOptions and DokanOperations must outlive
+// it. Replies of pended requests go to AsyncDevice.
+PDOKAN_INSTANCE FakeDeviceCreateInstance(PDOKAN_OPTIONS DokanOptions,
+                                         PDOKAN_OPERATIONS DokanOperations,
+                                         PFAKE_DEVICE AsyncDevice);
+
+// Waits for the pended requests of the instance like the unmount, then frees
+// it.
+VOID FakeDeviceDeleteInstance(PDOKAN_INSTANCE DokanInstance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FAKEDEVICE_H_
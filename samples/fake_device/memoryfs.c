@@ -0,0 +1,683 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "memoryfs.h"
+
+#include <wctype.h>
+
+// Buckets of the directory entries, the samples stay far below a million
+// files
+#define MEMORY_FS_BUCKETS (64 * 1024)
+#define MEMORY_FS_VOLUME_SERIAL 0x19831116
+#define MEMORY_FS_VOLUME_SIZE (64ULL * 1024 * 1024 * 1024)
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+typedef struct _MEMORY_FS_NODE {
+  /** Directory of the entry, NULL for the root and removed entries */
+  struct _MEMORY_FS_NODE *Parent;
+  /** Next entry of the bucket */
+  struct _MEMORY_FS_NODE *HashNext;
+  /** Entries of a directory */
+  struct _MEMORY_FS_NODE *FirstChild;
+  struct _MEMORY_FS_NODE *NextSibling;
+  struct _MEMORY_FS_NODE *PrevSibling;
+  /** One for the namespace while the entry is in it, and one per handle */
+  volatile LONG References;
+  ULONG Hash;
+  LPWSTR Name;
+  size_t NameLength;
+  BOOL IsDirectory;
+  ULONGLONG Index;
+  /** Protects the fields below */
+  SRWLOCK DataLock;
+  DWORD Attributes;
+  FILETIME CreationTime;
+  FILETIME LastAccessTime;
+  FILETIME LastWriteTime;
+  PCHAR Data;
+  ULONGLONG Size;
+  ULONGLONG Capacity;
+} MEMORY_FS_NODE, *PMEMORY_FS_NODE;
+
+// Protects the entries of the directories and the names
+static SRWLOCK g_NamespaceLock = SRWLOCK_INIT;
+static PMEMORY_FS_NODE g_Buckets[MEMORY_FS_BUCKETS];
+static PMEMORY_FS_NODE g_Root;
+static ULONGLONG g_NextIndex;
+static volatile LONG64 g_CallCount;
+
+static ULONG NameHash(PMEMORY_FS_NODE Parent, LPCWSTR Name, size_t Length) {
+  ULONG hash = FNV_OFFSET_BASIS ^ (ULONG)((ULONG_PTR)Parent >> 4);
+  size_t i;
+
+  for (i = 0; i < Length; ++i) {
+    hash ^= (ULONG)towupper(Name[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static PMEMORY_FS_NODE FindChild(PMEMORY_FS_NODE Parent, LPCWSTR Name,
+                                 size_t Length) {
+  ULONG hash = NameHash(Parent, Name, Length);
+  PMEMORY_FS_NODE node;
+
+  for (node = g_Buckets[hash % MEMORY_FS_BUCKETS]; node != NULL;
+       node = node->HashNext) {
+    if (node->Hash == hash && node->Parent == Parent &&
+        node->NameLength == Length &&
+        _wcsnicmp(node->Name, Name, Length) == 0)
+      return node;
+  }
+  return NULL;
+}
+
+// Returns the entry of FileName, NULL if there is none. Parent gets the entry
+// the last component of the name is in, NULL if it does not exist, and
+// LastName that component.
+static PMEMORY_FS_NODE Lookup(LPCWSTR FileName, PMEMORY_FS_NODE *Parent,
+                              LPCWSTR *LastName, size_t *LastLength) {
+  PMEMORY_FS_NODE directory = g_Root;
+  PMEMORY_FS_NODE node = g_Root;
+  LPCWSTR component = FileName;
+  size_t length;
+
+  *Parent = NULL;
+  *LastName = FileName;
+  *LastLength = 0;
+  for (;;) {
+    while (*component == L'\\')
+      ++component;
+    if (*component == L'\0')
+      return node;
+    for (length = 0; component[length] != L'\0' && component[length] != L'\\';
+         ++length)
+      ;
+    if (directory == NULL) {
+      *Parent = NULL;
+      return NULL;
+    }
+    node = FindChild(directory, component, length);
+    *Parent = directory;
+    *LastName = component;
+    *LastLength = length;
+    directory = node;
+    component += length;
+  }
+}
+
+static PMEMORY_FS_NODE NewNode(LPCWSTR Name, size_t Length, BOOL IsDirectory,
+                               DWORD Attributes) {
+  PMEMORY_FS_NODE node = (PMEMORY_FS_NODE)calloc(1, sizeof(MEMORY_FS_NODE));
+
+  if (node == NULL)
+    return NULL;
+  node->Name = (LPWSTR)malloc((Length + 1) * sizeof(WCHAR));
+  if (node->Name == NULL) {
+    free(node);
+    return NULL;
+  }
+  CopyMemory(node->Name, Name, Length * sizeof(WCHAR));
+  node->Name[Length] = L'\0';
+  node->NameLength = Length;
+  node->References = 1;
+  node->IsDirectory = IsDirectory;
+  node->Index = ++g_NextIndex;
+  InitializeSRWLock(&node->DataLock);
+  node->Attributes = IsDirectory ? FILE_ATTRIBUTE_DIRECTORY
+                                 : (Attributes & ~FILE_ATTRIBUTE_DIRECTORY);
+  if (node->Attributes == 0)
+    node->Attributes = FILE_ATTRIBUTE_NORMAL;
+  GetSystemTimeAsFileTime(&node->CreationTime);
+  node->LastAccessTime = node->CreationTime;
+  node->LastWriteTime = node->CreationTime;
+  return node;
+}
+
+static VOID ReleaseNode(PMEMORY_FS_NODE Node) {
+  if (InterlockedDecrement(&Node->References) != 0)
+    return;
+  free(Node->Data);
+  free(Node->Name);
+  free(Node);
+}
+
+// Called with the namespace lock held exclusively
+static VOID LinkNode(PMEMORY_FS_NODE Parent, PMEMORY_FS_NODE Node) {
+  PMEMORY_FS_NODE *bucket;
+
+  Node->Parent = Parent;
+  Node->Hash = NameHash(Parent, Node->Name, Node->NameLength);
+  bucket = &g_Buckets[Node->Hash % MEMORY_FS_BUCKETS];
+  Node->HashNext = *bucket;
+  *bucket = Node;
+  Node->PrevSibling = NULL;
+  Node->NextSibling = Parent->FirstChild;
+  if (Parent->FirstChild != NULL)
+    Parent->FirstChild->PrevSibling = Node;
+  Parent->FirstChild = Node;
+}
+
+// Called with the namespace lock held exclusively, the caller keeps the
+// reference of the namespace
+static VOID UnlinkNode(PMEMORY_FS_NODE Node) {
+  PMEMORY_FS_NODE *link = &g_Buckets[Node->Hash % MEMORY_FS_BUCKETS];
+
+  while (*link != Node)
+    link = &(*link)->HashNext;
+  *link = Node->HashNext;
+  if (Node->PrevSibling != NULL)
+    Node->PrevSibling->NextSibling = Node->NextSibling;
+  else
+    Node->Parent->FirstChild = Node->NextSibling;
+  if (Node->NextSibling != NULL)
+    Node->NextSibling->PrevSibling = Node->PrevSibling;
+  Node->Parent = NULL;
+  Node->HashNext = NULL;
+  Node->NextSibling = NULL;
+  Node->PrevSibling = NULL;
+}
+
+// Called with the data lock of the file held exclusively
+static BOOL ResizeNode(PMEMORY_FS_NODE Node, ULONGLONG Size) {
+  ULONGLONG capacity;
+  PCHAR data;
+
+  if (Size > Node->Capacity) {
+    capacity = Node->Capacity < 4096 ? 4096 : Node->Capacity;
+    while (capacity < Size)
+      capacity *= 2;
+    if (capacity != (size_t)capacity)
+      return FALSE;
+    data = (PCHAR)realloc(Node->Data, (size_t)capacity);
+    if (data == NULL)
+      return FALSE;
+    Node->Data = data;
+    Node->Capacity = capacity;
+  }
+  if (Size > Node->Size)
+    ZeroMemory(Node->Data + Node->Size, (size_t)(Size - Node->Size));
+  Node->Size = Size;
+  return TRUE;
+}
+
+static PMEMORY_FS_NODE NodeOf(PDOKAN_FILE_INFO DokanFileInfo) {
+  InterlockedIncrement64(&g_CallCount);
+  return (PMEMORY_FS_NODE)(ULONG_PTR)DokanFileInfo->Context;
+}
+
+static NTSTATUS DOKAN_CALLBACK
+MemoryFsCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
+                   ACCESS_MASK DesiredAccess, ULONG FileAttributes,
+                   ULONG ShareAccess, ULONG CreateDisposition,
+                   ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE parent;
+  PMEMORY_FS_NODE node;
+  LPCWSTR lastName;
+  size_t lastLength;
+  NTSTATUS status = STATUS_SUCCESS;
+  BOOL lookupOnly = CreateDisposition == FILE_OPEN;
+
+  UNREFERENCED_PARAMETER(SecurityContext);
+  UNREFERENCED_PARAMETER(DesiredAccess);
+  UNREFERENCED_PARAMETER(ShareAccess);
+  InterlockedIncrement64(&g_CallCount);
+
+  if (lookupOnly)
+    AcquireSRWLockShared(&g_NamespaceLock);
+  else
+    AcquireSRWLockExclusive(&g_NamespaceLock);
+
+  node = Lookup(FileName, &parent, &lastName, &lastLength);
+  if (node != NULL) {
+    if (node->IsDirectory && (CreateOptions & FILE_NON_DIRECTORY_FILE)) {
+      status = STATUS_FILE_IS_A_DIRECTORY;
+    } else if (!node->IsDirectory && (CreateOptions & FILE_DIRECTORY_FILE)) {
+      status = STATUS_NOT_A_DIRECTORY;
+    } else if (CreateDisposition == FILE_CREATE) {
+      status = STATUS_OBJECT_NAME_COLLISION;
+      node = NULL;
+    } else {
+      if (!node->IsDirectory && (CreateDisposition == FILE_OVERWRITE ||
+                                 CreateDisposition == FILE_OVERWRITE_IF ||
+                                 CreateDisposition == FILE_SUPERSEDE)) {
+        AcquireSRWLockExclusive(&node->DataLock);
+        ResizeNode(node, 0);
+        ReleaseSRWLockExclusive(&node->DataLock);
+      }
+      // Success for these dispositions when the file exists
+      if (CreateDisposition == FILE_OPEN_IF ||
+          CreateDisposition == FILE_OVERWRITE_IF ||
+          CreateDisposition == FILE_SUPERSEDE)
+        status = STATUS_OBJECT_NAME_COLLISION;
+    }
+    if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_COLLISION)
+      node = NULL;
+  } else if (parent == NULL || !parent->IsDirectory) {
+    status = STATUS_OBJECT_PATH_NOT_FOUND;
+  } else if (CreateDisposition == FILE_OPEN ||
+             CreateDisposition == FILE_OVERWRITE) {
+    status = STATUS_OBJECT_NAME_NOT_FOUND;
+  } else {
+    node = NewNode(lastName, lastLength,
+                   (CreateOptions & FILE_DIRECTORY_FILE) != 0, FileAttributes);
+    if (node == NULL)
+      status = STATUS_INSUFFICIENT_RESOURCES;
+    else
+      LinkNode(parent, node);
+  }
+
+  if (node != NULL) {
+    InterlockedIncrement(&node->References);
+    DokanFileInfo->Context = (ULONG64)(ULONG_PTR)node;
+    DokanFileInfo->IsDirectory = (UCHAR)node->IsDirectory;
+  }
+
+  if (lookupOnly)
+    ReleaseSRWLockShared(&g_NamespaceLock);
+  else
+    ReleaseSRWLockExclusive(&g_NamespaceLock);
+  return status;
+}
+
+static void DOKAN_CALLBACK MemoryFsCleanupFile(LPCWSTR FileName,
+                                               PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL || !DokanFileInfo->DeleteOnClose)
+    return;
+  AcquireSRWLockExclusive(&g_NamespaceLock);
+  // Another handle may have deleted it already
+  if (node->Parent == NULL ||
+      (node->IsDirectory && node->FirstChild != NULL)) {
+    node = NULL;
+  } else {
+    UnlinkNode(node);
+  }
+  ReleaseSRWLockExclusive(&g_NamespaceLock);
+  if (node != NULL)
+    ReleaseNode(node);
+}
+
+static void DOKAN_CALLBACK MemoryFsCloseFile(LPCWSTR FileName,
+                                             PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node != NULL)
+    ReleaseNode(node);
+  DokanFileInfo->Context = 0;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsReadFile(LPCWSTR FileName, LPVOID Buffer,
+                                                DWORD BufferLength,
+                                                LPDWORD ReadLength,
+                                                LONGLONG Offset,
+                                                PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+  ULONGLONG length = 0;
+
+  UNREFERENCED_PARAMETER(FileName);
+  *ReadLength = 0;
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (node->IsDirectory)
+    return STATUS_INVALID_DEVICE_REQUEST;
+  AcquireSRWLockShared(&node->DataLock);
+  if (Offset >= 0 && (ULONGLONG)Offset < node->Size) {
+    length = node->Size - (ULONGLONG)Offset;
+    if (length > BufferLength)
+      length = BufferLength;
+    CopyMemory(Buffer, node->Data + Offset, (size_t)length);
+  }
+  ReleaseSRWLockShared(&node->DataLock);
+  *ReadLength = (DWORD)length;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsWriteFile(
+    LPCWSTR FileName, LPCVOID Buffer, DWORD NumberOfBytesToWrite,
+    LPDWORD NumberOfBytesWritten, LONGLONG Offset,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+  ULONGLONG offset;
+  ULONGLONG length = NumberOfBytesToWrite;
+  NTSTATUS status = STATUS_SUCCESS;
+
+  UNREFERENCED_PARAMETER(FileName);
+  *NumberOfBytesWritten = 0;
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (node->IsDirectory)
+    return STATUS_INVALID_DEVICE_REQUEST;
+  AcquireSRWLockExclusive(&node->DataLock);
+  offset = DokanFileInfo->WriteToEndOfFile ? node->Size : (ULONGLONG)Offset;
+  // Paging writes do not extend the file
+  if (DokanFileInfo->PagingIo) {
+    if (offset >= node->Size)
+      length = 0;
+    else if (offset + length > node->Size)
+      length = node->Size - offset;
+  }
+  if (length != 0) {
+    if (offset + length > node->Size && !ResizeNode(node, offset + length)) {
+      status = STATUS_DISK_FULL;
+    } else {
+      CopyMemory(node->Data + offset, Buffer, (size_t)length);
+      *NumberOfBytesWritten = (DWORD)length;
+      GetSystemTimeAsFileTime(&node->LastWriteTime);
+    }
+  }
+  ReleaseSRWLockExclusive(&node->DataLock);
+  return status;
+}
+
+static NTSTATUS DOKAN_CALLBACK
+MemoryFsFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(FileName);
+  return NodeOf(DokanFileInfo) != NULL ? STATUS_SUCCESS : STATUS_INVALID_HANDLE;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsGetFileInformation(
+    LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  AcquireSRWLockShared(&node->DataLock);
+  Buffer->dwFileAttributes = node->Attributes;
+  Buffer->ftCreationTime = node->CreationTime;
+  Buffer->ftLastAccessTime = node->LastAccessTime;
+  Buffer->ftLastWriteTime = node->LastWriteTime;
+  Buffer->nFileSizeHigh = (DWORD)(node->Size >> 32);
+  Buffer->nFileSizeLow = (DWORD)node->Size;
+  ReleaseSRWLockShared(&node->DataLock);
+  Buffer->dwVolumeSerialNumber = MEMORY_FS_VOLUME_SERIAL;
+  Buffer->nNumberOfLinks = 1;
+  Buffer->nFileIndexHigh = (DWORD)(node->Index >> 32);
+  Buffer->nFileIndexLow = (DWORD)node->Index;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsFindFiles(LPCWSTR FileName,
+                                                 PFillFindData FillFindData,
+                                                 PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE directory = NodeOf(DokanFileInfo);
+  PMEMORY_FS_NODE node;
+  WIN32_FIND_DATAW findData;
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (directory == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (!directory->IsDirectory)
+    return STATUS_NOT_A_DIRECTORY;
+  ZeroMemory(&findData, sizeof(WIN32_FIND_DATAW));
+  AcquireSRWLockShared(&g_NamespaceLock);
+  for (node = directory->FirstChild; node != NULL; node = node->NextSibling) {
+    AcquireSRWLockShared(&node->DataLock);
+    findData.dwFileAttributes = node->Attributes;
+    findData.ftCreationTime = node->CreationTime;
+    findData.ftLastAccessTime = node->LastAccessTime;
+    findData.ftLastWriteTime = node->LastWriteTime;
+    findData.nFileSizeHigh = (DWORD)(node->Size >> 32);
+    findData.nFileSizeLow = (DWORD)node->Size;
+    ReleaseSRWLockShared(&node->DataLock);
+    wcsncpy_s(findData.cFileName, MAX_PATH, node->Name, _TRUNCATE);
+    FillFindData(&findData, DokanFileInfo);
+  }
+  ReleaseSRWLockShared(&g_NamespaceLock);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsSetFileAttributes(
+    LPCWSTR FileName, DWORD FileAttributes, PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  // 0 leaves them as they are
+  if (FileAttributes == 0)
+    return STATUS_SUCCESS;
+  AcquireSRWLockExclusive(&node->DataLock);
+  node->Attributes =
+      node->IsDirectory ? (FileAttributes | FILE_ATTRIBUTE_DIRECTORY)
+                        : (FileAttributes & ~FILE_ATTRIBUTE_DIRECTORY);
+  ReleaseSRWLockExclusive(&node->DataLock);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsSetFileTime(
+    LPCWSTR FileName, CONST FILETIME *CreationTime,
+    CONST FILETIME *LastAccessTime, CONST FILETIME *LastWriteTime,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  AcquireSRWLockExclusive(&node->DataLock);
+  if (CreationTime != NULL)
+    node->CreationTime = *CreationTime;
+  if (LastAccessTime != NULL)
+    node->LastAccessTime = *LastAccessTime;
+  if (LastWriteTime != NULL)
+    node->LastWriteTime = *LastWriteTime;
+  ReleaseSRWLockExclusive(&node->DataLock);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsDeleteFile(LPCWSTR FileName,
+                                                  PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (node->IsDirectory)
+    return STATUS_ACCESS_DENIED;
+  if (node->Attributes & FILE_ATTRIBUTE_READONLY)
+    return STATUS_CANNOT_DELETE;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK
+MemoryFsDeleteDirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+  NTSTATUS status = STATUS_SUCCESS;
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (node == g_Root)
+    return STATUS_CANNOT_DELETE;
+  AcquireSRWLockShared(&g_NamespaceLock);
+  if (node->FirstChild != NULL)
+    status = STATUS_DIRECTORY_NOT_EMPTY;
+  ReleaseSRWLockShared(&g_NamespaceLock);
+  return status;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsMoveFile(LPCWSTR FileName,
+                                                LPCWSTR NewFileName,
+                                                BOOL ReplaceIfExisting,
+                                                PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+  PMEMORY_FS_NODE parent;
+  PMEMORY_FS_NODE target;
+  PMEMORY_FS_NODE ancestor;
+  LPCWSTR lastName;
+  size_t lastLength;
+  LPWSTR name;
+  NTSTATUS status = STATUS_SUCCESS;
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  AcquireSRWLockExclusive(&g_NamespaceLock);
+  target = Lookup(NewFileName, &parent, &lastName, &lastLength);
+  if (node->Parent == NULL) {
+    status = STATUS_OBJECT_NAME_NOT_FOUND;
+  } else if (parent == NULL || !parent->IsDirectory || lastLength == 0) {
+    status = STATUS_OBJECT_PATH_NOT_FOUND;
+  } else if (target != NULL && target != node && !ReplaceIfExisting) {
+    status = STATUS_OBJECT_NAME_COLLISION;
+  } else if (target != NULL && target != node && target->IsDirectory) {
+    status = STATUS_ACCESS_DENIED;
+  } else {
+    // A directory cannot move below itself
+    for (ancestor = parent; ancestor != NULL; ancestor = ancestor->Parent) {
+      if (ancestor == node)
+        status = STATUS_INVALID_PARAMETER;
+    }
+  }
+  if (status == STATUS_SUCCESS) {
+    name = (LPWSTR)malloc((lastLength + 1) * sizeof(WCHAR));
+    if (name == NULL) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+      CopyMemory(name, lastName, lastLength * sizeof(WCHAR));
+      name[lastLength] = L'\0';
+      if (target != NULL && target != node)
+        UnlinkNode(target);
+      else
+        target = NULL;
+      UnlinkNode(node);
+      free(node->Name);
+      node->Name = name;
+      node->NameLength = lastLength;
+      LinkNode(parent, node);
+    }
+  } else {
+    target = NULL;
+  }
+  ReleaseSRWLockExclusive(&g_NamespaceLock);
+  if (target != NULL)
+    ReleaseNode(target);
+  return status;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsSetEndOfFile(
+    LPCWSTR FileName, LONGLONG ByteOffset, PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+  NTSTATUS status = STATUS_SUCCESS;
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (ByteOffset < 0)
+    return STATUS_INVALID_PARAMETER;
+  AcquireSRWLockExclusive(&node->DataLock);
+  if (!ResizeNode(node, (ULONGLONG)ByteOffset))
+    status = STATUS_DISK_FULL;
+  ReleaseSRWLockExclusive(&node->DataLock);
+  return status;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsSetAllocationSize(
+    LPCWSTR FileName, LONGLONG AllocSize, PDOKAN_FILE_INFO DokanFileInfo) {
+  PMEMORY_FS_NODE node = NodeOf(DokanFileInfo);
+
+  UNREFERENCED_PARAMETER(FileName);
+  if (node == NULL)
+    return STATUS_INVALID_HANDLE;
+  if (AllocSize < 0)
+    return STATUS_INVALID_PARAMETER;
+  // Only a smaller allocation changes the file
+  AcquireSRWLockExclusive(&node->DataLock);
+  if ((ULONGLONG)AllocSize < node->Size)
+    ResizeNode(node, (ULONGLONG)AllocSize);
+  ReleaseSRWLockExclusive(&node->DataLock);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsGetDiskFreeSpace(
+    PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes,
+    PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(DokanFileInfo);
+  InterlockedIncrement64(&g_CallCount);
+  *FreeBytesAvailable = MEMORY_FS_VOLUME_SIZE;
+  *TotalNumberOfBytes = MEMORY_FS_VOLUME_SIZE;
+  *TotalNumberOfFreeBytes = MEMORY_FS_VOLUME_SIZE;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MemoryFsGetVolumeInformation(
+    LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber,
+    LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags,
+    LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(DokanFileInfo);
+  InterlockedIncrement64(&g_CallCount);
+  wcscpy_s(VolumeNameBuffer, VolumeNameSize, L"MemoryFs");
+  *VolumeSerialNumber = MEMORY_FS_VOLUME_SERIAL;
+  *MaximumComponentLength = 255;
+  *FileSystemFlags = FILE_CASE_PRESERVED_NAMES | FILE_UNICODE_ON_DISK;
+  wcscpy_s(FileSystemNameBuffer, FileSystemNameSize, L"MemoryFs");
+  return STATUS_SUCCESS;
+}
+
+VOID MemoryFsInit(PDOKAN_OPERATIONS Operations) {
+  g_NextIndex = 0;
+  g_CallCount = 0;
+  g_Root = NewNode(L"", 0, TRUE, FILE_ATTRIBUTE_DIRECTORY);
+
+  ZeroMemory(Operations, sizeof(DOKAN_OPERATIONS));
+  Operations->ZwCreateFile = MemoryFsCreateFile;
+  Operations->Cleanup = MemoryFsCleanupFile;
+  Operations->CloseFile = MemoryFsCloseFile;
+  Operations->ReadFile = MemoryFsReadFile;
+  Operations->WriteFile = MemoryFsWriteFile;
+  Operations->FlushFileBuffers = MemoryFsFlushFileBuffers;
+  Operations->GetFileInformation = MemoryFsGetFileInformation;
+  Operations->FindFiles = MemoryFsFindFiles;
+  Operations->SetFileAttributes = MemoryFsSetFileAttributes;
+  Operations->SetFileTime = MemoryFsSetFileTime;
+  Operations->DeleteFile = MemoryFsDeleteFile;
+  Operations->DeleteDirectory = MemoryFsDeleteDirectory;
+  Operations->MoveFile = MemoryFsMoveFile;
+  Operations->SetEndOfFile = MemoryFsSetEndOfFile;
+  Operations->SetAllocationSize = MemoryFsSetAllocationSize;
+  Operations->GetDiskFreeSpace = MemoryFsGetDiskFreeSpace;
+  Operations->GetVolumeInformation = MemoryFsGetVolumeInformation;
+}
+
+VOID MemoryFsCleanup(void) {
+  PMEMORY_FS_NODE node;
+  ULONG i;
+
+  for (i = 0; i < MEMORY_FS_BUCKETS; ++i) {
+    while ((node = g_Buckets[i]) != NULL) {
+      g_Buckets[i] = node->HashNext;
+      ReleaseNode(node);
+    }
+  }
+  if (g_Root != NULL)
+    ReleaseNode(g_Root);
+  g_Root = NULL;
+}
+
+LONG64 MemoryFsCallCount(void) { return g_CallCount; }
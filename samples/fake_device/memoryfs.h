@@ -0,0 +1,54 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYFS_H_
+#define MEMORYFS_H_
+
+// In-memory file system implementing DOKAN_OPERATIONS, the reference backend
+// of the samples that run the dispatch functions on the fake device.
+//
+// Names are compared without case like on NTFS. Each directory indexes its
+// entries in a hash table shared by the whole file system, so an open costs
+// one lookup per component of its name and a rename only moves one entry.
+// The namespace has one lock, the data of each file has its own. Files
+// removed while they are opened live until their last handle is closed.
+
+#include "dokani.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts an empty file system with only its root and fills Operations with
+// its callbacks. Called again after MemoryFsCleanup to start over.
+VOID MemoryFsInit(PDOKAN_OPERATIONS Operations);
+
+// Frees the file system, once no handle is opened on it anymore.
+VOID MemoryFsCleanup(void);
+
+// Number of callbacks run since MemoryFsInit.
+LONG64 MemoryFsCallCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MEMORYFS_H_
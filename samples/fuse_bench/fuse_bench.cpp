@@ -0,0 +1,532 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark of the FUSE bridge of dokan_fuse/src/fusemain.cpp over
+// samples/fuse_memfs, without a mounted volume. The Dokan callbacks of
+// dokanfuse.cpp are replayed on impl_fuse_context with a synthetic
+// DOKAN_FILE_INFO, so what is measured is the bridge and the in-memory
+// backend. Every thread replays traces of one mix:
+//   read  - open a shared file, read it sequentially, cleanup and close
+//   write - overwrite a file of the thread, write it, cleanup and close
+//   stat  - open a shared file, get its information, cleanup and close
+//   find  - open the directory of the files, list it, cleanup and close
+//   mixed - 50% read, 20% write, 20% stat and 10% find traces
+// and reports callbacks per second, their latency percentiles and how many
+// fuse_operations calls each of them made.
+//
+// Build it on Linux with the Win32 shim, fusememfs.c and fuse_opt.c with a C
+// compiler and the bridge with a C++11 compiler:
+//   gcc -c -O2 -D_WIN32 -D_FILE_OFFSET_BITS=64 -I../win32_shim
+//       -I../../dokan_fuse/include fuse_bench_memfs.c
+//       ../../dokan_fuse/src/fuse_opt.c
+//   g++ -O2 -std=c++11 -pthread -D_WIN32 -D_FILE_OFFSET_BITS=64
+//       -I../win32_shim -I../../sys -I../../dokan_fuse/include fuse_bench.cpp
+//       ../../dokan_fuse/src/fusemain.cpp ../../dokan_fuse/src/utils.cpp
+//       ../../dokan_fuse/src/fusestats.cpp fuse_bench_memfs.o fuse_opt.o
+//       -o fuse_bench
+//
+// fuse_bench [/t 1,2,4,8] [/d Seconds] [/m read,write,stat,find,mixed]
+//            [/s IoSize] [/f SharedFiles] [/l BackendLatencyUs]
+//            [/r ReadAhead] [/w WriteBack]
+//
+// Exits with 1 if a callback failed.
+
+#include <windows.h>
+
+#include "fusemain.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" int fusememfs_main(int argc, char *argv[]);
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Reads or writes of one trace, each of the I/O size
+const unsigned kIoPerTrace = 4;
+// Latencies kept per callback and thread for the percentiles
+const size_t kMaxSamples = 1 << 20;
+
+const wchar_t kDirectory[] = L"\\bench";
+
+// Dokan callbacks replayed by the traces
+enum Callback {
+  kCreateFile,
+  kReadFile,
+  kWriteFile,
+  kGetFileInformation,
+  kFindFiles,
+  kCleanup,
+  kCloseFile,
+  kCallbackCount
+};
+
+const char *const kCallbackNames[kCallbackCount] = {
+    "CreateFile", "ReadFile", "WriteFile", "GetFileInformation",
+    "FindFiles",  "Cleanup",  "CloseFile"};
+
+const impl_fuse_op kCallbackOps[kCallbackCount] = {
+    FUSE_OP_CREATE_FILE,          FUSE_OP_READ_FILE, FUSE_OP_WRITE_FILE,
+    FUSE_OP_GET_FILE_INFORMATION, FUSE_OP_FIND_FILES, FUSE_OP_CLEANUP,
+    FUSE_OP_CLOSE_FILE};
+
+struct Options {
+  std::vector<unsigned> threads{1, 2, 4, 8};
+  double seconds = 2;
+  std::vector<std::string> mixes{"read", "write", "stat", "find", "mixed"};
+  unsigned ioSize = 4096;
+  unsigned sharedFiles = 64;
+  unsigned latencyUs = 0;
+  unsigned readAhead = 0;
+  unsigned writeBack = 0;
+};
+
+struct CallbackStats {
+  uint64_t calls = 0;
+  uint64_t failures = 0;
+  uint64_t backendCalls = 0;
+  std::vector<uint32_t> latencyNs;
+};
+
+struct ThreadStats {
+  CallbackStats callbacks[kCallbackCount];
+};
+
+Options g_Options;
+impl_fuse_context *g_Impl;
+DOKAN_OPTIONS g_DokanOptions;
+uint64_t g_Failures;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+double Percentile(std::vector<uint32_t> &Samples, double Percent) {
+  if (Samples.empty())
+    return 0;
+  size_t index = static_cast<size_t>(Samples.size() * Percent / 100.0);
+  if (index >= Samples.size())
+    index = Samples.size() - 1;
+  std::nth_element(Samples.begin(), Samples.begin() + index, Samples.end());
+  return Samples[index];
+}
+
+std::wstring SharedFileName(unsigned Index) {
+  return std::wstring(kDirectory) + L"\\shared" + std::to_wstring(Index);
+}
+
+int WINAPI CountFindData(PWIN32_FIND_DATAW FindData,
+                         PDOKAN_FILE_INFO DokanFileInfo) {
+  (void)FindData;
+  (void)DokanFileInfo;
+  return 0;
+}
+
+// As WalkDirectoryWithSetFuseContext of dokanfuse.cpp
+int WalkDirectory(PDOKAN_FILE_INFO DokanFileInfo, void *buf, const char *name,
+                  const struct FUSE_STAT *stbuf, FUSE_OFF_T off) {
+  impl_chain_guard guard(g_Impl, DokanFileInfo->ProcessId);
+  return impl_fuse_context::walk_directory(buf, name, stbuf, off);
+}
+
+// The handle of one thread on the bridge. Each call goes through the FUSE
+// frame and the stats timer as the callbacks of dokanfuse.cpp do, and is
+// timed with the fuse_operations calls it made.
+class Session {
+public:
+  Session(ULONG ProcessId, ThreadStats &Stats)
+      : processId_(ProcessId), stats_(Stats), buffer_(g_Options.ioSize) {
+    std::memset(&info_, 0, sizeof(info_));
+  }
+
+  bool Open(const std::wstring &FileName, DWORD DesiredAccess,
+            DWORD Disposition) {
+    Reset();
+    return Call(kCreateFile, [&]() -> NTSTATUS {
+      NTSTATUS status = g_Impl->create_file(
+          FileName.c_str(), DesiredAccess,
+          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, Disposition,
+          FILE_ATTRIBUTE_NORMAL, FILE_NON_DIRECTORY_FILE, &info_);
+      // Tells Dokan that an existing file was opened
+      if (status == STATUS_OBJECT_NAME_COLLISION &&
+          (Disposition == FILE_OPEN_IF || Disposition == FILE_OVERWRITE_IF))
+        status = STATUS_SUCCESS;
+      return status;
+    });
+  }
+
+  bool OpenDirectory(const std::wstring &FileName) {
+    Reset();
+    info_.IsDirectory = TRUE;
+    return Call(kCreateFile, [&] {
+      return errno_to_ntstatus_error(
+          g_Impl->open_directory(FileName.c_str(), &info_));
+    });
+  }
+
+  bool Read(const std::wstring &FileName, LONGLONG Offset) {
+    DWORD read = 0;
+    return Call(kReadFile, [&] {
+             return errno_to_ntstatus_error(
+                 g_Impl->read_file(FileName.c_str(), buffer_.data(),
+                                   g_Options.ioSize, &read, Offset, &info_));
+           }) &&
+           Check(kReadFile, read == g_Options.ioSize);
+  }
+
+  bool Write(const std::wstring &FileName, LONGLONG Offset) {
+    DWORD written = 0;
+    return Call(kWriteFile, [&] {
+             return errno_to_ntstatus_error(
+                 g_Impl->write_file(FileName.c_str(), buffer_.data(),
+                                    g_Options.ioSize, &written, Offset,
+                                    &info_));
+           }) &&
+           Check(kWriteFile, written == g_Options.ioSize);
+  }
+
+  bool GetFileInformation(const std::wstring &FileName) {
+    BY_HANDLE_FILE_INFORMATION information;
+    return Call(kGetFileInformation, [&] {
+      return errno_to_ntstatus_error(g_Impl->get_file_information(
+          FileName.c_str(), &information, &info_));
+    });
+  }
+
+  bool FindFiles(const std::wstring &FileName) {
+    return Call(kFindFiles, [&] {
+      return errno_to_ntstatus_error(g_Impl->find_files(
+          FileName.c_str(), CountFindData, WalkDirectory, &info_));
+    });
+  }
+
+  // Cleanup and CloseFile as for the last handle on the file
+  void Close(const std::wstring &FileName) {
+    Call(kCleanup, [&] {
+      return errno_to_ntstatus_error(
+          g_Impl->cleanup(FileName.c_str(), &info_));
+    });
+    Call(kCloseFile, [&] {
+      return errno_to_ntstatus_error(
+          g_Impl->close_file(FileName.c_str(), &info_));
+    });
+  }
+
+private:
+  void Reset() {
+    std::memset(&info_, 0, sizeof(info_));
+    info_.DokanOptions = &g_DokanOptions;
+    info_.ProcessId = processId_;
+  }
+
+  template <typename Body> bool Call(Callback Kind, Body Run) {
+    CallbackStats &stats = stats_.callbacks[Kind];
+    int64_t backendCalls = impl_fuse_stats::backend_calls();
+    uint64_t start = NowNs();
+    NTSTATUS status;
+    {
+      impl_chain_guard guard(g_Impl, processId_);
+      impl_fuse_op_timer timer(g_Impl->stats(), kCallbackOps[Kind]);
+      status = Run();
+    }
+    uint64_t elapsed = NowNs() - start;
+    stats.calls++;
+    stats.backendCalls += impl_fuse_stats::backend_calls() - backendCalls;
+    if (stats.latencyNs.size() < kMaxSamples)
+      stats.latencyNs.push_back(
+          static_cast<uint32_t>(std::min<uint64_t>(elapsed, UINT32_MAX)));
+    return Check(Kind, status == STATUS_SUCCESS);
+  }
+
+  bool Check(Callback Kind, bool Succeeded) {
+    if (!Succeeded)
+      stats_.callbacks[Kind].failures++;
+    return Succeeded;
+  }
+
+  ULONG processId_;
+  ThreadStats &stats_;
+  std::vector<char> buffer_;
+  DOKAN_FILE_INFO info_;
+};
+
+void ReadTrace(Session &Session_, const std::wstring &FileName) {
+  if (!Session_.Open(FileName, FILE_GENERIC_READ, FILE_OPEN))
+    return;
+  for (unsigned i = 0; i < kIoPerTrace; ++i)
+    Session_.Read(FileName, static_cast<LONGLONG>(i) * g_Options.ioSize);
+  Session_.Close(FileName);
+}
+
+void WriteTrace(Session &Session_, const std::wstring &FileName) {
+  if (!Session_.Open(FileName, FILE_GENERIC_WRITE, FILE_OVERWRITE_IF))
+    return;
+  for (unsigned i = 0; i < kIoPerTrace; ++i)
+    Session_.Write(FileName, static_cast<LONGLONG>(i) * g_Options.ioSize);
+  Session_.Close(FileName);
+}
+
+void StatTrace(Session &Session_, const std::wstring &FileName) {
+  if (!Session_.Open(FileName, FILE_READ_ATTRIBUTES, FILE_OPEN))
+    return;
+  Session_.GetFileInformation(FileName);
+  Session_.Close(FileName);
+}
+
+void FindTrace(Session &Session_) {
+  if (!Session_.OpenDirectory(kDirectory))
+    return;
+  Session_.FindFiles(kDirectory);
+  Session_.Close(kDirectory);
+}
+
+void Worker(const std::string &Mix, unsigned Index,
+            const std::atomic<bool> &Stop, ThreadStats &Stats) {
+  Session session(1000 + Index, Stats);
+  std::minstd_rand random(Index);
+  std::wstring own =
+      std::wstring(kDirectory) + L"\\thread" + std::to_wstring(Index);
+  std::vector<std::wstring> shared;
+  for (unsigned i = 0; i < g_Options.sharedFiles; ++i)
+    shared.push_back(SharedFileName(i));
+
+  while (!Stop.load(std::memory_order_relaxed)) {
+    const std::wstring &file = shared[random() % shared.size()];
+    unsigned pick = Mix == "mixed" ? random() % 100 : 0;
+    if (Mix == "read" || (Mix == "mixed" && pick < 50))
+      ReadTrace(session, file);
+    else if (Mix == "write" || (Mix == "mixed" && pick < 70))
+      WriteTrace(session, own);
+    else if (Mix == "stat" || (Mix == "mixed" && pick < 90))
+      StatTrace(session, file);
+    else
+      FindTrace(session);
+  }
+}
+
+// Creates the directory and the shared files the traces read
+bool Populate() {
+  ThreadStats stats;
+  Session session(1, stats);
+  bool created;
+  {
+    impl_chain_guard guard(g_Impl, 1);
+    created = g_Impl->create_directory(kDirectory, nullptr) == 0;
+  }
+  if (!created)
+    return false;
+  for (unsigned i = 0; i < g_Options.sharedFiles; ++i)
+    WriteTrace(session, SharedFileName(i));
+  for (const CallbackStats &callback : stats.callbacks) {
+    if (callback.failures != 0)
+      return false;
+  }
+  return true;
+}
+
+void Run(const std::string &Mix, unsigned Threads) {
+  std::vector<ThreadStats> stats(Threads);
+  std::vector<std::thread> workers;
+  std::atomic<bool> stop(false);
+  uint64_t start = NowNs();
+  for (unsigned i = 0; i < Threads; ++i)
+    workers.emplace_back(Worker, std::cref(Mix), i + 1, std::cref(stop),
+                         std::ref(stats[i]));
+  std::this_thread::sleep_for(std::chrono::duration<double>(g_Options.seconds));
+  stop.store(true);
+  for (std::thread &worker : workers)
+    worker.join();
+  double elapsed = (NowNs() - start) / 1e9;
+
+  ThreadStats total;
+  CallbackStats all;
+  for (int kind = 0; kind < kCallbackCount; ++kind) {
+    CallbackStats &callback = total.callbacks[kind];
+    for (ThreadStats &thread : stats) {
+      CallbackStats &own = thread.callbacks[kind];
+      callback.calls += own.calls;
+      callback.failures += own.failures;
+      callback.backendCalls += own.backendCalls;
+      callback.latencyNs.insert(callback.latencyNs.end(),
+                                own.latencyNs.begin(), own.latencyNs.end());
+    }
+    all.calls += callback.calls;
+    all.failures += callback.failures;
+    all.backendCalls += callback.backendCalls;
+    all.latencyNs.insert(all.latencyNs.end(), callback.latencyNs.begin(),
+                         callback.latencyNs.end());
+  }
+  g_Failures += all.failures;
+
+  std::printf("%-6s %7u %-18s %12.0f %9.1f %9.1f %9.1f %10.2f %8llu\n",
+              Mix.c_str(), Threads, "all", all.calls / elapsed,
+              Percentile(all.latencyNs, 50) / 1e3,
+              Percentile(all.latencyNs, 99) / 1e3,
+              Percentile(all.latencyNs, 99.9) / 1e3,
+              all.calls ? static_cast<double>(all.backendCalls) / all.calls : 0,
+              static_cast<unsigned long long>(all.failures));
+  for (int kind = 0; kind < kCallbackCount; ++kind) {
+    CallbackStats &callback = total.callbacks[kind];
+    if (callback.calls == 0)
+      continue;
+    std::printf("%-6s %7s %-18s %12.0f %9.1f %9.1f %9.1f %10.2f %8llu\n", "",
+                "", kCallbackNames[kind], callback.calls / elapsed,
+                Percentile(callback.latencyNs, 50) / 1e3,
+                Percentile(callback.latencyNs, 99) / 1e3,
+                Percentile(callback.latencyNs, 99.9) / 1e3,
+                static_cast<double>(callback.backendCalls) / callback.calls,
+                static_cast<unsigned long long>(callback.failures));
+  }
+}
+
+void ParseList(const char *Value, std::vector<std::string> &Items) {
+  Items.clear();
+  std::string list(Value);
+  size_t position = 0;
+  while (position <= list.size()) {
+    size_t end = list.find(',', position);
+    if (end == std::string::npos)
+      end = list.size();
+    Items.push_back(list.substr(position, end - position));
+    position = end + 1;
+  }
+}
+
+bool ParseOptions(int argc, char *argv[], Options &Options_) {
+  std::vector<std::string> items;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc || std::strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-'))
+      return false;
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 't':
+      ParseList(value, items);
+      Options_.threads.clear();
+      for (const std::string &item : items) {
+        unsigned threads = std::strtoul(item.c_str(), nullptr, 10);
+        if (threads == 0)
+          return false;
+        Options_.threads.push_back(threads);
+      }
+      break;
+    case 'd':
+      Options_.seconds = std::atof(value);
+      break;
+    case 'm':
+      ParseList(value, Options_.mixes);
+      for (const std::string &mix : Options_.mixes) {
+        if (mix != "read" && mix != "write" && mix != "stat" &&
+            mix != "find" && mix != "mixed")
+          return false;
+      }
+      break;
+    case 's':
+      Options_.ioSize = std::strtoul(value, nullptr, 10);
+      break;
+    case 'f':
+      Options_.sharedFiles = std::strtoul(value, nullptr, 10);
+      break;
+    case 'l':
+      Options_.latencyUs = std::strtoul(value, nullptr, 10);
+      break;
+    case 'r':
+      Options_.readAhead = std::strtoul(value, nullptr, 10);
+      break;
+    case 'w':
+      Options_.writeBack = std::strtoul(value, nullptr, 10);
+      break;
+    default:
+      return false;
+    }
+  }
+  return Options_.seconds > 0 && Options_.ioSize > 0 &&
+         Options_.sharedFiles > 0;
+}
+
+} // namespace
+
+// Called by the main of fusememfs.c once the filesystem is ready, in place of
+// the one of dokanfuse.cpp that mounts it
+extern "C" int fuse_main_real(int argc, char *argv[],
+                              const struct fuse_operations *op,
+                              size_t op_size, void *user_data) {
+  (void)argc;
+  (void)argv;
+  (void)op_size;
+
+  impl_fuse_context impl(op, user_data, false, 0777, 0777, nullptr, nullptr,
+                         nullptr, 1, g_Options.readAhead, g_Options.writeBack,
+                         true);
+  g_Impl = &impl;
+  g_DokanOptions.GlobalContext = reinterpret_cast<ULONG64>(&impl);
+
+  if (!Populate()) {
+    std::fprintf(stderr, "Cannot create the files of the benchmark\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("Latencies are in us, backend is the number of fuse_operations "
+              "calls per callback\n");
+  std::printf("%-6s %7s %-18s %12s %9s %9s %9s %10s %8s\n", "mix", "threads",
+              "callback", "calls/s", "p50", "p99", "p99.9", "backend",
+              "failed");
+  for (const std::string &mix : g_Options.mixes) {
+    for (unsigned threads : g_Options.threads)
+      Run(mix, threads);
+  }
+
+  impl.unmounted(nullptr);
+  return g_Failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  if (!ParseOptions(argc, argv, g_Options)) {
+    std::fprintf(stderr, "fuse_bench [/t 1,2,4,8] [/d Seconds] "
+                         "[/m read,write,stat,find,mixed] [/s IoSize] "
+                         "[/f SharedFiles] [/l BackendLatencyUs] "
+                         "[/r ReadAhead] [/w WriteBack]\n");
+    return EXIT_FAILURE;
+  }
+
+  // The options of fusememfs.c, its main hands the filesystem to
+  // fuse_main_real above
+  std::string latency = "memfs_latency=" + std::to_string(g_Options.latencyUs);
+  char name[] = "fuse_bench";
+  char option[] = "-o";
+  std::vector<char> value(latency.begin(), latency.end());
+  value.push_back('\0');
+  char *memfsArgv[] = {name, option, value.data(), nullptr};
+  return fusememfs_main(3, memfsArgv);
+}
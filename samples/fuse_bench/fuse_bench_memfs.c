@@ -0,0 +1,38 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Builds samples/fuse_memfs as the backend of fuse_bench.cpp. Its main is
+// renamed so that the benchmark can run it: it parses the options of the
+// filesystem, creates the root and hands memfs_oper to fuse_main_real, which
+// the benchmark defines instead of dokanfuse.
+
+#include <windows.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <fuse.h>
+
+// With _WIN32 the bridge takes the stat of Cygwin and 64-bit offsets, not the
+// types of the C runtime that fusememfs.c uses
+#define stat FUSE_STAT
+#define off_t FUSE_OFF_T
+
+#define main fusememfs_main
+#include "../fuse_memfs/fusememfs.c"
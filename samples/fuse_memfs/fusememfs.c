@@ -0,0 +1,632 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+/** @file
+ * @tableofcontents
+ *
+ * fusememfs.c - FUSE: in-memory filesystem
+ *
+ * Keeps the whole tree in memory so that the cost measured through it is
+ * the one of the FUSE bridge and not of a backing store. Mount it with
+ * "-o stats" to get per-operation figures of the bridge on unmount, and
+ * with "-o memfs_latency=N" to simulate a backend answering in N us.
+ *
+ * \section section_compile compiling this example
+ *
+ * gcc -Wall fusememfs.c `pkg-config fuse --cflags --libs` -o fusememfs
+ *
+ * \section section_source the complete source
+ * \include fusememfs.c
+ */
+
+
+#define FUSE_USE_VERSION 27
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fuse.h>
+#include <fuse_opt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+struct memfs_node {
+	char *name;
+	mode_t mode;
+	char *data;		/* File content or symlink target */
+	size_t size;
+	size_t capacity;
+	time_t atime, mtime, ctime;
+	struct memfs_node *parent;
+	struct memfs_node *children;
+	struct memfs_node *next;
+};
+
+struct memfs_config {
+	unsigned int latency;	/* Microseconds added to each call */
+};
+
+static struct memfs_config memfs_conf;
+static struct memfs_node *memfs_root;
+static pthread_mutex_t memfs_lock;
+
+#define MEMFS_OPT(t, p, v) { t, offsetof(struct memfs_config, p), v }
+
+static const struct fuse_opt memfs_opts[] = {
+	MEMFS_OPT("memfs_latency=%u", latency, 0),
+	FUSE_OPT_END
+};
+
+static void memfs_enter(void)
+{
+	if (memfs_conf.latency)
+		usleep(memfs_conf.latency);
+	pthread_mutex_lock(&memfs_lock);
+}
+
+static void memfs_leave(void)
+{
+	pthread_mutex_unlock(&memfs_lock);
+}
+
+static struct memfs_node *memfs_new_node(const char *name, mode_t mode)
+{
+	struct memfs_node *node = calloc(1, sizeof(struct memfs_node));
+	if (node == NULL)
+		return NULL;
+	node->name = strdup(name);
+	if (node->name == NULL) {
+		free(node);
+		return NULL;
+	}
+	node->mode = mode;
+	node->atime = node->mtime = node->ctime = time(NULL);
+	return node;
+}
+
+static void memfs_free_node(struct memfs_node *node)
+{
+	while (node->children) {
+		struct memfs_node *child = node->children;
+		node->children = child->next;
+		memfs_free_node(child);
+	}
+	free(node->data);
+	free(node->name);
+	free(node);
+}
+
+static void memfs_link_node(struct memfs_node *parent, struct memfs_node *node)
+{
+	node->parent = parent;
+	node->next = parent->children;
+	parent->children = node;
+	parent->mtime = parent->ctime = time(NULL);
+}
+
+static void memfs_unlink_node(struct memfs_node *node)
+{
+	struct memfs_node **link = &node->parent->children;
+	while (*link != node)
+		link = &(*link)->next;
+	*link = node->next;
+	node->parent->mtime = node->parent->ctime = time(NULL);
+	node->parent = NULL;
+	node->next = NULL;
+}
+
+static struct memfs_node *memfs_child(struct memfs_node *dir, const char *name,
+				      size_t len)
+{
+	struct memfs_node *child;
+	for (child = dir->children; child; child = child->next)
+		if (strlen(child->name) == len && !strncmp(child->name, name, len))
+			return child;
+	return NULL;
+}
+
+static struct memfs_node *memfs_lookup(const char *path)
+{
+	struct memfs_node *node = memfs_root;
+	while (node && *path) {
+		const char *end;
+		while (*path == '/')
+			path++;
+		if (!*path)
+			break;
+		if (!S_ISDIR(node->mode))
+			return NULL;
+		end = strchr(path, '/');
+		if (end == NULL)
+			end = path + strlen(path);
+		node = memfs_child(node, path, end - path);
+		path = end;
+	}
+	return node;
+}
+
+/* Finds the parent directory of path and the last component of it */
+static int memfs_lookup_parent(const char *path, struct memfs_node **parent,
+			       const char **name)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+
+	if (slash == NULL || slash[1] == '\0')
+		return -EINVAL;
+	dir = strndup(path, slash - path);
+	if (dir == NULL)
+		return -ENOMEM;
+	*parent = memfs_lookup(dir);
+	free(dir);
+	if (*parent == NULL)
+		return -ENOENT;
+	if (!S_ISDIR((*parent)->mode))
+		return -ENOTDIR;
+	*name = slash + 1;
+	return 0;
+}
+
+static int memfs_add(const char *path, mode_t mode, struct memfs_node **res)
+{
+	struct memfs_node *parent, *node;
+	const char *name;
+	int err = memfs_lookup_parent(path, &parent, &name);
+	if (err)
+		return err;
+	if (memfs_child(parent, name, strlen(name)))
+		return -EEXIST;
+	node = memfs_new_node(name, mode);
+	if (node == NULL)
+		return -ENOMEM;
+	memfs_link_node(parent, node);
+	if (res)
+		*res = node;
+	return 0;
+}
+
+static int memfs_resize(struct memfs_node *node, size_t size)
+{
+	if (size > node->capacity) {
+		size_t capacity = node->capacity ? node->capacity : 4096;
+		char *data;
+		while (capacity < size)
+			capacity *= 2;
+		data = realloc(node->data, capacity);
+		if (data == NULL)
+			return -ENOMEM;
+		node->data = data;
+		node->capacity = capacity;
+	}
+	if (size > node->size)
+		memset(node->data + node->size, 0, size - node->size);
+	node->size = size;
+	node->mtime = node->ctime = time(NULL);
+	return 0;
+}
+
+static void *memfs_init(struct fuse_conn_info *conn)
+{
+	/* Every call takes memfs_lock, concurrent reads are safe */
+	conn->async_read = 1;
+	return NULL;
+}
+
+static void memfs_destroy(void *private_data)
+{
+	(void) private_data;
+	memfs_free_node(memfs_root);
+	memfs_root = NULL;
+}
+
+static int memfs_getattr(const char *path, struct stat *stbuf)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else {
+		memset(stbuf, 0, sizeof(struct stat));
+		stbuf->st_mode = node->mode;
+		stbuf->st_nlink = S_ISDIR(node->mode) ? 2 : 1;
+		stbuf->st_size = node->size;
+		stbuf->st_atime = node->atime;
+		stbuf->st_mtime = node->mtime;
+		stbuf->st_ctime = node->ctime;
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_fgetattr(const char *path, struct stat *stbuf,
+			  struct fuse_file_info *fi)
+{
+	(void) fi;
+	return memfs_getattr(path, stbuf);
+}
+
+static int memfs_readlink(const char *path, char *buf, size_t size)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else if (!S_ISLNK(node->mode)) {
+		res = -EINVAL;
+	} else {
+		size_t len = node->size < size - 1 ? node->size : size - 1;
+		memcpy(buf, node->data, len);
+		buf[len] = '\0';
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+			 off_t offset, struct fuse_file_info *fi)
+{
+	struct memfs_node *node, *child;
+	int res = 0;
+
+	(void) offset;
+	(void) fi;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else if (!S_ISDIR(node->mode)) {
+		res = -ENOTDIR;
+	} else {
+		filler(buf, ".", NULL, 0);
+		filler(buf, "..", NULL, 0);
+		for (child = node->children; child; child = child->next) {
+			struct stat st;
+			memset(&st, 0, sizeof(st));
+			st.st_mode = child->mode;
+			st.st_size = child->size;
+			st.st_mtime = child->mtime;
+			if (filler(buf, child->name, &st, 0))
+				break;
+		}
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_mkdir(const char *path, mode_t mode)
+{
+	int res;
+
+	memfs_enter();
+	res = memfs_add(path, S_IFDIR | (mode & 07777), NULL);
+	memfs_leave();
+	return res;
+}
+
+static int memfs_unlink(const char *path)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else if (S_ISDIR(node->mode)) {
+		res = -EISDIR;
+	} else {
+		memfs_unlink_node(node);
+		memfs_free_node(node);
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_rmdir(const char *path)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else if (!S_ISDIR(node->mode)) {
+		res = -ENOTDIR;
+	} else if (node->children) {
+		res = -ENOTEMPTY;
+	} else if (node == memfs_root) {
+		res = -EBUSY;
+	} else {
+		memfs_unlink_node(node);
+		memfs_free_node(node);
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_symlink(const char *from, const char *to)
+{
+	struct memfs_node *node;
+	int res;
+
+	memfs_enter();
+	res = memfs_add(to, S_IFLNK | 0777, &node);
+	if (res == 0) {
+		res = memfs_resize(node, strlen(from));
+		if (res == 0)
+			memcpy(node->data, from, node->size);
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_rename(const char *from, const char *to)
+{
+	struct memfs_node *node, *parent, *target, *dir;
+	const char *name;
+	char *new_name;
+	int res;
+
+	memfs_enter();
+	node = memfs_lookup(from);
+	res = memfs_lookup_parent(to, &parent, &name);
+	if (node == NULL)
+		res = -ENOENT;
+	if (res)
+		goto out;
+
+	/* A directory cannot be moved below itself */
+	for (dir = parent; dir; dir = dir->parent) {
+		if (dir == node) {
+			res = -EINVAL;
+			goto out;
+		}
+	}
+
+	target = memfs_child(parent, name, strlen(name));
+	if (target == node)
+		goto out;
+	if (target) {
+		if (S_ISDIR(target->mode) && target->children) {
+			res = -ENOTEMPTY;
+			goto out;
+		}
+		memfs_unlink_node(target);
+		memfs_free_node(target);
+	}
+
+	new_name = strdup(name);
+	if (new_name == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	memfs_unlink_node(node);
+	free(node->name);
+	node->name = new_name;
+	node->ctime = time(NULL);
+	memfs_link_node(parent, node);
+out:
+	memfs_leave();
+	return res;
+}
+
+static int memfs_chmod(const char *path, mode_t mode)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else {
+		node->mode = (node->mode & S_IFMT) | (mode & 07777);
+		node->ctime = time(NULL);
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_truncate(const char *path, off_t size)
+{
+	struct memfs_node *node;
+	int res;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL)
+		res = -ENOENT;
+	else if (S_ISDIR(node->mode))
+		res = -EISDIR;
+	else
+		res = memfs_resize(node, size);
+	memfs_leave();
+	return res;
+}
+
+static int memfs_ftruncate(const char *path, off_t size,
+			   struct fuse_file_info *fi)
+{
+	(void) fi;
+	return memfs_truncate(path, size);
+}
+
+static int memfs_utimens(const char *path, const struct timespec ts[2])
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else {
+		node->atime = ts[0].tv_sec;
+		node->mtime = ts[1].tv_sec;
+		node->ctime = time(NULL);
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_create(const char *path, mode_t mode,
+			struct fuse_file_info *fi)
+{
+	int res;
+
+	(void) fi;
+
+	memfs_enter();
+	res = memfs_add(path, S_IFREG | (mode & 07777), NULL);
+	memfs_leave();
+	return res;
+}
+
+static int memfs_open(const char *path, struct fuse_file_info *fi)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	(void) fi;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL)
+		res = -ENOENT;
+	else if (S_ISDIR(node->mode))
+		res = -EISDIR;
+	memfs_leave();
+	return res;
+}
+
+static int memfs_read(const char *path, char *buf, size_t size, off_t offset,
+		      struct fuse_file_info *fi)
+{
+	struct memfs_node *node;
+	int res = 0;
+
+	(void) fi;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else if (offset < (off_t) node->size) {
+		if (size > node->size - offset)
+			size = node->size - offset;
+		memcpy(buf, node->data + offset, size);
+		node->atime = time(NULL);
+		res = size;
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_write(const char *path, const char *buf, size_t size,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	struct memfs_node *node;
+	int res;
+
+	(void) fi;
+
+	memfs_enter();
+	node = memfs_lookup(path);
+	if (node == NULL) {
+		res = -ENOENT;
+	} else {
+		res = 0;
+		if (offset + size > node->size)
+			res = memfs_resize(node, offset + size);
+		if (res == 0) {
+			memcpy(node->data + offset, buf, size);
+			node->mtime = node->ctime = time(NULL);
+			res = size;
+		}
+	}
+	memfs_leave();
+	return res;
+}
+
+static int memfs_statfs(const char *path, struct statvfs *stbuf)
+{
+	(void) path;
+
+	memset(stbuf, 0, sizeof(struct statvfs));
+	stbuf->f_bsize = 4096;
+	stbuf->f_frsize = 4096;
+	stbuf->f_blocks = 1024 * 1024;
+	stbuf->f_bfree = 1024 * 1024;
+	stbuf->f_bavail = 1024 * 1024;
+	stbuf->f_namemax = 255;
+	return 0;
+}
+
+static struct fuse_operations memfs_oper = {
+	.init		= memfs_init,
+	.destroy	= memfs_destroy,
+	.getattr	= memfs_getattr,
+	.fgetattr	= memfs_fgetattr,
+	.readlink	= memfs_readlink,
+	.readdir	= memfs_readdir,
+	.mkdir		= memfs_mkdir,
+	.symlink	= memfs_symlink,
+	.unlink		= memfs_unlink,
+	.rmdir		= memfs_rmdir,
+	.rename		= memfs_rename,
+	.chmod		= memfs_chmod,
+	.truncate	= memfs_truncate,
+	.ftruncate	= memfs_ftruncate,
+	.utimens	= memfs_utimens,
+	.create		= memfs_create,
+	.open		= memfs_open,
+	.read		= memfs_read,
+	.write		= memfs_write,
+	.statfs		= memfs_statfs,
+};
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	pthread_mutexattr_t attr;
+	int res;
+
+	if (fuse_opt_parse(&args, &memfs_conf, memfs_opts, NULL) == -1)
+		return 1;
+
+	/* readdir fillers may call back into getattr to resolve symlinks */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&memfs_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	memfs_root = memfs_new_node("", S_IFDIR | 0755);
+	if (memfs_root == NULL)
+		return 1;
+
+	umask(0);
+	res = fuse_main(args.argc, args.argv, &memfs_oper, NULL);
+	fuse_opt_free_args(&args);
+	return res;
+}
@@ -0,0 +1,196 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the per-operation statistics of the FUSE bridge in
+// dokan_fuse/src/fusestats.cpp, without a mounted volume: latency buckets and
+// percentiles, backend calls counted per thread and attributed to the
+// callback that caused them, records from many threads, and the table printed
+// on unmount.
+//
+// Build it with any C++11 compiler:
+//   cl /O2 /EHsc /I..\..\dokan_fuse\include fusestats_test.cpp
+//       ..\..\dokan_fuse\src\fusestats.cpp
+//   g++ -O2 -pthread -I../../dokan_fuse/include fusestats_test.cpp
+//       ../../dokan_fuse/src/fusestats.cpp -o fusestats_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "fusestats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static void TestBuckets() {
+  impl_fuse_stats stats;
+
+  CHECK(stats.calls(FUSE_OP_READ_FILE) == 0);
+
+  // Bucket i holds latencies below 2^i microseconds
+  stats.record(FUSE_OP_READ_FILE, 0, 0);
+  CHECK(stats.percentile_us(FUSE_OP_READ_FILE, 50) == 1);
+  stats.record(FUSE_OP_WRITE_FILE, 1, 0);
+  CHECK(stats.percentile_us(FUSE_OP_WRITE_FILE, 50) == 2);
+  stats.record(FUSE_OP_CLEANUP, 1023, 0);
+  CHECK(stats.percentile_us(FUSE_OP_CLEANUP, 50) == 1024);
+  stats.record(FUSE_OP_CLOSE_FILE, 1024, 0);
+  CHECK(stats.percentile_us(FUSE_OP_CLOSE_FILE, 50) == 2048);
+  // Latencies past the last bucket stay in it
+  stats.record(FUSE_OP_FIND_FILES, 1LL << 50, 0);
+  CHECK(stats.percentile_us(FUSE_OP_FIND_FILES, 100) ==
+        1LL << (FUSE_STATS_BUCKETS - 1));
+  stats.record(FUSE_OP_MOVE_FILE, -5, 0);
+  CHECK(stats.percentile_us(FUSE_OP_MOVE_FILE, 50) == 1);
+}
+
+static void TestPercentiles() {
+  impl_fuse_stats stats;
+  int i;
+
+  // 98 calls of 10us, then 2 of 5000us
+  for (i = 0; i < 98; ++i)
+    stats.record(FUSE_OP_GET_FILE_INFORMATION, 10, 1);
+  stats.record(FUSE_OP_GET_FILE_INFORMATION, 5000, 1);
+  stats.record(FUSE_OP_GET_FILE_INFORMATION, 5000, 1);
+
+  CHECK(stats.calls(FUSE_OP_GET_FILE_INFORMATION) == 100);
+  CHECK(stats.percentile_us(FUSE_OP_GET_FILE_INFORMATION, 50) == 16);
+  CHECK(stats.percentile_us(FUSE_OP_GET_FILE_INFORMATION, 98) == 16);
+  CHECK(stats.percentile_us(FUSE_OP_GET_FILE_INFORMATION, 99) == 8192);
+  CHECK(stats.percentile_us(FUSE_OP_GET_FILE_INFORMATION, 100) == 8192);
+  // No record: the first bucket holds the rank 0
+  CHECK(stats.percentile_us(FUSE_OP_LOCK_FILE, 99) == 1);
+}
+
+static void TestTimer() {
+  impl_fuse_stats stats;
+
+  // Backend calls made before the callback are not its own
+  impl_fuse_stats::add_backend_calls(5);
+  {
+    impl_fuse_op_timer timer(&stats, FUSE_OP_CREATE_FILE);
+    impl_fuse_stats::add_backend_calls(3);
+  }
+  {
+    impl_fuse_op_timer timer(&stats, FUSE_OP_CREATE_FILE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  CHECK(stats.calls(FUSE_OP_CREATE_FILE) == 2);
+  CHECK(stats.percentile_us(FUSE_OP_CREATE_FILE, 100) >= 2048);
+  CHECK(impl_fuse_stats::backend_calls() == 8);
+
+  // Without stats nothing is recorded
+  {
+    impl_fuse_op_timer timer(nullptr, FUSE_OP_CREATE_FILE);
+    impl_fuse_stats::add_backend_calls(1);
+  }
+  CHECK(stats.calls(FUSE_OP_CREATE_FILE) == 2);
+
+  // Each thread counts its own backend calls
+  int64_t other = -1;
+  std::thread thread([&other] {
+    impl_fuse_stats::add_backend_calls(2);
+    other = impl_fuse_stats::backend_calls();
+  });
+  thread.join();
+  CHECK(other == 2);
+  CHECK(impl_fuse_stats::backend_calls() == 9);
+}
+
+static void TestThreads() {
+  impl_fuse_stats stats;
+  std::vector<std::thread> threads;
+  const int thread_count = 8;
+  const int record_count = 10000;
+
+  for (int i = 0; i < thread_count; ++i) {
+    threads.emplace_back([&stats] {
+      for (int j = 0; j < record_count; ++j)
+        stats.record(FUSE_OP_WRITE_FILE, j % 3, 2);
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+
+  CHECK(stats.calls(FUSE_OP_WRITE_FILE) == thread_count * record_count);
+  // A third of 0us, two thirds of 1 or 2us
+  CHECK(stats.percentile_us(FUSE_OP_WRITE_FILE, 33) == 1);
+  CHECK(stats.percentile_us(FUSE_OP_WRITE_FILE, 50) == 2);
+  CHECK(stats.percentile_us(FUSE_OP_WRITE_FILE, 100) == 4);
+}
+
+static void TestDump() {
+  impl_fuse_stats stats;
+  char text[4096];
+  size_t length;
+  FILE *file = tmpfile();
+
+  CHECK(file != NULL);
+  if (file == NULL)
+    return;
+  stats.record(FUSE_OP_READ_FILE, 100, 3);
+  stats.record(FUSE_OP_READ_FILE, 300, 1);
+  stats.record(FUSE_OP_GET_VOLUME_INFORMATION, 7, 0);
+  stats.dump(file);
+  rewind(file);
+  length = fread(text, 1, sizeof(text) - 1, file);
+  text[length] = '\0';
+  fclose(file);
+
+  CHECK(strstr(text, "Operation") == text);
+  // Calls, average, P50 and P99 latencies, then backend calls per callback
+  CHECK(strstr(text, "ReadFile") != NULL);
+  CHECK(strstr(text, " 200 ") != NULL);
+  CHECK(strstr(text, " 128 ") != NULL);
+  CHECK(strstr(text, " 512 ") != NULL);
+  CHECK(strstr(text, " 2.00\n") != NULL);
+  CHECK(strstr(text, "GetVolumeInformation") != NULL);
+  // Operations without calls are left out
+  CHECK(strstr(text, "WriteFile") == NULL);
+  CHECK(strstr(text, "\n3 operations in ") != NULL);
+}
+
+int main() {
+  TestBuckets();
+  TestPercentiles();
+  TestTimer();
+  TestThreads();
+  TestDump();
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,382 @@
+param(
+    [Parameter(Mandatory=$false)][string] $Mirror = "..\x64\Release\mirror.exe",
+    [Parameter(Mandatory=$false)][string] $Dokanctl = "..\x64\Release\dokanctl.exe",
+    [Parameter(Mandatory=$false)][string] $MirrorDir = "C:\FSBENCH",
+    [Parameter(Mandatory=$false)][string] $DokanDriverLetter = "M",
+    [Parameter(Mandatory=$false)][string] $MirrorArguments = "",
+    [Parameter(Mandatory=$false)][string] $Output = "mirror_bench.json",
+    [Parameter(Mandatory=$false)][int] $Files = 2000,
+    [Parameter(Mandatory=$false)][int] $SequentialMB = 256,
+    [Parameter(Mandatory=$false)][int] $Threads = 4,
+    [Parameter(Mandatory=$false)][int] $AsyncLatency = -1,
+    [Parameter(Mandatory=$false)][string] $Baseline = "",
+    [Parameter(Mandatory=$false)][int] $MaxRegression = 20
+)
+# End to end benchmark of mirror: each scenario is run against the mounted
+# drive and reports throughput and p50/p99/p999 latency of every file system
+# call. Results are written as JSON to $Output to compare builds.
+# The request trace of mirror is also dumped and converted with dokanctl /t and
+# /x to see where time is spent inside the library.
+# With $AsyncLatency >= 0, mirror pends reads and writes and completes them
+# from a thread pool after that many milliseconds, like a slow remote backend.
+# Every scenario also checks what it reads back. The script exits with 1 if a
+# check failed or, when $Baseline names the JSON of an earlier run, if the
+# operations per second of a scenario dropped by more than $MaxRegression
+# percent or a scenario of the baseline is missing.
+
+$ErrorActionPreference = "Stop"
+
+$Source = @"
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Threading;
+
+public class BenchResult {
+  public string Name;
+  public long Operations;
+  public double Seconds;
+  public double OperationsPerSecond;
+  public double MBPerSecond;
+  public double P50Us;
+  public double P99Us;
+  public double P999Us;
+  // Checks of the data read back that failed
+  public long Mismatches;
+}
+
+public static class DokanBench {
+  // Latencies in Stopwatch ticks of the scenario being run
+  class Recorder {
+    public List<long> Ticks = new List<long>();
+    public long Bytes;
+    public long Mismatches;
+    public void Expect(bool condition) {
+      if (!condition)
+        ++Mismatches;
+    }
+    public void Time(Action action) {
+      long start = Stopwatch.GetTimestamp();
+      action();
+      Ticks.Add(Stopwatch.GetTimestamp() - start);
+    }
+  }
+
+  static double Percentile(long[] sorted, double percent) {
+    if (sorted.Length == 0)
+      return 0;
+    int index = (int)Math.Ceiling(sorted.Length * percent / 100.0) - 1;
+    if (index < 0)
+      index = 0;
+    return sorted[index] * 1000000.0 / Stopwatch.Frequency;
+  }
+
+  static BenchResult Report(string name, Recorder[] recorders, long elapsed) {
+    List<long> all = new List<long>();
+    long bytes = 0;
+    long mismatches = 0;
+    foreach (Recorder recorder in recorders) {
+      all.AddRange(recorder.Ticks);
+      bytes += recorder.Bytes;
+      mismatches += recorder.Mismatches;
+    }
+    long[] sorted = all.ToArray();
+    Array.Sort(sorted);
+    BenchResult result = new BenchResult();
+    result.Name = name;
+    result.Operations = sorted.Length;
+    result.Seconds = (double)elapsed / Stopwatch.Frequency;
+    result.OperationsPerSecond = result.Seconds > 0 ? sorted.Length / result.Seconds : 0;
+    result.MBPerSecond = result.Seconds > 0 ? bytes / 1048576.0 / result.Seconds : 0;
+    result.P50Us = Percentile(sorted, 50);
+    result.P99Us = Percentile(sorted, 99);
+    result.P999Us = Percentile(sorted, 99.9);
+    result.Mismatches = mismatches;
+    return result;
+  }
+
+  static BenchResult Run(string name, int threads, Action<Recorder, int> body) {
+    Recorder[] recorders = new Recorder[threads];
+    Thread[] workers = new Thread[threads];
+    for (int i = 0; i < threads; ++i) {
+      int index = i;
+      recorders[i] = new Recorder();
+      workers[i] = new Thread(delegate() { body(recorders[index], index); });
+    }
+    long start = Stopwatch.GetTimestamp();
+    foreach (Thread worker in workers)
+      worker.Start();
+    foreach (Thread worker in workers)
+      worker.Join();
+    return Report(name, recorders, Stopwatch.GetTimestamp() - start);
+  }
+
+  public static BenchResult[] SmallFiles(string root, int files) {
+    string dir = Path.Combine(root, "small");
+    Directory.CreateDirectory(dir);
+    byte[] data = new byte[] { 0x5A };
+    List<BenchResult> results = new List<BenchResult>();
+    results.Add(Run("small-create-close", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < files; ++i) {
+        string path = Path.Combine(dir, "f" + i);
+        r.Time(delegate() { File.WriteAllBytes(path, data); });
+      }
+    }));
+    results.Add(Run("small-stat", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < files; ++i) {
+        string path = Path.Combine(dir, "f" + i);
+        FileAttributes attributes = 0;
+        r.Time(delegate() { attributes = File.GetAttributes(path); });
+        r.Expect((attributes & FileAttributes.Directory) == 0);
+      }
+    }));
+    results.Add(Run("small-open-read-close", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < files; ++i) {
+        string path = Path.Combine(dir, "f" + i);
+        byte[] read = null;
+        r.Time(delegate() { read = File.ReadAllBytes(path); });
+        r.Bytes += read.Length;
+        r.Expect(read.Length == 1 && read[0] == data[0]);
+      }
+    }));
+    results.Add(Run("small-delete", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < files; ++i) {
+        string path = Path.Combine(dir, "f" + i);
+        r.Time(delegate() { File.Delete(path); });
+        r.Expect(!File.Exists(path));
+      }
+    }));
+    return results.ToArray();
+  }
+
+  public static BenchResult[] Sequential(string root, int megabytes) {
+    string path = Path.Combine(root, "sequential.bin");
+    byte[] buffer = new byte[1048576];
+    new Random(0).NextBytes(buffer);
+    List<BenchResult> results = new List<BenchResult>();
+    results.Add(Run("sequential-write-1M", 1, delegate(Recorder r, int t) {
+      using (FileStream stream = new FileStream(path, FileMode.Create,
+                 FileAccess.Write, FileShare.None, 1, FileOptions.WriteThrough)) {
+        for (int i = 0; i < megabytes; ++i) {
+          r.Time(delegate() { stream.Write(buffer, 0, buffer.Length); });
+          r.Bytes += buffer.Length;
+        }
+      }
+    }));
+    results.Add(Run("sequential-read-1M", 1, delegate(Recorder r, int t) {
+      byte[] readBuffer = new byte[buffer.Length];
+      using (FileStream stream = new FileStream(path, FileMode.Open,
+                 FileAccess.Read, FileShare.None, 1, FileOptions.SequentialScan)) {
+        int read = 1;
+        while (read > 0) {
+          r.Time(delegate() { read = stream.Read(readBuffer, 0, readBuffer.Length); });
+          // Every megabyte of the file is a copy of buffer
+          for (int i = 0; i < read; ++i) {
+            if (readBuffer[i] != buffer[(r.Bytes + i) % buffer.Length]) {
+              r.Expect(false);
+              break;
+            }
+          }
+          r.Bytes += read;
+        }
+      }
+      r.Expect(r.Bytes == (long)megabytes * buffer.Length);
+    }));
+    File.Delete(path);
+    return results.ToArray();
+  }
+
+  // Adds dir to dirs and its number of entries to entries
+  static void CreateTree(string dir, int depth, List<string> dirs,
+                         List<int> entries) {
+    Directory.CreateDirectory(dir);
+    dirs.Add(dir);
+    entries.Add(depth == 0 ? 16 : 20);
+    for (int i = 0; i < 8; ++i) {
+      File.WriteAllBytes(Path.Combine(dir, "file" + i + ".txt"), new byte[0]);
+      File.WriteAllBytes(Path.Combine(dir, "file" + i + ".dat"), new byte[0]);
+    }
+    if (depth == 0)
+      return;
+    for (int i = 0; i < 4; ++i)
+      CreateTree(Path.Combine(dir, "d" + i), depth - 1, dirs, entries);
+  }
+
+  public static BenchResult[] DirectoryWalk(string root) {
+    string dir = Path.Combine(root, "tree");
+    List<string> dirs = new List<string>();
+    List<int> entries = new List<int>();
+    CreateTree(dir, 4, dirs, entries);
+    List<BenchResult> results = new List<BenchResult>();
+    results.Add(Run("walk-list-all", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < dirs.Count; ++i) {
+        string[] found = null;
+        r.Time(delegate() { found = Directory.GetFileSystemEntries(dirs[i]); });
+        r.Expect(found.Length == entries[i]);
+      }
+    }));
+    results.Add(Run("walk-pattern", 1, delegate(Recorder r, int t) {
+      foreach (string d in dirs) {
+        string[] found = null;
+        r.Time(delegate() { found = Directory.GetFiles(d, "file?.txt"); });
+        r.Expect(found.Length == 8);
+      }
+    }));
+    Directory.Delete(dir, true);
+    return results.ToArray();
+  }
+
+  public static BenchResult[] Rename(string root, int files) {
+    string dir = Path.Combine(root, "rename");
+    Directory.CreateDirectory(dir);
+    string a = Path.Combine(dir, "a");
+    string b = Path.Combine(dir, "b");
+    File.WriteAllBytes(a, new byte[1]);
+    List<BenchResult> results = new List<BenchResult>();
+    results.Add(Run("rename", 1, delegate(Recorder r, int t) {
+      for (int i = 0; i < files; ++i) {
+        if ((i & 1) == 0)
+          r.Time(delegate() { File.Move(a, b); });
+        else
+          r.Time(delegate() { File.Move(b, a); });
+      }
+      r.Expect(File.Exists((files & 1) == 0 ? a : b));
+    }));
+    Directory.Delete(dir, true);
+    return results.ToArray();
+  }
+
+  public static BenchResult[] Mixed(string root, int files, int threads) {
+    string dir = Path.Combine(root, "mixed");
+    Directory.CreateDirectory(dir);
+    byte[] data = new byte[4096];
+    List<BenchResult> results = new List<BenchResult>();
+    results.Add(Run("mixed-" + threads + "-threads", threads, delegate(Recorder r, int t) {
+      Random random = new Random(t);
+      string own = Path.Combine(dir, "t" + t);
+      Directory.CreateDirectory(own);
+      for (int i = 0; i < files; ++i) {
+        string path = Path.Combine(own, "f" + random.Next(64));
+        switch (random.Next(5)) {
+        case 0:
+          r.Time(delegate() { File.WriteAllBytes(path, data); });
+          r.Bytes += data.Length;
+          break;
+        case 1:
+          r.Time(delegate() {
+            if (File.Exists(path)) {
+              int length = File.ReadAllBytes(path).Length;
+              r.Bytes += length;
+              // Each thread only writes its own files, always in full
+              r.Expect(length == data.Length);
+            }
+          });
+          break;
+        case 2:
+          r.Time(delegate() { File.Exists(path); });
+          break;
+        case 3:
+          r.Time(delegate() { Directory.GetFiles(own); });
+          break;
+        default:
+          r.Time(delegate() { File.Delete(path); });
+          break;
+        }
+      }
+    }));
+    Directory.Delete(dir, true);
+    return results.ToArray();
+  }
+}
+"@
+
+Add-Type -TypeDefinition $Source -Language CSharp
+add-type -AssemblyName System.Windows.Forms
+
+$baselineResults = $null
+if ($Baseline -ne "") {
+	$baselineResults = (Get-Content -Raw $Baseline | ConvertFrom-Json).Results
+}
+
+if (!(Test-Path $MirrorDir)) { New-Item $MirrorDir -type directory | Out-Null }
+Remove-Item -Recurse -Force "$MirrorDir\*" | Out-Null
+# dummy file used for checking that the mount succeeded further below
+New-Item -Force "$MirrorDir\tmp" | Out-Null
+
+$destination = "$($DokanDriverLetter):"
+if ($AsyncLatency -ge 0) { $MirrorArguments = "$MirrorArguments /y $AsyncLatency" }
+$app = Start-Process -passthru $Mirror -ArgumentList "/r $MirrorDir /l $DokanDriverLetter $MirrorArguments"
+
+# When mirror finished mounting, Test-Path will return success.
+$count = 20;
+while (!(Test-Path "$($destination)\tmp") -and ($count -ne 0)) { Start-Sleep -m 250; $count -= 1 }
+if ($count -eq 0) {
+	throw ("Impossible to mount $MirrorDir on $destination")
+}
+
+$results = @()
+try {
+	Write-Host "Small files" -ForegroundColor Green
+	$results += [DokanBench]::SmallFiles("$destination\", $Files)
+	Write-Host "Sequential read and write" -ForegroundColor Green
+	$results += [DokanBench]::Sequential("$destination\", $SequentialMB)
+	Write-Host "Directory walk" -ForegroundColor Green
+	$results += [DokanBench]::DirectoryWalk("$destination\")
+	Write-Host "Rename" -ForegroundColor Green
+	$results += [DokanBench]::Rename("$destination\", $Files)
+	Write-Host "Mixed" -ForegroundColor Green
+	$results += [DokanBench]::Mixed("$destination\", $Files, $Threads)
+
+	$results | Format-Table Name, Operations, OperationsPerSecond, MBPerSecond, P50Us, P99Us, P999Us, Mismatches -AutoSize
+
+	if (Test-Path $Dokanctl) {
+		& $Dokanctl /s $DokanDriverLetter
+		& $Dokanctl /t $app.Id | Out-Null
+		$trace = "$env:TEMP\dokan_trace_$($app.Id).bin"
+		$count = 20;
+		while (!(Test-Path $trace) -and ($count -ne 0)) { Start-Sleep -m 250; $count -= 1 }
+		if (Test-Path $trace) {
+			# Let mirror finish writing the dump
+			Start-Sleep -m 500
+			& $Dokanctl /x $trace ([System.IO.Path]::ChangeExtension($Output, ".trace.json")) | Out-Null
+		}
+	}
+
+	@{
+		"Date" = (Get-Date -Format o);
+		"Mirror" = $Mirror;
+		"MirrorArguments" = $MirrorArguments;
+		"Results" = $results
+	} | ConvertTo-Json -Depth 3 | Out-File -Encoding ascii $Output
+	Write-Host "Results written to $Output" -ForegroundColor Green
+} finally {
+	#TODO: can we use dokanctl to unmount?
+	[System.Windows.Forms.SendKeys]::SendWait("^{c}")
+	$app.WaitForExit()
+}
+
+$failures = @()
+foreach ($result in $results) {
+	if ($result.Mismatches -ne 0) {
+		$failures += "$($result.Name): $($result.Mismatches) checks of the data read back failed"
+	}
+}
+if ($baselineResults) {
+	foreach ($expected in $baselineResults) {
+		$result = $results | Where-Object { $_.Name -eq $expected.Name }
+		if (!$result) {
+			$failures += "$($expected.Name): missing from this run"
+			continue
+		}
+		$floor = $expected.OperationsPerSecond * (100 - $MaxRegression) / 100
+		if ($result.OperationsPerSecond -lt $floor) {
+			$failures += ("{0}: {1:N1} operations per second, baseline {2:N1}" -f $result.Name, $result.OperationsPerSecond, $expected.OperationsPerSecond)
+		}
+	}
+}
+if ($failures.Count -ne 0) {
+	$failures | ForEach-Object { Write-Host $_ -ForegroundColor Red }
+	exit 1
+}
+Write-Host "All checks passed" -ForegroundColor Green
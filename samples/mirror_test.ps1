@@ -58,6 +58,11 @@ $Configs = @(
 		"MirrorArguments" = "/l $DokanDriverLetter /n /u \myfs\dokan";
 		"Destination" = "\\myfs\dokan";
 		"Name" = "netUnc";
+	},
+	@{
+		"MirrorArguments" = "/l $DokanDriverLetter /y 2";
+		"Destination" = "$($DokanDriverLetter):";
+		"Name" = "driveAsync";
 	}
 )
 
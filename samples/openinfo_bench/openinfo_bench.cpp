@@ -0,0 +1,536 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Portable model of how DokanLoop threads reference DOKAN_OPEN_INFO, to
+// compare the instance CRITICAL_SECTION used before with the handle table of
+// dokan/openinfo.c without a mounted volume:
+//   locked - OpenCount updated under one lock shared by every thread
+//   table  - generation-tagged handles and atomic reference counts
+// Every thread runs requests on files shared by all threads and open/close
+// storms on its own files, like a build opening many small files.
+//
+// Build it with any C++11 compiler:
+//   cl /O2 /EHsc openinfo_bench.cpp
+//   g++ -O2 -std=c++11 -pthread openinfo_bench.cpp -o openinfo_bench
+//
+// openinfo_bench [/t 1,2,4,8,16,32] [/d Seconds] [/s SharedFiles]
+//                [/o OpenPercent] [/w CallbackWork]
+//
+// Lock hold times include the two clock reads around the critical section.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// One in kSampleRate operations has its timings kept for the percentiles
+const uint64_t kSampleRate = 16;
+const size_t kMaxSamples = 1 << 20;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct ThreadStats {
+  uint64_t operations = 0;
+  uint64_t opens = 0;
+  uint64_t lockAcquisitions = 0;
+  uint64_t lockWaitNs = 0;
+  uint64_t lockHoldNs = 0;
+  uint64_t casRetries = 0;
+  // Time spent to take and give back a reference, per request
+  std::vector<uint32_t> referenceNs;
+  // Time the lock was held, per acquisition
+  std::vector<uint32_t> holdNs;
+};
+
+void Sample(std::vector<uint32_t> &Samples, uint64_t Ns) {
+  if (Samples.size() < kMaxSamples)
+    Samples.push_back(static_cast<uint32_t>(std::min<uint64_t>(Ns, UINT32_MAX)));
+}
+
+// Stands for the find data cached on a directory between FindFiles calls
+typedef std::vector<int> FindData;
+
+// Requests running at the same time on a file may both create its find data
+FindData *PublishDirList(std::atomic<FindData *> &DirList) {
+  FindData *list = DirList.load();
+  if (list != nullptr)
+    return list;
+  FindData *created = new FindData();
+  if (DirList.compare_exchange_strong(list, created))
+    return created;
+  delete created;
+  return list;
+}
+
+// DOKAN_OPEN_INFO and GetDokanOpenInfo / ReleaseDokanOpenInfo before the
+// handle table: the driver gets the address of the entry.
+class LockedModel {
+public:
+  static const char *Name() { return "locked"; }
+
+  uint64_t Open(ThreadStats &Stats) {
+    Entry *entry = new Entry();
+    // One reference for the open file and one for the create request
+    entry->openCount = 2;
+    uint64_t handle = reinterpret_cast<uintptr_t>(entry);
+    Release(handle, Stats);
+    return handle;
+  }
+
+  bool Get(uint64_t Handle, ThreadStats &Stats) {
+    Entry *entry = reinterpret_cast<Entry *>(static_cast<uintptr_t>(Handle));
+    Locked(Stats, [entry] { entry->openCount++; });
+    return true;
+  }
+
+  void Release(uint64_t Handle, ThreadStats &Stats) {
+    Entry *entry = reinterpret_cast<Entry *>(static_cast<uintptr_t>(Handle));
+    bool last = false;
+    Locked(Stats, [entry, &last] {
+      entry->openCount--;
+      if (entry->openCount < 1) {
+        delete entry->dirList;
+        last = true;
+      }
+    });
+    if (last)
+      delete entry;
+  }
+
+  void Close(uint64_t Handle, ThreadStats &Stats) {
+    Entry *entry = reinterpret_cast<Entry *>(static_cast<uintptr_t>(Handle));
+    Get(Handle, Stats);
+    Locked(Stats, [entry] { entry->openCount--; });
+    Release(Handle, Stats);
+  }
+
+  FindData *DirList(uint64_t Handle) {
+    Entry *entry = reinterpret_cast<Entry *>(static_cast<uintptr_t>(Handle));
+    return PublishDirList(entry->dirList);
+  }
+
+private:
+  struct Entry {
+    unsigned long openCount = 0;
+    std::atomic<FindData *> dirList{nullptr};
+  };
+
+  template <typename Body> void Locked(ThreadStats &Stats, Body body) {
+    bool sampled = Stats.lockAcquisitions++ % kSampleRate == 0;
+    uint64_t start = NowNs();
+    lock_.lock();
+    uint64_t acquired = NowNs();
+    body();
+    uint64_t held = NowNs() - acquired;
+    lock_.unlock();
+    Stats.lockWaitNs += acquired - start;
+    Stats.lockHoldNs += held;
+    if (sampled)
+      Sample(Stats.holdNs, held);
+  }
+
+  std::mutex lock_;
+};
+
+// dokan/openinfo.c: slabs that live as long as the instance, a free list
+// with a sequence number like SLIST_HEADER, and the generation and reference
+// count of each entry packed in one 64 bit value.
+class TableModel {
+public:
+  static const char *Name() { return "table"; }
+
+  TableModel() : slabCount_(0), freeHead_(0) {
+    for (uint32_t i = 0; i < kMaxSlabs; ++i)
+      slabs_[i].store(nullptr);
+  }
+
+  ~TableModel() {
+    for (uint32_t i = 0; i < slabCount_.load(); ++i) {
+      Entry *slab = slabs_[i].load();
+      for (uint32_t j = 0; j < kSlabSize; ++j)
+        delete slab[j].dirList;
+      delete[] slab;
+    }
+  }
+
+  uint64_t Open(ThreadStats &Stats) {
+    Entry *entry = Pop(Stats);
+    if (entry == nullptr)
+      return 0;
+    uint32_t generation = Generation(entry->state.load());
+    entry->handle = (static_cast<uint64_t>(generation) << 32) |
+                    (static_cast<uint64_t>(entry->index) + 1);
+    entry->state.store(State(generation, 2));
+    uint64_t handle = entry->handle;
+    Release(handle, Stats);
+    return handle;
+  }
+
+  bool Get(uint64_t Handle, ThreadStats &Stats) {
+    Entry *entry = Lookup(Handle);
+    if (entry == nullptr)
+      return false;
+    uint32_t generation = static_cast<uint32_t>(Handle >> 32);
+    uint64_t state = entry->state.load();
+    for (;;) {
+      if (Generation(state) != generation || References(state) == 0)
+        return false;
+      if (entry->state.compare_exchange_weak(state, state + 1))
+        return true;
+      Stats.casRetries++;
+    }
+  }
+
+  void Release(uint64_t Handle, ThreadStats &Stats) {
+    Entry *entry = Lookup(Handle);
+    uint64_t state = entry->state.fetch_sub(1) - 1;
+    if (References(state) != 0)
+      return;
+    delete entry->dirList;
+    entry->dirList = nullptr;
+    uint32_t generation = Generation(state) + 1;
+    if (generation == 0)
+      generation = 1;
+    entry->state.store(State(generation, 0));
+    Push(entry, Stats);
+  }
+
+  void Close(uint64_t Handle, ThreadStats &Stats) {
+    Get(Handle, Stats);
+    Release(Handle, Stats);
+    Release(Handle, Stats);
+  }
+
+  FindData *DirList(uint64_t Handle) {
+    return PublishDirList(Lookup(Handle)->dirList);
+  }
+
+private:
+  static const uint32_t kSlabSize = 1024;
+  static const uint32_t kMaxSlabs = 1024;
+
+  struct Entry {
+    std::atomic<uint64_t> state{0};
+    // Index plus one of the next free entry
+    std::atomic<uint32_t> nextFree{0};
+    std::atomic<FindData *> dirList{nullptr};
+    uint64_t handle = 0;
+    uint32_t index = 0;
+  };
+
+  static uint64_t State(uint32_t Generation, uint32_t References) {
+    return (static_cast<uint64_t>(Generation) << 32) | References;
+  }
+  static uint32_t Generation(uint64_t State) {
+    return static_cast<uint32_t>(State >> 32);
+  }
+  static uint32_t References(uint64_t State) {
+    return static_cast<uint32_t>(State & 0xFFFFFFFF);
+  }
+
+  Entry *Lookup(uint64_t Handle) {
+    uint32_t index = static_cast<uint32_t>(Handle & 0xFFFFFFFF);
+    if (index == 0 || index > kMaxSlabs * kSlabSize)
+      return nullptr;
+    --index;
+    Entry *slab = slabs_[index / kSlabSize].load();
+    return slab != nullptr ? &slab[index % kSlabSize] : nullptr;
+  }
+
+  Entry *Pop(ThreadStats &Stats) {
+    for (;;) {
+      uint64_t head = freeHead_.load();
+      uint32_t index = static_cast<uint32_t>(head & 0xFFFFFFFF);
+      if (index == 0) {
+        if (!Grow())
+          return nullptr;
+        continue;
+      }
+      // Entries are never freed, a concurrent pop only makes the CAS fail
+      Entry *entry = Lookup(index);
+      uint64_t next = ((head >> 32) + 1) << 32 | entry->nextFree.load();
+      if (freeHead_.compare_exchange_weak(head, next))
+        return entry;
+      Stats.casRetries++;
+    }
+  }
+
+  void Push(Entry *Entry_, ThreadStats &Stats) {
+    uint64_t head = freeHead_.load();
+    for (;;) {
+      Entry_->nextFree.store(static_cast<uint32_t>(head & 0xFFFFFFFF));
+      uint64_t next = ((head >> 32) + 1) << 32 | (Entry_->index + 1);
+      if (freeHead_.compare_exchange_weak(head, next))
+        return;
+      Stats.casRetries++;
+    }
+  }
+
+  bool Grow() {
+    std::lock_guard<std::mutex> guard(growLock_);
+    if ((freeHead_.load() & 0xFFFFFFFF) != 0)
+      return true;
+    uint32_t count = slabCount_.load();
+    if (count == kMaxSlabs)
+      return false;
+    Entry *slab = new Entry[kSlabSize];
+    for (uint32_t i = 0; i < kSlabSize; ++i) {
+      slab[i].index = count * kSlabSize + i;
+      slab[i].state.store(State(1, 0));
+    }
+    slabs_[count].store(slab);
+    slabCount_.store(count + 1);
+    ThreadStats unused;
+    for (uint32_t i = kSlabSize; i > 0; --i)
+      Push(&slab[i - 1], unused);
+    return true;
+  }
+
+  std::atomic<Entry *> slabs_[kMaxSlabs];
+  std::atomic<uint32_t> slabCount_;
+  // Sequence number in the high 32 bits, index plus one of the first free
+  // entry in the low 32 bits
+  std::atomic<uint64_t> freeHead_;
+  std::mutex growLock_;
+};
+
+struct Options {
+  std::vector<unsigned> threads{1, 2, 4, 8, 16, 32};
+  double seconds = 2;
+  unsigned sharedFiles = 64;
+  unsigned openPercent = 20;
+  unsigned callbackWork = 200;
+};
+
+// Time spent in the file system callback, outside of any lock
+void CallbackWork(unsigned Work) {
+  volatile unsigned sink = 0;
+  for (unsigned i = 0; i < Work; ++i)
+    sink = sink + i;
+}
+
+template <typename Model>
+void Request(Model &Model_, uint64_t Handle, const Options &Options_,
+             ThreadStats &Stats) {
+  bool sampled = Stats.operations % kSampleRate == 0;
+  uint64_t start = sampled ? NowNs() : 0;
+  if (!Model_.Get(Handle, Stats))
+    return;
+  uint64_t got = sampled ? NowNs() : 0;
+  CallbackWork(Options_.callbackWork);
+  FindData *dirList = Model_.DirList(Handle);
+  (void)dirList;
+  uint64_t released = sampled ? NowNs() : 0;
+  Model_.Release(Handle, Stats);
+  if (sampled)
+    Sample(Stats.referenceNs, (got - start) + (NowNs() - released));
+  Stats.operations++;
+}
+
+template <typename Model>
+void Worker(Model &Model_, const std::vector<uint64_t> &Shared,
+            const Options &Options_, unsigned Seed,
+            const std::atomic<bool> &Stop, ThreadStats &Stats) {
+  std::minstd_rand random(Seed);
+  while (!Stop.load(std::memory_order_relaxed)) {
+    if (random() % 100 < Options_.openPercent) {
+      uint64_t handle = Model_.Open(Stats);
+      if (handle == 0)
+        continue;
+      Stats.opens++;
+      Stats.operations++;
+      unsigned requests = 1 + random() % 3;
+      for (unsigned i = 0; i < requests; ++i)
+        Request(Model_, handle, Options_, Stats);
+      Model_.Close(handle, Stats);
+      Stats.operations++;
+    } else {
+      Request(Model_, Shared[random() % Shared.size()], Options_, Stats);
+    }
+  }
+}
+
+double Percentile(std::vector<uint32_t> &Samples, double Percent) {
+  if (Samples.empty())
+    return 0;
+  size_t index = static_cast<size_t>(Samples.size() * Percent / 100.0);
+  if (index >= Samples.size())
+    index = Samples.size() - 1;
+  std::nth_element(Samples.begin(), Samples.begin() + index, Samples.end());
+  return Samples[index];
+}
+
+template <typename Model> void Run(unsigned Threads, const Options &Options_) {
+  Model model;
+  ThreadStats setup;
+  std::vector<uint64_t> shared;
+  for (unsigned i = 0; i < Options_.sharedFiles; ++i)
+    shared.push_back(model.Open(setup));
+
+  std::vector<ThreadStats> stats(Threads);
+  std::vector<std::thread> workers;
+  std::atomic<bool> stop(false);
+  uint64_t start = NowNs();
+  for (unsigned i = 0; i < Threads; ++i)
+    workers.emplace_back(Worker<Model>, std::ref(model), std::cref(shared),
+                         std::cref(Options_), i + 1, std::cref(stop),
+                         std::ref(stats[i]));
+  std::this_thread::sleep_for(std::chrono::duration<double>(Options_.seconds));
+  stop.store(true);
+  for (std::thread &worker : workers)
+    worker.join();
+  double elapsed = (NowNs() - start) / 1e9;
+
+  for (uint64_t handle : shared)
+    model.Close(handle, setup);
+
+  ThreadStats total;
+  for (ThreadStats &thread : stats) {
+    total.operations += thread.operations;
+    total.opens += thread.opens;
+    total.lockAcquisitions += thread.lockAcquisitions;
+    total.lockWaitNs += thread.lockWaitNs;
+    total.lockHoldNs += thread.lockHoldNs;
+    total.casRetries += thread.casRetries;
+    total.referenceNs.insert(total.referenceNs.end(),
+                             thread.referenceNs.begin(),
+                             thread.referenceNs.end());
+    total.holdNs.insert(total.holdNs.end(), thread.holdNs.begin(),
+                        thread.holdNs.end());
+  }
+
+  std::printf("%-7s %7u %12.0f %8.0f %8.0f %12llu %8.0f %8.0f %6.1f%% "
+              "%10llu\n",
+              Model::Name(), Threads, total.operations / elapsed,
+              Percentile(total.referenceNs, 50),
+              Percentile(total.referenceNs, 99),
+              static_cast<unsigned long long>(total.lockAcquisitions),
+              Percentile(total.holdNs, 50), Percentile(total.holdNs, 99),
+              100.0 * total.lockWaitNs / (elapsed * 1e9 * Threads),
+              static_cast<unsigned long long>(total.casRetries));
+}
+
+// A handle must stop resolving once its file is closed, even after the entry
+// is reused by another open.
+bool ModelCheck() {
+  TableModel table;
+  ThreadStats stats;
+  uint64_t first = table.Open(stats);
+  if (!table.Get(first, stats))
+    return false;
+  table.Release(first, stats);
+  table.Close(first, stats);
+  if (table.Get(first, stats))
+    return false;
+  uint64_t second = table.Open(stats);
+  if ((second & 0xFFFFFFFF) != (first & 0xFFFFFFFF) || second == first)
+    return false;
+  if (table.Get(first, stats) || !table.Get(second, stats))
+    return false;
+  table.Release(second, stats);
+  table.Close(second, stats);
+  return !table.Get(second, stats) && !table.Get(0, stats);
+}
+
+bool ParseOptions(int argc, char *argv[], Options &Options_) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc || std::strlen(argv[i]) != 2 ||
+        (argv[i][0] != '/' && argv[i][0] != '-'))
+      return false;
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 't': {
+      Options_.threads.clear();
+      std::string list(value);
+      size_t position = 0;
+      while (position < list.size()) {
+        unsigned threads = std::strtoul(list.c_str() + position, nullptr, 10);
+        if (threads == 0)
+          return false;
+        Options_.threads.push_back(threads);
+        position = list.find(',', position);
+        if (position == std::string::npos)
+          break;
+        ++position;
+      }
+    } break;
+    case 'd':
+      Options_.seconds = std::atof(value);
+      break;
+    case 's':
+      Options_.sharedFiles = std::strtoul(value, nullptr, 10);
+      break;
+    case 'o':
+      Options_.openPercent = std::strtoul(value, nullptr, 10);
+      break;
+    case 'w':
+      Options_.callbackWork = std::strtoul(value, nullptr, 10);
+      break;
+    default:
+      return false;
+    }
+  }
+  return !Options_.threads.empty() && Options_.seconds > 0 &&
+         Options_.sharedFiles > 0 && Options_.openPercent <= 100;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "openinfo_bench [/t 1,2,4,8,16,32] [/d Seconds] "
+                 "[/s SharedFiles] [/o OpenPercent] [/w CallbackWork]\n");
+    return EXIT_FAILURE;
+  }
+  if (!ModelCheck()) {
+    std::fprintf(stderr, "Handle table model check failed\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("Reference and hold times are in ns, wait is the share of "
+              "thread time spent waiting for the lock\n");
+  std::printf("%-7s %7s %12s %8s %8s %12s %8s %8s %7s %10s\n", "model",
+              "threads", "ops/s", "ref p50", "ref p99", "lock acq",
+              "hold p50", "hold p99", "wait", "cas retry");
+  for (unsigned threads : options.threads) {
+    Run<LockedModel>(threads, options);
+    Run<TableModel>(threads, options);
+  }
+  return EXIT_SUCCESS;
+}
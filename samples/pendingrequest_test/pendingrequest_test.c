@@ -0,0 +1,349 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the bookkeeping of pended requests of dokan/pendingrequest.c without
+// a mounted volume: the replies of reads and writes, completions before the
+// unmount, requests abandoned when its timeout expires and completed later,
+// uses that hold a request past the timeout, then completions racing with the
+// unmount on several threads.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan pendingrequest_test.c ..\..\dokan\pendingrequest.c
+//   gcc -O2 -pthread -I../../dokan pendingrequest_test.c
+//       ../../dokan/pendingrequest.c -o pendingrequest_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "pendingrequest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE THREAD;
+
+static DWORD WINAPI ThreadStart(LPVOID Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  *Thread = CreateThread(NULL, 0, ThreadStart, Parameter, 0, NULL);
+}
+static void JoinThread(THREAD Thread) {
+  WaitForSingleObject(Thread, INFINITE);
+  CloseHandle(Thread);
+}
+static void SleepMilliseconds(unsigned Milliseconds) { Sleep(Milliseconds); }
+#define AtomicIncrement(Value) InterlockedIncrement(Value)
+#else
+#include <pthread.h>
+#include <time.h>
+
+typedef pthread_t THREAD;
+
+static void *ThreadStart(void *Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  pthread_create(Thread, NULL, ThreadStart, Parameter);
+}
+static void JoinThread(THREAD Thread) { pthread_join(Thread, NULL); }
+static void SleepMilliseconds(unsigned Milliseconds) {
+  struct timespec delay;
+
+  delay.tv_sec = Milliseconds / 1000;
+  delay.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+  nanosleep(&delay, NULL);
+}
+#define AtomicIncrement(Value) __sync_add_and_fetch(Value, 1)
+#endif
+
+#define TIMEOUT 50
+#define STRESS_THREADS 8
+#define STRESS_REQUESTS 200
+
+// Request of the test, freed by whoever releases it last
+typedef struct _TEST_REQUEST {
+  DOKAN_PENDING_REQUEST Pending;
+  // Times it was completed and abandoned
+  volatile long Completed;
+  volatile long Abandoned;
+  volatile long *Freed;
+} TEST_REQUEST;
+
+static PDOKAN_PENDING_REQUESTS g_Requests;
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static TEST_REQUEST *NewRequest(volatile long *Freed) {
+  TEST_REQUEST *request = (TEST_REQUEST *)calloc(1, sizeof(TEST_REQUEST));
+
+  if (request == NULL) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  request->Freed = Freed;
+  DokanPendingRequestAdd(g_Requests, &request->Pending);
+  return request;
+}
+
+static void FreeRequest(TEST_REQUEST *Request) {
+  AtomicIncrement(Request->Freed);
+  free(Request);
+}
+
+// What DokanCompleteRequest does. Returns whether the reply was sent.
+static int Complete(TEST_REQUEST *Request) {
+  if (!DokanPendingRequestClaim(&Request->Pending)) {
+    if (DokanPendingRequestRelease(&Request->Pending))
+      FreeRequest(Request);
+    return 0;
+  }
+  AtomicIncrement(&Request->Completed);
+  DokanPendingRequestRemove(g_Requests, &Request->Pending);
+  FreeRequest(Request);
+  return 1;
+}
+
+// What the unmount does with the requests it abandons
+static void Abandon(void *Context, PDOKAN_PENDING_REQUEST Pending) {
+  TEST_REQUEST *request = (TEST_REQUEST *)Pending;
+
+  AtomicIncrement((volatile long *)Context);
+  AtomicIncrement(&request->Abandoned);
+  if (DokanPendingRequestRelease(Pending))
+    FreeRequest(request);
+}
+
+static void TestReply(void) {
+  uint32_t bytes;
+  int64_t offset;
+
+  // Reads
+  bytes = 10;
+  offset = -1;
+  CHECK(DokanRequestReply(1, 100, 1000, 0, &bytes, &offset) == 0);
+  CHECK(bytes == 10 && offset == 1010);
+  bytes = 200;
+  CHECK(DokanRequestReply(1, 100, 1000, 0, &bytes, &offset) == 0);
+  CHECK(bytes == 100 && offset == 1100);
+  bytes = 0;
+  offset = -1;
+  CHECK(DokanRequestReply(1, 100, 1000, 0, &bytes, &offset) ==
+        DOKAN_REQUEST_END_OF_FILE);
+  CHECK(bytes == 0 && offset == -1);
+
+  // Writes of nothing are not the end of the file
+  bytes = 0;
+  CHECK(DokanRequestReply(0, 100, 1000, 0, &bytes, &offset) == 0);
+  CHECK(bytes == 0 && offset == 1000);
+
+  // Failures reply nothing
+  bytes = 50;
+  offset = -1;
+  CHECK(DokanRequestReply(0, 100, 1000, (int32_t)0xC000007F, &bytes,
+                          &offset) == (int32_t)0xC000007F);
+  CHECK(bytes == 0 && offset == -1);
+}
+
+static void TestCompleted(void) {
+  volatile long freed = 0;
+  volatile long abandoned = 0;
+  TEST_REQUEST *first = NewRequest(&freed);
+  TEST_REQUEST *second = NewRequest(&freed);
+  TEST_REQUEST *third = NewRequest(&freed);
+
+  CHECK(DokanPendingRequestsCount(g_Requests) == 3);
+  CHECK(Complete(second) == 1);
+  CHECK(Complete(first) == 1);
+  CHECK(Complete(third) == 1);
+  CHECK(DokanPendingRequestsCount(g_Requests) == 0);
+  CHECK(freed == 3);
+
+  // Nothing pending, nothing to wait for
+  CHECK(DokanPendingRequestsWait(g_Requests, TIMEOUT, Abandon,
+                                 (void *)&abandoned) == 0);
+  CHECK(abandoned == 0);
+}
+
+static void TestAbandoned(void) {
+  volatile long freed = 0;
+  volatile long abandoned = 0;
+  TEST_REQUEST *kept = NewRequest(&freed);
+  TEST_REQUEST *lost = NewRequest(&freed);
+
+  CHECK(Complete(kept) == 1);
+  CHECK(DokanPendingRequestsWait(g_Requests, TIMEOUT, Abandon,
+                                 (void *)&abandoned) == 1);
+  CHECK(abandoned == 1);
+  CHECK(lost->Abandoned == 1);
+  CHECK(DokanPendingRequestsCount(g_Requests) == 0);
+  // The late completion only frees it
+  CHECK(freed == 1);
+  CHECK(Complete(lost) == 0);
+  CHECK(freed == 2);
+}
+
+typedef struct _THREAD_CONTEXT {
+  unsigned Seed;
+  // Requests the thread completes after Delay milliseconds, or uses for
+  // Delay milliseconds when Use is set
+  TEST_REQUEST **Requests;
+  int Count;
+  unsigned Delay;
+  int Use;
+  volatile long Sent;
+} THREAD_CONTEXT;
+
+static unsigned NextRandom(unsigned *Seed) {
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) & 0xFFFFFF;
+}
+
+static void RunThread(THREAD_CONTEXT *Context) {
+  int i;
+
+  for (i = 0; i < Context->Count; ++i) {
+    if (Context->Use) {
+      if (DokanPendingRequestUse(&Context->Requests[i]->Pending)) {
+        SleepMilliseconds(Context->Delay);
+        DokanPendingRequestEndUse(g_Requests, &Context->Requests[i]->Pending);
+      }
+      continue;
+    }
+    if (Context->Delay != 0)
+      SleepMilliseconds(NextRandom(&Context->Seed) % Context->Delay);
+    if (Complete(Context->Requests[i]))
+      AtomicIncrement(&Context->Sent);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadStart(LPVOID Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return 0;
+}
+#else
+static void *ThreadStart(void *Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return NULL;
+}
+#endif
+
+static void TestUse(void) {
+  volatile long freed = 0;
+  volatile long abandoned = 0;
+  TEST_REQUEST *request = NewRequest(&freed);
+  THREAD_CONTEXT context;
+  THREAD thread;
+
+  // A use is not abandoned, the wait abandons the request once it ends
+  memset(&context, 0, sizeof(context));
+  context.Requests = &request;
+  context.Count = 1;
+  context.Delay = 3 * TIMEOUT;
+  context.Use = 1;
+  CHECK(DokanPendingRequestUse(&request->Pending) == 1);
+  CHECK(DokanPendingRequestUse(&request->Pending) == 0);
+  DokanPendingRequestEndUse(g_Requests, &request->Pending);
+  StartThread(&thread, &context);
+  SleepMilliseconds(TIMEOUT / 5);
+  CHECK(DokanPendingRequestsWait(g_Requests, TIMEOUT, Abandon,
+                                 (void *)&abandoned) == 1);
+  JoinThread(thread);
+  CHECK(request->Abandoned == 1);
+  CHECK(DokanPendingRequestUse(&request->Pending) == 0);
+  CHECK(Complete(request) == 0);
+  CHECK(freed == 1);
+
+  // A completion waits for the use to end
+  request = NewRequest(&freed);
+  context.Delay = TIMEOUT / 5;
+  StartThread(&thread, &context);
+  SleepMilliseconds(TIMEOUT / 10);
+  CHECK(Complete(request) == 1);
+  JoinThread(thread);
+  CHECK(freed == 2);
+  CHECK(DokanPendingRequestsCount(g_Requests) == 0);
+}
+
+// Requests completed at random times around the timeout of the unmount, each
+// one must be completed or abandoned exactly once and freed once
+static void TestStress(void) {
+  static TEST_REQUEST *requests[STRESS_THREADS][STRESS_REQUESTS];
+  THREAD threads[STRESS_THREADS];
+  THREAD_CONTEXT contexts[STRESS_THREADS];
+  volatile long freed = 0;
+  volatile long abandoned = 0;
+  long sent = 0;
+  int i;
+  int j;
+
+  for (i = 0; i < STRESS_THREADS; ++i) {
+    for (j = 0; j < STRESS_REQUESTS; ++j)
+      requests[i][j] = NewRequest(&freed);
+  }
+  for (i = 0; i < STRESS_THREADS; ++i) {
+    memset(&contexts[i], 0, sizeof(contexts[i]));
+    contexts[i].Seed = 4000 + i;
+    contexts[i].Requests = requests[i];
+    contexts[i].Count = STRESS_REQUESTS;
+    contexts[i].Delay = 2;
+    StartThread(&threads[i], &contexts[i]);
+  }
+  DokanPendingRequestsWait(g_Requests, TIMEOUT, Abandon, (void *)&abandoned);
+  CHECK(DokanPendingRequestsCount(g_Requests) == 0);
+  for (i = 0; i < STRESS_THREADS; ++i) {
+    JoinThread(threads[i]);
+    sent += contexts[i].Sent;
+  }
+  CHECK(sent + abandoned == STRESS_THREADS * STRESS_REQUESTS);
+  CHECK(freed == STRESS_THREADS * STRESS_REQUESTS);
+  printf("%ld completed %ld abandoned\n", sent, (long)abandoned);
+}
+
+int main(void) {
+  g_Requests = DokanPendingRequestsCreate();
+  CHECK(g_Requests != NULL);
+  if (g_Requests == NULL) {
+    return 1;
+  }
+
+  TestReply();
+  TestCompleted();
+  TestAbandoned();
+  TestUse();
+  TestStress();
+
+  DokanPendingRequestsDelete(g_Requests);
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,373 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the security descriptor cache of dokan/securitycache.c without a
+// mounted volume: sharing of identical descriptors, the entries of each
+// security information, least recently used eviction, removal and prefix
+// invalidation, inserts racing with changes, then lookups, inserts and
+// changes on several threads.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan securitycache_test.c ..\..\dokan\securitycache.c
+//   gcc -O2 -pthread -I../../dokan securitycache_test.c
+//       ../../dokan/securitycache.c -o securitycache_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "securitycache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE THREAD;
+
+static DWORD WINAPI ThreadStart(LPVOID Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  *Thread = CreateThread(NULL, 0, ThreadStart, Parameter, 0, NULL);
+}
+static void JoinThread(THREAD Thread) {
+  WaitForSingleObject(Thread, INFINITE);
+  CloseHandle(Thread);
+}
+#define AtomicIncrement(Value) InterlockedIncrement(Value)
+#else
+#include <pthread.h>
+
+typedef pthread_t THREAD;
+
+static void *ThreadStart(void *Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  pthread_create(Thread, NULL, ThreadStart, Parameter);
+}
+static void JoinThread(THREAD Thread) { pthread_join(Thread, NULL); }
+#define AtomicIncrement(Value) __sync_add_and_fetch(Value, 1)
+#endif
+
+#define OWNER 1
+#define DACL 4
+#define DESCRIPTOR_SIZE 64
+
+static PDOKAN_SECURITY_CACHE g_Cache;
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+// Descriptor whose bytes all are Seed
+static void MakeDescriptor(uint8_t *Descriptor, uint8_t Seed) {
+  memset(Descriptor, Seed, DESCRIPTOR_SIZE);
+}
+
+static void Insert(const char *Name, uint32_t SecurityInformation,
+                   uint8_t Seed) {
+  uint8_t descriptor[DESCRIPTOR_SIZE];
+
+  MakeDescriptor(descriptor, Seed);
+  DokanSecurityCacheInsert(g_Cache, Name, (uint32_t)strlen(Name),
+                           SecurityInformation, descriptor, DESCRIPTOR_SIZE,
+                           DokanSecurityCacheGeneration(g_Cache));
+}
+
+// Whether the cache has the descriptor of Seed for the file, -1 if none
+static int Lookup(const char *Name, uint32_t SecurityInformation,
+                  uint8_t Seed) {
+  uint8_t expected[DESCRIPTOR_SIZE];
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR descriptor;
+  const void *data;
+  uint32_t length;
+  int matches;
+
+  descriptor = DokanSecurityCacheLookup(g_Cache, Name, (uint32_t)strlen(Name),
+                                        SecurityInformation);
+  if (descriptor == NULL) {
+    return -1;
+  }
+  MakeDescriptor(expected, Seed);
+  data = DokanSecurityCacheDescriptorData(descriptor, &length);
+  matches = length == DESCRIPTOR_SIZE &&
+            memcmp(data, expected, DESCRIPTOR_SIZE) == 0;
+  DokanSecurityCacheRelease(g_Cache, descriptor);
+  return matches;
+}
+
+static void GetCounters(PDOKAN_SECURITY_CACHE_COUNTERS Counters) {
+  DokanSecurityCacheGetCounters(g_Cache, Counters);
+}
+
+static void TestSharing(void) {
+  DOKAN_SECURITY_CACHE_COUNTERS counters;
+  PDOKAN_SECURITY_CACHE_DESCRIPTOR held;
+
+  Insert("\\A\\1", DACL, 1);
+  Insert("\\A\\2", DACL, 1);
+  Insert("\\A\\3", DACL, 1);
+  Insert("\\A\\1", OWNER, 2);
+  GetCounters(&counters);
+  CHECK(counters.Entries == 4);
+  CHECK(counters.Descriptors == 2);
+  CHECK(counters.DescriptorBytes == 2 * DESCRIPTOR_SIZE);
+
+  CHECK(Lookup("\\A\\1", DACL, 1) == 1);
+  CHECK(Lookup("\\A\\1", OWNER, 2) == 1);
+  CHECK(Lookup("\\A\\2", DACL, 1) == 1);
+  CHECK(Lookup("\\A\\2", OWNER, 2) == -1);
+  CHECK(Lookup("\\A\\4", DACL, 1) == -1);
+
+  // Replacing a descriptor keeps the shared one for the other files
+  Insert("\\A\\3", DACL, 3);
+  CHECK(Lookup("\\A\\3", DACL, 3) == 1);
+  CHECK(Lookup("\\A\\2", DACL, 1) == 1);
+  GetCounters(&counters);
+  CHECK(counters.Entries == 4);
+  CHECK(counters.Descriptors == 3);
+
+  // A descriptor still referenced by a lookup outlives its entries
+  held = DokanSecurityCacheLookup(g_Cache, "\\A\\3", 4, DACL);
+  CHECK(held != NULL);
+  DokanSecurityCacheRemove(g_Cache, "\\A\\3", 4);
+  GetCounters(&counters);
+  CHECK(counters.Descriptors == 3);
+  DokanSecurityCacheRelease(g_Cache, held);
+  GetCounters(&counters);
+  CHECK(counters.Descriptors == 2);
+
+  DokanSecurityCacheInvalidate(g_Cache, "", 0);
+  GetCounters(&counters);
+  CHECK(counters.Entries == 0);
+  CHECK(counters.Descriptors == 0);
+  CHECK(counters.DescriptorBytes == 0);
+}
+
+static void TestChanges(void) {
+  DOKAN_SECURITY_CACHE_COUNTERS before;
+  DOKAN_SECURITY_CACHE_COUNTERS after;
+
+  Insert("\\D\\F", DACL, 4);
+  Insert("\\D\\F", OWNER, 4);
+  Insert("\\D\\SUB\\G", DACL, 4);
+  Insert("\\DX", DACL, 4);
+  GetCounters(&before);
+
+  // Removing a file drops all its security information
+  DokanSecurityCacheRemove(g_Cache, "\\D\\F", 4);
+  CHECK(Lookup("\\D\\F", DACL, 4) == -1);
+  CHECK(Lookup("\\D\\F", OWNER, 4) == -1);
+  CHECK(Lookup("\\D\\SUB\\G", DACL, 4) == 1);
+
+  // Directory prefixes end with a backslash so \DX is kept
+  DokanSecurityCacheInvalidate(g_Cache, "\\D\\", 3);
+  CHECK(Lookup("\\D\\SUB\\G", DACL, 4) == -1);
+  CHECK(Lookup("\\DX", DACL, 4) == 1);
+  GetCounters(&after);
+  CHECK(after.Invalidations - before.Invalidations == 3);
+  CHECK(after.Entries == 1);
+
+  DokanSecurityCacheInvalidate(g_Cache, "", 0);
+}
+
+static void TestRaces(void) {
+  uint8_t descriptor[DESCRIPTOR_SIZE];
+  uint64_t generation;
+
+  // A change between reading the descriptor and inserting it drops it
+  generation = DokanSecurityCacheGeneration(g_Cache);
+  MakeDescriptor(descriptor, 5);
+  DokanSecurityCacheRemove(g_Cache, "\\R", 2);
+  DokanSecurityCacheInsert(g_Cache, "\\R", 2, DACL, descriptor,
+                           DESCRIPTOR_SIZE, generation);
+  CHECK(Lookup("\\R", DACL, 5) == -1);
+
+  generation = DokanSecurityCacheGeneration(g_Cache);
+  DokanSecurityCacheInvalidate(g_Cache, "\\OTHER\\", 7);
+  DokanSecurityCacheInsert(g_Cache, "\\R", 2, DACL, descriptor,
+                           DESCRIPTOR_SIZE, generation);
+  CHECK(Lookup("\\R", DACL, 5) == -1);
+
+  generation = DokanSecurityCacheGeneration(g_Cache);
+  DokanSecurityCacheInsert(g_Cache, "\\R", 2, DACL, descriptor,
+                           DESCRIPTOR_SIZE, generation);
+  CHECK(Lookup("\\R", DACL, 5) == 1);
+
+  DokanSecurityCacheInvalidate(g_Cache, "", 0);
+}
+
+static void TestEviction(void) {
+  PDOKAN_SECURITY_CACHE cache = g_Cache;
+  DOKAN_SECURITY_CACHE_COUNTERS counters;
+
+  g_Cache = DokanSecurityCacheCreate(3);
+  CHECK(g_Cache != NULL);
+  if (g_Cache == NULL) {
+    g_Cache = cache;
+    return;
+  }
+  Insert("\\1", DACL, 1);
+  Insert("\\2", DACL, 2);
+  Insert("\\3", DACL, 3);
+  // \1 becomes the most recently used, \2 is evicted first
+  CHECK(Lookup("\\1", DACL, 1) == 1);
+  Insert("\\4", DACL, 4);
+  CHECK(Lookup("\\2", DACL, 2) == -1);
+  CHECK(Lookup("\\1", DACL, 1) == 1);
+  CHECK(Lookup("\\3", DACL, 3) == 1);
+  CHECK(Lookup("\\4", DACL, 4) == 1);
+  GetCounters(&counters);
+  CHECK(counters.Entries == 3);
+  CHECK(counters.Descriptors == 3);
+  CHECK(counters.Evictions == 1);
+  CHECK(counters.Hits == 4);
+  CHECK(counters.Misses == 1);
+  DokanSecurityCacheDelete(g_Cache);
+  g_Cache = cache;
+
+  // At least one entry is kept
+  g_Cache = DokanSecurityCacheCreate(0);
+  CHECK(g_Cache != NULL);
+  if (g_Cache != NULL) {
+    Insert("\\1", DACL, 1);
+    CHECK(Lookup("\\1", DACL, 1) == 1);
+    Insert("\\2", DACL, 2);
+    CHECK(Lookup("\\1", DACL, 1) == -1);
+    CHECK(Lookup("\\2", DACL, 2) == 1);
+    DokanSecurityCacheDelete(g_Cache);
+  }
+  g_Cache = cache;
+}
+
+typedef struct _THREAD_CONTEXT {
+  unsigned Seed;
+  volatile long *Errors;
+} THREAD_CONTEXT;
+
+static unsigned NextRandom(unsigned *Seed) {
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) & 0xFFFFFF;
+}
+
+// Every file of the stress test has the descriptor of its number, whatever
+// the thread that inserts it, so any hit must return that one
+static void RunThread(THREAD_CONTEXT *Context) {
+  char name[16];
+  unsigned file;
+  int i;
+
+  for (i = 0; i < 20000; ++i) {
+    file = NextRandom(&Context->Seed) % 64;
+    snprintf(name, sizeof(name), "\\S\\%u", file);
+    switch (NextRandom(&Context->Seed) % 8) {
+    case 0:
+      DokanSecurityCacheRemove(g_Cache, name, (uint32_t)strlen(name));
+      break;
+    case 1:
+      if (file == 0) {
+        DokanSecurityCacheInvalidate(g_Cache, "\\S\\", 3);
+      }
+      break;
+    case 2:
+    case 3:
+      Insert(name, DACL, (uint8_t)file);
+      break;
+    default:
+      if (Lookup(name, DACL, (uint8_t)file) == 0) {
+        AtomicIncrement(Context->Errors);
+      }
+      break;
+    }
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadStart(LPVOID Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return 0;
+}
+#else
+static void *ThreadStart(void *Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return NULL;
+}
+#endif
+
+static void TestStress(void) {
+  THREAD threads[8];
+  THREAD_CONTEXT contexts[8];
+  DOKAN_SECURITY_CACHE_COUNTERS counters;
+  volatile long errors = 0;
+  int i;
+
+  for (i = 0; i < 8; ++i) {
+    contexts[i].Seed = 2000 + i;
+    contexts[i].Errors = &errors;
+    StartThread(&threads[i], &contexts[i]);
+  }
+  for (i = 0; i < 8; ++i) {
+    JoinThread(threads[i]);
+  }
+  CHECK(errors == 0);
+  GetCounters(&counters);
+  CHECK(counters.Entries <= 32);
+  CHECK(counters.Descriptors <= counters.Entries);
+  CHECK(counters.Evictions > 0);
+}
+
+int main(void) {
+  DOKAN_SECURITY_CACHE_COUNTERS counters;
+
+  g_Cache = DokanSecurityCacheCreate(32);
+  CHECK(g_Cache != NULL);
+  if (g_Cache == NULL) {
+    return 1;
+  }
+
+  TestSharing();
+  TestChanges();
+  TestRaces();
+  TestEviction();
+  TestStress();
+
+  GetCounters(&counters);
+  printf("hits %llu misses %llu evictions %llu invalidations %llu "
+         "entries %llu descriptors %llu descriptor bytes %llu\n",
+         (unsigned long long)counters.Hits,
+         (unsigned long long)counters.Misses,
+         (unsigned long long)counters.Evictions,
+         (unsigned long long)counters.Invalidations,
+         (unsigned long long)counters.Entries,
+         (unsigned long long)counters.Descriptors,
+         (unsigned long long)counters.DescriptorBytes);
+  DokanSecurityCacheDelete(g_Cache);
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the latency histogram buckets of dokan/histogram.c used by
+// DokanGetStatistics, without a mounted volume: the buckets of every value up
+// to 2^20 and of powers of two against their limits, the saturation of the
+// last bucket, and percentiles of known histograms.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan statistics_test.c ..\..\dokan\histogram.c
+//   gcc -O2 -I../../dokan statistics_test.c ../../dokan/histogram.c
+//       -o statistics_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+// Smallest value of the bucket
+static uint64_t BucketStart(uint32_t Bucket) {
+  return Bucket == 0 ? 0 : DokanHistogramBucketLimit(Bucket - 1);
+}
+
+static void TestSmallValues(void) {
+  uint32_t i;
+
+  for (i = 0; i < DOKAN_HISTOGRAM_SUB_BUCKETS; ++i) {
+    CHECK(DokanHistogramBucket(i) == i);
+    CHECK(DokanHistogramBucketLimit(i) == i + 1);
+  }
+  // Each power of two is split into 4 buckets of equal width
+  CHECK(DokanHistogramBucket(4) == 4);
+  CHECK(DokanHistogramBucket(5) == 5);
+  CHECK(DokanHistogramBucket(7) == 7);
+  CHECK(DokanHistogramBucket(8) == 8);
+  CHECK(DokanHistogramBucket(9) == 8);
+  CHECK(DokanHistogramBucket(10) == 9);
+  CHECK(DokanHistogramBucket(15) == 11);
+  CHECK(DokanHistogramBucket(16) == 12);
+  CHECK(DokanHistogramBucketLimit(8) == 10);
+  CHECK(DokanHistogramBucketLimit(11) == 16);
+}
+
+static void TestValues(void) {
+  uint64_t value;
+  uint32_t bucket;
+  uint32_t previous = 0;
+  int monotonic = 1;
+  int bounded = 1;
+
+  for (value = 0; value <= (1 << 20); ++value) {
+    bucket = DokanHistogramBucket(value);
+    if (bucket < previous || bucket > previous + 1)
+      monotonic = 0;
+    if (value < BucketStart(bucket) ||
+        value >= DokanHistogramBucketLimit(bucket))
+      bounded = 0;
+    previous = bucket;
+  }
+  CHECK(monotonic);
+  CHECK(bounded);
+}
+
+static void TestPowersOfTwo(void) {
+  uint32_t exponent;
+  uint64_t value;
+  uint32_t bucket;
+
+  for (exponent = 2; exponent < 64; ++exponent) {
+    value = (uint64_t)1 << exponent;
+    bucket = DokanHistogramBucket(value);
+    if (bucket == DOKAN_HISTOGRAM_BUCKETS - 1)
+      break;
+    CHECK(bucket == (exponent - 1) * DOKAN_HISTOGRAM_SUB_BUCKETS);
+    CHECK(BucketStart(bucket) == value);
+    CHECK(DokanHistogramBucket(value - 1) == bucket - 1);
+  }
+  // Every larger value saturates in the last bucket
+  CHECK(exponent < 64);
+  CHECK(DokanHistogramBucket(UINT64_MAX) == DOKAN_HISTOGRAM_BUCKETS - 1);
+  CHECK(DokanHistogramBucket((uint64_t)1 << 62) ==
+        DOKAN_HISTOGRAM_BUCKETS - 1);
+}
+
+static void TestPercentiles(void) {
+  uint64_t histogram[DOKAN_HISTOGRAM_BUCKETS];
+  uint32_t i;
+
+  memset(histogram, 0, sizeof(histogram));
+  CHECK(DokanHistogramPercentile(NULL, 50) == 0);
+  CHECK(DokanHistogramPercentile(histogram, 50) == 0);
+
+  // 100 values of 1, 2, ..., 100
+  for (i = 1; i <= 100; ++i)
+    histogram[DokanHistogramBucket(i)]++;
+  // The bucket of the 50th value, 50, spans 48 to 55
+  CHECK(DokanHistogramPercentile(histogram, 50) == 55);
+  // 99 and 100 are in the bucket from 96 to 111
+  CHECK(DokanHistogramPercentile(histogram, 99) == 111);
+  CHECK(DokanHistogramPercentile(histogram, 100) == 111);
+  CHECK(DokanHistogramPercentile(histogram, 1000) == 111);
+  // The 0th percentile is the first value
+  CHECK(DokanHistogramPercentile(histogram, 0) == 1);
+
+  // One value in the last bucket
+  memset(histogram, 0, sizeof(histogram));
+  histogram[DokanHistogramBucket(UINT64_MAX)] = 1;
+  CHECK(DokanHistogramPercentile(histogram, 50) ==
+        DokanHistogramBucketLimit(DOKAN_HISTOGRAM_BUCKETS - 1) - 1);
+}
+
+int main(void) {
+  TestSmallValues();
+  TestValues();
+  TestPowersOfTwo();
+  TestPercentiles();
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the timeout wheel of the pending IRPs in sys/timerwheel.c, outside of
+// the driver: deadlines expiring in their slot, entries more than one turn
+// away rolling over their slot, long pauses, timeout resets, and entries
+// canceled before, while and after they expire, and the serial table growing
+// with thousands of entries.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\sys timerwheel_test.c ..\..\sys\timerwheel.c
+//   gcc -O2 -I../../sys timerwheel_test.c ../../sys/timerwheel.c
+//       -o timerwheel_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "timerwheel.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+#define ENTRY_COUNT 8
+#define TURN ((uint64_t)DOKAN_TIMER_WHEEL_SLOTS)
+
+static DOKAN_TIMER_WHEEL g_Wheel;
+static DOKAN_TIMER_WHEEL_ENTRY g_Entries[ENTRY_COUNT];
+// First tick of the current slot of the wheel when the test starts
+static uint64_t g_Start;
+
+static void Reset(void) {
+  int i;
+
+  DokanTimerWheelInit(&g_Wheel);
+  for (i = 0; i < ENTRY_COUNT; ++i) {
+    DokanTimerWheelEntryInit(&g_Entries[i]);
+  }
+  g_Start = g_Wheel.CurrentSlot * g_Wheel.SlotTicks;
+}
+
+// Tick count Slots slots and Ticks ticks after the start
+static uint64_t At(uint64_t Slots, uint64_t Ticks) {
+  return g_Start + Slots * g_Wheel.SlotTicks + Ticks;
+}
+
+static void Insert(int Index, uint64_t Deadline) {
+  DokanTimerWheelInsert(&g_Wheel, &g_Entries[Index], (uint32_t)Index + 100,
+                        Deadline);
+}
+
+static int IsLinked(int Index) {
+  return g_Entries[Index].TimeoutLink.Flink != &g_Entries[Index].TimeoutLink;
+}
+
+// Collects at TickCount and takes the expired entries out of the wheel as
+// the timeout check of the driver does. Returns a bit per expired entry.
+static unsigned Collect(uint64_t TickCount) {
+  DOKAN_TIMER_LINK expired;
+  PDOKAN_TIMER_WHEEL_ENTRY entry;
+  unsigned mask = 0;
+  int index;
+
+  DokanTimerWheelCollect(&g_Wheel, TickCount, &expired);
+  while (expired.Flink != &expired) {
+    entry = (PDOKAN_TIMER_WHEEL_ENTRY)((char *)expired.Flink -
+                                       offsetof(DOKAN_TIMER_WHEEL_ENTRY,
+                                                TimeoutLink));
+    index = (int)(entry - g_Entries);
+    CHECK(index >= 0 && index < ENTRY_COUNT);
+    CHECK((mask & (1u << index)) == 0);
+    mask |= 1u << index;
+    DokanTimerWheelRemove(entry);
+  }
+  return mask;
+}
+
+static void TestInit(void) {
+  uint64_t now;
+
+  Reset();
+  now = DokanTimerWheelTickCount();
+  // Ticks are milliseconds outside of the driver
+  CHECK(g_Wheel.SlotTicks == DOKAN_TIMER_WHEEL_SLOT_DURATION);
+  CHECK(g_Wheel.CurrentSlot == now / g_Wheel.SlotTicks ||
+        g_Wheel.CurrentSlot + 1 == now / g_Wheel.SlotTicks);
+  CHECK(Collect(g_Start) == 0);
+}
+
+static void TestDeadlines(void) {
+  Reset();
+  Insert(0, At(0, 500));
+  Insert(1, At(3, 0));
+  Insert(2, At(3, 999));
+  Insert(3, At(10, 1));
+
+  CHECK(Collect(At(0, 499)) == 0);
+  CHECK(Collect(At(0, 500)) == 1u << 0);
+  // The second entry of a slot waits for its own deadline
+  CHECK(Collect(At(3, 0)) == 1u << 1);
+  CHECK(Collect(At(3, 998)) == 0);
+  CHECK(Collect(At(4, 0)) == 1u << 2);
+  CHECK(Collect(At(20, 0)) == 1u << 3);
+  CHECK(Collect(At(30, 0)) == 0);
+  CHECK(!IsLinked(0) && !IsLinked(3));
+  CHECK(DokanTimerWheelFind(&g_Wheel, 100) == NULL);
+
+  // Past and immediate deadlines expire at the next collect
+  Insert(4, g_Start);
+  Insert(5, 0);
+  CHECK(Collect(At(30, 0)) == (1u << 4 | 1u << 5));
+}
+
+static void TestSlotRollover(void) {
+  Reset();
+  // Same slot, one and two turns apart
+  Insert(0, At(5, 0));
+  Insert(1, At(5 + TURN, 0));
+  Insert(2, At(5 + 2 * TURN, 0));
+  // Last slot before the current one wraps around
+  Insert(3, At(TURN - 1, 0));
+
+  CHECK(Collect(At(5, 0)) == 1u << 0);
+  CHECK(IsLinked(1) && IsLinked(2));
+  CHECK(Collect(At(TURN - 1, 0)) == 1u << 3);
+  CHECK(Collect(At(TURN + 4, 999)) == 0);
+  CHECK(Collect(At(TURN + 5, 0)) == 1u << 1);
+  CHECK(Collect(At(2 * TURN + 4, 0)) == 0);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 102) == &g_Entries[2]);
+  CHECK(Collect(At(2 * TURN + 5, 0)) == 1u << 2);
+
+  // After a pause of several turns every slot is visited once
+  Reset();
+  Insert(0, At(1, 0));
+  Insert(1, At(TURN / 2, 0));
+  Insert(2, At(TURN + 7, 0));
+  Insert(3, At(10 * TURN, 0));
+  CHECK(Collect(At(3 * TURN + 1, 0)) == (1u << 0 | 1u << 1 | 1u << 2));
+  CHECK(g_Wheel.CurrentSlot == g_Start / g_Wheel.SlotTicks + 3 * TURN + 1);
+  CHECK(Collect(At(10 * TURN - 1, 0)) == 0);
+  CHECK(Collect(At(10 * TURN, 0)) == 1u << 3);
+
+  // A collect that goes back in time does not move the wheel back
+  Reset();
+  Insert(0, At(2, 0));
+  CHECK(Collect(At(4, 0)) == 1u << 0);
+  Insert(1, At(3, 0));
+  CHECK(Collect(At(1, 0)) == 0);
+  CHECK(g_Wheel.CurrentSlot == g_Start / g_Wheel.SlotTicks + 4);
+  CHECK(Collect(At(4, 0)) == 1u << 1);
+}
+
+static void TestReschedule(void) {
+  Reset();
+  Insert(0, At(2, 0));
+  Insert(1, At(2, 0));
+  CHECK(DokanTimerWheelFind(&g_Wheel, 100) == &g_Entries[0]);
+  DokanTimerWheelReschedule(&g_Wheel, &g_Entries[0], At(2 + TURN, 0));
+  CHECK(Collect(At(2, 0)) == 1u << 1);
+  CHECK(Collect(At(1 + TURN, 0)) == 0);
+  CHECK(Collect(At(2 + TURN, 0)) == 1u << 0);
+}
+
+static void TestCancel(void) {
+  DOKAN_TIMER_LINK expired;
+
+  // Canceled while waiting
+  Reset();
+  Insert(0, At(50, 0));
+  Insert(1, At(50, 0));
+  DokanTimerWheelExpireNow(&g_Wheel, &g_Entries[0]);
+  CHECK(g_Entries[0].Deadline == 0);
+  CHECK(Collect(At(1, 0)) == 1u << 0);
+  CHECK(Collect(At(50, 0)) == 1u << 1);
+
+  // Canceled twice, or canceled then removed
+  Reset();
+  Insert(0, At(5, 0));
+  Insert(1, At(5, 0));
+  DokanTimerWheelExpireNow(&g_Wheel, &g_Entries[0]);
+  DokanTimerWheelExpireNow(&g_Wheel, &g_Entries[0]);
+  DokanTimerWheelExpireNow(&g_Wheel, &g_Entries[1]);
+  DokanTimerWheelRemove(&g_Entries[1]);
+  CHECK(Collect(At(1, 0)) == 1u << 0);
+  CHECK(Collect(At(10, 0)) == 0);
+
+  // Canceled after expiring, while in the list of the collect
+  Reset();
+  Insert(0, At(1, 0));
+  Insert(1, At(1, 0));
+  DokanTimerWheelCollect(&g_Wheel, At(1, 0), &expired);
+  DokanTimerWheelRemove(&g_Entries[0]);
+  CHECK(expired.Flink == &g_Entries[1].TimeoutLink);
+  CHECK(expired.Blink == &g_Entries[1].TimeoutLink);
+  DokanTimerWheelRemove(&g_Entries[1]);
+  CHECK(expired.Flink == &expired && expired.Blink == &expired);
+
+  // Canceled after being taken out of the wheel
+  DokanTimerWheelRemove(&g_Entries[0]);
+  CHECK(!IsLinked(0));
+  CHECK(DokanTimerWheelFind(&g_Wheel, 100) == NULL);
+  CHECK(Collect(At(TURN, 0)) == 0);
+
+  // The entry can be inserted again
+  Insert(0, At(TURN + 3, 0));
+  CHECK(Collect(At(TURN + 3, 0)) == 1u << 0);
+}
+
+static void TestFind(void) {
+  DOKAN_TIMER_WHEEL_ENTRY entries[3];
+  int i;
+
+  Reset();
+  // Same serial bucket
+  for (i = 0; i < 3; ++i) {
+    DokanTimerWheelEntryInit(&entries[i]);
+    DokanTimerWheelInsert(&g_Wheel, &entries[i],
+                          7 + (uint32_t)i * DOKAN_TIMER_WHEEL_SERIAL_BUCKETS,
+                          At(1, 0));
+  }
+  CHECK(DokanTimerWheelFind(&g_Wheel, 7) == &entries[0]);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 7 + DOKAN_TIMER_WHEEL_SERIAL_BUCKETS) ==
+        &entries[1]);
+  CHECK(DokanTimerWheelFind(&g_Wheel,
+                            7 + 2 * DOKAN_TIMER_WHEEL_SERIAL_BUCKETS) ==
+        &entries[2]);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 8) == NULL);
+  DokanTimerWheelRemove(&entries[1]);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 7 + DOKAN_TIMER_WHEEL_SERIAL_BUCKETS) ==
+        NULL);
+  CHECK(DokanTimerWheelFind(&g_Wheel,
+                            7 + 2 * DOKAN_TIMER_WHEEL_SERIAL_BUCKETS) ==
+        &entries[2]);
+  DokanTimerWheelRemove(&entries[0]);
+  DokanTimerWheelRemove(&entries[2]);
+}
+
+#define MANY_ENTRY_COUNT 5000
+
+// Longest serial bucket of the wheel
+static uint32_t LongestBucket(void) {
+  PDOKAN_TIMER_LINK bucket, link;
+  uint32_t i, length, longest = 0;
+
+  for (i = 0; i < g_Wheel.SerialBucketCount; ++i) {
+    bucket = &g_Wheel.SerialBuckets[i];
+    length = 0;
+    for (link = bucket->Flink; link != bucket; link = link->Flink) {
+      ++length;
+    }
+    if (length > longest) {
+      longest = length;
+    }
+  }
+  return longest;
+}
+
+static void TestManyEntries(void) {
+  DOKAN_TIMER_LINK expired;
+  PDOKAN_TIMER_WHEEL_ENTRY entries;
+  int count = 0;
+  int i;
+
+  entries = malloc(sizeof(DOKAN_TIMER_WHEEL_ENTRY) * MANY_ENTRY_COUNT);
+  if (entries == NULL) {
+    CHECK(entries != NULL);
+    return;
+  }
+  Reset();
+  CHECK(g_Wheel.SerialBucketCount == DOKAN_TIMER_WHEEL_SERIAL_BUCKETS);
+  // Serial numbers are sequential from an arbitrary start, as in the driver
+  for (i = 0; i < MANY_ENTRY_COUNT; ++i) {
+    DokanTimerWheelEntryInit(&entries[i]);
+    DokanTimerWheelInsert(&g_Wheel, &entries[i], 0xFFFFF000u + (uint32_t)i,
+                          At(1 + (uint64_t)i % 30, 0));
+  }
+  CHECK(g_Wheel.Count == MANY_ENTRY_COUNT);
+  CHECK(g_Wheel.SerialBucketCount >=
+        MANY_ENTRY_COUNT / DOKAN_TIMER_WHEEL_SERIAL_LOAD);
+  CHECK(LongestBucket() <= DOKAN_TIMER_WHEEL_SERIAL_LOAD);
+  for (i = 0; i < MANY_ENTRY_COUNT; ++i) {
+    CHECK(DokanTimerWheelFind(&g_Wheel, 0xFFFFF000u + (uint32_t)i) ==
+          &entries[i]);
+  }
+
+  // Completed IRPs leave in any order, the table keeps its size meanwhile
+  for (i = 0; i < MANY_ENTRY_COUNT; i += 2) {
+    DokanTimerWheelRemove(&entries[i]);
+  }
+  CHECK(g_Wheel.Count == MANY_ENTRY_COUNT / 2);
+  CHECK(g_Wheel.SerialBucketCount > DOKAN_TIMER_WHEEL_SERIAL_BUCKETS);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 0xFFFFF000u) == NULL);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 0xFFFFF001u) == &entries[1]);
+
+  // The others time out
+  DokanTimerWheelCollect(&g_Wheel, At(31, 0), &expired);
+  while (expired.Flink != &expired) {
+    DokanTimerWheelRemove(
+        (PDOKAN_TIMER_WHEEL_ENTRY)((char *)expired.Flink -
+                                   offsetof(DOKAN_TIMER_WHEEL_ENTRY,
+                                            TimeoutLink)));
+    ++count;
+  }
+  CHECK(count == MANY_ENTRY_COUNT / 2);
+  CHECK(g_Wheel.Count == 0);
+  CHECK(g_Wheel.SerialBucketCount == DOKAN_TIMER_WHEEL_SERIAL_BUCKETS);
+  CHECK(g_Wheel.SerialBuckets == g_Wheel.InitialSerialBuckets);
+  CHECK(DokanTimerWheelFind(&g_Wheel, 0xFFFFF001u) == NULL);
+
+  // The initial buckets are usable again
+  DokanTimerWheelInsert(&g_Wheel, &entries[0], 3, At(1, 0));
+  CHECK(DokanTimerWheelFind(&g_Wheel, 3) == &entries[0]);
+  DokanTimerWheelRemove(&entries[0]);
+  DokanTimerWheelUninit(&g_Wheel);
+  free(entries);
+}
+
+int main(void) {
+  TestInit();
+  TestDeadlines();
+  TestSlotRollover();
+  TestReschedule();
+  TestCancel();
+  TestFind();
+  TestManyEntries();
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,241 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the trace rings and trace file records of dokan/tracering.c used by
+// DokanDumpTrace and dokanctl /x, without a mounted volume: headers and
+// records encoded and decoded back, their byte layout, rejected headers, then
+// rings before and after they wrap around and entries being written.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan trace_test.c ..\..\dokan\tracering.c
+//   gcc -O2 -I../../dokan trace_test.c ../../dokan/tracering.c -o trace_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "tracering.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+// Entry whose fields are all derived from Number
+static void MakeEntry(uint32_t Number, PDOKAN_TRACE_ENTRY Entry) {
+  memset(Entry, 0, sizeof(DOKAN_TRACE_ENTRY));
+  Entry->Timestamp = (uint64_t)Number * 1000003;
+  Entry->ThreadId = Number % 7 + 1;
+  Entry->SerialNumber = Number;
+  Entry->FileNameHash = Number * 2654435761u;
+  Entry->Status = Number % 3 == 0 ? (int32_t)0xC0000034 : 0;
+  Entry->BytesIn = Number * 3;
+  Entry->BytesOut = Number * 5;
+  Entry->CallbackTime = Number % 1000;
+  Entry->DispatchTime = Number % 1000 + 10;
+  Entry->MajorFunction = (uint8_t)(Number % 28);
+  Entry->MinorFunction = (uint8_t)(Number % 5);
+}
+
+static int SameEntry(const DOKAN_TRACE_ENTRY *Entry,
+                     const DOKAN_TRACE_ENTRY *Other) {
+  return Entry->Timestamp == Other->Timestamp &&
+         Entry->Sequence == Other->Sequence &&
+         Entry->ThreadId == Other->ThreadId &&
+         Entry->SerialNumber == Other->SerialNumber &&
+         Entry->FileNameHash == Other->FileNameHash &&
+         Entry->Status == Other->Status && Entry->BytesIn == Other->BytesIn &&
+         Entry->BytesOut == Other->BytesOut &&
+         Entry->CallbackTime == Other->CallbackTime &&
+         Entry->DispatchTime == Other->DispatchTime &&
+         Entry->MajorFunction == Other->MajorFunction &&
+         Entry->MinorFunction == Other->MinorFunction;
+}
+
+static void TestHeader(void) {
+  uint8_t buffer[DOKAN_TRACE_FILE_HEADER_SIZE];
+  DOKAN_TRACE_FILE_INFO info;
+  DOKAN_TRACE_FILE_INFO decoded;
+
+  info.RecordCount = 3000;
+  info.Frequency = 10000000;
+  info.ProcessId = 4242;
+  DokanTraceEncodeHeader(&info, buffer);
+  // "DKTR" then the version and the size of a record
+  CHECK(memcmp(buffer, "DKTR", 4) == 0);
+  CHECK(buffer[4] == DOKAN_TRACE_FILE_VERSION && buffer[5] == 0);
+  CHECK(buffer[8] == DOKAN_TRACE_FILE_RECORD_SIZE && buffer[9] == 0);
+  CHECK(buffer[12] == (3000 & 0xFF) && buffer[13] == (3000 >> 8));
+
+  memset(&decoded, 0, sizeof(decoded));
+  CHECK(DokanTraceDecodeHeader(buffer, &decoded));
+  CHECK(decoded.RecordCount == 3000);
+  CHECK(decoded.Frequency == 10000000);
+  CHECK(decoded.ProcessId == 4242);
+
+  // Other files, versions and record sizes are rejected
+  buffer[0] ^= 1;
+  CHECK(!DokanTraceDecodeHeader(buffer, &decoded));
+  buffer[0] ^= 1;
+  buffer[4]++;
+  CHECK(!DokanTraceDecodeHeader(buffer, &decoded));
+  buffer[4]--;
+  buffer[8]++;
+  CHECK(!DokanTraceDecodeHeader(buffer, &decoded));
+  buffer[8]--;
+  info.Frequency = 0;
+  DokanTraceEncodeHeader(&info, buffer);
+  CHECK(!DokanTraceDecodeHeader(buffer, &decoded));
+}
+
+static void TestRecord(void) {
+  uint8_t buffer[DOKAN_TRACE_FILE_RECORD_SIZE];
+  DOKAN_TRACE_ENTRY entry;
+  DOKAN_TRACE_ENTRY decoded;
+  uint32_t i;
+
+  for (i = 0; i < 1000; ++i) {
+    MakeEntry(i * 7919, &entry);
+    entry.Sequence = (uint64_t)i << 33 | i;
+    memset(buffer, 0xAA, sizeof(buffer));
+    DokanTraceEncodeRecord(&entry, buffer);
+    memset(&decoded, 0x55, sizeof(decoded));
+    DokanTraceDecodeRecord(buffer, &decoded);
+    CHECK(SameEntry(&entry, &decoded));
+  }
+
+  // Extreme values and the layout of DOKAN_TRACE_RECORD
+  memset(&entry, 0, sizeof(entry));
+  entry.Timestamp = UINT64_MAX;
+  entry.Sequence = 1;
+  entry.ThreadId = UINT32_MAX;
+  entry.Status = (int32_t)0x80000005;
+  entry.MajorFunction = 0xFF;
+  entry.MinorFunction = 0x12;
+  DokanTraceEncodeRecord(&entry, buffer);
+  CHECK(buffer[0] == 0xFF && buffer[7] == 0xFF);
+  CHECK(buffer[8] == 1 && buffer[15] == 0);
+  CHECK(buffer[16] == 0xFF && buffer[19] == 0xFF);
+  CHECK(buffer[28] == 0x05 && buffer[31] == 0x80);
+  CHECK(buffer[48] == 0xFF && buffer[49] == 0x12);
+  for (i = 50; i < DOKAN_TRACE_FILE_RECORD_SIZE; ++i)
+    CHECK(buffer[i] == 0);
+  DokanTraceDecodeRecord(buffer, &decoded);
+  CHECK(SameEntry(&entry, &decoded));
+  CHECK(decoded.Status < 0);
+}
+
+// Checks that the copy of a ring holds the entries First to Last in order
+static int CheckCopy(const DOKAN_TRACE_ENTRY *Entries, uint32_t Count,
+                     uint32_t First, uint32_t Last) {
+  DOKAN_TRACE_ENTRY expected;
+  uint32_t i;
+
+  if (Count != Last - First + 1)
+    return 0;
+  for (i = 0; i < Count; ++i) {
+    MakeEntry(First + i, &expected);
+    expected.Sequence = First + i;
+    if (!SameEntry(&Entries[i], &expected))
+      return 0;
+  }
+  return 1;
+}
+
+static void TestRing(void) {
+  PDOKAN_TRACE_RING_BUFFER ring;
+  PDOKAN_TRACE_ENTRY entries;
+  DOKAN_TRACE_ENTRY entry;
+  uint32_t count;
+  uint32_t i;
+
+  ring = (PDOKAN_TRACE_RING_BUFFER)calloc(1, sizeof(DOKAN_TRACE_RING_BUFFER));
+  entries = (PDOKAN_TRACE_ENTRY)malloc(sizeof(DOKAN_TRACE_ENTRY) *
+                                       DOKAN_TRACE_RING_ENTRIES);
+  if (ring == NULL || entries == NULL) {
+    printf("out of memory\n");
+    exit(1);
+  }
+
+  CHECK(DokanTraceRingCopy(ring, entries) == 0);
+
+  for (i = 1; i <= 10; ++i) {
+    MakeEntry(i, &entry);
+    DokanTraceRingWrite(ring, &entry);
+  }
+  count = DokanTraceRingCopy(ring, entries);
+  CHECK(CheckCopy(entries, count, 1, 10));
+
+  // Full
+  for (; i <= DOKAN_TRACE_RING_ENTRIES; ++i) {
+    MakeEntry(i, &entry);
+    DokanTraceRingWrite(ring, &entry);
+  }
+  count = DokanTraceRingCopy(ring, entries);
+  CHECK(CheckCopy(entries, count, 1, DOKAN_TRACE_RING_ENTRIES));
+
+  // One more overwrites the oldest
+  MakeEntry(i, &entry);
+  DokanTraceRingWrite(ring, &entry);
+  count = DokanTraceRingCopy(ring, entries);
+  CHECK(CheckCopy(entries, count, 2, DOKAN_TRACE_RING_ENTRIES + 1));
+
+  // Several rounds, ending in the middle of the ring
+  for (++i; i <= 3 * DOKAN_TRACE_RING_ENTRIES + 100; ++i) {
+    MakeEntry(i, &entry);
+    DokanTraceRingWrite(ring, &entry);
+  }
+  count = DokanTraceRingCopy(ring, entries);
+  CHECK(CheckCopy(entries, count, 2 * DOKAN_TRACE_RING_ENTRIES + 101,
+                  3 * DOKAN_TRACE_RING_ENTRIES + 100));
+  CHECK(count == DOKAN_TRACE_RING_ENTRIES);
+  CHECK(entries[0].Sequence == 2 * DOKAN_TRACE_RING_ENTRIES + 101);
+
+  // An entry being written is skipped
+  ring->Entries[100].Sequence = 0;
+  count = DokanTraceRingCopy(ring, entries);
+  CHECK(count == DOKAN_TRACE_RING_ENTRIES - 1);
+  for (i = 1; i < count; ++i)
+    CHECK(entries[i].Sequence > entries[i - 1].Sequence);
+
+  free(entries);
+  free(ring);
+}
+
+int main(void) {
+  TestHeader();
+  TestRecord();
+  TestRing();
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
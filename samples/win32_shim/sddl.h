@@ -0,0 +1,70 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_WIN32_SHIM_SDDL_H_
+#define DOKAN_WIN32_SHIM_SDDL_H_
+
+// Stand-in for <sddl.h>, see windows.h. Security descriptor strings need
+// Windows, the conversions fail.
+
+#include <windows.h>
+
+#define SDDL_REVISION_1 1
+
+static inline BOOL ConvertSidToStringSidW(PSID Sid, LPWSTR *StringSid) {
+  (void)Sid;
+  *StringSid = NULL;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+#define ConvertSidToStringSid ConvertSidToStringSidW
+
+static inline BOOL ConvertStringSecurityDescriptorToSecurityDescriptorW(
+    LPCWSTR StringSecurityDescriptor, DWORD StringSDRevision,
+    PSECURITY_DESCRIPTOR *SecurityDescriptor, PULONG SecurityDescriptorSize) {
+  (void)StringSecurityDescriptor;
+  (void)StringSDRevision;
+  *SecurityDescriptor = NULL;
+  if (SecurityDescriptorSize != NULL)
+    *SecurityDescriptorSize = 0;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+#define ConvertStringSecurityDescriptorToSecurityDescriptor                    \
+  ConvertStringSecurityDescriptorToSecurityDescriptorW
+
+static inline BOOL ConvertSecurityDescriptorToStringSecurityDescriptorW(
+    PSECURITY_DESCRIPTOR SecurityDescriptor, DWORD RequestedStringSDRevision,
+    SECURITY_INFORMATION SecurityInformation, LPWSTR *StringSecurityDescriptor,
+    PULONG StringSecurityDescriptorLen) {
+  (void)SecurityDescriptor;
+  (void)RequestedStringSDRevision;
+  (void)SecurityInformation;
+  *StringSecurityDescriptor = NULL;
+  if (StringSecurityDescriptorLen != NULL)
+    *StringSecurityDescriptorLen = 0;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+#define ConvertSecurityDescriptorToStringSecurityDescriptor                    \
+  ConvertSecurityDescriptorToStringSecurityDescriptorW
+
+#endif // DOKAN_WIN32_SHIM_SDDL_H_
@@ -0,0 +1,75 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_WIN32_SHIM_STRSAFE_H_
+#define DOKAN_WIN32_SHIM_STRSAFE_H_
+
+// Stand-in for <strsafe.h>, see windows.h
+
+#include <windows.h>
+
+static inline HRESULT StringCchVPrintfW(LPWSTR Destination, size_t Size,
+                                       LPCWSTR Format, va_list Arguments) {
+  int length;
+
+  if (Size == 0)
+    return STRSAFE_E_INVALID_PARAMETER;
+  length = vswprintf(Destination, Size, Format, Arguments);
+  if (length < 0) {
+    Destination[Size - 1] = L'\0';
+    return STRSAFE_E_INSUFFICIENT_BUFFER;
+  }
+  return S_OK;
+}
+
+static inline HRESULT StringCchPrintfW(LPWSTR Destination, size_t Size,
+                                      LPCWSTR Format, ...) {
+  va_list arguments;
+  HRESULT result;
+
+  va_start(arguments, Format);
+  result = StringCchVPrintfW(Destination, Size, Format, arguments);
+  va_end(arguments);
+  return result;
+}
+
+static inline HRESULT StringCbPrintfW(LPWSTR Destination, size_t Size,
+                                     LPCWSTR Format, ...) {
+  va_list arguments;
+  HRESULT result;
+
+  va_start(arguments, Format);
+  result = StringCchVPrintfW(Destination, Size / sizeof(WCHAR), Format,
+                             arguments);
+  va_end(arguments);
+  return result;
+}
+
+static inline HRESULT StringCchCopyW(LPWSTR Destination, size_t Size,
+                                    LPCWSTR Source) {
+  if (Size == 0)
+    return STRSAFE_E_INVALID_PARAMETER;
+  return wcscpy_s(Destination, Size, Source) == 0
+             ? S_OK
+             : STRSAFE_E_INSUFFICIENT_BUFFER;
+}
+
+#endif // DOKAN_WIN32_SHIM_STRSAFE_H_
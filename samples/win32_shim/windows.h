@@ -0,0 +1,1123 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_WIN32_SHIM_WINDOWS_H_
+#define DOKAN_WIN32_SHIM_WINDOWS_H_
+
+// Stand-in for <windows.h> to build the dispatch files of dokan/ and the FUSE
+// bridge of dokan_fuse/ with gcc on Linux, for the portable samples that run
+// them without a driver.
+//
+// It only has the part of the API these files use. Types have their Windows
+// sizes except WCHAR, which is the 4 byte wchar_t of the C runtime so that the
+// wide string functions and L"" literals work as they are. Synchronization is
+// done with pthreads and files with POSIX descriptors, and the calls that need
+// Windows itself (tokens, named objects) fail with ERROR_CALL_NOT_IMPLEMENTED.
+//
+// Everything is static inline so that a sample only adds this directory to
+// its include path.
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "winconst.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __stdcall
+#define __cdecl
+#define __declspec(x)
+#define __forceinline static inline
+#define __int64 long long
+#define WINAPI
+#define CALLBACK
+#define APIENTRY
+#define FORCEINLINE static inline
+#define DECLSPEC_ALIGN(x) __attribute__((aligned(x)))
+#define CONST const
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _Out_opt_
+
+#define _WIN32_WINNT_WIN7 0x0601
+#define _WIN32_WINNT_WIN10_RS1 0x0A00
+#define _WIN32_WINNT _WIN32_WINNT_WIN7
+#define DUMMYUNIONNAME
+#define DUMMYSTRUCTNAME
+
+#define TRUE 1
+#define FALSE 0
+
+typedef void VOID, *PVOID, *LPVOID;
+typedef const void *LPCVOID;
+typedef char CHAR, *PCHAR, *LPSTR, *PSTR, CCHAR;
+typedef const char *LPCSTR, *PCSTR;
+typedef wchar_t WCHAR, *PWCHAR, *LPWSTR, *PWSTR;
+typedef const wchar_t *LPCWSTR, *PCWSTR;
+typedef wchar_t TCHAR, *LPTSTR;
+typedef const wchar_t *LPCTSTR;
+typedef uint8_t UCHAR, *PUCHAR, BYTE, *PBYTE, *LPBYTE, BOOLEAN, *PBOOLEAN;
+typedef int16_t SHORT, *PSHORT;
+typedef uint16_t USHORT, *PUSHORT, WORD, *PWORD;
+typedef int INT, *PINT, BOOL, *PBOOL, *LPBOOL;
+typedef unsigned int UINT, *PUINT;
+typedef int32_t LONG, *PLONG;
+typedef uint32_t ULONG, *PULONG, DWORD, *PDWORD, *LPDWORD;
+typedef int64_t LONGLONG, *PLONGLONG, LONG64, *PLONG64, INT64;
+typedef uint64_t ULONGLONG, *PULONGLONG, ULONG64, *PULONG64, DWORD64, UINT64;
+typedef intptr_t INT_PTR, LONG_PTR;
+typedef uintptr_t UINT_PTR, ULONG_PTR, DWORD_PTR, *PULONG_PTR;
+typedef size_t SIZE_T, *PSIZE_T, rsize_t;
+typedef LONG NTSTATUS, HRESULT;
+typedef DWORD ACCESS_MASK, *PACCESS_MASK;
+typedef DWORD SECURITY_INFORMATION, *PSECURITY_INFORMATION;
+typedef PVOID PSECURITY_DESCRIPTOR, PSID;
+typedef WORD SECURITY_DESCRIPTOR_CONTROL;
+typedef PVOID PVOID64;
+typedef PVOID HANDLE, *PHANDLE, HINSTANCE, HMODULE, SC_HANDLE;
+typedef DWORD LCID;
+
+// Of the C runtime of Windows, for fuse_win.h
+typedef struct timespec timestruc_t;
+
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define INVALID_FILE_SIZE ((DWORD)0xFFFFFFFF)
+#define INVALID_SET_FILE_POINTER ((DWORD)-1)
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED ((DWORD)0xFFFFFFFF)
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+#define ANYSIZE_ARRAY 1
+
+#define CTL_CODE(DeviceType, Function, Method, Access)                         \
+  (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define MAKELONG(a, b)                                                         \
+  ((LONG)(((WORD)((DWORD_PTR)(a)&0xffff)) |                                    \
+          ((DWORD)((WORD)((DWORD_PTR)(b)&0xffff))) << 16))
+#define LOWORD(l) ((WORD)((DWORD_PTR)(l)&0xffff))
+#define HIWORD(l) ((WORD)((DWORD_PTR)(l) >> 16))
+// As with NOMINMAX in C++, where they would break the standard library of gcc
+#if !defined(NOMINMAX) && !defined(__cplusplus)
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define Int32x32To64(a, b) ((LONGLONG)(LONG)(a) * (LONGLONG)(LONG)(b))
+
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define CONTAINING_RECORD(address, type, field)                                \
+  ((type *)((char *)(address)-offsetof(type, field)))
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define C_ASSERT(e) typedef char __C_ASSERT__##__LINE__[(e) ? 1 : -1]
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define _countof(A) ARRAYSIZE(A)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define S_OK ((HRESULT)0)
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+#define STRSAFE_E_INVALID_PARAMETER ((HRESULT)0x80070057L)
+
+typedef union _LARGE_INTEGER {
+  struct {
+    DWORD LowPart;
+    LONG HighPart;
+  };
+  struct {
+    DWORD LowPart;
+    LONG HighPart;
+  } u;
+  LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+  struct {
+    DWORD LowPart;
+    DWORD HighPart;
+  };
+  struct {
+    DWORD LowPart;
+    DWORD HighPart;
+  } u;
+  ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _FILETIME {
+  DWORD dwLowDateTime;
+  DWORD dwHighDateTime;
+} FILETIME, *PFILETIME, *LPFILETIME;
+
+typedef struct _SYSTEMTIME {
+  WORD wYear;
+  WORD wMonth;
+  WORD wDayOfWeek;
+  WORD wDay;
+  WORD wHour;
+  WORD wMinute;
+  WORD wSecond;
+  WORD wMilliseconds;
+} SYSTEMTIME, *PSYSTEMTIME, *LPSYSTEMTIME;
+
+typedef struct _LIST_ENTRY {
+  struct _LIST_ENTRY *Flink;
+  struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _SINGLE_LIST_ENTRY {
+  struct _SINGLE_LIST_ENTRY *Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY;
+
+typedef struct _FILE_ID_128 {
+  BYTE Identifier[16];
+} FILE_ID_128, *PFILE_ID_128;
+
+typedef struct _BY_HANDLE_FILE_INFORMATION {
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD dwVolumeSerialNumber;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+  DWORD nNumberOfLinks;
+  DWORD nFileIndexHigh;
+  DWORD nFileIndexLow;
+} BY_HANDLE_FILE_INFORMATION, *PBY_HANDLE_FILE_INFORMATION,
+    *LPBY_HANDLE_FILE_INFORMATION;
+
+typedef struct _WIN32_FIND_DATAW {
+  DWORD dwFileAttributes;
+  FILETIME ftCreationTime;
+  FILETIME ftLastAccessTime;
+  FILETIME ftLastWriteTime;
+  DWORD nFileSizeHigh;
+  DWORD nFileSizeLow;
+  DWORD dwReserved0;
+  DWORD dwReserved1;
+  WCHAR cFileName[MAX_PATH];
+  WCHAR cAlternateFileName[14];
+} WIN32_FIND_DATAW, *PWIN32_FIND_DATAW, *LPWIN32_FIND_DATAW;
+
+typedef struct _WIN32_FIND_STREAM_DATA {
+  LARGE_INTEGER StreamSize;
+  WCHAR cStreamName[MAX_PATH + 36];
+} WIN32_FIND_STREAM_DATA, *PWIN32_FIND_STREAM_DATA;
+
+typedef struct _SECURITY_ATTRIBUTES {
+  DWORD nLength;
+  LPVOID lpSecurityDescriptor;
+  BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES, *PSECURITY_ATTRIBUTES, *LPSECURITY_ATTRIBUTES;
+
+typedef struct _OVERLAPPED {
+  ULONG_PTR Internal;
+  ULONG_PTR InternalHigh;
+  union {
+    struct {
+      DWORD Offset;
+      DWORD OffsetHigh;
+    };
+    PVOID Pointer;
+  };
+  HANDLE hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef ULONG_PTR KAFFINITY;
+typedef struct _GROUP_AFFINITY {
+  KAFFINITY Mask;
+  WORD Group;
+  WORD Reserved[3];
+} GROUP_AFFINITY, *PGROUP_AFFINITY;
+
+typedef struct _SYSTEM_INFO {
+  DWORD dwOemId;
+  DWORD dwPageSize;
+  LPVOID lpMinimumApplicationAddress;
+  LPVOID lpMaximumApplicationAddress;
+  DWORD_PTR dwActiveProcessorMask;
+  DWORD dwNumberOfProcessors;
+  DWORD dwProcessorType;
+  DWORD dwAllocationGranularity;
+  WORD wProcessorLevel;
+  WORD wProcessorRevision;
+} SYSTEM_INFO, *LPSYSTEM_INFO;
+
+typedef struct _SID_AND_ATTRIBUTES {
+  PSID Sid;
+  DWORD Attributes;
+} SID_AND_ATTRIBUTES;
+
+typedef struct _TOKEN_USER {
+  SID_AND_ATTRIBUTES User;
+} TOKEN_USER, *PTOKEN_USER;
+
+typedef struct _TOKEN_GROUPS {
+  DWORD GroupCount;
+  SID_AND_ATTRIBUTES Groups[ANYSIZE_ARRAY];
+} TOKEN_GROUPS, *PTOKEN_GROUPS;
+
+typedef enum _TOKEN_INFORMATION_CLASS {
+  TokenUser = 1,
+  TokenGroups
+} TOKEN_INFORMATION_CLASS;
+
+// Last error of the thread, one for every file including this one
+
+__attribute__((weak)) __thread DWORD ShimLastError;
+
+static inline DWORD GetLastError(void) { return ShimLastError; }
+static inline void SetLastError(DWORD Error) { ShimLastError = Error; }
+
+// Memory
+
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define ZeroMemory RtlZeroMemory
+#define RtlCopyMemory(Destination, Source, Length)                             \
+  memcpy((Destination), (Source), (Length))
+#define CopyMemory RtlCopyMemory
+#define RtlMoveMemory(Destination, Source, Length)                             \
+  memmove((Destination), (Source), (Length))
+#define MoveMemory RtlMoveMemory
+#define RtlFillMemory(Destination, Length, Fill)                               \
+  memset((Destination), (Fill), (Length))
+#define FillMemory RtlFillMemory
+
+static inline void *_aligned_malloc(size_t Size, size_t Alignment) {
+  void *memory;
+
+  if (posix_memalign(&memory, Alignment < sizeof(void *) ? sizeof(void *)
+                                                         : Alignment,
+                     Size) != 0)
+    return NULL;
+  return memory;
+}
+static inline void _aligned_free(void *Memory) { free(Memory); }
+static inline void *LocalFree(void *Memory) {
+  free(Memory);
+  return NULL;
+}
+#define _malloca(Size) malloc(Size)
+#define _freea(Memory) free(Memory)
+
+// Interlocked operations, full barriers as on Windows
+
+#define MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor() ((void)0)
+
+static inline LONG InterlockedIncrement(LONG volatile *Addend) {
+  return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+static inline LONG InterlockedDecrement(LONG volatile *Addend) {
+  return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+static inline LONG InterlockedExchange(LONG volatile *Target, LONG Value) {
+  return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG InterlockedExchangeAdd(LONG volatile *Addend, LONG Value) {
+  return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG InterlockedAdd(LONG volatile *Addend, LONG Value) {
+  return __atomic_add_fetch(Addend, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG InterlockedCompareExchange(LONG volatile *Destination,
+                                              LONG Exchange, LONG Comperand) {
+  __atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return Comperand;
+}
+static inline LONG64 InterlockedIncrement64(LONG64 volatile *Addend) {
+  return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+static inline LONG64 InterlockedDecrement64(LONG64 volatile *Addend) {
+  return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+static inline LONG64 InterlockedExchange64(LONG64 volatile *Target,
+                                           LONG64 Value) {
+  return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG64 InterlockedExchangeAdd64(LONG64 volatile *Addend,
+                                              LONG64 Value) {
+  return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG64 InterlockedAdd64(LONG64 volatile *Addend, LONG64 Value) {
+  return __atomic_add_fetch(Addend, Value, __ATOMIC_SEQ_CST);
+}
+static inline LONG64 InterlockedCompareExchange64(LONG64 volatile *Destination,
+                                                  LONG64 Exchange,
+                                                  LONG64 Comperand) {
+  __atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return Comperand;
+}
+static inline PVOID InterlockedExchangePointer(PVOID volatile *Target,
+                                               PVOID Value) {
+  return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+static inline PVOID InterlockedCompareExchangePointer(
+    PVOID volatile *Destination, PVOID Exchange, PVOID Comperand) {
+  __atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return Comperand;
+}
+
+// Singly linked lists, under a spin lock instead of a double width
+// compare-exchange
+
+typedef struct _SLIST_ENTRY {
+  struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+  PSLIST_ENTRY Next;
+  USHORT Depth;
+  volatile LONG Lock;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+static inline void ShimSListLock(PSLIST_HEADER ListHead) {
+  while (__atomic_exchange_n(&ListHead->Lock, 1, __ATOMIC_ACQUIRE) != 0)
+    sched_yield();
+}
+static inline void ShimSListUnlock(PSLIST_HEADER ListHead) {
+  __atomic_store_n(&ListHead->Lock, 0, __ATOMIC_RELEASE);
+}
+static inline void InitializeSListHead(PSLIST_HEADER ListHead) {
+  memset(ListHead, 0, sizeof(SLIST_HEADER));
+}
+static inline PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER ListHead,
+                                                     PSLIST_ENTRY ListEntry) {
+  PSLIST_ENTRY first;
+
+  ShimSListLock(ListHead);
+  first = ListHead->Next;
+  ListEntry->Next = first;
+  ListHead->Next = ListEntry;
+  ++ListHead->Depth;
+  ShimSListUnlock(ListHead);
+  return first;
+}
+static inline PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER ListHead) {
+  PSLIST_ENTRY first;
+
+  ShimSListLock(ListHead);
+  first = ListHead->Next;
+  if (first != NULL) {
+    ListHead->Next = first->Next;
+    --ListHead->Depth;
+  }
+  ShimSListUnlock(ListHead);
+  return first;
+}
+static inline PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER ListHead) {
+  PSLIST_ENTRY first;
+
+  ShimSListLock(ListHead);
+  first = ListHead->Next;
+  ListHead->Next = NULL;
+  ListHead->Depth = 0;
+  ShimSListUnlock(ListHead);
+  return first;
+}
+static inline USHORT QueryDepthSList(PSLIST_HEADER ListHead) {
+  return __atomic_load_n(&ListHead->Depth, __ATOMIC_RELAXED);
+}
+
+// Locks
+
+typedef pthread_mutex_t CRITICAL_SECTION, *PCRITICAL_SECTION,
+    *LPCRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(LPCRITICAL_SECTION Section) {
+  pthread_mutexattr_t attributes;
+
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(Section, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+}
+static inline BOOL
+InitializeCriticalSectionAndSpinCount(LPCRITICAL_SECTION Section,
+                                      DWORD SpinCount) {
+  (void)SpinCount;
+  InitializeCriticalSection(Section);
+  return TRUE;
+}
+static inline void DeleteCriticalSection(LPCRITICAL_SECTION Section) {
+  pthread_mutex_destroy(Section);
+}
+static inline void EnterCriticalSection(LPCRITICAL_SECTION Section) {
+  pthread_mutex_lock(Section);
+}
+static inline void LeaveCriticalSection(LPCRITICAL_SECTION Section) {
+  pthread_mutex_unlock(Section);
+}
+
+typedef pthread_rwlock_t SRWLOCK, *PSRWLOCK;
+
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+
+static inline void InitializeSRWLock(PSRWLOCK Lock) {
+  pthread_rwlock_init(Lock, NULL);
+}
+static inline void AcquireSRWLockExclusive(PSRWLOCK Lock) {
+  pthread_rwlock_wrlock(Lock);
+}
+static inline void ReleaseSRWLockExclusive(PSRWLOCK Lock) {
+  pthread_rwlock_unlock(Lock);
+}
+static inline void AcquireSRWLockShared(PSRWLOCK Lock) {
+  pthread_rwlock_rdlock(Lock);
+}
+static inline void ReleaseSRWLockShared(PSRWLOCK Lock) {
+  pthread_rwlock_unlock(Lock);
+}
+
+// Events, threads and files share the handle type, CloseHandle tells them
+// apart
+
+#define SHIM_HANDLE_EVENT 1
+#define SHIM_HANDLE_THREAD 2
+#define SHIM_HANDLE_FILE 3
+
+typedef struct _SHIM_HANDLE {
+  int Type;
+  pthread_mutex_t Mutex;
+  pthread_cond_t Condition;
+  // Event
+  BOOL ManualReset;
+  BOOL Signaled;
+  // Thread, signaled once it has exited
+  pthread_t Thread;
+  unsigned(__stdcall *StartAddress)(void *);
+  void *ArgList;
+  BOOL Detached;
+  // File
+  int Descriptor;
+} SHIM_HANDLE, *PSHIM_HANDLE;
+
+static inline PSHIM_HANDLE ShimNewHandle(int Type) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)calloc(1, sizeof(SHIM_HANDLE));
+
+  if (handle == NULL) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return NULL;
+  }
+  handle->Type = Type;
+  pthread_mutex_init(&handle->Mutex, NULL);
+  pthread_cond_init(&handle->Condition, NULL);
+  return handle;
+}
+
+static inline void ShimFreeHandle(PSHIM_HANDLE Handle) {
+  pthread_cond_destroy(&Handle->Condition);
+  pthread_mutex_destroy(&Handle->Mutex);
+  free(Handle);
+}
+
+static inline HANDLE CreateEventW(LPSECURITY_ATTRIBUTES Attributes,
+                                  BOOL ManualReset, BOOL InitialState,
+                                  LPCWSTR Name) {
+  PSHIM_HANDLE handle;
+
+  (void)Attributes;
+  if (Name != NULL) {
+    SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+    return NULL;
+  }
+  handle = ShimNewHandle(SHIM_HANDLE_EVENT);
+  if (handle != NULL) {
+    handle->ManualReset = ManualReset;
+    handle->Signaled = InitialState;
+  }
+  return handle;
+}
+#define CreateEvent CreateEventW
+
+static inline BOOL SetEvent(HANDLE Event) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)Event;
+
+  pthread_mutex_lock(&handle->Mutex);
+  handle->Signaled = TRUE;
+  pthread_cond_broadcast(&handle->Condition);
+  pthread_mutex_unlock(&handle->Mutex);
+  return TRUE;
+}
+
+static inline BOOL ResetEvent(HANDLE Event) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)Event;
+
+  pthread_mutex_lock(&handle->Mutex);
+  handle->Signaled = FALSE;
+  pthread_mutex_unlock(&handle->Mutex);
+  return TRUE;
+}
+
+static inline DWORD WaitForSingleObject(HANDLE Object, DWORD Milliseconds) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)Object;
+  struct timespec deadline;
+  DWORD result = WAIT_OBJECT_0;
+
+  if (Milliseconds != INFINITE) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += Milliseconds / 1000;
+    deadline.tv_nsec += (long)(Milliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      ++deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+  pthread_mutex_lock(&handle->Mutex);
+  while (!handle->Signaled) {
+    if (Milliseconds == INFINITE) {
+      pthread_cond_wait(&handle->Condition, &handle->Mutex);
+    } else if (pthread_cond_timedwait(&handle->Condition, &handle->Mutex,
+                                      &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  if (!handle->Signaled)
+    result = WAIT_TIMEOUT;
+  else if (handle->Type == SHIM_HANDLE_EVENT && !handle->ManualReset)
+    handle->Signaled = FALSE;
+  pthread_mutex_unlock(&handle->Mutex);
+  return result;
+}
+
+static inline void *ShimThreadStart(void *Parameter) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)Parameter;
+  BOOL detached;
+
+  handle->StartAddress(handle->ArgList);
+  pthread_mutex_lock(&handle->Mutex);
+  handle->Signaled = TRUE;
+  detached = handle->Detached;
+  pthread_cond_broadcast(&handle->Condition);
+  pthread_mutex_unlock(&handle->Mutex);
+  if (detached)
+    ShimFreeHandle(handle);
+  return NULL;
+}
+
+// Of <process.h>, only the thread return value is not kept
+static inline uintptr_t
+_beginthreadex(void *Security, unsigned StackSize,
+               unsigned(__stdcall *StartAddress)(void *), void *ArgList,
+               unsigned InitFlag, unsigned *ThreadAddress) {
+  PSHIM_HANDLE handle;
+
+  (void)Security;
+  (void)StackSize;
+  (void)InitFlag;
+  (void)ThreadAddress;
+  handle = ShimNewHandle(SHIM_HANDLE_THREAD);
+  if (handle == NULL)
+    return 0;
+  handle->StartAddress = StartAddress;
+  handle->ArgList = ArgList;
+  if (pthread_create(&handle->Thread, NULL, ShimThreadStart, handle) != 0) {
+    ShimFreeHandle(handle);
+    errno = EAGAIN;
+    return 0;
+  }
+  return (uintptr_t)handle;
+}
+
+// Threads return from their start routine right after calling it
+static inline void _endthreadex(unsigned ReturnCode) { (void)ReturnCode; }
+
+static inline BOOL CloseHandle(HANDLE Object) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)Object;
+  BOOL exited;
+
+  if (handle == NULL || Object == INVALID_HANDLE_VALUE)
+    return FALSE;
+  if (handle->Type == SHIM_HANDLE_THREAD) {
+    pthread_mutex_lock(&handle->Mutex);
+    exited = handle->Signaled;
+    handle->Detached = !exited;
+    pthread_mutex_unlock(&handle->Mutex);
+    pthread_detach(handle->Thread);
+    if (!exited)
+      return TRUE;
+  } else if (handle->Type == SHIM_HANDLE_FILE) {
+    close(handle->Descriptor);
+  }
+  ShimFreeHandle(handle);
+  return TRUE;
+}
+
+// Time
+
+static inline ULONGLONG GetTickCount64(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (ULONGLONG)now.tv_sec * 1000 + (ULONGLONG)now.tv_nsec / 1000000;
+}
+
+static inline BOOL QueryPerformanceCounter(PLARGE_INTEGER Count) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  Count->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+  return TRUE;
+}
+
+static inline BOOL QueryPerformanceFrequency(PLARGE_INTEGER Frequency) {
+  Frequency->QuadPart = 1000000000;
+  return TRUE;
+}
+
+// 100 nanoseconds since 1601
+static inline void GetSystemTimeAsFileTime(LPFILETIME Time) {
+  struct timespec now;
+  ULONGLONG value;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  value = ((ULONGLONG)now.tv_sec + 11644473600ULL) * 10000000 +
+          (ULONGLONG)now.tv_nsec / 100;
+  Time->dwLowDateTime = (DWORD)value;
+  Time->dwHighDateTime = (DWORD)(value >> 32);
+}
+
+static inline void Sleep(DWORD Milliseconds) {
+  struct timespec duration;
+
+  duration.tv_sec = Milliseconds / 1000;
+  duration.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+  nanosleep(&duration, NULL);
+}
+
+static inline BOOL SwitchToThread(void) { return sched_yield() == 0; }
+
+static inline DWORD GetCurrentThreadId(void) {
+  return (DWORD)(uintptr_t)pthread_self();
+}
+static inline DWORD GetCurrentProcessId(void) { return (DWORD)getpid(); }
+static inline HANDLE GetCurrentProcess(void) { return (HANDLE)(LONG_PTR)-1; }
+
+static inline void GetSystemInfo(LPSYSTEM_INFO SystemInfo) {
+  memset(SystemInfo, 0, sizeof(SYSTEM_INFO));
+  SystemInfo->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+  SystemInfo->dwNumberOfProcessors = (DWORD)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Strings
+
+static inline int _wcsicmp(const wchar_t *String1, const wchar_t *String2) {
+  return wcscasecmp(String1, String2);
+}
+static inline int _wcsnicmp(const wchar_t *String1, const wchar_t *String2,
+                            size_t Count) {
+  return wcsncasecmp(String1, String2, Count);
+}
+static inline int _stricmp(const char *String1, const char *String2) {
+  return strcasecmp(String1, String2);
+}
+
+static inline int wcscpy_s(wchar_t *Destination, size_t Size,
+                           const wchar_t *Source) {
+  size_t length = wcslen(Source);
+
+  if (Destination == NULL || Size == 0)
+    return EINVAL;
+  if (length >= Size) {
+    Destination[0] = L'\0';
+    return ERANGE;
+  }
+  wmemcpy(Destination, Source, length + 1);
+  return 0;
+}
+
+static inline int wcscat_s(wchar_t *Destination, size_t Size,
+                           const wchar_t *Source) {
+  size_t length;
+
+  if (Destination == NULL || Size == 0)
+    return EINVAL;
+  length = wcsnlen(Destination, Size);
+  if (length == Size)
+    return EINVAL;
+  return wcscpy_s(Destination + length, Size - length, Source);
+}
+
+#define _TRUNCATE ((size_t)-1)
+#define STRUNCATE 80
+
+static inline int wcsncpy_s(wchar_t *Destination, size_t Size,
+                            const wchar_t *Source, size_t Count) {
+  size_t length = wcsnlen(Source, Count);
+
+  if (Destination == NULL || Size == 0)
+    return EINVAL;
+  if (length >= Size) {
+    if (Count == _TRUNCATE) {
+      wmemcpy(Destination, Source, Size - 1);
+      Destination[Size - 1] = L'\0';
+      return STRUNCATE;
+    }
+    Destination[0] = L'\0';
+    return ERANGE;
+  }
+  wmemcpy(Destination, Source, length);
+  Destination[length] = L'\0';
+  return 0;
+}
+
+static inline int swprintf_s(wchar_t *Buffer, size_t Size,
+                             const wchar_t *Format, ...) {
+  va_list arguments;
+  int length;
+
+  va_start(arguments, Format);
+  length = vswprintf(Buffer, Size, Format, arguments);
+  va_end(arguments);
+  return length;
+}
+
+#define CP_ACP 0
+#define CP_UTF8 65001
+
+// Converts with the locale of the C runtime whatever the code page
+static inline int MultiByteToWideChar(UINT CodePage, DWORD Flags,
+                                      LPCSTR MultiByteString, int MultiByteSize,
+                                      LPWSTR WideString, int WideSize) {
+  size_t length;
+
+  (void)CodePage;
+  (void)Flags;
+  (void)MultiByteSize;
+  length = mbstowcs(NULL, MultiByteString, 0);
+  if (length == (size_t)-1) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return 0;
+  }
+  if (WideString == NULL)
+    return (int)length + 1;
+  if ((size_t)WideSize <= length) {
+    SetLastError(ERROR_INSUFFICIENT_BUFFER);
+    return 0;
+  }
+  mbstowcs(WideString, MultiByteString, length + 1);
+  return (int)length + 1;
+}
+
+static inline DWORD CharUpperBuffW(LPWSTR String, DWORD Length) {
+  DWORD i;
+
+  for (i = 0; i < Length; ++i)
+    String[i] = (WCHAR)towupper(String[i]);
+  return Length;
+}
+
+// The formats of the debug output are the ones of Windows, which only matters
+// with the debug output on
+static inline int _vscprintf(const char *Format, va_list Arguments) {
+  va_list copy;
+  int length;
+
+  va_copy(copy, Arguments);
+  length = vsnprintf(NULL, 0, Format, copy);
+  va_end(copy);
+  return length;
+}
+static inline int vsprintf_s(char *Buffer, size_t Size, const char *Format,
+                             va_list Arguments) {
+  return vsnprintf(Buffer, Size, Format, Arguments);
+}
+static inline int _vscwprintf(const wchar_t *Format, va_list Arguments) {
+  (void)Format;
+  (void)Arguments;
+  return 1024;
+}
+static inline int vswprintf_s(wchar_t *Buffer, size_t Size,
+                              const wchar_t *Format, va_list Arguments) {
+  return vswprintf(Buffer, Size, Format, Arguments);
+}
+static inline void OutputDebugStringA(LPCSTR String) {
+  fputs(String, stderr);
+}
+static inline void OutputDebugStringW(LPCWSTR String) {
+  fputws(String, stderr);
+}
+
+// Calls that need Windows
+
+static inline BOOL OpenProcessToken(HANDLE Process, DWORD DesiredAccess,
+                                    PHANDLE Token) {
+  (void)Process;
+  (void)DesiredAccess;
+  *Token = NULL;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+static inline BOOL GetTokenInformation(HANDLE Token,
+                                       TOKEN_INFORMATION_CLASS Class,
+                                       LPVOID Information, DWORD Length,
+                                       PDWORD ReturnLength) {
+  (void)Token;
+  (void)Class;
+  (void)Information;
+  (void)Length;
+  *ReturnLength = 0;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+static inline DWORD GetSecurityDescriptorLength(PSECURITY_DESCRIPTOR
+                                                    Descriptor) {
+  (void)Descriptor;
+  return 0;
+}
+
+static inline DWORD GetTempPathW(DWORD Length, LPWSTR Buffer) {
+  (void)Length;
+  (void)Buffer;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return 0;
+}
+
+static inline DWORD ShimErrorFromErrno(int Error) {
+  switch (Error) {
+  case ENOENT:
+    return ERROR_FILE_NOT_FOUND;
+  case ENOTDIR:
+    return ERROR_PATH_NOT_FOUND;
+  case EACCES:
+  case EPERM:
+    return ERROR_ACCESS_DENIED;
+  case EEXIST:
+    return ERROR_FILE_EXISTS;
+  case EMFILE:
+    return ERROR_TOO_MANY_OPEN_FILES;
+  case ENOSPC:
+    return ERROR_DISK_FULL;
+  case EINVAL:
+    return ERROR_INVALID_PARAMETER;
+  default:
+    return ERROR_GEN_FAILURE;
+  }
+}
+
+// Only the access and the disposition are used, files are opened without
+// sharing restrictions
+static inline HANDLE CreateFileW(LPCWSTR FileName, DWORD DesiredAccess,
+                                 DWORD ShareMode,
+                                 LPSECURITY_ATTRIBUTES Attributes,
+                                 DWORD CreationDisposition,
+                                 DWORD FlagsAndAttributes, HANDLE Template) {
+  char name[PATH_MAX];
+  PSHIM_HANDLE handle;
+  int flags;
+
+  (void)ShareMode;
+  (void)Attributes;
+  (void)FlagsAndAttributes;
+  (void)Template;
+  if (wcstombs(name, FileName, sizeof(name)) >= sizeof(name)) {
+    SetLastError(ERROR_FILENAME_EXCED_RANGE);
+    return INVALID_HANDLE_VALUE;
+  }
+  if ((DesiredAccess & GENERIC_READ) && (DesiredAccess & GENERIC_WRITE))
+    flags = O_RDWR;
+  else if (DesiredAccess & GENERIC_WRITE)
+    flags = O_WRONLY;
+  else
+    flags = O_RDONLY;
+  switch (CreationDisposition) {
+  case CREATE_NEW:
+    flags |= O_CREAT | O_EXCL;
+    break;
+  case CREATE_ALWAYS:
+    flags |= O_CREAT | O_TRUNC;
+    break;
+  case OPEN_ALWAYS:
+    flags |= O_CREAT;
+    break;
+  case TRUNCATE_EXISTING:
+    flags |= O_TRUNC;
+    break;
+  default:
+    break;
+  }
+  handle = ShimNewHandle(SHIM_HANDLE_FILE);
+  if (handle == NULL)
+    return INVALID_HANDLE_VALUE;
+  handle->Descriptor = open(name, flags, 0666);
+  if (handle->Descriptor < 0) {
+    SetLastError(ShimErrorFromErrno(errno));
+    ShimFreeHandle(handle);
+    return INVALID_HANDLE_VALUE;
+  }
+  return handle;
+}
+#define CreateFile CreateFileW
+static inline DWORD SetFilePointer(HANDLE File, LONG DistanceToMove,
+                                   PLONG DistanceToMoveHigh,
+                                   DWORD MoveMethod) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)File;
+  off_t offset = DistanceToMove;
+  off_t position;
+  int whence;
+
+  if (DistanceToMoveHigh != NULL)
+    offset = (off_t)(((uint64_t)(uint32_t)*DistanceToMoveHigh << 32) |
+                     (uint32_t)DistanceToMove);
+  whence = MoveMethod == FILE_END
+               ? SEEK_END
+               : MoveMethod == FILE_CURRENT ? SEEK_CUR : SEEK_SET;
+  position = lseek(handle->Descriptor, offset, whence);
+  if (position < 0) {
+    SetLastError(ShimErrorFromErrno(errno));
+    return INVALID_SET_FILE_POINTER;
+  }
+  if (DistanceToMoveHigh != NULL)
+    *DistanceToMoveHigh = (LONG)((uint64_t)position >> 32);
+  SetLastError(NO_ERROR);
+  return (DWORD)position;
+}
+static inline BOOL WriteFile(HANDLE File, LPCVOID Buffer, DWORD Length,
+                             LPDWORD Written, LPOVERLAPPED Overlapped) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)File;
+  const char *data = (const char *)Buffer;
+  ssize_t count;
+
+  (void)Overlapped;
+  *Written = 0;
+  while (*Written < Length) {
+    count = write(handle->Descriptor, data + *Written, Length - *Written);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      SetLastError(ShimErrorFromErrno(errno));
+      return FALSE;
+    }
+    *Written += (DWORD)count;
+  }
+  return TRUE;
+}
+static inline BOOL ReadFile(HANDLE File, LPVOID Buffer, DWORD Length,
+                            LPDWORD Read, LPOVERLAPPED Overlapped) {
+  PSHIM_HANDLE handle = (PSHIM_HANDLE)File;
+  char *data = (char *)Buffer;
+  ssize_t count;
+
+  (void)Overlapped;
+  *Read = 0;
+  while (*Read < Length) {
+    count = read(handle->Descriptor, data + *Read, Length - *Read);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      SetLastError(ShimErrorFromErrno(errno));
+      return FALSE;
+    }
+    if (count == 0)
+      break;
+    *Read += (DWORD)count;
+  }
+  return TRUE;
+}
+
+typedef VOID(CALLBACK *WAITORTIMERCALLBACK)(PVOID, BOOLEAN);
+static inline BOOL RegisterWaitForSingleObject(PHANDLE WaitObject,
+                                               HANDLE Object,
+                                               WAITORTIMERCALLBACK Callback,
+                                               PVOID Context,
+                                               ULONG Milliseconds,
+                                               ULONG Flags) {
+  (void)Object;
+  (void)Callback;
+  (void)Context;
+  (void)Milliseconds;
+  (void)Flags;
+  *WaitObject = NULL;
+  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+  return FALSE;
+}
+static inline BOOL UnregisterWait(HANDLE WaitHandle) {
+  (void)WaitHandle;
+  return TRUE;
+}
+
+typedef DWORD(WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+typedef struct _SHIM_WORK_ITEM {
+  LPTHREAD_START_ROUTINE Function;
+  PVOID Context;
+} SHIM_WORK_ITEM, *PSHIM_WORK_ITEM;
+
+static inline void *ShimWorkItemStart(void *Parameter) {
+  SHIM_WORK_ITEM item = *(PSHIM_WORK_ITEM)Parameter;
+
+  free(Parameter);
+  item.Function(item.Context);
+  return NULL;
+}
+
+// Each work item runs on a thread of its own instead of a pool
+static inline BOOL QueueUserWorkItem(LPTHREAD_START_ROUTINE Function,
+                                     PVOID Context, ULONG Flags) {
+  PSHIM_WORK_ITEM item;
+  pthread_t thread;
+
+  (void)Flags;
+  item = (PSHIM_WORK_ITEM)malloc(sizeof(SHIM_WORK_ITEM));
+  if (item == NULL) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  item->Function = Function;
+  item->Context = Context;
+  if (pthread_create(&thread, NULL, ShimWorkItemStart, item) != 0) {
+    free(item);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  pthread_detach(thread);
+  return TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_WIN32_SHIM_WINDOWS_H_
@@ -0,0 +1,400 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the write gathering of dokan/writegather.c without a mounted volume:
+// sequential writes joined into one flush, flushes caused by writes elsewhere,
+// by a full buffer, by overlapping reads and by age, pass through of large
+// writes, reporting of failed flushes, then writes, reads and age flushes on
+// several threads.
+//
+// Build it with any C compiler:
+//   cl /O2 /I..\..\dokan writegather_test.c ..\..\dokan\writegather.c
+//   gcc -O2 -pthread -I../../dokan writegather_test.c
+//       ../../dokan/writegather.c -o writegather_test
+//
+// Prints the failed checks and exits with 1 if there are any.
+
+#include "writegather.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE THREAD;
+
+static DWORD WINAPI ThreadStart(LPVOID Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  *Thread = CreateThread(NULL, 0, ThreadStart, Parameter, 0, NULL);
+}
+static void JoinThread(THREAD Thread) {
+  WaitForSingleObject(Thread, INFINITE);
+  CloseHandle(Thread);
+}
+#define AtomicIncrement(Value) InterlockedIncrement(Value)
+#define AtomicRead(Value) InterlockedCompareExchange(Value, 0, 0)
+#else
+#include <pthread.h>
+
+typedef pthread_t THREAD;
+
+static void *ThreadStart(void *Parameter);
+static void StartThread(THREAD *Thread, void *Parameter) {
+  pthread_create(Thread, NULL, ThreadStart, Parameter);
+}
+static void JoinThread(THREAD Thread) { pthread_join(Thread, NULL); }
+#define AtomicIncrement(Value) __sync_add_and_fetch(Value, 1)
+#define AtomicRead(Value) __sync_add_and_fetch(Value, 0)
+#endif
+
+#define CAPACITY 256
+#define FILE_SIZE (64 * 1024)
+#define DISK_FULL 0x7F
+#define STRESS_THREADS 4
+#define STRESS_REGION (FILE_SIZE / STRESS_THREADS)
+
+// File the flushes write to, only touched under the lock of the gather
+typedef struct _TEST_FILE {
+  uint8_t Data[FILE_SIZE];
+  // Flushes made and the range of the last one
+  int Flushes;
+  uint64_t LastOffset;
+  uint32_t LastLength;
+  // Status of the next flush, which then writes nothing
+  int32_t Fail;
+} TEST_FILE;
+
+static PDOKAN_WRITE_GATHER g_Gather;
+static TEST_FILE g_File;
+static int g_Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    if (!(Condition)) {                                                        \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);    \
+      g_Failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static int32_t Flush(void *Context, uint64_t Offset, const void *Buffer,
+                     uint32_t Length) {
+  TEST_FILE *file = (TEST_FILE *)Context;
+  int32_t status = file->Fail;
+
+  file->Flushes++;
+  file->LastOffset = Offset;
+  file->LastLength = Length;
+  file->Fail = 0;
+  if (status != 0)
+    return status;
+  if (Offset > FILE_SIZE || Length > FILE_SIZE - Offset)
+    return DISK_FULL;
+  memcpy(file->Data + Offset, Buffer, Length);
+  return 0;
+}
+
+// Bytes whose value is their offset plus Seed
+static void MakeData(uint8_t *Data, uint64_t Offset, uint32_t Length,
+                     uint8_t Seed) {
+  uint32_t i;
+
+  for (i = 0; i < Length; ++i)
+    Data[i] = (uint8_t)(Offset + i + Seed);
+}
+
+static int32_t Write(uint64_t Offset, uint32_t Length, uint8_t Seed,
+                     uint64_t Now) {
+  uint8_t data[2 * CAPACITY];
+
+  MakeData(data, Offset, Length, Seed);
+  return DokanWriteGatherWrite(g_Gather, Offset, data, Length, Now, Flush,
+                               &g_File);
+}
+
+// Whether the file has the data of Seed in the range
+static int HasData(uint64_t Offset, uint32_t Length, uint8_t Seed) {
+  uint8_t expected[FILE_SIZE];
+
+  MakeData(expected, Offset, Length, Seed);
+  return memcmp(g_File.Data + Offset, expected, Length) == 0;
+}
+
+static void Reset(void) {
+  DokanWriteGatherFlush(g_Gather, Flush, &g_File);
+  memset(&g_File, 0, sizeof(g_File));
+}
+
+static void TestSequential(void) {
+  uint64_t since = 0;
+
+  Reset();
+  CHECK(Write(0, 10, 1, 5) == 0);
+  CHECK(Write(10, 20, 1, 6) == 0);
+  CHECK(Write(30, 2, 1, 7) == 0);
+  CHECK(g_File.Flushes == 0);
+  CHECK(DokanWriteGatherPending(g_Gather, &since) == 32);
+  CHECK(since == 5);
+
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 1);
+  CHECK(g_File.LastOffset == 0 && g_File.LastLength == 32);
+  CHECK(HasData(0, 32, 1));
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 0);
+
+  // Nothing left to write
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 1);
+}
+
+static void TestBreaks(void) {
+  Reset();
+  // A write elsewhere flushes the gathered data first, backwards included
+  CHECK(Write(100, 10, 2, 0) == 0);
+  CHECK(Write(200, 10, 2, 0) == 0);
+  CHECK(g_File.Flushes == 1);
+  CHECK(g_File.LastOffset == 100 && g_File.LastLength == 10);
+  CHECK(Write(190, 10, 2, 0) == 0);
+  CHECK(g_File.Flushes == 2);
+  CHECK(g_File.LastOffset == 200 && g_File.LastLength == 10);
+  CHECK(Write(190, 10, 3, 0) == 0);
+  CHECK(g_File.Flushes == 3);
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+  CHECK(HasData(190, 10, 3));
+  CHECK(HasData(200, 10, 2));
+
+  // The write that fills the buffer flushes it, the one that does not fit
+  // flushes before it is gathered
+  Reset();
+  CHECK(Write(0, CAPACITY - 16, 4, 0) == 0);
+  CHECK(Write(CAPACITY - 16, 16, 4, 0) == 0);
+  CHECK(g_File.Flushes == 1);
+  CHECK(g_File.LastLength == CAPACITY);
+  CHECK(Write(CAPACITY, CAPACITY - 8, 4, 0) == 0);
+  CHECK(Write(2 * CAPACITY - 8, 16, 4, 0) == 0);
+  CHECK(g_File.Flushes == 2);
+  CHECK(g_File.LastOffset == CAPACITY && g_File.LastLength == CAPACITY - 8);
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 16);
+
+  // Large writes go through after the gathered data
+  CHECK(Write(2 * CAPACITY + 8, CAPACITY, 4, 0) == 0);
+  CHECK(g_File.Flushes == 4);
+  CHECK(g_File.LastOffset == 2 * CAPACITY + 8);
+  CHECK(g_File.LastLength == CAPACITY);
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 0);
+  CHECK(HasData(0, 3 * CAPACITY + 8, 4));
+}
+
+static void TestRanges(void) {
+  Reset();
+  CHECK(Write(1000, 100, 5, 0) == 0);
+
+  // Ranges touching the gathered data without overlapping it
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 900, 100, Flush, &g_File) == 0);
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 1100, 100, Flush, &g_File) == 0);
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 1050, 0, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 0);
+
+  // Ranges starting before, inside and around it
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 900, 101, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 1);
+  CHECK(Write(1000, 100, 5, 0) == 0);
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 1099, 1, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 2);
+  CHECK(Write(1000, 100, 5, 0) == 0);
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 0, 4096, Flush, &g_File) == 0);
+  CHECK(g_File.Flushes == 3);
+  CHECK(HasData(1000, 100, 5));
+}
+
+static void TestAge(void) {
+  Reset();
+  CHECK(Write(0, 10, 6, 100) == 0);
+  CHECK(Write(10, 10, 6, 180) == 0);
+
+  // The age counts from the first write, a clock behind it flushes nothing
+  DokanWriteGatherFlushExpired(g_Gather, 150, 100, Flush, &g_File);
+  DokanWriteGatherFlushExpired(g_Gather, 50, 10, Flush, &g_File);
+  CHECK(g_File.Flushes == 0);
+  DokanWriteGatherFlushExpired(g_Gather, 200, 100, Flush, &g_File);
+  CHECK(g_File.Flushes == 1);
+  CHECK(g_File.LastLength == 20);
+
+  // The next gathered data starts its own age
+  CHECK(Write(20, 10, 6, 300) == 0);
+  DokanWriteGatherFlushExpired(g_Gather, 350, 100, Flush, &g_File);
+  CHECK(g_File.Flushes == 1);
+  DokanWriteGatherFlushExpired(g_Gather, 300, 0, Flush, &g_File);
+  CHECK(g_File.Flushes == 2);
+  CHECK(HasData(0, 30, 6));
+}
+
+static void TestErrors(void) {
+  Reset();
+  // A flush caused by a write fails the write
+  CHECK(Write(0, 10, 7, 0) == 0);
+  g_File.Fail = DISK_FULL;
+  CHECK(Write(100, 10, 7, 0) == DISK_FULL);
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 0);
+  CHECK(Write(100, 10, 7, 0) == 0);
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+
+  // A failed age flush is reported once by the next write, which is dropped
+  CHECK(Write(200, 10, 7, 0) == 0);
+  g_File.Fail = DISK_FULL;
+  DokanWriteGatherFlushExpired(g_Gather, 0, 0, Flush, &g_File);
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 0);
+  CHECK(Write(210, 10, 7, 0) == DISK_FULL);
+  CHECK(DokanWriteGatherPending(g_Gather, NULL) == 0);
+  CHECK(Write(210, 10, 7, 0) == 0);
+
+  // or by the next flush, whatever its range. Failed flushes lose their data.
+  g_File.Fail = DISK_FULL;
+  DokanWriteGatherFlushExpired(g_Gather, 0, 0, Flush, &g_File);
+  CHECK(DokanWriteGatherFlushRange(g_Gather, 5000, 1, Flush, &g_File) ==
+        DISK_FULL);
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+  CHECK(HasData(100, 10, 7));
+  CHECK(!HasData(200, 10, 7));
+  CHECK(!HasData(210, 10, 7));
+}
+
+typedef struct _THREAD_CONTEXT {
+  unsigned Seed;
+  // Region written by the thread, the age thread when Length is 0
+  uint64_t Offset;
+  uint32_t Length;
+  volatile long *Errors;
+  volatile long *Running;
+} THREAD_CONTEXT;
+
+static unsigned NextRandom(unsigned *Seed) {
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) & 0xFFFFFF;
+}
+
+// Writers share the gather of one handle, each one sequentially through its
+// own region in random sizes, reading its last writes back now and then
+static void RunWriter(THREAD_CONTEXT *Context) {
+  uint8_t data[2 * CAPACITY];
+  uint64_t offset = Context->Offset;
+  uint64_t end = Context->Offset + Context->Length;
+  uint32_t length;
+
+  while (offset < end) {
+    length = NextRandom(&Context->Seed) % (CAPACITY + CAPACITY / 2) + 1;
+    if (length > end - offset)
+      length = (uint32_t)(end - offset);
+    MakeData(data, offset, length, 8);
+    if (DokanWriteGatherWrite(g_Gather, offset, data, length, 0, Flush,
+                              &g_File) != 0)
+      AtomicIncrement(Context->Errors);
+    if (NextRandom(&Context->Seed) % 8 == 0 &&
+        DokanWriteGatherFlushRange(g_Gather, offset, length, Flush,
+                                   &g_File) != 0)
+      AtomicIncrement(Context->Errors);
+    offset += length;
+  }
+}
+
+static void RunAger(THREAD_CONTEXT *Context) {
+  uint64_t now = 0;
+
+  while (AtomicRead(Context->Running) == 1) {
+    DokanWriteGatherFlushExpired(g_Gather, ++now, 0, Flush, &g_File);
+    DokanWriteGatherPending(g_Gather, NULL);
+  }
+}
+
+static void RunThread(THREAD_CONTEXT *Context) {
+  if (Context->Length != 0)
+    RunWriter(Context);
+  else
+    RunAger(Context);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadStart(LPVOID Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return 0;
+}
+#else
+static void *ThreadStart(void *Parameter) {
+  RunThread((THREAD_CONTEXT *)Parameter);
+  return NULL;
+}
+#endif
+
+static void TestStress(void) {
+  THREAD threads[STRESS_THREADS + 1];
+  THREAD_CONTEXT contexts[STRESS_THREADS + 1];
+  volatile long errors = 0;
+  volatile long running = 1;
+  int i;
+
+  Reset();
+  for (i = 0; i <= STRESS_THREADS; ++i) {
+    contexts[i].Seed = 3000 + i;
+    contexts[i].Offset = (uint64_t)i * STRESS_REGION;
+    contexts[i].Length = i < STRESS_THREADS ? STRESS_REGION : 0;
+    contexts[i].Errors = &errors;
+    contexts[i].Running = &running;
+    StartThread(&threads[i], &contexts[i]);
+  }
+  for (i = 0; i < STRESS_THREADS; ++i) {
+    JoinThread(threads[i]);
+  }
+  AtomicIncrement(&running);
+  JoinThread(threads[STRESS_THREADS]);
+
+  CHECK(errors == 0);
+  CHECK(DokanWriteGatherFlush(g_Gather, Flush, &g_File) == 0);
+  CHECK(HasData(0, FILE_SIZE, 8));
+  printf("%d flushes for %d bytes\n", g_File.Flushes, FILE_SIZE);
+}
+
+int main(void) {
+  g_Gather = DokanWriteGatherCreate(CAPACITY);
+  CHECK(g_Gather != NULL);
+  CHECK(DokanWriteGatherCreate(0) == NULL);
+  if (g_Gather == NULL) {
+    return 1;
+  }
+
+  TestSequential();
+  TestBreaks();
+  TestRanges();
+  TestAge();
+  TestErrors();
+  TestStress();
+
+  // Data not flushed is dropped with the gather
+  CHECK(Write(0, 10, 9, 0) == 0);
+  DokanWriteGatherDelete(g_Gather);
+
+  if (g_Failures != 0) {
+    printf("%d checks failed\n", g_Failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
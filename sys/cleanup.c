@@ -50,6 +50,7 @@ Return Value:
   PDokanFCB fcb = NULL;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  ULONG fileNameLength;
   DOKAN_INIT_LOGGER(logger, DeviceObject->DriverObject, IRP_MJ_CLEANUP);
 
   __try {
@@ -119,7 +120,8 @@ Return Value:
 
     DokanFCBLockRW(fcb);
 
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength;
     eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
 
     if (eventContext == NULL) {
@@ -135,9 +137,9 @@ Return Value:
     // DDbgPrint("   get Context %X\n", (ULONG)ccb->UserContext);
 
     // copy the filename to EventContext from ccb
-    eventContext->Operation.Cleanup.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Cleanup.FileName,
-                  fcb->FileName.Buffer, fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.Cleanup.FileNameLength,
+                           eventContext->Operation.Cleanup.FileName);
 
     // FsRtlCheckOpLock is called with non-NULL completion routine - not blocking.
     status = DokanCheckOplock(fcb, Irp, eventContext, DokanOplockComplete,
@@ -49,6 +49,7 @@ Return Value:
   PDokanCCB ccb;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  ULONG fileNameLength;
   PDokanFCB fcb;
   DOKAN_INIT_LOGGER(logger, DeviceObject->DriverObject, IRP_MJ_CLOSE);
 
@@ -117,7 +118,8 @@ Return Value:
       __leave;
     }
 
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength;
     eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
 
     if (eventContext == NULL) {
@@ -135,9 +137,9 @@ Return Value:
     DDbgPrint("   UserContext:%X\n", (ULONG)ccb->UserContext);
 
     // copy the file name to be closed
-    eventContext->Operation.Close.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Close.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.Close.FileNameLength,
+                           eventContext->Operation.Close.FileName);
 
     DDbgPrint("   Free CCB:%p\n", ccb);
     DokanFreeCCB(ccb);
@@ -150,6 +152,8 @@ Return Value:
     // eventContext->SerialNumber, 0);
 
     // inform it to user-mode
+    InterlockedIncrement64(
+        (LONG64 *)&vcb->Dcb->Metrics.DispatchCount[IRP_MJ_CLOSE]);
     DokanEventNotification(&vcb->Dcb->NotifyEvent, eventContext);
 
     status = STATUS_SUCCESS;
@@ -82,6 +82,10 @@ PDokanFCB DokanAllocateFCB(__in PDokanVCB Vcb, __in PWCHAR FileName,
   fcb->FileName.Buffer = FileName;
   fcb->FileName.Length = (USHORT)FileNameLength;
   fcb->FileName.MaximumLength = (USHORT)FileNameLength;
+  fcb->NameGeneration = 1;
+
+  KeInitializeSpinLock(&fcb->AttributesLock);
+  DokanSetNotifyBucket(fcb);
 
   InitializeListHead(&fcb->NextCCB);
   InsertTailList(&Vcb->NextFCB, &fcb->NextFCB);
@@ -183,6 +187,9 @@ DokanFreeFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb) {
     Fcb->FileName.Length = 0;
     Fcb->FileName.MaximumLength = 0;
 
+    DokanReleaseCachedSecurityDescriptor(Fcb->SecurityDescriptor);
+    Fcb->SecurityDescriptor = NULL;
+
     FsRtlUninitializeOplock(DokanGetFcbOplock(Fcb));
 
     FsRtlTeardownPerStreamContexts(&Fcb->AdvancedFCBHeader);
@@ -277,6 +284,7 @@ DokanFreeCCB(__in PDokanCCB ccb) {
   if (ccb->SearchPattern) {
     ExFreePool(ccb->SearchPattern);
   }
+  DokanFreeDirectoryPage(ccb);
 
   ExFreeToLookasideListEx(&g_DokanCCBLookasideList, ccb);
   InterlockedIncrement(&fcb->Vcb->CcbFreed);
@@ -1053,6 +1061,8 @@ Return Value:
     // other context info
     eventContext->Context = 0;
     eventContext->FileFlags |= DokanFCBFlagsGet(fcb);
+    // The name of the target of a rename is not the name of the parent FCB
+    eventContext->NameGeneration = parentDir ? 0 : fcb->NameGeneration;
 
     // copy the file name
 
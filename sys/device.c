@@ -1017,6 +1017,14 @@ Return Value:
     case IOCTL_GET_ACCESS_TOKEN:
       status = DokanGetAccessToken(DeviceObject, Irp);
       break;
+
+    case IOCTL_GET_VOLUME_METRICS:
+      status = DokanGetVolumeMetrics(DeviceObject, Irp);
+      break;
+
+    case IOCTL_SET_VOLUME_INFORMATION:
+      status = DokanSetVolumeInformationCache(DeviceObject, Irp);
+      break;
     default: {
       ULONG baseCode = DEVICE_TYPE_FROM_CTL_CODE(
           irpSp->Parameters.DeviceIoControl.IoControlCode);
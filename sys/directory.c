@@ -23,7 +23,8 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "dokan.h"
 
 NTSTATUS
-DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp);
+DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
+                    __out PULONG_PTR Information);
 
 NTSTATUS
 DokanNotifyChangeDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp);
@@ -148,12 +149,210 @@ DokanMaybeOptimizeSingleNameSearch(__in PIRP Irp,
   return DokanOptimizeSingleNameSearch(Irp, IrpSp, Vcb, DirectoryFcb);
 }
 
+// Drops the directory entries kept on the CCB. Called with the CCB Resource
+// held exclusively or once the CCB is no longer used.
+VOID DokanFreeDirectoryPage(__in PDokanCCB Ccb) {
+  if (Ccb->DirectoryPage != NULL) {
+    ExFreePool(Ccb->DirectoryPage);
+    Ccb->DirectoryPage = NULL;
+    InterlockedExchangeAdd(&Ccb->Fcb->Vcb->DirectoryPagesLength,
+                           -(LONG)Ccb->DirectoryPageLength);
+  }
+  Ccb->DirectoryPageLength = 0;
+  Ccb->DirectoryPageOffset = 0;
+  Ccb->DirectoryPageEnd = FALSE;
+}
+
+// Keeps the entries of a reply that did not fit in the buffer of the caller.
+// Called with the CCB Resource held exclusively.
+static VOID DokanKeepDirectoryPage(__in PDokanCCB Ccb,
+                                   __in ULONG FileInformationClass,
+                                   __in PUCHAR Entries, __in ULONG Length,
+                                   __in BOOLEAN End) {
+  PDokanVCB vcb = Ccb->Fcb->Vcb;
+
+  if (Length == 0 && !End) {
+    return;
+  }
+  if (Length != 0) {
+    // The next query asks user mode again from Ccb->Context when the page is
+    // not kept
+    if (InterlockedExchangeAdd(&vcb->DirectoryPagesLength, (LONG)Length) +
+            Length >
+        DOKAN_DIRECTORY_PAGES_MAX_LENGTH) {
+      DDbgPrint("    too many directory pages kept on the volume\n");
+      InterlockedExchangeAdd(&vcb->DirectoryPagesLength, -(LONG)Length);
+      return;
+    }
+    Ccb->DirectoryPage = ExAllocatePoolWithTag(PagedPool, Length, TAG);
+    if (Ccb->DirectoryPage == NULL) {
+      InterlockedExchangeAdd(&vcb->DirectoryPagesLength, -(LONG)Length);
+      return;
+    }
+    RtlCopyMemory(Ccb->DirectoryPage, Entries, Length);
+  }
+  Ccb->DirectoryPageLength = Length;
+  Ccb->DirectoryPageOffset = 0;
+  Ccb->DirectoryPageClass = FileInformationClass;
+  Ccb->DirectoryPageEnd = End;
+}
+
+// Copies the whole entries at the start of Entries that fit in Buffer, only the
+// first one for SL_RETURN_SINGLE_ENTRY. Returns the bytes written to Buffer, 0
+// when the first entry does not fit. *Consumed receives the bytes of Entries
+// copied and *Index the FileIndex user mode gave to the last copied entry,
+// which is where the listing continues.
+static ULONG DokanCopyDirectoryEntries(__out_bcount(BufferLength) PUCHAR Buffer,
+                                       __in ULONG BufferLength,
+                                       __in PUCHAR Entries,
+                                       __in ULONG EntriesLength,
+                                       __in BOOLEAN SingleEntry,
+                                       __out PULONG Consumed,
+                                       __out PULONG Index) {
+  PFILE_NAMES_INFORMATION entry;
+  PFILE_NAMES_INFORMATION last = NULL;
+  ULONG offset = 0;
+  ULONG entryLength;
+
+  *Consumed = 0;
+  // Every directory information class starts with NextEntryOffset and
+  // FileIndex like FILE_NAMES_INFORMATION
+  while (EntriesLength - offset >= sizeof(FILE_NAMES_INFORMATION)) {
+    entry = (PFILE_NAMES_INFORMATION)(Entries + offset);
+    entryLength = entry->NextEntryOffset != 0 ? entry->NextEntryOffset
+                                              : EntriesLength - offset;
+    if (entryLength > EntriesLength - offset ||
+        entryLength > BufferLength - offset) {
+      break;
+    }
+    RtlCopyMemory(Buffer + offset, entry, entryLength);
+    last = (PFILE_NAMES_INFORMATION)(Buffer + offset);
+    *Index = entry->FileIndex;
+    offset += entryLength;
+    if (SingleEntry || entry->NextEntryOffset == 0) {
+      break;
+    }
+  }
+  if (last == NULL) {
+    return 0;
+  }
+  last->NextEntryOffset = 0;
+  *Consumed = offset;
+  return offset;
+}
+
+// Index of the entry a query starts from
+static ULONG DokanDirectoryQueryIndex(__in PIO_STACK_LOCATION IrpSp,
+                                     __in PDokanCCB Ccb) {
+  if (FlagOn(IrpSp->Flags, SL_INDEX_SPECIFIED)) {
+    return IrpSp->Parameters.QueryDirectory.FileIndex;
+  }
+  if (FlagOn(IrpSp->Flags, SL_RESTART_SCAN)) {
+    return 0;
+  }
+  return (ULONG)Ccb->Context;
+}
+
+// Whether the entries kept on the CCB continue the listing of the query.
+// Called with the CCB Resource held.
+static BOOLEAN DokanDirectoryPageMatches(__in PIO_STACK_LOCATION IrpSp,
+                                         __in PDokanCCB Ccb) {
+  PUNICODE_STRING pattern = IrpSp->Parameters.QueryDirectory.FileName;
+
+  if (FlagOn(IrpSp->Flags, SL_RESTART_SCAN) ||
+      IrpSp->Parameters.QueryDirectory.FileInformationClass !=
+          Ccb->DirectoryPageClass ||
+      DokanDirectoryQueryIndex(IrpSp, Ccb) != (ULONG)Ccb->Context) {
+    return FALSE;
+  }
+  if (pattern != NULL && pattern->Length != 0 &&
+      (Ccb->SearchPattern == NULL ||
+       pattern->Length != Ccb->SearchPatternLength ||
+       !RtlEqualMemory(pattern->Buffer, Ccb->SearchPattern,
+                       pattern->Length))) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Answers a query from the entries an earlier reply left on the CCB. Returns
+// STATUS_INVALID_PARAMETER when user mode has to be asked instead.
+static NTSTATUS DokanQueryDirectoryPage(__in PIRP Irp,
+                                        __in PIO_STACK_LOCATION IrpSp,
+                                        __in PDokanCCB Ccb,
+                                        __out PULONG_PTR Information) {
+  NTSTATUS status = STATUS_INVALID_PARAMETER;
+  ULONG bufferLength = IrpSp->Parameters.QueryDirectory.Length;
+  PUCHAR buffer = Irp->UserBuffer;
+  ULONG copied = 0;
+  ULONG consumed = 0;
+  ULONG index = 0;
+
+  *Information = 0;
+  if (Irp->MdlAddress) {
+    buffer = MmGetSystemAddressForMdlNormalSafe(Irp->MdlAddress);
+  }
+
+  KeEnterCriticalRegion();
+  ExAcquireResourceExclusiveLite(&Ccb->Resource, TRUE);
+
+  if (Ccb->DirectoryPage == NULL && !Ccb->DirectoryPageEnd) {
+    status = STATUS_INVALID_PARAMETER;
+  } else if (!DokanDirectoryPageMatches(IrpSp, Ccb)) {
+    DDbgPrint("    drop directory page\n");
+    DokanFreeDirectoryPage(Ccb);
+  } else if (buffer == NULL || bufferLength == 0) {
+    // Failed as usual by the completion of the event
+    status = STATUS_INVALID_PARAMETER;
+  } else if (Ccb->DirectoryPageOffset == Ccb->DirectoryPageLength) {
+    DDbgPrint("    directory page end\n");
+    status = STATUS_NO_MORE_FILES;
+  } else {
+    __try {
+      RtlZeroMemory(buffer, bufferLength);
+      copied = DokanCopyDirectoryEntries(
+          buffer, bufferLength, Ccb->DirectoryPage + Ccb->DirectoryPageOffset,
+          Ccb->DirectoryPageLength - Ccb->DirectoryPageOffset,
+          FlagOn(IrpSp->Flags, SL_RETURN_SINGLE_ENTRY), &consumed, &index);
+      status = copied != 0 ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+      status = GetExceptionCode();
+      copied = 0;
+    }
+    // Entries after the page could have fit, user mode returns them with the
+    // ones of the page
+    if (copied != 0 && !Ccb->DirectoryPageEnd &&
+        !FlagOn(IrpSp->Flags, SL_RETURN_SINGLE_ENTRY) &&
+        Ccb->DirectoryPageOffset + consumed == Ccb->DirectoryPageLength) {
+      DDbgPrint("    drop directory page tail\n");
+      DokanFreeDirectoryPage(Ccb);
+      status = STATUS_INVALID_PARAMETER;
+      copied = 0;
+    }
+    if (copied != 0) {
+      DDbgPrint("    %lu bytes from directory page\n", copied);
+      Ccb->DirectoryPageOffset += consumed;
+      Ccb->Context = index;
+      if (Ccb->DirectoryPageOffset == Ccb->DirectoryPageLength &&
+          !Ccb->DirectoryPageEnd) {
+        DokanFreeDirectoryPage(Ccb);
+      }
+      *Information = copied;
+    }
+  }
+
+  ExReleaseResourceLite(&Ccb->Resource);
+  KeLeaveCriticalRegion();
+  return status;
+}
+
 NTSTATUS
 DokanDispatchDirectoryControl(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
   PFILE_OBJECT fileObject;
   PIO_STACK_LOCATION irpSp;
   PDokanVCB vcb;
+  ULONG_PTR info = 0;
 
   __try {
     DDbgPrint("==> DokanDirectoryControl\n");
@@ -178,7 +377,7 @@ DokanDispatchDirectoryControl(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     DokanPrintFileName(fileObject);
 
     if (irpSp->MinorFunction == IRP_MN_QUERY_DIRECTORY) {
-      status = DokanQueryDirectory(DeviceObject, Irp);
+      status = DokanQueryDirectory(DeviceObject, Irp, &info);
 
     } else if (irpSp->MinorFunction == IRP_MN_NOTIFY_CHANGE_DIRECTORY) {
       status = DokanNotifyChangeDirectory(DeviceObject, Irp);
@@ -189,7 +388,7 @@ DokanDispatchDirectoryControl(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 
   } __finally {
 
-    DokanCompleteIrpRequest(Irp, status, 0);
+    DokanCompleteIrpRequest(Irp, status, info);
 
     DDbgPrint("<== DokanDirectoryControl\n");
   }
@@ -198,7 +397,8 @@ DokanDispatchDirectoryControl(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 }
 
 NTSTATUS
-DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
+DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
+                    __out PULONG_PTR Information) {
   PFILE_OBJECT fileObject;
   PIO_STACK_LOCATION irpSp;
   PDokanVCB vcb;
@@ -273,6 +473,11 @@ DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     return status;
   }
 
+  status = DokanQueryDirectoryPage(Irp, irpSp, ccb, Information);
+  if (status != STATUS_INVALID_PARAMETER) {
+    return status;
+  }
+
   // make a MDL for UserBuffer that can be used later on another thread context
   if (Irp->MdlAddress == NULL) {
     status = DokanAllocateMdl(Irp, irpSp->Parameters.QueryDirectory.Length);
@@ -340,25 +545,21 @@ DokanQueryDirectory(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 
   // index which specified index-1 th directory entry has been returned
   // this time, 'index'th entry should be returned
-  index = 0;
-
-  if (irpSp->Flags & SL_INDEX_SPECIFIED) {
-    index = irpSp->Parameters.QueryDirectory.FileIndex;
-    DDbgPrint("    using FileIndex %d\n", index);
-
-  } else if (FlagOn(irpSp->Flags, SL_RESTART_SCAN)) {
-    DDbgPrint("    SL_RESTART_SCAN\n");
-    index = 0;
-
-  } else {
-    index = (ULONG)ccb->Context;
-    DDbgPrint("    ccb->Context %d\n", index);
-  }
+  index = DokanDirectoryQueryIndex(irpSp, ccb);
+  DDbgPrint("    index %d\n", index);
 
   eventContext->Operation.Directory.FileInformationClass =
       irpSp->Parameters.QueryDirectory.FileInformationClass;
   eventContext->Operation.Directory.BufferLength =
       irpSp->Parameters.QueryDirectory.Length; // length of buffer
+  // Ask for a page of entries, the ones the caller has no room for answer its
+  // next queries
+  if (!FlagOn(irpSp->Flags, SL_RETURN_SINGLE_ENTRY) &&
+      eventContext->Operation.Directory.BufferLength <
+          DOKAN_DIRECTORY_PAGE_LENGTH) {
+    eventContext->Operation.Directory.BufferLength =
+        DOKAN_DIRECTORY_PAGE_LENGTH;
+  }
   eventContext->Operation.Directory.FileIndex =
       index; // directory index which should be returned this time
 
@@ -458,15 +659,16 @@ VOID DokanCompleteDirectoryControl(__in PIRP_ENTRY IrpEntry,
 
   // DDbgPrint("  !!Returning DirecotyInfo!!\n");
 
-  // buffer is not specified or short of length
-  if (bufferLen == 0 || buffer == NULL || bufferLen < EventInfo->BufferLength) {
+  // buffer is not specified
+  if (bufferLen == 0 || buffer == NULL) {
     info = 0;
     status = STATUS_INSUFFICIENT_RESOURCES;
 
   } else {
 
     PDokanCCB ccb = IrpEntry->FileObject->FsContext2;
-    // ULONG     orgLen = irpSp->Parameters.QueryDirectory.Length;
+    ULONG index = EventInfo->Operation.Directory.Index;
+    ULONG consumed = 0;
 
     //
     // set the information received from user mode
@@ -475,9 +677,6 @@ VOID DokanCompleteDirectoryControl(__in PIRP_ENTRY IrpEntry,
 
     RtlZeroMemory(buffer, bufferLen);
 
-    // DDbgPrint("   copy DirectoryInfo\n");
-    RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
-
     DDbgPrint("    eventInfo->Directory.Index = %lu\n",
               EventInfo->Operation.Directory.Index);
     DDbgPrint("    eventInfo->BufferLength    = %lu\n",
@@ -485,19 +684,52 @@ VOID DokanCompleteDirectoryControl(__in PIRP_ENTRY IrpEntry,
     DDbgPrint("    eventInfo->Status = %x (%lu)\n", EventInfo->Status,
               EventInfo->Status);
 
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&ccb->Resource, TRUE);
+
+    // A reply replaces what an earlier one left
+    DokanFreeDirectoryPage(ccb);
+
+    status = EventInfo->Status;
+
+    if (EventInfo->BufferLength <= bufferLen) {
+      // DDbgPrint("   copy DirectoryInfo\n");
+      RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
+      info = EventInfo->BufferLength;
+      consumed = EventInfo->BufferLength;
+
+    } else if (status == STATUS_SUCCESS) {
+      // A page larger than the buffer, the caller gets the entries that fit
+      info = DokanCopyDirectoryEntries(
+          buffer, bufferLen, EventInfo->Buffer, EventInfo->BufferLength,
+          FlagOn(irpSp->Flags, SL_RETURN_SINGLE_ENTRY), &consumed, &index);
+      if (info == 0) {
+        status = STATUS_BUFFER_OVERFLOW;
+        index = DokanDirectoryQueryIndex(irpSp, ccb);
+      }
+
+    } else {
+      info = 0;
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      consumed = EventInfo->BufferLength;
+      index = (ULONG)ccb->Context;
+    }
+
     // update index which specified n-th directory entry is returned
-    // this should be locked before writing?
-    ccb->Context = EventInfo->Operation.Directory.Index;
+    ccb->Context = index;
 
     ccb->UserContext = EventInfo->Context;
     // DDbgPrint("   set Context %X\n", (ULONG)ccb->UserContext);
 
-    // written bytes
-    // irpSp->Parameters.QueryDirectory.Length = EventInfo->BufferLength;
-
-    status = EventInfo->Status;
+    if (status == STATUS_SUCCESS || status == STATUS_BUFFER_OVERFLOW) {
+      DokanKeepDirectoryPage(
+          ccb, irpSp->Parameters.QueryDirectory.FileInformationClass,
+          EventInfo->Buffer + consumed, EventInfo->BufferLength - consumed,
+          (BOOLEAN)FlagOn(EventInfo->Flags, DOKAN_EVENT_INFO_NO_MORE_ENTRIES));
+    }
 
-    info = EventInfo->BufferLength;
+    ExReleaseResourceLite(&ccb->Resource);
+    KeLeaveCriticalRegion();
   }
 
   if (IrpEntry->Flags & DOKAN_MDL_ALLOCATED) {
@@ -36,6 +36,8 @@ ULONG g_Debug = DOKAN_DEBUG_NONE;
 LOOKASIDE_LIST_EX g_DokanCCBLookasideList;
 LOOKASIDE_LIST_EX g_DokanFCBLookasideList;
 LOOKASIDE_LIST_EX g_DokanEResourceLookasideList;
+LOOKASIDE_LIST_EX
+    g_DokanEventContextLookasideList[DOKAN_EVENT_CONTEXT_SIZE_CLASSES];
 
 NPAGED_LOOKASIDE_LIST DokanIrpEntryLookasideList;
 ULONG DokanMdlSafePriority = 0;
@@ -85,6 +87,86 @@ DokanFastIoRead(__in PFILE_OBJECT FileObject, __in PLARGE_INTEGER FileOffset,
   return FALSE;
 }
 
+// Returns the FCB whose cached attributes can answer a fast I/O query
+static PDokanFCB DokanFastIoQueryFcb(__in PFILE_OBJECT FileObject,
+                                     __in PDEVICE_OBJECT DeviceObject) {
+  PDokanVCB vcb = DeviceObject->DeviceExtension;
+  if (GetIdentifierType(vcb) != VCB ||
+      !DokanCheckCCB(vcb->Dcb, FileObject->FsContext2)) {
+    return NULL;
+  }
+  return ((PDokanCCB)FileObject->FsContext2)->Fcb;
+}
+
+// The fast I/O queries only succeed from attributes user mode attached to an
+// earlier reply, the I/O manager sends an IRP otherwise.
+FAST_IO_QUERY_BASIC_INFO DokanFastIoQueryBasicInfo;
+BOOLEAN
+DokanFastIoQueryBasicInfo(__in PFILE_OBJECT FileObject, __in BOOLEAN Wait,
+                          __out PFILE_BASIC_INFORMATION Buffer,
+                          __out PIO_STATUS_BLOCK IoStatus,
+                          __in PDEVICE_OBJECT DeviceObject) {
+  PDokanFCB fcb;
+  ULONG info = 0;
+
+  UNREFERENCED_PARAMETER(Wait);
+
+  fcb = DokanFastIoQueryFcb(FileObject, DeviceObject);
+  if (fcb == NULL ||
+      !DokanFillCachedFileInformation(fcb, FileBasicInformation, Buffer,
+                                      sizeof(FILE_BASIC_INFORMATION), &info)) {
+    return FALSE;
+  }
+  IoStatus->Status = STATUS_SUCCESS;
+  IoStatus->Information = info;
+  return TRUE;
+}
+
+FAST_IO_QUERY_STANDARD_INFO DokanFastIoQueryStandardInfo;
+BOOLEAN
+DokanFastIoQueryStandardInfo(__in PFILE_OBJECT FileObject, __in BOOLEAN Wait,
+                             __out PFILE_STANDARD_INFORMATION Buffer,
+                             __out PIO_STATUS_BLOCK IoStatus,
+                             __in PDEVICE_OBJECT DeviceObject) {
+  PDokanFCB fcb;
+  ULONG info = 0;
+
+  UNREFERENCED_PARAMETER(Wait);
+
+  fcb = DokanFastIoQueryFcb(FileObject, DeviceObject);
+  if (fcb == NULL || !DokanFillCachedFileInformation(
+                         fcb, FileStandardInformation, Buffer,
+                         sizeof(FILE_STANDARD_INFORMATION), &info)) {
+    return FALSE;
+  }
+  IoStatus->Status = STATUS_SUCCESS;
+  IoStatus->Information = info;
+  return TRUE;
+}
+
+FAST_IO_QUERY_NETWORK_OPEN_INFO DokanFastIoQueryNetworkOpenInfo;
+BOOLEAN
+DokanFastIoQueryNetworkOpenInfo(__in PFILE_OBJECT FileObject,
+                                __in BOOLEAN Wait,
+                                __out PFILE_NETWORK_OPEN_INFORMATION Buffer,
+                                __out PIO_STATUS_BLOCK IoStatus,
+                                __in PDEVICE_OBJECT DeviceObject) {
+  PDokanFCB fcb;
+  ULONG info = 0;
+
+  UNREFERENCED_PARAMETER(Wait);
+
+  fcb = DokanFastIoQueryFcb(FileObject, DeviceObject);
+  if (fcb == NULL || !DokanFillCachedFileInformation(
+                         fcb, FileNetworkOpenInformation, Buffer,
+                         sizeof(FILE_NETWORK_OPEN_INFORMATION), &info)) {
+    return FALSE;
+  }
+  IoStatus->Status = STATUS_SUCCESS;
+  IoStatus->Information = info;
+  return TRUE;
+}
+
 FAST_IO_ACQUIRE_FILE DokanAcquireForCreateSection;
 VOID DokanAcquireForCreateSection(__in PFILE_OBJECT FileObject) {
   PDokanCCB ccb = (PDokanCCB)FileObject->FsContext2;
@@ -239,6 +321,7 @@ Return Value:
   NTSTATUS status;
   FS_FILTER_CALLBACKS filterCallbacks;
   PDOKAN_GLOBAL dokanGlobal = NULL;
+  ULONG i;
 
   UNREFERENCED_PARAMETER(RegistryPath);
 
@@ -290,6 +373,9 @@ Return Value:
   // FastIoDispatch.FastIoRead = DokanFastIoRead;
   FastIoDispatch.FastIoRead = FsRtlCopyRead;
   FastIoDispatch.FastIoWrite = FsRtlCopyWrite;
+  FastIoDispatch.FastIoQueryBasicInfo = DokanFastIoQueryBasicInfo;
+  FastIoDispatch.FastIoQueryStandardInfo = DokanFastIoQueryStandardInfo;
+  FastIoDispatch.FastIoQueryNetworkOpenInfo = DokanFastIoQueryNetworkOpenInfo;
   FastIoDispatch.AcquireFileForNtCreateSection = DokanAcquireForCreateSection;
   FastIoDispatch.ReleaseFileForNtCreateSection = DokanReleaseForCreateSection;
   FastIoDispatch.AcquireForCcFlush = DokanAcquireForCcFlush;
@@ -345,6 +431,22 @@ Return Value:
     return STATUS_INSUFFICIENT_RESOURCES;
   }
 
+  for (i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASSES; ++i) {
+    if (!DokanLookasideCreate(&g_DokanEventContextLookasideList[i],
+                              DOKAN_EVENT_CONTEXT_CLASS_SIZE(i))) {
+      DDbgPrint("  DokanLookasideCreate g_DokanEventContextLookasideList "
+                "failed");
+      CleanupGlobalDiskDevice(dokanGlobal);
+      ExDeleteLookasideListEx(&g_DokanCCBLookasideList);
+      ExDeleteLookasideListEx(&g_DokanFCBLookasideList);
+      ExDeleteLookasideListEx(&g_DokanEResourceLookasideList);
+      while (i-- > 0) {
+        ExDeleteLookasideListEx(&g_DokanEventContextLookasideList[i]);
+      }
+      return STATUS_INSUFFICIENT_RESOURCES;
+    }
+  }
+
   DDbgPrint("<== DriverEntry\n");
 
   return (status);
@@ -371,6 +473,7 @@ Return Value:
 
   PDEVICE_OBJECT deviceObject = DriverObject->DeviceObject;
   PDOKAN_GLOBAL dokanGlobal;
+  ULONG i;
 
   DDbgPrint("==> DokanUnload\n");
 
@@ -387,6 +490,9 @@ Return Value:
   ExDeleteLookasideListEx(&g_DokanCCBLookasideList);
   ExDeleteLookasideListEx(&g_DokanFCBLookasideList);
   ExDeleteLookasideListEx(&g_DokanEResourceLookasideList);
+  for (i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASSES; ++i) {
+    ExDeleteLookasideListEx(&g_DokanEventContextLookasideList[i]);
+  }
 
   DDbgPrint("<== DokanUnload\n");
 }
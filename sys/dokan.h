@@ -34,6 +34,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <ntstrsafe.h>
 
 #include "public.h"
+#include "timerwheel.h"
 
 //
 // DEFINES
@@ -100,9 +101,20 @@ extern ULONG DokanMdlSafePriority;
 #define DOKAN_IRP_PENDING_TIMEOUT (1000 * 15)               // in millisecond
 #define DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX (1000 * 60 * 5) // in millisecond
 #define DOKAN_CHECK_INTERVAL (1000 * 5)                     // in millisecond
+#define DOKAN_TIMEOUT_CHECK_INTERVAL (1000 * 1)             // in millisecond
 
 #define DOKAN_KEEPALIVE_TIMEOUT_DEFAULT (1000 * 15) // in millisecond
 
+// Bytes of directory entries user mode is asked for at once when the buffer of
+// the query is smaller. The surplus is kept on the CCB, see DirectoryPage.
+#define DOKAN_DIRECTORY_PAGE_LENGTH (64 * 1024)
+// Most bytes of directory pages kept on the handles of a volume. Once reached,
+// queries of other handles ask user mode for each of them.
+#define DOKAN_DIRECTORY_PAGES_MAX_LENGTH (8 * 1024 * 1024)
+
+// Buckets of file name hashes counting the FSCTL_NOTIFY_PATH calls of a volume
+#define DOKAN_NOTIFY_GENERATION_BUCKETS 64
+
 #define DDbgPrint(...)                                                         \
   if (g_Debug & DOKAN_DEBUG_DEFAULT) {                                         \
     KdPrintEx(                                                                 \
@@ -124,6 +136,14 @@ extern NPAGED_LOOKASIDE_LIST DokanIrpEntryLookasideList;
 #define DokanFreeIrpEntry(IrpEntry)                                            \
   ExFreeToNPagedLookasideList(&DokanIrpEntryLookasideList, IrpEntry)
 
+// Event contexts up to 32 KB, DRIVER_EVENT_CONTEXT header included, come from
+// lookaside lists of 512 B, 2 KB, 8 KB and 32 KB entries
+#define DOKAN_EVENT_CONTEXT_SIZE_CLASSES                                       \
+  (DOKAN_METRICS_EVENT_CONTEXT_ALLOCATORS - 1)
+#define DOKAN_EVENT_CONTEXT_CLASS_SIZE(SizeClass) (512UL << (2 * (SizeClass)))
+extern LOOKASIDE_LIST_EX
+    g_DokanEventContextLookasideList[DOKAN_EVENT_CONTEXT_SIZE_CLASSES];
+
 //
 //  Undocumented definition of ExtensionFlags
 //
@@ -170,6 +190,9 @@ typedef struct _IRP_LIST {
   LIST_ENTRY ListHead;
   KEVENT NotEmpty;
   KSPIN_LOCK ListLock;
+  // Number of entries and the highest it has been, protected by ListLock
+  LONG Count;
+  LONG PeakCount;
 } IRP_LIST, *PIRP_LIST;
 
 typedef struct _MOUNT_ENTRY {
@@ -247,6 +270,8 @@ typedef struct _DokanDiskControlBlock {
 
   // the list of waiting Event
   IRP_LIST PendingIrp;
+  // Deadlines and serial numbers of the PendingIrp entries
+  DOKAN_TIMER_WHEEL TimerWheel;
   IRP_LIST PendingEvent;
   IRP_LIST NotifyEvent;
   // IRPs that need to be retried in kernel mode, e.g. due to oplock breaks
@@ -282,6 +307,8 @@ typedef struct _DokanDiskControlBlock {
   USHORT UseMountManager;
   USHORT MountGlobally;
   USHORT FileLockInUserMode;
+  // When HandleOnlyEvents is 1, events on an opened file omit known names
+  USHORT HandleOnlyEvents;
 
   // to make a unique id for pending IRP
   ULONG SerialNumber;
@@ -308,6 +335,12 @@ typedef struct _DokanDiskControlBlock {
 
   // Whether any oplock functionality should be disabled.
   BOOLEAN OplocksDisabled;
+
+  // Counters returned by IOCTL_GET_VOLUME_METRICS. The queue depths are taken
+  // from the IRP lists when the snapshot is made.
+  DOKAN_VOLUME_METRICS Metrics;
+  // Interrupt time when the device was created
+  ULONGLONG CreateTime;
 } DokanDCB, *PDokanDCB;
 
 #define IS_DEVICE_READ_ONLY(DeviceObject)                                      \
@@ -359,6 +392,22 @@ typedef struct _DokanVolumeControlBlock {
   // Whether keep-alive has been activated on this volume.
   BOOLEAN IsKeepaliveActive;
 
+  // Answers of the volume callbacks pushed by user mode with
+  // IOCTL_SET_VOLUME_INFORMATION, used until the interrupt time reaches
+  // VolumeInformationExpiry. Both are protected by VolumeInformationLock.
+  KSPIN_LOCK VolumeInformationLock;
+  EVENT_VOLUME_INFORMATION VolumeInformation;
+  ULONGLONG VolumeInformationExpiry;
+
+  // Bytes of the directory pages kept on the CCBs of the volume, up to
+  // DOKAN_DIRECTORY_PAGES_MAX_LENGTH. Changed with atomic operations.
+  LONG DirectoryPagesLength;
+
+  // FSCTL_NOTIFY_PATH calls on the names of each bucket, see
+  // DokanNotifyBucket. FCBs compare them with their NotifyGeneration instead
+  // of being looked up by name on every call. Changed with atomic operations.
+  LONG NotifyGenerations[DOKAN_NOTIFY_GENERATION_BUCKETS];
+
 } DokanVCB, *PDokanVCB;
 
 // Flags for volume
@@ -420,6 +469,15 @@ typedef struct _DokanOplockDebugInfo {
 #define DOKAN_OPLOCK_DEBUG_CREATE_RETRY_QUEUED 64
 #define DOKAN_OPLOCK_DEBUG_CREATE_RETRIED 128
 
+// Security descriptor attached by user mode to a query security reply, see
+// DOKAN_EVENT_INFO_SECURITY_DESCRIPTOR. Shared by the FCB that keeps it and the
+// queries copying it, freed with the last reference.
+typedef struct _DOKAN_CACHED_SECURITY_DESCRIPTOR {
+  LONG References;
+  ULONG Length;
+  UCHAR Data[1];
+} DOKAN_CACHED_SECURITY_DESCRIPTOR, *PDOKAN_CACHED_SECURITY_DESCRIPTOR;
+
 typedef struct _DokanFileControlBlock {
   // Locking: Identifier is read-only, no locks needed.
   FSD_IDENTIFIER Identifier;
@@ -454,6 +512,8 @@ typedef struct _DokanFileControlBlock {
   // Modifications must lock the VCB followed by the FCB. Reads may
   // lock either one.
   UNICODE_STRING FileName;
+  // Locking: Same as FileName. Changed with it, never 0.
+  ULONG NameGeneration;
 
   // Locking: FsRtl routines should be enough after initialization.
   FILE_LOCK FileLock;
@@ -497,6 +557,29 @@ typedef struct _DokanFileControlBlock {
   // Info that is useful for troubleshooting oplock problems in a debugger.
   DokanOplockDebugInfo OplockDebugInfo;
 
+  // Attributes user mode attached to a reply, see EVENT_FILE_ATTRIBUTES.
+  // Locking: AttributesLock for all the Attributes* fields.
+  KSPIN_LOCK AttributesLock;
+  EVENT_FILE_ATTRIBUTES Attributes;
+  // Interrupt time after which Attributes are stale, 0 when there are none
+  ULONGLONG AttributesExpiry;
+  // Changed each time the file may have changed, replies to requests sent
+  // before are not cached.
+  ULONG AttributesGeneration;
+  // Bucket of FileName in the VCB NotifyGenerations, and the value it had
+  // when the FCB last applied it
+  ULONG NotifyBucket;
+  LONG NotifyGeneration;
+
+  // Descriptor of the file for SecurityDescriptorInformation, valid until
+  // SecurityDescriptorExpiry while AttributesGeneration stays
+  // SecurityDescriptorGeneration. Locking: AttributesLock for all the
+  // SecurityDescriptor* fields.
+  PDOKAN_CACHED_SECURITY_DESCRIPTOR SecurityDescriptor;
+  SECURITY_INFORMATION SecurityDescriptorInformation;
+  ULONG SecurityDescriptorGeneration;
+  ULONGLONG SecurityDescriptorExpiry;
+
 } DokanFCB, *PDokanFCB;
 
 #define DokanResourceLockRO(resource)                                          \
@@ -635,12 +718,27 @@ typedef struct _DokanContextControlBlock {
   PWCHAR SearchPattern;
   ULONG SearchPatternLength;
 
+  // Directory entries user mode returned beyond the buffer of a query, served
+  // to the next queries of the handle without an event. Kept while
+  // DirectoryPageEnd is set even when all entries were served.
+  // Locking: CCB Resource.
+  PUCHAR DirectoryPage;
+  ULONG DirectoryPageLength;
+  ULONG DirectoryPageOffset;
+  ULONG DirectoryPageClass;
+  // The directory has no entries after the page
+  BOOLEAN DirectoryPageEnd;
+
   // Locking: Use atomic flag operations - DokanCCBFlags*
   ULONG Flags;
 
   // Locking: Read only field. No locking needed.
   ULONG MountId;
 
+  // Generation of the FCB name user mode has for this handle, 0 for none.
+  // Locking: Atomics, see DokanAcknowledgeFileName.
+  ULONG NameGeneration;
+
   // Whether keep-alive has been activated on this volume.
   BOOLEAN IsKeepaliveActive;
 
@@ -685,6 +783,12 @@ typedef struct _IRP_ENTRY {
   ULONG Flags;
   LARGE_INTEGER TickCount;
   PIRP_LIST IrpList;
+  // Interrupt time when the IRP was queued
+  ULONGLONG QueuedTime;
+  // Place in the timer wheel of the volume, only used for PendingIrp entries
+  DOKAN_TIMER_WHEEL_ENTRY Timer;
+  // FCB AttributesGeneration when the request was sent to user mode
+  ULONG AttributesGeneration;
 } IRP_ENTRY, *PIRP_ENTRY;
 
 typedef struct _DEVICE_ENTRY {
@@ -699,6 +803,13 @@ typedef struct _DEVICE_ENTRY {
 typedef struct _DRIVER_EVENT_CONTEXT {
   LIST_ENTRY ListEntry;
   PKEVENT Completed;
+  // Interrupt time when the event was queued for user mode
+  ULONGLONG QueuedTime;
+  // Lookaside list the context comes from, DOKAN_EVENT_CONTEXT_SIZE_CLASSES
+  // if it was allocated from the pool
+  ULONG SizeClass;
+  // Bytes allocated for the context
+  ULONG AllocationLength;
   EVENT_CONTEXT EventContext;
 } DRIVER_EVENT_CONTEXT, *PDRIVER_EVENT_CONTEXT;
 
@@ -803,6 +914,14 @@ DRIVER_DISPATCH DokanResetPendingIrpTimeout;
 
 DRIVER_DISPATCH DokanGetAccessToken;
 
+DRIVER_DISPATCH DokanGetVolumeMetrics;
+
+DRIVER_DISPATCH DokanSetVolumeInformationCache;
+
+// Adds the elapsed time since Start to the Total and Max metrics counters.
+VOID DokanMetricsAddTime(__inout volatile ULONG64 *Total,
+                         __inout volatile ULONG64 *Max, __in ULONGLONG Start);
+
 LONG
 DokanUnicodeStringChar(__in PUNICODE_STRING UnicodeString,
                             __in WCHAR Char);
@@ -844,6 +963,21 @@ AllocateEventContext(__in PDokanDCB Dcb, __in PIRP Irp,
 
 VOID DokanFreeEventContext(__in PEVENT_CONTEXT EventContext);
 
+ULONG DokanEventFileNameLength(__in PDokanDCB Dcb, __in PDokanFCB Fcb,
+                               __in PDokanCCB Ccb);
+
+VOID DokanCopyEventFileName(__in PEVENT_CONTEXT EventContext,
+                            __in PDokanFCB Fcb, __in ULONG FileNameLength,
+                            __out PULONG EventFileNameLength,
+                            __out PWCHAR EventFileName);
+
+VOID DokanAcknowledgeFileName(__in_opt PDokanCCB Ccb,
+                              __in ULONG NameGeneration);
+
+VOID DokanFreeDriverEventContext(__in PDRIVER_EVENT_CONTEXT DriverEventContext);
+
+VOID DokanGetEventContextMetrics(__out PDOKAN_VOLUME_METRICS Metrics);
+
 NTSTATUS
 DokanRegisterPendingIrp(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
                         __in PEVENT_CONTEXT EventContext, __in ULONG Flags);
@@ -862,6 +996,8 @@ VOID DokanEventNotification(__in PIRP_LIST NotifyEvent,
 VOID DokanCompleteDirectoryControl(__in PIRP_ENTRY IrpEntry,
                                    __in PEVENT_INFORMATION EventInfo);
 
+VOID DokanFreeDirectoryPage(__in PDokanCCB Ccb);
+
 VOID DokanCompleteRead(__in PIRP_ENTRY IrpEntry,
                        __in PEVENT_INFORMATION EventInfo);
 
@@ -874,6 +1010,47 @@ VOID DokanCompleteQueryInformation(__in PIRP_ENTRY IrpEntry,
 VOID DokanCompleteSetInformation(__in PIRP_ENTRY IrpEntry,
                                  __in PEVENT_INFORMATION EventInfo);
 
+// Returns the bucket of the name in the VCB NotifyGenerations.
+ULONG DokanNotifyBucket(__in PUNICODE_STRING FileName);
+
+// Sets the notify bucket of the FCB after its name changed.
+VOID DokanSetNotifyBucket(__in PDokanFCB Fcb);
+
+// Forgets the attributes cached for the opened files with the given name, once
+// they are next used.
+VOID DokanInvalidateFileAttributesByName(__in PDokanVCB Vcb,
+                                         __in PUNICODE_STRING FileName);
+
+// Forgets the attributes cached for the file if its name got a
+// FSCTL_NOTIFY_PATH since the last call. Called with the AttributesLock held
+// before the Attributes* and SecurityDescriptor* fields are used.
+VOID DokanApplyNotifyGeneration(__in PDokanFCB Fcb);
+
+// Called before a request is sent to user mode.
+VOID DokanPrepareFileAttributes(__in PIRP_ENTRY IrpEntry);
+
+// Called with the reply to a request, EventLength being the length of the
+// reply as sent by user mode.
+VOID DokanUpdateFileAttributes(__in PIRP_ENTRY IrpEntry,
+                               __in PEVENT_INFORMATION EventInfo,
+                               __in ULONG EventLength);
+
+// Fills Buffer from the attributes cached for the file. Returns FALSE when
+// they are stale or the class is not one they can answer.
+BOOLEAN
+DokanFillCachedFileInformation(__in PDokanFCB Fcb,
+                               __in FILE_INFORMATION_CLASS InformationClass,
+                               __out PVOID Buffer, __in ULONG Length,
+                               __out PULONG Information);
+
+// Fills Buffer from the volume information pushed by user mode. Returns FALSE
+// when it is stale or the class is not one it can answer.
+BOOLEAN
+DokanFillCachedVolumeInformation(__in PDokanVCB Vcb,
+                                 __in FS_INFORMATION_CLASS InformationClass,
+                                 __out PVOID Buffer, __in ULONG Length,
+                                 __out PULONG Information);
+
 // Invokes DokanCompleteCreate safely to time out an IRP_MJ_CREATE from a thread
 // that is not already in the context of a file system request.
 VOID
@@ -898,7 +1075,11 @@ VOID DokanCompleteFlush(__in PIRP_ENTRY IrpEntry,
                         __in PEVENT_INFORMATION EventInfo);
 
 VOID DokanCompleteQuerySecurity(__in PIRP_ENTRY IrpEntry,
-                                __in PEVENT_INFORMATION EventInfo);
+                                __in PEVENT_INFORMATION EventInfo,
+                                __in ULONG EventLength);
+
+VOID DokanReleaseCachedSecurityDescriptor(
+    __in_opt PDOKAN_CACHED_SECURITY_DESCRIPTOR Descriptor);
 
 VOID DokanCompleteSetSecurity(__in PIRP_ENTRY IrpEntry,
                               __in PEVENT_INFORMATION EventInfo);
@@ -966,6 +1147,24 @@ DokanCheckCCB(__in PDokanDCB Dcb, __in_opt PDokanCCB Ccb);
 
 VOID DokanInitIrpList(__in PIRP_LIST IrpList);
 
+// Updates the depth of an IRP list after an entry was added to it. Must be
+// called with the ListLock held, as DokanIrpListRemoved.
+__inline VOID DokanIrpListAdded(__inout PIRP_LIST IrpList) {
+  if (++IrpList->Count > IrpList->PeakCount) {
+    IrpList->PeakCount = IrpList->Count;
+  }
+}
+
+#define DokanIrpListRemoved(IrpList) (--(IrpList)->Count)
+
+// Deadline of a PendingIrp entry in the timer wheel. Canceled creates have a
+// zero tick count and failed async creates are registered with their failure
+// status, both are released at the next timeout check.
+#define DokanIrpEntryDeadline(IrpEntry)                                        \
+  ((IrpEntry)->AsyncStatus != STATUS_SUCCESS                                   \
+       ? 0                                                                     \
+       : (ULONGLONG)(IrpEntry)->TickCount.QuadPart)
+
 NTSTATUS
 DokanStartEventNotificationThread(__in PDokanDCB Dcb);
 
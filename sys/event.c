@@ -35,14 +35,28 @@ VOID DokanCreateIrpCancelRoutine(_Inout_ PDEVICE_OBJECT DeviceObject,
   // context where the cancel routine runs. For other types of IRPs, the cancel
   // routine actually does cancelation/cleanup.
   IoReleaseCancelSpinLock(Irp->CancelIrql);
+  PDokanVCB vcb = DeviceObject->DeviceExtension;
+  PDokanDCB dcb = vcb->Dcb;
+  KIRQL oldIrql;
+  ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+  KeAcquireSpinLock(&dcb->PendingIrp.ListLock, &oldIrql);
   PIRP_ENTRY irpEntry =
       Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY];
   if (irpEntry != NULL) {
     Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_EVENT] = NULL;
     InterlockedAnd64(&irpEntry->TickCount.QuadPart, 0);
     irpEntry->AsyncStatus = STATUS_CANCELLED;
-    PDokanVCB vcb = DeviceObject->DeviceExtension;
-    PDokanDCB dcb = vcb->Dcb;
+    // Creates waiting for a retry are not in the timer wheel and are released
+    // when they are dispatched again. DokanCompleteIrp may have lost the race
+    // for the cancel routine after taking the entry off PendingIrp, it is
+    // expired all the same and ReleaseTimeoutPendingIrp does not count it
+    // again.
+    if (irpEntry->IrpList == &dcb->PendingIrp) {
+      DokanTimerWheelExpireNow(&dcb->TimerWheel, &irpEntry->Timer);
+    }
+  }
+  KeReleaseSpinLock(&dcb->PendingIrp.ListLock, oldIrql);
+  if (irpEntry != NULL) {
     KeSetEvent(&dcb->ForceTimeoutEvent, 0, FALSE);
   }
 }
@@ -76,8 +90,19 @@ VOID DokanIrpCancelRoutine(_Inout_ PDEVICE_OBJECT DeviceObject,
 
     serialNumber = irpEntry->SerialNumber;
 
+    // The entry is not linked anymore if it was already taken off the list
+    if (!IsListEmpty(&irpEntry->ListEntry)) {
+      DokanIrpListRemoved(irpEntry->IrpList);
+      if (GetIdentifierType(DeviceObject->DeviceExtension) == VCB) {
+        PDokanDCB dcb = ((PDokanVCB)DeviceObject->DeviceExtension)->Dcb;
+        if (irpEntry->IrpList == &dcb->PendingIrp) {
+          InterlockedIncrement64((LONG64 *)&dcb->Metrics.CancelCount);
+        }
+      }
+    }
     RemoveEntryList(&irpEntry->ListEntry);
     InitializeListHead(&irpEntry->ListEntry);
+    DokanTimerWheelRemove(&irpEntry->Timer);
 
     // If Write is canceld before completion and buffer that saves writing
     // content is not freed, free it here
@@ -197,6 +222,7 @@ RegisterPendingIrpMain(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
   RtlZeroMemory(irpEntry, sizeof(IRP_ENTRY));
 
   InitializeListHead(&irpEntry->ListEntry);
+  DokanTimerWheelEntryInit(&irpEntry->Timer);
 
   irpEntry->SerialNumber = SerialNumber;
   irpEntry->FileObject = irpSp->FileObject;
@@ -205,6 +231,7 @@ RegisterPendingIrpMain(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
   irpEntry->IrpList = IrpList;
   irpEntry->Flags = Flags;
   irpEntry->AsyncStatus = CurrentStatus;
+  irpEntry->QueuedTime = KeQueryInterruptTime();
 
   // Update the irp timeout for the entry
   if (vcb) {
@@ -215,6 +242,12 @@ RegisterPendingIrpMain(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
     DokanUpdateTimeout(&irpEntry->TickCount, DOKAN_IRP_PENDING_TIMEOUT);
   }
 
+  // Only replies to requests sent after the last change of the file can
+  // leave attributes on its FCB
+  if (vcb != NULL && IrpList == &vcb->Dcb->PendingIrp) {
+    DokanPrepareFileAttributes(irpEntry);
+  }
+
   // DDbgPrint("  Lock IrpList.ListLock\n");
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&IrpList->ListLock, &oldIrql);
@@ -239,6 +272,12 @@ RegisterPendingIrpMain(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
   IoMarkIrpPending(Irp);
 
   InsertTailList(&IrpList->ListHead, &irpEntry->ListEntry);
+  DokanIrpListAdded(IrpList);
+  if (vcb != NULL && IrpList == &vcb->Dcb->PendingIrp) {
+    DokanTimerWheelInsert(&vcb->Dcb->TimerWheel, &irpEntry->Timer,
+                          irpEntry->SerialNumber,
+                          DokanIrpEntryDeadline(irpEntry));
+  }
 
   irpEntry->CancelRoutineFreeMemory = FALSE;
 
@@ -272,6 +311,11 @@ DokanRegisterPendingIrp(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
                                   /*CurrentStatus=*/STATUS_SUCCESS);
 
   if (status == STATUS_PENDING) {
+    if (EventContext->MajorFunction < DOKAN_METRICS_MAJOR_FUNCTIONS) {
+      InterlockedIncrement64(
+          (LONG64 *)&vcb->Dcb->Metrics
+              .DispatchCount[EventContext->MajorFunction]);
+    }
     DokanEventNotification(&vcb->Dcb->NotifyEvent, EventContext);
   } else {
     DokanFreeEventContext(EventContext);
@@ -297,6 +341,7 @@ DokanRegisterPendingRetryIrp(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     DokanCCBFlagsSetBit(ccb, DOKAN_RETRY_CREATE);
     OplockDebugRecordFlag(ccb->Fcb, DOKAN_OPLOCK_DEBUG_CREATE_RETRY_QUEUED);
   }
+  InterlockedIncrement64((LONG64 *)&vcb->Dcb->Metrics.RetryCount);
   RegisterPendingIrpMain(DeviceObject, Irp, /*SerialNumber=*/0,
                          &vcb->Dcb->PendingRetryIrp, /*Flags=*/0,
                          /*CheckMount=*/TRUE,
@@ -416,6 +461,8 @@ DokanCompleteIrp(__in PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
     }
 
     RemoveEntryList(thisEntry);
+    DokanIrpListRemoved(&vcb->Dcb->PendingIrp);
+    DokanTimerWheelRemove(&irpEntry->Timer);
 
     irp = irpEntry->Irp;
 
@@ -454,6 +501,21 @@ DokanCompleteIrp(__in PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
           "      !!WARNING!! Do not return STATUS_PENDING DokanCompleteIrp!");
     }
 
+    // User mode tells which name of the file it has for this handle
+    if (irpEntry->FileObject != NULL) {
+      DokanAcknowledgeFileName(irpEntry->FileObject->FsContext2,
+                               eventInfo->NameGeneration);
+    }
+
+    DokanUpdateFileAttributes(
+        irpEntry, eventInfo,
+        IoGetCurrentIrpStackLocation(Irp)
+            ->Parameters.DeviceIoControl.InputBufferLength);
+
+    InterlockedIncrement64((LONG64 *)&vcb->Dcb->Metrics.ReplyCount);
+    DokanMetricsAddTime(&vcb->Dcb->Metrics.ReplyTime,
+                        &vcb->Dcb->Metrics.MaxReplyTime, irpEntry->QueuedTime);
+
     switch (irpSp->MajorFunction) {
     case IRP_MJ_DIRECTORY_CONTROL:
       DokanCompleteDirectoryControl(irpEntry, eventInfo);
@@ -486,7 +548,10 @@ DokanCompleteIrp(__in PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
       DokanCompleteFlush(irpEntry, eventInfo);
       break;
     case IRP_MJ_QUERY_SECURITY:
-      DokanCompleteQuerySecurity(irpEntry, eventInfo);
+      DokanCompleteQuerySecurity(
+          irpEntry, eventInfo,
+          IoGetCurrentIrpStackLocation(Irp)
+              ->Parameters.DeviceIoControl.InputBufferLength);
       break;
     case IRP_MJ_SET_SECURITY:
       DokanCompleteSetSecurity(irpEntry, eventInfo);
@@ -759,6 +824,12 @@ DokanEventStart(__in PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
     dcb->UseAltStream = 1;
   }
 
+  dcb->HandleOnlyEvents = 0;
+  if (eventStart->Flags & DOKAN_EVENT_HANDLE_ONLY) {
+    DDbgPrint("  HANDLE_ONLY\n");
+    dcb->HandleOnlyEvents = 1;
+  }
+
   DokanStartEventNotificationThread(dcb);
 
   ExReleaseResourceLite(&dokanGlobal->Resource);
@@ -32,6 +32,7 @@ DokanDispatchQueryInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   PDokanVCB vcb;
   ULONG info = 0;
   ULONG eventLength;
+  ULONG fileNameLength;
   PEVENT_CONTEXT eventContext;
 
   // PAGED_CODE();
@@ -209,6 +210,15 @@ DokanDispatchQueryInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
       break;
     }
 
+    // Attributes attached to an earlier reply may still be valid
+    if (DokanFillCachedFileInformation(
+            fcb, irpSp->Parameters.QueryFile.FileInformationClass,
+            Irp->AssociatedIrp.SystemBuffer, irpSp->Parameters.QueryFile.Length,
+            &info)) {
+      status = STATUS_SUCCESS;
+      __leave;
+    }
+
     if (fcb->BlockUserModeDispatch) {
       status = STATUS_SUCCESS;
       __leave;
@@ -218,7 +228,8 @@ DokanDispatchQueryInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 
     // calculate the length of EVENT_CONTEXT
     // sum of it's size and file name length
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength;
 
     eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
 
@@ -238,9 +249,9 @@ DokanDispatchQueryInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
         irpSp->Parameters.QueryFile.Length;
 
     // copy file name to EventContext from FCB
-    eventContext->Operation.File.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.File.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.File.FileNameLength,
+                           eventContext->Operation.File.FileName);
 
     // register this IRP to pending IPR list
     status = DokanRegisterPendingIrp(DeviceObject, Irp, eventContext, 0);
@@ -359,6 +370,237 @@ VOID DokanCompleteQueryInformation(__in PIRP_ENTRY IrpEntry,
   DDbgPrint("<== DokanCompleteQueryInformation\n");
 }
 
+// Names are compared without case, like FCB names are
+ULONG DokanNotifyBucket(__in PUNICODE_STRING FileName) {
+  ULONG hash = 0;
+
+  if (!NT_SUCCESS(RtlHashUnicodeString(FileName, TRUE,
+                                       HASH_STRING_ALGORITHM_DEFAULT,
+                                       &hash))) {
+    return 0;
+  }
+  return hash % DOKAN_NOTIFY_GENERATION_BUCKETS;
+}
+
+VOID DokanSetNotifyBucket(__in PDokanFCB Fcb) {
+  ULONG bucket = DokanNotifyBucket(&Fcb->FileName);
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&Fcb->AttributesLock, &oldIrql);
+  Fcb->NotifyBucket = bucket;
+  Fcb->NotifyGeneration =
+      InterlockedCompareExchange(&Fcb->Vcb->NotifyGenerations[bucket], 0, 0);
+  KeReleaseSpinLock(&Fcb->AttributesLock, oldIrql);
+}
+
+// Only counts the call, the FCBs of the bucket apply it when they next use
+// their attributes. Files whose name shares the bucket lose theirs as well.
+VOID DokanInvalidateFileAttributesByName(__in PDokanVCB Vcb,
+                                         __in PUNICODE_STRING FileName) {
+  InterlockedIncrement(&Vcb->NotifyGenerations[DokanNotifyBucket(FileName)]);
+}
+
+VOID DokanApplyNotifyGeneration(__in PDokanFCB Fcb) {
+  LONG generation = InterlockedCompareExchange(
+      &Fcb->Vcb->NotifyGenerations[Fcb->NotifyBucket], 0, 0);
+
+  if (generation != Fcb->NotifyGeneration) {
+    Fcb->NotifyGeneration = generation;
+    Fcb->AttributesGeneration++;
+    Fcb->AttributesExpiry = 0;
+  }
+}
+
+// Returns the FCB of the file a pending request is on, NULL for none
+static PDokanFCB DokanIrpEntryFcb(__in PIRP_ENTRY IrpEntry) {
+  PDokanCCB ccb;
+
+  if (IrpEntry->FileObject == NULL) {
+    return NULL;
+  }
+  ccb = IrpEntry->FileObject->FsContext2;
+  if (ccb == NULL || GetIdentifierType(ccb) != CCB) {
+    return NULL;
+  }
+  return ccb->Fcb;
+}
+
+// Whether the request may change what EVENT_FILE_ATTRIBUTES or the cached
+// security descriptor describe
+static BOOLEAN DokanChangesFileAttributes(__in PIO_STACK_LOCATION IrpSp,
+                                          __in PDokanFCB Fcb) {
+  switch (IrpSp->MajorFunction) {
+  case IRP_MJ_CREATE:
+    // Every disposition but FILE_OPEN may create or overwrite the file
+    return ((IrpSp->Parameters.Create.Options >> 24) & 0x000000ff) !=
+           FILE_OPEN;
+  case IRP_MJ_CLEANUP:
+    // Writes through the handle already changed the generation
+    return DokanFCBFlagsIsSet(Fcb, DOKAN_DELETE_ON_CLOSE) != 0;
+  case IRP_MJ_WRITE:
+  case IRP_MJ_SET_INFORMATION:
+  case IRP_MJ_SET_SECURITY:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+VOID DokanPrepareFileAttributes(__in PIRP_ENTRY IrpEntry) {
+  PDokanFCB fcb;
+  KIRQL oldIrql;
+
+  fcb = DokanIrpEntryFcb(IrpEntry);
+  if (fcb == NULL) {
+    return;
+  }
+
+  KeAcquireSpinLock(&fcb->AttributesLock, &oldIrql);
+  DokanApplyNotifyGeneration(fcb);
+  // Replies to requests user mode got before this one may describe the file
+  // as it was before the change
+  if (DokanChangesFileAttributes(IrpEntry->IrpSp, fcb)) {
+    fcb->AttributesGeneration++;
+    fcb->AttributesExpiry = 0;
+  }
+  IrpEntry->AttributesGeneration = fcb->AttributesGeneration;
+  KeReleaseSpinLock(&fcb->AttributesLock, oldIrql);
+}
+
+VOID DokanUpdateFileAttributes(__in PIRP_ENTRY IrpEntry,
+                               __in PEVENT_INFORMATION EventInfo,
+                               __in ULONG EventLength) {
+  PDokanFCB fcb;
+  EVENT_FILE_ATTRIBUTES attributes;
+  BOOLEAN attached = FALSE;
+  BOOLEAN current;
+  ULONG bufferEnd;
+  KIRQL oldIrql;
+
+  fcb = DokanIrpEntryFcb(IrpEntry);
+  if (fcb == NULL) {
+    return;
+  }
+
+  // The block ends the reply, after the returned buffer
+  if (NT_SUCCESS(EventInfo->Status) &&
+      (EventInfo->Flags & DOKAN_EVENT_INFO_FILE_ATTRIBUTES) &&
+      (IrpEntry->IrpSp->MajorFunction == IRP_MJ_CREATE ||
+       IrpEntry->IrpSp->MajorFunction == IRP_MJ_QUERY_INFORMATION)) {
+    bufferEnd =
+        FIELD_OFFSET(EVENT_INFORMATION, Buffer) + EventInfo->BufferLength;
+    if (bufferEnd >= EventInfo->BufferLength &&
+        EventLength >= sizeof(EVENT_FILE_ATTRIBUTES) &&
+        EventLength - sizeof(EVENT_FILE_ATTRIBUTES) >= bufferEnd) {
+      RtlCopyMemory(&attributes,
+                    (PUCHAR)EventInfo + EventLength -
+                        sizeof(EVENT_FILE_ATTRIBUTES),
+                    sizeof(EVENT_FILE_ATTRIBUTES));
+      attached = attributes.ValidityMs != 0;
+    } else {
+      DDbgPrint("  Reply too short for its file attributes\n");
+    }
+  }
+
+  KeAcquireSpinLock(&fcb->AttributesLock, &oldIrql);
+  DokanApplyNotifyGeneration(fcb);
+  current = fcb->AttributesGeneration == IrpEntry->AttributesGeneration;
+  // What user mode did may have made attributes replied meanwhile stale
+  if (DokanChangesFileAttributes(IrpEntry->IrpSp, fcb)) {
+    fcb->AttributesGeneration++;
+    fcb->AttributesExpiry = 0;
+  }
+  if (attached && current) {
+    fcb->Attributes = attributes;
+    fcb->AttributesExpiry =
+        KeQueryInterruptTime() + (ULONGLONG)attributes.ValidityMs * 10000;
+  }
+  KeReleaseSpinLock(&fcb->AttributesLock, oldIrql);
+}
+
+BOOLEAN
+DokanFillCachedFileInformation(__in PDokanFCB Fcb,
+                               __in FILE_INFORMATION_CLASS InformationClass,
+                               __out PVOID Buffer, __in ULONG Length,
+                               __out PULONG Information) {
+  EVENT_FILE_ATTRIBUTES attributes;
+  ULONG required;
+  BOOLEAN valid;
+  KIRQL oldIrql;
+
+  switch (InformationClass) {
+  case FileBasicInformation:
+    required = sizeof(FILE_BASIC_INFORMATION);
+    break;
+  case FileStandardInformation:
+    required = sizeof(FILE_STANDARD_INFORMATION);
+    break;
+  case FileNetworkOpenInformation:
+    required = sizeof(FILE_NETWORK_OPEN_INFORMATION);
+    break;
+  default:
+    return FALSE;
+  }
+
+  // Short buffers get the answer of user mode
+  if (Buffer == NULL || Length < required) {
+    return FALSE;
+  }
+
+  KeAcquireSpinLock(&Fcb->AttributesLock, &oldIrql);
+  DokanApplyNotifyGeneration(Fcb);
+  valid = Fcb->AttributesExpiry != 0 &&
+          KeQueryInterruptTime() < Fcb->AttributesExpiry;
+  if (valid) {
+    attributes = Fcb->Attributes;
+  }
+  KeReleaseSpinLock(&Fcb->AttributesLock, oldIrql);
+
+  if (!valid) {
+    return FALSE;
+  }
+
+  RtlZeroMemory(Buffer, required);
+
+  if (InformationClass == FileBasicInformation) {
+    PFILE_BASIC_INFORMATION basicInfo = Buffer;
+    basicInfo->CreationTime = attributes.CreationTime;
+    basicInfo->LastAccessTime = attributes.LastAccessTime;
+    basicInfo->LastWriteTime = attributes.LastWriteTime;
+    basicInfo->ChangeTime = attributes.ChangeTime;
+    basicInfo->FileAttributes = attributes.FileAttributes;
+  } else if (InformationClass == FileStandardInformation) {
+    PFILE_STANDARD_INFORMATION standardInfo = Buffer;
+    standardInfo->AllocationSize = attributes.AllocationSize;
+    standardInfo->EndOfFile = attributes.EndOfFile;
+    standardInfo->NumberOfLinks = attributes.NumberOfLinks;
+    standardInfo->DeletePending =
+        DokanFCBFlagsIsSet(Fcb, DOKAN_DELETE_ON_CLOSE) != 0;
+    standardInfo->Directory =
+        (attributes.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+  } else {
+    PFILE_NETWORK_OPEN_INFORMATION networkInfo = Buffer;
+    networkInfo->CreationTime = attributes.CreationTime;
+    networkInfo->LastAccessTime = attributes.LastAccessTime;
+    networkInfo->LastWriteTime = attributes.LastWriteTime;
+    networkInfo->ChangeTime = attributes.ChangeTime;
+    networkInfo->AllocationSize = attributes.AllocationSize;
+    networkInfo->EndOfFile = attributes.EndOfFile;
+    networkInfo->FileAttributes = attributes.FileAttributes;
+  }
+
+  // Same as DokanCompleteQueryInformation does with the answer of user mode
+  if (InformationClass != FileBasicInformation) {
+    InterlockedExchange64(&Fcb->AdvancedFCBHeader.AllocationSize.QuadPart,
+                          attributes.AllocationSize.QuadPart);
+    InterlockedExchange64(&Fcb->AdvancedFCBHeader.FileSize.QuadPart,
+                          attributes.EndOfFile.QuadPart);
+  }
+
+  *Information = required;
+  return TRUE;
+}
+
 BOOLEAN StartsWith(__in PUNICODE_STRING str, __in PUNICODE_STRING prefix) {
   if (prefix == NULL || prefix->Length == 0) {
     return TRUE;
@@ -476,6 +718,7 @@ DokanDispatchSetInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   PDokanFCB fcb = NULL;
   PDokanVCB vcb;
   ULONG eventLength;
+  ULONG fileNameLength;
   PFILE_OBJECT targetFileObject;
   PEVENT_CONTEXT eventContext;
   BOOLEAN isPagingIo = FALSE;
@@ -604,9 +847,18 @@ DokanDispatchSetInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 
     // calcurate the size of EVENT_CONTEXT
     // it is sum of file name length and size of FileInformation
+    BOOLEAN isRenameOrLink =
+        irpSp->Parameters.SetFile.FileInformationClass == FileRenameInformation
+		|| irpSp->Parameters.SetFile.FileInformationClass == FileLinkInformation
+		|| irpSp->Parameters.SetFile.FileInformationClass == FileRenameInformationEx;
+
     DokanFCBLockRW(fcb);
     fcbLocked = TRUE;
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length +
+    // Renames and links always carry the name of the source file
+    fileNameLength = isRenameOrLink
+                         ? fcb->FileName.Length
+                         : DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength +
                   irpSp->Parameters.SetFile.Length;
 
     targetFileObject = irpSp->Parameters.SetFile.FileObject;
@@ -635,12 +887,7 @@ DokanDispatchSetInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     // the offset from beginning of structure to fill FileInfo
     eventContext->Operation.SetFile.BufferOffset =
         FIELD_OFFSET(EVENT_CONTEXT, Operation.SetFile.FileName[0]) +
-        fcb->FileName.Length + sizeof(WCHAR); // the last null char
-
-    BOOLEAN isRenameOrLink =
-        irpSp->Parameters.SetFile.FileInformationClass == FileRenameInformation
-		|| irpSp->Parameters.SetFile.FileInformationClass == FileLinkInformation
-		|| irpSp->Parameters.SetFile.FileInformationClass == FileRenameInformationEx;
+        fileNameLength + sizeof(WCHAR); // the last null char
 
     if (!isRenameOrLink) {
       // copy FileInformation
@@ -709,9 +956,9 @@ DokanDispatchSetInformation(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     }
 
     // copy the file name
-    eventContext->Operation.SetFile.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.SetFile.FileName,
-                  fcb->FileName.Buffer, fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.SetFile.FileNameLength,
+                           eventContext->Operation.SetFile.FileName);
 
     // FsRtlCheckOpLock is called with non-NULL completion routine - not blocking.
     status = DokanCheckOplock(fcb, Irp, eventContext, DokanOplockComplete,
@@ -897,6 +1144,11 @@ VOID DokanCompleteSetInformation(__in PIRP_ENTRY IrpEntry,
 
         fcb->FileName.Length = (USHORT)EventInfo->BufferLength;
         fcb->FileName.MaximumLength = (USHORT)EventInfo->BufferLength;
+        // Handles send the new name in their next event
+        if (++fcb->NameGeneration == 0) {
+          fcb->NameGeneration = 1;
+        }
+        DokanSetNotifyBucket(fcb);
         DDbgPrint("   rename also done on fcb %wZ \n", &fcb->FileName);
       }
     }
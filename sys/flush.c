@@ -31,6 +31,7 @@ DokanDispatchFlush(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   PDokanVCB vcb;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  ULONG fileNameLength;
 
   __try {
     DDbgPrint("==> DokanFlush\n");
@@ -61,7 +62,8 @@ DokanDispatchFlush(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     OplockDebugRecordMajorFunction(fcb, IRP_MJ_FLUSH_BUFFERS);
     DokanFCBLockRO(fcb);
 
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength;
     eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
 
     if (eventContext == NULL) {
@@ -73,9 +75,9 @@ DokanDispatchFlush(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     DDbgPrint("   get Context %X\n", (ULONG)ccb->UserContext);
 
     // copy file name to be flushed
-    eventContext->Operation.Flush.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Flush.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.Flush.FileNameLength,
+                           eventContext->Operation.Flush.FileName);
 
     CcUninitializeCacheMap(fileObject, NULL, NULL);
     // fileObject->Flags &= FO_CLEANUP_COMPLETE;
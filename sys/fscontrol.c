@@ -426,6 +426,8 @@ DokanUserFsRequest(__in PDEVICE_OBJECT DeviceObject, __in PIRP *pIrp) {
               "Length: %i, Path: %wZ\n",
               pNotifyPath->CompletionFilter, pNotifyPath->Action,
               receivedBuffer.Length, &receivedBuffer);
+    // The file changed behind the back of the driver
+    DokanInvalidateFileAttributesByName(fcb->Vcb, &receivedBuffer);
     DokanFCBLockRO(fcb);
     DokanNotifyReportChange0(fcb, &receivedBuffer,
                              pNotifyPath->CompletionFilter,
@@ -771,6 +773,7 @@ NTSTATUS DokanMountVolume(__in PDEVICE_OBJECT DiskDevice, __in PIRP Irp) {
   dcb->Vcb = vcb;
 
   InitializeListHead(&vcb->NextFCB);
+  KeInitializeSpinLock(&vcb->VolumeInformationLock);
 
   InitializeListHead(&vcb->DirNotifyList);
   FsRtlNotifyInitializeSync(&vcb->NotifySync);
@@ -381,6 +381,8 @@ VOID DokanInitIrpList(__in PIRP_LIST IrpList) {
   InitializeListHead(&IrpList->ListHead);
   KeInitializeSpinLock(&IrpList->ListLock);
   KeInitializeEvent(&IrpList->NotEmpty, NotificationEvent, FALSE);
+  IrpList->Count = 0;
+  IrpList->PeakCount = 0;
 }
 
 PDEVICE_ENTRY
@@ -584,6 +586,7 @@ VOID DeleteDeviceDelayed(PDOKAN_GLOBAL dokanGlobal) {
         if (deviceEntry->DiskDeviceObject && canDeleteDiskDevice) {
           DDbgPrint("  Delete the disk device. ReferenceCount %lu \n",
                     deviceEntry->DiskDeviceObject->ReferenceCount);
+          DokanTimerWheelUninit(&dcb->TimerWheel);
           IoDeleteDevice(deviceEntry->DiskDeviceObject);
           if (deviceEntry->DiskDeviceObject->Vpb) {
             DDbgPrint("  Volume->DeviceObject set to NULL\n")
@@ -1369,6 +1372,7 @@ DokanCreateDiskDevice(__in PDRIVER_OBJECT DriverObject, __in ULONG MountId,
     dcb->DeviceType = FILE_DEVICE_DISK;
     dcb->DeviceCharacteristics = DeviceCharacteristics;
     dcb->SessionId = SessionId;
+    dcb->CreateTime = KeQueryInterruptTime();
     KeInitializeEvent(&dcb->KillEvent, NotificationEvent, FALSE);
     KeInitializeEvent(&dcb->ForceTimeoutEvent, NotificationEvent, FALSE);
     IoInitializeRemoveLock(&dcb->RemoveLock, TAG, 1, 100);
@@ -1379,6 +1383,7 @@ DokanCreateDiskDevice(__in PDRIVER_OBJECT DriverObject, __in ULONG MountId,
 
     // initialize Event and Event queue
     DokanInitIrpList(&dcb->PendingIrp);
+    DokanTimerWheelInit(&dcb->TimerWheel);
     DokanInitIrpList(&dcb->PendingEvent);
     DokanInitIrpList(&dcb->NotifyEvent);
     DokanInitIrpList(&dcb->PendingRetryIrp);
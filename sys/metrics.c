@@ -0,0 +1,89 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+VOID DokanMetricsAddTime(__inout volatile ULONG64 *Total,
+                         __inout volatile ULONG64 *Max, __in ULONGLONG Start) {
+  ULONGLONG elapsed = KeQueryInterruptTime() - Start;
+  LONG64 max;
+
+  InterlockedExchangeAdd64((LONG64 *)Total, (LONG64)elapsed);
+  do {
+    max = *(LONG64 *)Max;
+    if (elapsed <= (ULONGLONG)max) {
+      break;
+    }
+  } while (InterlockedCompareExchange64((LONG64 *)Max, (LONG64)elapsed, max) !=
+           max);
+}
+
+static VOID GetQueueMetrics(__in PIRP_LIST IrpList,
+                            __out PDOKAN_QUEUE_METRICS Metrics) {
+  KIRQL oldIrql;
+
+  ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+  KeAcquireSpinLock(&IrpList->ListLock, &oldIrql);
+  Metrics->Current = (ULONG)IrpList->Count;
+  Metrics->Peak = (ULONG)IrpList->PeakCount;
+  KeReleaseSpinLock(&IrpList->ListLock, oldIrql);
+}
+
+NTSTATUS
+DokanGetVolumeMetrics(__in PDEVICE_OBJECT DeviceObject, _Inout_ PIRP Irp) {
+  PDokanVCB vcb;
+  PDokanDCB dcb;
+  PIO_STACK_LOCATION irpSp;
+  PDOKAN_VOLUME_METRICS metrics;
+
+  DDbgPrint("==> DokanGetVolumeMetrics\n");
+
+  vcb = DeviceObject->DeviceExtension;
+  if (GetIdentifierType(vcb) != VCB) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  dcb = vcb->Dcb;
+
+  irpSp = IoGetCurrentIrpStackLocation(Irp);
+  if (irpSp->Parameters.DeviceIoControl.OutputBufferLength <
+      sizeof(DOKAN_VOLUME_METRICS)) {
+    DDbgPrint("  output buffer is too small\n");
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+
+  metrics = (PDOKAN_VOLUME_METRICS)Irp->AssociatedIrp.SystemBuffer;
+  ASSERT(metrics != NULL);
+
+  // Counters keep changing while they are copied, they are only consistent
+  // with each other on an idle volume.
+  RtlCopyMemory(metrics, &dcb->Metrics, sizeof(DOKAN_VOLUME_METRICS));
+  GetQueueMetrics(&dcb->PendingIrp, &metrics->PendingIrp);
+  GetQueueMetrics(&dcb->PendingEvent, &metrics->PendingEvent);
+  GetQueueMetrics(&dcb->NotifyEvent, &metrics->NotifyEvent);
+  GetQueueMetrics(&dcb->PendingRetryIrp, &metrics->PendingRetryIrp);
+  metrics->Uptime = KeQueryInterruptTime() - dcb->CreateTime;
+  DokanGetEventContextMetrics(metrics);
+
+  Irp->IoStatus.Information = sizeof(DOKAN_VOLUME_METRICS);
+
+  DDbgPrint("<== DokanGetVolumeMetrics\n");
+  return STATUS_SUCCESS;
+}
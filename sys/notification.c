@@ -78,22 +78,64 @@ VOID SetCommonEventContext(__in PDokanDCB Dcb, __in PEVENT_CONTEXT EventContext,
   EventContext->ProcessId = IoGetRequestorProcessId(Irp);
 }
 
+// Event context allocations and bytes in use for all volumes
+static DOKAN_VOLUME_METRICS g_EventContextMetrics;
+
+static VOID AddEventContextBytes(__in LONG64 Length) {
+  LONG64 bytes = InterlockedExchangeAdd64(
+                     (LONG64 *)&g_EventContextMetrics.EventContextBytes,
+                     Length) +
+                 Length;
+  LONG64 peak;
+
+  do {
+    peak = *(volatile LONG64 *)&g_EventContextMetrics.EventContextPeakBytes;
+    if (bytes <= peak) {
+      break;
+    }
+  } while (InterlockedCompareExchange64(
+               (LONG64 *)&g_EventContextMetrics.EventContextPeakBytes, bytes,
+               peak) != peak);
+}
+
 PEVENT_CONTEXT
 AllocateEventContextRaw(__in ULONG EventContextLength) {
   ULONG driverContextLength;
   PDRIVER_EVENT_CONTEXT driverEventContext;
   PEVENT_CONTEXT eventContext;
+  ULONG sizeClass = 0;
+  ULONG allocationLength;
 
   driverContextLength =
       EventContextLength - sizeof(EVENT_CONTEXT) + sizeof(DRIVER_EVENT_CONTEXT);
-  driverEventContext = ExAllocatePool(driverContextLength);
+
+  while (sizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASSES &&
+         driverContextLength > DOKAN_EVENT_CONTEXT_CLASS_SIZE(sizeClass)) {
+    ++sizeClass;
+  }
+  if (sizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASSES) {
+    allocationLength = DOKAN_EVENT_CONTEXT_CLASS_SIZE(sizeClass);
+    driverEventContext = ExAllocateFromLookasideListEx(
+        &g_DokanEventContextLookasideList[sizeClass]);
+  } else {
+    allocationLength = driverContextLength;
+    driverEventContext = ExAllocatePool(driverContextLength);
+  }
 
   if (driverEventContext == NULL) {
     return NULL;
   }
 
+  // Only the part used by this context is cleared, not the whole lookaside
+  // entry. Requests rely on it to terminate their strings.
   RtlZeroMemory(driverEventContext, driverContextLength);
   InitializeListHead(&driverEventContext->ListEntry);
+  driverEventContext->SizeClass = sizeClass;
+  driverEventContext->AllocationLength = allocationLength;
+
+  InterlockedIncrement64(
+      (LONG64 *)&g_EventContextMetrics.EventContextAllocations[sizeClass]);
+  AddEventContextBytes(allocationLength);
 
   eventContext = &driverEventContext->EventContext;
   eventContext->Length = EventContextLength;
@@ -101,6 +143,26 @@ AllocateEventContextRaw(__in ULONG EventContextLength) {
   return eventContext;
 }
 
+VOID DokanFreeDriverEventContext(
+    __in PDRIVER_EVENT_CONTEXT DriverEventContext) {
+  AddEventContextBytes(-(LONG64)DriverEventContext->AllocationLength);
+  if (DriverEventContext->SizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASSES) {
+    ExFreeToLookasideListEx(
+        &g_DokanEventContextLookasideList[DriverEventContext->SizeClass],
+        DriverEventContext);
+  } else {
+    ExFreePool(DriverEventContext);
+  }
+}
+
+VOID DokanGetEventContextMetrics(__out PDOKAN_VOLUME_METRICS Metrics) {
+  RtlCopyMemory(Metrics->EventContextAllocations,
+                g_EventContextMetrics.EventContextAllocations,
+                sizeof(Metrics->EventContextAllocations));
+  Metrics->EventContextBytes = g_EventContextMetrics.EventContextBytes;
+  Metrics->EventContextPeakBytes = g_EventContextMetrics.EventContextPeakBytes;
+}
+
 PEVENT_CONTEXT
 AllocateEventContext(__in PDokanDCB Dcb, __in PIRP Irp,
                      __in ULONG EventContextLength, __in_opt PDokanCCB Ccb) {
@@ -118,23 +180,69 @@ AllocateEventContext(__in PDokanDCB Dcb, __in PIRP Irp,
 VOID DokanFreeEventContext(__in PEVENT_CONTEXT EventContext) {
   PDRIVER_EVENT_CONTEXT driverEventContext =
       CONTAINING_RECORD(EventContext, DRIVER_EVENT_CONTEXT, EventContext);
-  ExFreePool(driverEventContext);
+  DokanFreeDriverEventContext(driverEventContext);
+}
+
+// Length of the name to copy into an event on an opened file. In handle-only
+// mode it is omitted once user mode acknowledged the current name of the file
+// for this handle. Called with the FCB lock held.
+ULONG DokanEventFileNameLength(__in PDokanDCB Dcb, __in PDokanFCB Fcb,
+                               __in PDokanCCB Ccb) {
+  if (Dcb->HandleOnlyEvents && Ccb->NameGeneration == Fcb->NameGeneration) {
+    return 0;
+  }
+  return Fcb->FileName.Length;
+}
+
+VOID DokanCopyEventFileName(__in PEVENT_CONTEXT EventContext,
+                            __in PDokanFCB Fcb, __in ULONG FileNameLength,
+                            __out PULONG EventFileNameLength,
+                            __out PWCHAR EventFileName) {
+  EventContext->NameGeneration = Fcb->NameGeneration;
+  *EventFileNameLength = FileNameLength;
+  if (FileNameLength != 0) {
+    RtlCopyMemory(EventFileName, Fcb->FileName.Buffer, FileNameLength);
+  }
+}
+
+// Records the name generation user mode replied with for a handle. Replies
+// can arrive out of order, the generation only moves forward.
+VOID DokanAcknowledgeFileName(__in_opt PDokanCCB Ccb,
+                              __in ULONG NameGeneration) {
+  ULONG current;
+  ULONG previous;
+
+  if (Ccb == NULL || NameGeneration == 0 || GetIdentifierType(Ccb) != CCB) {
+    return;
+  }
+  current = Ccb->NameGeneration;
+  while ((LONG)(NameGeneration - current) > 0) {
+    previous = (ULONG)InterlockedCompareExchange(
+        (LONG *)&Ccb->NameGeneration, (LONG)NameGeneration, (LONG)current);
+    if (previous == current) {
+      break;
+    }
+    current = previous;
+  }
 }
 
 VOID DokanEventNotification(__in PIRP_LIST NotifyEvent,
                             __in PEVENT_CONTEXT EventContext) {
   PDRIVER_EVENT_CONTEXT driverEventContext =
       CONTAINING_RECORD(EventContext, DRIVER_EVENT_CONTEXT, EventContext);
+  KIRQL oldIrql;
 
   InitializeListHead(&driverEventContext->ListEntry);
+  driverEventContext->QueuedTime = KeQueryInterruptTime();
 
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
 
   // DDbgPrint("DokanEventNotification\n");
 
-  ExInterlockedInsertTailList(&NotifyEvent->ListHead,
-                              &driverEventContext->ListEntry,
-                              &NotifyEvent->ListLock);
+  KeAcquireSpinLock(&NotifyEvent->ListLock, &oldIrql);
+  InsertTailList(&NotifyEvent->ListHead, &driverEventContext->ListEntry);
+  DokanIrpListAdded(NotifyEvent);
+  KeReleaseSpinLock(&NotifyEvent->ListLock, oldIrql);
 
   KeSetEvent(&NotifyEvent->NotEmpty, IO_NO_INCREMENT, FALSE);
 }
@@ -157,6 +265,7 @@ VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest) {
   while (!IsListEmpty(&Source->ListHead)) {
     listHead = RemoveHeadList(&Source->ListHead);
     irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+    DokanTimerWheelRemove(&irpEntry->Timer);
     irp = irpEntry->Irp;
     if (irp == NULL) {
       // this IRP has already been canceled
@@ -174,6 +283,7 @@ VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest) {
     InsertTailList(Dest, &irpEntry->ListEntry);
   }
 
+  Source->Count = 0;
   KeClearEvent(&Source->NotEmpty);
   KeReleaseSpinLock(&Source->ListLock, oldIrql);
 }
@@ -206,9 +316,10 @@ VOID ReleaseNotifyEvent(__in PIRP_LIST NotifyEvent) {
     listHead = RemoveHeadList(&NotifyEvent->ListHead);
     driverEventContext =
         CONTAINING_RECORD(listHead, DRIVER_EVENT_CONTEXT, ListEntry);
-    ExFreePool(driverEventContext);
+    DokanFreeDriverEventContext(driverEventContext);
   }
 
+  NotifyEvent->Count = 0;
   KeClearEvent(&NotifyEvent->NotEmpty);
   KeReleaseSpinLock(&NotifyEvent->ListLock, oldIrql);
 }
@@ -231,7 +342,68 @@ VOID RetryIrps(__in PIRP_LIST PendingRetryIrp) {
   }
 }
 
-VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
+// Waiting threads looked at to find one of the group of a request
+#define DOKAN_AFFINITY_SCAN_MAX 64
+
+// Affinity given by the thread that sent an IOCTL_EVENT_WAIT, NULL if it
+// takes any request
+static PEVENT_WAIT_AFFINITY GetEventWaitAffinity(__in PIRP_ENTRY IrpEntry) {
+  PEVENT_WAIT_AFFINITY affinity;
+
+  if (IrpEntry->Irp == NULL ||
+      IrpEntry->IrpSp->MajorFunction != IRP_MJ_DEVICE_CONTROL ||
+      IrpEntry->IrpSp->Parameters.DeviceIoControl.IoControlCode !=
+          IOCTL_EVENT_WAIT ||
+      IrpEntry->IrpSp->Parameters.DeviceIoControl.InputBufferLength <
+          sizeof(EVENT_WAIT_AFFINITY)) {
+    return NULL;
+  }
+  affinity = (PEVENT_WAIT_AFFINITY)IrpEntry->Irp->AssociatedIrp.SystemBuffer;
+  if (affinity == NULL || affinity->GroupCount < 2 ||
+      affinity->Group >= affinity->GroupCount) {
+    return NULL;
+  }
+  return affinity;
+}
+
+// Returns the waiting thread a request is given to: the first one of the
+// group of the file when there is one, the oldest one otherwise.
+// PendingIrp must not be empty and its lock must be held.
+static PLIST_ENTRY SelectEventWait(__in PIRP_LIST PendingIrp,
+                                   __in PEVENT_CONTEXT EventContext,
+                                   __out PBOOLEAN AffinityMatched) {
+  PLIST_ENTRY listHead = &PendingIrp->ListHead;
+  PLIST_ENTRY entry;
+  PEVENT_WAIT_AFFINITY affinity;
+  ULONG scanned = 0;
+
+  *AffinityMatched = FALSE;
+  if (EventContext->Context == 0) {
+    return listHead->Flink;
+  }
+  for (entry = listHead->Flink;
+       entry != listHead && scanned < DOKAN_AFFINITY_SCAN_MAX;
+       entry = entry->Flink, ++scanned) {
+    affinity =
+        GetEventWaitAffinity(CONTAINING_RECORD(entry, IRP_ENTRY, ListEntry));
+    if (affinity == NULL) {
+      // The threads of this mount have no affinity
+      if (scanned == 0) {
+        break;
+      }
+      continue;
+    }
+    if (affinity->Group ==
+        DOKAN_AFFINITY_GROUP(EventContext->Context, affinity->GroupCount)) {
+      *AffinityMatched = TRUE;
+      return entry;
+    }
+  }
+  return listHead->Flink;
+}
+
+VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent,
+                      __in_opt PDokanDCB Dcb) {
   PDRIVER_EVENT_CONTEXT driverEventContext;
   PLIST_ENTRY listHead;
   PIRP_ENTRY irpEntry;
@@ -242,6 +414,7 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
   ULONG eventLen;
   ULONG bufferLen;
   PVOID buffer;
+  BOOLEAN affinityMatched;
 
   DDbgPrint("=> NotificationLoop\n");
 
@@ -258,11 +431,15 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
          !IsListEmpty(&NotifyEvent->ListHead)) {
 
     listHead = RemoveHeadList(&NotifyEvent->ListHead);
+    DokanIrpListRemoved(NotifyEvent);
 
     driverEventContext =
         CONTAINING_RECORD(listHead, DRIVER_EVENT_CONTEXT, ListEntry);
 
-    listHead = RemoveHeadList(&PendingIrp->ListHead);
+    listHead = SelectEventWait(PendingIrp, &driverEventContext->EventContext,
+                               &affinityMatched);
+    RemoveEntryList(listHead);
+    DokanIrpListRemoved(PendingIrp);
     irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
 
     eventLen = driverEventContext->EventContext.Length;
@@ -277,6 +454,7 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
       DokanFreeIrpEntry(irpEntry);
       // push back
       InsertTailList(&NotifyEvent->ListHead, &driverEventContext->ListEntry);
+      DokanIrpListAdded(NotifyEvent);
       continue;
     }
 
@@ -287,6 +465,7 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
       irpEntry->CancelRoutineFreeMemory = TRUE;
       // push back
       InsertTailList(&NotifyEvent->ListHead, &driverEventContext->ListEntry);
+      DokanIrpListAdded(NotifyEvent);
       continue;
     }
 
@@ -301,6 +480,7 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
       DDbgPrint("  bufferLen: %d, eventLen: %d\n", bufferLen, eventLen);
       // push back
       InsertTailList(&NotifyEvent->ListHead, &driverEventContext->ListEntry);
+      DokanIrpListAdded(NotifyEvent);
       // marks as STATUS_INSUFFICIENT_RESOURCES
       irpEntry->SerialNumber = 0;
     } else {
@@ -309,10 +489,20 @@ VOID NotificationLoop(__in PIRP_LIST PendingIrp, __in PIRP_LIST NotifyEvent) {
       // save event length
       irpEntry->SerialNumber = eventLen;
 
+      if (Dcb) {
+        InterlockedIncrement64((LONG64 *)&Dcb->Metrics.PickupCount);
+        if (affinityMatched) {
+          InterlockedIncrement64((LONG64 *)&Dcb->Metrics.AffinityPickupCount);
+        }
+        DokanMetricsAddTime(&Dcb->Metrics.QueueTime,
+                            &Dcb->Metrics.MaxQueueTime,
+                            driverEventContext->QueuedTime);
+      }
+
       if (driverEventContext->Completed) {
         KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
       }
-      ExFreePool(driverEventContext);
+      DokanFreeDriverEventContext(driverEventContext);
     }
     InsertTailList(&completeList, &irpEntry->ListEntry);
   }
@@ -374,10 +564,10 @@ VOID NotificationThread(__in PVOID pDcb) {
 
     if (status != STATUS_WAIT_0) {
       if (status == STATUS_WAIT_1 || status == STATUS_WAIT_2) {
-        NotificationLoop(&Dcb->PendingEvent, &Dcb->NotifyEvent);
+        NotificationLoop(&Dcb->PendingEvent, &Dcb->NotifyEvent, Dcb);
       } else if (status == STATUS_WAIT_0 + 3 || status == STATUS_WAIT_0 + 4) {
         NotificationLoop(&Dcb->Global->PendingService,
-                         &Dcb->Global->NotifyService);
+                         &Dcb->Global->NotifyService, NULL);
       } else {
         RetryIrps(&Dcb->PendingRetryIrp);
       }
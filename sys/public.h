@@ -80,6 +80,15 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define FSCTL_NOTIFY_PATH                                                      \
   CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x810, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// DeviceIoControl code to get a DOKAN_VOLUME_METRICS snapshot of a volume.
+#define IOCTL_GET_VOLUME_METRICS                                               \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x811, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to give a volume the EVENT_VOLUME_INFORMATION it
+// answers volume information queries from.
+#define IOCTL_SET_VOLUME_INFORMATION                                           \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x812, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 #define DRIVER_FUNC_INSTALL 0x01
 #define DRIVER_FUNC_REMOVE 0x02
 
@@ -207,6 +216,9 @@ typedef struct _CREATE_CONTEXT {
   ULONG FileNameOffset;
 } CREATE_CONTEXT, *PCREATE_CONTEXT;
 
+// In DOKAN_EVENT_HANDLE_ONLY mode, FileNameLength of the contexts of requests
+// on an opened file below is 0 when user mode already acknowledged the current
+// name of the file for this handle, see EVENT_CONTEXT.NameGeneration.
 typedef struct _CLEANUP_CONTEXT {
   ULONG FileNameLength;
   WCHAR FileName[1];
@@ -222,6 +234,8 @@ typedef struct _CLOSE_CONTEXT {
 typedef struct _DIRECTORY_CONTEXT {
   ULONG FileInformationClass;
   ULONG FileIndex;
+  // Bytes of entries user mode can return. Can exceed the buffer of the
+  // caller, the driver keeps the surplus for the next queries of the handle.
   ULONG BufferLength;
   ULONG DirectoryNameLength;
   ULONG SearchPatternLength;
@@ -310,6 +324,9 @@ typedef struct _EVENT_CONTEXT {
   UCHAR MinorFunction;
   ULONG Flags;
   ULONG FileFlags;
+  // Generation of the name of the file, changed when it is renamed. 0 when the
+  // name of a create is not the name of the opened file.
+  ULONG NameGeneration;
   ULONG64 Context;
   union {
     DIRECTORY_CONTEXT Directory;
@@ -336,6 +353,8 @@ typedef struct _EVENT_INFORMATION {
   ULONG SerialNumber;
   NTSTATUS Status;
   ULONG Flags;
+  // Generation of the file name user mode has for the handle, 0 for none
+  ULONG NameGeneration;
   union {
     struct {
       ULONG Index;
@@ -366,6 +385,63 @@ typedef struct _EVENT_INFORMATION {
 
 } EVENT_INFORMATION, *PEVENT_INFORMATION;
 
+// EVENT_INFORMATION Flags
+// The directory has no entries after the ones returned
+#define DOKAN_EVENT_INFO_NO_MORE_ENTRIES 1
+// An EVENT_FILE_ATTRIBUTES block ends the reply
+#define DOKAN_EVENT_INFO_FILE_ATTRIBUTES 2
+// The reply to a query security holds the whole BufferLength bytes long
+// descriptor even when it is STATUS_BUFFER_OVERFLOW. The driver answers the
+// queries of the file for the same security information from it for
+// DOKAN_SECURITY_DESCRIPTOR_VALIDITY milliseconds.
+#define DOKAN_EVENT_INFO_SECURITY_DESCRIPTOR 4
+#define DOKAN_SECURITY_DESCRIPTOR_VALIDITY 1000
+
+/**
+* \struct EVENT_FILE_ATTRIBUTES
+* \brief Optional attributes of the file attached to a create or query
+* information reply
+*
+* The block takes the last bytes of the reply, after Buffer, and is announced
+* with DOKAN_EVENT_INFO_FILE_ATTRIBUTES. The driver answers basic, standard and
+* network open information queries of the file from it for ValidityMs, unless
+* the file is written, changed or notified in the meantime.
+*/
+typedef struct _EVENT_FILE_ATTRIBUTES {
+  LARGE_INTEGER CreationTime;
+  LARGE_INTEGER LastAccessTime;
+  LARGE_INTEGER LastWriteTime;
+  LARGE_INTEGER ChangeTime;
+  LARGE_INTEGER AllocationSize;
+  LARGE_INTEGER EndOfFile;
+  ULONG FileAttributes;
+  ULONG NumberOfLinks;
+  /** Milliseconds the attributes may be used for, 0 to not cache them */
+  ULONG ValidityMs;
+  ULONG Reserved;
+} EVENT_FILE_ATTRIBUTES, *PEVENT_FILE_ATTRIBUTES;
+
+/**
+* \struct EVENT_WAIT_AFFINITY
+* \brief Optional input of IOCTL_EVENT_WAIT
+*
+* Requests on an opened file go to a waiting thread of the group its Context
+* hashes to when there is one, and to the oldest waiting thread otherwise.
+*/
+typedef struct _EVENT_WAIT_AFFINITY {
+  /** Group of the waiting thread, lower than GroupCount */
+  ULONG Group;
+  /** Number of groups the threads of the mount are spread over */
+  ULONG GroupCount;
+} EVENT_WAIT_AFFINITY, *PEVENT_WAIT_AFFINITY;
+
+// Group of EVENT_WAIT_AFFINITY a request on an opened file is given to
+#define DOKAN_AFFINITY_GROUP(Context, GroupCount)                              \
+  ((ULONG)((((ULONG64)(Context) ^ ((ULONG64)(Context) >> 32)) *                \
+            0x9E3779B97F4A7C15ULL) >>                                          \
+           32) %                                                               \
+   (GroupCount))
+
 // Dokan events
 #define DOKAN_EVENT_ALTERNATIVE_STREAM_ON 1
 #define DOKAN_EVENT_WRITE_PROTECT 2
@@ -375,6 +451,7 @@ typedef struct _EVENT_INFORMATION {
 #define DOKAN_EVENT_FILELOCK_USER_MODE 32
 #define DOKAN_EVENT_DISABLE_OPLOCKS 64
 #define DOKAN_EVENT_OPTIMIZE_SINGLE_NAME_SEARCH 128
+#define DOKAN_EVENT_HANDLE_ONLY 256
 
 // Dokan debug log options
 #define DOKAN_DEBUG_NONE 0
@@ -444,4 +521,105 @@ typedef struct _DOKAN_CONTROL {
   ULONG SessionId;
 } DOKAN_CONTROL, *PDOKAN_CONTROL;
 
+// IRP_MJ_MAXIMUM_FUNCTION + 1
+#define DOKAN_METRICS_MAJOR_FUNCTIONS 0x1c
+// Event context allocators: 512 B, 2 KB, 8 KB and 32 KB lookaside lists and
+// the pool for larger ones
+#define DOKAN_METRICS_EVENT_CONTEXT_ALLOCATORS 5
+
+/**
+* \struct DOKAN_QUEUE_METRICS
+* \brief Depth of one of the driver queues of a volume
+*/
+typedef struct _DOKAN_QUEUE_METRICS {
+  /** Number of entries in the queue */
+  ULONG Current;
+  /** Highest number of entries since the volume was mounted */
+  ULONG Peak;
+} DOKAN_QUEUE_METRICS, *PDOKAN_QUEUE_METRICS;
+
+/**
+* \struct DOKAN_VOLUME_METRICS
+* \brief Driver statistics of a volume returned by IOCTL_GET_VOLUME_METRICS
+*
+* Times are in 100 nanoseconds units. The time a request spends in user mode
+* is about ReplyTime / ReplyCount - QueueTime / PickupCount.
+*/
+typedef struct _DOKAN_VOLUME_METRICS {
+  /** Requests sent to user mode and waiting for their reply */
+  DOKAN_QUEUE_METRICS PendingIrp;
+  /** IOCTL_EVENT_WAIT of idle user mode threads */
+  DOKAN_QUEUE_METRICS PendingEvent;
+  /** Requests waiting for a user mode thread to pick them up */
+  DOKAN_QUEUE_METRICS NotifyEvent;
+  /** IRPs waiting to be retried after an oplock break */
+  DOKAN_QUEUE_METRICS PendingRetryIrp;
+  /** Requests sent to user mode per IRP major function */
+  ULONG64 DispatchCount[DOKAN_METRICS_MAJOR_FUNCTIONS];
+  /** Requests picked up by a user mode thread */
+  ULONG64 PickupCount;
+  /** Total time requests waited before being picked up */
+  ULONG64 QueueTime;
+  /** Longest time a request waited before being picked up */
+  ULONG64 MaxQueueTime;
+  /** Requests completed by a reply of user mode */
+  ULONG64 ReplyCount;
+  /** Total time from queuing to reply of the replied requests */
+  ULONG64 ReplyTime;
+  /** Longest time from queuing to reply of a request */
+  ULONG64 MaxReplyTime;
+  /** Pending requests canceled by their issuer */
+  ULONG64 CancelCount;
+  /** Pending requests completed because user mode did not reply in time */
+  ULONG64 TimeoutCount;
+  /** IRPs queued to be retried after an oplock break */
+  ULONG64 RetryCount;
+  /** Time since the volume was mounted */
+  ULONG64 Uptime;
+  /**
+   * Event contexts allocated by each allocator since the driver was loaded,
+   * for all volumes
+   */
+  ULONG64 EventContextAllocations[DOKAN_METRICS_EVENT_CONTEXT_ALLOCATORS];
+  /** Bytes of event contexts currently allocated, for all volumes */
+  ULONG64 EventContextBytes;
+  /** Highest EventContextBytes since the driver was loaded */
+  ULONG64 EventContextPeakBytes;
+  /**
+   * Requests on an opened file picked up by a thread of the group its Context
+   * hashes to, see EVENT_WAIT_AFFINITY
+   */
+  ULONG64 AffinityPickupCount;
+} DOKAN_VOLUME_METRICS, *PDOKAN_VOLUME_METRICS;
+
+// Longest volume and file system names in an EVENT_VOLUME_INFORMATION
+#define DOKAN_VOLUME_INFORMATION_NAME_MAX 64
+
+/**
+* \struct EVENT_VOLUME_INFORMATION
+* \brief Input of IOCTL_SET_VOLUME_INFORMATION
+*
+* Answers of the GetVolumeInformation and GetDiskFreeSpace callbacks. The
+* driver answers volume, size, full size and attribute information queries
+* from them for Validity milliseconds instead of asking user mode.
+*/
+typedef struct _EVENT_VOLUME_INFORMATION {
+  /** Milliseconds the answers may be used for, 0 drops the driver copy */
+  ULONG Validity;
+  ULONG VolumeSerialNumber;
+  ULONG MaximumComponentLength;
+  ULONG FileSystemFlags;
+  ULONG64 FreeBytesAvailable;
+  ULONG64 TotalNumberOfBytes;
+  ULONG64 TotalNumberOfFreeBytes;
+  ULONG AllocationUnitSize;
+  ULONG SectorSize;
+  /** Length in bytes of VolumeName */
+  ULONG VolumeNameLength;
+  /** Length in bytes of FileSystemName */
+  ULONG FileSystemNameLength;
+  WCHAR VolumeName[DOKAN_VOLUME_INFORMATION_NAME_MAX];
+  WCHAR FileSystemName[DOKAN_VOLUME_INFORMATION_NAME_MAX];
+} EVENT_VOLUME_INFORMATION, *PEVENT_VOLUME_INFORMATION;
+
 #endif // PUBLIC_H_
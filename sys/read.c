@@ -54,6 +54,7 @@ Return Value:
   PVOID currentAddress = NULL;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  ULONG fileNameLength;
   BOOLEAN fcbLocked = FALSE;
   BOOLEAN isPagingIo = FALSE;
   BOOLEAN isSynchronousIo = FALSE;
@@ -185,7 +186,8 @@ Return Value:
     DokanFCBLockRO(fcb);
     fcbLocked = TRUE;
     // length of EventContext is sum of file name length and itself
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
+    eventLength = sizeof(EVENT_CONTEXT) + fileNameLength;
 
     eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
     if (eventContext == NULL) {
@@ -218,9 +220,9 @@ Return Value:
     eventContext->Operation.Read.BufferLength = irpSp->Parameters.Read.Length;
 
     // copy the accessed file name
-    eventContext->Operation.Read.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Read.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.Read.FileNameLength,
+                           eventContext->Operation.Read.FileName);
 
     //
     //  We now check whether we can proceed based on the state of
@@ -21,6 +21,125 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokan.h"
 
+VOID DokanReleaseCachedSecurityDescriptor(
+    __in_opt PDOKAN_CACHED_SECURITY_DESCRIPTOR Descriptor) {
+  if (Descriptor != NULL &&
+      InterlockedDecrement(&Descriptor->References) == 0) {
+    ExFreePool(Descriptor);
+  }
+}
+
+// Answers the query from the descriptor user mode attached to a previous
+// reply for the same security information. Returns FALSE if there is none
+// still valid.
+static BOOLEAN DokanQueryCachedSecurity(__in PDokanFCB Fcb, __in PIRP Irp,
+                                        __in SECURITY_INFORMATION SecurityInfo,
+                                        __in ULONG BufferLength,
+                                        __out PNTSTATUS Status,
+                                        __out PULONG Information) {
+  PDOKAN_CACHED_SECURITY_DESCRIPTOR descriptor = NULL;
+  PVOID buffer;
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&Fcb->AttributesLock, &oldIrql);
+  DokanApplyNotifyGeneration(Fcb);
+  if (Fcb->SecurityDescriptor != NULL &&
+      Fcb->SecurityDescriptorInformation == SecurityInfo &&
+      Fcb->SecurityDescriptorGeneration == Fcb->AttributesGeneration &&
+      KeQueryInterruptTime() < Fcb->SecurityDescriptorExpiry) {
+    descriptor = Fcb->SecurityDescriptor;
+    InterlockedIncrement(&descriptor->References);
+  }
+  KeReleaseSpinLock(&Fcb->AttributesLock, oldIrql);
+
+  if (descriptor == NULL) {
+    return FALSE;
+  }
+
+  *Information = descriptor->Length;
+  if (BufferLength < descriptor->Length) {
+    *Status = STATUS_BUFFER_OVERFLOW;
+  } else {
+    // The caller locked the buffer in an MDL, which probed it
+    buffer = Irp->MdlAddress != NULL
+                 ? MmGetSystemAddressForMdlNormalSafe(Irp->MdlAddress)
+                 : NULL;
+    if (buffer == NULL) {
+      *Status = STATUS_INSUFFICIENT_RESOURCES;
+      *Information = 0;
+    } else {
+      RtlCopyMemory(buffer, descriptor->Data, descriptor->Length);
+      *Status = STATUS_SUCCESS;
+    }
+  }
+
+  DokanReleaseCachedSecurityDescriptor(descriptor);
+  return TRUE;
+}
+
+// Keeps the descriptor attached to the reply on the FCB, unless the file may
+// have changed since the query was sent
+static VOID DokanCacheSecurityDescriptor(__in PIRP_ENTRY IrpEntry,
+                                         __in PEVENT_INFORMATION EventInfo,
+                                         __in ULONG EventLength) {
+  PDOKAN_CACHED_SECURITY_DESCRIPTOR descriptor;
+  PDOKAN_CACHED_SECURITY_DESCRIPTOR old = NULL;
+  SECURITY_INFORMATION securityInfo;
+  PDokanCCB ccb;
+  PDokanFCB fcb;
+  ULONG bufferEnd;
+  KIRQL oldIrql;
+
+  if (!(EventInfo->Flags & DOKAN_EVENT_INFO_SECURITY_DESCRIPTOR) ||
+      (EventInfo->Status != STATUS_SUCCESS &&
+       EventInfo->Status != STATUS_BUFFER_OVERFLOW) ||
+      EventInfo->BufferLength == 0 || IrpEntry->FileObject == NULL) {
+    return;
+  }
+  ccb = IrpEntry->FileObject->FsContext2;
+  if (ccb == NULL || GetIdentifierType(ccb) != CCB || ccb->Fcb == NULL) {
+    return;
+  }
+  fcb = ccb->Fcb;
+
+  bufferEnd = FIELD_OFFSET(EVENT_INFORMATION, Buffer) + EventInfo->BufferLength;
+  securityInfo = IrpEntry->IrpSp->Parameters.QuerySecurity.SecurityInformation;
+  if (bufferEnd < EventInfo->BufferLength || EventLength < bufferEnd ||
+      !RtlValidRelativeSecurityDescriptor(EventInfo->Buffer,
+                                          EventInfo->BufferLength,
+                                          securityInfo)) {
+    DDbgPrint("  Reply too short for its security descriptor\n");
+    return;
+  }
+
+  descriptor = ExAllocatePool(
+      FIELD_OFFSET(DOKAN_CACHED_SECURITY_DESCRIPTOR, Data) +
+      EventInfo->BufferLength);
+  if (descriptor == NULL) {
+    return;
+  }
+  descriptor->References = 1;
+  descriptor->Length = EventInfo->BufferLength;
+  RtlCopyMemory(descriptor->Data, EventInfo->Buffer, EventInfo->BufferLength);
+
+  KeAcquireSpinLock(&fcb->AttributesLock, &oldIrql);
+  DokanApplyNotifyGeneration(fcb);
+  if (fcb->AttributesGeneration == IrpEntry->AttributesGeneration) {
+    old = fcb->SecurityDescriptor;
+    fcb->SecurityDescriptor = descriptor;
+    fcb->SecurityDescriptorInformation = securityInfo;
+    fcb->SecurityDescriptorGeneration = fcb->AttributesGeneration;
+    fcb->SecurityDescriptorExpiry =
+        KeQueryInterruptTime() +
+        (ULONGLONG)DOKAN_SECURITY_DESCRIPTOR_VALIDITY * 10000;
+    descriptor = NULL;
+  }
+  KeReleaseSpinLock(&fcb->AttributesLock, oldIrql);
+
+  DokanReleaseCachedSecurityDescriptor(old);
+  DokanReleaseCachedSecurityDescriptor(descriptor);
+}
+
 NTSTATUS
 DokanDispatchQuerySecurity(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   PIO_STACK_LOCATION irpSp;
@@ -93,27 +212,36 @@ DokanDispatchQuerySecurity(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     }
 
     DokanFCBLockRO(fcb);
-    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
-    eventContext = AllocateEventContext(dcb, Irp, eventLength, ccb);
-
-    if (eventContext == NULL) {
-      status = STATUS_INSUFFICIENT_RESOURCES;
-      __leave;
-    }
-
     if (Irp->UserBuffer != NULL && bufferLength > 0) {
       // make a MDL for UserBuffer that can be used later on another thread
-      // context
+      // context, or now to copy a cached descriptor
       if (Irp->MdlAddress == NULL) {
         status = DokanAllocateMdl(Irp, bufferLength);
         if (!NT_SUCCESS(status)) {
-          DokanFreeEventContext(eventContext);
           __leave;
         }
         flags = DOKAN_MDL_ALLOCATED;
       }
     }
 
+    if (DokanQueryCachedSecurity(fcb, Irp, *securityInfo, bufferLength,
+                                 &status, &info)) {
+      DDbgPrint("  Answered from the cached security descriptor\n");
+      if (flags & DOKAN_MDL_ALLOCATED)
+        DokanFreeMdl(Irp);
+      __leave;
+    }
+
+    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
+    eventContext = AllocateEventContext(dcb, Irp, eventLength, ccb);
+
+    if (eventContext == NULL) {
+      if (flags & DOKAN_MDL_ALLOCATED)
+        DokanFreeMdl(Irp);
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+
     eventContext->Context = ccb->UserContext;
     eventContext->Operation.Security.SecurityInformation = *securityInfo;
     eventContext->Operation.Security.BufferLength = bufferLength;
@@ -137,7 +265,8 @@ DokanDispatchQuerySecurity(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
 }
 
 VOID DokanCompleteQuerySecurity(__in PIRP_ENTRY IrpEntry,
-                                __in PEVENT_INFORMATION EventInfo) {
+                                __in PEVENT_INFORMATION EventInfo,
+                                __in ULONG EventLength) {
   PIRP irp;
   PIO_STACK_LOCATION irpSp;
   NTSTATUS status;
@@ -158,6 +287,8 @@ VOID DokanCompleteQuerySecurity(__in PIRP_ENTRY IrpEntry,
 
   bufferLength = irpSp->Parameters.QuerySecurity.Length;
 
+  DokanCacheSecurityDescriptor(IrpEntry, EventInfo, EventLength);
+
   if (EventInfo->Status == STATUS_SUCCESS &&
       EventInfo->BufferLength <= bufferLength && buffer != NULL) {
     if (!RtlValidRelativeSecurityDescriptor(
@@ -120,9 +120,9 @@ VOID DokanCheckKeepAlive(__in PDokanDCB Dcb) {
 NTSTATUS
 ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
   KIRQL oldIrql;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
+  PLIST_ENTRY thisEntry, listHead;
   PIRP_ENTRY irpEntry;
-  LARGE_INTEGER tickCount;
+  LIST_ENTRY expiredList;
   LIST_ENTRY completeList;
   PIRP irp;
   BOOLEAN shouldUnmount = FALSE;
@@ -142,29 +142,25 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
     return STATUS_SUCCESS;
   }
 
-  KeQueryTickCount(&tickCount);
-
-  // search timeout IRP through pending IRP list
-  listHead = &Dcb->PendingIrp.ListHead;
-
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
-
-    nextEntry = thisEntry->Flink;
-
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-    // If an async operation (like an oplock break or CancelIoEx call from user
-    // mode) has set the AsyncStatus to a failure status, then we clean up that
-    // IRP as if it had timed out but use the status. The normal way an IRP gets
-    // timed out is by its TickCount being too long ago. Continuing here means
-    // the IRP is not eligible for cleanup in either way.
-    if (irpEntry->AsyncStatus == STATUS_SUCCESS &&
-        tickCount.QuadPart < irpEntry->TickCount.QuadPart) {
-      continue;
+  // Only the IRPs whose deadline is reached are visited. If an async operation
+  // (like an oplock break or CancelIoEx call from user mode) has set the
+  // AsyncStatus to a failure status, the IRP is also released here as if it
+  // had timed out but with that status.
+  DokanTimerWheelCollect(&Dcb->TimerWheel, DokanTimerWheelTickCount(),
+                         &expiredList);
+
+  while (!IsListEmpty(&expiredList)) {
+    thisEntry = expiredList.Flink;
+    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, Timer.TimeoutLink);
+    DokanTimerWheelRemove(&irpEntry->Timer);
+
+    // A completion that lost the race with the cancel routine already took
+    // the entry off the list and counted it
+    if (!IsListEmpty(&irpEntry->ListEntry)) {
+      DokanIrpListRemoved(&Dcb->PendingIrp);
     }
-
-    RemoveEntryList(thisEntry);
+    RemoveEntryList(&irpEntry->ListEntry);
+    InitializeListHead(&irpEntry->ListEntry);
 
     DDbgPrint(" timeout Irp #%X\n", irpEntry->SerialNumber);
 
@@ -192,6 +188,12 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
     // Prevent possible future runs of the cancel routine from doing anything.
     irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
 
+    if (irpEntry->AsyncStatus == STATUS_CANCELLED) {
+      InterlockedIncrement64((LONG64 *)&Dcb->Metrics.CancelCount);
+    } else if (irpEntry->AsyncStatus == STATUS_SUCCESS) {
+      InterlockedIncrement64((LONG64 *)&Dcb->Metrics.TimeoutCount);
+    }
+
     InsertTailList(&completeList, &irpEntry->ListEntry);
   }
 
@@ -247,8 +249,8 @@ NTSTATUS
 DokanResetPendingIrpTimeout(__in PDEVICE_OBJECT DeviceObject,
                             _Inout_ PIRP Irp) {
   KIRQL oldIrql;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
-  PIRP_ENTRY irpEntry;
+  PDOKAN_TIMER_WHEEL_ENTRY timerEntry;
+  PIRP_ENTRY irpEntry = NULL;
   PDokanVCB vcb;
   PEVENT_INFORMATION eventInfo;
   ULONG timeout; // in milisecond
@@ -270,22 +272,16 @@ DokanResetPendingIrpTimeout(__in PDEVICE_OBJECT DeviceObject,
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&vcb->Dcb->PendingIrp.ListLock, &oldIrql);
 
-  // search corresponding IRP through pending IRP list
-  listHead = &vcb->Dcb->PendingIrp.ListHead;
-
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
-
-    nextEntry = thisEntry->Flink;
-
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-    if (irpEntry->SerialNumber != eventInfo->SerialNumber) {
-      continue;
-    }
-
+  timerEntry =
+      DokanTimerWheelFind(&vcb->Dcb->TimerWheel, eventInfo->SerialNumber);
+  if (timerEntry != NULL) {
+    irpEntry = CONTAINING_RECORD(timerEntry, IRP_ENTRY, Timer);
+  }
+  // A canceled IRP keeps its place in the expired list
+  if (irpEntry != NULL && irpEntry->AsyncStatus == STATUS_SUCCESS) {
     DokanUpdateTimeout(&irpEntry->TickCount, timeout);
-    break;
+    DokanTimerWheelReschedule(&vcb->Dcb->TimerWheel, &irpEntry->Timer,
+                              DokanIrpEntryDeadline(irpEntry));
   }
   KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
   DDbgPrint("<== ResetPendingIrpTimeout\n");
@@ -298,7 +294,8 @@ VOID DokanTimeoutThread(PVOID pDcb)
 
 Routine Description:
 
-        checks wheter pending IRP is timeout or not each DOKAN_CHECK_INTERVAL
+        checks wheter pending IRP is timeout or not each
+        DOKAN_TIMEOUT_CHECK_INTERVAL and the keepalive each DOKAN_CHECK_INTERVAL
 
 --*/
 {
@@ -309,6 +306,7 @@ Routine Description:
   BOOLEAN waitObj = TRUE;
   LARGE_INTEGER LastTime = {0};
   LARGE_INTEGER CurrentTime = {0};
+  LARGE_INTEGER LastKeepAliveTime = {0};
   PDokanVCB vcb;
   PDokanDCB Dcb = pDcb;
   DOKAN_INIT_LOGGER(logger, Dcb->DeviceObject->DriverObject, 0);
@@ -323,9 +321,12 @@ Routine Description:
 
   vcb = Dcb->Vcb;
 
-  KeSetTimerEx(&timer, timeout, DOKAN_CHECK_INTERVAL, NULL);
+  // Checking timeouts only visits expired IRPs, so it can run more often than
+  // the keepalive check
+  KeSetTimerEx(&timer, timeout, DOKAN_TIMEOUT_CHECK_INTERVAL, NULL);
 
   KeQuerySystemTime(&LastTime);
+  LastKeepAliveTime = LastTime;
 
   while (waitObj) {
     status = KeWaitForMultipleObjects(3, pollevents, WaitAny, Executive,
@@ -338,18 +339,23 @@ Routine Description:
     } else {
       KeClearEvent(&Dcb->ForceTimeoutEvent);
       // in this case the timer was executed and we are checking if the timer
-      // occurred regulary using the period DOKAN_CHECK_INTERVAL. If not, this
-      // means the system was in sleep mode. If in this case the timer is
-      // faster awaken than the incoming IOCTL_KEEPALIVE
+      // occurred regulary using the period DOKAN_TIMEOUT_CHECK_INTERVAL. If
+      // not, this means the system was in sleep mode. If in this case the
+      // timer is faster awaken than the incoming IOCTL_KEEPALIVE
       // the MountPoint would be removed by mistake (DokanCheckKeepAlive).
       KeQuerySystemTime(&CurrentTime);
       if ((CurrentTime.QuadPart - LastTime.QuadPart) >
-          ((DOKAN_CHECK_INTERVAL + 2000) * 10000)) {
+          ((DOKAN_TIMEOUT_CHECK_INTERVAL + 2000) * 10000)) {
         DokanLogInfo(&logger, L"Wake from sleep detected.");
+        LastKeepAliveTime = CurrentTime;
       } else {
         ReleaseTimeoutPendingIrp(Dcb);
-        if (!vcb->IsKeepaliveActive)
-          DokanCheckKeepAlive(Dcb); //Remove for Dokan 2.x.x
+        if ((CurrentTime.QuadPart - LastKeepAliveTime.QuadPart) >=
+            (DOKAN_CHECK_INTERVAL * 10000)) {
+          if (!vcb->IsKeepaliveActive)
+            DokanCheckKeepAlive(Dcb); //Remove for Dokan 2.x.x
+          LastKeepAliveTime = CurrentTime;
+        }
       }
       KeQuerySystemTime(&LastTime);
     }
@@ -0,0 +1,313 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "timerwheel.h"
+
+#ifdef _KERNEL_MODE
+// The wheel is used under the spin lock of its owner
+#define TimerWheelAssertLocked() ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL)
+
+uint64_t DokanTimerWheelTickCount(void) {
+  LARGE_INTEGER tickCount;
+
+  KeQueryTickCount(&tickCount);
+  return (uint64_t)tickCount.QuadPart;
+}
+
+// In 100 nanoseconds
+#define TimerWheelTickLength() KeQueryTimeIncrement()
+
+#define TimerWheelAllocate(Size)                                               \
+  ExAllocatePoolWithTag(NonPagedPool, (Size), (ULONG)'AKOD')
+#define TimerWheelFree(Buffer) ExFreePool(Buffer)
+#else
+#include <stddef.h>
+#include <stdlib.h>
+
+// Callers serialize their uses of a wheel
+#define TimerWheelAssertLocked()
+
+#define CONTAINING_RECORD(Address, Type, Field)                                \
+  ((Type *)((char *)(Address)-offsetof(Type, Field)))
+
+static void InitializeListHead(PDOKAN_TIMER_LINK ListHead) {
+  ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static int IsListEmpty(PDOKAN_TIMER_LINK ListHead) {
+  return ListHead->Flink == ListHead;
+}
+
+static void RemoveEntryList(PDOKAN_TIMER_LINK Entry) {
+  Entry->Blink->Flink = Entry->Flink;
+  Entry->Flink->Blink = Entry->Blink;
+}
+
+static void InsertTailList(PDOKAN_TIMER_LINK ListHead,
+                           PDOKAN_TIMER_LINK Entry) {
+  Entry->Flink = ListHead;
+  Entry->Blink = ListHead->Blink;
+  ListHead->Blink->Flink = Entry;
+  ListHead->Blink = Entry;
+}
+
+static PDOKAN_TIMER_LINK RemoveHeadList(PDOKAN_TIMER_LINK ListHead) {
+  PDOKAN_TIMER_LINK entry = ListHead->Flink;
+
+  RemoveEntryList(entry);
+  return entry;
+}
+
+#ifdef _WIN32
+#include <windows.h>
+
+uint64_t DokanTimerWheelTickCount(void) { return GetTickCount64(); }
+#else
+#include <time.h>
+
+uint64_t DokanTimerWheelTickCount(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+#endif
+
+// One millisecond
+#define TimerWheelTickLength() 10000
+
+#define TimerWheelAllocate(Size) malloc(Size)
+#define TimerWheelFree(Buffer) free(Buffer)
+#endif
+
+static void InitSerialBuckets(PDOKAN_TIMER_LINK Buckets, uint32_t Count) {
+  uint32_t i;
+
+  for (i = 0; i < Count; ++i) {
+    InitializeListHead(&Buckets[i]);
+  }
+}
+
+static PDOKAN_TIMER_LINK SerialBucket(PDOKAN_TIMER_WHEEL Wheel,
+                                      uint32_t SerialNumber) {
+  // Serial numbers are sequential, their low bits spread them evenly
+  return &Wheel->SerialBuckets[SerialNumber & (Wheel->SerialBucketCount - 1)];
+}
+
+static void ResetSerialBuckets(PDOKAN_TIMER_WHEEL Wheel) {
+  if (Wheel->SerialBuckets != Wheel->InitialSerialBuckets) {
+    TimerWheelFree(Wheel->SerialBuckets);
+  }
+  Wheel->SerialBuckets = Wheel->InitialSerialBuckets;
+  Wheel->SerialBucketCount = DOKAN_TIMER_WHEEL_SERIAL_BUCKETS;
+  InitSerialBuckets(Wheel->SerialBuckets, Wheel->SerialBucketCount);
+}
+
+static void GrowSerialBuckets(PDOKAN_TIMER_WHEEL Wheel) {
+  uint32_t oldCount = Wheel->SerialBucketCount;
+  PDOKAN_TIMER_LINK oldBuckets = Wheel->SerialBuckets;
+  PDOKAN_TIMER_LINK buckets;
+  PDOKAN_TIMER_WHEEL_ENTRY entry;
+  uint32_t i;
+
+  buckets = TimerWheelAllocate(sizeof(DOKAN_TIMER_LINK) * oldCount * 2);
+  if (buckets == NULL) {
+    return;
+  }
+  InitSerialBuckets(buckets, oldCount * 2);
+  Wheel->SerialBuckets = buckets;
+  Wheel->SerialBucketCount = oldCount * 2;
+  for (i = 0; i < oldCount; ++i) {
+    while (!IsListEmpty(&oldBuckets[i])) {
+      entry = CONTAINING_RECORD(RemoveHeadList(&oldBuckets[i]),
+                                DOKAN_TIMER_WHEEL_ENTRY, SerialLink);
+      InsertTailList(SerialBucket(Wheel, entry->SerialNumber),
+                     &entry->SerialLink);
+    }
+  }
+  if (oldBuckets != Wheel->InitialSerialBuckets) {
+    TimerWheelFree(oldBuckets);
+  }
+}
+
+void DokanTimerWheelInit(PDOKAN_TIMER_WHEEL Wheel) {
+  uint32_t i;
+
+  for (i = 0; i < DOKAN_TIMER_WHEEL_SLOTS; ++i) {
+    InitializeListHead(&Wheel->Slots[i]);
+  }
+  InitializeListHead(&Wheel->Expired);
+  Wheel->SerialBuckets = Wheel->InitialSerialBuckets;
+  Wheel->SerialBucketCount = DOKAN_TIMER_WHEEL_SERIAL_BUCKETS;
+  InitSerialBuckets(Wheel->SerialBuckets, Wheel->SerialBucketCount);
+  Wheel->Count = 0;
+
+  Wheel->SlotTicks = (uint64_t)DOKAN_TIMER_WHEEL_SLOT_DURATION * 1000 * 10 /
+                     TimerWheelTickLength();
+  if (Wheel->SlotTicks == 0) {
+    Wheel->SlotTicks = 1;
+  }
+  Wheel->CurrentSlot = DokanTimerWheelTickCount() / Wheel->SlotTicks;
+}
+
+// Entries left in the wheel are not touched, their buckets are freed
+void DokanTimerWheelUninit(PDOKAN_TIMER_WHEEL Wheel) {
+  if (Wheel->SerialBuckets != Wheel->InitialSerialBuckets) {
+    TimerWheelFree(Wheel->SerialBuckets);
+    Wheel->SerialBuckets = Wheel->InitialSerialBuckets;
+    Wheel->SerialBucketCount = DOKAN_TIMER_WHEEL_SERIAL_BUCKETS;
+  }
+}
+
+void DokanTimerWheelEntryInit(PDOKAN_TIMER_WHEEL_ENTRY Entry) {
+  Entry->Wheel = NULL;
+  InitializeListHead(&Entry->TimeoutLink);
+  InitializeListHead(&Entry->SerialLink);
+}
+
+static void ScheduleEntry(PDOKAN_TIMER_WHEEL Wheel,
+                          PDOKAN_TIMER_WHEEL_ENTRY Entry) {
+  uint64_t slot;
+
+  if (Entry->Deadline == 0) {
+    InsertTailList(&Wheel->Expired, &Entry->TimeoutLink);
+    return;
+  }
+
+  slot = Entry->Deadline / Wheel->SlotTicks;
+  if (slot < Wheel->CurrentSlot) {
+    slot = Wheel->CurrentSlot;
+  }
+  InsertTailList(&Wheel->Slots[slot % DOKAN_TIMER_WHEEL_SLOTS],
+                 &Entry->TimeoutLink);
+}
+
+void DokanTimerWheelInsert(PDOKAN_TIMER_WHEEL Wheel,
+                           PDOKAN_TIMER_WHEEL_ENTRY Entry,
+                           uint32_t SerialNumber, uint64_t Deadline) {
+  TimerWheelAssertLocked();
+  if (Wheel->Count >=
+          Wheel->SerialBucketCount * DOKAN_TIMER_WHEEL_SERIAL_LOAD &&
+      Wheel->SerialBucketCount < DOKAN_TIMER_WHEEL_SERIAL_BUCKETS_MAX) {
+    GrowSerialBuckets(Wheel);
+  }
+  Entry->Wheel = Wheel;
+  Entry->SerialNumber = SerialNumber;
+  Entry->Deadline = Deadline;
+  InsertTailList(SerialBucket(Wheel, SerialNumber), &Entry->SerialLink);
+  ++Wheel->Count;
+  ScheduleEntry(Wheel, Entry);
+}
+
+// Unlinked entries point to themselves, removing them again changes nothing
+void DokanTimerWheelRemove(PDOKAN_TIMER_WHEEL_ENTRY Entry) {
+  PDOKAN_TIMER_WHEEL wheel = Entry->Wheel;
+
+  TimerWheelAssertLocked();
+  RemoveEntryList(&Entry->TimeoutLink);
+  InitializeListHead(&Entry->TimeoutLink);
+  RemoveEntryList(&Entry->SerialLink);
+  InitializeListHead(&Entry->SerialLink);
+  if (wheel == NULL) {
+    return;
+  }
+  Entry->Wheel = NULL;
+  // A grown table is only given back once the burst is over, so that it does
+  // not shrink and grow again around the threshold
+  if (--wheel->Count == 0 &&
+      wheel->SerialBuckets != wheel->InitialSerialBuckets) {
+    ResetSerialBuckets(wheel);
+  }
+}
+
+void DokanTimerWheelReschedule(PDOKAN_TIMER_WHEEL Wheel,
+                               PDOKAN_TIMER_WHEEL_ENTRY Entry,
+                               uint64_t Deadline) {
+  TimerWheelAssertLocked();
+  RemoveEntryList(&Entry->TimeoutLink);
+  Entry->Deadline = Deadline;
+  ScheduleEntry(Wheel, Entry);
+}
+
+void DokanTimerWheelExpireNow(PDOKAN_TIMER_WHEEL Wheel,
+                              PDOKAN_TIMER_WHEEL_ENTRY Entry) {
+  TimerWheelAssertLocked();
+  RemoveEntryList(&Entry->TimeoutLink);
+  Entry->Deadline = 0;
+  InsertTailList(&Wheel->Expired, &Entry->TimeoutLink);
+}
+
+static void CollectSlot(PDOKAN_TIMER_LINK Slot, uint64_t TickCount,
+                        PDOKAN_TIMER_LINK Expired) {
+  PDOKAN_TIMER_LINK thisLink, nextLink;
+  PDOKAN_TIMER_WHEEL_ENTRY entry;
+
+  for (thisLink = Slot->Flink; thisLink != Slot; thisLink = nextLink) {
+    nextLink = thisLink->Flink;
+    entry = CONTAINING_RECORD(thisLink, DOKAN_TIMER_WHEEL_ENTRY, TimeoutLink);
+    if (entry->Deadline <= TickCount) {
+      RemoveEntryList(thisLink);
+      InsertTailList(Expired, thisLink);
+    }
+  }
+}
+
+void DokanTimerWheelCollect(PDOKAN_TIMER_WHEEL Wheel, uint64_t TickCount,
+                            PDOKAN_TIMER_LINK Expired) {
+  uint64_t nowSlot = TickCount / Wheel->SlotTicks;
+  uint64_t slot = Wheel->CurrentSlot;
+
+  TimerWheelAssertLocked();
+  InitializeListHead(Expired);
+  while (!IsListEmpty(&Wheel->Expired)) {
+    InsertTailList(Expired, RemoveHeadList(&Wheel->Expired));
+  }
+
+  // After a long pause every slot has elapsed, but each is visited once
+  if (nowSlot >= slot + DOKAN_TIMER_WHEEL_SLOTS) {
+    slot = nowSlot - DOKAN_TIMER_WHEEL_SLOTS + 1;
+  }
+  // The current slot is only partly elapsed and is visited again next time
+  for (; slot <= nowSlot; ++slot) {
+    CollectSlot(&Wheel->Slots[slot % DOKAN_TIMER_WHEEL_SLOTS], TickCount,
+                Expired);
+  }
+  if (nowSlot > Wheel->CurrentSlot) {
+    Wheel->CurrentSlot = nowSlot;
+  }
+}
+
+PDOKAN_TIMER_WHEEL_ENTRY DokanTimerWheelFind(PDOKAN_TIMER_WHEEL Wheel,
+                                             uint32_t SerialNumber) {
+  PDOKAN_TIMER_LINK listHead = SerialBucket(Wheel, SerialNumber);
+  PDOKAN_TIMER_LINK thisLink;
+  PDOKAN_TIMER_WHEEL_ENTRY entry;
+
+  TimerWheelAssertLocked();
+  for (thisLink = listHead->Flink; thisLink != listHead;
+       thisLink = thisLink->Flink) {
+    entry = CONTAINING_RECORD(thisLink, DOKAN_TIMER_WHEEL_ENTRY, SerialLink);
+    if (entry->SerialNumber == SerialNumber) {
+      return entry;
+    }
+  }
+  return NULL;
+}
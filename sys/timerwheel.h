@@ -0,0 +1,154 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2015 - 2019 Adrien J. <liryna.stark@gmail.com> and Maxime C. <maxime@islog.com>
+  Copyright (C) 2007 - 2011 Hiroki Asakawa <info@dokan-dev.net>
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_TIMERWHEEL_H_
+#define DOKAN_TIMERWHEEL_H_
+
+// Timeout wheel of the pending IRPs of a volume.
+//
+// The wheel replaces a scan of the whole PendingIrp list on every timeout
+// check. Each entry is linked in the slot of its deadline, so a check only
+// visits the slots elapsed since the previous one and the entries they hold.
+// An entry whose deadline is more than one turn away shares its slot with
+// earlier ones and is simply left there until its turn comes. Entries are also
+// indexed by serial number, for the timeout resets of user mode. The serial
+// table doubles as entries are added so that a lookup stays constant time with
+// thousands of pending IRPs, and goes back to its initial buckets once the
+// wheel is empty.
+//
+// Deadlines are tick counts. The wheel has no lock of its own, its functions
+// are called with the lock of its owner held, the PendingIrp ListLock in the
+// driver.
+//
+// This file and timerwheel.c only depend on the kernel or on the C runtime,
+// samples/timerwheel_test checks them on any platform.
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#endif
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One slot per second, spanning more than DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX
+// so a slot only holds entries of one round in the common case.
+#define DOKAN_TIMER_WHEEL_SLOTS 512
+#define DOKAN_TIMER_WHEEL_SLOT_DURATION (1000 * 1) // in millisecond
+// Serial buckets of a new wheel, and most buckets it grows to. The table
+// doubles when there are more than DOKAN_TIMER_WHEEL_SERIAL_LOAD entries per
+// bucket.
+#define DOKAN_TIMER_WHEEL_SERIAL_BUCKETS 64
+#define DOKAN_TIMER_WHEEL_SERIAL_BUCKETS_MAX (16 * 1024)
+#define DOKAN_TIMER_WHEEL_SERIAL_LOAD 2
+
+#ifdef _KERNEL_MODE
+typedef LIST_ENTRY DOKAN_TIMER_LINK, *PDOKAN_TIMER_LINK;
+#else
+// Same layout and use as LIST_ENTRY
+typedef struct _DOKAN_TIMER_LINK {
+  struct _DOKAN_TIMER_LINK *Flink;
+  struct _DOKAN_TIMER_LINK *Blink;
+} DOKAN_TIMER_LINK, *PDOKAN_TIMER_LINK;
+#endif
+
+struct _DOKAN_TIMER_WHEEL;
+
+// Part of a pending IRP entry. Its links point to themselves while it is not
+// in a wheel.
+typedef struct _DOKAN_TIMER_WHEEL_ENTRY {
+  // Wheel of the entry, NULL while it is in none
+  struct _DOKAN_TIMER_WHEEL *Wheel;
+  // In a slot, or in Expired of the wheel or of a collect
+  DOKAN_TIMER_LINK TimeoutLink;
+  // In a serial bucket
+  DOKAN_TIMER_LINK SerialLink;
+  // Tick count of the deadline, 0 to expire at the next collect
+  uint64_t Deadline;
+  uint32_t SerialNumber;
+} DOKAN_TIMER_WHEEL_ENTRY, *PDOKAN_TIMER_WHEEL_ENTRY;
+
+typedef struct _DOKAN_TIMER_WHEEL {
+  // Entries linked by TimeoutLink, slot is deadline / SlotTicks
+  DOKAN_TIMER_LINK Slots[DOKAN_TIMER_WHEEL_SLOTS];
+  // Entries to release at the next collect
+  DOKAN_TIMER_LINK Expired;
+  // Entries linked by SerialLink, bucket is the serial number modulo
+  // SerialBucketCount, a power of two. Points to InitialSerialBuckets until
+  // the table grows, so a wheel must not be copied.
+  PDOKAN_TIMER_LINK SerialBuckets;
+  uint32_t SerialBucketCount;
+  // Number of entries in the wheel
+  uint32_t Count;
+  DOKAN_TIMER_LINK InitialSerialBuckets[DOKAN_TIMER_WHEEL_SERIAL_BUCKETS];
+  // Number of tick counts per slot
+  uint64_t SlotTicks;
+  // First slot that has not been fully checked
+  uint64_t CurrentSlot;
+} DOKAN_TIMER_WHEEL, *PDOKAN_TIMER_WHEEL;
+
+// Returns the current tick count of the clock of the wheels.
+uint64_t DokanTimerWheelTickCount(void);
+
+// Starts the wheel at the current tick count.
+void DokanTimerWheelInit(PDOKAN_TIMER_WHEEL Wheel);
+
+// Frees the serial table of a wheel that is not used anymore.
+void DokanTimerWheelUninit(PDOKAN_TIMER_WHEEL Wheel);
+
+// Initializes the links of an entry that is not in a wheel.
+void DokanTimerWheelEntryInit(PDOKAN_TIMER_WHEEL_ENTRY Entry);
+
+// Grows the serial table when it gets loaded, keeps the current one if there is
+// not enough memory for it.
+void DokanTimerWheelInsert(PDOKAN_TIMER_WHEEL Wheel,
+                           PDOKAN_TIMER_WHEEL_ENTRY Entry,
+                           uint32_t SerialNumber, uint64_t Deadline);
+
+// Takes the entry out of its wheel. Does nothing for an entry that is not in
+// a wheel, so it can follow a collect or another remove.
+void DokanTimerWheelRemove(PDOKAN_TIMER_WHEEL_ENTRY Entry);
+
+// Moves an entry of the wheel to the slot of its new deadline.
+void DokanTimerWheelReschedule(PDOKAN_TIMER_WHEEL Wheel,
+                               PDOKAN_TIMER_WHEEL_ENTRY Entry,
+                               uint64_t Deadline);
+
+// Expires an entry of the wheel at the next collect.
+void DokanTimerWheelExpireNow(PDOKAN_TIMER_WHEEL Wheel,
+                              PDOKAN_TIMER_WHEEL_ENTRY Entry);
+
+// Moves the entries whose deadline is reached at TickCount to Expired, linked
+// by their TimeoutLink. The caller takes each of them out of Expired and of the
+// wheel with DokanTimerWheelRemove.
+void DokanTimerWheelCollect(PDOKAN_TIMER_WHEEL Wheel, uint64_t TickCount,
+                            PDOKAN_TIMER_LINK Expired);
+
+// Returns NULL if no entry of the wheel has the serial number.
+PDOKAN_TIMER_WHEEL_ENTRY DokanTimerWheelFind(PDOKAN_TIMER_WHEEL Wheel,
+                                             uint32_t SerialNumber);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOKAN_TIMERWHEEL_H_
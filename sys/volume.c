@@ -60,6 +60,14 @@ DokanDispatchQueryVolumeInformation(__in PDEVICE_OBJECT DeviceObject,
 
     DDbgPrint("  FileName: %wZ\n", &fileObject->FileName);
 
+    // Answers pushed by user mode may still be valid
+    if (DokanFillCachedVolumeInformation(
+            vcb, irpSp->Parameters.QueryVolume.FsInformationClass, buffer,
+            irpSp->Parameters.QueryVolume.Length, &info)) {
+      status = STATUS_SUCCESS;
+      __leave;
+    }
+
     switch (irpSp->Parameters.QueryVolume.FsInformationClass) {
     case FileFsVolumeInformation:
       DDbgPrint("  FileFsVolumeInformation\n");
@@ -269,6 +277,177 @@ DokanDispatchQueryVolumeInformation(__in PDEVICE_OBJECT DeviceObject,
   return status;
 }
 
+NTSTATUS
+DokanSetVolumeInformationCache(__in PDEVICE_OBJECT DeviceObject,
+                               _Inout_ PIRP Irp) {
+  PDokanVCB vcb;
+  PIO_STACK_LOCATION irpSp;
+  PEVENT_VOLUME_INFORMATION volumeInfo;
+  KIRQL oldIrql;
+
+  DDbgPrint("==> DokanSetVolumeInformationCache\n");
+
+  vcb = DeviceObject->DeviceExtension;
+  if (GetIdentifierType(vcb) != VCB) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  irpSp = IoGetCurrentIrpStackLocation(Irp);
+  if (irpSp->Parameters.DeviceIoControl.InputBufferLength <
+      sizeof(EVENT_VOLUME_INFORMATION)) {
+    DDbgPrint("  input buffer is too small\n");
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+
+  volumeInfo = (PEVENT_VOLUME_INFORMATION)Irp->AssociatedIrp.SystemBuffer;
+  ASSERT(volumeInfo != NULL);
+
+  if (volumeInfo->Validity != 0 &&
+      (volumeInfo->VolumeNameLength > sizeof(volumeInfo->VolumeName) ||
+       volumeInfo->FileSystemNameLength >
+           sizeof(volumeInfo->FileSystemName) ||
+       volumeInfo->VolumeNameLength % sizeof(WCHAR) != 0 ||
+       volumeInfo->FileSystemNameLength % sizeof(WCHAR) != 0 ||
+       volumeInfo->AllocationUnitSize == 0 || volumeInfo->SectorSize == 0)) {
+    DDbgPrint("  invalid volume information\n");
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  KeAcquireSpinLock(&vcb->VolumeInformationLock, &oldIrql);
+  if (volumeInfo->Validity == 0) {
+    vcb->VolumeInformationExpiry = 0;
+  } else {
+    vcb->VolumeInformation = *volumeInfo;
+    vcb->VolumeInformationExpiry =
+        KeQueryInterruptTime() + (ULONGLONG)volumeInfo->Validity * 10000;
+  }
+  KeReleaseSpinLock(&vcb->VolumeInformationLock, oldIrql);
+
+  Irp->IoStatus.Information = 0;
+
+  DDbgPrint("<== DokanSetVolumeInformationCache\n");
+
+  return STATUS_SUCCESS;
+}
+
+BOOLEAN
+DokanFillCachedVolumeInformation(__in PDokanVCB Vcb,
+                                 __in FS_INFORMATION_CLASS InformationClass,
+                                 __out PVOID Buffer, __in ULONG Length,
+                                 __out PULONG Information) {
+  EVENT_VOLUME_INFORMATION volumeInfo;
+  ULONG required;
+  ULONG remainingLength;
+  ULONG bytesToCopy;
+  BOOLEAN valid;
+  KIRQL oldIrql;
+
+  switch (InformationClass) {
+  case FileFsVolumeInformation:
+    required = sizeof(FILE_FS_VOLUME_INFORMATION);
+    break;
+  case FileFsSizeInformation:
+    required = sizeof(FILE_FS_SIZE_INFORMATION);
+    break;
+  case FileFsAttributeInformation:
+    required = sizeof(FILE_FS_ATTRIBUTE_INFORMATION);
+    break;
+  case FileFsFullSizeInformation:
+    required = sizeof(FILE_FS_FULL_SIZE_INFORMATION);
+    break;
+  default:
+    return FALSE;
+  }
+
+  // Short buffers get the answer of user mode
+  if (Buffer == NULL || Length < required) {
+    return FALSE;
+  }
+
+  KeAcquireSpinLock(&Vcb->VolumeInformationLock, &oldIrql);
+  valid = Vcb->VolumeInformationExpiry != 0 &&
+          KeQueryInterruptTime() < Vcb->VolumeInformationExpiry;
+  if (valid) {
+    volumeInfo = Vcb->VolumeInformation;
+  }
+  KeReleaseSpinLock(&Vcb->VolumeInformationLock, oldIrql);
+
+  if (!valid) {
+    return FALSE;
+  }
+
+  // Same layout as the answers built by the library and completed by
+  // DokanCompleteQueryVolumeInformation
+  RtlZeroMemory(Buffer, Length);
+
+  if (InformationClass == FileFsVolumeInformation) {
+    PFILE_FS_VOLUME_INFORMATION fsVolumeInfo = Buffer;
+    PWCHAR volumeLabel = volumeInfo.VolumeName;
+
+    fsVolumeInfo->VolumeSerialNumber = volumeInfo.VolumeSerialNumber;
+    remainingLength =
+        Length - FIELD_OFFSET(FILE_FS_VOLUME_INFORMATION, VolumeLabel[0]);
+    bytesToCopy = volumeInfo.VolumeNameLength;
+    if (Vcb->Dcb->VolumeLabel != NULL) {
+      volumeLabel = Vcb->Dcb->VolumeLabel;
+      bytesToCopy = (ULONG)wcslen(Vcb->Dcb->VolumeLabel) * sizeof(WCHAR);
+    }
+    if (remainingLength < bytesToCopy) {
+      bytesToCopy = remainingLength;
+    }
+    fsVolumeInfo->VolumeLabelLength = bytesToCopy;
+    RtlCopyMemory(fsVolumeInfo->VolumeLabel, volumeLabel, bytesToCopy);
+    *Information =
+        FIELD_OFFSET(FILE_FS_VOLUME_INFORMATION, VolumeLabel[0]) + bytesToCopy;
+  } else if (InformationClass == FileFsAttributeInformation) {
+    PFILE_FS_ATTRIBUTE_INFORMATION attrInfo = Buffer;
+
+    attrInfo->FileSystemAttributes = volumeInfo.FileSystemFlags;
+    if (IS_DEVICE_READ_ONLY(Vcb->DeviceObject)) {
+      attrInfo->FileSystemAttributes |= FILE_READ_ONLY_VOLUME;
+    }
+    attrInfo->MaximumComponentNameLength = volumeInfo.MaximumComponentLength;
+    remainingLength =
+        Length - FIELD_OFFSET(FILE_FS_ATTRIBUTE_INFORMATION, FileSystemName[0]);
+    bytesToCopy = volumeInfo.FileSystemNameLength;
+    if (remainingLength < bytesToCopy) {
+      bytesToCopy = remainingLength;
+    }
+    attrInfo->FileSystemNameLength = bytesToCopy;
+    RtlCopyMemory(attrInfo->FileSystemName, volumeInfo.FileSystemName,
+                  bytesToCopy);
+    *Information = FIELD_OFFSET(FILE_FS_ATTRIBUTE_INFORMATION,
+                                FileSystemName[0]) +
+                   bytesToCopy;
+  } else if (InformationClass == FileFsSizeInformation) {
+    PFILE_FS_SIZE_INFORMATION sizeInfo = Buffer;
+
+    sizeInfo->TotalAllocationUnits.QuadPart =
+        volumeInfo.TotalNumberOfBytes / volumeInfo.AllocationUnitSize;
+    sizeInfo->AvailableAllocationUnits.QuadPart =
+        volumeInfo.FreeBytesAvailable / volumeInfo.AllocationUnitSize;
+    sizeInfo->SectorsPerAllocationUnit =
+        volumeInfo.AllocationUnitSize / volumeInfo.SectorSize;
+    sizeInfo->BytesPerSector = volumeInfo.SectorSize;
+    *Information = required;
+  } else {
+    PFILE_FS_FULL_SIZE_INFORMATION fullSizeInfo = Buffer;
+
+    fullSizeInfo->TotalAllocationUnits.QuadPart =
+        volumeInfo.TotalNumberOfBytes / volumeInfo.AllocationUnitSize;
+    fullSizeInfo->ActualAvailableAllocationUnits.QuadPart =
+        volumeInfo.TotalNumberOfFreeBytes / volumeInfo.AllocationUnitSize;
+    fullSizeInfo->CallerAvailableAllocationUnits.QuadPart =
+        volumeInfo.FreeBytesAvailable / volumeInfo.AllocationUnitSize;
+    fullSizeInfo->SectorsPerAllocationUnit =
+        volumeInfo.AllocationUnitSize / volumeInfo.SectorSize;
+    fullSizeInfo->BytesPerSector = volumeInfo.SectorSize;
+    *Information = required;
+  }
+
+  return TRUE;
+}
+
 VOID DokanCompleteQueryVolumeInformation(__in PIRP_ENTRY IrpEntry,
                                          __in PEVENT_INFORMATION EventInfo,
                                          __in PDEVICE_OBJECT DeviceObject) {
@@ -29,6 +29,7 @@ DokanDispatchWrite(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
   NTSTATUS status = STATUS_INVALID_PARAMETER;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  ULONG fileNameLength;
   PDokanCCB ccb;
   PDokanFCB fcb = NULL;
   PDokanVCB vcb;
@@ -145,13 +146,14 @@ DokanDispatchWrite(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     DokanFCBLockRO(fcb);
     fcbLocked = TRUE;
 
+    fileNameLength = DokanEventFileNameLength(vcb->Dcb, fcb, ccb);
     LARGE_INTEGER safeEventLength;
     safeEventLength.QuadPart =
         sizeof(EVENT_CONTEXT) + irpSp->Parameters.Write.Length +
-                  fcb->FileName.Length;
+                  fileNameLength;
     if (safeEventLength.HighPart != 0 ||
         safeEventLength.QuadPart <
-            sizeof(EVENT_CONTEXT) + fcb->FileName.Length) {
+            sizeof(EVENT_CONTEXT) + fileNameLength) {
       DOKAN_INIT_LOGGER(logger, vcb->DeviceObject->DriverObject, IRP_MJ_WRITE);
       DokanLogError(&logger,
                     STATUS_INVALID_PARAMETER,
@@ -219,7 +221,7 @@ DokanDispatchWrite(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
     // the contents to write will be copyed to this offset
     eventContext->Operation.Write.BufferOffset =
         FIELD_OFFSET(EVENT_CONTEXT, Operation.Write.FileName[0]) +
-        fcb->FileName.Length + sizeof(WCHAR); // adds last null char
+        fileNameLength + sizeof(WCHAR); // adds last null char
 
     // copies the content to write to EventContext
     RtlCopyMemory((PCHAR)eventContext +
@@ -227,9 +229,9 @@ DokanDispatchWrite(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp) {
                   buffer, irpSp->Parameters.Write.Length);
 
     // copies file name
-    eventContext->Operation.Write.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Write.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
+    DokanCopyEventFileName(eventContext, fcb, fileNameLength,
+                           &eventContext->Operation.Write.FileNameLength,
+                           eventContext->Operation.Write.FileName);
 
     // When eventlength is less than event notification buffer,
     // returns it to user-mode using pending event.